@@ -1,29 +1,38 @@
 #include "BaseSocket.h"
 #include "EventDispatch.h"
+#if (defined __linux__)
+#include <sys/sendfile.h>
+#endif
 
+//socket按所属的reactor分别保存在各自CEventDispatch的hash_map中,
 //之所以不用map而用hash_map是因为STL的map底层是用红黑树实现的，查找时间复杂度是log(n)，
 //而hash_map底层是用hash表存储的，查询时间复杂度是O(1)。
-typedef hash_map<net_handle_t, CBaseSocket*> SocketMap;  
-SocketMap	g_socket_map;
-
 void AddBaseSocket(CBaseSocket* pSocket)
 {
-	g_socket_map.insert(make_pair((net_handle_t)pSocket->GetSocket(), pSocket));
+	pSocket->GetDispatch()->AddSocket(pSocket);
 }
 
 void RemoveBaseSocket(CBaseSocket* pSocket)
 {
-	g_socket_map.erase((net_handle_t)pSocket->GetSocket());
+	pSocket->GetDispatch()->RemoveSocket(pSocket);
 }
 
 CBaseSocket* FindBaseSocket(net_handle_t fd)
 {
-	CBaseSocket* pSocket = NULL;
-	SocketMap::iterator iter = g_socket_map.find(fd);
-	if (iter != g_socket_map.end())
+	// 绝大多数情况下socket都属于当前线程的reactor
+	CEventDispatch* pCurDispatch = CEventDispatch::Instance();
+	CBaseSocket* pSocket = pCurDispatch->FindSocket(fd);
+	if (pSocket)
+		return pSocket;
+
+	uint32_t reactor_cnt = CEventDispatch::GetReactorCount();
+	for (uint32_t i = 0; i < reactor_cnt && !pSocket; i++)
 	{
-		pSocket = iter->second;
-		pSocket->AddRef();
+		CEventDispatch* pDispatch = CEventDispatch::GetReactor(i);
+		if (pDispatch != pCurDispatch)
+		{
+			pSocket = pDispatch->FindSocket(fd);
+		}
 	}
 
 	return pSocket;
@@ -36,6 +45,7 @@ CBaseSocket::CBaseSocket()
 	//log("CBaseSocket::CBaseSocket\n");
 	m_socket = INVALID_SOCKET;
 	m_state = SOCKET_STATE_IDLE;
+	m_dispatch = NULL;
 }
 
 CBaseSocket::~CBaseSocket()
@@ -49,6 +59,8 @@ int CBaseSocket::Listen(const char* server_ip, uint16_t port, callback_t callbac
 	m_local_port = port;
 	m_callback = callback;
 	m_callback_data = callback_data;
+	if (!m_dispatch)
+		m_dispatch = CEventDispatch::Instance();
 
 	m_socket = socket(AF_INET, SOCK_STREAM, 0);
 	if (m_socket == INVALID_SOCKET)
@@ -59,6 +71,9 @@ int CBaseSocket::Listen(const char* server_ip, uint16_t port, callback_t callbac
 
 	//将绑定的地址设置成reuse
 	_SetReuseAddr(m_socket);
+	//多reactor时每个reactor各有一个侦听socket, 由内核在它们之间分配新连接
+	if (CEventDispatch::GetReactorCount() > 1)
+		_SetReusePort(m_socket);
 	//设置非阻塞socket
 	_SetNonblock(m_socket);
 
@@ -82,12 +97,12 @@ int CBaseSocket::Listen(const char* server_ip, uint16_t port, callback_t callbac
 	//将socket的状态设置成SOCKET_STATE_LISTENING，这个状态将侦听的socket与普通客户端连接的socket区别开来。
 	m_state = SOCKET_STATE_LISTENING;
 
-	log("CBaseSocket::Listen on %s:%d", server_ip, port);
+	log("CBaseSocket::Listen on %s:%d, reactor=%u", server_ip, port, m_dispatch->GetIndex());
 
-	//AddBaseSocket(this);将socket句柄和对应的CBaseSocket放到一个全局对象中管理起来。
+	//AddBaseSocket(this);将socket句柄和对应的CBaseSocket放到所属reactor的socket map中管理起来。
 	AddBaseSocket(this);
 	//目前只关注socket的读和异常事件，侦听socket可读意味着有新连接到来，异常就意味着侦听出错。对于服务器程序一般要关闭或重启服务
-	CEventDispatch::Instance()->AddEvent(m_socket, SOCKET_READ | SOCKET_EXCEP);
+	m_dispatch->AddEvent(m_socket, SOCKET_READ | SOCKET_EXCEP);
 	return NETLIB_OK;
 }
 
@@ -99,6 +114,8 @@ net_handle_t CBaseSocket::Connect(const char* server_ip, uint16_t port, callback
 	m_remote_port = port;
 	m_callback = callback;
 	m_callback_data = callback_data;
+	if (!m_dispatch)
+		m_dispatch = CEventDispatch::Instance();
 
 	m_socket = socket(AF_INET, SOCK_STREAM, 0);
 	if (m_socket == INVALID_SOCKET)
@@ -120,7 +137,7 @@ net_handle_t CBaseSocket::Connect(const char* server_ip, uint16_t port, callback
 	}
 	m_state = SOCKET_STATE_CONNECTING;
 	AddBaseSocket(this);
-	CEventDispatch::Instance()->AddEvent(m_socket, SOCKET_ALL);
+	m_dispatch->AddEvent(m_socket, SOCKET_ALL);
 	
 	return (net_handle_t)m_socket;
 }
@@ -140,7 +157,7 @@ int CBaseSocket::Send(void* buf, int len)
 		{
 #if ((defined _WIN32) || (defined __APPLE__))
 			//这个时候关注socket的可写事件
-			CEventDispatch::Instance()->AddEvent(m_socket, SOCKET_WRITE);
+			m_dispatch->AddEvent(m_socket, SOCKET_WRITE);
 #endif
 			ret = 0;
 			//log("socket send block fd=%d", m_socket);
@@ -154,6 +171,99 @@ int CBaseSocket::Send(void* buf, int len)
 	return ret;
 }
 
+int CBaseSocket::SendV(netlib_iovec_t* iov, int iov_cnt)
+{
+	if (m_state != SOCKET_STATE_CONNECTED)
+		return NETLIB_ERROR;
+
+	if (iov_cnt > NETLIB_MAX_IOV_CNT)
+		iov_cnt = NETLIB_MAX_IOV_CNT;
+
+	int ret = 0;
+#ifdef _WIN32
+	WSABUF bufs[NETLIB_MAX_IOV_CNT];
+	for (int i = 0; i < iov_cnt; i++)
+	{
+		bufs[i].buf = (char*)iov[i].base;
+		bufs[i].len = iov[i].len;
+	}
+
+	DWORD send_bytes = 0;
+	if (WSASend(m_socket, bufs, iov_cnt, &send_bytes, 0, NULL, NULL) == 0)
+		ret = (int)send_bytes;
+	else
+		ret = SOCKET_ERROR;
+#else
+	struct iovec vec[NETLIB_MAX_IOV_CNT];
+	for (int i = 0; i < iov_cnt; i++)
+	{
+		vec[i].iov_base = iov[i].base;
+		vec[i].iov_len = iov[i].len;
+	}
+
+	ret = writev(m_socket, vec, iov_cnt);
+#endif
+	if (ret == SOCKET_ERROR)
+	{
+		int err_code = _GetErrorCode();
+		if (_IsBlock(err_code))
+		{
+#if ((defined _WIN32) || (defined __APPLE__))
+			m_dispatch->AddEvent(m_socket, SOCKET_WRITE);
+#endif
+			ret = 0;
+		}
+		else
+		{
+			log("!!!writev failed, error code: %d", err_code);
+		}
+	}
+
+	return ret;
+}
+
+int CBaseSocket::SendFile(int file_fd, uint64_t* offset, uint32_t len)
+{
+	if (m_state != SOCKET_STATE_CONNECTED)
+		return NETLIB_ERROR;
+
+	int ret = 0;
+#if (defined _WIN32)
+	return NETLIB_ERROR;
+#elif (defined __APPLE__)
+	off_t send_bytes = len;
+	ret = sendfile(file_fd, m_socket, (off_t)*offset, &send_bytes, NULL, 0);
+	// 发送缓冲区满时返回-1(EAGAIN), 但可能已经发出了一部分
+	if (send_bytes > 0)
+	{
+		ret = (int)send_bytes;
+		*offset += send_bytes;
+	}
+#else
+	off_t off = (off_t)*offset;
+	ret = sendfile(m_socket, file_fd, &off, len);
+	if (ret > 0)
+		*offset = (uint64_t)off;
+#endif
+	if (ret == SOCKET_ERROR)
+	{
+		int err_code = _GetErrorCode();
+		if (_IsBlock(err_code))
+		{
+#if ((defined _WIN32) || (defined __APPLE__))
+			m_dispatch->AddEvent(m_socket, SOCKET_WRITE);
+#endif
+			ret = 0;
+		}
+		else
+		{
+			log("!!!sendfile failed, error code: %d", err_code);
+		}
+	}
+
+	return ret;
+}
+
 int CBaseSocket::Recv(void* buf, int len)
 {
 	return recv(m_socket, (char*)buf, len, 0);
@@ -161,7 +271,15 @@ int CBaseSocket::Recv(void* buf, int len)
 
 int CBaseSocket::Close()
 {
-	CEventDispatch::Instance()->RemoveEvent(m_socket, SOCKET_ALL);
+	// socket只能在所属reactor的线程里关闭, 否则该reactor可能正在处理它的事件, 而fd已经被重用
+	if (CEventDispatch::GetReactorCount() > 1 && !m_dispatch->IsInLoopThread())
+	{
+		AddRef();
+		m_dispatch->PostTask(_CloseTaskCallback, this);
+		return 0;
+	}
+
+	m_dispatch->RemoveEvent(m_socket, SOCKET_ALL);
 	RemoveBaseSocket(this);
 	closesocket(m_socket);
 	ReleaseRef();
@@ -197,7 +315,7 @@ void CBaseSocket::OnWrite()
 {
 #if ((defined _WIN32) || (defined __APPLE__))
 	//可写，先移除可写事件
-	CEventDispatch::Instance()->RemoveEvent(m_socket, SOCKET_WRITE);
+	m_dispatch->RemoveEvent(m_socket, SOCKET_WRITE);
 #endif
 
 	if (m_state == SOCKET_STATE_CONNECTING)
@@ -298,6 +416,20 @@ void CBaseSocket::_SetReuseAddr(SOCKET fd)
 	}
 }
 
+void CBaseSocket::_SetReusePort(SOCKET fd)
+{
+#ifdef SO_REUSEPORT
+	int reuse = 1;
+	int ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (char*)&reuse, sizeof(reuse));
+	if (ret == SOCKET_ERROR)
+	{
+		log("_SetReusePort failed, err_code=%d", _GetErrorCode());
+	}
+#else
+	log("SO_REUSEPORT not supported");
+#endif
+}
+
 void CBaseSocket::_SetNoDelay(SOCKET fd)
 {
 	int nodelay = 1;
@@ -345,6 +477,7 @@ void CBaseSocket::_AcceptNewSocket()
 		log("AcceptNewSocket, socket=%d from %s:%d\n", fd, ip_str, port);
 
 		pSocket->SetSocket(fd);
+		pSocket->SetDispatch(m_dispatch);
 		pSocket->SetCallback(m_callback);
 		pSocket->SetCallbackData(m_callback_data);
 		//6. 将socket的状态设置成SOCKET_STATE_CONNECTED。
@@ -356,10 +489,19 @@ void CBaseSocket::_AcceptNewSocket()
 		_SetNoDelay(fd);
 		//3. 新socket同样被设置成非阻塞的。
 		_SetNonblock(fd);
-		//2. 该socket和对应的CBaseSocket对象和侦听socket一样也被加入全局g_socket_map中进行管理。
+		//2. 该socket和对应的CBaseSocket对象和侦听socket一样也被加入所属reactor的socket map中进行管理。
 		AddBaseSocket(pSocket);
+
+		//非主reactor上的连接, 业务对象统一在主reactor里创建, 创建完成后再回到本reactor关注读事件
+		if (m_dispatch->GetIndex() != 0)
+		{
+			pSocket->AddRef();
+			CEventDispatch::GetReactor(0)->PostTask(_AcceptTaskCallback, pSocket);
+			continue;
+		}
+
 		//5. 关注该socket的读和异常事件
-		CEventDispatch::Instance()->AddEvent(fd, SOCKET_READ | SOCKET_EXCEP);
+		m_dispatch->AddEvent(fd, SOCKET_READ | SOCKET_EXCEP);
 
 		//7. 调用侦听socket的的回调函数m_callback(m_callback_data, NETLIB_MSG_CONNECT, (net_handle_t)fd, NULL)，并传入消息类型是NETLIB_MSG_CONNECT。
 		//这个回调函数在上面初始化侦听函数设置的，指向main函数proxy_serv_callback
@@ -367,3 +509,46 @@ void CBaseSocket::_AcceptNewSocket()
 	}
 }
 
+// run in main reactor
+void CBaseSocket::_AcceptTaskCallback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+	CBaseSocket* pSocket = (CBaseSocket*)callback_data;
+	// OnConnect里会把回调换成imconn_callback, 所以先保存侦听socket的回调
+	callback_t callback = pSocket->m_callback;
+	void* user_data = pSocket->m_callback_data;
+	callback(user_data, NETLIB_MSG_CONNECT, (net_handle_t)pSocket->m_socket, NULL);
+
+	pSocket->m_dispatch->PostTask(_RegisterTaskCallback, pSocket);
+}
+
+// run in the socket's reactor
+void CBaseSocket::_RegisterTaskCallback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+	CBaseSocket* pSocket = (CBaseSocket*)callback_data;
+	CBaseSocket* pFound = pSocket->m_dispatch->FindSocket(pSocket->m_socket);
+	if (pFound == pSocket)
+	{
+		pSocket->m_dispatch->AddEvent(pSocket->m_socket, SOCKET_READ | SOCKET_EXCEP);
+	}
+
+	if (pFound)
+		pFound->ReleaseRef();
+	pSocket->ReleaseRef();
+}
+
+// run in the socket's reactor
+void CBaseSocket::_CloseTaskCallback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+	CBaseSocket* pSocket = (CBaseSocket*)callback_data;
+	// 可能已经被关闭过了
+	CBaseSocket* pFound = pSocket->m_dispatch->FindSocket(pSocket->m_socket);
+	if (pFound == pSocket)
+	{
+		pSocket->Close();
+	}
+
+	if (pFound)
+		pFound->ReleaseRef();
+	pSocket->ReleaseRef();
+}
+
@@ -7,6 +7,7 @@
 
 #include "ostype.h"
 #include "util.h"
+#include "netlib.h"
 
 enum
 {
@@ -17,6 +18,8 @@ enum
 	SOCKET_STATE_CLOSING
 };
 
+class CEventDispatch;
+
 class CBaseSocket : public CRefObject
 {
 public:
@@ -34,11 +37,13 @@ public:
 	void SetRemotePort(uint16_t port) { m_remote_port = port; }
 	void SetSendBufSize(uint32_t send_size);
 	void SetRecvBufSize(uint32_t recv_size);
+	void SetDispatch(CEventDispatch* pDispatch) { m_dispatch = pDispatch; }
 
 	const char*	GetRemoteIP() { return m_remote_ip.c_str(); }
 	uint16_t	GetRemotePort() { return m_remote_port; }
 	const char*	GetLocalIP() { return m_local_ip.c_str(); }
 	uint16_t	GetLocalPort() { return m_local_port; }
+	CEventDispatch* GetDispatch() { return m_dispatch; }
 public:
 	int Listen(
 		const char*		server_ip, 
@@ -54,6 +59,10 @@ public:
 
 	int Send(void* buf, int len);
 
+	int SendV(netlib_iovec_t* iov, int iov_cnt);
+
+	int SendFile(int file_fd, uint64_t* offset, uint32_t len);
+
 	int Recv(void* buf, int len);
 
 	int Close();
@@ -69,11 +78,16 @@ private:
 
 	void _SetNonblock(SOCKET fd);
 	void _SetReuseAddr(SOCKET fd);
+	void _SetReusePort(SOCKET fd);
 	void _SetNoDelay(SOCKET fd);
 	void _SetAddr(const char* ip, const uint16_t port, sockaddr_in* pAddr);
 
 	void _AcceptNewSocket();
 
+	static void _AcceptTaskCallback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam);
+	static void _RegisterTaskCallback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam);
+	static void _CloseTaskCallback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam);
+
 private:
 	string			m_remote_ip;
 	uint16_t		m_remote_port;
@@ -85,6 +99,8 @@ private:
 
 	uint8_t			m_state;
 	SOCKET			m_socket;
+
+	CEventDispatch*	m_dispatch;		// 所属的reactor
 };
 
 CBaseSocket* FindBaseSocket(net_handle_t fd);
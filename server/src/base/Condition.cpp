@@ -9,6 +9,8 @@
 *
 ================================================================*/
 #include <assert.h>
+#include <errno.h>
+#include <sys/time.h>
 #include "Condition.h"
 
 CCondition::CCondition(CLock* pLock):m_pLock(pLock)
@@ -34,12 +36,13 @@ void CCondition::wait()
  */
 bool CCondition::waitTime(uint64_t nWaitTime)
 {
-    uint64_t nTime = nWaitTime * 1000000;
+    // 绝对时间要精确到微秒, 否则毫秒级的等待会被放大到整秒
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t nNsec = (uint64_t)tv.tv_usec * 1000 + (nWaitTime % 1000) * 1000000;
     struct timespec sTime;
-    uint64_t nSec = nTime / (1000000000);
-    uint64_t nNsec = nTime % (1000000000);
-    sTime.tv_sec = time(NULL) + (uint32_t)nSec;
-    sTime.tv_nsec = (uint32_t)nNsec;
+    sTime.tv_sec = tv.tv_sec + (time_t)(nWaitTime / 1000) + (time_t)(nNsec / 1000000000);
+    sTime.tv_nsec = (long)(nNsec % 1000000000);
     if(ETIMEDOUT == pthread_cond_timedwait(&m_cond, &m_pLock->getMutex(), &sTime))
     {
         return false;
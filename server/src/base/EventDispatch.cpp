@@ -1,13 +1,33 @@
 #include "EventDispatch.h"
 #include "BaseSocket.h"
+#include "Metrics.h"
+
+#ifdef _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#elif __APPLE__
+#define THREAD_LOCAL __thread
+#else
+#include <sys/eventfd.h>
+#define THREAD_LOCAL __thread
+#endif
 
 #define MIN_TIMER_DURATION	100	// 100 miliseconds
 
-CEventDispatch* CEventDispatch::m_pEventDispatch = NULL;
+CEventDispatch** CEventDispatch::m_reactor_list = NULL;
+uint32_t CEventDispatch::m_reactor_cnt = 0;
 
-CEventDispatch::CEventDispatch()
+// 当前线程所运行的reactor, 非reactor线程为NULL
+static THREAD_LOCAL CEventDispatch* s_loop_dispatch = NULL;
+
+CEventDispatch::CEventDispatch(uint32_t index)
 {
     running = false;
+	m_index = index;
+	m_wait_timeout = 100;
+	m_notify_cnt = 0;
+	// 0号reactor由调用netlib_init的主线程跑, 其他reactor等自己的线程起来后再设置
+	m_thread_id = pthread_self();
+	m_thread_valid = (index == 0);
 #ifdef _WIN32
 	FD_ZERO(&m_read_set);
 	FD_ZERO(&m_write_set);
@@ -18,12 +38,34 @@ CEventDispatch::CEventDispatch()
 	{
 		log("kqueue failed");
 	}
+
+	if (pipe(m_wakeup_fd) == 0)
+	{
+		fcntl(m_wakeup_fd[0], F_SETFL, O_NONBLOCK | fcntl(m_wakeup_fd[0], F_GETFL));
+		fcntl(m_wakeup_fd[1], F_SETFL, O_NONBLOCK | fcntl(m_wakeup_fd[1], F_GETFL));
+		AddEvent(m_wakeup_fd[0], SOCKET_READ);
+	}
+	else
+	{
+		log("pipe failed");
+		m_wakeup_fd[0] = m_wakeup_fd[1] = -1;
+	}
 #else
 	m_epfd = epoll_create(1024);
 	if (m_epfd == -1)
 	{
 		log("epoll_create failed");
 	}
+
+	m_wakeup_fd = eventfd(0, EFD_NONBLOCK);
+	if (m_wakeup_fd == -1)
+	{
+		log("eventfd failed");
+	}
+	else
+	{
+		AddEvent(m_wakeup_fd, SOCKET_READ);
+	}
 #endif
 }
 
@@ -33,63 +75,88 @@ CEventDispatch::~CEventDispatch()
 
 #elif __APPLE__
 	close(m_kqfd);
+	if (m_wakeup_fd[0] != -1)
+	{
+		close(m_wakeup_fd[0]);
+		close(m_wakeup_fd[1]);
+	}
 #else
 	close(m_epfd);
+	if (m_wakeup_fd != -1)
+	{
+		close(m_wakeup_fd);
+	}
 #endif
 }
 
 void CEventDispatch::AddTimer(callback_t callback, void* user_data, uint64_t interval)
 {
-	list<TimerItem*>::iterator it;
-	for (it = m_timer_list.begin(); it != m_timer_list.end(); it++)
+	LegacyTimer* pItem = NULL;
+	LegacyTimerMap::iterator it = m_legacy_timer_map.find(make_pair(callback, user_data));
+	if (it != m_legacy_timer_map.end())
 	{
-		TimerItem* pItem = *it;
-		if (pItem->callback == callback && pItem->user_data == user_data)
-		{
-			pItem->interval = interval;
-			pItem->next_tick = get_tick_count() + interval;
-			return;
-		}
+		pItem = it->second;
+	}
+	else
+	{
+		pItem = new LegacyTimer;
+		pItem->callback = callback;
+		pItem->user_data = user_data;
+		pItem->timer.Init(_LegacyTimerCallback, pItem);
+		m_legacy_timer_map.insert(make_pair(make_pair(callback, user_data), pItem));
 	}
 
-	TimerItem* pItem = new TimerItem;
-	pItem->callback = callback;
-	pItem->user_data = user_data;
-	pItem->interval = interval;
-	pItem->next_tick = get_tick_count() + interval;
-	m_timer_list.push_back(pItem);
+	m_timer_wheel.AddTimer(&pItem->timer, interval, interval);
 }
 
 void CEventDispatch::RemoveTimer(callback_t callback, void* user_data)
 {
-	list<TimerItem*>::iterator it;
-	for (it = m_timer_list.begin(); it != m_timer_list.end(); it++)
+	LegacyTimerMap::iterator it = m_legacy_timer_map.find(make_pair(callback, user_data));
+	if (it != m_legacy_timer_map.end())
 	{
-		TimerItem* pItem = *it;
-		if (pItem->callback == callback && pItem->user_data == user_data)
-		{
-			m_timer_list.erase(it);
-			delete pItem;
-			return;
-		}
+		LegacyTimer* pItem = it->second;
+		m_legacy_timer_map.erase(it);
+		delete pItem;	// ~CWheelTimer() cancels the timer
 	}
 }
 
+void CEventDispatch::_LegacyTimerCallback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+	// the item may be removed in the callback, so do not touch it afterwards
+	LegacyTimer* pItem = (LegacyTimer*)callback_data;
+	pItem->callback(pItem->user_data, NETLIB_MSG_TIMER, 0, NULL);
+}
+
 void CEventDispatch::_CheckTimer()
 {
-	uint64_t curr_tick = get_tick_count();
-	list<TimerItem*>::iterator it;
+	m_timer_wheel.Expire(get_tick_count());
+}
 
-	for (it = m_timer_list.begin(); it != m_timer_list.end(); )
+/*
+ * epoll/kqueue/select只需要等到最近的定时器到期, 没有定时器时一直阻塞,
+ * 有新任务或者StopDispatch()时通过wakeup fd唤醒;
+ * 注册了loop回调(如db_proxy的应答队列)的reactor仍然按wait_timeout轮询
+ */
+int CEventDispatch::_GetWaitTimeout(uint32_t wait_timeout)
+{
+	int64_t timeout = m_timer_wheel.GetNextTimeout(get_tick_count());
+#ifdef _WIN32
+	// select()没有wakeup fd
+	bool need_poll = true;
+#else
+	bool need_poll = !m_loop_list.empty();
+#endif
+	if (need_poll && (timeout < 0 || timeout > wait_timeout))
 	{
-		TimerItem* pItem = *it;
-		it++;		// iterator maybe deleted in the callback, so we should increment it before callback
-		if (curr_tick >= pItem->next_tick)
-		{
-			pItem->next_tick += pItem->interval;
-			pItem->callback(pItem->user_data, NETLIB_MSG_TIMER, 0, NULL);
-		}
+		timeout = wait_timeout;
 	}
+
+	if (timeout > 0x7fffffff)
+	{
+		timeout = 0x7fffffff;
+	}
+
+	return (int)timeout;
 }
 
 void CEventDispatch::AddLoop(callback_t callback, void* user_data)
@@ -108,14 +175,207 @@ void CEventDispatch::_CheckLoop()
     }
 }
 
+void CEventDispatch::PostTask(callback_t callback, void* user_data)
+{
+	TimerItem* pItem = new TimerItem;
+	pItem->callback = callback;
+	pItem->user_data = user_data;
+	pItem->interval = 0;
+	pItem->next_tick = 0;
+
+	m_task_lock.lock();
+	// 队列非空说明已经唤醒过, 还没来得及处理
+	bool need_wakeup = m_task_list.empty();
+	m_task_list.push_back(pItem);
+	m_task_lock.unlock();
+
+	if (need_wakeup)
+	{
+		_Wakeup();
+	}
+}
+
+void CEventDispatch::_CheckTask()
+{
+	list<TimerItem*> task_list;
+	m_task_lock.lock();
+	task_list.swap(m_task_list);
+	m_task_lock.unlock();
+
+	for (list<TimerItem*>::iterator it = task_list.begin(); it != task_list.end(); it++) {
+		TimerItem* pItem = *it;
+		pItem->callback(pItem->user_data, NETLIB_MSG_TASK, 0, NULL);
+		delete pItem;
+	}
+}
+
+int CEventDispatch::AddNotify(callback_t callback, void* user_data)
+{
+	CAutoLock func_lock(&m_task_lock);
+	if (m_notify_cnt >= MAX_NOTIFY_CNT)
+		return -1;
+
+	NotifyItem* pItem = &m_notify_list[m_notify_cnt];
+	pItem->callback = callback;
+	pItem->user_data = user_data;
+	pItem->pending = 0;
+	__sync_synchronize();	// 先填好再发布m_notify_cnt
+	return (int)m_notify_cnt++;
+}
+
+void CEventDispatch::Notify(int notify_id)
+{
+	if (notify_id < 0 || notify_id >= m_notify_cnt)
+		return;
+
+	// 已经有未处理的通知就不用再写eventfd了
+	NotifyItem* pItem = &m_notify_list[notify_id];
+	if (pItem->pending == 0 && __sync_bool_compare_and_swap(&pItem->pending, 0, 1))
+	{
+		_Wakeup();
+	}
+}
+
+void CEventDispatch::_CheckNotify()
+{
+	long notify_cnt = m_notify_cnt;
+	for (long i = 0; i < notify_cnt; i++) {
+		NotifyItem* pItem = &m_notify_list[i];
+		// 先清标志再回调, 回调取队列期间新入队的数据会再触发一次通知, 不会丢
+		if (pItem->pending && __sync_bool_compare_and_swap(&pItem->pending, 1, 0))
+		{
+			pItem->callback(pItem->user_data, NETLIB_MSG_NOTIFY, 0, NULL);
+		}
+	}
+}
+
+void CEventDispatch::_Wakeup()
+{
+#ifdef _WIN32
+	// select() wakes up at most MIN_TIMER_DURATION later
+#elif __APPLE__
+	if (m_wakeup_fd[1] != -1)
+	{
+		char c = 0;
+		(void)write(m_wakeup_fd[1], &c, 1);
+	}
+#else
+	if (m_wakeup_fd != -1)
+	{
+		uint64_t one = 1;
+		(void)write(m_wakeup_fd, &one, sizeof(one));
+	}
+#endif
+}
+
+void CEventDispatch::AddSocket(CBaseSocket* pSocket)
+{
+	CAutoLock func_lock(&m_socket_lock);
+	m_socket_map.insert(make_pair((net_handle_t)pSocket->GetSocket(), pSocket));
+}
+
+void CEventDispatch::RemoveSocket(CBaseSocket* pSocket)
+{
+	CAutoLock func_lock(&m_socket_lock);
+	m_socket_map.erase((net_handle_t)pSocket->GetSocket());
+}
+
+CBaseSocket* CEventDispatch::FindSocket(net_handle_t fd)
+{
+	CBaseSocket* pSocket = NULL;
+	CAutoLock func_lock(&m_socket_lock);
+	SocketMap::iterator iter = m_socket_map.find(fd);
+	if (iter != m_socket_map.end())
+	{
+		pSocket = iter->second;
+		pSocket->AddRef();
+	}
+
+	return pSocket;
+}
+
+bool CEventDispatch::IsInLoopThread()
+{
+	return m_thread_valid && pthread_equal(m_thread_id, pthread_self()) != 0;
+}
+
+void* CEventDispatch::_DispatchRoutine(void* arg)
+{
+	CEventDispatch* pDispatch = (CEventDispatch*)arg;
+	pDispatch->m_thread_id = pthread_self();
+	pDispatch->m_thread_valid = true;
+	pDispatch->StartDispatch(pDispatch->m_wait_timeout);
+	return NULL;
+}
+
+void CEventDispatch::StartDispatchThread(uint32_t wait_timeout)
+{
+	m_wait_timeout = wait_timeout;
+	// m_thread_id由新线程自己设置, 在那之前IsInLoopThread()对任何线程都返回false
+	pthread_t thread_id;
+	if (pthread_create(&thread_id, NULL, _DispatchRoutine, this) != 0)
+	{
+		log("create reactor thread failed, idx=%u", m_index);
+	}
+}
+
 CEventDispatch* CEventDispatch::Instance()
 {
-	if (m_pEventDispatch == NULL)
+	if (s_loop_dispatch)
+	{
+		return s_loop_dispatch;
+	}
+
+	return GetReactor(0);
+}
+
+/*
+ * must be called in main thread before any socket is created,
+ * reactor 0 is the main reactor which runs in netlib_eventloop()'s caller thread
+ */
+int CEventDispatch::InitReactors(uint32_t reactor_cnt)
+{
+	if (reactor_cnt == 0 || reactor_cnt < m_reactor_cnt)
+	{
+		return -1;
+	}
+
+	if (reactor_cnt == m_reactor_cnt)
+	{
+		return 0;
+	}
+
+	// 主reactor可能已经注册了定时器, 保留已创建的reactor
+	CEventDispatch** reactor_list = new CEventDispatch* [reactor_cnt];
+	for (uint32_t i = 0; i < reactor_cnt; i++)
+	{
+		reactor_list[i] = (i < m_reactor_cnt) ? m_reactor_list[i] : new CEventDispatch(i);
+	}
+
+	delete [] m_reactor_list;
+	m_reactor_list = reactor_list;
+	m_reactor_cnt = reactor_cnt;
+	return 0;
+}
+
+uint32_t CEventDispatch::GetReactorCount()
+{
+	return m_reactor_cnt ? m_reactor_cnt : 1;
+}
+
+CEventDispatch* CEventDispatch::GetReactor(uint32_t idx)
+{
+	if (m_reactor_list == NULL)
+	{
+		InitReactors(1);
+	}
+
+	if (idx >= m_reactor_cnt)
 	{
-		m_pEventDispatch = new CEventDispatch();
+		return NULL;
 	}
 
-	return m_pEventDispatch;
+	return m_reactor_list[idx];
 }
 
 #ifdef _WIN32
@@ -178,12 +438,13 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout)
 	*/
 	fd_set read_set, write_set, excep_set;
 	timeval timeout;
-	timeout.tv_sec = 0;
-	timeout.tv_usec = wait_timeout * 1000;	// 10 millisecond
 
     if(running)
         return;
     running = true;
+	m_thread_id = pthread_self();
+	m_thread_valid = true;
+	s_loop_dispatch = this;
     
     while (running)
 	{
@@ -191,6 +452,9 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout)
 		_CheckTimer();
 		//发送应答包
         _CheckLoop();
+		//其他线程投递的任务
+		_CheckTask();
+		_CheckNotify();
 
 		if (!m_read_set.fd_count && !m_write_set.fd_count && !m_excep_set.fd_count)
 		{
@@ -204,6 +468,9 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout)
 		memcpy(&excep_set, &m_excep_set, sizeof(fd_set));
 		m_lock.unlock();
 
+		int wait_ms = _GetWaitTimeout(wait_timeout);
+		timeout.tv_sec = wait_ms / 1000;
+		timeout.tv_usec = (wait_ms % 1000) * 1000;
 		int nfds = select(0, &read_set, &write_set, &excep_set, &timeout);
 
 		if (nfds == SOCKET_ERROR)
@@ -222,8 +489,8 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout)
 		{
 			//log("select return read count=%d\n", read_set.fd_count);
 			SOCKET fd = read_set.fd_array[i];
-			//FindBaseSocket()就是在上文提到的socket集合map中通过句柄查找socket
-			CBaseSocket* pSocket = FindBaseSocket((net_handle_t)fd);
+			//FindSocket()就是在上文提到的socket集合map中通过句柄查找socket
+			CBaseSocket* pSocket = FindSocket((net_handle_t)fd);
 			if (pSocket)
 			{
 				pSocket->OnRead();
@@ -235,7 +502,7 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout)
 		{
 			//log("select return write count=%d\n", write_set.fd_count);
 			SOCKET fd = write_set.fd_array[i];
-			CBaseSocket* pSocket = FindBaseSocket((net_handle_t)fd);
+			CBaseSocket* pSocket = FindSocket((net_handle_t)fd);
 			if (pSocket)
 			{
 				pSocket->OnWrite();
@@ -247,7 +514,7 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout)
 		{
 			//log("select return exception count=%d\n", excep_set.fd_count);
 			SOCKET fd = excep_set.fd_array[i];
-			CBaseSocket* pSocket = FindBaseSocket((net_handle_t)fd);
+			CBaseSocket* pSocket = FindSocket((net_handle_t)fd);
 			if (pSocket)
 			{
 				pSocket->OnClose();
@@ -261,6 +528,7 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout)
 void CEventDispatch::StopDispatch()
 {
     running = false;
+	_Wakeup();
 }
 
 #elif __APPLE__
@@ -304,21 +572,32 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout)
 	struct kevent events[1024];
 	int nfds = 0;
 	struct timespec timeout;
-	timeout.tv_sec = 0;
-	timeout.tv_nsec = wait_timeout * 1000000;
 
     if(running)
         return;
     running = true;
+	m_thread_id = pthread_self();
+	m_thread_valid = true;
+	s_loop_dispatch = this;
     
     while (running)
 	{
-		nfds = kevent(m_kqfd, NULL, 0, events, 1024, &timeout);
+		int wait_ms = _GetWaitTimeout(wait_timeout);
+		timeout.tv_sec = wait_ms / 1000;
+		timeout.tv_nsec = (wait_ms % 1000) * 1000000;
+		nfds = kevent(m_kqfd, NULL, 0, events, 1024, (wait_ms < 0) ? NULL : &timeout);
 
 		for (int i = 0; i < nfds; i++)
 		{
 			int ev_fd = events[i].ident;
-			CBaseSocket* pSocket = FindBaseSocket(ev_fd);
+			if (ev_fd == m_wakeup_fd[0])
+			{
+				char buf[64];
+				while (read(m_wakeup_fd[0], buf, sizeof(buf)) > 0) {}
+				continue;
+			}
+
+			CBaseSocket* pSocket = FindSocket(ev_fd);
 			if (!pSocket)
 				continue;
 
@@ -339,12 +618,15 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout)
 
 		_CheckTimer();
         _CheckLoop();
+		_CheckTask();
+		_CheckNotify();
 	}
 }
 
 void CEventDispatch::StopDispatch()
 {
     running = false;
+	_Wakeup();
 }
 
 #else
@@ -376,14 +658,31 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout)
     if(running)
         return;
     running = true;
+	m_thread_id = pthread_self();
+	m_thread_valid = true;
+	s_loop_dispatch = this;
+
+	// 每轮循环处理事件、定时器和任务的耗时, 不含epoll_wait的等待
+	char reactor_idx[16];
+	snprintf(reactor_idx, sizeof(reactor_idx), "%u", m_index);
+	CMetricHistogram* loop_histogram = CMetricsRegistry::getInstance()->GetLatencyHistogram("teamtalk_reactor_loop_seconds",
+			"time spent in one event loop iteration, excluding epoll_wait", metrics_label("reactor", reactor_idx));
     
 	while (running)
 	{
-		nfds = epoll_wait(m_epfd, events, 1024, wait_timeout);
+		nfds = epoll_wait(m_epfd, events, 1024, _GetWaitTimeout(wait_timeout));
+		uint64_t start_us = metrics_now_us();
 		for (int i = 0; i < nfds; i++)
 		{
 			int ev_fd = events[i].data.fd;
-			CBaseSocket* pSocket = FindBaseSocket(ev_fd);
+			if (ev_fd == m_wakeup_fd)
+			{
+				uint64_t cnt = 0;
+				(void)read(m_wakeup_fd, &cnt, sizeof(cnt));
+				continue;
+			}
+
+			CBaseSocket* pSocket = FindSocket(ev_fd);
 			if (!pSocket)
 				continue;
             
@@ -420,12 +719,16 @@ void CEventDispatch::StartDispatch(uint32_t wait_timeout)
 
 		_CheckTimer();
         _CheckLoop();
+		_CheckTask();
+		_CheckNotify();
+		loop_histogram->Observe(metrics_now_us() - start_us);
 	}
 }
 
 void CEventDispatch::StopDispatch()
 {
     running = false;
+	_Wakeup();
 }
 
 
@@ -1,7 +1,11 @@
 /*
- * A socket event dispatcher, features include: 
+ * A socket event dispatcher, features include:
  * 1. portable: worked both on Windows, MAC OS X,  LINUX platform
- * 2. a singleton pattern: only one instance of this class can exist
+ * 2. one dispatcher per reactor thread: Instance() returns the dispatcher bound to
+ *    the calling thread, or the main reactor(index 0) for non-reactor threads
+ * 3. each reactor owns its epoll fd, timer wheel, socket map and a task mailbox
+ * 3.1 notify slots let other threads wake a reactor to drain their own lock-free queues
+ * 4. the poll timeout is derived from the nearest timer, an idle reactor sleeps until woken
  */
 #ifndef __EVENT_DISPATCH_H__
 #define __EVENT_DISPATCH_H__
@@ -10,6 +14,7 @@
 #include "util.h"
 
 #include "Lock.h"
+#include "TimerWheel.h"
 
 enum {
 	SOCKET_READ		= 0x1,
@@ -18,6 +23,10 @@ enum {
 	SOCKET_ALL		= 0x7
 };
 
+#define MAX_NOTIFY_CNT	16
+
+class CBaseSocket;
+
 class CEventDispatch
 {
 public:
@@ -26,23 +35,53 @@ public:
 	void AddEvent(SOCKET fd, uint8_t socket_event);
 	void RemoveEvent(SOCKET fd, uint8_t socket_event);
 
+	// 兼容老接口, 按(callback, user_data)查找, 回调的pParam为NULL
 	void AddTimer(callback_t callback, void* user_data, uint64_t interval);
 	void RemoveTimer(callback_t callback, void* user_data);
-    
+
+	// 只能在本reactor线程里使用
+	CTimerWheel* GetTimerWheel() { return &m_timer_wheel; }
+
     void AddLoop(callback_t callback, void* user_data);
 
+	// thread safe, callback is called in this reactor's thread with NETLIB_MSG_TASK
+	void PostTask(callback_t callback, void* user_data);
+
+	// 返回通知id, 失败返回-1; 需要在生产者线程开始Notify之前注册
+	int AddNotify(callback_t callback, void* user_data);
+	// thread safe, callback is called in this reactor's thread with NETLIB_MSG_NOTIFY,
+	// 回调之前的多次通知合并成一次, 回调里要把对应的队列取空
+	void Notify(int notify_id);
+
+	void AddSocket(CBaseSocket* pSocket);
+	void RemoveSocket(CBaseSocket* pSocket);
+	CBaseSocket* FindSocket(net_handle_t fd);
+
 	void StartDispatch(uint32_t wait_timeout = 100);
+	void StartDispatchThread(uint32_t wait_timeout = 100);
     void StopDispatch();
-    
+
     bool isRunning() {return running;}
+	uint32_t GetIndex() { return m_index; }
+	bool IsInLoopThread();
 
 	static CEventDispatch* Instance();
+	static int InitReactors(uint32_t reactor_cnt);
+	static uint32_t GetReactorCount();
+	static CEventDispatch* GetReactor(uint32_t idx);
 protected:
-	CEventDispatch();
+	CEventDispatch(uint32_t index = 0);
 
 private:
 	void _CheckTimer();
+	int _GetWaitTimeout(uint32_t wait_timeout);
     void _CheckLoop();
+	void _CheckTask();
+	void _CheckNotify();
+	void _Wakeup();
+
+	static void* _DispatchRoutine(void* arg);
+	static void _LegacyTimerCallback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam);
 
 	typedef struct {
 		callback_t	callback;
@@ -51,6 +90,21 @@ private:
 		uint64_t	next_tick;
 	} TimerItem;
 
+	typedef struct {
+		callback_t		callback;
+		void*			user_data;
+		volatile long	pending;
+	} NotifyItem;
+
+	typedef struct {
+		CWheelTimer	timer;
+		callback_t	callback;
+		void*		user_data;
+	} LegacyTimer;
+
+	typedef hash_map<net_handle_t, CBaseSocket*> SocketMap;
+	typedef map<pair<callback_t, void*>, LegacyTimer*> LegacyTimerMap;
+
 private:
 #ifdef _WIN32
 	fd_set	m_read_set;
@@ -58,15 +112,33 @@ private:
 	fd_set	m_excep_set;
 #elif __APPLE__
 	int 	m_kqfd;
+	int		m_wakeup_fd[2];
 #else
 	int		m_epfd;
+	int		m_wakeup_fd;
 #endif
 	CLock			m_lock;
-	list<TimerItem*>	m_timer_list;
+	CTimerWheel			m_timer_wheel;
+	LegacyTimerMap		m_legacy_timer_map;
 	list<TimerItem*>	m_loop_list;
 
-	static CEventDispatch* m_pEventDispatch;
-    
+	CLock				m_task_lock;
+	list<TimerItem*>	m_task_list;	// 其他线程投递过来的任务
+
+	NotifyItem			m_notify_list[MAX_NOTIFY_CNT];
+	volatile long		m_notify_cnt;
+
+	CLock			m_socket_lock;
+	SocketMap		m_socket_map;
+
+	uint32_t		m_index;
+	uint32_t		m_wait_timeout;
+	pthread_t		m_thread_id;
+	volatile bool	m_thread_valid;	// m_thread_id已经是跑这个reactor的线程
+
+	static CEventDispatch**	m_reactor_list;
+	static uint32_t			m_reactor_cnt;
+
     bool running;
 };
 
@@ -13,11 +13,35 @@
 
 CHttpParserWrapper::CHttpParserWrapper()
 {
-
+    m_body_callback = NULL;
+    m_body_callback_data = NULL;
 }
 
 
 void CHttpParserWrapper::ParseHttpContent(const char* buf, uint32_t len)
+{
+    _Reset();
+    m_body_callback = NULL;
+    m_body_callback_data = NULL;
+    http_parser_execute(&m_http_parser, &m_settings, buf, len);
+}
+
+void CHttpParserWrapper::InitStream(http_body_callback_t callback, void* callback_data)
+{
+    _Reset();
+    m_body_callback = callback;
+    m_body_callback_data = callback_data;
+}
+
+void CHttpParserWrapper::ParseStream(const char* buf, uint32_t len)
+{
+    // 出错之后http_parser不再解析, 这里也不用再调
+    if (IsParseError())
+        return;
+    http_parser_execute(&m_http_parser, &m_settings, buf, len);
+}
+
+void CHttpParserWrapper::_Reset()
 {
 	http_parser_init(&m_http_parser, HTTP_REQUEST);
 	memset(&m_settings, 0, sizeof(m_settings));
@@ -36,6 +60,7 @@ void CHttpParserWrapper::ParseHttpContent(const char* buf, uint32_t len)
     m_read_content_type = false;
     m_read_content_len = false;
     m_read_host = false;
+    m_read_range = false;
     m_total_length = 0;
     m_url.clear();
     m_body_content.clear();
@@ -45,8 +70,7 @@ void CHttpParserWrapper::ParseHttpContent(const char* buf, uint32_t len)
     m_content_type.clear();
     m_content_len = 0;
     m_host.clear();
-    
-    http_parser_execute(&m_http_parser, &m_settings, buf, len);
+    m_range.clear();
 }
 
 int CHttpParserWrapper::OnUrl(http_parser* parser, const char *at,
@@ -105,6 +129,13 @@ int CHttpParserWrapper::OnHeaderField(http_parser* parser, const char *at,
             ((CHttpParserWrapper*)obj)->SetReadHost(true);
         }
     }
+    if(!((CHttpParserWrapper*)obj)->HasReadRange())
+    {
+        if(length == 5 && strncasecmp(at, "Range", 5) == 0)
+        {
+            ((CHttpParserWrapper*)obj)->SetReadRange(true);
+        }
+    }
     return 0;
 }
 
@@ -148,6 +179,12 @@ int CHttpParserWrapper::OnHeaderValue(http_parser* parser, const char *at, size_
         ((CHttpParserWrapper*)obj)->SetHost(at, length);
         ((CHttpParserWrapper*)obj)->SetReadHost(false);
     }
+
+    if(((CHttpParserWrapper*)obj)->IsReadRange())
+    {
+        ((CHttpParserWrapper*)obj)->SetRange(at, length);
+        ((CHttpParserWrapper*)obj)->SetReadRange(false);
+    }
     return 0;
 }
 
@@ -159,7 +196,10 @@ int CHttpParserWrapper::OnHeadersComplete(http_parser* parser, void* obj)
 
 int CHttpParserWrapper::OnBody(http_parser* parser, const char *at, size_t length, void* obj)
 {
-    ((CHttpParserWrapper*)obj)->SetBodyContent(at, length);
+    CHttpParserWrapper* pParser = (CHttpParserWrapper*)obj;
+    if (pParser->m_body_callback)
+        return pParser->m_body_callback(pParser->m_body_callback_data, at, length);
+    pParser->SetBodyContent(at, length);
     return 0;
 }
 
@@ -12,6 +12,9 @@
 #include "util.h"
 #include "http_parser.h"
 
+// 连续解析时正文的回调, 返回非0时停止解析
+typedef int (*http_body_callback_t)(void* callback_data, const char* at, size_t length);
+
 // extract url and content body from an ajax request
 class CHttpParserWrapper {
 public:
@@ -20,6 +23,13 @@ public:
     virtual ~CHttpParserWrapper() { }
     
     void ParseHttpContent(const char* buf, uint32_t len);
+    /*
+     * 连续解析: InitStream之后每收到一段数据调用一次ParseStream, 只传新数据;
+     * 设置了callback时正文不再缓存在m_body_content里, 直接交给callback(如msfs边收边写文件)
+     */
+    void InitStream(http_body_callback_t callback, void* callback_data);
+    void ParseStream(const char* buf, uint32_t len);
+    bool IsParseError() { return HTTP_PARSER_ERRNO(&m_http_parser) != HPE_OK; }
     
     bool IsReadAll() { return m_read_all; }
     bool IsReadReferer() { return m_read_referer; }
@@ -34,6 +44,8 @@ public:
     bool HasReadContentLen() { return m_content_len != 0; }
     bool IsReadHost()  { return m_read_host;  }
     bool HasReadHost() { return m_host.size()>0; }
+    bool IsReadRange() { return m_read_range; }
+    bool HasReadRange() { return m_range.size() > 0; }
 
     uint32_t GetTotalLength() { return m_total_length; }
     char* GetUrl() { return (char*)m_url.c_str(); }
@@ -46,6 +58,7 @@ public:
     char* GetContentType() { return (char*) m_content_type.c_str(); }
     uint32_t  GetContentLen() { return m_content_len; }
     char* GetHost() { return (char*) m_host.c_str(); }
+    char* GetRange() { return (char*) m_range.c_str(); }
     
     void SetUrl(const char* url, size_t length) { m_url.append(url, length); }
     void SetReferer(const char* referer, size_t length) { m_referer.append(referer, length); }
@@ -56,6 +69,7 @@ public:
     void SetContentLen(uint32_t content_len) { m_content_len = content_len; }
     void SetTotalLength(uint32_t total_len) { m_total_length = total_len; }
     void SetHost(const char* host, size_t length) { m_host.append(host, length); }
+    void SetRange(const char* range, size_t length) { m_range.append(range, length); }
     void SetReadAll() { m_read_all = true; }
     void SetReadReferer(bool read_referer) { m_read_referer = read_referer; }
     void SetReadForwardIP(bool read_forward_ip) { m_read_forward_ip = read_forward_ip; }
@@ -63,6 +77,7 @@ public:
     void SetReadContentType(bool read_content_type) { m_read_content_type =  read_content_type; }
     void SetReadContentLen(bool read_content_len) { m_read_content_len = read_content_len; }
     void SetReadHost(bool read_host) { m_read_host = read_host; }
+    void SetReadRange(bool read_range) { m_read_range = read_range; }
 
     static int OnUrl(http_parser* parser, const char *at, size_t length, void* obj);
     static int OnHeaderField(http_parser* parser, const char *at, size_t length, void* obj);
@@ -72,6 +87,7 @@ public:
     static int OnMessageComplete (http_parser* parser, void* obj);
 
 private:
+    void _Reset();
 
 private:
 
@@ -85,6 +101,7 @@ private:
     bool m_read_content_type;
     bool m_read_content_len;
     bool m_read_host;
+    bool m_read_range;
     uint32_t    m_total_length;
     string	m_url;
     string	m_body_content;
@@ -94,6 +111,9 @@ private:
     string m_content_type;
     uint32_t  m_content_len;
     string m_host;
+    string m_range;
+    http_body_callback_t m_body_callback;
+    void* m_body_callback_data;
 };
 
 #endif
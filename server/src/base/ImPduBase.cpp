@@ -18,30 +18,58 @@ CImPdu::CImPdu()
 	m_pdu_header.command_id = 0;
 	m_pdu_header.seq_num = 0;
     m_pdu_header.reversed = 0;
+    m_view_buf = NULL;
+    m_view_len = 0;
 }
 
 uchar_t* CImPdu::GetBuffer()
 {
-    return m_buf.GetBuffer();
+    return m_view_buf ? m_view_buf : m_buf.GetBuffer();
 }
 
 uint32_t CImPdu::GetLength()
 {
-    return m_buf.GetWriteOffset();
+    return m_view_buf ? m_view_len : m_buf.GetWriteOffset();
 }
 
 uchar_t* CImPdu::GetBodyData()
 {
-    return m_buf.GetBuffer() + sizeof(PduHeader_t);
+    return GetBuffer() + sizeof(PduHeader_t);
 }
 
 uint32_t CImPdu::GetBodyLength()
 {
     uint32_t body_length = 0;
-    body_length = m_buf.GetWriteOffset() - sizeof(PduHeader_t);
+    body_length = GetLength() - sizeof(PduHeader_t);
     return body_length;
 }
 
+void CImPdu::Write(uchar_t* buf, uint32_t len)
+{
+    _Detach();
+    m_buf.Write((void*)buf, len);
+}
+
+CImPdu* CImPdu::Retain()
+{
+    CImPdu* pPdu = new CImPdu();
+    pPdu->Write(GetBuffer(), GetLength());
+    pPdu->ReadPduHeader(GetBuffer(), IM_PDU_HEADER_LEN);
+    return pPdu;
+}
+
+void CImPdu::_Detach()
+{
+    if (!m_view_buf)
+        return;
+
+    uchar_t* view_buf = m_view_buf;
+    m_view_buf = NULL;
+    m_buf.Read(NULL, m_buf.GetWriteOffset());
+    m_buf.Write(view_buf, m_view_len);
+    m_view_len = 0;
+}
+
 void CImPdu::WriteHeader()
 {
 	uchar_t* buf = GetBuffer();
@@ -154,12 +182,20 @@ bool CImPdu::IsPduAvailable(uchar_t* buf, uint32_t len, uint32_t& pdu_len)
         throw CPduException(1, "pdu_len is 0");
     }
 
+    // 包头都放不下的长度, 后面按包头解析会越界
+    if (pdu_len < IM_PDU_HEADER_LEN)
+    {
+        throw CPduException(1, "pdu_len is less than header length");
+    }
+
 	return true;
 }
 
 void CImPdu::SetPBMsg(const google::protobuf::MessageLite* msg)
 {
-    //设置包体，则需要重置下空间
+    //设置包体，则需要重置下空间, 原来引用的读缓冲区数据不再需要
+    m_view_buf = NULL;
+    m_view_len = 0;
     m_buf.Read(NULL, m_buf.GetWriteOffset());
     m_buf.Write(NULL, sizeof(PduHeader_t));
     uint32_t msg_size = msg->ByteSize();
@@ -175,3 +211,11 @@ void CImPdu::SetPBMsg(const google::protobuf::MessageLite* msg)
     WriteHeader();
 }
 
+
+//////////////////////////////
+CImPduView::CImPduView(uchar_t* buf, uint32_t len)
+{
+    m_view_buf = buf;
+    m_view_len = len;
+    ReadPduHeader(buf, IM_PDU_HEADER_LEN);
+}
@@ -82,13 +82,33 @@ public:
     
     static bool IsPduAvailable(uchar_t* buf, uint32_t len, uint32_t& pdu_len);
     static CImPdu* ReadPdu(uchar_t* buf, uint32_t len);
-    void Write(uchar_t* buf, uint32_t len) { m_buf.Write((void*)buf, len); }
+    void Write(uchar_t* buf, uint32_t len);
     int ReadPduHeader(uchar_t* buf, uint32_t len);
     void SetPBMsg(const google::protobuf::MessageLite* msg);
     
+    bool IsView() { return m_view_buf != NULL; }
+    // 返回一个拥有自己缓冲区的拷贝, 用于数据包需要在读缓冲区之外继续存活的场合(如交给工作线程)
+    CImPdu* Retain();
+    
+protected:
+    void _Detach();
+    
 protected:
     CSimpleBuffer	m_buf;          //包体
     PduHeader_t		m_pdu_header;   //包头
+    uchar_t*		m_view_buf;     // 不为NULL时直接引用连接读缓冲区里的数据, 不拥有该内存
+    uint32_t		m_view_len;
+};
+
+/*
+ * 不拷贝数据的包, 只在HandlePdu()调用期间有效, 一般在栈上构造;
+ * 修改包体(SetPBMsg/Write)时会自动转成拥有自己缓冲区的包, 修改包头字段则直接改读缓冲区里的数据
+ */
+class DLL_MODIFIER CImPduView : public CImPdu
+{
+public:
+    CImPduView(uchar_t* buf, uint32_t len);
+    virtual ~CImPduView() {}
 };
 
 
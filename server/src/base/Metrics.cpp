@@ -0,0 +1,356 @@
+/*
+ * Metrics.cpp
+ */
+
+#include <time.h>
+#include "util.h"
+#include "Metrics.h"
+
+// 微秒, 50us ~ 10s
+static const uint64_t g_latency_bounds[] = {
+	50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+	100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+};
+
+static volatile long g_shard_generator = 0;
+static __thread int t_shard_idx = -1;
+
+// 线程第一次使用时轮流分配, 线程不多于METRICS_SHARD_CNT时每个线程独占一个分片
+static inline uint32_t get_shard_idx()
+{
+	if (t_shard_idx < 0) {
+		t_shard_idx = (int)(__sync_fetch_and_add(&g_shard_generator, 1) % METRICS_SHARD_CNT);
+	}
+	return (uint32_t)t_shard_idx;
+}
+
+uint64_t metrics_now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+string metrics_label(const char* name, const string& value)
+{
+	string label = name;
+	label += "=\"";
+	for (size_t i = 0; i < value.size(); i++) {
+		char c = value[i];
+		if (c == '\\' || c == '"') {
+			label += '\\';
+			label += c;
+		} else if (c == '\n') {
+			label += "\\n";
+		} else {
+			label += c;
+		}
+	}
+	label += "\"";
+	return label;
+}
+
+//////////////
+CMetricCounter::CMetricCounter()
+{
+	memset(m_shards, 0, sizeof(m_shards));
+}
+
+void CMetricCounter::Inc(uint64_t n)
+{
+	(void)__sync_add_and_fetch(&m_shards[get_shard_idx()].value, n);
+}
+
+uint64_t CMetricCounter::Value()
+{
+	uint64_t value = 0;
+	for (uint32_t i = 0; i < METRICS_SHARD_CNT; i++) {
+		value += m_shards[i].value;
+	}
+	return value;
+}
+
+//////////////
+CMetricHistogram::CMetricHistogram(const uint64_t* bounds, uint32_t bound_cnt, double scale)
+{
+	if (bound_cnt > METRICS_MAX_BUCKETS) {
+		log("too many histogram buckets: %u, only the first %u are used", bound_cnt, METRICS_MAX_BUCKETS);
+		bound_cnt = METRICS_MAX_BUCKETS;
+	}
+
+	memcpy(m_bounds, bounds, bound_cnt * sizeof(uint64_t));
+	m_bound_cnt = bound_cnt;
+	m_scale = (scale > 0) ? scale : 1;
+	memset((void*)m_shards, 0, sizeof(m_shards));
+}
+
+void CMetricHistogram::Observe(uint64_t value)
+{
+	uint32_t idx = 0;
+	while (idx < m_bound_cnt && value > m_bounds[idx]) {
+		idx++;
+	}
+
+	Shard_t& shard = m_shards[get_shard_idx()];
+	(void)__sync_add_and_fetch(&shard.buckets[idx], 1);
+	(void)__sync_add_and_fetch(&shard.sum, value);
+	(void)__sync_add_and_fetch(&shard.count, 1);
+}
+
+void CMetricHistogram::GetValue(uint64_t* buckets, uint64_t* sum, uint64_t* count)
+{
+	memset(buckets, 0, (m_bound_cnt + 1) * sizeof(uint64_t));
+	*sum = 0;
+	*count = 0;
+
+	// 各个字段分开累加, 读取时不是同一时刻的快照, count和各桶之和可能差几个, 导出时以桶为准
+	for (uint32_t i = 0; i < METRICS_SHARD_CNT; i++) {
+		for (uint32_t j = 0; j <= m_bound_cnt; j++) {
+			buckets[j] += m_shards[i].buckets[j];
+		}
+		*sum += m_shards[i].sum;
+		*count += m_shards[i].count;
+	}
+}
+
+//////////////
+CMetricHistogramMap::CMetricHistogramMap(const char* name, const char* help, const char* label_name)
+{
+	m_name = name;
+	m_help = help;
+	m_label_name = label_name;
+	memset((void*)m_pages, 0, sizeof(m_pages));
+}
+
+CMetricHistogramMap::~CMetricHistogramMap()
+{
+	// 直方图归CMetricsRegistry所有, 这里只释放索引
+	for (uint32_t i = 0; i < 256; i++) {
+		delete [] m_pages[i];
+	}
+}
+
+CMetricHistogram* CMetricHistogramMap::Get(uint16_t key)
+{
+	CMetricHistogram* volatile* page = m_pages[key >> 8];
+	if (!page) {
+		CMetricHistogram* volatile* new_page = new CMetricHistogram* volatile [256]();
+		if (__sync_bool_compare_and_swap(&m_pages[key >> 8], (CMetricHistogram* volatile*)NULL, new_page)) {
+			page = new_page;
+		} else {
+			delete [] new_page;
+			page = m_pages[key >> 8];
+		}
+	}
+
+	CMetricHistogram* histogram = page[key & 0xFF];
+	if (!histogram) {
+		// 同名同标签重复注册返回同一个对象, 多个线程同时走到这里也没关系
+		char value[16];
+		snprintf(value, sizeof(value), "0x%04x", key);
+		histogram = CMetricsRegistry::getInstance()->GetLatencyHistogram(m_name.c_str(), m_help.c_str(),
+				metrics_label(m_label_name.c_str(), value));
+		page[key & 0xFF] = histogram;
+	}
+
+	return histogram;
+}
+
+//////////////
+CMetricsRegistry* volatile CMetricsRegistry::s_instance = NULL;
+
+CMetricsRegistry* CMetricsRegistry::getInstance()
+{
+	// 各个reactor和工作线程可能同时第一次调用
+	if (!s_instance) {
+		CMetricsRegistry* instance = new CMetricsRegistry();
+		if (!__sync_bool_compare_and_swap(&s_instance, (CMetricsRegistry*)NULL, instance)) {
+			delete instance;
+		}
+	}
+
+	return s_instance;
+}
+
+CMetricCounter* CMetricsRegistry::GetCounter(const char* name, const char* help, const string& labels)
+{
+	CAutoLock autoLock(&m_lock);
+	bool conflict = false;
+	CMetricCounter* counter = (CMetricCounter*)_Find(METRIC_TYPE_COUNTER, name, labels, &conflict);
+	if (!counter) {
+		counter = new CMetricCounter();
+		if (!conflict) {
+			_Add(METRIC_TYPE_COUNTER, name, help, labels, counter, NULL, NULL);
+		}
+	}
+
+	return counter;
+}
+
+CMetricGauge* CMetricsRegistry::GetGauge(const char* name, const char* help, const string& labels)
+{
+	CAutoLock autoLock(&m_lock);
+	bool conflict = false;
+	CMetricGauge* gauge = (CMetricGauge*)_Find(METRIC_TYPE_GAUGE, name, labels, &conflict);
+	if (!gauge) {
+		gauge = new CMetricGauge();
+		if (!conflict) {
+			_Add(METRIC_TYPE_GAUGE, name, help, labels, gauge, NULL, NULL);
+		}
+	}
+
+	return gauge;
+}
+
+CMetricHistogram* CMetricsRegistry::GetHistogram(const char* name, const char* help, const string& labels,
+		const uint64_t* bounds, uint32_t bound_cnt, double scale)
+{
+	CAutoLock autoLock(&m_lock);
+	bool conflict = false;
+	CMetricHistogram* histogram = (CMetricHistogram*)_Find(METRIC_TYPE_HISTOGRAM, name, labels, &conflict);
+	if (!histogram) {
+		histogram = new CMetricHistogram(bounds, bound_cnt, scale);
+		if (!conflict) {
+			_Add(METRIC_TYPE_HISTOGRAM, name, help, labels, histogram, NULL, NULL);
+		}
+	}
+
+	return histogram;
+}
+
+CMetricHistogram* CMetricsRegistry::GetLatencyHistogram(const char* name, const char* help, const string& labels)
+{
+	return GetHistogram(name, help, labels, g_latency_bounds,
+			sizeof(g_latency_bounds) / sizeof(g_latency_bounds[0]), 1000000);
+}
+
+void CMetricsRegistry::AddCallback(int type, const char* name, const char* help, const string& labels,
+		metric_callback_t callback, void* user_data)
+{
+	if (type != METRIC_TYPE_COUNTER && type != METRIC_TYPE_GAUGE) {
+		log("metric %s: callback must be a counter or a gauge", name);
+		return;
+	}
+
+	CAutoLock autoLock(&m_lock);
+	bool conflict = false;
+	if (_Find(type, name, labels, &conflict) || conflict) {
+		log("metric %s{%s} already registered, callback ignored", name, labels.c_str());
+		return;
+	}
+
+	_Add(type, name, help, labels, NULL, callback, user_data);
+}
+
+void CMetricsRegistry::Export(string& out)
+{
+	char buf[256];
+	CAutoLock autoLock(&m_lock);
+	for (map<string, Family_t>::iterator it = m_family_map.begin(); it != m_family_map.end(); it++) {
+		const string& name = it->first;
+		Family_t& family = it->second;
+		const char* type_name = (family.type == METRIC_TYPE_COUNTER) ? "counter" :
+				((family.type == METRIC_TYPE_GAUGE) ? "gauge" : "histogram");
+		out += "# HELP " + name + " " + family.help + "\n";
+		out += "# TYPE " + name + " " + type_name + "\n";
+
+		for (vector<Metric_t>::iterator it_metric = family.metric_list.begin(); it_metric != family.metric_list.end(); it_metric++) {
+			Metric_t& metric = *it_metric;
+			if (family.type == METRIC_TYPE_HISTOGRAM) {
+				_ExportHistogram(name, metric, out);
+				continue;
+			}
+
+			out += name;
+			if (!metric.labels.empty()) {
+				out += "{" + metric.labels + "}";
+			}
+
+			if (metric.callback) {
+				snprintf(buf, sizeof(buf), " %.17g\n", metric.callback(metric.user_data));
+			} else if (family.type == METRIC_TYPE_COUNTER) {
+				snprintf(buf, sizeof(buf), " %llu\n", (unsigned long long)((CMetricCounter*)metric.metric)->Value());
+			} else {
+				snprintf(buf, sizeof(buf), " %lld\n", (long long)((CMetricGauge*)metric.metric)->Value());
+			}
+			out += buf;
+		}
+	}
+}
+
+void* CMetricsRegistry::_Find(int type, const char* name, const string& labels, bool* conflict)
+{
+	map<string, Family_t>::iterator it = m_family_map.find(name);
+	if (it == m_family_map.end()) {
+		return NULL;
+	}
+
+	// 冲突时调用者拿到的是一个不导出的对象, 只打日志, 不影响业务
+	if (it->second.type != type) {
+		log("metric %s registered with a different type, the new one is not exported", name);
+		*conflict = true;
+		return NULL;
+	}
+
+	vector<Metric_t>& metric_list = it->second.metric_list;
+	for (vector<Metric_t>::iterator it_metric = metric_list.begin(); it_metric != metric_list.end(); it_metric++) {
+		if (it_metric->labels == labels) {
+			if (!it_metric->metric) {
+				log("metric %s{%s} registered as a callback, the new one is not exported", name, labels.c_str());
+				*conflict = true;
+			}
+			return it_metric->metric;
+		}
+	}
+
+	return NULL;
+}
+
+void CMetricsRegistry::_Add(int type, const char* name, const char* help, const string& labels,
+		void* metric, metric_callback_t callback, void* user_data)
+{
+	Family_t& family = m_family_map[name];
+	if (family.metric_list.empty()) {
+		family.type = type;
+		family.help = help;
+	}
+
+	Metric_t item;
+	item.labels = labels;
+	item.metric = metric;
+	item.callback = callback;
+	item.user_data = user_data;
+	family.metric_list.push_back(item);
+}
+
+void CMetricsRegistry::_ExportHistogram(const string& name, const Metric_t& metric, string& out)
+{
+	CMetricHistogram* histogram = (CMetricHistogram*)metric.metric;
+	uint32_t bound_cnt = histogram->GetBoundCount();
+	double scale = histogram->GetScale();
+	uint64_t buckets[METRICS_MAX_BUCKETS + 1];
+	uint64_t sum = 0, count = 0;
+	histogram->GetValue(buckets, &sum, &count);
+	(void)count;
+
+	string prefix = metric.labels.empty() ? "" : metric.labels + ",";
+	char buf[256];
+	uint64_t cumulative = 0;
+	for (uint32_t i = 0; i <= bound_cnt; i++) {
+		cumulative += buckets[i];
+		if (i < bound_cnt) {
+			snprintf(buf, sizeof(buf), "_bucket{%sle=\"%g\"} %llu\n", prefix.c_str(),
+					histogram->GetBound(i) / scale, (unsigned long long)cumulative);
+		} else {
+			snprintf(buf, sizeof(buf), "_bucket{%sle=\"+Inf\"} %llu\n", prefix.c_str(), (unsigned long long)cumulative);
+		}
+		out += name + buf;
+	}
+
+	string labels = metric.labels.empty() ? "" : "{" + metric.labels + "}";
+	snprintf(buf, sizeof(buf), "_sum%s %.6f\n", labels.c_str(), sum / scale);
+	out += name + buf;
+	// +Inf桶必须等于count
+	snprintf(buf, sizeof(buf), "_count%s %llu\n", labels.c_str(), (unsigned long long)cumulative);
+	out += name + buf;
+}
@@ -0,0 +1,164 @@
+/*
+ * Metrics.h
+ *
+ * 进程内的运行指标: 计数器(counter), 仪表(gauge), 固定分桶的直方图(histogram)
+ * 1. 热点路径上只有原子加, 不加锁; 计数器和直方图按线程分片, 每个线程第一次使用时分到一个槽,
+ *    槽按cache line对齐, 多个线程同时累加时不会争用同一个cache line, 读取时把所有分片加起来
+ * 2. 指标按 名字+标签 注册到CMetricsRegistry, 重复注册返回同一个对象; 对象注册后不再释放,
+ *    调用者可以把指针保存在静态变量或成员变量里, 只有注册和导出时加锁
+ * 3. 已有的统计(队列长度, 连接数等)不用改成指标对象, 用AddCallback在导出时取值
+ * 4. 导出为Prometheus文本格式, 由MetricsServer在本地端口上提供 GET /metrics
+ *
+ * 延迟统一用微秒记录, 导出时换算成秒(Prometheus的惯例)
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include "ostype.h"
+#include "Lock.h"
+#include <string>
+#include <vector>
+#include <map>
+using namespace std;
+
+#define METRICS_SHARD_CNT		16		// 每个计数器/直方图的分片数, 线程数超过时多个线程共用一个分片
+#define METRICS_MAX_BUCKETS		24		// 直方图最多的桶数(不含+Inf)
+#define METRICS_CACHE_LINE		64
+
+enum {
+	METRIC_TYPE_COUNTER = 0,
+	METRIC_TYPE_GAUGE,
+	METRIC_TYPE_HISTOGRAM,
+};
+
+// 导出时调用, 在导出的线程(某个reactor)里执行, 不能阻塞
+typedef double (*metric_callback_t)(void* user_data);
+
+// 单调时钟, 微秒
+uint64_t metrics_now_us();
+// 拼一个Prometheus标签, 如 pool="teamtalk_slave", 值里的引号和反斜杠会被转义
+string metrics_label(const char* name, const string& value);
+
+class CMetricCounter
+{
+public:
+	CMetricCounter();
+
+	void Inc(uint64_t n = 1);
+	uint64_t Value();
+private:
+	struct {
+		volatile uint64_t	value;
+		char				pad[METRICS_CACHE_LINE - sizeof(uint64_t)];
+	} m_shards[METRICS_SHARD_CNT];
+};
+
+// 只有一个值, 可增可减, 用于连接数、排队数等
+class CMetricGauge
+{
+public:
+	CMetricGauge() : m_value(0) {}
+
+	void Set(int64_t value) { m_value = value; }
+	void Add(int64_t n) { (void)__sync_add_and_fetch(&m_value, n); }
+	void Sub(int64_t n) { (void)__sync_sub_and_fetch(&m_value, n); }
+	int64_t Value() { return m_value; }
+private:
+	volatile int64_t	m_value;
+};
+
+class CMetricHistogram
+{
+public:
+	// bounds为递增的桶上界, 超过最后一个上界的值落在+Inf桶里; scale为导出时的除数
+	CMetricHistogram(const uint64_t* bounds, uint32_t bound_cnt, double scale);
+
+	void Observe(uint64_t value);
+
+	uint32_t GetBoundCount() { return m_bound_cnt; }
+	uint64_t GetBound(uint32_t idx) { return m_bounds[idx]; }
+	double GetScale() { return m_scale; }
+	// buckets的大小为GetBoundCount()+1, 每个桶各自的个数(非累计), 最后一个是+Inf
+	void GetValue(uint64_t* buckets, uint64_t* sum, uint64_t* count);
+private:
+	typedef struct {
+		volatile uint64_t	buckets[METRICS_MAX_BUCKETS + 1];
+		volatile uint64_t	sum;
+		volatile uint64_t	count;
+		uint64_t			pad[(METRICS_CACHE_LINE - (METRICS_MAX_BUCKETS + 3) * 8 % METRICS_CACHE_LINE) / 8];
+	} Shard_t;
+
+	uint64_t	m_bounds[METRICS_MAX_BUCKETS];
+	uint32_t	m_bound_cnt;
+	double		m_scale;
+	Shard_t		m_shards[METRICS_SHARD_CNT];
+};
+
+/*
+ * 按16位的key(如命令号)分开的一组直方图, 标签为 label_name="0x0301";
+ * key第一次出现时注册, 之后是无锁的两级查表
+ */
+class CMetricHistogramMap
+{
+public:
+	// 延迟直方图, 用默认的分桶
+	CMetricHistogramMap(const char* name, const char* help, const char* label_name);
+	~CMetricHistogramMap();
+
+	CMetricHistogram* Get(uint16_t key);
+private:
+	string					m_name;
+	string					m_help;
+	string					m_label_name;
+	CMetricHistogram* volatile*	volatile m_pages[256];
+};
+
+class CMetricsRegistry
+{
+public:
+	static CMetricsRegistry* getInstance();
+
+	// labels是metrics_label()拼好的标签, 多个标签用逗号分开, 可以为空
+	CMetricCounter* GetCounter(const char* name, const char* help, const string& labels = "");
+	CMetricGauge* GetGauge(const char* name, const char* help, const string& labels = "");
+	CMetricHistogram* GetHistogram(const char* name, const char* help, const string& labels,
+			const uint64_t* bounds, uint32_t bound_cnt, double scale);
+	// 微秒记录, 按秒导出, 分桶从50us到10s
+	CMetricHistogram* GetLatencyHistogram(const char* name, const char* help, const string& labels = "");
+
+	// type为METRIC_TYPE_COUNTER或METRIC_TYPE_GAUGE
+	void AddCallback(int type, const char* name, const char* help, const string& labels,
+			metric_callback_t callback, void* user_data);
+
+	// Prometheus文本格式(text/plain; version=0.0.4)
+	void Export(string& out);
+private:
+	CMetricsRegistry() {}
+
+	typedef struct {
+		string				labels;
+		void*				metric;
+		metric_callback_t	callback;
+		void*				user_data;
+	} Metric_t;
+
+	typedef struct {
+		int					type;
+		string				help;
+		vector<Metric_t>	metric_list;
+	} Family_t;
+
+	// 同名同标签已经注册过的对象; 类型不同, 或者已经注册成回调时返回NULL并置conflict
+	void* _Find(int type, const char* name, const string& labels, bool* conflict);
+	void _Add(int type, const char* name, const char* help, const string& labels,
+			void* metric, metric_callback_t callback, void* user_data);
+	void _ExportHistogram(const string& name, const Metric_t& metric, string& out);
+private:
+	static CMetricsRegistry* volatile	s_instance;
+
+	CLock						m_lock;
+	map<string, Family_t>		m_family_map;	// 按名字排序, 导出的顺序固定
+};
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,190 @@
+/*
+ * MetricsServer.cpp
+ */
+
+#include "netlib.h"
+#include "util.h"
+#include "Metrics.h"
+#include "MetricsServer.h"
+
+#define METRICS_MAX_REQUEST_SIZE	8192
+
+// 连接的回调都在连接所属的reactor里执行, 连接之间不共享数据, 不需要加锁
+class CMetricsConn
+{
+public:
+	CMetricsConn(net_handle_t handle) : m_handle(handle), m_send_offset(0), m_responded(false) {}
+
+	void OnRead();
+	void OnWrite();
+	void Close();
+private:
+	void _HandleRequest();
+	void _Send();
+private:
+	net_handle_t	m_handle;
+	string			m_request;
+	string			m_response;
+	size_t			m_send_offset;
+	bool			m_responded;
+};
+
+static void metrics_conn_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+	NOTUSED_ARG(handle);
+	NOTUSED_ARG(pParam);
+
+	CMetricsConn* pConn = (CMetricsConn*)callback_data;
+	switch (msg)
+	{
+	case NETLIB_MSG_READ:
+		pConn->OnRead();
+		break;
+	case NETLIB_MSG_WRITE:
+		pConn->OnWrite();
+		break;
+	case NETLIB_MSG_CLOSE:
+		pConn->Close();
+		break;
+	default:
+		log("!!!metrics_conn_callback error msg: %d ", msg);
+		break;
+	}
+}
+
+// 关闭后同一轮epoll里可能还有这个socket的其他事件, 换成空回调, 不再访问已经释放的连接
+static void metrics_closed_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+	NOTUSED_ARG(callback_data);
+	NOTUSED_ARG(msg);
+	NOTUSED_ARG(handle);
+	NOTUSED_ARG(pParam);
+}
+
+static void metrics_listen_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+	NOTUSED_ARG(callback_data);
+	NOTUSED_ARG(pParam);
+
+	if (msg == NETLIB_MSG_CONNECT)
+	{
+		CMetricsConn* pConn = new CMetricsConn(handle);
+		netlib_option(handle, NETLIB_OPT_SET_CALLBACK, (void*)metrics_conn_callback);
+		netlib_option(handle, NETLIB_OPT_SET_CALLBACK_DATA, (void*)pConn);
+	}
+	else
+	{
+		log("!!!error msg: %d ", msg);
+	}
+}
+
+void CMetricsConn::OnRead()
+{
+	char buf[1024];
+	for (;;)
+	{
+		int ret = netlib_recv(m_handle, buf, sizeof(buf));
+		if (ret <= 0)
+			break;
+
+		m_request.append(buf, ret);
+	}
+
+	if (m_responded)
+		return;
+
+	if (m_request.find("\r\n\r\n") != string::npos)
+	{
+		_HandleRequest();
+	}
+	else if (m_request.size() > METRICS_MAX_REQUEST_SIZE)
+	{
+		log("metrics request too large, close the connection");
+		Close();
+	}
+}
+
+void CMetricsConn::OnWrite()
+{
+	if (m_responded)
+		_Send();
+}
+
+void CMetricsConn::Close()
+{
+	netlib_option(m_handle, NETLIB_OPT_SET_CALLBACK, (void*)metrics_closed_callback);
+	netlib_option(m_handle, NETLIB_OPT_SET_CALLBACK_DATA, NULL);
+	netlib_close(m_handle);
+	delete this;
+}
+
+void CMetricsConn::_HandleRequest()
+{
+	m_responded = true;
+
+	string body;
+	const char* status = "200 OK";
+	if (m_request.compare(0, 13, "GET /metrics ") == 0 || m_request.compare(0, 14, "GET /metrics?") == 0)
+	{
+		CMetricsRegistry::getInstance()->Export(body);
+	}
+	else
+	{
+		status = "404 Not Found";
+		body = "not found, try /metrics\n";
+	}
+
+	char header[256];
+	snprintf(header, sizeof(header), "HTTP/1.1 %s\r\n"
+			"Connection: close\r\n"
+			"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+			"Content-Length: %u\r\n\r\n", status, (uint32_t)body.size());
+	m_response = header;
+	m_response += body;
+	_Send();
+}
+
+void CMetricsConn::_Send()
+{
+	while (m_send_offset < m_response.size())
+	{
+		int ret = netlib_send(m_handle, (void*)(m_response.data() + m_send_offset), (int)(m_response.size() - m_send_offset));
+		if (ret < 0)
+			break;
+		if (ret == 0)
+			return;		// 发送缓冲区满了, 等NETLIB_MSG_WRITE
+
+		m_send_offset += ret;
+	}
+
+	Close();
+}
+
+/*
+ * 各服务的配置文件里用同样的两项:
+ *   MetricsPort 没有配置或者为0时不监听, 服务照常启动
+ *   MetricsListenIP 没有配置时只监听127.0.0.1, 改成外网地址前要确认抓取程序以外的人访问不到
+ */
+int metrics_server_init(CConfigFileReader* config_file)
+{
+	char* str_port = config_file->GetConfigName("MetricsPort");
+	char* listen_ip = config_file->GetConfigName("MetricsListenIP");
+	uint16_t port = str_port ? (uint16_t)atoi(str_port) : 0;
+	if (port == 0)
+	{
+		log("MetricsPort not configured, metrics server disabled");
+		return 0;
+	}
+
+	if (!listen_ip)
+		listen_ip = (char*)"127.0.0.1";
+
+	if (netlib_listen(listen_ip, port, metrics_listen_callback, NULL) == NETLIB_ERROR)
+	{
+		log("metrics server listen on %s:%d failed", listen_ip, port);
+		return -1;
+	}
+
+	log("metrics server listen on %s:%d", listen_ip, port);
+	return 0;
+}
@@ -0,0 +1,18 @@
+/*
+ * MetricsServer.h
+ *
+ * 在本地端口上以HTTP提供 GET /metrics, 内容是CMetricsRegistry导出的Prometheus文本格式
+ * 每个请求一个短连接, 应答发完后关闭, 只给抓取程序用, 不要监听在外网地址上
+ *
+ * 配置项MetricsListenIP/MetricsPort写在各个服务自己的配置文件里, 含义见metrics_server_init
+ */
+
+#ifndef METRICSSERVER_H_
+#define METRICSSERVER_H_
+
+#include "ConfigFileReader.h"
+
+// 在netlib_init()之后调用, 没有配置端口时返回0, 监听失败返回-1
+int metrics_server_init(CConfigFileReader* config_file);
+
+#endif /* METRICSSERVER_H_ */
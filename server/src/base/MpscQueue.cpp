@@ -0,0 +1,71 @@
+/*
+ * MpscQueue.cpp
+ */
+
+#include "MpscQueue.h"
+#include "atomic.h"
+
+CMpscQueue::CMpscQueue()
+{
+	m_head = &m_stub;
+	m_tail = &m_stub;
+	m_size = 0;
+}
+
+CMpscQueue::~CMpscQueue()
+{
+	CMpscNode* pNode = NULL;
+	while ((pNode = Pop()) != NULL) {
+		delete pNode;
+	}
+}
+
+void CMpscQueue::Push(CMpscNode* pNode)
+{
+	pNode->m_next = NULL;
+	__sync_synchronize();	// 先写完节点内容再发布
+	CMpscNode* pPrev = __sync_lock_test_and_set(&m_head, pNode);
+	// 交换和链接之间消费者看到的是断开的链表, Pop会返回NULL等待下次通知
+	pPrev->m_next = pNode;
+
+	if (pNode != &m_stub) {
+		ATOMIC_ADD(&m_size, 1);
+	}
+}
+
+CMpscNode* CMpscQueue::Pop()
+{
+	CMpscNode* pTail = m_tail;
+	CMpscNode* pNext = pTail->m_next;
+
+	// 跳过哨兵节点
+	if (pTail == &m_stub) {
+		if (!pNext)
+			return NULL;
+
+		m_tail = pNext;
+		pTail = pNext;
+		pNext = pNext->m_next;
+	}
+
+	if (pNext) {
+		m_tail = pNext;
+		ATOMIC_SUB_AND_FETCH(&m_size, 1);
+		return pTail;
+	}
+
+	if (pTail != m_head)
+		return NULL;	// 有生产者还没链接完
+
+	// 只剩最后一个节点, 重新放回哨兵节点才能把它取出来
+	Push(&m_stub);
+
+	pNext = pTail->m_next;
+	if (pNext) {
+		m_tail = pNext;
+		ATOMIC_SUB_AND_FETCH(&m_size, 1);
+		return pTail;
+	}
+
+	return NULL;
+}
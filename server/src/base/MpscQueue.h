@@ -0,0 +1,46 @@
+/*
+ * MpscQueue.h
+ *
+ * 多生产者单消费者的无锁队列(侵入式, Vyukov算法):
+ * 1. 任意线程Push, 只做一次原子交换, 不加锁也不分配内存
+ * 2. 只有一个消费者线程(一般是reactor线程)Pop, 按Push的顺序出队
+ * 3. 元素需要继承CMpscNode, 出队后由消费者负责释放
+ */
+
+#ifndef MPSCQUEUE_H_
+#define MPSCQUEUE_H_
+
+#include "ostype.h"
+
+class CMpscNode
+{
+public:
+	CMpscNode() : m_next(NULL) {}
+	virtual ~CMpscNode() {}
+
+	CMpscNode* volatile	m_next;
+};
+
+class CMpscQueue
+{
+public:
+	CMpscQueue();
+	~CMpscQueue();
+
+	// 任意线程调用
+	void Push(CMpscNode* pNode);
+
+	// 只能在消费者线程调用, 队列为空返回NULL;
+	// 某个生产者正在Push时也可能暂时返回NULL, 它Push完成后会再通知消费者
+	CMpscNode* Pop();
+
+	// 近似值, 只用于统计
+	uint32_t GetSize() { return (uint32_t)m_size; }
+private:
+	CMpscNode* volatile	m_head;		// 生产者修改
+	CMpscNode*			m_tail;		// 消费者修改
+	CMpscNode			m_stub;
+	volatile long		m_size;
+};
+
+#endif /* MPSCQUEUE_H_ */
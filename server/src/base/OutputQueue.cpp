@@ -0,0 +1,236 @@
+/*
+ * OutputQueue.cpp
+ */
+
+#include <unistd.h>
+#include "OutputQueue.h"
+#include "Metrics.h"
+
+// 字节, 连接生命期内发送队列的峰值
+static const uint64_t g_peak_bytes_bounds[] = {
+	0, 1024, 4096, 16384, 65536, 262144, 1048576, 4194304, 16777216
+};
+
+// 所有连接发送队列里还没发出去的字节数
+static CMetricGauge* get_pending_bytes_gauge()
+{
+	static CMetricGauge* s_gauge = CMetricsRegistry::getInstance()->GetGauge("teamtalk_conn_out_queue_bytes",
+			"bytes waiting in the output queues of all connections");
+	return s_gauge;
+}
+
+static CMetricHistogram* get_peak_bytes_histogram()
+{
+	static CMetricHistogram* s_histogram = CMetricsRegistry::getInstance()->GetHistogram("teamtalk_conn_out_queue_peak_bytes",
+			"peak output queue size of each closed connection", "",
+			g_peak_bytes_bounds, sizeof(g_peak_bytes_bounds) / sizeof(g_peak_bytes_bounds[0]), 1);
+	return s_histogram;
+}
+
+CSharedBuffer::CSharedBuffer(const void* data, uint32_t len)
+{
+	m_len = len;
+	m_data = new uchar_t [len > 0 ? len : 1];
+	if (data && len > 0)
+	{
+		memcpy(m_data, data, len);
+	}
+}
+
+CSharedBuffer::~CSharedBuffer()
+{
+	delete [] m_data;
+}
+
+CSharedFile::~CSharedFile()
+{
+	if (m_fd != -1)
+	{
+		close(m_fd);
+	}
+}
+
+//////////////////////////
+COutputQueue::COutputQueue()
+{
+	m_pending_bytes = 0;
+	m_peak_pending_bytes = 0;
+	m_queued_bytes = 0;
+	m_queued_segments = 0;
+	m_sent_bytes = 0;
+}
+
+COutputQueue::~COutputQueue()
+{
+	Clear();
+	get_peak_bytes_histogram()->Observe(m_peak_pending_bytes);
+}
+
+void COutputQueue::Append(CSharedBuffer* pBuf, uint32_t offset)
+{
+	if (offset >= pBuf->GetLength())
+		return;
+
+	Segment_t seg;
+	seg.pBuf = pBuf;
+	seg.offset = offset;
+	seg.pFile = NULL;
+	seg.file_offset = 0;
+	seg.file_remain = 0;
+	pBuf->AddRef();
+	m_seg_list.push_back(seg);
+
+	uint32_t len = pBuf->GetLength() - offset;
+	m_pending_bytes += len;
+	if (m_pending_bytes > m_peak_pending_bytes)
+		m_peak_pending_bytes = m_pending_bytes;
+	m_queued_bytes += len;
+	m_queued_segments++;
+	get_pending_bytes_gauge()->Add(len);
+}
+
+void COutputQueue::Append(const void* data, uint32_t len)
+{
+	if (len == 0)
+		return;
+
+	CSharedBuffer* pBuf = new CSharedBuffer(data, len);
+	Append(pBuf);
+	pBuf->ReleaseRef();
+}
+
+void COutputQueue::Append(CSharedFile* pFile, uint64_t offset, uint32_t len)
+{
+	if (len == 0)
+		return;
+
+	Segment_t seg;
+	seg.pBuf = NULL;
+	seg.offset = 0;
+	seg.pFile = pFile;
+	seg.file_offset = offset;
+	seg.file_remain = len;
+	pFile->AddRef();
+	m_seg_list.push_back(seg);
+
+	m_pending_bytes += len;
+	if (m_pending_bytes > m_peak_pending_bytes)
+		m_peak_pending_bytes = m_pending_bytes;
+	m_queued_bytes += len;
+	m_queued_segments++;
+	get_pending_bytes_gauge()->Add(len);
+}
+
+// 返回sendfile发出的字节数, 出错返回-1
+int COutputQueue::_FlushFile(net_handle_t handle, Segment_t& seg, uint32_t send_size)
+{
+	// sendfile自己推进file_offset
+	int ret = netlib_sendfile(handle, seg.pFile->GetFd(), &seg.file_offset, send_size);
+	if (ret <= 0)
+		return ret;
+
+	seg.file_remain -= ret;
+	m_sent_bytes += ret;
+	m_pending_bytes -= ret;
+	get_pending_bytes_gauge()->Sub(ret);
+	return ret;
+}
+
+int COutputQueue::Flush(net_handle_t handle)
+{
+	netlib_iovec_t iov[NETLIB_MAX_IOV_CNT];
+	int total = 0;
+
+	while (!m_seg_list.empty())
+	{
+		if (m_seg_list.front().pBuf == NULL)
+		{
+			// 和netlib_send一样, 单次最多发送NETLIB_MAX_SOCKET_BUF_SIZE字节
+			Segment_t& seg = m_seg_list.front();
+			uint32_t send_size = seg.file_remain;
+			if (send_size > NETLIB_MAX_SOCKET_BUF_SIZE)
+				send_size = NETLIB_MAX_SOCKET_BUF_SIZE;
+
+			int ret = _FlushFile(handle, seg, send_size);
+			if (ret < 0)
+				return (total > 0) ? total : -1;
+			if (ret == 0)
+				break;
+
+			total += ret;
+			if (seg.file_remain == 0)
+			{
+				seg.pFile->ReleaseRef();
+				m_seg_list.pop_front();
+			}
+			if ((uint32_t)ret < send_size)
+				break;	// socket发送缓冲区满了
+			continue;
+		}
+
+		int iov_cnt = 0;
+		uint32_t iov_bytes = 0;
+		for (list<Segment_t>::iterator it = m_seg_list.begin(); it != m_seg_list.end() && iov_cnt < NETLIB_MAX_IOV_CNT; it++)
+		{
+			// 和netlib_send一样, 单次最多发送NETLIB_MAX_SOCKET_BUF_SIZE字节
+			if (iov_bytes >= NETLIB_MAX_SOCKET_BUF_SIZE)
+				break;
+			// 文件数据块不能放进writev, 等前面的发完再单独sendfile
+			if (it->pBuf == NULL)
+				break;
+
+			iov[iov_cnt].base = it->pBuf->GetBuffer() + it->offset;
+			iov[iov_cnt].len = it->pBuf->GetLength() - it->offset;
+			iov_bytes += iov[iov_cnt].len;
+			iov_cnt++;
+		}
+
+		int ret = netlib_sendv(handle, iov, iov_cnt);
+		if (ret < 0)
+			return (total > 0) ? total : -1;
+		if (ret == 0)
+			break;
+
+		total += ret;
+		m_sent_bytes += ret;
+		m_pending_bytes -= ret;
+		get_pending_bytes_gauge()->Sub(ret);
+
+		// 释放已经发完的数据块, 最后一块可能只发了一部分
+		uint32_t remain = ret;
+		while (remain > 0)
+		{
+			Segment_t& seg = m_seg_list.front();
+			uint32_t seg_len = seg.pBuf->GetLength() - seg.offset;
+			if (remain < seg_len)
+			{
+				seg.offset += remain;
+				break;
+			}
+
+			remain -= seg_len;
+			seg.pBuf->ReleaseRef();
+			m_seg_list.pop_front();
+		}
+
+		if ((uint32_t)ret < iov_bytes)
+			break;	// socket发送缓冲区满了
+	}
+
+	return total;
+}
+
+void COutputQueue::Clear()
+{
+	for (list<Segment_t>::iterator it = m_seg_list.begin(); it != m_seg_list.end(); it++)
+	{
+		if (it->pBuf)
+			it->pBuf->ReleaseRef();
+		else
+			it->pFile->ReleaseRef();
+	}
+
+	m_seg_list.clear();
+	get_pending_bytes_gauge()->Sub(m_pending_bytes);
+	m_pending_bytes = 0;
+}
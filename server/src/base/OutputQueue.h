@@ -0,0 +1,87 @@
+/*
+ * OutputQueue.h
+ *
+ * 连接的发送队列: 由引用计数的只读数据块组成, 用netlib_sendv()一次发送多个数据块,
+ * 同一个数据包序列化一次后可以挂到任意多个连接的队列里而不需要拷贝;
+ * 也可以排队文件里的一段, 发送时用netlib_sendfile()直接从内核发出, 不读到用户态
+ */
+
+#ifndef OUTPUTQUEUE_H_
+#define OUTPUTQUEUE_H_
+
+#include "netlib.h"
+#include "util.h"
+
+// 创建后内容不再修改, 引用计数是原子操作, 可以在reactor线程之间传递
+class CSharedBuffer : public CRefObject
+{
+public:
+	CSharedBuffer(const void* data, uint32_t len);
+	virtual ~CSharedBuffer();
+
+	uchar_t* GetBuffer() { return m_data; }
+	uint32_t GetLength() { return m_len; }
+private:
+	uchar_t*	m_data;
+	uint32_t	m_len;
+};
+
+// 引用计数的文件描述符, 最后一个引用释放时close, 文件数据块排队期间文件不会被关闭
+class CSharedFile : public CRefObject
+{
+public:
+	CSharedFile(int fd) { m_fd = fd; }
+	virtual ~CSharedFile();
+
+	int GetFd() { return m_fd; }
+private:
+	int		m_fd;
+};
+
+class COutputQueue
+{
+public:
+	COutputQueue();
+	~COutputQueue();
+
+	bool IsEmpty() { return m_seg_list.empty(); }
+
+	// 从pBuf的offset处开始排队, 只增加引用计数
+	void Append(CSharedBuffer* pBuf, uint32_t offset = 0);
+	// 拷贝一份数据排队
+	void Append(const void* data, uint32_t len);
+	// 排队pFile从offset开始的len字节, 只增加引用计数
+	void Append(CSharedFile* pFile, uint64_t offset, uint32_t len);
+
+	// 尽量把队列里的数据发出去, 返回发送的字节数, 出错返回-1
+	int Flush(net_handle_t handle);
+	void Clear();
+
+	uint32_t GetPendingBytes() { return m_pending_bytes; }
+	uint32_t GetPendingSegments() { return (uint32_t)m_seg_list.size(); }
+	uint64_t GetQueuedBytes() { return m_queued_bytes; }
+	uint64_t GetQueuedSegments() { return m_queued_segments; }
+	uint64_t GetSentBytes() { return m_sent_bytes; }
+	uint32_t GetPeakPendingBytes() { return m_peak_pending_bytes; }
+private:
+	typedef struct {
+		CSharedBuffer*	pBuf;			// 为NULL时是文件数据块
+		uint32_t		offset;
+		CSharedFile*	pFile;
+		uint64_t		file_offset;	// 文件里下一个要发送的位置
+		uint32_t		file_remain;
+	} Segment_t;
+
+	int _FlushFile(net_handle_t handle, Segment_t& seg, uint32_t send_size);
+
+	list<Segment_t>	m_seg_list;
+
+	// 统计信息, 用于监控慢连接
+	uint32_t		m_pending_bytes;
+	uint32_t		m_peak_pending_bytes;
+	uint64_t		m_queued_bytes;		// 累计排队的字节数
+	uint64_t		m_queued_segments;	// 累计排队的数据块数
+	uint64_t		m_sent_bytes;		// 累计从队列里发出的字节数
+};
+
+#endif /* OUTPUTQUEUE_H_ */
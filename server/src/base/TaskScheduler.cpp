@@ -0,0 +1,399 @@
+/*
+ * TaskScheduler.cpp
+ */
+
+#include "util.h"
+#include "atomic.h"
+#include "TaskScheduler.h"
+#include "Metrics.h"
+
+// 导出时从调度器已有的统计里取值, 入队和执行的路径上不再额外计数
+static double task_pending_callback(void* user_data)
+{
+	TaskSchedulerStat_t stat;
+	((CTaskScheduler*)user_data)->GetStat(&stat);
+	return (double)stat.pending_cnt;
+}
+
+static double task_execute_callback(void* user_data)
+{
+	TaskSchedulerStat_t stat;
+	((CTaskScheduler*)user_data)->GetStat(&stat);
+	return (double)stat.execute_cnt;
+}
+
+static double task_steal_callback(void* user_data)
+{
+	TaskSchedulerStat_t stat;
+	((CTaskScheduler*)user_data)->GetStat(&stat);
+	return (double)stat.steal_cnt;
+}
+
+///////////
+CTaskWorker::CTaskWorker()
+{
+	m_scheduler = NULL;
+	m_thread_idx = 0;
+	m_started = false;
+	m_running = false;
+	m_sleeping = 0;
+	m_top = 0;
+	m_bottom = 0;
+	m_stealable_cnt = 0;
+	m_pinned_cnt = 0;
+	m_execute_cnt = 0;
+	m_steal_cnt = 0;
+}
+
+CTaskWorker::~CTaskWorker()
+{
+	Stop();
+
+	CTask* pTask = NULL;
+	while ((pTask = _DequeTake()) != NULL) {
+		delete pTask;
+	}
+
+	for (list<CTask*>::iterator it = m_inbox_list.begin(); it != m_inbox_list.end(); it++) {
+		delete *it;
+	}
+
+	for (list<CTask*>::iterator it = m_pinned_list.begin(); it != m_pinned_list.end(); it++) {
+		delete *it;
+	}
+}
+
+void* CTaskWorker::StartRoutine(void* arg)
+{
+	CTaskWorker* pWorker = (CTaskWorker*)arg;
+
+	pWorker->Execute();
+
+	return NULL;
+}
+
+void CTaskWorker::Start(CTaskScheduler* pScheduler, uint32_t idx)
+{
+	m_scheduler = pScheduler;
+	m_thread_idx = idx;
+	m_running = true;
+	if (pthread_create(&m_thread_id, NULL, StartRoutine, this) == 0) {
+		m_started = true;
+	} else {
+		log("create task worker failed, idx=%u", idx);
+	}
+}
+
+void CTaskWorker::Stop()
+{
+	if (!m_started)
+		return;
+
+	m_running = false;
+	Wakeup();
+	pthread_join(m_thread_id, NULL);
+	m_started = false;
+}
+
+void CTaskWorker::Execute()
+{
+	while (m_running) {
+		bool stolen = false;
+		CTask* pTask = _GetLocalTask();
+		if (!pTask) {
+			pTask = m_scheduler->StealTask(m_thread_idx);
+			stolen = (pTask != NULL);
+		}
+
+		if (!pTask) {
+			m_thread_notify.Lock();
+			m_sleeping = 1;
+			__sync_synchronize();
+			// 先标记睡眠再检查队列, 提交任务时先入队再检查m_sleeping, 两边配合不会丢失唤醒
+			while (m_running && !_HasLocalTask() && !m_scheduler->HasStealableTask(m_thread_idx)) {
+				m_thread_notify.Wait();
+			}
+			m_sleeping = 0;
+			m_thread_notify.Unlock();
+			continue;
+		}
+
+		pTask->run();
+
+		delete pTask;
+
+		ATOMIC_ADD(&m_execute_cnt, 1);
+		if (stolen) {
+			ATOMIC_ADD(&m_steal_cnt, 1);
+		}
+	}
+}
+
+bool CTaskWorker::PushTask(CTask* pTask, bool pinned)
+{
+	m_inbox_lock.lock();
+	if (pinned) {
+		m_pinned_list.push_back(pTask);
+		ATOMIC_ADD(&m_pinned_cnt, 1);
+	} else {
+		m_inbox_list.push_back(pTask);
+		ATOMIC_ADD(&m_stealable_cnt, 1);
+	}
+	m_inbox_lock.unlock();
+
+	__sync_synchronize();
+	if (m_sleeping) {
+		Wakeup();
+		return true;
+	}
+
+	return false;
+}
+
+CTask* CTaskWorker::StealTask()
+{
+	CTask* pTask = _DequeTake();
+	if (!pTask) {
+		// 本线程正在执行一个慢任务, 还没来得及把新任务移到m_deque
+		m_inbox_lock.lock();
+		if (!m_inbox_list.empty()) {
+			pTask = m_inbox_list.front();
+			m_inbox_list.pop_front();
+		}
+		m_inbox_lock.unlock();
+	}
+
+	if (pTask) {
+		ATOMIC_SUB_AND_FETCH(&m_stealable_cnt, 1);
+	}
+
+	return pTask;
+}
+
+void CTaskWorker::Wakeup()
+{
+	m_thread_notify.Lock();
+	m_thread_notify.Signal();
+	m_thread_notify.Unlock();
+}
+
+void CTaskWorker::GetStat(TaskSchedulerStat_t* pStat)
+{
+	pStat->pending_cnt = ATOMIC_FETCH(&m_stealable_cnt) + ATOMIC_FETCH(&m_pinned_cnt);
+	pStat->execute_cnt = ATOMIC_FETCH(&m_execute_cnt);
+	pStat->steal_cnt = ATOMIC_FETCH(&m_steal_cnt);
+}
+
+CTask* CTaskWorker::_GetLocalTask()
+{
+	CTask* pTask = NULL;
+
+	// 带亲和性的任务只有本线程能执行, 优先处理
+	if (m_pinned_cnt > 0) {
+		m_inbox_lock.lock();
+		if (!m_pinned_list.empty()) {
+			pTask = m_pinned_list.front();
+			m_pinned_list.pop_front();
+		}
+		m_inbox_lock.unlock();
+
+		if (pTask) {
+			ATOMIC_SUB_AND_FETCH(&m_pinned_cnt, 1);
+			return pTask;
+		}
+	}
+
+	pTask = _DequeTake();
+	if (!pTask) {
+		_RefillDeque();
+		pTask = _DequeTake();
+	}
+
+	if (pTask) {
+		ATOMIC_SUB_AND_FETCH(&m_stealable_cnt, 1);
+	}
+
+	return pTask;
+}
+
+bool CTaskWorker::_HasLocalTask()
+{
+	return (m_pinned_cnt > 0) || (m_stealable_cnt > 0);
+}
+
+void CTaskWorker::_RefillDeque()
+{
+	m_inbox_lock.lock();
+	while (!m_inbox_list.empty() && _DequePush(m_inbox_list.front())) {
+		m_inbox_list.pop_front();
+	}
+	m_inbox_lock.unlock();
+}
+
+bool CTaskWorker::_DequePush(CTask* pTask)
+{
+	long bottom = m_bottom;
+	long top = m_top;
+	if (bottom - top >= TASK_DEQUE_SIZE)
+		return false;
+
+	m_deque[bottom & TASK_DEQUE_MASK] = pTask;
+	__sync_synchronize();	// 先写任务再发布m_bottom
+	m_bottom = bottom + 1;
+	return true;
+}
+
+CTask* CTaskWorker::_DequeTake()
+{
+	for (;;) {
+		long top = m_top;
+		__sync_synchronize();
+		long bottom = m_bottom;
+		if (top >= bottom)
+			return NULL;
+
+		// m_top只增不减, CAS成功说明这个槽在读取之后没有被覆盖
+		CTask* pTask = m_deque[top & TASK_DEQUE_MASK];
+		if (__sync_bool_compare_and_swap(&m_top, top, top + 1))
+			return pTask;
+	}
+}
+
+//////////////
+CTaskScheduler::CTaskScheduler()
+{
+	m_worker_size = 0;
+	m_worker_list = NULL;
+	m_next_worker = 0;
+}
+
+CTaskScheduler::~CTaskScheduler()
+{
+	Destory();
+}
+
+int CTaskScheduler::Init(uint32_t worker_size, const char* name)
+{
+	if (worker_size == 0) {
+		return 1;
+	}
+
+	m_worker_size = worker_size;
+	m_worker_list = new CTaskWorker [m_worker_size];
+	if (!m_worker_list) {
+		return 1;
+	}
+
+	for (uint32_t i = 0; i < m_worker_size; i++) {
+		m_worker_list[i].Start(this, i);
+	}
+
+	CMetricsRegistry* pRegistry = CMetricsRegistry::getInstance();
+	string labels = metrics_label("pool", name);
+	pRegistry->AddCallback(METRIC_TYPE_GAUGE, "teamtalk_task_queue_depth", "tasks waiting in the worker pool",
+			labels, task_pending_callback, this);
+	pRegistry->AddCallback(METRIC_TYPE_COUNTER, "teamtalk_task_executed_total", "tasks executed by the worker pool",
+			labels, task_execute_callback, this);
+	pRegistry->AddCallback(METRIC_TYPE_COUNTER, "teamtalk_task_stolen_total", "tasks stolen from another worker's queue",
+			labels, task_steal_callback, this);
+
+	return 0;
+}
+
+void CTaskScheduler::Destory()
+{
+	if (m_worker_list) {
+		// 先停掉所有线程, 避免析构时还有线程在偷任务
+		for (uint32_t i = 0; i < m_worker_size; i++) {
+			m_worker_list[i].Stop();
+		}
+
+		delete [] m_worker_list;
+		m_worker_list = NULL;
+	}
+
+	m_worker_size = 0;
+}
+
+void CTaskScheduler::AddTask(CTask* pTask)
+{
+	// 优先交给空闲的线程, 都在忙就轮流分配
+	uint32_t start = (uint32_t)ATOMIC_ADD_AND_FETCH(&m_next_worker, 1) % m_worker_size;
+	uint32_t worker_idx = start;
+	for (uint32_t i = 0; i < m_worker_size; i++) {
+		uint32_t idx = (start + i) % m_worker_size;
+		if (m_worker_list[idx].IsSleeping()) {
+			worker_idx = idx;
+			break;
+		}
+	}
+
+	if (!m_worker_list[worker_idx].PushTask(pTask, false)) {
+		// 目标线程在忙, 叫醒一个空闲线程来偷
+		_WakeupIdleWorker(worker_idx);
+	}
+}
+
+void CTaskScheduler::AddTask(CTask* pTask, uint32_t affinity_key)
+{
+	m_worker_list[affinity_key % m_worker_size].PushTask(pTask, true);
+}
+
+void CTaskScheduler::GetStat(TaskSchedulerStat_t* pStat)
+{
+	pStat->pending_cnt = 0;
+	pStat->execute_cnt = 0;
+	pStat->steal_cnt = 0;
+
+	for (uint32_t i = 0; i < m_worker_size; i++) {
+		TaskSchedulerStat_t stat;
+		m_worker_list[i].GetStat(&stat);
+		pStat->pending_cnt += stat.pending_cnt;
+		pStat->execute_cnt += stat.execute_cnt;
+		pStat->steal_cnt += stat.steal_cnt;
+	}
+}
+
+void CTaskScheduler::GetWorkerStat(uint32_t idx, TaskSchedulerStat_t* pStat)
+{
+	if (idx < m_worker_size) {
+		m_worker_list[idx].GetStat(pStat);
+	}
+}
+
+CTask* CTaskScheduler::StealTask(uint32_t thief_idx)
+{
+	for (uint32_t i = 1; i < m_worker_size; i++) {
+		CTaskWorker* pVictim = &m_worker_list[(thief_idx + i) % m_worker_size];
+		if (!pVictim->HasStealableTask())
+			continue;
+
+		CTask* pTask = pVictim->StealTask();
+		if (pTask)
+			return pTask;
+	}
+
+	return NULL;
+}
+
+bool CTaskScheduler::HasStealableTask(uint32_t thief_idx)
+{
+	for (uint32_t i = 1; i < m_worker_size; i++) {
+		if (m_worker_list[(thief_idx + i) % m_worker_size].HasStealableTask())
+			return true;
+	}
+
+	return false;
+}
+
+void CTaskScheduler::_WakeupIdleWorker(uint32_t except_idx)
+{
+	__sync_synchronize();
+	for (uint32_t i = 1; i < m_worker_size; i++) {
+		CTaskWorker* pWorker = &m_worker_list[(except_idx + i) % m_worker_size];
+		if (pWorker->IsSleeping()) {
+			pWorker->Wakeup();
+			return;
+		}
+	}
+}
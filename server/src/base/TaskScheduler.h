@@ -0,0 +1,112 @@
+/*
+ * TaskScheduler.h
+ *
+ * 工作窃取的任务调度器, 用来代替CThreadPool的随机分配:
+ * 1. 每个工作线程有一个无锁的任务队列, 自己空闲时从其他线程的队列里偷任务,
+ *    一个慢任务(如慢SQL)不会卡住排在它后面的任务
+ * 2. 带亲和性key的任务总是在同一个线程里按提交顺序执行, 不会被偷走
+ * 3. 提供排队深度、执行数、偷取数等统计
+ */
+
+#ifndef TASKSCHEDULER_H_
+#define TASKSCHEDULER_H_
+
+#include "ostype.h"
+#include "Thread.h"
+#include "Task.h"
+#include "Lock.h"
+#include <pthread.h>
+#include <list>
+using namespace std;
+
+#define TASK_DEQUE_SIZE		1024	// 必须是2的幂
+#define TASK_DEQUE_MASK		(TASK_DEQUE_SIZE - 1)
+
+typedef struct {
+	uint64_t	pending_cnt;	// 正在排队的任务数
+	uint64_t	execute_cnt;	// 已经执行完的任务数
+	uint64_t	steal_cnt;		// 从其他线程偷来执行的任务数
+} TaskSchedulerStat_t;
+
+class CTaskScheduler;
+
+class CTaskWorker {
+public:
+	CTaskWorker();
+	~CTaskWorker();
+
+	static void* StartRoutine(void* arg);
+
+	void Start(CTaskScheduler* pScheduler, uint32_t idx);
+	void Stop();
+	void Execute();
+
+	// 外部线程调用, 返回是否唤醒了本线程
+	bool PushTask(CTask* pTask, bool pinned);
+	// 其他工作线程偷任务, 带亲和性的任务不会被偷走
+	CTask* StealTask();
+
+	bool IsSleeping() { return m_sleeping != 0; }
+	bool HasStealableTask() { return m_stealable_cnt > 0; }
+	void Wakeup();
+	void GetStat(TaskSchedulerStat_t* pStat);
+private:
+	CTask* _GetLocalTask();
+	bool _HasLocalTask();
+	void _RefillDeque();
+
+	// 单生产者(本线程)多消费者的无锁环形队列, 消费者通过CAS移动m_top
+	bool _DequePush(CTask* pTask);
+	CTask* _DequeTake();
+private:
+	CTaskScheduler*	m_scheduler;
+	uint32_t		m_thread_idx;
+	pthread_t		m_thread_id;
+	bool			m_started;
+	volatile bool	m_running;
+	volatile long	m_sleeping;
+	CThreadNotify	m_thread_notify;
+
+	volatile long	m_top;
+	volatile long	m_bottom;
+	CTask*			m_deque[TASK_DEQUE_SIZE];
+
+	CLock			m_inbox_lock;
+	list<CTask*>	m_inbox_list;	// 外部线程提交的任务, 由本线程批量移入m_deque
+	list<CTask*>	m_pinned_list;	// 带亲和性key的任务, 只能由本线程执行
+
+	volatile long	m_stealable_cnt;	// m_deque和m_inbox_list里的任务数
+	volatile long	m_pinned_cnt;
+	volatile long	m_execute_cnt;
+	volatile long	m_steal_cnt;
+};
+
+class CTaskScheduler {
+public:
+	CTaskScheduler();
+	virtual ~CTaskScheduler();
+
+	// name用作指标的pool标签, 同一个进程里的调度器不要重名
+	int Init(uint32_t worker_size, const char* name = "default");
+	// 没有顺序要求的任务, 会被空闲线程偷走执行
+	void AddTask(CTask* pTask);
+	// 相同affinity_key(如连接uuid、用户id、会话id)的任务在同一个线程里按提交顺序执行
+	void AddTask(CTask* pTask, uint32_t affinity_key);
+	void Destory();
+
+	uint32_t GetWorkerSize() { return m_worker_size; }
+	void GetStat(TaskSchedulerStat_t* pStat);
+	void GetWorkerStat(uint32_t idx, TaskSchedulerStat_t* pStat);
+
+	// 工作线程调用
+	CTask* StealTask(uint32_t thief_idx);
+	bool HasStealableTask(uint32_t thief_idx);
+private:
+	void _WakeupIdleWorker(uint32_t except_idx);
+private:
+	uint32_t 		m_worker_size;
+	CTaskWorker* 	m_worker_list;
+	volatile long	m_next_worker;
+};
+
+#endif /* TASKSCHEDULER_H_ */
@@ -13,6 +13,8 @@
 CWorkerThread::CWorkerThread()
 {
 	m_task_cnt = 0;
+	m_queue_gauge = NULL;
+	m_execute_counter = NULL;
 }
 
 CWorkerThread::~CWorkerThread()
@@ -29,6 +31,12 @@ void* CWorkerThread::StartRoutine(void* arg)
 	return NULL;
 }
 
+void CWorkerThread::SetMetrics(CMetricGauge* pQueueGauge, CMetricCounter* pExecuteCounter)
+{
+	m_queue_gauge = pQueueGauge;
+	m_execute_counter = pExecuteCounter;
+}
+
 void CWorkerThread::Start()
 {
 	(void)pthread_create(&m_thread_id, NULL, StartRoutine, this);
@@ -47,18 +55,21 @@ void CWorkerThread::Execute()
 		CTask* pTask = m_task_list.front();
 		m_task_list.pop_front();
 		m_thread_notify.Unlock();
+		m_queue_gauge->Sub(1);
 
 		pTask->run();
 
 		delete pTask;
 
 		m_task_cnt++;
+		m_execute_counter->Inc();
 		//log("%d have the execute %d task\n", m_thread_idx, m_task_cnt);
 	}
 }
 
 void CWorkerThread::PushTask(CTask* pTask)
 {
+	m_queue_gauge->Add(1);
 	m_thread_notify.Lock();
 	m_task_list.push_back(pTask);
 	m_thread_notify.Signal();
@@ -77,7 +88,7 @@ CThreadPool::~CThreadPool()
 
 }
 
-int CThreadPool::Init(uint32_t worker_size)
+int CThreadPool::Init(uint32_t worker_size, const char* name)
 {
     m_worker_size = worker_size;
 	m_worker_list = new CWorkerThread [m_worker_size];
@@ -85,7 +96,13 @@ int CThreadPool::Init(uint32_t worker_size)
 		return 1;
 	}
 
+	CMetricsRegistry* pRegistry = CMetricsRegistry::getInstance();
+	string labels = metrics_label("pool", name);
+	CMetricGauge* pQueueGauge = pRegistry->GetGauge("teamtalk_task_queue_depth", "tasks waiting in the worker pool", labels);
+	CMetricCounter* pExecuteCounter = pRegistry->GetCounter("teamtalk_task_executed_total", "tasks executed by the worker pool", labels);
+
 	for (uint32_t i = 0; i < m_worker_size; i++) {
+		m_worker_list[i].SetMetrics(pQueueGauge, pExecuteCounter);
 		m_worker_list[i].SetThreadIdx(i);
 		m_worker_list[i].Start();
 	}
@@ -10,6 +10,7 @@
 #include "ostype.h"
 #include "Thread.h"
 #include "Task.h"
+#include "Metrics.h"
 #include <pthread.h>
 #include <list>
 using namespace std;
@@ -26,6 +27,7 @@ public:
 	void PushTask(CTask* pTask);
 
 	void SetThreadIdx(uint32_t idx) { m_thread_idx = idx; }
+	void SetMetrics(CMetricGauge* pQueueGauge, CMetricCounter* pExecuteCounter);
 private:
 
 	uint32_t		m_thread_idx;
@@ -33,6 +35,9 @@ private:
 	pthread_t		m_thread_id;
 	CThreadNotify	m_thread_notify;
 	list<CTask*>	m_task_list;
+
+	CMetricGauge*	m_queue_gauge;		// 同一个线程池的所有线程共用
+	CMetricCounter*	m_execute_counter;
 };
 
 class CThreadPool {
@@ -40,7 +45,8 @@ public:
 	CThreadPool();
 	virtual ~CThreadPool();
 
-	int Init(uint32_t worker_size);
+	// name用作指标的pool标签
+	int Init(uint32_t worker_size, const char* name = "default");
 	void AddTask(CTask* pTask);
 	void Destory();
 private:
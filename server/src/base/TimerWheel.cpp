@@ -0,0 +1,262 @@
+#include "TimerWheel.h"
+#include "util.h"
+
+CWheelTimer::CWheelTimer()
+{
+	prev = next = NULL;
+	m_wheel = NULL;
+	m_expire_tick = 0;
+	m_interval = 0;
+	m_callback = NULL;
+	m_user_data = NULL;
+}
+
+CWheelTimer::~CWheelTimer()
+{
+	Cancel();
+}
+
+void CWheelTimer::Init(callback_t callback, void* user_data)
+{
+	m_callback = callback;
+	m_user_data = user_data;
+}
+
+void CWheelTimer::Cancel()
+{
+	if (m_wheel)
+	{
+		m_wheel->CancelTimer(this);
+	}
+}
+
+//////////////////////////////
+CTimerWheel::CTimerWheel()
+{
+	m_curr_tick = get_tick_count();
+	m_timer_cnt = 0;
+
+	for (int i = 0; i < TVR_SIZE; i++)
+	{
+		_ListInit(&m_tv1[i]);
+	}
+
+	for (int level = 0; level < TVN_LEVEL; level++)
+	{
+		for (int i = 0; i < TVN_SIZE; i++)
+		{
+			_ListInit(&m_tvn[level][i]);
+		}
+	}
+}
+
+CTimerWheel::~CTimerWheel()
+{
+	// 还在时间轮里的定时器属于使用者, 只需要把它们摘下来
+	for (int i = 0; i < TVR_SIZE; i++)
+	{
+		while (!_ListEmpty(&m_tv1[i]))
+		{
+			CancelTimer((CWheelTimer*)m_tv1[i].next);
+		}
+	}
+
+	for (int level = 0; level < TVN_LEVEL; level++)
+	{
+		for (int i = 0; i < TVN_SIZE; i++)
+		{
+			while (!_ListEmpty(&m_tvn[level][i]))
+			{
+				CancelTimer((CWheelTimer*)m_tvn[level][i].next);
+			}
+		}
+	}
+}
+
+void CTimerWheel::AddTimer(CWheelTimer* pTimer, uint64_t delay, uint64_t interval)
+{
+	if (pTimer->m_wheel)
+	{
+		pTimer->m_wheel->CancelTimer(pTimer);
+	}
+
+	pTimer->m_expire_tick = get_tick_count() + delay;
+	pTimer->m_interval = interval;
+	pTimer->m_wheel = this;
+	_AddTimer(pTimer);
+	m_timer_cnt++;
+}
+
+void CTimerWheel::CancelTimer(CWheelTimer* pTimer)
+{
+	if (pTimer->m_wheel != this)
+		return;
+
+	_ListDel(pTimer);
+	pTimer->m_wheel = NULL;
+	m_timer_cnt--;
+}
+
+void CTimerWheel::Expire(uint64_t curr_tick)
+{
+	TimerListNode_t work_list;
+
+	while (m_curr_tick <= curr_tick)
+	{
+		// 没有定时器时直接跳到当前时间, 避免长时间空转后逐个tick追赶
+		if (m_timer_cnt == 0)
+		{
+			m_curr_tick = curr_tick + 1;
+			break;
+		}
+
+		uint32_t idx = m_curr_tick & TVR_MASK;
+		if (idx == 0)
+		{
+			// 低一级转完一圈, 把高一级当前槽里的定时器重新分配到低级
+			for (int level = 0; level < TVN_LEVEL; level++)
+			{
+				uint32_t n = (m_curr_tick >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK;
+				_Cascade(&m_tvn[level][n]);
+				if (n != 0)
+					break;
+			}
+		}
+
+		_ListInit(&work_list);
+		_ListMove(&m_tv1[idx], &work_list);
+		m_curr_tick++;
+
+		// 回调里可能取消或删除work_list里的其他定时器, 所以每次只取第一个
+		while (!_ListEmpty(&work_list))
+		{
+			CWheelTimer* pTimer = (CWheelTimer*)work_list.next;
+			_ListDel(pTimer);
+			m_timer_cnt--;
+
+			if (pTimer->m_interval)
+			{
+				pTimer->m_expire_tick += pTimer->m_interval;
+				if (pTimer->m_expire_tick <= curr_tick)
+				{
+					pTimer->m_expire_tick = curr_tick + pTimer->m_interval;
+				}
+				_AddTimer(pTimer);
+				m_timer_cnt++;
+			}
+			else
+			{
+				pTimer->m_wheel = NULL;
+			}
+
+			// 回调之后不再访问pTimer, 它可能已经随使用者一起被删除
+			pTimer->m_callback(pTimer->m_user_data, NETLIB_MSG_TIMER, 0, pTimer);
+		}
+	}
+}
+
+int64_t CTimerWheel::GetNextTimeout(uint64_t curr_tick)
+{
+	if (m_timer_cnt == 0)
+		return -1;
+
+	// 第一级里没有定时器时, 在下一次cascade的时候醒来重新计算
+	uint64_t next_tick = (m_curr_tick & TVR_MASK) ? ((m_curr_tick | TVR_MASK) + 1) : m_curr_tick;
+	for (uint64_t tick = m_curr_tick; tick < next_tick; tick++)
+	{
+		if (!_ListEmpty(&m_tv1[tick & TVR_MASK]))
+		{
+			next_tick = tick;
+			break;
+		}
+	}
+
+	if (next_tick <= curr_tick)
+		return 0;
+
+	return (int64_t)(next_tick - curr_tick);
+}
+
+void CTimerWheel::_AddTimer(CWheelTimer* pTimer)
+{
+	uint64_t expires = pTimer->m_expire_tick;
+	TimerListNode_t* pSlot = NULL;
+
+	if (expires < m_curr_tick)
+	{
+		// 已经过期的放到下一个要处理的槽里
+		pSlot = &m_tv1[m_curr_tick & TVR_MASK];
+	}
+	else if (expires - m_curr_tick < TVR_SIZE)
+	{
+		pSlot = &m_tv1[expires & TVR_MASK];
+	}
+	else
+	{
+		uint64_t idx = expires - m_curr_tick;
+		if (idx > 0xffffffffULL)
+		{
+			// 超出时间轮范围的先挂在最高一级, cascade时会按真实到期时间重新分配
+			expires = m_curr_tick + 0xffffffffULL;
+			idx = 0xffffffffULL;
+		}
+
+		int level = 0;
+		while (level < TVN_LEVEL - 1 && idx >= (1ULL << (TVR_BITS + (level + 1) * TVN_BITS)))
+		{
+			level++;
+		}
+
+		pSlot = &m_tvn[level][(expires >> (TVR_BITS + level * TVN_BITS)) & TVN_MASK];
+	}
+
+	_ListAdd(pSlot, pTimer);
+}
+
+void CTimerWheel::_Cascade(TimerListNode_t* pSlot)
+{
+	TimerListNode_t tmp_list;
+	_ListInit(&tmp_list);
+	_ListMove(pSlot, &tmp_list);
+
+	while (!_ListEmpty(&tmp_list))
+	{
+		CWheelTimer* pTimer = (CWheelTimer*)tmp_list.next;
+		_ListDel(pTimer);
+		_AddTimer(pTimer);
+	}
+}
+
+void CTimerWheel::_ListInit(TimerListNode_t* pHead)
+{
+	pHead->prev = pHead->next = pHead;
+}
+
+void CTimerWheel::_ListAdd(TimerListNode_t* pHead, TimerListNode_t* pNode)
+{
+	// 加到链表尾部
+	pNode->prev = pHead->prev;
+	pNode->next = pHead;
+	pHead->prev->next = pNode;
+	pHead->prev = pNode;
+}
+
+void CTimerWheel::_ListDel(TimerListNode_t* pNode)
+{
+	pNode->prev->next = pNode->next;
+	pNode->next->prev = pNode->prev;
+	pNode->prev = pNode->next = NULL;
+}
+
+void CTimerWheel::_ListMove(TimerListNode_t* pFromHead, TimerListNode_t* pToHead)
+{
+	if (_ListEmpty(pFromHead))
+		return;
+
+	// pToHead必须是空链表
+	pToHead->next = pFromHead->next;
+	pToHead->prev = pFromHead->prev;
+	pToHead->next->prev = pToHead;
+	pToHead->prev->next = pToHead;
+	_ListInit(pFromHead);
+}
@@ -0,0 +1,82 @@
+/*
+ * A hierarchical timing wheel, features include:
+ * 1. O(1) add/cancel: timers are intrusive nodes owned by the caller, cancel never searches
+ * 2. 5 levels (256 + 4 * 64 slots) with 1 millisecond tick, covers 2^32 ms
+ * 3. not thread safe: each CEventDispatch owns one and only touches it in its own thread
+ */
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include "ostype.h"
+
+#define TVR_BITS	8
+#define TVN_BITS	6
+#define TVR_SIZE	(1 << TVR_BITS)
+#define TVN_SIZE	(1 << TVN_BITS)
+#define TVR_MASK	(TVR_SIZE - 1)
+#define TVN_MASK	(TVN_SIZE - 1)
+#define TVN_LEVEL	4
+
+class CTimerWheel;
+
+typedef struct TimerListNode {
+	struct TimerListNode*	prev;
+	struct TimerListNode*	next;
+} TimerListNode_t;
+
+// 定时器节点, 一般作为成员变量嵌在使用者对象里, 析构时自动取消
+class CWheelTimer : public TimerListNode_t
+{
+public:
+	CWheelTimer();
+	~CWheelTimer();
+
+	// callback(user_data, NETLIB_MSG_TIMER, 0, this)
+	void Init(callback_t callback, void* user_data);
+	void Cancel();
+	bool IsPending() { return m_wheel != NULL; }
+	uint64_t GetExpireTick() { return m_expire_tick; }
+private:
+	friend class CTimerWheel;
+
+	CTimerWheel*	m_wheel;		// 不为NULL表示已经在时间轮里
+	uint64_t		m_expire_tick;
+	uint64_t		m_interval;		// 0表示只触发一次
+	callback_t		m_callback;
+	void*			m_user_data;
+};
+
+class CTimerWheel
+{
+public:
+	CTimerWheel();
+	virtual ~CTimerWheel();
+
+	// delay毫秒后触发, interval不为0时周期触发; 已经在时间轮里的定时器会被重新调度
+	void AddTimer(CWheelTimer* pTimer, uint64_t delay, uint64_t interval = 0);
+	void CancelTimer(CWheelTimer* pTimer);
+
+	// 执行所有到期的定时器
+	void Expire(uint64_t curr_tick);
+
+	// 距离下一个定时器到期还有多少毫秒, 没有定时器返回-1
+	int64_t GetNextTimeout(uint64_t curr_tick);
+
+	uint32_t GetTimerCount() { return m_timer_cnt; }
+private:
+	void _AddTimer(CWheelTimer* pTimer);
+	void _Cascade(TimerListNode_t* pSlot);
+
+	static void _ListInit(TimerListNode_t* pHead);
+	static void _ListAdd(TimerListNode_t* pHead, TimerListNode_t* pNode);
+	static void _ListDel(TimerListNode_t* pNode);
+	static void _ListMove(TimerListNode_t* pFromHead, TimerListNode_t* pToHead);
+	static bool _ListEmpty(TimerListNode_t* pHead) { return pHead->next == pHead; }
+private:
+	uint64_t			m_curr_tick;	// 下一个要处理的tick
+	uint32_t			m_timer_cnt;
+	TimerListNode_t		m_tv1[TVR_SIZE];
+	TimerListNode_t		m_tvn[TVN_LEVEL][TVN_SIZE];
+};
+
+#endif
@@ -0,0 +1,88 @@
+/*
+ * UserStatCodec.cpp
+ *
+ */
+
+#include "UserStatCodec.h"
+#include <algorithm>
+
+struct UserStatLess {
+	bool operator()(const user_stat_t& lhs, const user_stat_t& rhs) const
+	{
+		if (lhs.user_id != rhs.user_id)
+			return lhs.user_id < rhs.user_id;
+		return lhs.client_type < rhs.client_type;
+	}
+};
+
+static uchar_t* write_varint(uchar_t* pos, uint32_t value)
+{
+	while (value >= 0x80) {
+		*pos++ = (uchar_t)(value | 0x80);
+		value >>= 7;
+	}
+	*pos++ = (uchar_t)value;
+	return pos;
+}
+
+static bool read_varint(const uchar_t*& pos, const uchar_t* end, uint32_t& value)
+{
+	value = 0;
+	for (uint32_t shift = 0; shift < 35; shift += 7) {
+		if (pos >= end)
+			return false;
+
+		uint32_t byte = *pos++;
+		value |= (byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+void encode_user_stat_list(vector<user_stat_t>& user_list, string& out)
+{
+	sort(user_list.begin(), user_list.end(), UserStatLess());
+
+	// 每项最多5+5个字节, 先按最大长度分配, 写完再截断
+	out.resize(5 + user_list.size() * 10);
+	uchar_t* start = (uchar_t*)&out[0];
+	uchar_t* pos = write_varint(start, user_list.size());
+
+	uint32_t last_user_id = 0;
+	for (vector<user_stat_t>::iterator it = user_list.begin(); it != user_list.end(); it++) {
+		pos = write_varint(pos, it->user_id - last_user_id);
+		pos = write_varint(pos, (it->client_type << 2) | (it->status & 0x03));
+		last_user_id = it->user_id;
+	}
+	out.resize(pos - start);
+}
+
+bool decode_user_stat_list(const string& data, vector<user_stat_t>& user_list)
+{
+	const uchar_t* pos = (const uchar_t*)data.data();
+	const uchar_t* end = pos + data.size();
+
+	uint32_t user_cnt = 0;
+	if (!read_varint(pos, end, user_cnt))
+		return false;
+
+	// 个数是对端给的, 不能直接按它分配内存, 每项至少2个字节
+	user_list.reserve(user_list.size() + min((size_t)user_cnt, (size_t)(end - pos) / 2));
+
+	uint32_t user_id = 0;
+	for (uint32_t i = 0; i < user_cnt; i++) {
+		uint32_t delta = 0, type_status = 0;
+		if (!read_varint(pos, end, delta) || !read_varint(pos, end, type_status))
+			return false;
+
+		user_id += delta;
+		user_stat_t user_stat;
+		user_stat.user_id = user_id;
+		user_stat.status = type_status & 0x03;
+		user_stat.client_type = type_status >> 2;
+		user_list.push_back(user_stat);
+	}
+
+	return pos == end;
+}
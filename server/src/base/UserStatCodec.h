@@ -0,0 +1,25 @@
+/*
+ * UserStatCodec.h
+ *
+ * msg_server连上route_server时上报的在线用户全量列表(IMOnlineUserInfo.user_stat_data)的编码:
+ * 按(user_id, client_type)排序, 开头是varint的个数, 每一项是
+ *   varint(user_id - 上一项的user_id) + varint(client_type << 2 | status)
+ * user_id一般是连续分配的, 差值多数1~2个字节, 一项约3个字节;
+ * 逐项的ServerUserStat每项十几个字节, 而且解析时每项都要分配一个子消息
+ */
+
+#ifndef USERSTATCODEC_H_
+#define USERSTATCODEC_H_
+
+#include "ostype.h"
+#include "public_define.h"
+#include <string>
+#include <vector>
+using namespace std;
+
+// user_list会被排序
+void encode_user_stat_list(vector<user_stat_t>& user_list, string& out);
+// 数据不完整或者格式不对时返回false, user_list里是已经解出来的部分
+bool decode_user_stat_list(const string& data, vector<user_stat_t>& user_list);
+
+#endif /* USERSTATCODEC_H_ */
@@ -67,6 +67,57 @@ uint32_t CSimpleBuffer::Read(void* buf, uint32_t len)
 	return len;
 }
 
+////// CReadBuffer //////
+CReadBuffer::CReadBuffer()
+{
+	m_buffer = NULL;
+	m_alloc_size = 0;
+	m_read_offset = 0;
+	m_write_offset = 0;
+}
+
+CReadBuffer::~CReadBuffer()
+{
+	if (m_buffer)
+	{
+		free(m_buffer);
+		m_buffer = NULL;
+	}
+}
+
+void CReadBuffer::EnsureWritable(uint32_t len)
+{
+	if (GetWritableSize() >= len)
+		return;
+
+	uint32_t readable = GetReadableSize();
+	if (m_read_offset > 0)
+	{
+		// 一批数据包处理完后通常只剩下不到一个包
+		memmove(m_buffer, m_buffer + m_read_offset, readable);
+		m_read_offset = 0;
+		m_write_offset = readable;
+		if (GetWritableSize() >= len)
+			return;
+	}
+
+	m_alloc_size = m_write_offset + len;
+	m_alloc_size += m_alloc_size >> 2;	// increase by 1/4 allocate size
+	m_buffer = (uchar_t*)realloc(m_buffer, m_alloc_size);
+}
+
+void CReadBuffer::Consume(uint32_t len)
+{
+	if (len > GetReadableSize())
+		len = GetReadableSize();
+
+	m_read_offset += len;
+	if (m_read_offset == m_write_offset)
+	{
+		m_read_offset = m_write_offset = 0;
+	}
+}
+
 ////// CByteStream //////
 CByteStream::CByteStream(uchar_t* buf, uint32_t len)
 {
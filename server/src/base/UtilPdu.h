@@ -83,6 +83,31 @@ private:
 	uint32_t	m_write_offset;
 };
 
+/*
+ * 连接的读缓冲区: 读走的数据只移动读指针, 不做memmove;
+ * 只有尾部空间不够时才把剩下的半个包挪到头部, 数据包在缓冲区里始终是连续的
+ */
+class DLL_MODIFIER CReadBuffer
+{
+public:
+	CReadBuffer();
+	~CReadBuffer();
+	uchar_t* GetReadPtr() { return m_buffer + m_read_offset; }
+	uint32_t GetReadableSize() { return m_write_offset - m_read_offset; }
+	uchar_t* GetWritePtr() { return m_buffer + m_write_offset; }
+	uint32_t GetWritableSize() { return m_alloc_size - m_write_offset; }
+	void IncWriteOffset(uint32_t len) { m_write_offset += len; }
+
+	// 保证至少有len字节可写, 优先压缩已读部分, 不够再扩容
+	void EnsureWritable(uint32_t len);
+	void Consume(uint32_t len);
+private:
+	uchar_t*	m_buffer;
+	uint32_t	m_alloc_size;
+	uint32_t	m_read_offset;
+	uint32_t	m_write_offset;
+};
+
 class CByteStream
 {
 public:
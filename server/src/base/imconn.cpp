@@ -6,13 +6,55 @@
  */
 
 #include "imconn.h"
+#include "EventDispatch.h"
+#include "Metrics.h"
 
 //static uint64_t g_send_pkt_cnt = 0;		// 发送数据包总数
 //static uint64_t g_recv_pkt_cnt = 0;		// 接收数据包总数
 
+// 多reactor时, 业务逻辑都在主reactor里执行, 其他reactor只负责收发数据和拆包
+static CRWLock g_conn_map_lock;
+
+typedef struct {
+	ConnMap_t*		conn_map;
+	net_handle_t	handle;
+	CImConn*		pConn;
+	CImPdu*			pPdu;
+	uint8_t			msg;
+} ImConnEvent_t;
+
+typedef struct {
+	CImConn*		pConn;
+	CSharedBuffer*	pBuf;
+	CSharedFile*	pFile;		// 不为NULL时pBuf之后还要sendfile文件的一段
+	uint64_t		file_offset;
+	uint32_t		file_len;
+} ImConnSend_t;
+
+// 按命令号统计HandlePdu()的耗时
+static CMetricHistogramMap g_pdu_handle_metrics("teamtalk_pdu_handle_seconds",
+		"time spent in CImConn::HandlePdu by command id", "cmd");
+
+static void imconn_handle_pdu(CImConn* pConn, CImPdu* pPdu)
+{
+	uint16_t command_id = pPdu->GetCommandId();
+	uint64_t start_us = metrics_now_us();
+	pConn->HandlePdu(pPdu);
+	g_pdu_handle_metrics.Get(command_id)->Observe(metrics_now_us() - start_us);
+}
+
+static bool imconn_in_main_reactor()
+{
+	return (netlib_get_reactor_count() == 1) || (netlib_current_reactor() == 0);
+}
+
 static CImConn* FindImConn(ConnMap_t* imconn_map, net_handle_t handle)
 {
 	CImConn* pConn = NULL;
+	bool need_lock = (netlib_get_reactor_count() > 1);
+	if (need_lock)
+		g_conn_map_lock.rlock();
+
 	ConnMap_t::iterator iter = imconn_map->find(handle);
 	if (iter != imconn_map->end())
 	{
@@ -20,9 +62,81 @@ static CImConn* FindImConn(ConnMap_t* imconn_map, net_handle_t handle)
 		pConn->AddRef();
 	}
 
+	if (need_lock)
+		g_conn_map_lock.unlock();
 	return pConn;
 }
 
+void imconn_map_add(ConnMap_t* conn_map, net_handle_t handle, CImConn* pConn)
+{
+	CAutoRWLock autoLock(&g_conn_map_lock, false);
+	conn_map->insert(make_pair(handle, pConn));
+}
+
+void imconn_map_del(ConnMap_t* conn_map, net_handle_t handle)
+{
+	CAutoRWLock autoLock(&g_conn_map_lock, false);
+	conn_map->erase(handle);
+}
+
+// run in main reactor
+static void imconn_event_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+	ImConnEvent_t* pEvent = (ImConnEvent_t*)callback_data;
+
+	// 投递过来之前连接可能已经在主reactor里被关闭了
+	CImConn* pConn = FindImConn(pEvent->conn_map, pEvent->handle);
+	if (pConn && pConn == pEvent->pConn)
+	{
+		switch (pEvent->msg)
+		{
+		case NETLIB_MSG_CONFIRM:
+			pConn->OnConfirm();
+			break;
+		case NETLIB_MSG_READ:
+			try
+			{
+				imconn_handle_pdu(pConn, pEvent->pPdu);
+			} catch (CPduException& ex) {
+				log("!!!catch exception, sid=%u, cid=%u, err_code=%u, err_msg=%s, close the connection ",
+						ex.GetServiceId(), ex.GetCommandId(), ex.GetErrorCode(), ex.GetErrorMsg());
+				pConn->OnClose();
+			}
+			break;
+		case NETLIB_MSG_CLOSE:
+			pConn->OnClose();
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (pConn)
+		pConn->ReleaseRef();
+	pEvent->pConn->ReleaseRef();
+	if (pEvent->pPdu)
+		delete pEvent->pPdu;
+	delete pEvent;
+}
+
+// run in the connection's reactor
+static void imconn_send_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+	ImConnSend_t* pSend = (ImConnSend_t*)callback_data;
+	if (pSend->pFile)
+	{
+		pSend->pConn->SendFile(pSend->pBuf, pSend->pFile, pSend->file_offset, pSend->file_len);
+		pSend->pFile->ReleaseRef();
+	}
+	else
+	{
+		pSend->pConn->SendBuffer(pSend->pBuf);
+	}
+	pSend->pConn->ReleaseRef();
+	pSend->pBuf->ReleaseRef();
+	delete pSend;
+}
+
 void imconn_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
 {
 	NOTUSED_ARG(handle);
@@ -36,6 +150,9 @@ void imconn_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pP
 	if (!pConn)
 		return;
 
+	pConn->SetConnMap(conn_map);
+	bool in_main = imconn_in_main_reactor();
+
 	//log("msg=%d, handle=%d ", msg, handle);
 	//当时写回调时，NETLIB_MSG_WRITE，所以走pConn->OnWrite分支，
 	//接着由于多态调用CImConn的子类CProxyConn的OnWrite()函数，
@@ -43,7 +160,10 @@ void imconn_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pP
 	switch (msg)
 	{
 	case NETLIB_MSG_CONFIRM:
-		pConn->OnConfirm();
+		if (in_main)
+			pConn->OnConfirm();
+		else
+			pConn->PostToMainReactor(msg, NULL);
 		break;
 	case NETLIB_MSG_READ:
 		pConn->OnRead();
@@ -52,7 +172,10 @@ void imconn_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pP
 		pConn->OnWrite();
 		break;
 	case NETLIB_MSG_CLOSE:
-		pConn->OnClose();
+		if (in_main)
+			pConn->OnClose();
+		else
+			pConn->PostToMainReactor(msg, NULL);
 		break;
 	default:
 		log("!!!imconn_callback error msg: %d ", msg);
@@ -70,6 +193,13 @@ CImConn::CImConn()
 	m_busy = false;
 	m_handle = NETLIB_INVALID_HANDLE;
 	m_recv_bytes = 0;
+	m_conn_map = NULL;
+	m_reactor_idx = -1;
+
+	for (int i = 0; i < IMCONN_TIMER_CNT; i++)
+	{
+		m_timers[i].Init(_TimerCallback, this);
+	}
 
 	m_last_send_tick = m_last_recv_tick = get_tick_count();
 }
@@ -79,18 +209,98 @@ CImConn::~CImConn()
 	//log("CImConn::~CImConn, handle=%d ", m_handle);
 }
 
-int CImConn::Send(void* data, int len)
+void CImConn::PostToMainReactor(uint8_t msg, CImPdu* pPdu)
 {
-	//发送数据的时候，先记录一下发送数据的时间
-	m_last_send_tick = get_tick_count();
-//	++g_send_pkt_cnt;
+	ImConnEvent_t* pEvent = new ImConnEvent_t;
+	pEvent->conn_map = m_conn_map;
+	pEvent->handle = m_handle;
+	pEvent->pConn = this;
+	pEvent->pPdu = pPdu;
+	pEvent->msg = msg;
+
+	AddRef();
+	netlib_post_task(0, imconn_event_callback, pEvent);
+}
 
-	if (m_busy)
+void CImConn::SetTimer(uint32_t timer_type, uint64_t delay, uint64_t interval)
+{
+	if (timer_type >= IMCONN_TIMER_CNT)
+		return;
+
+	// 重新调度已经在时间轮里的定时器时引用不变
+	if (!m_timers[timer_type].IsPending())
+		AddRef();
+
+	CEventDispatch::GetReactor(0)->GetTimerWheel()->AddTimer(&m_timers[timer_type], delay, interval);
+}
+
+void CImConn::KillTimer(uint32_t timer_type)
+{
+	if (timer_type >= IMCONN_TIMER_CNT || !m_timers[timer_type].IsPending())
+		return;
+
+	m_timers[timer_type].Cancel();
+	ReleaseRef();
+}
+
+void CImConn::KillAllTimers()
+{
+	// 最后一个ReleaseRef()可能释放this
+	AddRef();
+	for (uint32_t i = 0; i < IMCONN_TIMER_CNT; i++)
 	{
-		m_out_buf.Write(data, len);
-		return len;
+		KillTimer(i);
 	}
+	ReleaseRef();
+}
+
+// run in main reactor
+void CImConn::_TimerCallback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+	CImConn* pConn = (CImConn*)callback_data;
+	CWheelTimer* pTimer = (CWheelTimer*)pParam;
+	uint32_t timer_type = pTimer - pConn->m_timers;
+
+	// 一次性定时器触发后已经不在时间轮里, 它持有的引用在这里释放
+	bool release_timer_ref = !pTimer->IsPending();
+
+	pConn->AddRef();
+	pConn->OnTimerExpire(timer_type, get_tick_count());
+	if (release_timer_ref)
+		pConn->ReleaseRef();
+	pConn->ReleaseRef();
+}
+
+bool CImConn::_IsInOwnerReactor()
+{
+	if (netlib_get_reactor_count() == 1)
+		return true;
+
+	// 连接不会在reactor之间迁移, 查一次即可
+	if (m_reactor_idx < 0)
+		m_reactor_idx = netlib_get_reactor(m_handle);
+
+	// socket已经关闭, 走原来的流程
+	return (m_reactor_idx < 0) || (m_reactor_idx == netlib_current_reactor());
+}
 
+// pBuf和pFile的引用随之转移
+void CImConn::_PostSend(CSharedBuffer* pBuf, CSharedFile* pFile, uint64_t file_offset, uint32_t file_len)
+{
+	ImConnSend_t* pSend = new ImConnSend_t;
+	pSend->pConn = this;
+	pSend->pBuf = pBuf;
+	pSend->pFile = pFile;
+	pSend->file_offset = file_offset;
+	pSend->file_len = file_len;
+
+	AddRef();
+	netlib_post_task(m_reactor_idx, imconn_send_callback, pSend);
+}
+
+// 返回直接发出去的字节数
+int CImConn::_SendDirect(uchar_t* data, int len)
+{
 	int offset = 0;
 	int remain = len;
 	//先尝试发送，能发多少是多少
@@ -109,12 +319,35 @@ int CImConn::Send(void* data, int len)
 		offset += ret;
 		remain -= ret;
 	}
-	//有剩余没有发送完毕，放入该连接的发送缓冲区中，并将m_busy值为true，下一个来的直接写到缓冲区
-	if (remain > 0)
+
+	return offset;
+}
+
+int CImConn::Send(void* data, int len)
+{
+	//发送数据的时候，先记录一下发送数据的时间
+	m_last_send_tick = get_tick_count();
+//	++g_send_pkt_cnt;
+
+	if (!_IsInOwnerReactor())
+	{
+		_PostSend(new CSharedBuffer(data, len));
+		return len;
+	}
+
+	if (m_busy)
+	{
+		m_out_queue.Append(data, len);
+		return len;
+	}
+
+	int offset = _SendDirect((uchar_t*)data, len);
+	//有剩余没有发送完毕，放入该连接的发送队列中，并将m_busy值为true，下一个来的直接排队
+	if (offset < len)
 	{
-		m_out_buf.Write((char*)data + offset, remain);
+		m_out_queue.Append((uchar_t*)data + offset, len - offset);
 		m_busy = true;
-		log("send busy, remain=%d ", m_out_buf.GetWriteOffset());
+		log("send busy, remain=%d ", m_out_queue.GetPendingBytes());
 	}
     else
     {
@@ -124,15 +357,94 @@ int CImConn::Send(void* data, int len)
 	return len;
 }
 
+int CImConn::SendBuffer(CSharedBuffer* pBuf)
+{
+	int len = (int)pBuf->GetLength();
+	m_last_send_tick = get_tick_count();
+
+	if (!_IsInOwnerReactor())
+	{
+		pBuf->AddRef();
+		_PostSend(pBuf);
+		return len;
+	}
+
+	if (m_busy)
+	{
+		m_out_queue.Append(pBuf);
+		return len;
+	}
+
+	int offset = _SendDirect(pBuf->GetBuffer(), len);
+	if (offset < len)
+	{
+		m_out_queue.Append(pBuf, offset);
+		m_busy = true;
+		log("send busy, remain=%d ", m_out_queue.GetPendingBytes());
+	}
+    else
+    {
+        OnWriteCompelete();
+    }
+
+	return len;
+}
+
+int CImConn::SendFile(CSharedBuffer* pHead, CSharedFile* pFile, uint64_t offset, uint32_t len)
+{
+	uint32_t head_len = pHead->GetLength();
+	m_last_send_tick = get_tick_count();
+
+	if (!_IsInOwnerReactor())
+	{
+		pHead->AddRef();
+		pFile->AddRef();
+		_PostSend(pHead, pFile, offset, len);
+		return head_len + len;
+	}
+
+	if (m_busy)
+	{
+		m_out_queue.Append(pHead);
+		m_out_queue.Append(pFile, offset, len);
+		return head_len + len;
+	}
+
+	uint32_t head_sent = _SendDirect(pHead->GetBuffer(), head_len);
+	uint32_t remain = len;
+	while (head_sent == head_len && remain > 0)
+	{
+		uint32_t send_size = (remain > NETLIB_MAX_SOCKET_BUF_SIZE) ? NETLIB_MAX_SOCKET_BUF_SIZE : remain;
+		// sendfile自己推进offset
+		int ret = netlib_sendfile(m_handle, pFile->GetFd(), &offset, send_size);
+		if (ret <= 0)
+			break;
+
+		remain -= ret;
+	}
+
+	if (head_sent < head_len || remain > 0)
+	{
+		m_out_queue.Append(pHead, head_sent);
+		m_out_queue.Append(pFile, offset, remain);
+		m_busy = true;
+		log("send busy, remain=%d ", m_out_queue.GetPendingBytes());
+	}
+	else
+	{
+		OnWriteCompelete();
+	}
+
+	return head_len + len;
+}
+
 void CImConn::OnRead()
 {
 	for (;;)
 	{
-		uint32_t free_buf_len = m_in_buf.GetAllocSize() - m_in_buf.GetWriteOffset();
-		if (free_buf_len < READ_BUF_SIZE)
-			m_in_buf.Extend(READ_BUF_SIZE);
+		m_in_buf.EnsureWritable(READ_BUF_SIZE);
 
-		int ret = netlib_recv(m_handle, m_in_buf.GetBuffer() + m_in_buf.GetWriteOffset(), READ_BUF_SIZE);
+		int ret = netlib_recv(m_handle, m_in_buf.GetWritePtr(), READ_BUF_SIZE);
 		if (ret <= 0)
 			break;
 
@@ -143,29 +455,36 @@ void CImConn::OnRead()
 	}
 
 
-    CImPdu* pPdu = NULL;
+    bool in_main = imconn_in_main_reactor();
+    uint32_t pdu_len = 0;
 	try
     {
-		while ( ( pPdu = CImPdu::ReadPdu(m_in_buf.GetBuffer(), m_in_buf.GetWriteOffset()) ) )
+		while (CImPdu::IsPduAvailable(m_in_buf.GetReadPtr(), m_in_buf.GetReadableSize(), pdu_len))
 		{
-            uint32_t pdu_len = pPdu->GetLength();
-            
+            // 直接在读缓冲区上解析, 不再为每个包new一个CImPdu并拷贝数据
+            CImPduView pdu(m_in_buf.GetReadPtr(), pdu_len);
+
+            if (!in_main) {
+                // 数据包交给主reactor处理, 需要脱离读缓冲区
+                CImPdu* pPdu = pdu.Retain();
+                m_in_buf.Consume(pdu_len);
+                PostToMainReactor(NETLIB_MSG_READ, pPdu);
+                continue;
+            }
+
 			//所有的连接都会继承CImConn，重写CImConn的HandlePdu函数，接受数据包
-			HandlePdu(pPdu);
+			imconn_handle_pdu(this, &pdu);
 
-			m_in_buf.Read(NULL, pdu_len);
-			delete pPdu;
-            pPdu = NULL;
+			m_in_buf.Consume(pdu_len);
 //			++g_recv_pkt_cnt;
 		}
 	} catch (CPduException& ex) {
 		log("!!!catch exception, sid=%u, cid=%u, err_code=%u, err_msg=%s, close the connection ",
 				ex.GetServiceId(), ex.GetCommandId(), ex.GetErrorCode(), ex.GetErrorMsg());
-        if (pPdu) {
-            delete pPdu;
-            pPdu = NULL;
-        }
-        OnClose();
+        if (in_main)
+            OnClose();
+        else
+            PostToMainReactor(NETLIB_MSG_CLOSE, NULL);
 	}
 }
 
@@ -174,28 +493,12 @@ void CImConn::OnWrite()
 	if (!m_busy)
 		return;
 
-	while (m_out_buf.GetWriteOffset() > 0) {
-		int send_size = m_out_buf.GetWriteOffset();
-		if (send_size > NETLIB_MAX_SOCKET_BUF_SIZE) {
-			send_size = NETLIB_MAX_SOCKET_BUF_SIZE;
-		}
+	// 一次writev把队列里的多个数据块发出去
+	m_out_queue.Flush(m_handle);
 
-		int ret = netlib_send(m_handle, m_out_buf.GetBuffer(), send_size);
-		if (ret <= 0) {
-			ret = 0;
-			break;
-		}
-
-		m_out_buf.Read(NULL, ret);//每次发送出去多少，就从写缓冲区中移除该部分字节
-	}
-
-	if (m_out_buf.GetWriteOffset() == 0) {
+	if (m_out_queue.IsEmpty()) {
 		m_busy = false;
 	}
 
-	log("onWrite, remain=%d ", m_out_buf.GetWriteOffset());
+	log("onWrite, remain=%d ", m_out_queue.GetPendingBytes());
 }
-
-
-
-
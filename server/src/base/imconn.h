@@ -11,6 +11,8 @@
 #include "netlib.h"
 #include "util.h"
 #include "ImPduBase.h"
+#include "TimerWheel.h"
+#include "OutputQueue.h"
 
 #define SERVER_HEARTBEAT_INTERVAL	5000
 #define SERVER_TIMEOUT				30000
@@ -19,6 +21,19 @@
 #define MOBILE_CLIENT_TIMEOUT       60000 * 5
 #define READ_BUF_SIZE	2048
 
+// 每个连接自带的定时器, 挂在主reactor的时间轮上, 取代全局每秒遍历所有连接
+enum {
+	IMCONN_TIMER_IDLE = 0,
+	IMCONN_TIMER_LOGIN,
+	IMCONN_TIMER_ACK,
+	IMCONN_TIMER_CNT
+};
+
+class CImConn;
+
+typedef hash_map<net_handle_t, CImConn*> ConnMap_t;  //key是socket句柄， value
+typedef hash_map<uint32_t, CImConn*> UserMap_t;
+
 class CImConn : public CRefObject
 {
 public:
@@ -27,7 +42,21 @@ public:
 
 	bool IsBusy() { return m_busy; }
 	int SendPdu(CImPdu* pPdu) { return Send(pPdu->GetBuffer(), pPdu->GetLength()); }
+	// 线程安全, 不在连接所属reactor线程调用时会拷贝数据投递给所属reactor发送
 	int Send(void* data, int len);
+	// 线程安全, 发不完的部分只引用pBuf不拷贝, 广播时同一个pBuf可以发给任意多个连接
+	int SendBuffer(CSharedBuffer* pBuf);
+	/*
+	 * 线程安全, 先发pHead(一般是包头), 再用sendfile发pFile从offset开始的len字节, 文件数据不经过用户态;
+	 * 发不完的部分只引用pHead和pFile
+	 */
+	int SendFile(CSharedBuffer* pHead, CSharedFile* pFile, uint64_t offset, uint32_t len);
+
+	COutputQueue* GetOutQueue() { return &m_out_queue; }
+
+	void SetConnMap(ConnMap_t* conn_map) { m_conn_map = conn_map; }
+	// 把非主reactor上收到的事件(数据包/连接关闭)交给主reactor处理, pPdu的所有权随之转移
+	void PostToMainReactor(uint8_t msg, CImPdu* pPdu);
 
 	virtual void OnConnect(net_handle_t handle) { m_handle = handle; }
 	virtual void OnConfirm() {}
@@ -35,30 +64,52 @@ public:
 	virtual void OnWrite();
 	virtual void OnClose() {}
 	virtual void OnTimer(uint64_t curr_tick) {}
+	virtual void OnTimerExpire(uint32_t timer_type, uint64_t curr_tick) {}
     virtual void OnWriteCompelete() {};
 
 	virtual void HandlePdu(CImPdu* pPdu) {}
 
+	/*
+	 * 只能在主reactor线程调用; 定时器在时间轮里时持有连接的一个引用,
+	 * 所以关闭连接时需要KillAllTimers(), 否则连接不会被释放
+	 */
+	void SetTimer(uint32_t timer_type, uint64_t delay, uint64_t interval = 0);
+	void KillTimer(uint32_t timer_type);
+	void KillAllTimers();
+	bool IsTimerPending(uint32_t timer_type) { return (timer_type < IMCONN_TIMER_CNT) && m_timers[timer_type].IsPending(); }
+
+protected:
+	bool _IsInOwnerReactor();
+	int _SendDirect(uchar_t* data, int len);
+	void _PostSend(CSharedBuffer* pBuf, CSharedFile* pFile = NULL, uint64_t file_offset = 0, uint32_t file_len = 0);
+private:
+	static void _TimerCallback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam);
+
 protected:
 	net_handle_t	m_handle;
 	bool			m_busy;
 
 	string			m_peer_ip;
 	uint16_t		m_peer_port;
-	CSimpleBuffer	m_in_buf;    //读缓冲区
-	CSimpleBuffer	m_out_buf;   //写缓冲区
+	CReadBuffer		m_in_buf;    //读缓冲区
+	COutputQueue	m_out_queue; //写缓冲区
 
 	bool			m_policy_conn;
 	uint32_t		m_recv_bytes;
 	uint64_t		m_last_send_tick;
 	uint64_t		m_last_recv_tick;
     uint64_t        m_last_all_user_tick;
-};
 
-typedef hash_map<net_handle_t, CImConn*> ConnMap_t;  //key是socket句柄， value
-typedef hash_map<uint32_t, CImConn*> UserMap_t;
+	ConnMap_t*		m_conn_map;		// 连接所在的ConnMap_t, 由imconn_callback设置
+	int				m_reactor_idx;	// 连接所属的reactor, -1表示还没查询
+
+	CWheelTimer		m_timers[IMCONN_TIMER_CNT];
+};
 
 void imconn_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam);
+// 多reactor时ConnMap_t会被其他reactor线程读取, 主线程对它的修改需要通过这两个函数
+void imconn_map_add(ConnMap_t* conn_map, net_handle_t handle, CImConn* pConn);
+void imconn_map_del(ConnMap_t* conn_map, net_handle_t handle);
 void ReadPolicyFile();
 
 #endif /* IMCONN_H_ */
@@ -30,20 +30,102 @@ int netlib_destroy()
 	return ret;
 }
 
+int netlib_init_reactors(uint32_t reactor_cnt)
+{
+	if (CEventDispatch::InitReactors(reactor_cnt) != 0)
+		return NETLIB_ERROR;
+
+	return NETLIB_OK;
+}
+
+uint32_t netlib_get_reactor_count()
+{
+	return CEventDispatch::GetReactorCount();
+}
+
+int netlib_get_reactor(net_handle_t handle)
+{
+	CBaseSocket* pSocket = FindBaseSocket(handle);
+	if (!pSocket)
+		return -1;
+
+	int idx = pSocket->GetDispatch()->GetIndex();
+	pSocket->ReleaseRef();
+	return idx;
+}
+
+int netlib_current_reactor()
+{
+	uint32_t reactor_cnt = CEventDispatch::GetReactorCount();
+	for (uint32_t i = 0; i < reactor_cnt; i++)
+	{
+		if (CEventDispatch::GetReactor(i)->IsInLoopThread())
+			return i;
+	}
+
+	return -1;
+}
+
+int netlib_post_task(uint32_t reactor_idx, callback_t callback, void* user_data)
+{
+	CEventDispatch* pDispatch = CEventDispatch::GetReactor(reactor_idx);
+	if (!pDispatch)
+		return NETLIB_ERROR;
+
+	pDispatch->PostTask(callback, user_data);
+	return NETLIB_OK;
+}
+
+int netlib_add_notify(uint32_t reactor_idx, callback_t callback, void* user_data)
+{
+	CEventDispatch* pDispatch = CEventDispatch::GetReactor(reactor_idx);
+	if (!pDispatch)
+		return NETLIB_ERROR;
+
+	return pDispatch->AddNotify(callback, user_data);
+}
+
+int netlib_notify(uint32_t reactor_idx, int notify_id)
+{
+	CEventDispatch* pDispatch = CEventDispatch::GetReactor(reactor_idx);
+	if (!pDispatch)
+		return NETLIB_ERROR;
+
+	pDispatch->Notify(notify_id);
+	return NETLIB_OK;
+}
+
+/*
+ * 多reactor时在每个reactor上各开一个SO_REUSEPORT的侦听socket,
+ * accept到的连接固定在对应的reactor上收发数据
+ */
 int netlib_listen(
 		const char*	server_ip, 
 		uint16_t	port,
 		callback_t	callback,
 		void*		callback_data)
 {
-	CBaseSocket* pSocket = new CBaseSocket();
-	if (!pSocket)
-		return NETLIB_ERROR;
+	uint32_t reactor_cnt = CEventDispatch::GetReactorCount();
+	list<CBaseSocket*> listen_list;
+	for (uint32_t i = 0; i < reactor_cnt; i++)
+	{
+		CBaseSocket* pSocket = new CBaseSocket();
+		pSocket->SetDispatch(CEventDispatch::GetReactor(i));
+		int ret =  pSocket->Listen(server_ip, port, callback, callback_data);
+		if (ret == NETLIB_ERROR)
+		{
+			delete pSocket;
+			// 前面reactor上已经建好的侦听socket要一起关掉, 否则端口一直被占着, 也还留在reactor里
+			for (list<CBaseSocket*>::iterator it = listen_list.begin(); it != listen_list.end(); it++)
+			{
+				(*it)->Close();
+			}
+			return ret;
+		}
+		listen_list.push_back(pSocket);
+	}
 
-	int ret =  pSocket->Listen(server_ip, port, callback, callback_data);
-	if (ret == NETLIB_ERROR)
-		delete pSocket;
-	return ret;
+	return NETLIB_OK;
 }
 
 net_handle_t netlib_connect(
@@ -74,6 +156,30 @@ int netlib_send(net_handle_t handle, void* buf, int len)
 	return ret;
 }
 
+int netlib_sendv(net_handle_t handle, netlib_iovec_t* iov, int iov_cnt)
+{
+	CBaseSocket* pSocket = FindBaseSocket(handle);
+	if (!pSocket)
+	{
+		return NETLIB_ERROR;
+	}
+	int ret = pSocket->SendV(iov, iov_cnt);
+	pSocket->ReleaseRef();
+	return ret;
+}
+
+int netlib_sendfile(net_handle_t handle, int file_fd, uint64_t* offset, uint32_t len)
+{
+	CBaseSocket* pSocket = FindBaseSocket(handle);
+	if (!pSocket)
+	{
+		return NETLIB_ERROR;
+	}
+	int ret = pSocket->SendFile(file_fd, offset, len);
+	pSocket->ReleaseRef();
+	return ret;
+}
+
 int netlib_recv(net_handle_t handle, void* buf, int len)
 {
 	CBaseSocket* pSocket = FindBaseSocket(handle);
@@ -155,17 +261,28 @@ int netlib_add_loop(callback_t callback, void* user_data)
 	return 0;
 }
 
+// 主reactor在调用线程里运行, 其他reactor各自启动一个线程
 void netlib_eventloop(uint32_t wait_timeout)
 {
-	CEventDispatch::Instance()->StartDispatch(wait_timeout);
+	uint32_t reactor_cnt = CEventDispatch::GetReactorCount();
+	for (uint32_t i = 1; i < reactor_cnt; i++)
+	{
+		CEventDispatch::GetReactor(i)->StartDispatchThread(wait_timeout);
+	}
+
+	CEventDispatch::GetReactor(0)->StartDispatch(wait_timeout);
 }
 
 void netlib_stop_event()
 {
-    CEventDispatch::Instance()->StopDispatch();
+	uint32_t reactor_cnt = CEventDispatch::GetReactorCount();
+	for (uint32_t i = 0; i < reactor_cnt; i++)
+	{
+		CEventDispatch::GetReactor(i)->StopDispatch();
+	}
 }
 
 bool netlib_is_running()
 {
-    return CEventDispatch::Instance()->isRunning();
+    return CEventDispatch::GetReactor(0)->isRunning();
 }
@@ -13,6 +13,12 @@
 #define NETLIB_OPT_SET_RECV_BUF_SIZE	8
 
 #define NETLIB_MAX_SOCKET_BUF_SIZE		(128 * 1024)
+#define NETLIB_MAX_IOV_CNT				64		// 一次netlib_sendv最多发送的数据块数
+
+typedef struct {
+	void*		base;
+	uint32_t	len;
+} netlib_iovec_t;
 
 #ifdef __cplusplus
 extern "C" {
@@ -22,6 +28,26 @@ int netlib_init();
 
 int netlib_destroy();
 
+// 设置reactor(事件循环线程)个数, 必须在netlib_listen/netlib_connect之前调用, 默认1个
+int netlib_init_reactors(uint32_t reactor_cnt);
+
+uint32_t netlib_get_reactor_count();
+
+// socket所属reactor的序号, 找不到返回-1
+int netlib_get_reactor(net_handle_t handle);
+
+// 当前线程所运行的reactor的序号, 非reactor线程返回-1
+int netlib_current_reactor();
+
+// 线程安全, callback在reactor_idx的线程里以NETLIB_MSG_TASK被调用
+int netlib_post_task(uint32_t reactor_idx, callback_t callback, void* user_data);
+
+// 注册通知, 返回通知id, 失败返回-1; 用于工作线程把结果放进无锁队列后立即唤醒reactor
+int netlib_add_notify(uint32_t reactor_idx, callback_t callback, void* user_data);
+
+// 线程安全, callback在reactor_idx的线程里以NETLIB_MSG_NOTIFY被调用, 多次通知可能合并成一次
+int netlib_notify(uint32_t reactor_idx, int notify_id);
+
 int netlib_listen(	
 		const char*	server_ip, 
 		uint16_t	port,
@@ -36,6 +62,13 @@ net_handle_t netlib_connect(
 
 int netlib_send(net_handle_t handle, void* buf, int len);
 
+// 聚集写, 一次系统调用发送多个数据块, iov_cnt最多NETLIB_MAX_IOV_CNT; 返回值同netlib_send
+int netlib_sendv(net_handle_t handle, netlib_iovec_t* iov, int iov_cnt);
+
+// 把file_fd从*offset开始的len字节直接从内核发到socket(Linux/Mac的sendfile), 返回发出的字节数,
+// 发送缓冲区满时返回0, *offset前移发出的字节数; Windows上不支持, 返回NETLIB_ERROR
+int netlib_sendfile(net_handle_t handle, int file_fd, uint64_t* offset, uint32_t len);
+
 int netlib_recv(net_handle_t handle, void* buf, int len);
 
 int netlib_close(net_handle_t handle);
@@ -18,6 +18,7 @@
     #include <pthread.h>
     #include <sys/types.h>
     #include <sys/socket.h>
+    #include <sys/uio.h>		// writev
     #include <sys/ioctl.h>
     #include <netinet/in.h>
     #include <netinet/tcp.h>
@@ -90,7 +91,9 @@ enum
 	NETLIB_MSG_WRITE,
 	NETLIB_MSG_CLOSE,
 	NETLIB_MSG_TIMER,
-    NETLIB_MSG_LOOP
+    NETLIB_MSG_LOOP,
+	NETLIB_MSG_TASK,
+	NETLIB_MSG_NOTIFY
 };
 
 const uint32_t INVALID_UINT32  = (uint32_t) -1;
@@ -250,6 +250,9 @@ bool OtherCmdID_IsValid(int value) {
     case 1808:
     case 1809:
     case 1810:
+    case 1811:
+    case 1812:
+    case 1813:
     case 1841:
     case 1842:
     case 1843:
@@ -198,6 +198,9 @@ enum OtherCmdID {
   CID_OTHER_PUSH_TO_USER_RSP = 1808,
   CID_OTHER_GET_SHIELD_REQ = 1809,
   CID_OTHER_GET_SHIELD_RSP = 1810,
+  CID_OTHER_USER_STATUS_BATCH = 1811,
+  CID_OTHER_USER_STAT_NOTIFY_BATCH = 1812,
+  CID_OTHER_LOGIN_STATUS_NOTIFY_BATCH = 1813,
   CID_OTHER_FILE_TRANSFER_REQ = 1841,
   CID_OTHER_FILE_TRANSFER_RSP = 1842,
   CID_OTHER_FILE_SERVER_IP_REQ = 1843,
@@ -2269,6 +2269,7 @@ const int IMGroupChangeMemberRsp::kGroupIdFieldNumber;
 const int IMGroupChangeMemberRsp::kCurUserIdListFieldNumber;
 const int IMGroupChangeMemberRsp::kChgUserIdListFieldNumber;
 const int IMGroupChangeMemberRsp::kAttachDataFieldNumber;
+const int IMGroupChangeMemberRsp::kVersionFieldNumber;
 #endif  // !_MSC_VER
 
 IMGroupChangeMemberRsp::IMGroupChangeMemberRsp()
@@ -2295,6 +2296,7 @@ void IMGroupChangeMemberRsp::SharedCtor() {
   result_code_ = 0u;
   group_id_ = 0u;
   attach_data_ = const_cast< ::std::string*>(&::google::protobuf::internal::GetEmptyStringAlreadyInited());
+  version_ = 0u;
   ::memset(_has_bits_, 0, sizeof(_has_bits_));
 }
 
@@ -2346,7 +2348,7 @@ void IMGroupChangeMemberRsp::Clear() {
     ::memset(&first, 0, n);                                \
   } while (0)
 
-  if (_has_bits_[0 / 32] & 79) {
+  if (_has_bits_[0 / 32] & 207) {
     ZR_(result_code_, group_id_);
     user_id_ = 0u;
     change_type_ = 1;
@@ -2355,6 +2357,7 @@ void IMGroupChangeMemberRsp::Clear() {
         attach_data_->clear();
       }
     }
+    version_ = 0u;
   }
 
 #undef OFFSET_OF_FIELD_
@@ -2479,6 +2482,21 @@ bool IMGroupChangeMemberRsp::MergePartialFromCodedStream(
           goto handle_unusual;
         }
         if (input->ExpectTag(48)) goto parse_chg_user_id_list;
+        if (input->ExpectTag(56)) goto parse_version;
+        break;
+      }
+
+      // optional uint32 version = 7;
+      case 7: {
+        if (tag == 56) {
+         parse_version:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::uint32, ::google::protobuf::internal::WireFormatLite::TYPE_UINT32>(
+                 input, &version_)));
+          set_has_version();
+        } else {
+          goto handle_unusual;
+        }
         if (input->ExpectTag(162)) goto parse_attach_data;
         break;
       }
@@ -2554,6 +2572,11 @@ void IMGroupChangeMemberRsp::SerializeWithCachedSizes(
       6, this->chg_user_id_list(i), output);
   }
 
+  // optional uint32 version = 7;
+  if (has_version()) {
+    ::google::protobuf::internal::WireFormatLite::WriteUInt32(7, this->version(), output);
+  }
+
   // optional bytes attach_data = 20;
   if (has_attach_data()) {
     ::google::protobuf::internal::WireFormatLite::WriteBytesMaybeAliased(
@@ -2603,6 +2626,13 @@ int IMGroupChangeMemberRsp::ByteSize() const {
           this->attach_data());
     }
 
+    // optional uint32 version = 7;
+    if (has_version()) {
+      total_size += 1 +
+        ::google::protobuf::internal::WireFormatLite::UInt32Size(
+          this->version());
+    }
+
   }
   // repeated uint32 cur_user_id_list = 5;
   {
@@ -2657,6 +2687,9 @@ void IMGroupChangeMemberRsp::MergeFrom(const IMGroupChangeMemberRsp& from) {
     if (from.has_attach_data()) {
       set_attach_data(from.attach_data());
     }
+    if (from.has_version()) {
+      set_version(from.version());
+    }
   }
   mutable_unknown_fields()->append(from.unknown_fields());
 }
@@ -2682,6 +2715,7 @@ void IMGroupChangeMemberRsp::Swap(IMGroupChangeMemberRsp* other) {
     cur_user_id_list_.Swap(&other->cur_user_id_list_);
     chg_user_id_list_.Swap(&other->chg_user_id_list_);
     std::swap(attach_data_, other->attach_data_);
+    std::swap(version_, other->version_);
     std::swap(_has_bits_[0], other->_has_bits_[0]);
     _unknown_fields_.swap(other->_unknown_fields_);
     std::swap(_cached_size_, other->_cached_size_);
@@ -3333,6 +3367,7 @@ const int IMGroupChangeMemberNotify::kChangeTypeFieldNumber;
 const int IMGroupChangeMemberNotify::kGroupIdFieldNumber;
 const int IMGroupChangeMemberNotify::kCurUserIdListFieldNumber;
 const int IMGroupChangeMemberNotify::kChgUserIdListFieldNumber;
+const int IMGroupChangeMemberNotify::kVersionFieldNumber;
 #endif  // !_MSC_VER
 
 IMGroupChangeMemberNotify::IMGroupChangeMemberNotify()
@@ -3356,6 +3391,7 @@ void IMGroupChangeMemberNotify::SharedCtor() {
   user_id_ = 0u;
   change_type_ = 1;
   group_id_ = 0u;
+  version_ = 0u;
   ::memset(_has_bits_, 0, sizeof(_has_bits_));
 }
 
@@ -3394,10 +3430,11 @@ IMGroupChangeMemberNotify* IMGroupChangeMemberNotify::New() const {
 }
 
 void IMGroupChangeMemberNotify::Clear() {
-  if (_has_bits_[0 / 32] & 7) {
+  if (_has_bits_[0 / 32] & 39) {
     user_id_ = 0u;
     change_type_ = 1;
     group_id_ = 0u;
+    version_ = 0u;
   }
   cur_user_id_list_.Clear();
   chg_user_id_list_.Clear();
@@ -3503,6 +3540,21 @@ bool IMGroupChangeMemberNotify::MergePartialFromCodedStream(
           goto handle_unusual;
         }
         if (input->ExpectTag(40)) goto parse_chg_user_id_list;
+        if (input->ExpectTag(48)) goto parse_version;
+        break;
+      }
+
+      // optional uint32 version = 6;
+      case 6: {
+        if (tag == 48) {
+         parse_version:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::uint32, ::google::protobuf::internal::WireFormatLite::TYPE_UINT32>(
+                 input, &version_)));
+          set_has_version();
+        } else {
+          goto handle_unusual;
+        }
         if (input->ExpectAtEnd()) goto success;
         break;
       }
@@ -3560,6 +3612,11 @@ void IMGroupChangeMemberNotify::SerializeWithCachedSizes(
       5, this->chg_user_id_list(i), output);
   }
 
+  // optional uint32 version = 6;
+  if (has_version()) {
+    ::google::protobuf::internal::WireFormatLite::WriteUInt32(6, this->version(), output);
+  }
+
   output->WriteRaw(unknown_fields().data(),
                    unknown_fields().size());
   // @@protoc_insertion_point(serialize_end:IM.Group.IMGroupChangeMemberNotify)
@@ -3589,6 +3646,13 @@ int IMGroupChangeMemberNotify::ByteSize() const {
           this->group_id());
     }
 
+    // optional uint32 version = 6;
+    if (has_version()) {
+      total_size += 1 +
+        ::google::protobuf::internal::WireFormatLite::UInt32Size(
+          this->version());
+    }
+
   }
   // repeated uint32 cur_user_id_list = 4;
   {
@@ -3637,6 +3701,9 @@ void IMGroupChangeMemberNotify::MergeFrom(const IMGroupChangeMemberNotify& from)
     if (from.has_group_id()) {
       set_group_id(from.group_id());
     }
+    if (from.has_version()) {
+      set_version(from.version());
+    }
   }
   mutable_unknown_fields()->append(from.unknown_fields());
 }
@@ -3660,6 +3727,7 @@ void IMGroupChangeMemberNotify::Swap(IMGroupChangeMemberNotify* other) {
     std::swap(group_id_, other->group_id_);
     cur_user_id_list_.Swap(&other->cur_user_id_list_);
     chg_user_id_list_.Swap(&other->chg_user_id_list_);
+    std::swap(version_, other->version_);
     std::swap(_has_bits_[0], other->_has_bits_[0]);
     _unknown_fields_.swap(other->_unknown_fields_);
     std::swap(_cached_size_, other->_cached_size_);
@@ -1088,6 +1088,13 @@ class IMGroupChangeMemberRsp : public ::google::protobuf::MessageLite {
   inline ::std::string* release_attach_data();
   inline void set_allocated_attach_data(::std::string* attach_data);
 
+  // optional uint32 version = 7;
+  inline bool has_version() const;
+  inline void clear_version();
+  static const int kVersionFieldNumber = 7;
+  inline ::google::protobuf::uint32 version() const;
+  inline void set_version(::google::protobuf::uint32 value);
+
   // @@protoc_insertion_point(class_scope:IM.Group.IMGroupChangeMemberRsp)
  private:
   inline void set_has_user_id();
@@ -1100,6 +1107,8 @@ class IMGroupChangeMemberRsp : public ::google::protobuf::MessageLite {
   inline void clear_has_group_id();
   inline void set_has_attach_data();
   inline void clear_has_attach_data();
+  inline void set_has_version();
+  inline void clear_has_version();
 
   ::std::string _unknown_fields_;
 
@@ -1112,6 +1121,7 @@ class IMGroupChangeMemberRsp : public ::google::protobuf::MessageLite {
   ::google::protobuf::RepeatedField< ::google::protobuf::uint32 > cur_user_id_list_;
   ::google::protobuf::RepeatedField< ::google::protobuf::uint32 > chg_user_id_list_;
   ::std::string* attach_data_;
+  ::google::protobuf::uint32 version_;
   #ifdef GOOGLE_PROTOBUF_NO_STATIC_INITIALIZER
   friend void  protobuf_AddDesc_IM_2eGroup_2eproto_impl();
   #else
@@ -1483,6 +1493,13 @@ class IMGroupChangeMemberNotify : public ::google::protobuf::MessageLite {
   inline ::google::protobuf::RepeatedField< ::google::protobuf::uint32 >*
       mutable_chg_user_id_list();
 
+  // optional uint32 version = 6;
+  inline bool has_version() const;
+  inline void clear_version();
+  static const int kVersionFieldNumber = 6;
+  inline ::google::protobuf::uint32 version() const;
+  inline void set_version(::google::protobuf::uint32 value);
+
   // @@protoc_insertion_point(class_scope:IM.Group.IMGroupChangeMemberNotify)
  private:
   inline void set_has_user_id();
@@ -1491,6 +1508,8 @@ class IMGroupChangeMemberNotify : public ::google::protobuf::MessageLite {
   inline void clear_has_change_type();
   inline void set_has_group_id();
   inline void clear_has_group_id();
+  inline void set_has_version();
+  inline void clear_has_version();
 
   ::std::string _unknown_fields_;
 
@@ -1501,6 +1520,7 @@ class IMGroupChangeMemberNotify : public ::google::protobuf::MessageLite {
   ::google::protobuf::RepeatedField< ::google::protobuf::uint32 > cur_user_id_list_;
   ::google::protobuf::RepeatedField< ::google::protobuf::uint32 > chg_user_id_list_;
   ::google::protobuf::uint32 group_id_;
+  ::google::protobuf::uint32 version_;
   #ifdef GOOGLE_PROTOBUF_NO_STATIC_INITIALIZER
   friend void  protobuf_AddDesc_IM_2eGroup_2eproto_impl();
   #else
@@ -3010,6 +3030,30 @@ inline void IMGroupChangeMemberRsp::set_allocated_attach_data(::std::string* att
   // @@protoc_insertion_point(field_set_allocated:IM.Group.IMGroupChangeMemberRsp.attach_data)
 }
 
+// optional uint32 version = 7;
+inline bool IMGroupChangeMemberRsp::has_version() const {
+  return (_has_bits_[0] & 0x00000080u) != 0;
+}
+inline void IMGroupChangeMemberRsp::set_has_version() {
+  _has_bits_[0] |= 0x00000080u;
+}
+inline void IMGroupChangeMemberRsp::clear_has_version() {
+  _has_bits_[0] &= ~0x00000080u;
+}
+inline void IMGroupChangeMemberRsp::clear_version() {
+  version_ = 0u;
+  clear_has_version();
+}
+inline ::google::protobuf::uint32 IMGroupChangeMemberRsp::version() const {
+  // @@protoc_insertion_point(field_get:IM.Group.IMGroupChangeMemberRsp.version)
+  return version_;
+}
+inline void IMGroupChangeMemberRsp::set_version(::google::protobuf::uint32 value) {
+  set_has_version();
+  version_ = value;
+  // @@protoc_insertion_point(field_set:IM.Group.IMGroupChangeMemberRsp.version)
+}
+
 // -------------------------------------------------------------------
 
 // IMGroupShieldReq
@@ -3451,6 +3495,30 @@ IMGroupChangeMemberNotify::mutable_chg_user_id_list() {
   return &chg_user_id_list_;
 }
 
+// optional uint32 version = 6;
+inline bool IMGroupChangeMemberNotify::has_version() const {
+  return (_has_bits_[0] & 0x00000020u) != 0;
+}
+inline void IMGroupChangeMemberNotify::set_has_version() {
+  _has_bits_[0] |= 0x00000020u;
+}
+inline void IMGroupChangeMemberNotify::clear_has_version() {
+  _has_bits_[0] &= ~0x00000020u;
+}
+inline void IMGroupChangeMemberNotify::clear_version() {
+  version_ = 0u;
+  clear_has_version();
+}
+inline ::google::protobuf::uint32 IMGroupChangeMemberNotify::version() const {
+  // @@protoc_insertion_point(field_get:IM.Group.IMGroupChangeMemberNotify.version)
+  return version_;
+}
+inline void IMGroupChangeMemberNotify::set_version(::google::protobuf::uint32 value) {
+  set_has_version();
+  version_ = value;
+  // @@protoc_insertion_point(field_set:IM.Group.IMGroupChangeMemberNotify.version)
+}
+
 
 // @@protoc_insertion_point(namespace_scope)
 
@@ -1609,6 +1609,7 @@ void IMRoleSet::Swap(IMRoleSet* other) {
 
 #ifndef _MSC_VER
 const int IMOnlineUserInfo::kUserStatListFieldNumber;
+const int IMOnlineUserInfo::kUserStatDataFieldNumber;
 #endif  // !_MSC_VER
 
 IMOnlineUserInfo::IMOnlineUserInfo()
@@ -1628,7 +1629,9 @@ IMOnlineUserInfo::IMOnlineUserInfo(const IMOnlineUserInfo& from)
 }
 
 void IMOnlineUserInfo::SharedCtor() {
+  ::google::protobuf::internal::GetEmptyString();
   _cached_size_ = 0;
+  user_stat_data_ = const_cast< ::std::string*>(&::google::protobuf::internal::GetEmptyStringAlreadyInited());
   ::memset(_has_bits_, 0, sizeof(_has_bits_));
 }
 
@@ -1638,6 +1641,9 @@ IMOnlineUserInfo::~IMOnlineUserInfo() {
 }
 
 void IMOnlineUserInfo::SharedDtor() {
+  if (user_stat_data_ != &::google::protobuf::internal::GetEmptyStringAlreadyInited()) {
+    delete user_stat_data_;
+  }
   #ifdef GOOGLE_PROTOBUF_NO_STATIC_INITIALIZER
   if (this != &default_instance()) {
   #else
@@ -1667,6 +1673,11 @@ IMOnlineUserInfo* IMOnlineUserInfo::New() const {
 }
 
 void IMOnlineUserInfo::Clear() {
+  if (has_user_stat_data()) {
+    if (user_stat_data_ != &::google::protobuf::internal::GetEmptyStringAlreadyInited()) {
+      user_stat_data_->clear();
+    }
+  }
   user_stat_list_.Clear();
   ::memset(_has_bits_, 0, sizeof(_has_bits_));
   mutable_unknown_fields()->clear();
@@ -1696,6 +1707,19 @@ bool IMOnlineUserInfo::MergePartialFromCodedStream(
           goto handle_unusual;
         }
         if (input->ExpectTag(10)) goto parse_user_stat_list;
+        if (input->ExpectTag(18)) goto parse_user_stat_data;
+        break;
+      }
+
+      // optional bytes user_stat_data = 2;
+      case 2: {
+        if (tag == 18) {
+         parse_user_stat_data:
+          DO_(::google::protobuf::internal::WireFormatLite::ReadBytes(
+                input, this->mutable_user_stat_data()));
+        } else {
+          goto handle_unusual;
+        }
         if (input->ExpectAtEnd()) goto success;
         break;
       }
@@ -1731,6 +1755,12 @@ void IMOnlineUserInfo::SerializeWithCachedSizes(
       1, this->user_stat_list(i), output);
   }
 
+  // optional bytes user_stat_data = 2;
+  if (has_user_stat_data()) {
+    ::google::protobuf::internal::WireFormatLite::WriteBytesMaybeAliased(
+      2, this->user_stat_data(), output);
+  }
+
   output->WriteRaw(unknown_fields().data(),
                    unknown_fields().size());
   // @@protoc_insertion_point(serialize_end:IM.Server.IMOnlineUserInfo)
@@ -1739,6 +1769,15 @@ void IMOnlineUserInfo::SerializeWithCachedSizes(
 int IMOnlineUserInfo::ByteSize() const {
   int total_size = 0;
 
+  if (_has_bits_[1 / 32] & (0xffu << (1 % 32))) {
+    // optional bytes user_stat_data = 2;
+    if (has_user_stat_data()) {
+      total_size += 1 +
+        ::google::protobuf::internal::WireFormatLite::BytesSize(
+          this->user_stat_data());
+    }
+
+  }
   // repeated .IM.BaseDefine.ServerUserStat user_stat_list = 1;
   total_size += 1 * this->user_stat_list_size();
   for (int i = 0; i < this->user_stat_list_size(); i++) {
@@ -1763,6 +1802,11 @@ void IMOnlineUserInfo::CheckTypeAndMergeFrom(
 void IMOnlineUserInfo::MergeFrom(const IMOnlineUserInfo& from) {
   GOOGLE_CHECK_NE(&from, this);
   user_stat_list_.MergeFrom(from.user_stat_list_);
+  if (from._has_bits_[1 / 32] & (0xffu << (1 % 32))) {
+    if (from.has_user_stat_data()) {
+      set_user_stat_data(from.user_stat_data());
+    }
+  }
   mutable_unknown_fields()->append(from.unknown_fields());
 }
 
@@ -1781,6 +1825,7 @@ bool IMOnlineUserInfo::IsInitialized() const {
 void IMOnlineUserInfo::Swap(IMOnlineUserInfo* other) {
   if (other != this) {
     user_stat_list_.Swap(&other->user_stat_list_);
+    std::swap(user_stat_data_, other->user_stat_data_);
     std::swap(_has_bits_[0], other->_has_bits_[0]);
     _unknown_fields_.swap(other->_unknown_fields_);
     std::swap(_cached_size_, other->_cached_size_);
@@ -804,14 +804,29 @@ class IMOnlineUserInfo : public ::google::protobuf::MessageLite {
   inline ::google::protobuf::RepeatedPtrField< ::IM::BaseDefine::ServerUserStat >*
       mutable_user_stat_list();
 
+  // optional bytes user_stat_data = 2;
+  inline bool has_user_stat_data() const;
+  inline void clear_user_stat_data();
+  static const int kUserStatDataFieldNumber = 2;
+  inline const ::std::string& user_stat_data() const;
+  inline void set_user_stat_data(const ::std::string& value);
+  inline void set_user_stat_data(const char* value);
+  inline void set_user_stat_data(const void* value, size_t size);
+  inline ::std::string* mutable_user_stat_data();
+  inline ::std::string* release_user_stat_data();
+  inline void set_allocated_user_stat_data(::std::string* user_stat_data);
+
   // @@protoc_insertion_point(class_scope:IM.Server.IMOnlineUserInfo)
  private:
+  inline void set_has_user_stat_data();
+  inline void clear_has_user_stat_data();
 
   ::std::string _unknown_fields_;
 
   ::google::protobuf::uint32 _has_bits_[1];
   mutable int _cached_size_;
   ::google::protobuf::RepeatedPtrField< ::IM::BaseDefine::ServerUserStat > user_stat_list_;
+  ::std::string* user_stat_data_;
   #ifdef GOOGLE_PROTOBUF_NO_STATIC_INITIALIZER
   friend void  protobuf_AddDesc_IM_2eServer_2eproto_impl();
   #else
@@ -3207,6 +3222,82 @@ IMOnlineUserInfo::mutable_user_stat_list() {
   return &user_stat_list_;
 }
 
+// optional bytes user_stat_data = 2;
+inline bool IMOnlineUserInfo::has_user_stat_data() const {
+  return (_has_bits_[0] & 0x00000002u) != 0;
+}
+inline void IMOnlineUserInfo::set_has_user_stat_data() {
+  _has_bits_[0] |= 0x00000002u;
+}
+inline void IMOnlineUserInfo::clear_has_user_stat_data() {
+  _has_bits_[0] &= ~0x00000002u;
+}
+inline void IMOnlineUserInfo::clear_user_stat_data() {
+  if (user_stat_data_ != &::google::protobuf::internal::GetEmptyStringAlreadyInited()) {
+    user_stat_data_->clear();
+  }
+  clear_has_user_stat_data();
+}
+inline const ::std::string& IMOnlineUserInfo::user_stat_data() const {
+  // @@protoc_insertion_point(field_get:IM.Server.IMOnlineUserInfo.user_stat_data)
+  return *user_stat_data_;
+}
+inline void IMOnlineUserInfo::set_user_stat_data(const ::std::string& value) {
+  set_has_user_stat_data();
+  if (user_stat_data_ == &::google::protobuf::internal::GetEmptyStringAlreadyInited()) {
+    user_stat_data_ = new ::std::string;
+  }
+  user_stat_data_->assign(value);
+  // @@protoc_insertion_point(field_set:IM.Server.IMOnlineUserInfo.user_stat_data)
+}
+inline void IMOnlineUserInfo::set_user_stat_data(const char* value) {
+  set_has_user_stat_data();
+  if (user_stat_data_ == &::google::protobuf::internal::GetEmptyStringAlreadyInited()) {
+    user_stat_data_ = new ::std::string;
+  }
+  user_stat_data_->assign(value);
+  // @@protoc_insertion_point(field_set_char:IM.Server.IMOnlineUserInfo.user_stat_data)
+}
+inline void IMOnlineUserInfo::set_user_stat_data(const void* value, size_t size) {
+  set_has_user_stat_data();
+  if (user_stat_data_ == &::google::protobuf::internal::GetEmptyStringAlreadyInited()) {
+    user_stat_data_ = new ::std::string;
+  }
+  user_stat_data_->assign(reinterpret_cast<const char*>(value), size);
+  // @@protoc_insertion_point(field_set_pointer:IM.Server.IMOnlineUserInfo.user_stat_data)
+}
+inline ::std::string* IMOnlineUserInfo::mutable_user_stat_data() {
+  set_has_user_stat_data();
+  if (user_stat_data_ == &::google::protobuf::internal::GetEmptyStringAlreadyInited()) {
+    user_stat_data_ = new ::std::string;
+  }
+  // @@protoc_insertion_point(field_mutable:IM.Server.IMOnlineUserInfo.user_stat_data)
+  return user_stat_data_;
+}
+inline ::std::string* IMOnlineUserInfo::release_user_stat_data() {
+  clear_has_user_stat_data();
+  if (user_stat_data_ == &::google::protobuf::internal::GetEmptyStringAlreadyInited()) {
+    return NULL;
+  } else {
+    ::std::string* temp = user_stat_data_;
+    user_stat_data_ = const_cast< ::std::string*>(&::google::protobuf::internal::GetEmptyStringAlreadyInited());
+    return temp;
+  }
+}
+inline void IMOnlineUserInfo::set_allocated_user_stat_data(::std::string* user_stat_data) {
+  if (user_stat_data_ != &::google::protobuf::internal::GetEmptyStringAlreadyInited()) {
+    delete user_stat_data_;
+  }
+  if (user_stat_data) {
+    set_has_user_stat_data();
+    user_stat_data_ = user_stat_data;
+  } else {
+    clear_has_user_stat_data();
+    user_stat_data_ = const_cast< ::std::string*>(&::google::protobuf::internal::GetEmptyStringAlreadyInited());
+  }
+  // @@protoc_insertion_point(field_set_allocated:IM.Server.IMOnlineUserInfo.user_stat_data)
+}
+
 // -------------------------------------------------------------------
 
 // IMMsgServInfo
@@ -1,4 +1,5 @@
 #include "util.h"
+#include "atomic.h"
 #include <sstream>
 using namespace std;
 
@@ -25,7 +26,8 @@ void CRefObject::AddRef()
 	}
 	else
 	{
-		m_refCount++;
+		// 多reactor时同一个对象会在多个线程间传递
+		ATOMIC_ADD(&m_refCount, 1);
 	}
 }
 
@@ -44,8 +46,7 @@ void CRefObject::ReleaseRef()
 	}
 	else
 	{
-		m_refCount--;
-		if (m_refCount == 0)
+		if (ATOMIC_SUB_AND_FETCH(&m_refCount, 1) == 0)
 			delete this;
 	}
 }
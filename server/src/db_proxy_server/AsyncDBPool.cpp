@@ -0,0 +1,673 @@
+/*
+ * AsyncDBPool.cpp
+ */
+
+#include <set>
+#include <unistd.h>
+#include <errmsg.h>
+#include "util.h"
+#include "atomic.h"
+#include "Thread.h"
+#include "ConfigFileReader.h"
+#include "AsyncDBPool.h"
+
+#define DEFAULT_ASYNC_CONN_CNT		8
+#define ASYNC_RECONNECT_INTERVAL	1000	// 毫秒
+#define ASYNC_CONNECT_TIMEOUT		5		// 秒
+#define ASYNC_READ_TIMEOUT			30		// 秒
+#define ASYNC_MAX_WAIT_TIME			1000	// epoll_wait最长等待, 毫秒
+#define ASYNC_EPOLL_EVENT_CNT		64
+#define ASYNC_DB_STAT_INTERVAL		60000
+
+typedef struct {
+	string				pool_name;
+	string				sql;
+	AsyncQueryCallback	callback;
+	uint64_t			submit_tick;
+	uint64_t			start_tick;
+} AsyncQuery_t;
+
+// MariaDB客户端库才有非阻塞接口, 用libmysqlclient编译时只能同步执行,
+// cmake -DUSE_MARIADB_CLIENT=ON 会换成libmariadb
+#if defined(USE_MARIADB_CLIENT) && !defined(MYSQL_WAIT_READ)
+#error "USE_MARIADB_CLIENT is set but mysql.h has no non-blocking api, check MYSQL_INCLUDE_DIR"
+#endif
+
+#ifdef MYSQL_WAIT_READ
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+enum {
+	ASYNC_CONN_CLOSED,
+	ASYNC_CONN_CONNECTING,
+	ASYNC_CONN_IDLE,
+	ASYNC_CONN_QUERYING,
+	ASYNC_CONN_STORING,
+};
+
+/*
+ * 一个非阻塞的mysql连接, 只在所属的异步线程里使用, 不加锁
+ * 每一步操作: xxx_start()返回需要等待的事件, 事件到达(或者超时)后调用xxx_cont(), 直到返回0
+ */
+class CAsyncDBConn {
+public:
+	CAsyncDBConn(CDBPool* pDBPool, int epfd);
+	virtual ~CAsyncDBConn();
+
+	void Connect(uint64_t nNow);
+	void Execute(AsyncQuery_t* pQuery, uint64_t nNow);
+	// nStatus为MYSQL_WAIT_xxx的组合
+	void OnEvent(int nStatus, uint64_t nNow);
+
+	int GetState() { return m_state; }
+	uint64_t GetDeadline() { return m_deadline; }
+private:
+	void _Wait(int nStatus, uint64_t nNow);
+	void _WatchIdle();
+	void _OnConnected(MYSQL* ret, uint64_t nNow);
+	void _OnQueried(int ret, uint64_t nNow);
+	void _Finish(MYSQL_RES* res, uint64_t nNow);
+	void _Close(uint64_t nNow);
+private:
+	CDBPool*		m_pDBPool;
+	int				m_epfd;
+	MYSQL*			m_mysql;
+	int				m_fd;			// 已经加入epoll的socket, -1表示没有
+	int				m_state;
+	uint64_t		m_deadline;		// 超时或者重连的时间, 0表示没有
+	AsyncQuery_t*	m_pQuery;
+};
+
+CAsyncDBConn::CAsyncDBConn(CDBPool* pDBPool, int epfd)
+{
+	m_pDBPool = pDBPool;
+	m_epfd = epfd;
+	m_mysql = NULL;
+	m_fd = -1;
+	m_state = ASYNC_CONN_CLOSED;
+	m_deadline = 0;
+	m_pQuery = NULL;
+}
+
+CAsyncDBConn::~CAsyncDBConn()
+{
+	if (m_mysql) {
+		mysql_close(m_mysql);
+	}
+}
+
+void CAsyncDBConn::Connect(uint64_t nNow)
+{
+	m_mysql = mysql_init(NULL);
+	if (!m_mysql) {
+		log("mysql_init failed");
+		m_deadline = nNow + ASYNC_RECONNECT_INTERVAL;
+		return;
+	}
+
+	unsigned int connect_timeout = ASYNC_CONNECT_TIMEOUT;
+	unsigned int read_timeout = ASYNC_READ_TIMEOUT;
+	mysql_options(m_mysql, MYSQL_OPT_NONBLOCK, 0);
+	mysql_options(m_mysql, MYSQL_SET_CHARSET_NAME, "utf8mb4");
+	mysql_options(m_mysql, MYSQL_OPT_CONNECT_TIMEOUT, &connect_timeout);
+	mysql_options(m_mysql, MYSQL_OPT_READ_TIMEOUT, &read_timeout);
+
+	m_state = ASYNC_CONN_CONNECTING;
+	MYSQL* ret = NULL;
+	int nStatus = mysql_real_connect_start(&ret, m_mysql, m_pDBPool->GetDBServerIP(), m_pDBPool->GetUsername(),
+			m_pDBPool->GetPasswrod(), m_pDBPool->GetDBName(), m_pDBPool->GetDBServerPort(), NULL, 0);
+	if (nStatus) {
+		_Wait(nStatus, nNow);
+	} else {
+		_OnConnected(ret, nNow);
+	}
+}
+
+void CAsyncDBConn::Execute(AsyncQuery_t* pQuery, uint64_t nNow)
+{
+	m_pQuery = pQuery;
+	m_pQuery->start_tick = nNow;
+	m_state = ASYNC_CONN_QUERYING;
+
+	int ret = 0;
+	int nStatus = mysql_real_query_start(&ret, m_mysql, pQuery->sql.c_str(), pQuery->sql.size());
+	if (nStatus) {
+		_Wait(nStatus, nNow);
+	} else {
+		_OnQueried(ret, nNow);
+	}
+}
+
+void CAsyncDBConn::OnEvent(int nStatus, uint64_t nNow)
+{
+	switch (m_state) {
+	case ASYNC_CONN_CONNECTING:
+	{
+		MYSQL* ret = NULL;
+		nStatus = mysql_real_connect_cont(&ret, m_mysql, nStatus);
+		if (nStatus) {
+			_Wait(nStatus, nNow);
+		} else {
+			_OnConnected(ret, nNow);
+		}
+		break;
+	}
+	case ASYNC_CONN_QUERYING:
+	{
+		int ret = 0;
+		nStatus = mysql_real_query_cont(&ret, m_mysql, nStatus);
+		if (nStatus) {
+			_Wait(nStatus, nNow);
+		} else {
+			_OnQueried(ret, nNow);
+		}
+		break;
+	}
+	case ASYNC_CONN_STORING:
+	{
+		MYSQL_RES* res = NULL;
+		nStatus = mysql_store_result_cont(&res, m_mysql, nStatus);
+		if (nStatus) {
+			_Wait(nStatus, nNow);
+		} else {
+			_Finish(res, nNow);
+		}
+		break;
+	}
+	case ASYNC_CONN_IDLE:
+		// 空闲时socket可读说明服务端关闭了连接(wait_timeout, 重启), 马上重连, 不要等到下一个查询失败
+		log("async db connection closed by server, pool=%s", m_pDBPool->GetPoolName());
+		_Close(nNow);
+		m_deadline = nNow;
+		break;
+	case ASYNC_CONN_CLOSED:
+		if (m_deadline && m_deadline <= nNow) {
+			Connect(nNow);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void CAsyncDBConn::_Wait(int nStatus, uint64_t nNow)
+{
+	struct epoll_event ev;
+	ev.events = 0;
+	ev.data.ptr = this;
+	if (nStatus & MYSQL_WAIT_READ)
+		ev.events |= EPOLLIN;
+	if (nStatus & MYSQL_WAIT_WRITE)
+		ev.events |= EPOLLOUT;
+	if (nStatus & MYSQL_WAIT_EXCEPT)
+		ev.events |= EPOLLPRI;
+
+	if (m_fd == -1) {
+		m_fd = mysql_get_socket(m_mysql);
+		epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_fd, &ev);
+	} else {
+		epoll_ctl(m_epfd, EPOLL_CTL_MOD, m_fd, &ev);
+	}
+
+	m_deadline = (nStatus & MYSQL_WAIT_TIMEOUT) ? nNow + mysql_get_timeout_value_ms(m_mysql) : 0;
+}
+
+void CAsyncDBConn::_WatchIdle()
+{
+	struct epoll_event ev;
+	ev.events = EPOLLIN | EPOLLRDHUP;
+	ev.data.ptr = this;
+	epoll_ctl(m_epfd, EPOLL_CTL_MOD, m_fd, &ev);
+	m_deadline = 0;
+}
+
+void CAsyncDBConn::_OnConnected(MYSQL* ret, uint64_t nNow)
+{
+	if (!ret) {
+		log("async mysql connect failed: %s, pool=%s", mysql_error(m_mysql), m_pDBPool->GetPoolName());
+		_Close(nNow);
+		return;
+	}
+
+	if (m_fd == -1) {
+		// 一次就连上了, 还没有加入epoll
+		struct epoll_event ev;
+		ev.events = 0;
+		ev.data.ptr = this;
+		m_fd = mysql_get_socket(m_mysql);
+		epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_fd, &ev);
+	}
+	m_state = ASYNC_CONN_IDLE;
+	_WatchIdle();
+}
+
+void CAsyncDBConn::_OnQueried(int ret, uint64_t nNow)
+{
+	if (ret) {
+		log("async mysql_real_query failed: %s, sql: %s", mysql_error(m_mysql), m_pQuery->sql.c_str());
+		_Finish(NULL, nNow);
+		return;
+	}
+
+	m_state = ASYNC_CONN_STORING;
+	MYSQL_RES* res = NULL;
+	int nStatus = mysql_store_result_start(&res, m_mysql);
+	if (nStatus) {
+		_Wait(nStatus, nNow);
+	} else {
+		_Finish(res, nNow);
+	}
+}
+
+void CAsyncDBConn::_Finish(MYSQL_RES* res, uint64_t nNow)
+{
+	CAsyncDBManager* pManager = CAsyncDBManager::getInstance();
+	AsyncQuery_t* pQuery = m_pQuery;
+	m_pQuery = NULL;
+	ATOMIC_ADD(&pManager->m_stat.exec_time, nNow - pQuery->start_tick);
+
+	if (res) {
+		m_state = ASYNC_CONN_IDLE;
+		_WatchIdle();
+	} else {
+		ATOMIC_ADD(&pManager->m_stat.error_cnt, 1);
+		unsigned int nErrno = mysql_errno(m_mysql);
+		if (nErrno == 0) {
+			log("async query returned no result set, sql: %s", pQuery->sql.c_str());
+		} else if (m_state == ASYNC_CONN_STORING) {
+			log("async mysql_store_result failed: %s", mysql_error(m_mysql));
+		}
+
+		if (nErrno == CR_SERVER_GONE_ERROR || nErrno == CR_SERVER_LOST) {
+			_Close(nNow);
+		} else {
+			m_state = ASYNC_CONN_IDLE;
+			_WatchIdle();
+		}
+	}
+
+	// 先把连接还回去再调回调, 回调里提交的新查询可以用这个连接
+	CResultSet* pResultSet = res ? new CResultSet(res) : NULL;
+	pQuery->callback(pResultSet);
+	delete pResultSet;
+	delete pQuery;
+}
+
+void CAsyncDBConn::_Close(uint64_t nNow)
+{
+	if (m_fd != -1) {
+		epoll_ctl(m_epfd, EPOLL_CTL_DEL, m_fd, NULL);
+		m_fd = -1;
+	}
+	if (m_mysql) {
+		mysql_close(m_mysql);
+		m_mysql = NULL;
+	}
+
+	m_state = ASYNC_CONN_CLOSED;
+	m_deadline = nNow + ASYNC_RECONNECT_INTERVAL;
+	ATOMIC_ADD(&CAsyncDBManager::getInstance()->m_stat.reconnect_cnt, 1);
+}
+
+/*
+ * 异步线程, 一个epoll循环驱动本线程的所有连接
+ * 工作线程提交的查询放进m_query_list, 用eventfd唤醒
+ */
+class CAsyncDBThread : public CThread {
+public:
+	CAsyncDBThread();
+	virtual ~CAsyncDBThread();
+
+	int Init(const set<string>& instance_set, uint32_t conn_cnt);
+	void AddQuery(AsyncQuery_t* pQuery);
+
+	virtual void OnThreadRun(void);
+private:
+	void _Dispatch(uint64_t nNow);
+	void _CheckDeadline(uint64_t nNow);
+	int _GetTimeout(uint64_t nNow);
+	void _FailQuery(AsyncQuery_t* pQuery);
+private:
+	typedef struct {
+		vector<CAsyncDBConn*>	conn_list;
+		list<AsyncQuery_t*>		query_list;		// 等待空闲连接的查询
+	} AsyncPool_t;
+
+	int						m_epfd;
+	int						m_event_fd;
+
+	CLock					m_lock;
+	list<AsyncQuery_t*>		m_query_list;		// 其他线程提交的查询
+
+	map<string, AsyncPool_t>	m_pool_map;
+};
+
+CAsyncDBThread::CAsyncDBThread()
+{
+	m_epfd = -1;
+	m_event_fd = -1;
+}
+
+CAsyncDBThread::~CAsyncDBThread()
+{
+}
+
+int CAsyncDBThread::Init(const set<string>& instance_set, uint32_t conn_cnt)
+{
+	m_epfd = epoll_create(1024);
+	m_event_fd = eventfd(0, EFD_NONBLOCK);
+	if (m_epfd == -1 || m_event_fd == -1) {
+		log("create epoll/eventfd failed, errno=%d", errno);
+		return 1;
+	}
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_event_fd, &ev);
+
+	for (set<string>::const_iterator it = instance_set.begin(); it != instance_set.end(); it++) {
+		CDBPool* pDBPool = CDBManager::getInstance()->GetDBPool(it->c_str());
+		AsyncPool_t& pool = m_pool_map[*it];
+		for (uint32_t i = 0; i < conn_cnt; i++) {
+			pool.conn_list.push_back(new CAsyncDBConn(pDBPool, m_epfd));
+		}
+	}
+
+	return 0;
+}
+
+void CAsyncDBThread::AddQuery(AsyncQuery_t* pQuery)
+{
+	m_lock.lock();
+	m_query_list.push_back(pQuery);
+	m_lock.unlock();
+
+	uint64_t nOne = 1;
+	if (write(m_event_fd, &nOne, sizeof(nOne)) != sizeof(nOne)) {
+		// 计数器满了也一定是可读的, 不影响唤醒
+	}
+}
+
+void CAsyncDBThread::OnThreadRun(void)
+{
+	mysql_thread_init();
+
+	uint64_t nNow = get_tick_count();
+	for (map<string, AsyncPool_t>::iterator it = m_pool_map.begin(); it != m_pool_map.end(); it++) {
+		for (size_t i = 0; i < it->second.conn_list.size(); i++) {
+			it->second.conn_list[i]->Connect(nNow);
+		}
+	}
+
+	struct epoll_event events[ASYNC_EPOLL_EVENT_CNT];
+	while (true) {
+		int nfds = epoll_wait(m_epfd, events, ASYNC_EPOLL_EVENT_CNT, _GetTimeout(nNow));
+		nNow = get_tick_count();
+
+		for (int i = 0; i < nfds; i++) {
+			if (events[i].data.ptr == NULL) {
+				uint64_t nCnt = 0;
+				if (read(m_event_fd, &nCnt, sizeof(nCnt)) != sizeof(nCnt)) {
+					// 别的事件已经读过了
+				}
+				continue;
+			}
+
+			int nStatus = 0;
+			if (events[i].events & EPOLLIN)
+				nStatus |= MYSQL_WAIT_READ;
+			if (events[i].events & EPOLLOUT)
+				nStatus |= MYSQL_WAIT_WRITE;
+			if (events[i].events & EPOLLPRI)
+				nStatus |= MYSQL_WAIT_EXCEPT;
+			if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+				nStatus |= MYSQL_WAIT_READ | MYSQL_WAIT_WRITE;
+			((CAsyncDBConn*)events[i].data.ptr)->OnEvent(nStatus, nNow);
+		}
+
+		_CheckDeadline(nNow);
+		_Dispatch(nNow);
+	}
+}
+
+void CAsyncDBThread::_Dispatch(uint64_t nNow)
+{
+	list<AsyncQuery_t*> query_list;
+	m_lock.lock();
+	query_list.swap(m_query_list);
+	m_lock.unlock();
+
+	for (list<AsyncQuery_t*>::iterator it = query_list.begin(); it != query_list.end(); it++) {
+		m_pool_map[(*it)->pool_name].query_list.push_back(*it);
+	}
+
+	CAsyncDBManager* pManager = CAsyncDBManager::getInstance();
+	for (map<string, AsyncPool_t>::iterator it = m_pool_map.begin(); it != m_pool_map.end(); it++) {
+		AsyncPool_t& pool = it->second;
+		bool bUsable = false;
+		for (size_t i = 0; i < pool.conn_list.size(); i++) {
+			CAsyncDBConn* pConn = pool.conn_list[i];
+			if (pConn->GetState() != ASYNC_CONN_CLOSED) {
+				bUsable = true;
+			}
+			if (pConn->GetState() == ASYNC_CONN_IDLE && !pool.query_list.empty()) {
+				AsyncQuery_t* pQuery = pool.query_list.front();
+				pool.query_list.pop_front();
+				ATOMIC_ADD(&pManager->m_stat.wait_time, nNow - pQuery->submit_tick);
+				pConn->Execute(pQuery, nNow);
+			}
+		}
+
+		// 所有连接都断了, 不让查询一直排队, 直接失败
+		if (!bUsable && !pool.query_list.empty()) {
+			log("no async db connection for %s, %lu queries failed", it->first.c_str(), pool.query_list.size());
+			while (!pool.query_list.empty()) {
+				AsyncQuery_t* pQuery = pool.query_list.front();
+				pool.query_list.pop_front();
+				_FailQuery(pQuery);
+			}
+		}
+	}
+}
+
+void CAsyncDBThread::_CheckDeadline(uint64_t nNow)
+{
+	for (map<string, AsyncPool_t>::iterator it = m_pool_map.begin(); it != m_pool_map.end(); it++) {
+		for (size_t i = 0; i < it->second.conn_list.size(); i++) {
+			CAsyncDBConn* pConn = it->second.conn_list[i];
+			uint64_t nDeadline = pConn->GetDeadline();
+			if (nDeadline && nDeadline <= nNow) {
+				pConn->OnEvent(MYSQL_WAIT_TIMEOUT, nNow);
+			}
+		}
+	}
+}
+
+int CAsyncDBThread::_GetTimeout(uint64_t nNow)
+{
+	uint64_t nTimeout = ASYNC_MAX_WAIT_TIME;
+	for (map<string, AsyncPool_t>::iterator it = m_pool_map.begin(); it != m_pool_map.end(); it++) {
+		for (size_t i = 0; i < it->second.conn_list.size(); i++) {
+			uint64_t nDeadline = it->second.conn_list[i]->GetDeadline();
+			if (nDeadline == 0) {
+				continue;
+			}
+			if (nDeadline <= nNow) {
+				return 0;
+			}
+			if (nDeadline - nNow < nTimeout) {
+				nTimeout = nDeadline - nNow;
+			}
+		}
+	}
+	return (int)nTimeout;
+}
+
+void CAsyncDBThread::_FailQuery(AsyncQuery_t* pQuery)
+{
+	ATOMIC_ADD(&CAsyncDBManager::getInstance()->m_stat.error_cnt, 1);
+	pQuery->callback(NULL);
+	delete pQuery;
+}
+
+#else
+
+// 没有非阻塞接口, 不会创建异步线程, 只是为了编译通过
+class CAsyncDBThread : public CThread {
+public:
+	int Init(const set<string>&, uint32_t) { return 1; }
+	void AddQuery(AsyncQuery_t*) {}
+	virtual void OnThreadRun(void) {}
+};
+
+#endif
+
+CAsyncDBManager* CAsyncDBManager::s_async_db_manager = NULL;
+
+CAsyncDBManager::CAsyncDBManager()
+{
+	m_next_thread = 0;
+	m_last_log_tick = 0;
+	memset(&m_stat, 0, sizeof(m_stat));
+}
+
+CAsyncDBManager::~CAsyncDBManager()
+{
+}
+
+CAsyncDBManager* CAsyncDBManager::getInstance()
+{
+	if (!s_async_db_manager) {
+		s_async_db_manager = new CAsyncDBManager();
+	}
+
+	return s_async_db_manager;
+}
+
+int CAsyncDBManager::Init()
+{
+	CConfigFileReader config_file("dbproxyserver.conf");
+	char* str_thread_num = config_file.GetConfigName("AsyncDBThreadNum");
+	char* str_conn_cnt = config_file.GetConfigName("AsyncDBConnCnt");
+	char* str_instances = config_file.GetConfigName("AsyncDBInstances");
+
+	uint32_t thread_num = str_thread_num ? atoi(str_thread_num) : 0;
+	uint32_t conn_cnt = (str_conn_cnt && atoi(str_conn_cnt) > 0) ? atoi(str_conn_cnt) : DEFAULT_ASYNC_CONN_CNT;
+	return Init(thread_num, conn_cnt, str_instances);
+}
+
+int CAsyncDBManager::Init(uint32_t thread_num, uint32_t conn_cnt, const char* instances)
+{
+	if (thread_num == 0 || !instances) {
+		log("async db disabled");
+		return 0;
+	}
+
+#ifndef MYSQL_WAIT_READ
+	log("mysql client library has no non-blocking api, async db disabled");
+	return 0;
+#endif
+
+	CStrExplode instances_name((char*)instances, ',');
+	for (uint32_t i = 0; i < instances_name.GetItemCnt(); i++) {
+		char* pool_name = instances_name.GetItem(i);
+		if (!CDBManager::getInstance()->GetDBPool(pool_name)) {
+			log("async db instance %s is not in DBInstances", pool_name);
+			continue;
+		}
+		m_instance_set.insert(pool_name);
+	}
+	if (m_instance_set.empty()) {
+		log("no async db instance, async db disabled");
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < thread_num; i++) {
+		CAsyncDBThread* pThread = new CAsyncDBThread();
+		if (pThread->Init(m_instance_set, conn_cnt)) {
+			delete pThread;
+			return 1;
+		}
+		m_thread_list.push_back(pThread);
+	}
+	for (uint32_t i = 0; i < m_thread_list.size(); i++) {
+		m_thread_list[i]->StartThread();
+	}
+
+	log("async db enabled, thread_num=%u, conn_cnt=%u, instances=%s", thread_num, conn_cnt, instances);
+	return 0;
+}
+
+void CAsyncDBManager::Query(const char* dbpool_name, const string& sql, const AsyncQueryCallback& callback)
+{
+	uint64_t nNow = get_tick_count();
+	ATOMIC_ADD(&m_stat.query_cnt, 1);
+	_LogStat(nNow);
+
+	if (m_thread_list.empty() || m_instance_set.find(dbpool_name) == m_instance_set.end()) {
+		ATOMIC_ADD(&m_stat.sync_cnt, 1);
+		_QuerySync(dbpool_name, sql, callback);
+		return;
+	}
+
+	AsyncQuery_t* pQuery = new AsyncQuery_t;
+	pQuery->pool_name = dbpool_name;
+	pQuery->sql = sql;
+	pQuery->callback = callback;
+	pQuery->submit_tick = nNow;
+	pQuery->start_tick = 0;
+
+	uint32_t nIndex = ATOMIC_ADD_AND_FETCH(&m_next_thread, 1) % m_thread_list.size();
+	m_thread_list[nIndex]->AddQuery(pQuery);
+}
+
+void CAsyncDBManager::GetStat(AsyncDBStat_t* pStat)
+{
+	pStat->query_cnt = ATOMIC_FETCH(&m_stat.query_cnt);
+	pStat->error_cnt = ATOMIC_FETCH(&m_stat.error_cnt);
+	pStat->sync_cnt = ATOMIC_FETCH(&m_stat.sync_cnt);
+	pStat->reconnect_cnt = ATOMIC_FETCH(&m_stat.reconnect_cnt);
+	pStat->wait_time = ATOMIC_FETCH(&m_stat.wait_time);
+	pStat->exec_time = ATOMIC_FETCH(&m_stat.exec_time);
+}
+
+void CAsyncDBManager::_QuerySync(const char* dbpool_name, const string& sql, const AsyncQueryCallback& callback)
+{
+	CResultSet* pResultSet = NULL;
+	CDBManager* pDBManager = CDBManager::getInstance();
+	CDBConn* pDBConn = pDBManager->GetDBConn(dbpool_name);
+	if (pDBConn) {
+		pResultSet = pDBConn->ExecuteQuery(sql.c_str());
+		// 结果已经全部取到客户端, 先释放连接, 回调里还可以再取连接
+		pDBManager->RelDBConn(pDBConn);
+	} else {
+		log("no db connection for %s", dbpool_name);
+	}
+
+	if (!pResultSet) {
+		ATOMIC_ADD(&m_stat.error_cnt, 1);
+	}
+	callback(pResultSet);
+	delete pResultSet;
+}
+
+void CAsyncDBManager::_LogStat(uint64_t nNow)
+{
+	uint64_t nLast = m_last_log_tick;
+	if (nNow < nLast + ASYNC_DB_STAT_INTERVAL)
+		return;
+	if (!__sync_bool_compare_and_swap(&m_last_log_tick, nLast, nNow))
+		return;
+
+	AsyncDBStat_t stat;
+	GetStat(&stat);
+	uint64_t nAsyncCnt = stat.query_cnt - stat.sync_cnt;
+	if (nAsyncCnt == 0)
+		return;
+
+	log("async db stat: query_cnt=%llu, sync_cnt=%llu, error_cnt=%llu, reconnect_cnt=%llu, avg_wait=%.2fms, avg_exec=%.2fms",
+		(unsigned long long)stat.query_cnt, (unsigned long long)stat.sync_cnt, (unsigned long long)stat.error_cnt,
+		(unsigned long long)stat.reconnect_cnt, (double)stat.wait_time / nAsyncCnt, (double)stat.exec_time / nAsyncCnt);
+}
@@ -0,0 +1,74 @@
+/*
+ * AsyncDBPool.h
+ *
+ * 基于MariaDB客户端非阻塞接口(mysql_real_query_start/_cont)的异步查询:
+ * 每个异步线程一个epoll循环, 对每个配置的实例各持有若干连接, 一个线程上同时有多个查询在执行,
+ * 工作线程提交查询后直接返回, 不再阻塞在mysql_real_query和连接池的m_free_notify.Wait()上;
+ * 查询完成后在异步线程里调用回调(continuation), 回调里组装应答, 用CProxyConn::AddResponsePdu发回
+ *
+ * 回调在异步线程里执行, 不能再做阻塞的操作(同步查库, 访问redis等), 否则会卡住这个线程上所有的查询;
+ * 回调的pResultSet为NULL表示失败, 回调返回后结果集即被释放
+ * 只支持返回结果集的查询(select), 写操作仍然走CDBConn
+ *
+ * 没有开启(AsyncDBThreadNum=0), 客户端库不支持非阻塞接口, 或者实例不在AsyncDBInstances里时,
+ * Query()在调用线程里用CDBConn同步执行并调用回调, 业务代码不用区分
+ *
+ * 配置(dbproxyserver.conf):
+ *   AsyncDBThreadNum=2					# 异步线程数, 0表示关闭
+ *   AsyncDBConnCnt=8					# 每个线程对每个实例的连接数, 即每个线程最多同时执行的查询数
+ *   AsyncDBInstances=teamtalk_slave	# 哪些实例使用异步查询, 连接参数和DBInstances里的相同
+ */
+
+#ifndef ASYNCDBPOOL_H_
+#define ASYNCDBPOOL_H_
+
+#include <functional>
+#include <set>
+#include "DBPool.h"
+#include "Lock.h"
+
+typedef std::function<void (CResultSet* pResultSet)> AsyncQueryCallback;
+
+typedef struct {
+	uint64_t	query_cnt;		// 提交的查询数
+	uint64_t	error_cnt;		// 失败的查询数
+	uint64_t	sync_cnt;		// 没有异步连接, 同步执行的查询数
+	uint64_t	reconnect_cnt;
+	uint64_t	wait_time;		// 查询在队列里等待空闲连接的总时间, 毫秒
+	uint64_t	exec_time;		// 查询从发出到收完结果的总时间, 毫秒
+} AsyncDBStat_t;
+
+class CAsyncDBThread;
+
+class CAsyncDBManager {
+public:
+	virtual ~CAsyncDBManager();
+
+	static CAsyncDBManager* getInstance();
+
+	// 在CDBManager::Init之后调用, 从配置文件读取参数
+	int Init();
+	int Init(uint32_t thread_num, uint32_t conn_cnt, const char* instances);
+	bool IsEnabled() { return !m_thread_list.empty(); }
+
+	void Query(const char* dbpool_name, const string& sql, const AsyncQueryCallback& callback);
+
+	void GetStat(AsyncDBStat_t* pStat);
+private:
+	CAsyncDBManager();
+	void _QuerySync(const char* dbpool_name, const string& sql, const AsyncQueryCallback& callback);
+	void _LogStat(uint64_t nNow);
+private:
+	static CAsyncDBManager*		s_async_db_manager;
+
+	vector<CAsyncDBThread*>		m_thread_list;
+	set<string>					m_instance_set;
+	uint32_t					m_next_thread;
+
+	AsyncDBStat_t				m_stat;			// 原子操作更新, 不加锁
+	volatile uint64_t			m_last_log_tick;
+	friend class CAsyncDBThread;
+	friend class CAsyncDBConn;
+};
+
+#endif /* ASYNCDBPOOL_H_ */
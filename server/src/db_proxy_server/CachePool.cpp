@@ -558,6 +558,244 @@ bool CacheConn::lrange(string key, long start, long end, list<string>& ret_value
 	return true;
 }
 
+///////////////
+CachePipeline::CachePipeline(CacheConn* pCacheConn)
+{
+	m_pCacheConn = pCacheConn;
+}
+
+CachePipeline::~CachePipeline()
+{
+	_FreeReplies();
+}
+
+uint32_t CachePipeline::append(const vector<string>& argv)
+{
+	m_cmd_list.push_back(argv);
+	return (uint32_t)m_cmd_list.size() - 1;
+}
+
+uint32_t CachePipeline::get(const string& key)
+{
+	vector<string> argv;
+	argv.push_back("GET");
+	argv.push_back(key);
+	return append(argv);
+}
+
+uint32_t CachePipeline::set(const string& key, const string& value)
+{
+	vector<string> argv;
+	argv.push_back("SET");
+	argv.push_back(key);
+	argv.push_back(value);
+	return append(argv);
+}
+
+uint32_t CachePipeline::del(const string& key)
+{
+	vector<string> argv;
+	argv.push_back("DEL");
+	argv.push_back(key);
+	return append(argv);
+}
+
+uint32_t CachePipeline::hget(const string& key, const string& field)
+{
+	vector<string> argv;
+	argv.push_back("HGET");
+	argv.push_back(key);
+	argv.push_back(field);
+	return append(argv);
+}
+
+uint32_t CachePipeline::hgetAll(const string& key)
+{
+	vector<string> argv;
+	argv.push_back("HGETALL");
+	argv.push_back(key);
+	return append(argv);
+}
+
+uint32_t CachePipeline::hset(const string& key, const string& field, const string& value)
+{
+	vector<string> argv;
+	argv.push_back("HSET");
+	argv.push_back(key);
+	argv.push_back(field);
+	argv.push_back(value);
+	return append(argv);
+}
+
+uint32_t CachePipeline::hdel(const string& key, const string& field)
+{
+	vector<string> argv;
+	argv.push_back("HDEL");
+	argv.push_back(key);
+	argv.push_back(field);
+	return append(argv);
+}
+
+uint32_t CachePipeline::hincrBy(const string& key, const string& field, long value)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%ld", value);
+
+	vector<string> argv;
+	argv.push_back("HINCRBY");
+	argv.push_back(key);
+	argv.push_back(field);
+	argv.push_back(buf);
+	return append(argv);
+}
+
+bool CachePipeline::exec()
+{
+	_FreeReplies();
+
+	if (m_cmd_list.empty()) {
+		return true;
+	}
+
+	if (m_pCacheConn->Init()) {
+		return false;
+	}
+
+	redisContext* pContext = m_pCacheConn->m_pContext;
+	vector<const char*> argv;
+	vector<size_t> argvlen;
+	for (size_t i = 0; i < m_cmd_list.size(); i++) {
+		const vector<string>& cmd = m_cmd_list[i];
+		argv.resize(cmd.size());
+		argvlen.resize(cmd.size());
+		for (size_t j = 0; j < cmd.size(); j++) {
+			argv[j] = cmd[j].data();
+			argvlen[j] = cmd[j].size();
+		}
+
+		// 只写到hiredis的输出缓冲区, 第一次redisGetReply时才真正发送
+		if (redisAppendCommandArgv(pContext, (int)cmd.size(), &argv[0], &argvlen[0]) != REDIS_OK) {
+			log("redisAppendCommandArgv failed:%s", pContext->errstr);
+			redisFree(pContext);
+			m_pCacheConn->m_pContext = NULL;
+			return false;
+		}
+	}
+
+	m_reply_list.reserve(m_cmd_list.size());
+	for (size_t i = 0; i < m_cmd_list.size(); i++) {
+		void* reply = NULL;
+		if (redisGetReply(pContext, &reply) != REDIS_OK || !reply) {
+			// 回复没收全, 连接上还有残留的数据, 只能断开
+			log("redisGetReply failed:%s, cmd_cnt=%lu, reply_cnt=%lu", pContext->errstr,
+				m_cmd_list.size(), m_reply_list.size());
+			redisFree(pContext);
+			m_pCacheConn->m_pContext = NULL;
+			_FreeReplies();
+			return false;
+		}
+
+		m_reply_list.push_back((redisReply*)reply);
+	}
+
+	return true;
+}
+
+void CachePipeline::clear()
+{
+	m_cmd_list.clear();
+	_FreeReplies();
+}
+
+bool CachePipeline::isNil(uint32_t idx)
+{
+	redisReply* reply = _GetReply(idx);
+	return !reply || (reply->type == REDIS_REPLY_NIL);
+}
+
+bool CachePipeline::isInteger(uint32_t idx)
+{
+	redisReply* reply = _GetReply(idx);
+	return reply && (reply->type == REDIS_REPLY_INTEGER);
+}
+
+string CachePipeline::getError(uint32_t idx)
+{
+	string value;
+	if (idx < m_reply_list.size() && m_reply_list[idx]->type == REDIS_REPLY_ERROR) {
+		value.append(m_reply_list[idx]->str, m_reply_list[idx]->len);
+	}
+
+	return value;
+}
+
+string CachePipeline::getString(uint32_t idx)
+{
+	string value;
+	redisReply* reply = _GetReply(idx);
+	if (reply && (reply->type == REDIS_REPLY_STRING || reply->type == REDIS_REPLY_STATUS)) {
+		value.append(reply->str, reply->len);
+	}
+
+	return value;
+}
+
+long CachePipeline::getInteger(uint32_t idx)
+{
+	redisReply* reply = _GetReply(idx);
+	if (!reply) {
+		return 0;
+	}
+
+	if (reply->type == REDIS_REPLY_INTEGER) {
+		return (long)reply->integer;
+	} else if (reply->type == REDIS_REPLY_STRING) {
+		return atol(reply->str);
+	}
+
+	return 0;
+}
+
+bool CachePipeline::getHash(uint32_t idx, map<string, string>& ret_value)
+{
+	redisReply* reply = _GetReply(idx);
+	if (!reply || reply->type != REDIS_REPLY_ARRAY || (reply->elements % 2 != 0)) {
+		return false;
+	}
+
+	for (size_t i = 0; i + 1 < reply->elements; i += 2) {
+		redisReply* field_reply = reply->element[i];
+		redisReply* value_reply = reply->element[i + 1];
+		ret_value[string(field_reply->str, field_reply->len)] = string(value_reply->str, value_reply->len);
+	}
+
+	return true;
+}
+
+redisReply* CachePipeline::_GetReply(uint32_t idx)
+{
+	if (idx >= m_reply_list.size()) {
+		return NULL;
+	}
+
+	redisReply* reply = m_reply_list[idx];
+	if (reply->type == REDIS_REPLY_ERROR) {
+		log("pipeline cmd %u error: %s", idx, reply->str);
+		return NULL;
+	}
+
+	return reply;
+}
+
+void CachePipeline::_FreeReplies()
+{
+	for (size_t i = 0; i < m_reply_list.size(); i++) {
+		freeReplyObject(m_reply_list[i]);
+	}
+
+	m_reply_list.clear();
+}
+
 ///////////////
 CachePool::CachePool(const char* pool_name, const char* server_ip, int server_port, int db_num, int max_conn_cnt)
 {
@@ -567,6 +805,12 @@ CachePool::CachePool(const char* pool_name, const char* server_ip, int server_po
 	m_db_num = db_num;
 	m_max_conn_cnt = max_conn_cnt;
 	m_cur_conn_cnt = MIN_CACHE_CONN_CNT;
+
+	CMetricsRegistry* pRegistry = CMetricsRegistry::getInstance();
+	string labels = metrics_label("pool", m_pool_name);
+	m_wait_histogram = pRegistry->GetLatencyHistogram("teamtalk_cache_pool_wait_seconds", "time spent waiting for a free redis connection", labels);
+	m_busy_gauge = pRegistry->GetGauge("teamtalk_cache_pool_busy_conns", "redis connections taken from the pool", labels);
+	m_conn_gauge = pRegistry->GetGauge("teamtalk_cache_pool_conns", "redis connections opened by the pool", labels);
 }
 
 CachePool::~CachePool()
@@ -594,6 +838,7 @@ int CachePool::Init()
 		m_free_list.push_back(pConn);
 	}
 
+	m_conn_gauge->Set(m_cur_conn_cnt);
 	log("cache pool: %s, list size: %lu", m_pool_name.c_str(), m_free_list.size());
 	return 0;
 }
@@ -602,6 +847,8 @@ CacheConn* CachePool::GetCacheConn()
 {
 	m_free_notify.Lock();
 
+	// 有空闲连接时不取时间
+	uint64_t start_us = m_free_list.empty() ? metrics_now_us() : 0;
 	while (m_free_list.empty()) {
 		if (m_cur_conn_cnt >= m_max_conn_cnt) {
 			m_free_notify.Wait();
@@ -616,6 +863,7 @@ CacheConn* CachePool::GetCacheConn()
 			} else {
 				m_free_list.push_back(pCacheConn);
 				m_cur_conn_cnt++;
+				m_conn_gauge->Set(m_cur_conn_cnt);
 				log("new cache connection: %s, conn_cnt: %d", m_pool_name.c_str(), m_cur_conn_cnt);
 			}
 		}
@@ -626,6 +874,9 @@ CacheConn* CachePool::GetCacheConn()
 
 	m_free_notify.Unlock();
 
+	m_wait_histogram->Observe(start_us ? metrics_now_us() - start_us : 0);
+	m_busy_gauge->Add(1);
+
 	return pConn;
 }
 
@@ -642,6 +893,7 @@ void CachePool::RelCacheConn(CacheConn* pCacheConn)
 
 	if (it == m_free_list.end()) {
 		m_free_list.push_back(pCacheConn);
+		m_busy_gauge->Sub(1);
 	}
 
 	m_free_notify.Signal();
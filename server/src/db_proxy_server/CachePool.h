@@ -14,9 +14,11 @@
 #include <vector>
 #include "../base/util.h"
 #include "ThreadPool.h"
+#include "Metrics.h"
 #include "hiredis.h"
 
 class CachePool;
+class CachePipeline;
 
 class CacheConn {
 public:
@@ -57,11 +59,61 @@ public:
 	bool lrange(string key, long start, long end, list<string>& ret_value);
 
 private:
+	friend class CachePipeline;
+
 	CachePool* 		m_pCachePool;
 	redisContext* 	m_pContext;
 	uint64_t		m_last_connect_time;
 };
 
+/*
+ * 流水线: 先把多条命令排队, exec()时用redisAppendCommandArgv一次写出去,
+ * 再按顺序收取所有回复, N条命令只需要一次网络往返; 参数按二进制安全的方式传递
+ * 用法:
+ *   CachePipeline pipe(pCacheConn);
+ *   pipe.hget(key1, field); pipe.hget(key2, field);
+ *   if (pipe.exec()) { string v1 = pipe.getString(0); ... }
+ */
+class CachePipeline {
+public:
+	CachePipeline(CacheConn* pCacheConn);
+	virtual ~CachePipeline();
+
+	// 排队命令, 返回该命令回复的序号
+	uint32_t append(const vector<string>& argv);
+	uint32_t get(const string& key);
+	uint32_t set(const string& key, const string& value);
+	uint32_t del(const string& key);
+	uint32_t hget(const string& key, const string& field);
+	uint32_t hgetAll(const string& key);
+	uint32_t hset(const string& key, const string& field, const string& value);
+	uint32_t hdel(const string& key, const string& field);
+	uint32_t hincrBy(const string& key, const string& field, long value);
+
+	uint32_t size() { return (uint32_t)m_cmd_list.size(); }
+
+	// 发送所有排队的命令并收取回复, 失败时连接会被重置, 下次使用时重连
+	bool exec();
+	// 清除命令和回复, 可以继续排队下一批
+	void clear();
+
+	// 按序号取回复, 类型不符或为nil时返回默认值
+	bool isNil(uint32_t idx);
+	bool isInteger(uint32_t idx);
+	string getString(uint32_t idx);
+	long getInteger(uint32_t idx);
+	// 回复是错误时返回错误信息, 否则返回空串
+	string getError(uint32_t idx);
+	bool getHash(uint32_t idx, map<string, string>& ret_value);
+private:
+	redisReply* _GetReply(uint32_t idx);
+	void _FreeReplies();
+private:
+	CacheConn*				m_pCacheConn;
+	vector<vector<string> >	m_cmd_list;
+	vector<redisReply*>		m_reply_list;
+};
+
 class CachePool {
 public:
 	CachePool(const char* pool_name, const char* server_ip, int server_port, int db_num, int max_conn_cnt);
@@ -88,6 +140,10 @@ private:
 	//每一个缓存池对象CachePool的成员变量m_free_list中存储着若干个与redis的连接对象，具体是多少个，根据配置文件来配置
 	list<CacheConn*>	m_free_list;   
 	CThreadNotify		m_free_notify;
+
+	CMetricHistogram*	m_wait_histogram;	// GetCacheConn()等待空闲连接的时间
+	CMetricGauge*		m_busy_gauge;		// 被取走还没归还的连接数
+	CMetricGauge*		m_conn_gauge;		// 已经建立的连接数
 };
 
 class CacheManager {
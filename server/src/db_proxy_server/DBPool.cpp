@@ -11,24 +11,43 @@
  */
 
 
+#include <errmsg.h>
+#include <mysqld_error.h>
 #include "DBPool.h"
 #include "ConfigFileReader.h"
 
 #define MIN_DB_CONN_CNT		2
+#define MAX_STMT_CACHE_CNT	64		// 每个连接缓存的prepare语句数
+#define DB_CHECK_INTERVAL	10000	// 连接空闲超过这个时间(毫秒)才ping一次
 
 CDBManager* CDBManager::s_db_manager = NULL;
 
-CResultSet::CResultSet(MYSQL_RES* res)
+// 文本协议的整数列, 已知长度, 不用atoi再扫一遍找结束符
+static uint64_t parse_uint64(const char* str, unsigned long len)
 {
-	m_res = res;
+	unsigned long i = 0;
+	bool negative = false;
+	if (len > 0 && str[0] == '-') {
+		negative = true;
+		i++;
+	}
 
-	// map table field key to index in the result array
-	int num_fields = mysql_num_fields(m_res);
-	MYSQL_FIELD* fields = mysql_fetch_fields(m_res);
-	for(int i = 0; i < num_fields; i++)
-	{
-	   m_key_map.insert(make_pair(fields[i].name, i));
+	uint64_t value = 0;
+	for (; i < len && str[i] >= '0' && str[i] <= '9'; i++) {
+		value = value * 10 + (str[i] - '0');
 	}
+
+	return negative ? (uint64_t)(-(int64_t)value) : value;
+}
+
+static char s_empty_string[1] = {0};
+
+CResultSet::CResultSet(MYSQL_RES* res)
+{
+	m_res = res;
+	m_row = NULL;
+	m_lengths = NULL;
+	m_col_cnt = mysql_num_fields(m_res);
 }
 
 CResultSet::~CResultSet()
@@ -43,40 +62,45 @@ bool CResultSet::Next()
 {
 	m_row = mysql_fetch_row(m_res);
 	if (m_row) {
+		m_lengths = mysql_fetch_lengths(m_res);
 		return true;
 	} else {
 		return false;
 	}
 }
 
-int CResultSet::_GetIndex(const char* key)
+bool CResultSet::IsNull(uint32_t index)
 {
-	map<string, int>::iterator it = m_key_map.find(key);
-	if (it == m_key_map.end()) {
-		return -1;
-	} else {
-		return it->second;
-	}
+	return index >= m_col_cnt || m_row[index] == NULL;
 }
 
-int CResultSet::GetInt(const char* key)
+uint64_t CResultSet::GetUInt64(uint32_t index)
 {
-	int idx = _GetIndex(key);
-	if (idx == -1) {
+	if (index >= m_col_cnt) {
+		log("index too large: %d", index);
 		return 0;
-	} else {
-		return atoi(m_row[idx]);
 	}
+
+	if (!m_row[index]) {
+		return 0;
+	}
+
+	return parse_uint64(m_row[index], m_lengths[index]);
 }
 
-char* CResultSet::GetString(const char* key)
+DBString_t CResultSet::GetStringRef(uint32_t index)
 {
-	int idx = _GetIndex(key);
-	if (idx == -1) {
-		return NULL;
-	} else {
-		return m_row[idx];
+	DBString_t str = {s_empty_string, 0};
+	if (index >= m_col_cnt) {
+		log("index too large: %d", index);
+		return str;
+	}
+
+	if (m_row[index]) {
+		str.data = m_row[index];
+		str.len = (uint32_t)m_lengths[index];
 	}
+	return str;
 }
 
 /////////////////////////////////////////
@@ -85,10 +109,15 @@ CPrepareStatement::CPrepareStatement()
 	m_stmt = NULL;
 	m_param_bind = NULL;
 	m_param_cnt = 0;
+	m_result_bind = NULL;
+	m_has_result = false;
+	m_pDBConn = NULL;
 }
 
 CPrepareStatement::~CPrepareStatement()
 {
+	_FreeResult();
+
 	if (m_stmt) {
 		mysql_stmt_close(m_stmt);
 		m_stmt = NULL;
@@ -98,6 +127,11 @@ CPrepareStatement::~CPrepareStatement()
 		delete [] m_param_bind;
 		m_param_bind = NULL;
 	}
+
+	if (m_result_bind) {
+		delete [] m_result_bind;
+		m_result_bind = NULL;
+	}
 }
 
 bool CPrepareStatement::Init(MYSQL* mysql, string& sql)
@@ -175,20 +209,33 @@ void CPrepareStatement::SetParam(uint32_t index, const string& value)
     m_param_bind[index].buffer_length = value.size();
 }
 
-bool CPrepareStatement::ExecuteUpdate()
+bool CPrepareStatement::_Execute()
 {
 	if (!m_stmt) {
 		log("no m_stmt");
 		return false;
 	}
 
-	if (mysql_stmt_bind_param(m_stmt, m_param_bind)) {
+	// 上一次查询的结果没有取完也要先释放, 否则语句不能再执行
+	_FreeResult();
+
+	if (m_param_cnt > 0 && mysql_stmt_bind_param(m_stmt, m_param_bind)) {
 		log("mysql_stmt_bind_param failed: %s", mysql_stmt_error(m_stmt));
 		return false;
 	}
 
 	if (mysql_stmt_execute(m_stmt)) {
 		log("mysql_stmt_execute failed: %s", mysql_stmt_error(m_stmt));
+		_CheckError();
+		return false;
+	}
+
+	return true;
+}
+
+bool CPrepareStatement::ExecuteUpdate()
+{
+	if (!_Execute()) {
 		return false;
 	}
 
@@ -205,16 +252,185 @@ uint32_t CPrepareStatement::GetInsertId()
 	return mysql_stmt_insert_id(m_stmt);
 }
 
+bool CPrepareStatement::ExecuteQuery()
+{
+	if (!_Execute()) {
+		return false;
+	}
+
+	// 取到客户端时让库计算每列的max_length, 用来分配字符串列的缓冲区
+	my_bool update_max_length = 1;
+	mysql_stmt_attr_set(m_stmt, STMT_ATTR_UPDATE_MAX_LENGTH, &update_max_length);
+	if (mysql_stmt_store_result(m_stmt)) {
+		log("mysql_stmt_store_result failed: %s", mysql_stmt_error(m_stmt));
+		_CheckError();
+		return false;
+	}
+
+	m_has_result = true;
+	if (!_BindResult()) {
+		_FreeResult();
+		return false;
+	}
+
+	return true;
+}
+
+bool CPrepareStatement::Next()
+{
+	if (!m_has_result) {
+		return false;
+	}
+
+	int ret = mysql_stmt_fetch(m_stmt);
+	if (ret == 0 || ret == MYSQL_DATA_TRUNCATED) {
+		for (size_t i = 0; i < m_result_col.size(); i++) {
+			ResultCol_t& col = m_result_col[i];
+			if (col.is_null) {
+				col.int_value = 0;
+				col.length = 0;
+			}
+			if (!col.is_int) {
+				unsigned long len = min(col.length, (unsigned long)col.str_value.size() - 1);
+				col.str_value[len] = 0;
+			}
+		}
+		return true;
+	}
+
+	if (ret != MYSQL_NO_DATA) {
+		log("mysql_stmt_fetch failed: %s", mysql_stmt_error(m_stmt));
+	}
+	_FreeResult();
+	return false;
+}
+
+bool CPrepareStatement::IsNull(uint32_t index)
+{
+	return index >= m_result_col.size() || m_result_col[index].is_null;
+}
+
+uint64_t CPrepareStatement::GetUInt64(uint32_t index)
+{
+	if (index >= m_result_col.size()) {
+		log("index too large: %d", index);
+		return 0;
+	}
+
+	ResultCol_t& col = m_result_col[index];
+	return col.is_int ? (uint64_t)col.int_value : parse_uint64(&col.str_value[0], col.length);
+}
+
+DBString_t CPrepareStatement::GetStringRef(uint32_t index)
+{
+	DBString_t str = {s_empty_string, 0};
+	if (index >= m_result_col.size()) {
+		log("index too large: %d", index);
+		return str;
+	}
+
+	ResultCol_t& col = m_result_col[index];
+	if (col.is_null) {
+		return str;
+	}
+
+	if (col.is_int) {
+		// 整数列按字符串取的情况很少, 用到时再格式化
+		col.str_value.resize(24);
+		col.length = snprintf(&col.str_value[0], col.str_value.size(), "%lld", (long long)col.int_value);
+	}
+	str.data = &col.str_value[0];
+	str.len = (uint32_t)col.length;
+	return str;
+}
+
+bool CPrepareStatement::_BindResult()
+{
+	MYSQL_RES* meta = mysql_stmt_result_metadata(m_stmt);
+	if (!meta) {
+		log("mysql_stmt_result_metadata failed: %s", mysql_stmt_error(m_stmt));
+		return false;
+	}
+
+	uint32_t col_cnt = mysql_num_fields(meta);
+	MYSQL_FIELD* fields = mysql_fetch_fields(meta);
+	if (!m_result_bind || m_result_col.size() != col_cnt) {
+		if (m_result_bind) {
+			delete [] m_result_bind;
+		}
+		m_result_bind = new MYSQL_BIND [col_cnt];
+		m_result_col.resize(col_cnt);
+	}
+	memset(m_result_bind, 0, sizeof(MYSQL_BIND) * col_cnt);
+
+	for (uint32_t i = 0; i < col_cnt; i++) {
+		ResultCol_t& col = m_result_col[i];
+		MYSQL_BIND& bind = m_result_bind[i];
+		switch (fields[i].type) {
+		case MYSQL_TYPE_TINY:
+		case MYSQL_TYPE_SHORT:
+		case MYSQL_TYPE_INT24:
+		case MYSQL_TYPE_LONG:
+		case MYSQL_TYPE_LONGLONG:
+		case MYSQL_TYPE_YEAR:
+			col.is_int = true;
+			bind.buffer_type = MYSQL_TYPE_LONGLONG;
+			bind.buffer = &col.int_value;
+			bind.is_unsigned = (fields[i].flags & UNSIGNED_FLAG) ? 1 : 0;
+			break;
+		default:
+			// 其他类型都按字符串取, 多留一个字节放结束符
+			col.is_int = false;
+			col.str_value.resize(fields[i].max_length + 1);
+			bind.buffer_type = MYSQL_TYPE_STRING;
+			bind.buffer = &col.str_value[0];
+			bind.buffer_length = col.str_value.size();
+			break;
+		}
+		bind.length = &col.length;
+		bind.is_null = &col.is_null;
+	}
+	mysql_free_result(meta);
+
+	if (mysql_stmt_bind_result(m_stmt, m_result_bind)) {
+		log("mysql_stmt_bind_result failed: %s", mysql_stmt_error(m_stmt));
+		return false;
+	}
+
+	return true;
+}
+
+void CPrepareStatement::_FreeResult()
+{
+	if (m_has_result) {
+		mysql_stmt_free_result(m_stmt);
+		m_has_result = false;
+	}
+}
+
+void CPrepareStatement::_CheckError()
+{
+	// 连接断开或者服务端的语句已经失效, 让所属连接在下次取语句时检查
+	unsigned int err = mysql_stmt_errno(m_stmt);
+	if (m_pDBConn && (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST ||
+			err == CR_NO_PREPARE_STMT || err == ER_UNKNOWN_STMT_HANDLER)) {
+		m_pDBConn->m_need_check = true;
+	}
+}
+
 /////////////////////
 CDBConn::CDBConn(CDBPool* pPool)
 {
 	m_pDBPool = pPool;
 	m_mysql = NULL;
+	m_thread_id = 0;
+	m_last_check_tick = 0;
+	m_need_check = false;
 }
 
 CDBConn::~CDBConn()
 {
-
+	_ClearStatements();
 }
 
 int CDBConn::Init()
@@ -235,6 +451,8 @@ int CDBConn::Init()
 		return 2;
 	}
 
+	m_thread_id = mysql_thread_id(m_mysql);
+	m_last_check_tick = get_tick_count();
 	return 0;
 }
 
@@ -294,6 +512,67 @@ uint32_t CDBConn::GetInsertId()
 	return (uint32_t)mysql_insert_id(m_mysql);
 }
 
+CPrepareStatement* CDBConn::GetStatement(const string& sql)
+{
+	_CheckConnection();
+
+	map<string, StmtList_t::iterator>::iterator it = m_stmt_map.find(sql);
+	if (it != m_stmt_map.end()) {
+		// 命中的移到最前面
+		m_stmt_list.splice(m_stmt_list.begin(), m_stmt_list, it->second);
+		return it->second->second;
+	}
+
+	CPrepareStatement* pStmt = new CPrepareStatement();
+	string strSql = sql;
+	if (!pStmt->Init(m_mysql, strSql)) {
+		delete pStmt;
+		m_need_check = true;
+		return NULL;
+	}
+	pStmt->m_pDBConn = this;
+
+	m_stmt_list.push_front(make_pair(sql, pStmt));
+	m_stmt_map[sql] = m_stmt_list.begin();
+	if (m_stmt_list.size() > MAX_STMT_CACHE_CNT) {
+		m_stmt_map.erase(m_stmt_list.back().first);
+		delete m_stmt_list.back().second;
+		m_stmt_list.pop_back();
+	}
+
+	return pStmt;
+}
+
+/*
+ * 每次都ping要多一个往返, 只在连接空闲较久或者语句执行出现连接错误后才ping,
+ * 自动重连(包括ExecuteQuery等接口里的ping触发的)后服务端的语句已经没有了, 缓存全部作废
+ */
+void CDBConn::_CheckConnection()
+{
+	uint64_t now = get_tick_count();
+	if (m_need_check || now >= m_last_check_tick + DB_CHECK_INTERVAL) {
+		mysql_ping(m_mysql);
+		m_need_check = false;
+	}
+	m_last_check_tick = now;
+
+	unsigned long thread_id = mysql_thread_id(m_mysql);
+	if (thread_id != m_thread_id) {
+		log("db connection reconnected, drop %d statements", (int)m_stmt_list.size());
+		_ClearStatements();
+		m_thread_id = thread_id;
+	}
+}
+
+void CDBConn::_ClearStatements()
+{
+	for (StmtList_t::iterator it = m_stmt_list.begin(); it != m_stmt_list.end(); it++) {
+		delete it->second;
+	}
+	m_stmt_list.clear();
+	m_stmt_map.clear();
+}
+
 ////////////////
 CDBPool::CDBPool(const char* pool_name, const char* db_server_ip, uint16_t db_server_port,
 		const char* username, const char* password, const char* db_name, int max_conn_cnt)
@@ -306,6 +585,12 @@ CDBPool::CDBPool(const char* pool_name, const char* db_server_ip, uint16_t db_se
 	m_db_name = db_name;
 	m_db_max_conn_cnt = max_conn_cnt;
 	m_db_cur_conn_cnt = MIN_DB_CONN_CNT;
+
+	CMetricsRegistry* pRegistry = CMetricsRegistry::getInstance();
+	string labels = metrics_label("pool", m_pool_name);
+	m_wait_histogram = pRegistry->GetLatencyHistogram("teamtalk_db_pool_wait_seconds", "time spent waiting for a free mysql connection", labels);
+	m_busy_gauge = pRegistry->GetGauge("teamtalk_db_pool_busy_conns", "mysql connections taken from the pool", labels);
+	m_conn_gauge = pRegistry->GetGauge("teamtalk_db_pool_conns", "mysql connections opened by the pool", labels);
 }
 
 CDBPool::~CDBPool()
@@ -331,6 +616,7 @@ int CDBPool::Init()
 		m_free_list.push_back(pDBConn);
 	}
 
+	m_conn_gauge->Set(m_db_cur_conn_cnt);
 	log("db pool: %s, size: %d", m_pool_name.c_str(), (int)m_free_list.size());
 	return 0;
 }
@@ -343,6 +629,8 @@ CDBConn* CDBPool::GetDBConn()
 {
 	m_free_notify.Lock();
 
+	// 有空闲连接时不取时间
+	uint64_t start_us = m_free_list.empty() ? metrics_now_us() : 0;
 	while (m_free_list.empty()) {
 		if (m_db_cur_conn_cnt >= m_db_max_conn_cnt) {
 			m_free_notify.Wait();
@@ -357,6 +645,7 @@ CDBConn* CDBPool::GetDBConn()
 			} else {
 				m_free_list.push_back(pDBConn);
 				m_db_cur_conn_cnt++;
+				m_conn_gauge->Set(m_db_cur_conn_cnt);
 				log("new db connection: %s, conn_cnt: %d", m_pool_name.c_str(), m_db_cur_conn_cnt);
 			}
 		}
@@ -367,6 +656,9 @@ CDBConn* CDBPool::GetDBConn()
 
 	m_free_notify.Unlock();
 
+	m_wait_histogram->Observe(start_us ? metrics_now_us() - start_us : 0);
+	m_busy_gauge->Add(1);
+
 	return pConn;
 }
 
@@ -383,6 +675,7 @@ void CDBPool::RelDBConn(CDBConn* pConn)
 
 	if (it == m_free_list.end()) {
 		m_free_list.push_back(pConn);
+		m_busy_gauge->Sub(1);
 	}
 
 	m_free_notify.Signal();
@@ -493,3 +786,13 @@ void CDBManager::RelDBConn(CDBConn* pConn)
 		it->second->RelDBConn(pConn);
 	}
 }
+
+CDBPool* CDBManager::GetDBPool(const char* dbpool_name)
+{
+	map<string, CDBPool*>::iterator it = m_dbpool_map.find(dbpool_name);
+	if (it == m_dbpool_map.end()) {
+		return NULL;
+	}
+
+	return it->second;
+}
@@ -13,33 +13,68 @@
 
 #include "../base/util.h"
 #include "ThreadPool.h"
+#include "Metrics.h"
+#include <vector>
 #include <mysql.h>
 
 #define MAX_ESCAPE_STRING_LEN	10240
 
-class CResultSet {
+// 字符串列的引用, 不拷贝数据, 只在取下一行之前有效
+typedef struct DBString_t {
+	const char*	data;
+	uint32_t	len;
+
+	string ToString() const { return string(data, len); }
+} DBString_t;
+
+/*
+ * 查询结果的公共接口, 按select列表中的位置(从0开始)取值, 不再按列名查找
+ * 文本协议的结果(CResultSet)和prepare语句的二进制结果(CPrepareStatement)都实现这个接口,
+ * 业务代码写明select的列, 按顺序取即可
+ */
+class IResultSet {
+public:
+	virtual ~IResultSet() {}
+
+	virtual bool Next() = 0;
+	virtual uint32_t GetColumnCount() = 0;
+	virtual bool IsNull(uint32_t index) = 0;
+	virtual uint64_t GetUInt64(uint32_t index) = 0;
+	virtual DBString_t GetStringRef(uint32_t index) = 0;	// NULL值返回空串
+
+	int GetInt(uint32_t index) { return (int)GetUInt64(index); }
+	uint32_t GetUInt(uint32_t index) { return (uint32_t)GetUInt64(index); }
+	uint32_t GetStringLen(uint32_t index) { return GetStringRef(index).len; }
+	const char* GetString(uint32_t index) { return GetStringRef(index).data; }
+	string GetStdString(uint32_t index) { return GetStringRef(index).ToString(); }
+};
+
+class CResultSet : public IResultSet {
 public:
 	CResultSet(MYSQL_RES* res);
 	virtual ~CResultSet();
 
-	bool Next();
-	int GetInt(const char* key);
-	char* GetString(const char* key);
+	virtual bool Next();
+	virtual uint32_t GetColumnCount() { return m_col_cnt; }
+	virtual bool IsNull(uint32_t index);
+	virtual uint64_t GetUInt64(uint32_t index);
+	virtual DBString_t GetStringRef(uint32_t index);
 private:
-	int _GetIndex(const char* key);
-
 	MYSQL_RES* 			m_res;
 	MYSQL_ROW			m_row;
-	map<string, int>	m_key_map;
+	unsigned long*		m_lengths;
+	uint32_t			m_col_cnt;
 };
 
+class CDBConn;
+
 /*
- * TODO:
  * 用MySQL的prepare statement接口来防止SQL注入
- * 暂时只用于插入IMMessage表，因为只有那里有SQL注入的风险，
- * 以后可以把全部接口用这个来实现替换
+ * 通过CDBConn::GetStatement()获取的对象由连接缓存和释放, 在同一个连接上重复使用,
+ * 省掉每次调用的prepare和close往返, 调用者不能delete, 也不能在释放连接后继续使用
+ * 查询结果按列的位置以二进制方式绑定, 整数列不再经过字符串转换
  */
-class CPrepareStatement {
+class CPrepareStatement : public IResultSet {
 public:
 	CPrepareStatement();
 	virtual ~CPrepareStatement();
@@ -53,10 +88,39 @@ public:
 
 	bool ExecuteUpdate();
 	uint32_t GetInsertId();
+
+	// 执行查询并把结果全部取到客户端, 之后用Next()遍历
+	bool ExecuteQuery();
+
+	virtual bool Next();
+	virtual uint32_t GetColumnCount() { return (uint32_t)m_result_col.size(); }
+	virtual bool IsNull(uint32_t index);
+	virtual uint64_t GetUInt64(uint32_t index);
+	virtual DBString_t GetStringRef(uint32_t index);
+private:
+	bool _Execute();
+	bool _BindResult();
+	void _FreeResult();
+	void _CheckError();
 private:
+	typedef struct {
+		int64_t			int_value;
+		vector<char>	str_value;
+		unsigned long	length;
+		my_bool			is_null;
+		bool			is_int;
+	} ResultCol_t;
+
 	MYSQL_STMT*	m_stmt;
 	MYSQL_BIND*	m_param_bind;
 	uint32_t	m_param_cnt;
+
+	MYSQL_BIND*			m_result_bind;
+	vector<ResultCol_t>	m_result_col;
+	bool				m_has_result;
+
+	CDBConn*	m_pDBConn;	// 缓存在连接里的语句, 出现连接错误时通知连接重新检查
+	friend class CDBConn;
 };
 
 class CDBPool;
@@ -75,11 +139,27 @@ public:
 
 	const char* GetPoolName();
 	MYSQL* GetMysql() { return m_mysql; }
+
+	// 按SQL文本从本连接的LRU缓存中取prepare好的语句, 没有则prepare后放入缓存
+	// 返回的对象归连接所有, 失败返回NULL
+	CPrepareStatement* GetStatement(const string& sql);
+private:
+	void _CheckConnection();
+	void _ClearStatements();
 private:
+	typedef list<pair<string, CPrepareStatement*> >	StmtList_t;
+
 	CDBPool* 	m_pDBPool;	// to get MySQL server information
 	MYSQL* 		m_mysql;
 	//MYSQL_RES*	m_res;
 	char		m_escape_string[MAX_ESCAPE_STRING_LEN + 1];
+
+	StmtList_t								m_stmt_list;	// 最近使用的在前面
+	map<string, StmtList_t::iterator>		m_stmt_map;
+	unsigned long	m_thread_id;		// 重连后thread_id会变, 服务端的语句已经失效
+	uint64_t		m_last_check_tick;
+	bool			m_need_check;
+	friend class CPrepareStatement;
 };
 
 class CDBPool {
@@ -109,6 +189,10 @@ private:
 	int 		m_db_max_conn_cnt;
 	list<CDBConn*>	m_free_list;        //实际保存mysql连接的容器 连接池对象CDBPool用一个成员变量存储自己的若干个mysql连接：
 	CThreadNotify	m_free_notify;
+
+	CMetricHistogram*	m_wait_histogram;	// GetDBConn()等待空闲连接的时间
+	CMetricGauge*		m_busy_gauge;		// 被取走还没归还的连接数
+	CMetricGauge*		m_conn_gauge;		// 已经建立的连接数
 };
 
 // manage db pool (master for write and slave for read)
@@ -122,6 +206,8 @@ public:
 
 	CDBConn* GetDBConn(const char* dbpool_name);
 	void RelDBConn(CDBConn* pConn);
+	// 异步查询用同样的连接参数建立自己的连接
+	CDBPool* GetDBPool(const char* dbpool_name);
 private:
 	CDBManager();
 
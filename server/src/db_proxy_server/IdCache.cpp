@@ -0,0 +1,209 @@
+/*
+ * IdCache.cpp
+ */
+
+#include "util.h"
+#include "atomic.h"
+#include "ConfigFileReader.h"
+#include "IdCache.h"
+
+#define DEFAULT_ID_CACHE_SIZE		200000
+#define DEFAULT_ID_CACHE_TIME		300
+#define DEFAULT_ID_CACHE_NEG_TIME	10
+#define ID_CACHE_STAT_INTERVAL		60000
+
+CIdCache::CIdCache(const char* name)
+{
+	m_strName = name;
+	m_nMaxSize = 0;
+	m_nShardSize = 0;
+	m_nTtl = DEFAULT_ID_CACHE_TIME * 1000;
+	m_nNegativeTtl = DEFAULT_ID_CACHE_NEG_TIME * 1000;
+	m_nLastLogTick = 0;
+	memset(&m_stat, 0, sizeof(m_stat));
+	for (int i = 0; i < ID_CACHE_SHARD_CNT; i++) {
+		m_shards[i].remove_seq = 0;
+	}
+}
+
+CIdCache::~CIdCache()
+{
+}
+
+void CIdCache::init()
+{
+	CConfigFileReader config_file("dbproxyserver.conf");
+	char* str_size = config_file.GetConfigName("IdCacheSize");
+	char* str_time = config_file.GetConfigName("IdCacheTime");
+	char* str_neg_time = config_file.GetConfigName("IdCacheNegativeTime");
+
+	m_nMaxSize = str_size ? atoi(str_size) : DEFAULT_ID_CACHE_SIZE;
+	if (str_time && atoi(str_time) > 0) {
+		m_nTtl = atoi(str_time) * 1000;
+	}
+	if (str_neg_time) {
+		m_nNegativeTtl = atoi(str_neg_time) * 1000;
+	}
+
+	if (m_nMaxSize == 0) {
+		log("%s cache disabled", m_strName.c_str());
+		return;
+	}
+
+	m_nShardSize = (m_nMaxSize + ID_CACHE_SHARD_CNT - 1) / ID_CACHE_SHARD_CNT;
+	log("%s cache enabled, size=%u, ttl=%ums, negative_ttl=%ums", m_strName.c_str(), m_nMaxSize, m_nTtl, m_nNegativeTtl);
+}
+
+bool CIdCache::get(uint64_t nKey, uint32_t& nValue, uint32_t* pSeq)
+{
+	if (!isEnabled()) {
+		return false;
+	}
+
+	uint64_t nNow = get_tick_count();
+	_LogStat(nNow);
+
+	IdShard_t& shard = _GetShard(nKey);
+	CAutoLock autoLock(&shard.lock);
+	IdMap_t::iterator it = shard.id_map.find(nKey);
+	if (it != shard.id_map.end()) {
+		if (it->second.expire_tick > nNow) {
+			nValue = it->second.value;
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru_it);
+			ATOMIC_ADD(nValue != INVALID_VALUE ? &m_stat.hit_cnt : &m_stat.neg_hit_cnt, 1);
+			return true;
+		}
+		_Erase(shard, it);
+	}
+
+	if (pSeq) {
+		*pSeq = shard.remove_seq;
+	}
+	ATOMIC_ADD(&m_stat.miss_cnt, 1);
+	return false;
+}
+
+void CIdCache::set(uint64_t nKey, uint32_t nValue, uint32_t nSeq)
+{
+	if (!isEnabled()) {
+		return;
+	}
+
+	IdShard_t& shard = _GetShard(nKey);
+	CAutoLock autoLock(&shard.lock);
+	if (shard.remove_seq != nSeq) {
+		return;
+	}
+	_Insert(shard, nKey, nValue, get_tick_count());
+}
+
+void CIdCache::set(uint64_t nKey, uint32_t nValue)
+{
+	if (!isEnabled()) {
+		return;
+	}
+
+	IdShard_t& shard = _GetShard(nKey);
+	CAutoLock autoLock(&shard.lock);
+	_Insert(shard, nKey, nValue, get_tick_count());
+}
+
+void CIdCache::remove(uint64_t nKey)
+{
+	if (!isEnabled()) {
+		return;
+	}
+
+	IdShard_t& shard = _GetShard(nKey);
+	CAutoLock autoLock(&shard.lock);
+	shard.remove_seq++;
+	IdMap_t::iterator it = shard.id_map.find(nKey);
+	if (it != shard.id_map.end()) {
+		_Erase(shard, it);
+		ATOMIC_ADD(&m_stat.remove_cnt, 1);
+	}
+}
+
+void CIdCache::removeValue(uint32_t nValue)
+{
+	if (!isEnabled() || nValue == INVALID_VALUE) {
+		return;
+	}
+
+	for (int i = 0; i < ID_CACHE_SHARD_CNT; i++) {
+		IdShard_t& shard = m_shards[i];
+		CAutoLock autoLock(&shard.lock);
+		shard.remove_seq++;
+		for (IdMap_t::iterator it = shard.id_map.begin(); it != shard.id_map.end(); ) {
+			if (it->second.value == nValue) {
+				_Erase(shard, it++);
+				ATOMIC_ADD(&m_stat.remove_cnt, 1);
+			} else {
+				it++;
+			}
+		}
+	}
+}
+
+void CIdCache::getStat(IdCacheStat_t* pStat)
+{
+	pStat->hit_cnt = ATOMIC_FETCH(&m_stat.hit_cnt);
+	pStat->neg_hit_cnt = ATOMIC_FETCH(&m_stat.neg_hit_cnt);
+	pStat->miss_cnt = ATOMIC_FETCH(&m_stat.miss_cnt);
+	pStat->evict_cnt = ATOMIC_FETCH(&m_stat.evict_cnt);
+	pStat->remove_cnt = ATOMIC_FETCH(&m_stat.remove_cnt);
+}
+
+// 调用者持有分片锁
+void CIdCache::_Insert(IdShard_t& shard, uint64_t nKey, uint32_t nValue, uint64_t nNow)
+{
+	IdMap_t::iterator it = shard.id_map.find(nKey);
+	if (it != shard.id_map.end()) {
+		shard.lru.splice(shard.lru.begin(), shard.lru, it->second.lru_it);
+	} else {
+		// 满了淘汰链表尾部最久没访问的一条, 已经过期的不算淘汰
+		if (shard.id_map.size() >= m_nShardSize) {
+			IdMap_t::iterator it_old = shard.id_map.find(shard.lru.back());
+			if (it_old->second.expire_tick > nNow) {
+				ATOMIC_ADD(&m_stat.evict_cnt, 1);
+			}
+			_Erase(shard, it_old);
+		}
+		shard.lru.push_front(nKey);
+		it = shard.id_map.insert(make_pair(nKey, IdEntry_t())).first;
+		it->second.lru_it = shard.lru.begin();
+	}
+
+	it->second.value = nValue;
+	it->second.expire_tick = nNow + (nValue != INVALID_VALUE ? m_nTtl : m_nNegativeTtl);
+}
+
+// 调用者持有分片锁
+void CIdCache::_Erase(IdShard_t& shard, IdMap_t::iterator it)
+{
+	shard.lru.erase(it->second.lru_it);
+	shard.id_map.erase(it);
+}
+
+void CIdCache::_LogStat(uint64_t nNow)
+{
+	uint64_t nLast = m_nLastLogTick;
+	if (nNow < nLast + ID_CACHE_STAT_INTERVAL) {
+		return;
+	}
+	if (!__sync_bool_compare_and_swap(&m_nLastLogTick, nLast, nNow)) {
+		return;
+	}
+
+	IdCacheStat_t stat;
+	getStat(&stat);
+	uint64_t nTotal = stat.hit_cnt + stat.neg_hit_cnt + stat.miss_cnt;
+	if (nTotal == 0) {
+		return;
+	}
+
+	log("%s cache stat: hit=%llu, neg_hit=%llu, miss=%llu, hit_rate=%.1f%%, evict=%llu, remove=%llu",
+		m_strName.c_str(), (unsigned long long)stat.hit_cnt, (unsigned long long)stat.neg_hit_cnt,
+		(unsigned long long)stat.miss_cnt, (stat.hit_cnt + stat.neg_hit_cnt) * 100.0 / nTotal,
+		(unsigned long long)stat.evict_cnt, (unsigned long long)stat.remove_cnt);
+}
@@ -0,0 +1,98 @@
+/*
+ * IdCache.h
+ *
+ * 进程内的id映射缓存, 用于发消息路径上几乎不变的映射:
+ *   用户对 -> IMRelationShip.id (relateId)
+ *   用户 + 会话对象 -> IMRecentSession.id (sessionId)
+ * 按key分片加锁, 每个分片有容量上限, 分片内用LRU链表记录访问顺序, 满了淘汰最久没用的一条(O(1));
+ * 查不到的结果(INVALID_VALUE)也缓存一小段时间(负缓存), 避免反复查库
+ *
+ * 本进程内的删除会立即让缓存失效; 多个db_proxy之间没有通知,
+ * 所以记录带有效期, 别的实例做的删除最多延迟这么久生效
+ *
+ * 配置(dbproxyserver.conf):
+ *   IdCacheSize=200000		# 每种缓存的记录数上限, 0表示关闭
+ *   IdCacheTime=300		# 记录的有效期, 秒
+ *   IdCacheNegativeTime=10	# 负缓存的有效期, 秒
+ */
+
+#ifndef IDCACHE_H_
+#define IDCACHE_H_
+
+#include <string>
+#include <list>
+#include "ostype.h"
+#include "Lock.h"
+
+using namespace std;
+
+#define ID_CACHE_SHARD_CNT	16
+
+typedef struct {
+	uint64_t	hit_cnt;		// 命中有效的id
+	uint64_t	neg_hit_cnt;	// 命中负缓存
+	uint64_t	miss_cnt;
+	uint64_t	evict_cnt;		// 分片满了被淘汰的记录数
+	uint64_t	remove_cnt;		// 因为删除而失效的次数
+} IdCacheStat_t;
+
+class CIdCache
+{
+public:
+	CIdCache(const char* name);
+	virtual ~CIdCache();
+
+	// 从配置文件读取容量和有效期
+	void init();
+	bool isEnabled() { return m_nMaxSize > 0; }
+	const char* getName() { return m_strName.c_str(); }
+
+	// 命中返回true, nValue为INVALID_VALUE表示负缓存;
+	// 没命中时pSeq返回分片当前的删除序号, 查库之后用带序号的set写回,
+	// 这样查库期间发生的删除不会被旧的查询结果覆盖
+	bool get(uint64_t nKey, uint32_t& nValue, uint32_t* pSeq = NULL);
+	void set(uint64_t nKey, uint32_t nValue, uint32_t nSeq);
+	// 刚写入数据库的映射, 直接覆盖
+	void set(uint64_t nKey, uint32_t nValue);
+
+	void remove(uint64_t nKey);
+	// 只知道id的时候用, 要遍历所有分片, 只用于删除这种很少发生的操作
+	void removeValue(uint32_t nValue);
+
+	void getStat(IdCacheStat_t* pStat);
+private:
+	typedef list<uint64_t> IdLru_t;		// 头部是最近访问的key
+
+	typedef struct {
+		uint32_t	value;
+		uint64_t	expire_tick;
+		IdLru_t::iterator	lru_it;
+	} IdEntry_t;
+
+	typedef hash_map<uint64_t, IdEntry_t> IdMap_t;
+
+	typedef struct {
+		CLock		lock;
+		IdMap_t		id_map;
+		IdLru_t		lru;
+		uint32_t	remove_seq;
+	} IdShard_t;
+
+	IdShard_t& _GetShard(uint64_t nKey) { return m_shards[(nKey ^ (nKey >> 32)) % ID_CACHE_SHARD_CNT]; }
+	void _Insert(IdShard_t& shard, uint64_t nKey, uint32_t nValue, uint64_t nNow);
+	void _Erase(IdShard_t& shard, IdMap_t::iterator it);
+	void _LogStat(uint64_t nNow);
+private:
+	string			m_strName;
+	uint32_t		m_nMaxSize;
+	uint32_t		m_nShardSize;
+	uint32_t		m_nTtl;				// 毫秒
+	uint32_t		m_nNegativeTtl;		// 毫秒
+
+	IdShard_t		m_shards[ID_CACHE_SHARD_CNT];
+
+	IdCacheStat_t	m_stat;				// 原子操作更新, 不加锁
+	volatile uint64_t	m_nLastLogTick;
+};
+
+#endif /* IDCACHE_H_ */
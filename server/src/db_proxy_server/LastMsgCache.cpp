@@ -0,0 +1,261 @@
+/*
+ * LastMsgCache.cpp
+ */
+
+#include "util.h"
+#include "atomic.h"
+#include "ConfigFileReader.h"
+#include "CachePool.h"
+#include "LastMsgCache.h"
+
+#define DEFAULT_LAST_MSG_EXPIRE		604800
+#define LAST_MSG_STAT_INTERVAL		60000
+
+/*
+ * KEYS[1]: 记录
+ * ARGV[1..4]: msg_id, type, from_id, content, ARGV[5]: 有效期(秒)
+ * ARGV[6]: 回填时为读记录时看到的ver, 写消息时为空
+ * 只有新的msg_id更大(或者还没有记录)时才覆盖, 写入返回1, 否则返回0
+ */
+static const char* g_set_script =
+	"if ARGV[6] ~= '' and (redis.call('HGET', KEYS[1], 'ver') or '0') ~= ARGV[6] then return 0 end "
+	"local cur = redis.call('HGET', KEYS[1], 'msg_id') "
+	"if cur and tonumber(cur) >= tonumber(ARGV[1]) then return 0 end "
+	"redis.call('HMSET', KEYS[1], 'msg_id', ARGV[1], 'type', ARGV[2], 'from_id', ARGV[3], 'content', ARGV[4]) "
+	"redis.call('EXPIRE', KEYS[1], ARGV[5]) "
+	"return 1";
+
+CLastMsgCache* CLastMsgCache::m_pInstance = NULL;
+
+CLastMsgCache::CLastMsgCache()
+{
+	m_nExpire = 0;
+	m_nLastLogTick = 0;
+	memset(&m_stat, 0, sizeof(m_stat));
+}
+
+CLastMsgCache::~CLastMsgCache()
+{
+}
+
+CLastMsgCache* CLastMsgCache::getInstance()
+{
+	if (!m_pInstance) {
+		m_pInstance = new CLastMsgCache();
+	}
+
+	return m_pInstance;
+}
+
+int CLastMsgCache::init()
+{
+	CConfigFileReader config_file("dbproxyserver.conf");
+	char* str_expire = config_file.GetConfigName("LastMsgCacheTime");
+	m_nExpire = str_expire ? atoi(str_expire) : DEFAULT_LAST_MSG_EXPIRE;
+
+	if (m_nExpire == 0) {
+		log("last msg cache disabled");
+	} else {
+		log("last msg cache enabled, expire=%us", m_nExpire);
+	}
+	return 0;
+}
+
+void CLastMsgCache::update(const string& strKey, const LastMsg_t& msg)
+{
+	if (!isEnabled()) {
+		return;
+	}
+
+	ATOMIC_ADD(&m_stat.update_cnt, 1);
+	_Set(strKey, msg, "");
+}
+
+void CLastMsgCache::get(const vector<string>& vecKey, vector<LastMsgLookup_t>& vecResult)
+{
+	vecResult.resize(vecKey.size());
+	for (size_t i = 0; i < vecResult.size(); i++) {
+		vecResult[i].hit = false;
+		vecResult[i].ver = "0";
+	}
+
+	if (!isEnabled() || vecKey.empty()) {
+		return;
+	}
+
+	uint64_t nNow = get_tick_count();
+	_LogStat(nNow);
+
+	CacheManager* pCacheManager = CacheManager::getInstance();
+	CacheConn* pCacheConn = pCacheManager->GetCacheConn("unread");
+	if (!pCacheConn) {
+		log("no cache connection for unread");
+		ATOMIC_ADD(&m_stat.error_cnt, 1);
+		ATOMIC_ADD(&m_stat.miss_cnt, vecKey.size());
+		return;
+	}
+
+	CachePipeline pipe(pCacheConn);
+	for (size_t i = 0; i < vecKey.size(); i++) {
+		pipe.hgetAll(vecKey[i]);
+	}
+
+	uint32_t nHitCnt = 0;
+	if (pipe.exec()) {
+		for (size_t i = 0; i < vecKey.size(); i++) {
+			map<string, string> mapRecord;
+			if (!pipe.getHash((uint32_t)i, mapRecord)) {
+				continue;
+			}
+
+			LastMsgLookup_t& result = vecResult[i];
+			map<string, string>::iterator it = mapRecord.find("ver");
+			if (it != mapRecord.end()) {
+				result.ver = it->second;
+			}
+
+			it = mapRecord.find("msg_id");
+			if (it == mapRecord.end()) {
+				continue;
+			}
+
+			result.hit = true;
+			result.msg.msg_id = (uint32_t)strtoul(it->second.c_str(), NULL, 10);
+			result.msg.msg_type = (uint32_t)atoi(mapRecord["type"].c_str());
+			result.msg.from_id = (uint32_t)strtoul(mapRecord["from_id"].c_str(), NULL, 10);
+			result.msg.content = mapRecord["content"];
+			nHitCnt++;
+		}
+	} else {
+		ATOMIC_ADD(&m_stat.error_cnt, 1);
+	}
+	pCacheManager->RelCacheConn(pCacheConn);
+
+	ATOMIC_ADD(&m_stat.hit_cnt, nHitCnt);
+	ATOMIC_ADD(&m_stat.miss_cnt, vecKey.size() - nHitCnt);
+}
+
+void CLastMsgCache::fill(const string& strKey, const LastMsg_t& msg, const string& strVer)
+{
+	if (!isEnabled()) {
+		return;
+	}
+
+	_Set(strKey, msg, strVer.empty() ? "0" : strVer);
+}
+
+void CLastMsgCache::remove(const string& strKey)
+{
+	if (!isEnabled()) {
+		return;
+	}
+
+	CacheManager* pCacheManager = CacheManager::getInstance();
+	CacheConn* pCacheConn = pCacheManager->GetCacheConn("unread");
+	if (!pCacheConn) {
+		log("no cache connection for unread, last msg of %s not removed", strKey.c_str());
+		ATOMIC_ADD(&m_stat.error_cnt, 1);
+		return;
+	}
+
+	char expire[16];
+	snprintf(expire, sizeof(expire), "%u", m_nExpire);
+
+	// 先加ver再删字段, 两步之间的回填会因为ver不符被丢掉
+	CachePipeline pipe(pCacheConn);
+	pipe.hincrBy(strKey, "ver", 1);
+	vector<string> argv;
+	argv.push_back("HDEL");
+	argv.push_back(strKey);
+	argv.push_back("msg_id");
+	argv.push_back("type");
+	argv.push_back("from_id");
+	argv.push_back("content");
+	pipe.append(argv);
+	argv.clear();
+	argv.push_back("EXPIRE");
+	argv.push_back(strKey);
+	argv.push_back(expire);
+	pipe.append(argv);
+	if (pipe.exec()) {
+		ATOMIC_ADD(&m_stat.remove_cnt, 1);
+	} else {
+		log("remove last msg failed, key=%s", strKey.c_str());
+		ATOMIC_ADD(&m_stat.error_cnt, 1);
+	}
+	pCacheManager->RelCacheConn(pCacheConn);
+}
+
+void CLastMsgCache::getStat(LastMsgStat_t* pStat)
+{
+	pStat->hit_cnt = ATOMIC_FETCH(&m_stat.hit_cnt);
+	pStat->miss_cnt = ATOMIC_FETCH(&m_stat.miss_cnt);
+	pStat->update_cnt = ATOMIC_FETCH(&m_stat.update_cnt);
+	pStat->remove_cnt = ATOMIC_FETCH(&m_stat.remove_cnt);
+	pStat->error_cnt = ATOMIC_FETCH(&m_stat.error_cnt);
+}
+
+void CLastMsgCache::_Set(const string& strKey, const LastMsg_t& msg, const string& strVer)
+{
+	CacheManager* pCacheManager = CacheManager::getInstance();
+	CacheConn* pCacheConn = pCacheManager->GetCacheConn("unread");
+	if (!pCacheConn) {
+		log("no cache connection for unread");
+		ATOMIC_ADD(&m_stat.error_cnt, 1);
+		return;
+	}
+
+	char msg_id[16], msg_type[16], from_id[16], expire[16];
+	snprintf(msg_id, sizeof(msg_id), "%u", msg.msg_id);
+	snprintf(msg_type, sizeof(msg_type), "%u", msg.msg_type);
+	snprintf(from_id, sizeof(from_id), "%u", msg.from_id);
+	snprintf(expire, sizeof(expire), "%u", m_nExpire);
+
+	vector<string> argv;
+	argv.push_back("EVAL");
+	argv.push_back(g_set_script);
+	argv.push_back("1");
+	argv.push_back(strKey);
+	argv.push_back(msg_id);
+	argv.push_back(msg_type);
+	argv.push_back(from_id);
+	argv.push_back(msg.content);
+	argv.push_back(expire);
+	argv.push_back(strVer);
+
+	CachePipeline pipe(pCacheConn);
+	pipe.append(argv);
+	if (!pipe.exec()) {
+		ATOMIC_ADD(&m_stat.error_cnt, 1);
+	} else if (!pipe.isInteger(0)) {
+		// 脚本返回的是0或1, 其他都是出错(比如key的类型不对), 这条记录没写进去
+		string strErr = pipe.getError(0);
+		log("last msg script failed: %s, key=%s", strErr.c_str(), strKey.c_str());
+		ATOMIC_ADD(&m_stat.error_cnt, 1);
+		if (strErr.find("unknown command") != string::npos) {
+			// redis不支持lua脚本(2.6以下), 记录没法可靠地维护, 关闭缓存, 全部查库
+			log("redis does not support EVAL, last msg cache disabled");
+			m_nExpire = 0;
+		}
+	}
+	pCacheManager->RelCacheConn(pCacheConn);
+}
+
+void CLastMsgCache::_LogStat(uint64_t nNow)
+{
+	uint64_t nLast = m_nLastLogTick;
+	if (nNow < nLast + LAST_MSG_STAT_INTERVAL)
+		return;
+	if (!__sync_bool_compare_and_swap(&m_nLastLogTick, nLast, nNow))
+		return;
+
+	LastMsgStat_t stat;
+	getStat(&stat);
+	uint64_t nTotal = stat.hit_cnt + stat.miss_cnt;
+	if (nTotal == 0)
+		return;
+
+	log("last msg stat: hit=%llu, miss=%llu, hit_rate=%.1f%%, update=%llu, remove=%llu, error=%llu",
+		(unsigned long long)stat.hit_cnt, (unsigned long long)stat.miss_cnt, stat.hit_cnt * 100.0 / nTotal,
+		(unsigned long long)stat.update_cnt, (unsigned long long)stat.remove_cnt, (unsigned long long)stat.error_cnt);
+}
@@ -0,0 +1,83 @@
+/*
+ * LastMsgCache.h
+ *
+ * 会话最后一条消息的记录, 放在redis里, 多个db_proxy共用:
+ *   last_msg_<relateId>		单聊
+ *   group_last_msg_<groupId>	群聊
+ * 每条记录是一个hash: msg_id, type, from_id, content, ver
+ * 写消息成功后更新记录(msg_id更大才覆盖, 用lua脚本保证), 最近会话和未读计数
+ * 一次流水线取回所有会话的记录, 只有没有记录的会话才查库, 查到的结果回填
+ *
+ * 删除/撤回消息(status改为非0)之后必须调用remove: 清掉记录并把ver加1,
+ * 写消息失败时消息也可能已经提交了(比如提交时连接断开), 同样调用remove;
+ * 回填时带上读记录时看到的ver, ver变了说明查库期间有删除, 旧的查询结果不写回
+ * msg_id为0的记录表示会话里没有消息, 同样会被新消息覆盖
+ *
+ * 配置(dbproxyserver.conf):
+ *   LastMsgCacheTime=604800	# 记录的有效期, 秒, 0表示关闭, 每次都查库
+ */
+
+#ifndef LASTMSGCACHE_H_
+#define LASTMSGCACHE_H_
+
+#include <string>
+#include <vector>
+#include "ostype.h"
+
+using namespace std;
+
+typedef struct {
+	uint32_t	msg_id;		// 0表示会话里没有消息
+	uint32_t	msg_type;
+	uint32_t	from_id;
+	string		content;	// 语音消息存的是"[语音]"加密后的字符串
+} LastMsg_t;
+
+typedef struct {
+	bool		hit;
+	string		ver;		// 没命中时回填要带上
+	LastMsg_t	msg;
+} LastMsgLookup_t;
+
+typedef struct {
+	uint64_t	hit_cnt;
+	uint64_t	miss_cnt;
+	uint64_t	update_cnt;		// 写消息时更新记录的次数
+	uint64_t	remove_cnt;
+	uint64_t	error_cnt;		// redis出错的次数
+} LastMsgStat_t;
+
+class CLastMsgCache
+{
+public:
+	static CLastMsgCache* getInstance();
+
+	int init();
+	bool isEnabled() { return m_nExpire > 0; }
+
+	// 写消息成功后调用
+	void update(const string& strKey, const LastMsg_t& msg);
+	// 批量读取, vecResult和vecKey一一对应; redis出错时全部当作没命中
+	void get(const vector<string>& vecKey, vector<LastMsgLookup_t>& vecResult);
+	// 没命中时查库的结果写回, strVer为get返回的ver
+	void fill(const string& strKey, const LastMsg_t& msg, const string& strVer);
+	// 删除消息或者重置会话后调用
+	void remove(const string& strKey);
+
+	void getStat(LastMsgStat_t* pStat);
+private:
+	CLastMsgCache();
+	virtual ~CLastMsgCache();
+
+	void _Set(const string& strKey, const LastMsg_t& msg, const string& strVer);
+	void _LogStat(uint64_t nNow);
+private:
+	static CLastMsgCache*	m_pInstance;
+
+	uint32_t		m_nExpire;		// 秒
+
+	LastMsgStat_t	m_stat;			// 原子操作更新, 不加锁
+	volatile uint64_t	m_nLastLogTick;
+};
+
+#endif /* LASTMSGCACHE_H_ */
@@ -0,0 +1,323 @@
+/*
+ * MsgBatcher.cpp
+ */
+
+#include <map>
+#include <sys/time.h>
+#include <mysqld_error.h>
+#include "util.h"
+#include "ConfigFileReader.h"
+#include "DBPool.h"
+#include "MsgBatcher.h"
+
+#define MAX_BATCH_SQL_LEN	(512 * 1024)	// 单条insert语句的上限, 要小于max_allowed_packet
+#define MSG_BATCH_STAT_INTERVAL	60000
+
+static uint64_t get_time_us()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// 这些错误发生时服务端已经回滚了语句或整个事务, 整批没有写进去, 可以放心逐条重插
+// 断线之类的客户端错误(CR_*)不在里面: COMMIT可能已经在服务端生效, 重插会产生重复的消息
+static bool is_rollback_error(unsigned int nErrno)
+{
+	switch (nErrno) {
+	case ER_DUP_ENTRY:
+	case ER_BAD_NULL_ERROR:
+	case ER_DATA_TOO_LONG:
+	case ER_TRUNCATED_WRONG_VALUE_FOR_FIELD:
+	case ER_WARN_DATA_OUT_OF_RANGE:
+	case ER_NO_REFERENCED_ROW_2:
+	case ER_LOCK_WAIT_TIMEOUT:
+	case ER_LOCK_DEADLOCK:
+		return true;
+	default:
+		return false;
+	}
+}
+
+CMsgBatcher* CMsgBatcher::m_pInstance = NULL;
+
+CMsgBatcher::CMsgBatcher() : m_flushCond(&m_lock), m_doneCond(&m_lock)
+{
+	m_nWindow = 0;
+	m_nMaxSize = 64;
+	m_bRunning = false;
+	m_nLastLogTick = 0;
+	memset(&m_stat, 0, sizeof(m_stat));
+}
+
+CMsgBatcher::~CMsgBatcher()
+{
+	stop();
+}
+
+CMsgBatcher* CMsgBatcher::getInstance()
+{
+	if (!m_pInstance) {
+		m_pInstance = new CMsgBatcher();
+	}
+
+	return m_pInstance;
+}
+
+int CMsgBatcher::init()
+{
+	CConfigFileReader config_file("dbproxyserver.conf");
+	char* str_window = config_file.GetConfigName("MsgBatchWindow");
+	char* str_size = config_file.GetConfigName("MsgBatchSize");
+	if (str_window) {
+		m_nWindow = atoi(str_window);
+	}
+	if (str_size && atoi(str_size) > 0) {
+		m_nMaxSize = atoi(str_size);
+	}
+
+	if (m_nWindow == 0) {
+		log("msg batch disabled");
+		return 0;
+	}
+
+	m_bRunning = true;
+	if (pthread_create(&m_nThreadId, NULL, doFlush, this) != 0) {
+		log("create msg batch thread failed");
+		m_bRunning = false;
+		return 1;
+	}
+
+	log("msg batch enabled, window=%ums, size=%u", m_nWindow, m_nMaxSize);
+	return 0;
+}
+
+void CMsgBatcher::stop()
+{
+	if (!m_bRunning)
+		return;
+
+	m_lock.lock();
+	m_bRunning = false;
+	m_flushCond.notify();
+	m_lock.unlock();
+
+	// 写线程退出前会把排队的记录提交掉
+	pthread_join(m_nThreadId, NULL);
+}
+
+bool CMsgBatcher::insert(const string& strTable, const string& strColumns, const vector<string>& vecValues)
+{
+	InsertReq_t req;
+	req.pTable = &strTable;
+	req.pColumns = &strColumns;
+	req.pValues = &vecValues;
+	req.bDone = false;
+	req.bResult = false;
+
+	m_lock.lock();
+	if (!m_bRunning) {
+		m_lock.unlock();
+		return false;
+	}
+
+	m_lsPending.push_back(&req);
+	// 第一条记录开始计时, 攒够一批提前提交
+	if (m_lsPending.size() == 1 || m_lsPending.size() >= m_nMaxSize) {
+		m_flushCond.notify();
+	}
+
+	while (!req.bDone) {
+		m_doneCond.wait();
+	}
+	m_lock.unlock();
+
+	return req.bResult;
+}
+
+void CMsgBatcher::getStat(MsgBatchStat_t* pStat)
+{
+	CAutoLock autoLock(&m_statLock);
+	*pStat = m_stat;
+}
+
+void* CMsgBatcher::doFlush(void* arg)
+{
+	CMsgBatcher* pBatcher = (CMsgBatcher*)arg;
+	pBatcher->flushLoop();
+	return NULL;
+}
+
+void CMsgBatcher::flushLoop()
+{
+	for (;;) {
+		list<InsertReq_t*> lsReq;
+
+		m_lock.lock();
+		while (m_bRunning && m_lsPending.empty()) {
+			m_flushCond.wait();
+		}
+
+		// 窗口内继续收集, 攒够一批或者超时就提交
+		if (m_bRunning && m_lsPending.size() < m_nMaxSize) {
+			uint64_t nDeadline = get_tick_count() + m_nWindow;
+			uint64_t nNow = get_tick_count();
+			while (m_bRunning && m_lsPending.size() < m_nMaxSize && nNow < nDeadline) {
+				m_flushCond.waitTime(nDeadline - nNow);
+				nNow = get_tick_count();
+			}
+		}
+
+		bool bRunning = m_bRunning;
+		lsReq.swap(m_lsPending);
+		m_lock.unlock();
+
+		if (!lsReq.empty()) {
+			commitBatch(lsReq);
+
+			m_lock.lock();
+			for (list<InsertReq_t*>::iterator it = lsReq.begin(); it != lsReq.end(); it++) {
+				(*it)->bDone = true;
+			}
+			m_doneCond.notifyAll();
+			m_lock.unlock();
+		}
+
+		logStat();
+
+		if (!bRunning)
+			break;
+	}
+}
+
+void CMsgBatcher::commitBatch(list<InsertReq_t*>& lsReq)
+{
+	CDBManager* pDBManager = CDBManager::getInstance();
+	CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_master");
+	if (!pDBConn) {
+		log("no db connection for teamtalk_master, drop %lu messages", lsReq.size());
+		return;
+	}
+
+	// 按表分组, 每张表一条多行insert
+	map<string, list<InsertReq_t*> > mapTable;
+	for (list<InsertReq_t*>::iterator it = lsReq.begin(); it != lsReq.end(); it++) {
+		mapTable[*(*it)->pTable + *(*it)->pColumns].push_back(*it);
+	}
+
+	uint64_t nStart = get_time_us();
+	MYSQL* mysql = pDBConn->GetMysql();
+	mysql_ping(mysql);
+
+	bool bRet = (mysql_query(mysql, "START TRANSACTION") == 0);
+	for (map<string, list<InsertReq_t*> >::iterator it = mapTable.begin(); bRet && it != mapTable.end(); it++) {
+		bRet = insertRows(pDBConn, it->second);
+	}
+	if (bRet) {
+		bRet = (mysql_query(mysql, "COMMIT") == 0);
+	}
+
+	if (bRet) {
+		for (list<InsertReq_t*>::iterator it = lsReq.begin(); it != lsReq.end(); it++) {
+			(*it)->bResult = true;
+		}
+	} else {
+		unsigned int nErrno = mysql_errno(mysql);
+		log("msg batch commit failed: %u %s, batch_size=%lu", nErrno, mysql_error(mysql), lsReq.size());
+		mysql_query(mysql, "ROLLBACK");
+		if (is_rollback_error(nErrno)) {
+			// 一条坏数据不能拖累整批, 回滚后逐条插入
+			for (list<InsertReq_t*>::iterator it = lsReq.begin(); it != lsReq.end(); it++) {
+				list<InsertReq_t*> lsOne;
+				lsOne.push_back(*it);
+				(*it)->bResult = insertRows(pDBConn, lsOne);
+			}
+		} else {
+			// 不知道这批有没有提交, 整批按失败返回(bResult保持false), 不逐条重插
+			log("msg batch result unknown, not retrying row by row");
+		}
+	}
+
+	uint64_t nCost = get_time_us() - nStart;
+	pDBManager->RelDBConn(pDBConn);
+
+	CAutoLock autoLock(&m_statLock);
+	m_stat.batch_cnt++;
+	m_stat.row_cnt += lsReq.size();
+	if (lsReq.size() > m_stat.max_batch_size)
+		m_stat.max_batch_size = (uint32_t)lsReq.size();
+	m_stat.commit_us += nCost;
+	if (nCost > m_stat.max_commit_us)
+		m_stat.max_commit_us = nCost;
+	if (!bRet)
+		m_stat.fallback_cnt++;
+}
+
+bool CMsgBatcher::insertRows(CDBConn* pDBConn, const list<InsertReq_t*>& lsReq)
+{
+	const string& strTable = *lsReq.front()->pTable;
+	const string& strColumns = *lsReq.front()->pColumns;
+	string strHead = "insert into " + strTable + " " + strColumns + " values";
+
+	MYSQL* mysql = pDBConn->GetMysql();
+	list<InsertReq_t*>::const_iterator it = lsReq.begin();
+	while (it != lsReq.end()) {
+		string strSql = strHead;
+		uint32_t nRowCnt = 0;
+		// 语句太长就拆成多条, 还在同一个事务里
+		for (; it != lsReq.end() && (nRowCnt == 0 || strSql.size() < MAX_BATCH_SQL_LEN); it++) {
+			if (nRowCnt++ > 0) {
+				strSql.append(",");
+			}
+			appendRow(pDBConn, strSql, *(*it)->pValues);
+		}
+
+		if (mysql_real_query(mysql, strSql.c_str(), strSql.size())) {
+			log("mysql_real_query failed: %s, table=%s, rows=%u", mysql_error(mysql), strTable.c_str(), nRowCnt);
+			return false;
+		}
+
+		if (mysql_affected_rows(mysql) != nRowCnt) {
+			log("insert %s affected %lu rows, expect %u", strTable.c_str(), (unsigned long)mysql_affected_rows(mysql), nRowCnt);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void CMsgBatcher::appendRow(CDBConn* pDBConn, string& strSql, const vector<string>& vecValues)
+{
+	vector<char> vecEscape;
+	strSql.append("(");
+	for (size_t i = 0; i < vecValues.size(); i++) {
+		const string& strValue = vecValues[i];
+		vecEscape.resize(strValue.size() * 2 + 1);
+		unsigned long nLen = mysql_real_escape_string(pDBConn->GetMysql(), &vecEscape[0], strValue.c_str(), strValue.size());
+		if (i > 0) {
+			strSql.append(",");
+		}
+		strSql.append("'");
+		strSql.append(&vecEscape[0], nLen);
+		strSql.append("'");
+	}
+	strSql.append(")");
+}
+
+void CMsgBatcher::logStat()
+{
+	uint64_t nNow = get_tick_count();
+	if (nNow < m_nLastLogTick + MSG_BATCH_STAT_INTERVAL)
+		return;
+
+	m_nLastLogTick = nNow;
+	MsgBatchStat_t stat;
+	getStat(&stat);
+	if (stat.batch_cnt == 0)
+		return;
+
+	log("msg batch stat: batch_cnt=%llu, row_cnt=%llu, avg_size=%.1f, max_size=%u, avg_commit_us=%llu, max_commit_us=%llu, fallback_cnt=%llu",
+		(unsigned long long)stat.batch_cnt, (unsigned long long)stat.row_cnt, (double)stat.row_cnt / stat.batch_cnt,
+		stat.max_batch_size, (unsigned long long)(stat.commit_us / stat.batch_cnt),
+		(unsigned long long)stat.max_commit_us, (unsigned long long)stat.fallback_cnt);
+}
@@ -0,0 +1,87 @@
+/*
+ * MsgBatcher.h
+ *
+ * 消息写入的组提交(group commit):
+ * 各工作线程提交的IMMessage_x/IMGroupMessage_x插入先排队, 由一个写线程在一个很短的窗口内
+ * 收集起来, 按表合并成多行insert并放在一个事务里提交, 每条消息在所在批次提交后才返回,
+ * 这样MySQL的提交延迟由一批消息分摊, 而不是每条消息一次
+ *
+ * 配置(dbproxyserver.conf):
+ *   MsgBatchWindow=2	# 收集窗口, 毫秒, 0表示关闭, 每条消息单独插入
+ *   MsgBatchSize=64	# 攒够这么多条立即提交, 不再等窗口结束
+ */
+
+#ifndef MSGBATCHER_H_
+#define MSGBATCHER_H_
+
+#include <vector>
+#include <list>
+#include "ostype.h"
+#include "Lock.h"
+#include "Condition.h"
+
+using namespace std;
+
+class CDBConn;
+
+typedef struct {
+	uint64_t	batch_cnt;		// 提交的批次数
+	uint64_t	row_cnt;		// 写入的消息数
+	uint32_t	max_batch_size;	// 最大的一批消息数
+	uint64_t	commit_us;		// 累计提交耗时(微秒), 除以batch_cnt得到平均值
+	uint64_t	max_commit_us;
+	uint64_t	fallback_cnt;	// 批量提交失败后改为逐条插入的批次数
+} MsgBatchStat_t;
+
+class CMsgBatcher
+{
+public:
+	static CMsgBatcher* getInstance();
+
+	int init();
+	void stop();
+
+	bool isEnabled() { return m_bRunning; }
+
+	// 工作线程调用, 阻塞到这条记录所在的批次提交完成, 返回是否写入成功
+	// strColumns形如"(`a`, `b`)", 各个值都按字符串转义, 由MySQL转换成列的类型
+	bool insert(const string& strTable, const string& strColumns, const vector<string>& vecValues);
+
+	void getStat(MsgBatchStat_t* pStat);
+private:
+	CMsgBatcher();
+	~CMsgBatcher();
+
+	typedef struct {
+		const string*			pTable;
+		const string*			pColumns;
+		const vector<string>*	pValues;
+		bool					bDone;
+		bool					bResult;
+	} InsertReq_t;
+
+	static void* doFlush(void* arg);
+	void flushLoop();
+	void commitBatch(list<InsertReq_t*>& lsReq);
+	bool insertRows(CDBConn* pDBConn, const list<InsertReq_t*>& lsReq);
+	void appendRow(CDBConn* pDBConn, string& strSql, const vector<string>& vecValues);
+	void logStat();
+private:
+	static CMsgBatcher*	m_pInstance;
+
+	uint32_t			m_nWindow;		// 毫秒
+	uint32_t			m_nMaxSize;
+	volatile bool		m_bRunning;
+	pthread_t			m_nThreadId;
+
+	CLock				m_lock;
+	CCondition			m_flushCond;	// 通知写线程有新的记录
+	CCondition			m_doneCond;		// 通知工作线程批次已经提交
+	list<InsertReq_t*>	m_lsPending;
+
+	CLock				m_statLock;
+	MsgBatchStat_t		m_stat;
+	uint64_t			m_nLastLogTick;
+};
+
+#endif /* MSGBATCHER_H_ */
@@ -0,0 +1,298 @@
+/*
+ * MsgIdAllocator.cpp
+ */
+
+#include <unistd.h>
+#include "util.h"
+#include "atomic.h"
+#include "ConfigFileReader.h"
+#include "CachePool.h"
+#include "MsgIdAllocator.h"
+
+#define MIN_LEASE_SIZE			4
+#define DEFAULT_LEASE_SIZE		32
+#define DEFAULT_LEASE_TIME		10000
+#define MSG_ID_SWEEP_INTERVAL	1024	// 每个分片分配这么多次清理一次过期的记录
+#define MSG_ID_STAT_INTERVAL	60000
+#define MSG_ID_CONTEST_FACTOR	3		// 争抢标记的有效期是租期的几倍
+
+/*
+ * KEYS[1]: 计数器, KEYS[2]: 所有权, KEYS[3]: 争抢标记
+ * ARGV[1]: 本实例标识, ARGV[2]: 租期(毫秒), ARGV[3]: 段大小, ARGV[4]: 争抢标记的有效期(毫秒)
+ * 所有权空闲或者属于自己时续租并返回段内最后一个id,
+ * 否则只分配一个id, 以负数返回, 这样争抢时也只需要一次往返;
+ * 所有权在别人手里时打上争抢标记, 标记存在时持有者也只分配一个id, 不再给出新的段
+ */
+static const char* g_lease_script =
+	"local owner = redis.call('GET', KEYS[2]) "
+	"if owner and owner ~= ARGV[1] then "
+	"redis.call('SET', KEYS[3], 1, 'PX', ARGV[4]) "
+	"return -redis.call('INCRBY', KEYS[1], 1) end "
+	"redis.call('SET', KEYS[2], ARGV[1], 'PX', ARGV[2]) "
+	"if redis.call('EXISTS', KEYS[3]) == 1 then return -redis.call('INCRBY', KEYS[1], 1) end "
+	"return redis.call('INCRBY', KEYS[1], ARGV[3])";
+
+static uint32_t get_shard_idx(const string& strKey)
+{
+	uint32_t nHash = 0;
+	for (size_t i = 0; i < strKey.size(); i++) {
+		nHash = nHash * 131 + (uint8_t)strKey[i];
+	}
+	return nHash % MSG_ID_LOCK_CNT;
+}
+
+CMsgIdAllocator* CMsgIdAllocator::m_pInstance = NULL;
+
+CMsgIdAllocator::CMsgIdAllocator()
+{
+	m_nMaxSize = DEFAULT_LEASE_SIZE;
+	m_nLeaseTime = DEFAULT_LEASE_TIME;
+	m_bLeaseEnabled = false;
+	m_nLastLogTick = 0;
+	memset(&m_stat, 0, sizeof(m_stat));
+	for (int i = 0; i < MSG_ID_LOCK_CNT; i++) {
+		m_shards[i].alloc_cnt = 0;
+	}
+}
+
+CMsgIdAllocator::~CMsgIdAllocator()
+{
+}
+
+CMsgIdAllocator* CMsgIdAllocator::getInstance()
+{
+	if (!m_pInstance) {
+		m_pInstance = new CMsgIdAllocator();
+	}
+
+	return m_pInstance;
+}
+
+int CMsgIdAllocator::init()
+{
+	CConfigFileReader config_file("dbproxyserver.conf");
+	char* str_size = config_file.GetConfigName("MsgIdLeaseSize");
+	char* str_time = config_file.GetConfigName("MsgIdLeaseTime");
+	if (str_size) {
+		m_nMaxSize = atoi(str_size);
+	}
+	if (str_time && atoi(str_time) > 0) {
+		m_nLeaseTime = atoi(str_time);
+	}
+
+	char hostname[256] = {0};
+	gethostname(hostname, sizeof(hostname) - 1);
+	char owner_id[320];
+	snprintf(owner_id, sizeof(owner_id), "%s:%d:%llu", hostname, (int)getpid(), (unsigned long long)get_tick_count());
+	m_strOwnerId = owner_id;
+
+	if (m_nMaxSize == 0) {
+		log("msg id lease disabled");
+		return 0;
+	}
+
+	if (m_nMaxSize < MIN_LEASE_SIZE) {
+		m_nMaxSize = MIN_LEASE_SIZE;
+	}
+	m_bLeaseEnabled = true;
+	log("msg id lease enabled, owner=%s, max_size=%u, lease_time=%ums", m_strOwnerId.c_str(), m_nMaxSize, m_nLeaseTime);
+	return 0;
+}
+
+uint32_t CMsgIdAllocator::allocate(const string& strKey)
+{
+	CacheManager* pCacheManager = CacheManager::getInstance();
+	uint32_t nMsgId = INVALID_VALUE;
+	uint64_t nNow = get_tick_count();
+	ATOMIC_ADD(&m_stat.alloc_cnt, 1);
+	_LogStat(nNow);
+
+	if (!m_bLeaseEnabled) {
+		CacheConn* pCacheConn = pCacheManager->GetCacheConn("unread");
+		if (pCacheConn) {
+			nMsgId = _IncrOne(pCacheConn, strKey);
+			pCacheManager->RelCacheConn(pCacheConn);
+		} else {
+			log("no cache connection for unread");
+		}
+		return nMsgId;
+	}
+
+	// 续租时持有分片锁, 保证同一个会话的id按分配顺序递增
+	LeaseShard_t& shard = m_shards[get_shard_idx(strKey)];
+	CAutoLock autoLock(&shard.lock);
+
+	if (++shard.alloc_cnt % MSG_ID_SWEEP_INTERVAL == 0) {
+		_Sweep(shard, nNow);
+	}
+
+	MsgIdLease_t lease;
+	memset(&lease, 0, sizeof(lease));
+	LeaseMap_t::iterator it = shard.lease_map.find(strKey);
+	if (it != shard.lease_map.end()) {
+		if (it->second.next <= it->second.end && nNow < it->second.expire_tick) {
+			ATOMIC_ADD(&m_stat.hit_cnt, 1);
+			return it->second.next++;
+		}
+		lease = it->second;
+	}
+
+	CacheConn* pCacheConn = pCacheManager->GetCacheConn("unread");
+	if (!pCacheConn) {
+		log("no cache connection for unread");
+		return INVALID_VALUE;
+	}
+	nMsgId = _Lease(pCacheConn, strKey, lease, nNow);
+	pCacheManager->RelCacheConn(pCacheConn);
+
+	if (lease.next <= lease.end) {
+		shard.lease_map[strKey] = lease;
+	} else if (it != shard.lease_map.end()) {
+		shard.lease_map.erase(it);
+	}
+
+	return nMsgId;
+}
+
+void CMsgIdAllocator::reset(const string& strKey)
+{
+	if (!m_bLeaseEnabled)
+		return;
+
+	LeaseShard_t& shard = m_shards[get_shard_idx(strKey)];
+	CAutoLock autoLock(&shard.lock);
+	shard.lease_map.erase(strKey);
+
+	CacheManager* pCacheManager = CacheManager::getInstance();
+	CacheConn* pCacheConn = pCacheManager->GetCacheConn("unread");
+	if (pCacheConn) {
+		CachePipeline pipe(pCacheConn);
+		pipe.del(strKey + "_owner");
+		pipe.exec();
+		pCacheManager->RelCacheConn(pCacheConn);
+	}
+}
+
+void CMsgIdAllocator::getStat(MsgIdStat_t* pStat)
+{
+	pStat->alloc_cnt = ATOMIC_FETCH(&m_stat.alloc_cnt);
+	pStat->hit_cnt = ATOMIC_FETCH(&m_stat.hit_cnt);
+	pStat->lease_cnt = ATOMIC_FETCH(&m_stat.lease_cnt);
+	pStat->contest_cnt = ATOMIC_FETCH(&m_stat.contest_cnt);
+	pStat->error_cnt = ATOMIC_FETCH(&m_stat.error_cnt);
+}
+
+/*
+ * 去redis租用一段id, 返回其中第一个并更新lease; 拿不到所有权时脚本直接INCRBY 1,
+ * 返回这个id, lease置为空
+ */
+uint32_t CMsgIdAllocator::_Lease(CacheConn* pCacheConn, const string& strKey, MsgIdLease_t& lease, uint64_t nNow)
+{
+	// 租约还没到期就用完了说明会话很活跃, 段加倍; 否则从最小的段重新开始
+	uint32_t nSize = MIN_LEASE_SIZE;
+	if (lease.size > 0 && nNow < lease.expire_tick) {
+		nSize = lease.size * 2 < m_nMaxSize ? lease.size * 2 : m_nMaxSize;
+	}
+	memset(&lease, 0, sizeof(lease));
+	lease.next = 1;
+
+	char lease_time[16], lease_size[16], contest_time[16];
+	snprintf(lease_time, sizeof(lease_time), "%u", m_nLeaseTime);
+	snprintf(lease_size, sizeof(lease_size), "%u", nSize);
+	snprintf(contest_time, sizeof(contest_time), "%u", m_nLeaseTime * MSG_ID_CONTEST_FACTOR);
+
+	vector<string> argv;
+	argv.push_back("EVAL");
+	argv.push_back(g_lease_script);
+	argv.push_back("3");
+	argv.push_back(strKey);
+	argv.push_back(strKey + "_owner");
+	argv.push_back(strKey + "_contested");
+	argv.push_back(m_strOwnerId);
+	argv.push_back(lease_time);
+	argv.push_back(lease_size);
+	argv.push_back(contest_time);
+
+	CachePipeline pipe(pCacheConn);
+	pipe.append(argv);
+	if (!pipe.exec()) {
+		ATOMIC_ADD(&m_stat.error_cnt, 1);
+		return INVALID_VALUE;
+	}
+
+	if (!pipe.isInteger(0)) {
+		// 脚本出错(WRONGTYPE, 脚本错误)或者redis不支持lua脚本(2.6以下), 这条消息退回INCRBY 1;
+		// 不支持EVAL时以后也不再尝试租用
+		string strErr = pipe.getError(0);
+		log("msg id lease script failed: %s, key=%s, fall back to INCRBY", strErr.c_str(), strKey.c_str());
+		ATOMIC_ADD(&m_stat.error_cnt, 1);
+		if (strErr.find("unknown command") != string::npos) {
+			log("redis does not support EVAL, msg id lease disabled");
+			m_bLeaseEnabled = false;
+		}
+		return _IncrOne(pCacheConn, strKey);
+	}
+
+	long nRet = pipe.getInteger(0);
+	if (nRet < 0) {
+		// 争抢开始的那一刻持有者手里已经租到的段还会继续在本地分配, 这部分id会小于争抢方拿到的id;
+		// 乱序最多一个段, 持有者下次续租时看到争抢标记就不再租用, 之后两边都单调
+		ATOMIC_ADD(&m_stat.contest_cnt, 1);
+		return (uint32_t)(-nRet);
+	}
+
+	if (nRet < (long)nSize) {
+		// 计数器被改成了负数之类的异常值, 段里会有0或者回绕的id
+		log("msg id lease got invalid counter %ld, key=%s, size=%u", nRet, strKey.c_str(), nSize);
+		ATOMIC_ADD(&m_stat.error_cnt, 1);
+		return INVALID_VALUE;
+	}
+
+	ATOMIC_ADD(&m_stat.lease_cnt, 1);
+	lease.end = (uint32_t)nRet;
+	lease.next = lease.end - nSize + 1;
+	lease.size = nSize;
+	// 留出余量, 保证本地认为有效时redis里的所有权一定还在
+	lease.expire_tick = nNow + m_nLeaseTime - m_nLeaseTime / 5;
+	return lease.next++;
+}
+
+uint32_t CMsgIdAllocator::_IncrOne(CacheConn* pCacheConn, const string& strKey)
+{
+	long nRet = pCacheConn->incrBy(strKey, 1);
+	if (nRet <= 0) {
+		ATOMIC_ADD(&m_stat.error_cnt, 1);
+		return INVALID_VALUE;
+	}
+	return (uint32_t)nRet;
+}
+
+void CMsgIdAllocator::_Sweep(LeaseShard_t& shard, uint64_t nNow)
+{
+	LeaseMap_t::iterator it = shard.lease_map.begin();
+	while (it != shard.lease_map.end()) {
+		if (nNow >= it->second.expire_tick) {
+			shard.lease_map.erase(it++);
+		} else {
+			it++;
+		}
+	}
+}
+
+void CMsgIdAllocator::_LogStat(uint64_t nNow)
+{
+	uint64_t nLast = m_nLastLogTick;
+	if (nNow < nLast + MSG_ID_STAT_INTERVAL)
+		return;
+	if (!__sync_bool_compare_and_swap(&m_nLastLogTick, nLast, nNow))
+		return;
+
+	MsgIdStat_t stat;
+	getStat(&stat);
+	if (stat.alloc_cnt == 0)
+		return;
+
+	log("msg id stat: alloc_cnt=%llu, hit_cnt=%llu, hit_rate=%.1f%%, lease_cnt=%llu, contest_cnt=%llu, error_cnt=%llu",
+		(unsigned long long)stat.alloc_cnt, (unsigned long long)stat.hit_cnt, stat.hit_cnt * 100.0 / stat.alloc_cnt,
+		(unsigned long long)stat.lease_cnt, (unsigned long long)stat.contest_cnt, (unsigned long long)stat.error_cnt);
+}
@@ -0,0 +1,91 @@
+/*
+ * MsgIdAllocator.h
+ *
+ * 按会话租用消息id段:
+ * redis里的msg_id_<relateId>/group_msg_id_<groupId>计数器不变, 每次不再INCRBY 1,
+ * 而是用一个lua脚本同时抢占/续租会话的所有权(<计数器>_owner, 带过期时间)并INCRBY一段,
+ * 之后这一段id直接在内存里分配, 用完或者租约快到期时再去redis续租;
+ * 段的大小从MIN_LEASE_SIZE开始, 连续用完时翻倍, 最大MsgIdLeaseSize, 空闲会话浪费的id很少
+ *
+ * 所有权保证同一时刻只有一个db_proxy在内存里分配某个会话的id, 所以id在会话内单调递增;
+ * msg_server按会话把消息固定发给同一个db_proxy, 正常情况下不会争抢;
+ * 所有权被别的实例持有时退回每条消息INCRBY 1(在同一个脚本里完成), id仍然唯一;
+ * 同时给会话打上争抢标记(<计数器>_contested), 标记存在期间持有者续租时也不再租用新的段,
+ * 双方都每条消息INCRBY 1, 保证id单调; 标记在没有争抢后MSG_ID_CONTEST_FACTOR个租期后过期
+ *
+ * 配置(dbproxyserver.conf):
+ *   MsgIdLeaseSize=32		# 每段最多多少个id, 0表示关闭, 每条消息INCRBY 1
+ *   MsgIdLeaseTime=10000	# 所有权的租期, 毫秒
+ */
+
+#ifndef MSGIDALLOCATOR_H_
+#define MSGIDALLOCATOR_H_
+
+#include "ostype.h"
+#include "Lock.h"
+
+using namespace std;
+
+#define MSG_ID_LOCK_CNT		16		// 按会话分片加锁, 续租时只锁住一个分片
+
+typedef struct {
+	uint64_t	alloc_cnt;		// 分配的id数
+	uint64_t	hit_cnt;		// 直接从内存里的id段分配的次数
+	uint64_t	lease_cnt;		// 去redis租用id段的次数
+	uint64_t	contest_cnt;	// 所有权在别的实例手里, 退回INCRBY的次数
+	uint64_t	error_cnt;		// redis出错的次数
+} MsgIdStat_t;
+
+class CacheConn;
+
+class CMsgIdAllocator
+{
+public:
+	static CMsgIdAllocator* getInstance();
+
+	int init();
+
+	// strKey为redis里计数器的key, 失败返回INVALID_VALUE
+	uint32_t allocate(const string& strKey);
+	// 计数器被重置时调用, 丢掉内存里的id段并释放所有权
+	void reset(const string& strKey);
+
+	void getStat(MsgIdStat_t* pStat);
+private:
+	CMsgIdAllocator();
+	virtual ~CMsgIdAllocator();
+
+	typedef struct {
+		uint32_t	next;			// 下一个可用的id
+		uint32_t	end;			// 段内最后一个id
+		uint32_t	size;			// 上次租用的段大小
+		uint64_t	expire_tick;	// 本地认为租约有效的截止时间, 比redis里的过期时间早一些
+	} MsgIdLease_t;
+
+	typedef hash_map<string, MsgIdLease_t> LeaseMap_t;
+
+	typedef struct {
+		CLock		lock;
+		LeaseMap_t	lease_map;
+		uint32_t	alloc_cnt;		// 用于定期清理过期的记录
+	} LeaseShard_t;
+
+	uint32_t _Lease(CacheConn* pCacheConn, const string& strKey, MsgIdLease_t& lease, uint64_t nNow);
+	uint32_t _IncrOne(CacheConn* pCacheConn, const string& strKey);
+	void _Sweep(LeaseShard_t& shard, uint64_t nNow);
+	void _LogStat(uint64_t nNow);
+private:
+	static CMsgIdAllocator*	m_pInstance;
+
+	uint32_t		m_nMaxSize;
+	uint32_t		m_nLeaseTime;	// 毫秒
+	volatile bool	m_bLeaseEnabled;
+	string			m_strOwnerId;	// 本实例的标识, 写在<计数器>_owner里
+
+	LeaseShard_t	m_shards[MSG_ID_LOCK_CNT];
+
+	MsgIdStat_t		m_stat;			// 原子操作更新, 不加锁
+	volatile uint64_t	m_nLastLogTick;
+};
+
+#endif /* MSGIDALLOCATOR_H_ */
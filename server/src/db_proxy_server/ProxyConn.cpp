@@ -12,16 +12,18 @@
 #include "IM.Other.pb.h"
 #include "IM.BaseDefine.pb.h"
 #include "IM.Server.pb.h"
-#include "ThreadPool.h"
+#include "TaskScheduler.h"
 #include "SyncCenter.h"
+#include "MsgBatcher.h"
+#include "business/SessionModel.h"
 static ConnMap_t g_proxy_conn_map;
 static UserMap_t g_uuid_conn_map;
 static CHandlerMap* s_handler_map;
 
 uint32_t CProxyConn::s_uuid_alloctor = 0;
-CLock CProxyConn::s_list_lock;
-list<ResponsePdu_t*> CProxyConn::s_response_pdu_list;
-static CThreadPool g_thread_pool;
+CMpscQueue CProxyConn::s_response_queue;
+static int s_response_notify = -1;	// 工作线程入队后唤醒主线程的通知id
+static CTaskScheduler g_thread_pool;
 
 void proxy_timer_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
 {
@@ -35,8 +37,8 @@ void proxy_timer_callback(void* callback_data, uint8_t msg, uint32_t handle, voi
 	}
 }
 
-//
-void proxy_loop_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+// 工作线程入队后通过eventfd唤醒主线程, 不再等epoll超时轮询
+void proxy_notify_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
 {
 	CProxyConn::SendResponsePduList();
 }
@@ -50,6 +52,9 @@ void proxy_loop_callback(void* callback_data, uint8_t msg, uint32_t handle, void
 void exit_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
 {
 	log("exit_callback...");
+	// 把还在排队的消息和会话时间写进数据库
+	CMsgBatcher::getInstance()->stop();
+	CSessionModel::getInstance()->stop();
 	exit(0);
 }
 
@@ -80,9 +85,8 @@ int init_proxy_conn(uint32_t thread_num)
 {
 	//将各个任务id和对应的处理函数绑定起来
 	s_handler_map = CHandlerMap::getInstance();
-	g_thread_pool.Init(thread_num);
-
-	netlib_add_loop(proxy_loop_callback, NULL);
+	s_response_notify = netlib_add_notify(0, proxy_notify_callback, NULL);
+	g_thread_pool.Init(thread_num, "proxy");
 
 	signal(SIGTERM, sig_handler);
 
@@ -153,11 +157,9 @@ void CProxyConn::OnRead()
 	for (;;) {
 		//先检测该对象的读缓冲区中还有多少可用空间，如果可用空间小于当前收到的字节数目，
 		//则将该读缓冲区的大小扩展到需要的大小READ_BUF_SIZE
-		uint32_t free_buf_len = m_in_buf.GetAllocSize() - m_in_buf.GetWriteOffset();
-		if (free_buf_len < READ_BUF_SIZE)
-			m_in_buf.Extend(READ_BUF_SIZE);
+		m_in_buf.EnsureWritable(READ_BUF_SIZE);
 		//接着收到的数据放入读缓冲区中。并记录下这次收取数据的时间到m_last_recv_tick变量中。
-		int ret = netlib_recv(m_handle, m_in_buf.GetBuffer() + m_in_buf.GetWriteOffset(), READ_BUF_SIZE);
+		int ret = netlib_recv(m_handle, m_in_buf.GetWritePtr(), READ_BUF_SIZE);
 		if (ret <= 0)
 			break;
 
@@ -169,11 +171,11 @@ void CProxyConn::OnRead()
 	//接着开始解包，即调用CImPdu::IsPduAvailable()从读取缓冲区中取出数据处理
 	uint32_t pdu_len = 0;
     try {
-        while ( CImPdu::IsPduAvailable(m_in_buf.GetBuffer(), m_in_buf.GetWriteOffset(), pdu_len) ) {
+        while ( CImPdu::IsPduAvailable(m_in_buf.GetReadPtr(), m_in_buf.GetReadableSize(), pdu_len) ) {
 			//得到包的大小就可以正式处理包了，
-            HandlePduBuf(m_in_buf.GetBuffer(), pdu_len);
-			//该包处理完成以后，将该包的数据从连接的读缓冲区移除：
-            m_in_buf.Read(NULL, pdu_len);
+            HandlePduBuf(m_in_buf.GetReadPtr(), pdu_len);
+			//该包处理完成以后，将该包的数据从连接的读缓冲区移除(只移动读指针)：
+            m_in_buf.Consume(pdu_len);
         }
     } catch (CPduException& ex) {
         log("!!!catch exception, err_code=%u, err_msg=%s, close the connection ",
@@ -214,24 +216,26 @@ void CProxyConn::HandlePduBuf(uchar_t* pdu_buf, uint32_t pdu_len)
 {	
 	//包的数据结构是CImPdu（Im 即Instant Message即时通讯软件的意思，teamtalk本来就是一款即时通讯，
 	//pdu，Protocol Data Unit 协议数据单元，通俗的说就是一个包单位）
-    CImPdu* pPdu = NULL;
-    pPdu = CImPdu::ReadPdu(pdu_buf, pdu_len);
+    CImPduView pdu(pdu_buf, pdu_len);
 	//如果数据包是心跳包的话，就直接不处理了。因为心跳包只是来保活通信的，与具体业务无关：
-    if (pPdu->GetCommandId() == IM::BaseDefine::CID_OTHER_HEARTBEAT) {
+    if (pdu.GetCommandId() == IM::BaseDefine::CID_OTHER_HEARTBEAT) {
         return;
     }
     
 	//接着根据对应的命令号调用在程序初始化阶段绑定的包处理函数：
-    pdu_handler_t handler = s_handler_map->GetHandler(pPdu->GetCommandId());
+    pdu_handler_t handler = s_handler_map->GetHandler(pdu.GetCommandId());
     
 	//执行处理函数不是直接调用该函数，而是包装成一个任务放入前面介绍的任务队列中
     if (handler) {
+        // 任务在工作线程里执行, 这时读缓冲区早已被复用, 所以只有这里需要拷贝一份
+        CImPdu* pPdu = pdu.Retain();
         CTask* pTask = new CProxyTask(m_uuid, handler, pPdu);
 
-		//处理任务的线程可能有多个，那么到底将任务加入到哪个工作线程呢？这里采取的策略是随机分配：
+		//处理任务的线程可能有多个，那么到底将任务加入到哪个工作线程呢？
+		//优先交给空闲线程, 某个线程被慢SQL卡住时, 排在它后面的任务会被其他空闲线程偷走执行
         g_thread_pool.AddTask(pTask);
     } else {
-        log("no handler for packet type: %d", pPdu->GetCommandId());
+        log("no handler for packet type: %d", pdu.GetCommandId());
     }
 }
 
@@ -247,18 +251,14 @@ void CProxyConn::AddResponsePdu(uint32_t conn_uuid, CImPdu* pPdu)
 	pResp->conn_uuid = conn_uuid;
 	pResp->pPdu = pPdu;
 
-	s_list_lock.lock();
-	s_response_pdu_list.push_back(pResp);
-	s_list_lock.unlock();
+	s_response_queue.Push(pResp);
+	netlib_notify(0, s_response_notify);
 }
 
 void CProxyConn::SendResponsePduList()
 {
-	s_list_lock.lock();
-	while (!s_response_pdu_list.empty()) {
-		ResponsePdu_t* pResp = s_response_pdu_list.front();
-		s_response_pdu_list.pop_front();
-		s_list_lock.unlock();
+	ResponsePdu_t* pResp = NULL;
+	while ((pResp = (ResponsePdu_t*)s_response_queue.Pop()) != NULL) {
 		//第一个就是一般服务器端会有多个连接对象，那么如何定位某个应答数据包对应的连接对象呢？
 		//这里就通过数据包本身的conn_uuid来确定：
 		CProxyConn* pConn = get_proxy_conn_by_uuid(pResp->conn_uuid);
@@ -274,9 +274,5 @@ void CProxyConn::SendResponsePduList()
 		if (pResp->pPdu)
 			delete pResp->pPdu;
 		delete pResp;
-
-		s_list_lock.lock();
 	}
-
-	s_list_lock.unlock();
 }
@@ -12,11 +12,12 @@
 #include <curl/curl.h>
 #include "../base/util.h"
 #include "imconn.h"
+#include "MpscQueue.h"
 
-typedef struct {
+struct ResponsePdu_t : public CMpscNode {
 	uint32_t	conn_uuid;
 	CImPdu*		pPdu;
-} ResponsePdu_t;
+};
 
 class CProxyConn : public CImConn {
 public:
@@ -33,14 +34,13 @@ public:
 	void HandlePduBuf(uchar_t* pdu_buf, uint32_t pdu_len);
 
 	static void AddResponsePdu(uint32_t conn_uuid, CImPdu* pPdu);	// 工作线程调用
-	static void SendResponsePduList();	// 主线程调用
+	static void SendResponsePduList();	// 主线程调用, 收到通知后批量发送
 private:
 	// 由于处理请求和发送回复在两个线程，socket的handle可能重用，所以需要用一个一直增加的uuid来表示一个连接
 	static uint32_t	s_uuid_alloctor;
 	uint32_t		m_uuid;
 
-	static CLock			s_list_lock;
-	static list<ResponsePdu_t*>	s_response_pdu_list;	// 主线程发送回复消息
+	static CMpscQueue		s_response_queue;	// 工作线程无锁入队, 主线程发送回复消息
 };
 
 int init_proxy_conn(uint32_t thread_num);
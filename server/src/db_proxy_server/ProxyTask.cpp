@@ -11,12 +11,20 @@
 ================================================================*/
 #include "ProxyTask.h"
 #include "ProxyConn.h"
+#include "Metrics.h"
+
+// 按命令号统计, 异步查询的处理函数只统计到提交查询为止
+static CMetricHistogramMap g_handle_metrics("teamtalk_db_proxy_handle_seconds",
+		"time spent in db_proxy handlers by command id", "cmd");
+static CMetricHistogramMap g_queue_metrics("teamtalk_db_proxy_queue_wait_seconds",
+		"time a request waits in the worker queue by command id", "cmd");
 
 CProxyTask::CProxyTask(uint32_t conn_uuid, pdu_handler_t pdu_handler, CImPdu* pPdu)
 {
 	m_conn_uuid = conn_uuid;
 	m_pdu_handler = pdu_handler;
     m_pPdu = pPdu;
+    m_create_us = metrics_now_us();
 }
 
 CProxyTask::~CProxyTask()
@@ -34,7 +42,11 @@ void CProxyTask::run()
 		CProxyConn::AddResponsePdu(m_conn_uuid, NULL);
 	} else {
 		if (m_pdu_handler) {
+			uint16_t command_id = m_pPdu->GetCommandId();
+			uint64_t start_us = metrics_now_us();
+			g_queue_metrics.Get(command_id)->Observe(start_us - m_create_us);
 			m_pdu_handler(m_pPdu, m_conn_uuid);
+			g_handle_metrics.Get(command_id)->Observe(metrics_now_us() - start_us);
 		}
 	}
 }
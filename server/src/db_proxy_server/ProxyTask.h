@@ -29,6 +29,7 @@ private:
 	uint32_t 		m_conn_uuid;
 	pdu_handler_t	m_pdu_handler;
 	CImPdu* 		m_pPdu;
+	uint64_t		m_create_us;	// 入队时间, 统计排队的耗时
 };
 #endif
 
@@ -221,8 +221,8 @@ void* CSyncCenter::doSyncGroupChat(void* arg)
             if(pResult)
             {
                 while (pResult->Next()) {
-                    uint32_t nGroupId = pResult->GetInt("id");
-                    uint32_t nLastChat = pResult->GetInt("lastChated");
+                    uint32_t nGroupId = pResult->GetUInt(0);
+                    uint32_t nLastChat = pResult->GetUInt(1);
                     if(nLastChat != 0)
                     {
                         mapChangedGroup[nGroupId] = nLastChat;
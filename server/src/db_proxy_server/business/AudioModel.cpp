@@ -86,14 +86,14 @@ bool CAudioModel::readAudios(list<IM::BaseDefine::MsgInfo>& lsMsg)
             IM::BaseDefine::MsgType nType = it->msg_type();
             if((IM::BaseDefine::MSG_TYPE_GROUP_AUDIO ==  nType) || (IM::BaseDefine::MSG_TYPE_SINGLE_AUDIO == nType))
             {
-                string strSql = "select * from IMAudio where id=" + it->msg_data();
+                string strSql = "select duration, size, path from IMAudio where id=" + it->msg_data();
                 CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
                 if (pResultSet)
                 {
                     while (pResultSet->Next()) {
-                        uint32_t nCostTime = pResultSet->GetInt("duration");
-                        uint32_t nSize = pResultSet->GetInt("size");
-                        string strPath = pResultSet->GetString("path");
+                        uint32_t nCostTime = pResultSet->GetUInt(0);
+                        uint32_t nSize = pResultSet->GetUInt(1);
+                        string strPath = pResultSet->GetStdString(2);
                         readAudioContent(nCostTime, nSize, strPath, *it);
                     }
                     ++it;
@@ -33,8 +33,8 @@ void CDepartModel::getChgedDeptId(uint32_t& nLastTime, list<uint32_t>& lsChanged
         if(pResultSet)
         {
             while (pResultSet->Next()) {
-                uint32_t id = pResultSet->GetInt("id");
-                uint32_t nUpdated = pResultSet->GetInt("updated");
+                uint32_t id = pResultSet->GetUInt(0);
+                uint32_t nUpdated = pResultSet->GetUInt(1);
                 if(nLastTime < nUpdated)
                 {
                     nLastTime = nUpdated;
@@ -75,17 +75,17 @@ void CDepartModel::getDepts(list<uint32_t>& lsDeptIds, list<IM::BaseDefine::Depa
                 strClause += ("," + int2string(*it));
             }
         }
-        string strSql = "select * from IMDepart where id in ( " + strClause + " )";
+        string strSql = "select id, parentId, departName, status, priority from IMDepart where id in ( " + strClause + " )";
         CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
         if(pResultSet)
         {
             while (pResultSet->Next()) {
                 IM::BaseDefine::DepartInfo cDept;
-                uint32_t nId = pResultSet->GetInt("id");
-                uint32_t nParentId = pResultSet->GetInt("parentId");
-                string strDeptName = pResultSet->GetString("departName");
-                uint32_t nStatus = pResultSet->GetInt("status");
-                uint32_t nPriority = pResultSet->GetInt("priority");
+                uint32_t nId = pResultSet->GetUInt(0);
+                uint32_t nParentId = pResultSet->GetUInt(1);
+                string strDeptName = pResultSet->GetStdString(2);
+                uint32_t nStatus = pResultSet->GetUInt(3);
+                uint32_t nPriority = pResultSet->GetUInt(4);
                 if(IM::BaseDefine::DepartmentStatusType_IsValid(nStatus))
                 {
                     cDept.set_dept_id(nId);
@@ -112,16 +112,16 @@ void CDepartModel::getDept(uint32_t nDeptId, IM::BaseDefine::DepartInfo& cDept)
     CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_slave");
     if (pDBConn)
     {
-        string strSql = "select * from IMDepart where id = " + int2string(nDeptId);
+        string strSql = "select id, parentId, departName, status, priority from IMDepart where id = " + int2string(nDeptId);
         CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
         if(pResultSet)
         {
             while (pResultSet->Next()) {
-                uint32_t nId = pResultSet->GetInt("id");
-                uint32_t nParentId = pResultSet->GetInt("parentId");
-                string strDeptName = pResultSet->GetString("departName");
-                uint32_t nStatus = pResultSet->GetInt("status");
-                uint32_t nPriority = pResultSet->GetInt("priority");
+                uint32_t nId = pResultSet->GetUInt(0);
+                uint32_t nParentId = pResultSet->GetUInt(1);
+                string strDeptName = pResultSet->GetStdString(2);
+                uint32_t nStatus = pResultSet->GetUInt(3);
+                uint32_t nPriority = pResultSet->GetUInt(4);
                 if(IM::BaseDefine::DepartmentStatusType_IsValid(nStatus))
                 {
                     cDept.set_dept_id(nId);
@@ -37,17 +37,17 @@ void CFileModel::getOfflineFile(uint32_t userId, list<IM::BaseDefine::OfflineFil
     CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_slave");
     if (pDBConn)
     {
-        string strSql = "select * from IMTransmitFile where toId="+int2string(userId) + " and status=0 order by created";
+        string strSql = "select fromId, taskId, fileName, size from IMTransmitFile where toId="+int2string(userId) + " and status=0 order by created";
         CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
         if(pResultSet)
         {
             while (pResultSet->Next())
             {
                 IM::BaseDefine::OfflineFileInfo offlineFile;
-                offlineFile.set_from_user_id(pResultSet->GetInt("fromId"));
-                offlineFile.set_task_id(pResultSet->GetString("taskId"));
-                offlineFile.set_file_name(pResultSet->GetString("fileName"));
-                offlineFile.set_file_size(pResultSet->GetInt("size"));
+                offlineFile.set_from_user_id(pResultSet->GetUInt(0));
+                offlineFile.set_task_id(pResultSet->GetString(1), pResultSet->GetStringLen(1));
+                offlineFile.set_file_name(pResultSet->GetString(2), pResultSet->GetStringLen(2));
+                offlineFile.set_file_size(pResultSet->GetUInt(3));
                 lsOffline.push_back(offlineFile);
             }
             delete pResultSet;
@@ -72,9 +72,9 @@ void CFileModel::addOfflineFile(uint32_t fromId, uint32_t toId, string& taskId,
     {
         string strSql = "insert into IMTransmitFile (`fromId`,`toId`,`fileName`,`size`,`taskId`,`status`,`created`,`updated`) values(?,?,?,?,?,?,?,?)";
         
-        // 必须在释放连接前delete CPrepareStatement对象，否则有可能多个线程操作mysql对象，会crash
-        CPrepareStatement* pStmt = new CPrepareStatement();
-        if (pStmt->Init(pDBConn->GetMysql(), strSql))
+        // 语句由连接缓存, 不能delete, 释放连接后也不能再使用，否则有可能多个线程操作mysql对象，会crash
+        CPrepareStatement* pStmt = pDBConn->GetStatement(strSql);
+        if (pStmt)
         {
             uint32_t status = 0;
             uint32_t nCreated = (uint32_t)time(NULL);
@@ -96,7 +96,6 @@ void CFileModel::addOfflineFile(uint32_t fromId, uint32_t toId, string& taskId,
                 log("insert message failed: %s", strSql.c_str());
             }
         }
-        delete pStmt;
         pDBManager->RelDBConn(pDBConn);
     }
     else
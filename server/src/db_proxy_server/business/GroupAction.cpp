@@ -215,7 +215,8 @@ namespace DB_PROXY {
                     setUserId.insert(msg.member_id_list(i));
                 }
                 list<uint32_t> lsCurUserId;
-                bool bRet = CGroupModel::getInstance()->modifyGroupMember(nUserId, nGroupId, nType, setUserId, lsCurUserId);
+                uint32_t nVersion = 0;
+                bool bRet = CGroupModel::getInstance()->modifyGroupMember(nUserId, nGroupId, nType, setUserId, lsCurUserId, nVersion);
                 msgResp.set_user_id(nUserId);
                 msgResp.set_group_id(nGroupId);
                 msgResp.set_change_type(nType);
@@ -231,6 +232,9 @@ namespace DB_PROXY {
                     {
                         msgResp.add_cur_user_id_list(*it);
                     }
+                    if (nVersion != 0) {
+                        msgResp.set_version(nVersion);
+                    }
                 }
                 log("userId=%u, groupId=%u, result=%u, changeCount:%u, currentCount=%u",nUserId, nGroupId,  bRet?0:1, msgResp.chg_user_id_list_size(), msgResp.cur_user_id_list_size());
                 msgResp.set_attach_data(msg.attach_data());
@@ -11,9 +11,12 @@
 
 #include <map>
 #include <set>
+#include <vector>
 
 #include "../DBPool.h"
 #include "../CachePool.h"
+#include "../MsgBatcher.h"
+#include "../MsgIdAllocator.h"
 #include "GroupMessageModel.h"
 #include "AudioModel.h"
 #include "SessionModel.h"
@@ -73,7 +76,44 @@ CGroupMessageModel* CGroupMessageModel::getInstance()
 bool CGroupMessageModel::sendMessage(uint32_t nFromId, uint32_t nGroupId, IM::BaseDefine::MsgType nMsgType, uint32_t nCreateTime,uint32_t nMsgId, const string& strMsgContent)
 {
     bool bRet = false;
-    if(CGroupModel::getInstance()->isInGroup(nFromId, nGroupId))
+    if(!CGroupModel::getInstance()->isInGroup(nFromId, nGroupId))
+    {
+        log("not in the group.fromId=%u, groupId=%u", nFromId, nGroupId);
+        return bRet;
+    }
+    
+    // 开启组提交时和其他线程的消息合并成一个事务写入
+    CMsgBatcher* pBatcher = CMsgBatcher::getInstance();
+    if (pBatcher->isEnabled())
+    {
+        static const string strColumns = "(`groupId`, `userId`, `msgId`, `content`, `type`, `status`, `updated`, `created`)";
+        string strTableName = "IMGroupMessage_" + int2string(nGroupId % 8);
+        vector<string> vecValues;
+        vecValues.push_back(int2string(nGroupId));
+        vecValues.push_back(int2string(nFromId));
+        vecValues.push_back(int2string(nMsgId));
+        vecValues.push_back(strMsgContent);
+        vecValues.push_back(int2string(nMsgType));
+        vecValues.push_back("0");
+        vecValues.push_back(int2string(nCreateTime));
+        vecValues.push_back(int2string(nCreateTime));
+        bRet = pBatcher->insert(strTableName, strColumns, vecValues);
+        if (bRet)
+        {
+            CGroupModel::getInstance()->updateGroupChat(nGroupId);
+            incMessageCount(nFromId, nGroupId);
+            clearMessageCount(nFromId, nGroupId);
+            updateLastMsg(nFromId, nGroupId, nMsgType, nMsgId, strMsgContent);
+        }
+        else
+        {
+            log("insert message failed. table=%s, msgId=%u", strTableName.c_str(), nMsgId);
+            // 失败时这条消息也可能已经提交了, 清掉记录, 下次查库
+            CLastMsgCache::getInstance()->remove("group_last_msg_" + int2string(nGroupId));
+        }
+        return bRet;
+    }
+    
     {
         CDBManager* pDBManager = CDBManager::getInstance();
         CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_master");
@@ -83,9 +123,9 @@ bool CGroupMessageModel::sendMessage(uint32_t nFromId, uint32_t nGroupId, IM::Ba
             string strSql = "insert into " + strTableName + " (`groupId`, `userId`, `msgId`, `content`, `type`, `status`, `updated`, `created`) "\
             "values(?, ?, ?, ?, ?, ?, ?, ?)";
             
-            // 必须在释放连接前delete CPrepareStatement对象，否则有可能多个线程操作mysql对象，会crash
-            CPrepareStatement* pStmt = new CPrepareStatement();
-            if (pStmt->Init(pDBConn->GetMysql(), strSql))
+            // 语句由连接缓存, 不能delete, 释放连接后也不能再使用，否则有可能多个线程操作mysql对象，会crash
+            CPrepareStatement* pStmt = pDBConn->GetStatement(strSql);
+            if (pStmt)
             {
                 uint32_t nStatus = 0;
                 uint32_t nType = nMsgType;
@@ -99,17 +139,18 @@ bool CGroupMessageModel::sendMessage(uint32_t nFromId, uint32_t nGroupId, IM::Ba
                 pStmt->SetParam(index++, nCreateTime);
                 pStmt->SetParam(index++, nCreateTime);
                 
-                bool bRet = pStmt->ExecuteUpdate();
+                bRet = pStmt->ExecuteUpdate();
                 if (bRet)
                 {
                     CGroupModel::getInstance()->updateGroupChat(nGroupId);
                     incMessageCount(nFromId, nGroupId);
                     clearMessageCount(nFromId, nGroupId);
+                    updateLastMsg(nFromId, nGroupId, nMsgType, nMsgId, strMsgContent);
                 } else {
                     log("insert message failed: %s", strSql.c_str());
+                    CLastMsgCache::getInstance()->remove("group_last_msg_" + int2string(nGroupId));
                 }
             }
-            delete pStmt;
             pDBManager->RelDBConn(pDBConn);
         }
         else
@@ -117,10 +158,6 @@ bool CGroupMessageModel::sendMessage(uint32_t nFromId, uint32_t nGroupId, IM::Ba
             log("no db connection for teamtalk_master");
         }
     }
-    else
-    {
-        log("not in the group.fromId=%u, groupId=%u", nFromId, nGroupId);
-    }
     return bRet;
 }
 
@@ -181,9 +218,7 @@ bool CGroupMessageModel::clearMessageCount(uint32_t nUserId, uint32_t nGroupId)
     {
         string strGroupKey = int2string(nGroupId) + GROUP_TOTAL_MSG_COUNTER_REDIS_KEY_SUFFIX;
         map<string, string> mapGroupCount;
-        bool bRet = pCacheConn->hgetAll(strGroupKey, mapGroupCount);
-        pCacheManager->RelCacheConn(pCacheConn);
-        if(bRet)
+        if(pCacheConn->hgetAll(strGroupKey, mapGroupCount))
         {
             string strUserKey = int2string(nUserId) + "_" + int2string(nGroupId) + GROUP_USER_MSG_COUNTER_REDIS_KEY_SUFFIX;
             string strReply = pCacheConn->hmset(strUserKey, mapGroupCount);
@@ -200,6 +235,7 @@ bool CGroupMessageModel::clearMessageCount(uint32_t nUserId, uint32_t nGroupId)
         {
             log("hgetAll %s failed !", strGroupKey.c_str());
         }
+        pCacheManager->RelCacheConn(pCacheConn);
     }
     else
     {
@@ -224,10 +260,11 @@ bool CGroupMessageModel::incMessageCount(uint32_t nUserId, uint32_t nGroupId)
     if (pCacheConn)
     {
         string strGroupKey = int2string(nGroupId) + GROUP_TOTAL_MSG_COUNTER_REDIS_KEY_SUFFIX;
-        pCacheConn->hincrBy(strGroupKey, GROUP_COUNTER_SUBKEY_COUNTER_FIELD, 1);
+        CachePipeline pipe(pCacheConn);
+        pipe.hincrBy(strGroupKey, GROUP_COUNTER_SUBKEY_COUNTER_FIELD, 1);
+        uint32_t nGetAllIdx = pipe.hgetAll(strGroupKey);
         map<string, string> mapGroupCount;
-        bool bRet = pCacheConn->hgetAll(strGroupKey, mapGroupCount);
-        if(bRet)
+        if(pipe.exec() && pipe.getHash(nGetAllIdx, mapGroupCount))
         {
             string strUserKey = int2string(nUserId) + "_" + int2string(nGroupId) + GROUP_USER_MSG_COUNTER_REDIS_KEY_SUFFIX;
             string strReply = pCacheConn->hmset(strUserKey, mapGroupCount);
@@ -276,26 +313,37 @@ void CGroupMessageModel::getMessage(uint32_t nUserId, uint32_t nGroupId, uint32_
         string strSql;
         if(nMsgId == 0)
         {
-            strSql = "select * from " + strTableName + " where groupId = " + int2string(nGroupId) + " and status = 0 and created>="+ int2string(nUpdated) + " order by created desc, id desc limit " + int2string(nMsgCnt);
+            strSql = "select msgId, userId, created, type, content from " + strTableName + " where groupId = ? and status = 0 and created>=? order by created desc, id desc limit ?";
         }else {
-            strSql = "select * from " + strTableName + " where groupId = " + int2string(nGroupId) + " and msgId<=" + int2string(nMsgId) + " and status = 0 and created>="+ int2string(nUpdated) + " order by created desc, id desc limit " + int2string(nMsgCnt);
+            strSql = "select msgId, userId, created, type, content from " + strTableName + " where groupId = ? and msgId<=? and status = 0 and created>=? order by created desc, id desc limit ?";
         }
         
-        CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
-        if (pResultSet)
+        CPrepareStatement* pStmt = pDBConn->GetStatement(strSql);
+        bool bRet = false;
+        if (pStmt)
         {
-            map<uint32_t, IM::BaseDefine::MsgInfo> mapAudioMsg;
-            while(pResultSet->Next())
+            uint32_t index = 0;
+            pStmt->SetParam(index++, nGroupId);
+            if (nMsgId != 0) {
+                pStmt->SetParam(index++, nMsgId);
+            }
+            pStmt->SetParam(index++, nUpdated);
+            pStmt->SetParam(index++, nMsgCnt);
+            bRet = pStmt->ExecuteQuery();
+        }
+        if (bRet)
+        {
+            while(pStmt->Next())
             {
                 IM::BaseDefine::MsgInfo msg;
-                msg.set_msg_id(pResultSet->GetInt("msgId"));
-                msg.set_from_session_id(pResultSet->GetInt("userId"));
-                msg.set_create_time(pResultSet->GetInt("created"));
-                IM::BaseDefine::MsgType nMsgType = IM::BaseDefine::MsgType(pResultSet->GetInt("type"));
+                msg.set_msg_id(pStmt->GetUInt(0));
+                msg.set_from_session_id(pStmt->GetUInt(1));
+                msg.set_create_time(pStmt->GetUInt(2));
+                IM::BaseDefine::MsgType nMsgType = IM::BaseDefine::MsgType(pStmt->GetInt(3));
                 if(IM::BaseDefine::MsgType_IsValid(nMsgType))
                 {
                     msg.set_msg_type(nMsgType);
-                    msg.set_msg_data(pResultSet->GetString("content"));
+                    msg.set_msg_data(pStmt->GetString(4), pStmt->GetStringLen(4));
                     lsMsg.push_back(msg);
                 }
                 else
@@ -303,7 +351,6 @@ void CGroupMessageModel::getMessage(uint32_t nUserId, uint32_t nGroupId, uint32_
                     log("invalid msgType. userId=%u, groupId=%u, msgType=%u", nUserId, nGroupId, nMsgType);
                 }
             }
-            delete pResultSet;
         }
         else
         {
@@ -331,63 +378,113 @@ void CGroupMessageModel::getUnreadMsgCount(uint32_t nUserId, uint32_t &nTotalCnt
 {
     list<uint32_t> lsGroupId;
     CGroupModel::getInstance()->getUserGroupIds(nUserId, lsGroupId, 0);
-    uint32_t nCount = 0;
+    
+    list<pair<uint32_t, uint32_t> > lsUnreadCnt;
+    if (!getGroupUnreadCnt(nUserId, lsGroupId, lsUnreadCnt))
+    {
+        return;
+    }
+    
+    // 有未读消息的群的最后一条消息一次取回
+    list<uint32_t> lsUnreadGroupId;
+    for(auto it=lsUnreadCnt.begin(); it!=lsUnreadCnt.end(); ++it)
+    {
+        lsUnreadGroupId.push_back(it->first);
+    }
+    map<uint32_t, LastMsg_t> mapLastMsg;
+    getLastMsgs(lsUnreadGroupId, mapLastMsg);
+    
+    for(auto it=lsUnreadCnt.begin(); it!=lsUnreadCnt.end(); ++it)
+    {
+        uint32_t nGroupId = it->first;
+        uint32_t nCount = it->second;
+        IM::BaseDefine::UnreadInfo cUnreadInfo;
+        cUnreadInfo.set_session_id(nGroupId);
+        cUnreadInfo.set_session_type(IM::BaseDefine::SESSION_TYPE_GROUP);
+        cUnreadInfo.set_unread_cnt(nCount);
+        nTotalCnt += nCount;
+        auto itMsg = mapLastMsg.find(nGroupId);
+        if (itMsg == mapLastMsg.end())
+        {
+            continue;
+        }
+        uint32_t nMsgId = itMsg->second.msg_id;
+        IM::BaseDefine::MsgType nType = IM::BaseDefine::MsgType(itMsg->second.msg_type);
+        if(IM::BaseDefine::MsgType_IsValid(nType))
+        {
+            cUnreadInfo.set_latest_msg_id(nMsgId);
+            cUnreadInfo.set_latest_msg_data(itMsg->second.content);
+            cUnreadInfo.set_latest_msg_type(nType);
+            cUnreadInfo.set_latest_msg_from_user_id(itMsg->second.from_id);
+            lsUnreadCount.push_back(cUnreadInfo);
+        }
+        else
+        {
+            log("invalid msgType. userId=%u, groupId=%u, msgType=%u, msgId=%u", nUserId, nGroupId, nType, nMsgId);
+        }
+    }
+}
+
+/**
+ *  获取用户在多个群里的未读消息数
+ *  原来每个群要两次hget，用户在200个群里登录时要400次redis往返，现在合并成一次流水线
+ *
+ *  @param nUserId     用户Id
+ *  @param lsGroupId   群Id列表
+ *  @param lsUnreadCnt 未读数大于0的群，<群Id, 未读数>
+ *
+ *  @return 成功返回true，失败返回false
+ */
+bool CGroupMessageModel::getGroupUnreadCnt(uint32_t nUserId, const list<uint32_t>& lsGroupId, list<pair<uint32_t, uint32_t> >& lsUnreadCnt)
+{
+    if (lsGroupId.empty())
+    {
+        return true;
+    }
     
     CacheManager* pCacheManager = CacheManager::getInstance();
     CacheConn* pCacheConn = pCacheManager->GetCacheConn("unread");
-    if (pCacheConn)
+    if (!pCacheConn)
+    {
+        log("no cache connection for unread");
+        return false;
+    }
+    
+    // 每个群依次排两条命令: 群总消息数, 用户已读数
+    CachePipeline pipe(pCacheConn);
+    for(auto it=lsGroupId.begin(); it!=lsGroupId.end(); ++it)
     {
-        for(auto it=lsGroupId.begin(); it!=lsGroupId.end(); ++it)
+        uint32_t nGroupId = *it;
+        string strGroupKey = int2string(nGroupId) + GROUP_TOTAL_MSG_COUNTER_REDIS_KEY_SUFFIX;
+        string strUserKey = int2string(nUserId) + "_" + int2string(nGroupId) + GROUP_USER_MSG_COUNTER_REDIS_KEY_SUFFIX;
+        pipe.hget(strGroupKey, GROUP_COUNTER_SUBKEY_COUNTER_FIELD);
+        pipe.hget(strUserKey, GROUP_COUNTER_SUBKEY_COUNTER_FIELD);
+    }
+    
+    bool bRet = pipe.exec();
+    if (bRet)
+    {
+        uint32_t nIndex = 0;
+        for(auto it=lsGroupId.begin(); it!=lsGroupId.end(); ++it, nIndex += 2)
         {
-            uint32_t nGroupId = *it;
-            string strGroupKey = int2string(nGroupId) + GROUP_TOTAL_MSG_COUNTER_REDIS_KEY_SUFFIX;
-            string strGroupCnt = pCacheConn->hget(strGroupKey, GROUP_COUNTER_SUBKEY_COUNTER_FIELD);
-            if(strGroupCnt.empty())
+            if (pipe.isNil(nIndex))
             {
-//                log("hget %s : count failed !", strGroupKey.c_str());
                 continue;
             }
-            uint32_t nGroupCnt = (uint32_t)(atoi(strGroupCnt.c_str()));
-            
-            string strUserKey = int2string(nUserId) + "_" + int2string(nGroupId) + GROUP_USER_MSG_COUNTER_REDIS_KEY_SUFFIX;
-            string strUserCnt = pCacheConn->hget(strUserKey, GROUP_COUNTER_SUBKEY_COUNTER_FIELD);
-            
-            uint32_t nUserCnt = ( strUserCnt.empty() ? 0 : ((uint32_t)atoi(strUserCnt.c_str())) );
-            if(nGroupCnt >= nUserCnt) {
-                nCount = nGroupCnt - nUserCnt;
-            }
-            if(nCount > 0)
+            uint32_t nGroupCnt = (uint32_t)pipe.getInteger(nIndex);
+            uint32_t nUserCnt = (uint32_t)pipe.getInteger(nIndex + 1);
+            if(nGroupCnt > nUserCnt)
             {
-                IM::BaseDefine::UnreadInfo cUnreadInfo;
-                cUnreadInfo.set_session_id(nGroupId);
-                cUnreadInfo.set_session_type(IM::BaseDefine::SESSION_TYPE_GROUP);
-                cUnreadInfo.set_unread_cnt(nCount);
-                nTotalCnt += nCount;
-                string strMsgData;
-                uint32_t nMsgId;
-                IM::BaseDefine::MsgType nType;
-                uint32_t nFromId;
-                getLastMsg(nGroupId, nMsgId, strMsgData, nType, nFromId);
-                if(IM::BaseDefine::MsgType_IsValid(nType))
-                {
-                    cUnreadInfo.set_latest_msg_id(nMsgId);
-                    cUnreadInfo.set_latest_msg_data(strMsgData);
-                    cUnreadInfo.set_latest_msg_type(nType);
-                    cUnreadInfo.set_latest_msg_from_user_id(nFromId);
-                    lsUnreadCount.push_back(cUnreadInfo);
-                }
-                else
-                {
-                    log("invalid msgType. userId=%u, groupId=%u, msgType=%u, msgId=%u", nUserId, nGroupId, nType, nMsgId);
-                }
+                lsUnreadCnt.push_back(make_pair(*it, nGroupCnt - nUserCnt));
             }
         }
-        pCacheManager->RelCacheConn(pCacheConn);
     }
     else
     {
-        log("no cache connection for unread");
+        log("get group unread count failed. userId=%u, groupCnt=%lu", nUserId, lsGroupId.size());
     }
+    pCacheManager->RelCacheConn(pCacheConn);
+    return bRet;
 }
 
 /**
@@ -399,21 +496,8 @@ void CGroupMessageModel::getUnreadMsgCount(uint32_t nUserId, uint32_t &nTotalCnt
  */
 uint32_t CGroupMessageModel::getMsgId(uint32_t nGroupId)
 {
-    uint32_t nMsgId = 0;
-    CacheManager* pCacheManager = CacheManager::getInstance();
-    CacheConn* pCacheConn = pCacheManager->GetCacheConn("unread");
-    if(pCacheConn)
-    {
-        // TODO
-        string strKey = "group_msg_id_" + int2string(nGroupId);
-        nMsgId = pCacheConn->incrBy(strKey, 1);
-        pCacheManager->RelCacheConn(pCacheConn);
-    }
-    else
-    {
-        log("no cache connection for unread");
-    }
-    return nMsgId;
+    string strKey = "group_msg_id_" + int2string(nGroupId);
+    return CMsgIdAllocator::getInstance()->allocate(strKey);
 }
 
 /**
@@ -426,32 +510,101 @@ uint32_t CGroupMessageModel::getMsgId(uint32_t nGroupId)
  */
 void CGroupMessageModel::getLastMsg(uint32_t nGroupId, uint32_t &nMsgId, string &strMsgData, IM::BaseDefine::MsgType &nMsgType, uint32_t& nFromId)
 {
+    list<uint32_t> lsGroupId(1, nGroupId);
+    map<uint32_t, LastMsg_t> mapLastMsg;
+    getLastMsgs(lsGroupId, mapLastMsg);
+    auto it = mapLastMsg.find(nGroupId);
+    if (it != mapLastMsg.end())
+    {
+        nMsgId = it->second.msg_id;
+        nMsgType = IM::BaseDefine::MsgType(it->second.msg_type);
+        nFromId = it->second.from_id;
+        strMsgData = it->second.content;
+    }
+}
+
+/**
+ *  批量获取多个群的最后一条消息
+ *  先用一次redis流水线取写消息时维护的记录, 没有记录的群才查库, 查到的结果回填
+ *
+ *  @param lsGroupId  群Id列表
+ *  @param mapLastMsg <群Id, 最后一条消息>, 群里没有消息时msg_id为0, 查询失败的不返回
+ */
+void CGroupMessageModel::getLastMsgs(const list<uint32_t>& lsGroupId, map<uint32_t, LastMsg_t>& mapLastMsg)
+{
+    vector<uint32_t> vecGroupId(lsGroupId.begin(), lsGroupId.end());
+    vector<string> vecKey;
+    for (auto it = vecGroupId.begin(); it != vecGroupId.end(); ++it)
+    {
+        vecKey.push_back("group_last_msg_" + int2string(*it));
+    }
+
+    CLastMsgCache* pLastMsgCache = CLastMsgCache::getInstance();
+    vector<LastMsgLookup_t> vecResult;
+    pLastMsgCache->get(vecKey, vecResult);
+    for (size_t i = 0; i < vecKey.size(); i++)
+    {
+        if (vecResult[i].hit)
+        {
+            mapLastMsg[vecGroupId[i]] = vecResult[i].msg;
+            continue;
+        }
+
+        LastMsg_t cLastMsg;
+        if (queryLastMsg(vecGroupId[i], cLastMsg))
+        {
+            pLastMsgCache->fill(vecKey[i], cLastMsg, vecResult[i].ver);
+            mapLastMsg[vecGroupId[i]] = cLastMsg;
+        }
+    }
+}
+
+/**
+ *  从数据库查询群未被删除的最后一条消息
+ *
+ *  @param nGroupId 群Id
+ *  @param cLastMsg 最后一条消息, 没有消息时msg_id为0
+ *
+ *  @return 查询成功返回true, sql出错返回false
+ */
+bool CGroupMessageModel::queryLastMsg(uint32_t nGroupId, LastMsg_t& cLastMsg)
+{
+    cLastMsg.msg_id = 0;
+    cLastMsg.msg_type = 0;
+    cLastMsg.from_id = 0;
+    cLastMsg.content.clear();
+
     string strTableName = "IMGroupMessage_" + int2string(nGroupId % 8);
     
+    bool bRet = false;
     CDBManager* pDBManager = CDBManager::getInstance();
     CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_slave");
     if (pDBConn)
     {
-        string strSql = "select msgId, type,userId, content from " + strTableName + " where groupId = " + int2string(nGroupId) + " and status = 0 order by created desc, id desc limit 1";
+        string strSql = "select msgId, type,userId, content from " + strTableName + " where groupId = ? and status = 0 order by created desc, id desc limit 1";
         
-        CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
-        if (pResultSet)
+        CPrepareStatement* pStmt = pDBConn->GetStatement(strSql);
+        if (pStmt)
         {
-            while(pResultSet->Next()) {
-                nMsgId = pResultSet->GetInt("msgId");
-                nMsgType = IM::BaseDefine::MsgType(pResultSet->GetInt("type"));
-                nFromId = pResultSet->GetInt("userId");
-                if(nMsgType == IM::BaseDefine::MSG_TYPE_GROUP_AUDIO)
+            pStmt->SetParam(0, nGroupId);
+            bRet = pStmt->ExecuteQuery();
+        }
+        if (bRet)
+        {
+            while(pStmt->Next()) {
+                cLastMsg.msg_id = pStmt->GetUInt(0);
+                cLastMsg.msg_type = pStmt->GetUInt(1);
+                cLastMsg.from_id = pStmt->GetUInt(2);
+                if(cLastMsg.msg_type == IM::BaseDefine::MSG_TYPE_GROUP_AUDIO)
                 {
                     // "[语音]"加密后的字符串
-                    strMsgData = strAudioEnc;
+                    cLastMsg.content = strAudioEnc;
                 }
                 else
                 {
-                    strMsgData = pResultSet->GetString("content");
+                    cLastMsg.content.assign(pStmt->GetString(3), pStmt->GetStringLen(3));
                 }
             }
-            delete pResultSet;
         }
         else
         {
@@ -463,6 +616,21 @@ void CGroupMessageModel::getLastMsg(uint32_t nGroupId, uint32_t &nMsgId, string
     {
         log("no db connection for teamtalk_slave");
     }
+    return bRet;
+}
+
+/**
+ *  写消息成功后更新群的最后一条消息记录
+ */
+void CGroupMessageModel::updateLastMsg(uint32_t nFromId, uint32_t nGroupId, IM::BaseDefine::MsgType nMsgType, uint32_t nMsgId, const string& strMsgContent)
+{
+    LastMsg_t cLastMsg;
+    cLastMsg.msg_id = nMsgId;
+    cLastMsg.msg_type = nMsgType;
+    cLastMsg.from_id = nFromId;
+    // 语音消息的content是语音Id, 和查库时一样换成"[语音]"
+    cLastMsg.content = (nMsgType == IM::BaseDefine::MSG_TYPE_GROUP_AUDIO) ? strAudioEnc : strMsgContent;
+    CLastMsgCache::getInstance()->update("group_last_msg_" + int2string(nGroupId), cLastMsg);
 }
 
 /**
@@ -475,41 +643,14 @@ void CGroupMessageModel::getUnReadCntAll(uint32_t nUserId, uint32_t &nTotalCnt)
 {
     list<uint32_t> lsGroupId;
     CGroupModel::getInstance()->getUserGroupIds(nUserId, lsGroupId, 0);
-    uint32_t nCount = 0;
     
-    CacheManager* pCacheManager = CacheManager::getInstance();
-    CacheConn* pCacheConn = pCacheManager->GetCacheConn("unread");
-    if (pCacheConn)
+    list<pair<uint32_t, uint32_t> > lsUnreadCnt;
+    if (getGroupUnreadCnt(nUserId, lsGroupId, lsUnreadCnt))
     {
-        for(auto it=lsGroupId.begin(); it!=lsGroupId.end(); ++it)
+        for(auto it=lsUnreadCnt.begin(); it!=lsUnreadCnt.end(); ++it)
         {
-            uint32_t nGroupId = *it;
-            string strGroupKey = int2string(nGroupId) + GROUP_TOTAL_MSG_COUNTER_REDIS_KEY_SUFFIX;
-            string strGroupCnt = pCacheConn->hget(strGroupKey, GROUP_COUNTER_SUBKEY_COUNTER_FIELD);
-            if(strGroupCnt.empty())
-            {
-//                log("hget %s : count failed !", strGroupKey.c_str());
-                continue;
-            }
-            uint32_t nGroupCnt = (uint32_t)(atoi(strGroupCnt.c_str()));
-            
-            string strUserKey = int2string(nUserId) + "_" + int2string(nGroupId) + GROUP_USER_MSG_COUNTER_REDIS_KEY_SUFFIX;
-            string strUserCnt = pCacheConn->hget(strUserKey, GROUP_COUNTER_SUBKEY_COUNTER_FIELD);
-            
-            uint32_t nUserCnt = ( strUserCnt.empty() ? 0 : ((uint32_t)atoi(strUserCnt.c_str())) );
-            if(nGroupCnt >= nUserCnt) {
-                nCount = nGroupCnt - nUserCnt;
-            }
-            if(nCount > 0)
-            {
-                nTotalCnt += nCount;
-            }
+            nTotalCnt += it->second;
         }
-        pCacheManager->RelCacheConn(pCacheConn);
-    }
-    else
-    {
-        log("no cache connection for unread");
     }
 }
 
@@ -539,21 +680,21 @@ void CGroupMessageModel::getMsgByMsgId(uint32_t nUserId, uint32_t nGroupId, cons
                     }
                 }
                 
-                string strSql = "select * from " + strTableName + " where groupId=" + int2string(nGroupId) + " and msgId in (" + strClause + ") and status=0 and created >= " + int2string(nUpdated) + " order by created desc, id desc limit 100";
+                string strSql = "select msgId, userId, created, type, content from " + strTableName + " where groupId=" + int2string(nGroupId) + " and msgId in (" + strClause + ") and status=0 and created >= " + int2string(nUpdated) + " order by created desc, id desc limit 100";
                 CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
                 if (pResultSet)
                 {
                     while (pResultSet->Next())
                     {
                         IM::BaseDefine::MsgInfo msg;
-                        msg.set_msg_id(pResultSet->GetInt("msgId"));
-                        msg.set_from_session_id(pResultSet->GetInt("userId"));
-                        msg.set_create_time(pResultSet->GetInt("created"));
-                        IM::BaseDefine::MsgType nMsgType = IM::BaseDefine::MsgType(pResultSet->GetInt("type"));
+                        msg.set_msg_id(pResultSet->GetUInt(0));
+                        msg.set_from_session_id(pResultSet->GetUInt(1));
+                        msg.set_create_time(pResultSet->GetUInt(2));
+                        IM::BaseDefine::MsgType nMsgType = IM::BaseDefine::MsgType(pResultSet->GetInt(3));
                         if(IM::BaseDefine::MsgType_IsValid(nMsgType))
                         {
                             msg.set_msg_type(nMsgType);
-                            msg.set_msg_data(pResultSet->GetString("content"));
+                            msg.set_msg_data(pResultSet->GetString(4), pResultSet->GetStringLen(4));
                             lsMsg.push_back(msg);
                         }
                         else
@@ -604,6 +745,9 @@ bool CGroupMessageModel::resetMsgId(uint32_t nGroupId)
             bRet = true;
         }
         pCacheManager->RelCacheConn(pCacheConn);
+        CMsgIdAllocator::getInstance()->reset(strKey);
+        // msgId从头开始, 旧记录的msgId更大, 不清掉的话新消息写不进去
+        CLastMsgCache::getInstance()->remove("group_last_msg_" + int2string(nGroupId));
     }
     return bRet;
 }
\ No newline at end of file
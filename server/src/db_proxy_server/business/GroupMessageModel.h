@@ -13,12 +13,14 @@
 #define GROUP_MESSAGE_MODEL_H_
 
 #include <list>
+#include <map>
 #include <string>
 
 #include "util.h"
 #include "ImPduBase.h"
 #include "AudioModel.h"
 #include "GroupModel.h"
+#include "../LastMsgCache.h"
 #include "IM.BaseDefine.pb.h"
 
 using namespace std;
@@ -37,12 +39,17 @@ public:
     uint32_t getMsgId(uint32_t nGroupId);
     void getUnreadMsgCount(uint32_t nUserId, uint32_t &nTotalCnt, list<IM::BaseDefine::UnreadInfo>& lsUnreadCount);
     void getLastMsg(uint32_t nGroupId, uint32_t& nMsgId, string& strMsgData, IM::BaseDefine::MsgType & nMsgType, uint32_t& nFromId);
+    void getLastMsgs(const list<uint32_t>& lsGroupId, map<uint32_t, LastMsg_t>& mapLastMsg);
     void getUnReadCntAll(uint32_t nUserId, uint32_t &nTotalCnt);
     void getMsgByMsgId(uint32_t nUserId, uint32_t nGroupId, const list<uint32_t>& lsMsgId, list<IM::BaseDefine::MsgInfo>& lsMsg);
     bool resetMsgId(uint32_t nGroupId);
 private:
     CGroupMessageModel();
     bool incMessageCount(uint32_t nUserId, uint32_t nGroupId);
+    // 用一次redis流水线取出用户在各个群的未读数, 只返回未读数大于0的群
+    bool getGroupUnreadCnt(uint32_t nUserId, const list<uint32_t>& lsGroupId, list<pair<uint32_t, uint32_t> >& lsUnreadCnt);
+    void updateLastMsg(uint32_t nFromId, uint32_t nGroupId, IM::BaseDefine::MsgType nMsgType, uint32_t nMsgId, const string& strMsgContent);
+    bool queryLastMsg(uint32_t nGroupId, LastMsg_t& cLastMsg);
 
 private:
 	static CGroupMessageModel*	m_pInstance;
@@ -101,7 +101,7 @@ bool CGroupModel::removeGroup(uint32_t nUserId, uint32_t nGroupId, list<uint32_t
         {
             uint32_t nCreator;
             while (pResultSet->Next()) {
-                nCreator = pResultSet->GetInt("creator");
+                nCreator = pResultSet->GetUInt(0);
             }
             
             if(0 == nCreator || nCreator == nUserId)
@@ -119,7 +119,7 @@ bool CGroupModel::removeGroup(uint32_t nUserId, uint32_t nGroupId, list<uint32_t
             if(pResultSet)
             {
                 while (pResultSet->Next()) {
-                    uint32_t nId = pResultSet->GetInt("userId");
+                    uint32_t nId = pResultSet->GetUInt(0);
                     setGroupUsers.insert(nId);
                 }
                 delete pResultSet;
@@ -170,25 +170,25 @@ void CGroupModel::getGroupInfo(map<uint32_t,IM::BaseDefine::GroupVersionInfo>& m
                     strClause += ("," + int2string(it->first));
                 }
             }
-            string strSql = "select * from IMGroup where id in (" + strClause  + ") order by updated desc";
+            string strSql = "select id, version, name, avatar, type, creator from IMGroup where id in (" + strClause  + ") order by updated desc";
             CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
             if(pResultSet)
             {
                 while (pResultSet->Next()) {
-                    uint32_t nGroupId = pResultSet->GetInt("id");
-                    uint32_t nVersion = pResultSet->GetInt("version");
+                    uint32_t nGroupId = pResultSet->GetUInt(0);
+                    uint32_t nVersion = pResultSet->GetUInt(1);
                if(mapGroupId[nGroupId].version() < nVersion)
                     {
                         IM::BaseDefine::GroupInfo cGroupInfo;
                         cGroupInfo.set_group_id(nGroupId);
                         cGroupInfo.set_version(nVersion);
-                        cGroupInfo.set_group_name(pResultSet->GetString("name"));
-                        cGroupInfo.set_group_avatar(pResultSet->GetString("avatar"));
-                        IM::BaseDefine::GroupType nGroupType = IM::BaseDefine::GroupType(pResultSet->GetInt("type"));
+                        cGroupInfo.set_group_name(pResultSet->GetString(2), pResultSet->GetStringLen(2));
+                        cGroupInfo.set_group_avatar(pResultSet->GetString(3), pResultSet->GetStringLen(3));
+                        IM::BaseDefine::GroupType nGroupType = IM::BaseDefine::GroupType(pResultSet->GetInt(4));
                         if(IM::BaseDefine::GroupType_IsValid(nGroupType))
                         {
                             cGroupInfo.set_group_type(nGroupType);
-                            cGroupInfo.set_group_creator_id(pResultSet->GetInt("creator"));
+                            cGroupInfo.set_group_creator_id(pResultSet->GetUInt(5));
                             lsGroupInfo.push_back(cGroupInfo);
                         }
                         else
@@ -220,7 +220,7 @@ void CGroupModel::getGroupInfo(map<uint32_t,IM::BaseDefine::GroupVersionInfo>& m
     }
 }
 
-bool CGroupModel::modifyGroupMember(uint32_t nUserId, uint32_t nGroupId, IM::BaseDefine::GroupModifyType nType, set<uint32_t>& setUserId, list<uint32_t>& lsCurUserId)
+bool CGroupModel::modifyGroupMember(uint32_t nUserId, uint32_t nGroupId, IM::BaseDefine::GroupModifyType nType, set<uint32_t>& setUserId, list<uint32_t>& lsCurUserId, uint32_t& nVersion)
 {
     bool bRet = false;
     if(hasModifyPermission(nUserId, nGroupId, nType))
@@ -240,7 +240,7 @@ bool CGroupModel::modifyGroupMember(uint32_t nUserId, uint32_t nGroupId, IM::Bas
         //if modify group member success, need to inc the group version and clear the user count;
         if(bRet)
         {
-            incGroupVersion(nGroupId);
+            incGroupVersion(nGroupId, nVersion);
             for (auto it=setUserId.begin(); it!=setUserId.end(); ++it) {
                 uint32_t nUserId=*it;
                 CUserModel::getInstance()->clearUserCounter(nUserId, nGroupId, IM::BaseDefine::SESSION_TYPE_GROUP);
@@ -264,8 +264,8 @@ bool CGroupModel::insertNewGroup(uint32_t nUserId, const string& strGroupName, c
         string strSql = "insert into IMGroup(`name`, `avatar`, `creator`, `type`,`userCnt`, `status`, `version`, `lastChated`, `updated`, `created`) "\
         "values(?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
         
-        CPrepareStatement* pStmt = new CPrepareStatement();
-        if (pStmt->Init(pDBConn->GetMysql(), strSql))
+        CPrepareStatement* pStmt = pDBConn->GetStatement(strSql);
+        if (pStmt)
         {
             uint32_t nCreated = (uint32_t)time(NULL);
             uint32_t index = 0;
@@ -288,7 +288,6 @@ bool CGroupModel::insertNewGroup(uint32_t nUserId, const string& strGroupName, c
                 nGroupId = pStmt->GetInsertId();
             }
         }
-        delete pStmt;
         pDBManager->RelDBConn(pDBConn);
     }
     else
@@ -330,7 +329,7 @@ bool CGroupModel::insertNewMember(uint32_t nGroupId, set<uint32_t>& setUsers)
             if(pResult)
             {
                 while (pResult->Next()) {
-                    setHasUser.insert(pResult->GetInt("userId"));
+                    setHasUser.insert(pResult->GetUInt(0));
                 }
                 delete pResult;
             }
@@ -379,8 +378,8 @@ bool CGroupModel::insertNewMember(uint32_t nGroupId, set<uint32_t>& setUsers)
                         uint32_t nUserId = *it;
                         if(setHasUser.find(nUserId) == setHasUser.end())
                         {
-                            CPrepareStatement* pStmt = new CPrepareStatement();
-                            if (pStmt->Init(pDBConn->GetMysql(), strSql))
+                            CPrepareStatement* pStmt = pDBConn->GetStatement(strSql);
+                            if (pStmt)
                             {
                                 uint32_t index = 0;
                                 pStmt->SetParam(index++, nGroupId);
@@ -390,12 +389,10 @@ bool CGroupModel::insertNewMember(uint32_t nGroupId, set<uint32_t>& setUsers)
                                 pStmt->SetParam(index++, nCreated);
                                 pStmt->ExecuteUpdate();
                                 ++nIncMemberCnt;
-                                delete pStmt;
                             }
                             else
                             {
                                 setUsers.erase(it++);
-                                delete pStmt;
                                 continue;
                             }
                         }
@@ -407,11 +404,17 @@ bool CGroupModel::insertNewMember(uint32_t nGroupId, set<uint32_t>& setUsers)
                         pDBConn->ExecuteUpdate(strSql.c_str());
                     }
                     
-                    //更新一份到redis中
+                    //更新一份到redis中, 所有成员一次流水线写入
                     string strKey = "group_member_"+int2string(nGroupId);
+                    string strCreated = int2string(nCreated);
+                    CachePipeline pipe(pCacheConn);
                     for(auto it = setUsers.begin(); it!=setUsers.end(); ++it)
                     {
-                        pCacheConn->hset(strKey, int2string(*it), int2string(nCreated));
+                        pipe.hset(strKey, int2string(*it), strCreated);
+                    }
+                    if (!pipe.exec())
+                    {
+                        log("hset %s failed, userCnt=%lu", strKey.c_str(), setUsers.size());
                     }
                     pCacheManager->RelCacheConn(pCacheConn);
                     bRet = true;
@@ -455,7 +458,7 @@ void CGroupModel::getUserGroupIds(uint32_t nUserId, list<uint32_t>& lsGroupId, u
         {
             while(pResultSet->Next())
             {
-                uint32_t nGroupId = pResultSet->GetInt("groupId");
+                uint32_t nGroupId = pResultSet->GetUInt(0);
                 lsGroupId.push_back(nGroupId);
             }
             delete pResultSet;
@@ -508,8 +511,8 @@ void CGroupModel::getGroupVersion(list<uint32_t> &lsGroupId, list<IM::BaseDefine
                 while(pResultSet->Next())
                 {
                     IM::BaseDefine::GroupVersionInfo group;
-                    group.set_group_id(pResultSet->GetInt("id"));
-                    group.set_version(pResultSet->GetInt("version"));
+                    group.set_group_id(pResultSet->GetUInt(0));
+                    group.set_version(pResultSet->GetUInt(1));
                     lsGroup.push_back(group);
                 }
                 delete pResultSet;
@@ -571,8 +574,8 @@ bool CGroupModel::hasModifyPermission(uint32_t nUserId, uint32_t nGroupId, IM::B
         {
             while (pResultSet->Next())
             {
-                uint32_t nCreator = pResultSet->GetInt("creator");
-                IM::BaseDefine::GroupType nGroupType = IM::BaseDefine::GroupType(pResultSet->GetInt("type"));
+                uint32_t nCreator = pResultSet->GetUInt(0);
+                IM::BaseDefine::GroupType nGroupType = IM::BaseDefine::GroupType(pResultSet->GetInt(1));
                 if(IM::BaseDefine::GroupType_IsValid(nGroupType))
                 {
                     if(IM::BaseDefine::GROUP_TYPE_TMP == nGroupType && IM::BaseDefine::GROUP_MODIFY_TYPE_ADD == nType)
@@ -647,9 +650,13 @@ bool CGroupModel::removeMember(uint32_t nGroupId, set<uint32_t> &setUser, list<u
             
             //从redis中删除成员
             string strKey = "group_member_"+ int2string(nGroupId);
+            CachePipeline pipe(pCacheConn);
             for (auto it=setUser.begin(); it!=setUser.end(); ++it) {
-                string strField = int2string(*it);
-                pCacheConn->hdel(strKey, strField);
+                pipe.hdel(strKey, int2string(*it));
+            }
+            if (!pipe.exec())
+            {
+                log("hdel %s failed, userCnt=%lu", strKey.c_str(), setUser.size());
             }
             pCacheManager->RelCacheConn(pCacheConn);
             bRet = true;
@@ -673,24 +680,40 @@ bool CGroupModel::removeMember(uint32_t nGroupId, set<uint32_t> &setUser, list<u
 
 void CGroupModel::removeRepeatUser(uint32_t nGroupId, set<uint32_t> &setUser)
 {
+    if (setUser.empty())
+    {
+        return;
+    }
     CacheManager* pCacheManager = CacheManager::getInstance();
     CacheConn* pCacheConn = pCacheManager->GetCacheConn("group_member");
     if (pCacheConn)
     {
         string strKey = "group_member_"+int2string(nGroupId);
-        for (auto it=setUser.begin(); it!=setUser.end();) {
-            string strField = int2string(*it);
-            string strValue = pCacheConn->hget(strKey, strField);
-            pCacheManager->RelCacheConn(pCacheConn);
-            if(!strValue.empty())
-            {
-                setUser.erase(it++);
-            }
-            else
-            {
-                ++it;
+        CachePipeline pipe(pCacheConn);
+        for (auto it=setUser.begin(); it!=setUser.end(); ++it) {
+            pipe.hget(strKey, int2string(*it));
+        }
+        bool bRet = pipe.exec();
+        pCacheManager->RelCacheConn(pCacheConn);
+        if (bRet)
+        {
+            // 回复和排队时的顺序一致
+            uint32_t nIndex = 0;
+            for (auto it=setUser.begin(); it!=setUser.end(); ++nIndex) {
+                if(!pipe.isNil(nIndex))
+                {
+                    setUser.erase(it++);
+                }
+                else
+                {
+                    ++it;
+                }
             }
         }
+        else
+        {
+            log("hget %s failed, userCnt=%lu", strKey.c_str(), setUser.size());
+        }
     }
     else
     {
@@ -864,16 +887,19 @@ void CGroupModel::removeSession(uint32_t nGroupId, const set<uint32_t> &setUser)
     }
 }
 
-bool CGroupModel::incGroupVersion(uint32_t nGroupId)
+bool CGroupModel::incGroupVersion(uint32_t nGroupId, uint32_t& nVersion)
 {
     bool bRet = false;
+    nVersion = 0;
     CDBManager* pDBManager = CDBManager::getInstance();
     CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_master");
     if(pDBConn)
     {
-        string strSql = "update IMGroup set version=version+1 where id="+int2string(nGroupId);
+        // LAST_INSERT_ID(expr)让这条update顺带把加过之后的版本号带回来, 不用再查一次
+        string strSql = "update IMGroup set version=LAST_INSERT_ID(version+1) where id="+int2string(nGroupId);
         if(pDBConn->ExecuteUpdate(strSql.c_str()))
         {
+            nVersion = pDBConn->GetInsertId();
             bRet = true;
         }
         pDBManager->RelDBConn(pDBConn);
@@ -888,13 +914,40 @@ bool CGroupModel::incGroupVersion(uint32_t nGroupId)
 
 void CGroupModel::fillGroupMember(list<IM::BaseDefine::GroupInfo>& lsGroups)
 {
+    if (lsGroups.empty())
+    {
+        return;
+    }
+    CacheManager* pCacheManager = CacheManager::getInstance();
+    CacheConn* pCacheConn = pCacheManager->GetCacheConn("group_member");
+    if (!pCacheConn)
+    {
+        log("no cache connection for group_member");
+        return;
+    }
+    // 每个群一条hgetall, 合并成一次流水线
+    CachePipeline pipe(pCacheConn);
     for (auto it=lsGroups.begin(); it!=lsGroups.end(); ++it) {
-        list<uint32_t> lsUserIds;
-        uint32_t nGroupId = it->group_id();
-        getGroupUser(nGroupId, lsUserIds);
-        for(auto itUserId=lsUserIds.begin(); itUserId!=lsUserIds.end(); ++itUserId)
+        pipe.hgetAll("group_member_" + int2string(it->group_id()));
+    }
+    bool bRet = pipe.exec();
+    pCacheManager->RelCacheConn(pCacheConn);
+    if (!bRet)
+    {
+        log("hgetall group member failed, groupCnt=%lu", lsGroups.size());
+        return;
+    }
+    uint32_t nIndex = 0;
+    for (auto it=lsGroups.begin(); it!=lsGroups.end(); ++it, ++nIndex) {
+        map<string, string> mapAllUser;
+        if (!pipe.getHash(nIndex, mapAllUser))
         {
-            it->add_group_member_list(*itUserId);
+            log("hgetall group_member_%u failed!", it->group_id());
+            continue;
+        }
+        for(auto itUser=mapAllUser.begin(); itUser!=mapAllUser.end(); ++itUser)
+        {
+            it->add_group_member_list(string2int(itUser->first));
         }
     }
 }
@@ -939,19 +992,13 @@ void CGroupModel::clearGroupMember(uint32_t nGroupId)
     CacheConn* pCacheConn = pCacheManager->GetCacheConn("group_member");
     if(pCacheConn)
     {
+        // 删除所有field等同于删除整个key, 一次往返就够了
         string strKey = "group_member_" + int2string(nGroupId);
-        map<string, string> mapRet;
-        bool bRet = pCacheConn->hgetAll(strKey, mapRet);
-        if(bRet)
-        {
-            for(auto it=mapRet.begin(); it!=mapRet.end(); ++it)
-            {
-                pCacheConn->hdel(strKey, it->first);
-            }
-        }
-        else
+        CachePipeline pipe(pCacheConn);
+        pipe.del(strKey);
+        if(!pipe.exec())
         {
-            log("hgetall %s failed", strKey.c_str());
+            log("del %s failed", strKey.c_str());
         }
         pCacheManager->RelCacheConn(pCacheConn);
     }
@@ -41,7 +41,7 @@ public:
     bool setPush(uint32_t nUserId, uint32_t nGroupId, uint32_t nType, uint32_t nStatus);
     void getPush(uint32_t nGroupId, list<uint32_t>& lsUser, list<IM::BaseDefine::ShieldStatus>& lsPush);
     bool modifyGroupMember(uint32_t nUserId, uint32_t nGroupId, IM::BaseDefine::GroupModifyType nType, set<uint32_t>& setUserId,
-                           list<uint32_t>& lsCurUserId);
+                           list<uint32_t>& lsCurUserId, uint32_t& nVersion);
     void getGroupUser(uint32_t nGroupId, list<uint32_t>& lsUserId);
     bool isInGroup(uint32_t nUserId, uint32_t nGroupId);
     void updateGroupChat(uint32_t nGroupId);
@@ -59,7 +59,7 @@ private:
     bool removeMember(uint32_t nGroupId, set<uint32_t>& setUser,list<uint32_t>& lsCurUserId);
     void removeRepeatUser(uint32_t nGroupId, set<uint32_t>& setUser);
     void removeSession(uint32_t nGroupId, const set<uint32_t>& lsUser);
-    bool incGroupVersion(uint32_t nGroupId);
+    bool incGroupVersion(uint32_t nGroupId, uint32_t& nVersion);
     void clearGroupMember(uint32_t nGroupId);
     
     void fillGroupMember(list<IM::BaseDefine::GroupInfo>& lsGroups);
@@ -18,7 +18,7 @@ bool CInterLoginStrategy::doLogin(const std::string &strName, const std::string
     CDBManager* pDBManger = CDBManager::getInstance();
     CDBConn* pDBConn = pDBManger->GetDBConn("teamtalk_slave");
     if (pDBConn) {
-        string strSql = "select * from IMUser where name='" + strName + "' and status=0";
+        string strSql = "select id, password, salt, nick, sex, name, domain, phone, email, avatar, departId, status, sign_info from IMUser where name='" + strName + "' and status=0";
         CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
         if(pResultSet)
         {
@@ -26,20 +26,20 @@ bool CInterLoginStrategy::doLogin(const std::string &strName, const std::string
             uint32_t nId, nGender, nDeptId, nStatus;
             string strNick, strAvatar, strEmail, strRealName, strTel, strDomain,strSignInfo;
             while (pResultSet->Next()) {
-                nId = pResultSet->GetInt("id");
-                strResult = pResultSet->GetString("password");
-                strSalt = pResultSet->GetString("salt");
+                nId = pResultSet->GetUInt(0);
+                strResult = pResultSet->GetStdString(1);
+                strSalt = pResultSet->GetStdString(2);
                 
-                strNick = pResultSet->GetString("nick");
-                nGender = pResultSet->GetInt("sex");
-                strRealName = pResultSet->GetString("name");
-                strDomain = pResultSet->GetString("domain");
-                strTel = pResultSet->GetString("phone");
-                strEmail = pResultSet->GetString("email");
-                strAvatar = pResultSet->GetString("avatar");
-                nDeptId = pResultSet->GetInt("departId");
-                nStatus = pResultSet->GetInt("status");
-                strSignInfo = pResultSet->GetString("sign_info");
+                strNick = pResultSet->GetStdString(3);
+                nGender = pResultSet->GetUInt(4);
+                strRealName = pResultSet->GetStdString(5);
+                strDomain = pResultSet->GetStdString(6);
+                strTel = pResultSet->GetStdString(7);
+                strEmail = pResultSet->GetStdString(8);
+                strAvatar = pResultSet->GetStdString(9);
+                nDeptId = pResultSet->GetUInt(10);
+                nStatus = pResultSet->GetUInt(11);
+                strSignInfo = pResultSet->GetStdString(12);
 
             }
 
@@ -169,7 +169,7 @@ namespace DB_PROXY {
                             nPeerSessionId = CSessionModel::getInstance()->getSessionId(nToId, nFromId, IM::BaseDefine::SESSION_TYPE_SINGLE, false);
                             if(INVALID_VALUE ==  nPeerSessionId)
                             {
-                                nSessionId = CSessionModel::getInstance()->addSession(nToId, nFromId, IM::BaseDefine::SESSION_TYPE_SINGLE);
+                                nPeerSessionId = CSessionModel::getInstance()->addSession(nToId, nFromId, IM::BaseDefine::SESSION_TYPE_SINGLE);
                             }
                             uint32_t nRelateId = CRelationModel::getInstance()->getRelationId(nFromId, nToId, true);
                             if(nSessionId != INVALID_VALUE && nRelateId != INVALID_VALUE)
@@ -206,7 +206,7 @@ namespace DB_PROXY {
                             nPeerSessionId = CSessionModel::getInstance()->getSessionId(nToId, nFromId, IM::BaseDefine::SESSION_TYPE_SINGLE, false);
                             if(INVALID_VALUE ==  nPeerSessionId)
                             {
-                                nSessionId = CSessionModel::getInstance()->addSession(nToId, nFromId, IM::BaseDefine::SESSION_TYPE_SINGLE);
+                                nPeerSessionId = CSessionModel::getInstance()->addSession(nToId, nFromId, IM::BaseDefine::SESSION_TYPE_SINGLE);
                             }
                             uint32_t nRelateId = CRelationModel::getInstance()->getRelationId(nFromId, nToId, true);
                             if(nSessionId != INVALID_VALUE && nRelateId != INVALID_VALUE)
@@ -115,23 +115,30 @@ namespace DB_PROXY {
                 
                 string strOldValue = pCacheConn->get("device_"+int2string(nUserId));
                 
+                // 清掉旧token的反向映射和写入新映射放在一次流水线里
+                CachePipeline pipe(pCacheConn);
                 if(!strOldValue.empty())
                 {
                     size_t nPos = strOldValue.find(":");
                     if(nPos!=string::npos)
                     {
+                        // XX: 只在旧key存在时才覆盖, 省掉一次get
                         string strOldToken = strOldValue.substr(nPos + 1);
-                        string strReply = pCacheConn->get("device_"+strOldToken);
-                        if (!strReply.empty()) {
-                            string strNewValue("");
-                            pCacheConn->set("device_"+strOldToken, strNewValue);
-                        }
+                        vector<string> vecArgv;
+                        vecArgv.push_back("SET");
+                        vecArgv.push_back("device_"+strOldToken);
+                        vecArgv.push_back("");
+                        vecArgv.push_back("XX");
+                        pipe.append(vecArgv);
                     }
                 }
                 
-                pCacheConn->set("device_"+int2string(nUserId), strValue);
-                string strNewValue = int2string(nUserId);
-                pCacheConn->set("device_"+strToken, strNewValue);
+                pipe.set("device_"+int2string(nUserId), strValue);
+                pipe.set("device_"+strToken, int2string(nUserId));
+                if(!pipe.exec())
+                {
+                    log("set device token failed. userId=%u", nUserId);
+                }
             
                 log("setDeviceToken. userId=%u, deviceToken=%s", nUserId, strToken.c_str());
                 pCacheManager->RelCacheConn(pCacheConn);
@@ -11,9 +11,12 @@
 
 #include <map>
 #include <set>
+#include <vector>
 
 #include "../DBPool.h"
 #include "../CachePool.h"
+#include "../MsgBatcher.h"
+#include "../MsgIdAllocator.h"
 #include "MessageModel.h"
 #include "AudioModel.h"
 #include "SessionModel.h"
@@ -56,26 +59,37 @@ void CMessageModel::getMessage(uint32_t nUserId, uint32_t nPeerId, uint32_t nMsg
             string strTableName = "IMMessage_" + int2string(nRelateId % 8);
             string strSql;
             if (nMsgId == 0) {
-                strSql = "select * from " + strTableName + " force index (idx_relateId_status_created) where relateId= " + int2string(nRelateId) + " and status = 0 order by created desc, id desc limit " + int2string(nMsgCnt);
+                strSql = "select msgId, fromId, created, type, content from " + strTableName + " force index (idx_relateId_status_created) where relateId=? and status = 0 order by created desc, id desc limit ?";
             }
             else
             {
-                strSql = "select * from " + strTableName + " force index (idx_relateId_status_created) where relateId= " + int2string(nRelateId) + " and status = 0 and msgId <=" + int2string(nMsgId)+ " order by created desc, id desc limit " + int2string(nMsgCnt);
+                strSql = "select msgId, fromId, created, type, content from " + strTableName + " force index (idx_relateId_status_created) where relateId=? and status = 0 and msgId <=? order by created desc, id desc limit ?";
             }
-            CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
-            if (pResultSet)
+            CPrepareStatement* pStmt = pDBConn->GetStatement(strSql);
+            bool bRet = false;
+            if (pStmt)
             {
-                while (pResultSet->Next())
+                uint32_t index = 0;
+                pStmt->SetParam(index++, nRelateId);
+                if (nMsgId != 0) {
+                    pStmt->SetParam(index++, nMsgId);
+                }
+                pStmt->SetParam(index++, nMsgCnt);
+                bRet = pStmt->ExecuteQuery();
+            }
+            if (bRet)
+            {
+                while (pStmt->Next())
                 {
                     IM::BaseDefine::MsgInfo cMsg;
-                    cMsg.set_msg_id(pResultSet->GetInt("msgId"));
-                    cMsg.set_from_session_id(pResultSet->GetInt("fromId"));
-                    cMsg.set_create_time(pResultSet->GetInt("created"));
-                    IM::BaseDefine::MsgType nMsgType = IM::BaseDefine::MsgType(pResultSet->GetInt("type"));
+                    cMsg.set_msg_id(pStmt->GetUInt(0));
+                    cMsg.set_from_session_id(pStmt->GetUInt(1));
+                    cMsg.set_create_time(pStmt->GetUInt(2));
+                    IM::BaseDefine::MsgType nMsgType = IM::BaseDefine::MsgType(pStmt->GetInt(3));
                     if(IM::BaseDefine::MsgType_IsValid(nMsgType))
                     {
                         cMsg.set_msg_type(nMsgType);
-                        cMsg.set_msg_data(pResultSet->GetString("content"));
+                        cMsg.set_msg_data(pStmt->GetString(4), pStmt->GetStringLen(4));
                         lsMsg.push_back(cMsg);
                     }
                     else
@@ -83,7 +97,6 @@ void CMessageModel::getMessage(uint32_t nUserId, uint32_t nPeerId, uint32_t nMsg
                         log("invalid msgType. userId=%u, peerId=%u, msgId=%u, msgCnt=%u, msgType=%u", nUserId, nPeerId, nMsgId, nMsgCnt, nMsgType);
                     }
                 }
-                delete pResultSet;
             }
             else
             {
@@ -121,15 +134,46 @@ bool CMessageModel::sendMessage(uint32_t nRelateId, uint32_t nFromId, uint32_t n
         return bRet;
     }
 
+    // 开启组提交时和其他线程的消息合并成一个事务写入
+    CMsgBatcher* pBatcher = CMsgBatcher::getInstance();
+    if (pBatcher->isEnabled())
+    {
+        static const string strColumns = "(`relateId`, `fromId`, `toId`, `msgId`, `content`, `status`, `type`, `created`, `updated`)";
+        string strTableName = "IMMessage_" + int2string(nRelateId % 8);
+        vector<string> vecValues;
+        vecValues.push_back(int2string(nRelateId));
+        vecValues.push_back(int2string(nFromId));
+        vecValues.push_back(int2string(nToId));
+        vecValues.push_back(int2string(nMsgId));
+        vecValues.push_back(strMsgContent);
+        vecValues.push_back("0");
+        vecValues.push_back(int2string(nMsgType));
+        vecValues.push_back(int2string(nCreateTime));
+        vecValues.push_back(int2string(nCreateTime));
+        bRet = pBatcher->insert(strTableName, strColumns, vecValues);
+        if (bRet)
+        {
+            incMsgCount(nFromId, nToId);
+            updateLastMsg(nRelateId, nFromId, nMsgType, nMsgId, strMsgContent);
+        }
+        else
+        {
+            log("insert message failed. table=%s, msgId=%u", strTableName.c_str(), nMsgId);
+            // 失败时这条消息也可能已经提交了, 清掉记录, 下次查库
+            CLastMsgCache::getInstance()->remove("last_msg_" + int2string(nRelateId));
+        }
+        return bRet;
+    }
+
 	CDBManager* pDBManager = CDBManager::getInstance();
 	CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_master");
 	if (pDBConn)
     {
         string strTableName = "IMMessage_" + int2string(nRelateId % 8);
         string strSql = "insert into " + strTableName + " (`relateId`, `fromId`, `toId`, `msgId`, `content`, `status`, `type`, `created`, `updated`) values(?, ?, ?, ?, ?, ?, ?, ?, ?)";
-        // 必须在释放连接前delete CPrepareStatement对象，否则有可能多个线程操作mysql对象，会crash
-        CPrepareStatement* pStmt = new CPrepareStatement();
-        if (pStmt->Init(pDBConn->GetMysql(), strSql))
+        // 语句由连接缓存, 不能delete, 释放连接后也不能再使用，否则有可能多个线程操作mysql对象，会crash
+        CPrepareStatement* pStmt = pDBConn->GetStatement(strSql);
+        if (pStmt)
         {
             uint32_t nStatus = 0;
             uint32_t nType = nMsgType;
@@ -145,16 +189,17 @@ bool CMessageModel::sendMessage(uint32_t nRelateId, uint32_t nFromId, uint32_t n
             pStmt->SetParam(index++, nCreateTime);
             bRet = pStmt->ExecuteUpdate();
         }
-        delete pStmt;
         pDBManager->RelDBConn(pDBConn);
         if (bRet)
         {
             uint32_t nNow = (uint32_t) time(NULL);
             incMsgCount(nFromId, nToId);
+            updateLastMsg(nRelateId, nFromId, nMsgType, nMsgId, strMsgContent);
         }
         else
         {
             log("insert message failed: %s", strSql.c_str());
+            CLastMsgCache::getInstance()->remove("last_msg_" + int2string(nRelateId));
         }
 	}
     else
@@ -209,19 +254,29 @@ void CMessageModel::getUnreadMsgCount(uint32_t nUserId, uint32_t &nTotalCnt, lis
         pCacheManager->RelCacheConn(pCacheConn);
         if(bRet)
         {
+            list<uint32_t> lsPeerId;
+            for (auto it = mapUnread.begin(); it != mapUnread.end(); it++) {
+                lsPeerId.push_back(atoi(it->first.c_str()));
+            }
+            // 所有会话的最后一条消息一次取回
+            map<uint32_t, LastMsg_t> mapLastMsg;
+            getLastMsgs(nUserId, lsPeerId, mapLastMsg);
+
             IM::BaseDefine::UnreadInfo cUnreadInfo;
             for (auto it = mapUnread.begin(); it != mapUnread.end(); it++) {
                 cUnreadInfo.set_session_id(atoi(it->first.c_str()));
                 cUnreadInfo.set_unread_cnt(atoi(it->second.c_str()));
                 cUnreadInfo.set_session_type(IM::BaseDefine::SESSION_TYPE_SINGLE);
-                uint32_t nMsgId = 0;
-                string strMsgData;
-                IM::BaseDefine::MsgType nMsgType;
-                getLastMsg(cUnreadInfo.session_id(), nUserId, nMsgId, strMsgData, nMsgType);
+                auto itMsg = mapLastMsg.find(cUnreadInfo.session_id());
+                if (itMsg == mapLastMsg.end())
+                {
+                    continue;
+                }
+                IM::BaseDefine::MsgType nMsgType = IM::BaseDefine::MsgType(itMsg->second.msg_type);
                 if(IM::BaseDefine::MsgType_IsValid(nMsgType))
                 {
-                    cUnreadInfo.set_latest_msg_id(nMsgId);
-                    cUnreadInfo.set_latest_msg_data(strMsgData);
+                    cUnreadInfo.set_latest_msg_id(itMsg->second.msg_id);
+                    cUnreadInfo.set_latest_msg_data(itMsg->second.content);
                     cUnreadInfo.set_latest_msg_type(nMsgType);
                     cUnreadInfo.set_latest_msg_from_user_id(cUnreadInfo.session_id());
                     lsUnreadCount.push_back(cUnreadInfo);
@@ -246,16 +301,8 @@ void CMessageModel::getUnreadMsgCount(uint32_t nUserId, uint32_t &nTotalCnt, lis
 
 uint32_t CMessageModel::getMsgId(uint32_t nRelateId)
 {
-    uint32_t nMsgId = 0;
-    CacheManager* pCacheManager = CacheManager::getInstance();
-    CacheConn* pCacheConn = pCacheManager->GetCacheConn("unread");
-    if(pCacheConn)
-    {
-        string strKey = "msg_id_" + int2string(nRelateId);
-        nMsgId = pCacheConn->incrBy(strKey, 1);
-        pCacheManager->RelCacheConn(pCacheConn);
-    }
-    return nMsgId;
+    string strKey = "msg_id_" + int2string(nRelateId);
+    return CMsgIdAllocator::getInstance()->allocate(strKey);
 }
 
 /**
@@ -270,52 +317,139 @@ uint32_t CMessageModel::getMsgId(uint32_t nRelateId)
  */
 void CMessageModel::getLastMsg(uint32_t nFromId, uint32_t nToId, uint32_t& nMsgId, string& strMsgData, IM::BaseDefine::MsgType& nMsgType, uint32_t nStatus)
 {
-    uint32_t nRelateId = CRelationModel::getInstance()->getRelationId(nFromId, nToId, false);
-    
-    if (nRelateId != INVALID_VALUE)
+    list<uint32_t> lsPeerId(1, nFromId);
+    map<uint32_t, LastMsg_t> mapLastMsg;
+    getLastMsgs(nToId, lsPeerId, mapLastMsg);
+    auto it = mapLastMsg.find(nFromId);
+    if (it != mapLastMsg.end())
     {
+        nMsgId = it->second.msg_id;
+        nMsgType = IM::BaseDefine::MsgType(it->second.msg_type);
+        strMsgData = it->second.content;
+    }
+}
 
-        CDBManager* pDBManager = CDBManager::getInstance();
-        CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_slave");
-        if (pDBConn)
+/**
+ *  批量获取用户和多个人的单聊会话的最后一条消息
+ *  先用一次redis流水线取写消息时维护的记录, 没有记录的会话才查库, 查到的结果回填
+ *
+ *  @param nUserId    用户Id
+ *  @param lsPeerId   对方的用户Id列表
+ *  @param mapLastMsg <对方用户Id, 最后一条消息>, 会话里没有消息时msg_id为0, 查询失败的不返回
+ */
+void CMessageModel::getLastMsgs(uint32_t nUserId, const list<uint32_t>& lsPeerId, map<uint32_t, LastMsg_t>& mapLastMsg)
+{
+    // 关系Id一次取回, 没命中缓存的合并成一条sql
+    map<uint32_t, uint32_t> mapRelateId;
+    CRelationModel::getInstance()->getRelationIds(nUserId, lsPeerId, mapRelateId);
+
+    vector<uint32_t> vecPeerId;
+    vector<uint32_t> vecRelateId;
+    vector<string> vecKey;
+    for (auto it = lsPeerId.begin(); it != lsPeerId.end(); ++it)
+    {
+        auto itRelate = mapRelateId.find(*it);
+        if (itRelate == mapRelateId.end())
         {
-            string strTableName = "IMMessage_" + int2string(nRelateId % 8);
-            string strSql = "select msgId,type,content from " + strTableName + " force index (idx_relateId_status_created) where relateId= " + int2string(nRelateId) + " and status = 0 order by created desc, id desc limit 1";
-            CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
-            if (pResultSet)
+            log("no relation between %u and %u", nUserId, *it);
+            continue;
+        }
+        vecPeerId.push_back(*it);
+        vecRelateId.push_back(itRelate->second);
+        vecKey.push_back("last_msg_" + int2string(itRelate->second));
+    }
+
+    CLastMsgCache* pLastMsgCache = CLastMsgCache::getInstance();
+    vector<LastMsgLookup_t> vecResult;
+    pLastMsgCache->get(vecKey, vecResult);
+    for (size_t i = 0; i < vecKey.size(); i++)
+    {
+        if (vecResult[i].hit)
+        {
+            mapLastMsg[vecPeerId[i]] = vecResult[i].msg;
+            continue;
+        }
+
+        LastMsg_t cLastMsg;
+        if (queryLastMsg(vecRelateId[i], cLastMsg))
+        {
+            pLastMsgCache->fill(vecKey[i], cLastMsg, vecResult[i].ver);
+            mapLastMsg[vecPeerId[i]] = cLastMsg;
+        }
+    }
+}
+
+/**
+ *  从数据库查询单聊会话未被删除的最后一条消息
+ *
+ *  @param nRelateId 关系Id
+ *  @param cLastMsg  最后一条消息, 没有消息时msg_id为0
+ *
+ *  @return 查询成功返回true, sql出错返回false
+ */
+bool CMessageModel::queryLastMsg(uint32_t nRelateId, LastMsg_t& cLastMsg)
+{
+    cLastMsg.msg_id = 0;
+    cLastMsg.msg_type = 0;
+    cLastMsg.from_id = 0;
+    cLastMsg.content.clear();
+
+    bool bRet = false;
+    CDBManager* pDBManager = CDBManager::getInstance();
+    CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_slave");
+    if (pDBConn)
+    {
+        string strTableName = "IMMessage_" + int2string(nRelateId % 8);
+        string strSql = "select msgId,type,fromId,content from " + strTableName + " force index (idx_relateId_status_created) where relateId=? and status = 0 order by created desc, id desc limit 1";
+        CPrepareStatement* pStmt = pDBConn->GetStatement(strSql);
+        if (pStmt)
+        {
+            pStmt->SetParam(0, nRelateId);
+            bRet = pStmt->ExecuteQuery();
+        }
+        if (bRet)
+        {
+            while (pStmt->Next())
             {
-                while (pResultSet->Next())
+                cLastMsg.msg_id = pStmt->GetUInt(0);
+                cLastMsg.msg_type = pStmt->GetUInt(1);
+                cLastMsg.from_id = pStmt->GetUInt(2);
+                if (cLastMsg.msg_type == IM::BaseDefine::MSG_TYPE_SINGLE_AUDIO)
                 {
-                    nMsgId = pResultSet->GetInt("msgId");
-
-                    nMsgType = IM::BaseDefine::MsgType(pResultSet->GetInt("type"));
-                    if (nMsgType == IM::BaseDefine::MSG_TYPE_SINGLE_AUDIO)
-                    {
-                        // "[语音]"加密后的字符串
-                        strMsgData = strAudioEnc;
-                    }
-                    else
-                    {
-                        strMsgData = pResultSet->GetString("content");
-                    }
+                    // "[语音]"加密后的字符串
+                    cLastMsg.content = strAudioEnc;
+                }
+                else
+                {
+                    cLastMsg.content.assign(pStmt->GetString(3), pStmt->GetStringLen(3));
                 }
-                delete pResultSet;
-            }
-            else
-            {
-                log("no result set: %s", strSql.c_str());
             }
-            pDBManager->RelDBConn(pDBConn);
         }
         else
         {
-            log("no db connection_slave");
+            log("no result set: %s", strSql.c_str());
         }
+        pDBManager->RelDBConn(pDBConn);
     }
     else
     {
-        log("no relation between %lu and %lu", nFromId, nToId);
+        log("no db connection_slave");
     }
+    return bRet;
+}
+
+/**
+ *  写消息成功后更新会话的最后一条消息记录
+ */
+void CMessageModel::updateLastMsg(uint32_t nRelateId, uint32_t nFromId, IM::BaseDefine::MsgType nMsgType, uint32_t nMsgId, const string& strMsgContent)
+{
+    LastMsg_t cLastMsg;
+    cLastMsg.msg_id = nMsgId;
+    cLastMsg.msg_type = nMsgType;
+    cLastMsg.from_id = nFromId;
+    // 语音消息的content是语音Id, 和查库时一样换成"[语音]"
+    cLastMsg.content = (nMsgType == IM::BaseDefine::MSG_TYPE_SINGLE_AUDIO) ? strAudioEnc : strMsgContent;
+    CLastMsgCache::getInstance()->update("last_msg_" + int2string(nRelateId), cLastMsg);
 }
 
 void CMessageModel::getUnReadCntAll(uint32_t nUserId, uint32_t &nTotalCnt)
@@ -380,21 +514,21 @@ void CMessageModel::getMsgByMsgId(uint32_t nUserId, uint32_t nPeerId, const list
             }
         }
 
-        string strSql = "select * from " + strTableName + " where relateId=" + int2string(nRelateId) + "  and status=0 and msgId in (" + strClause + ") order by created desc, id desc limit 100";
+        string strSql = "select msgId, fromId, created, type, content from " + strTableName + " where relateId=" + int2string(nRelateId) + "  and status=0 and msgId in (" + strClause + ") order by created desc, id desc limit 100";
         CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
         if (pResultSet)
         {
             while (pResultSet->Next())
             {
                 IM::BaseDefine::MsgInfo msg;
-                msg.set_msg_id(pResultSet->GetInt("msgId"));
-                msg.set_from_session_id(pResultSet->GetInt("fromId"));
-                msg.set_create_time(pResultSet->GetInt("created"));
-                IM::BaseDefine::MsgType nMsgType = IM::BaseDefine::MsgType(pResultSet->GetInt("type"));
+                msg.set_msg_id(pResultSet->GetUInt(0));
+                msg.set_from_session_id(pResultSet->GetUInt(1));
+                msg.set_create_time(pResultSet->GetUInt(2));
+                IM::BaseDefine::MsgType nMsgType = IM::BaseDefine::MsgType(pResultSet->GetInt(3));
                 if(IM::BaseDefine::MsgType_IsValid(nMsgType))
                 {
                     msg.set_msg_type(nMsgType);
-                    msg.set_msg_data(pResultSet->GetString("content"));
+                    msg.set_msg_data(pResultSet->GetString(4), pResultSet->GetStringLen(4));
                     lsMsg.push_back(msg);
                 }
                 else
@@ -436,6 +570,9 @@ bool CMessageModel::resetMsgId(uint32_t nRelateId)
             bRet = true;
         }
         pCacheManager->RelCacheConn(pCacheConn);
+        CMsgIdAllocator::getInstance()->reset(strKey);
+        // msgId从头开始, 旧记录的msgId更大, 不清掉的话新消息写不进去
+        CLastMsgCache::getInstance()->remove("last_msg_" + int2string(nRelateId));
     }
     return bRet;
 }
@@ -13,11 +13,13 @@
 #define MESSAGE_MODEL_H_
 
 #include <list>
+#include <map>
 #include <string>
 
 #include "util.h"
 #include "ImPduBase.h"
 #include "AudioModel.h"
+#include "../LastMsgCache.h"
 #include "IM.BaseDefine.pb.h"
 using namespace std;
 
@@ -36,12 +38,15 @@ public:
     uint32_t getMsgId(uint32_t nRelateId);
     void getUnreadMsgCount(uint32_t nUserId, uint32_t &nTotalCnt, list<IM::BaseDefine::UnreadInfo>& lsUnreadCount);
     void getLastMsg(uint32_t nFromId, uint32_t nToId, uint32_t& nMsgId, string& strMsgData, IM::BaseDefine::MsgType & nMsgType, uint32_t nStatus = 0);
+    void getLastMsgs(uint32_t nUserId, const list<uint32_t>& lsPeerId, map<uint32_t, LastMsg_t>& mapLastMsg);
     void getUnReadCntAll(uint32_t nUserId, uint32_t &nTotalCnt);
     void getMsgByMsgId(uint32_t nUserId, uint32_t nPeerId, const list<uint32_t>& lsMsgId, list<IM::BaseDefine::MsgInfo>& lsMsg);
     bool resetMsgId(uint32_t nRelateId);
 private:
 	CMessageModel();
     void incMsgCount(uint32_t nFromId, uint32_t nToId);
+    void updateLastMsg(uint32_t nRelateId, uint32_t nFromId, IM::BaseDefine::MsgType nMsgType, uint32_t nMsgId, const string& strMsgContent);
+    bool queryLastMsg(uint32_t nRelateId, LastMsg_t& cLastMsg);
 private:
 	static CMessageModel*	m_pInstance;
 };
@@ -19,7 +19,7 @@ using namespace std;
 
 CRelationModel* CRelationModel::m_pInstance = NULL;
 
-CRelationModel::CRelationModel()
+CRelationModel::CRelationModel() : m_relationCache("relation")
 {
 
 }
@@ -54,12 +54,19 @@ uint32_t CRelationModel::getRelationId(uint32_t nUserAId, uint32_t nUserBId, boo
         log("invalied user id:%u->%u", nUserAId, nUserBId);
         return nRelationId;
     }
+    uint32_t nBigId = nUserAId > nUserBId ? nUserAId : nUserBId;
+    uint32_t nSmallId = nUserAId > nUserBId ? nUserBId : nUserAId;
+    uint64_t nKey = ((uint64_t)nSmallId << 32) | nBigId;
+    uint32_t nSeq = 0;
+    if (m_relationCache.get(nKey, nRelationId, &nSeq) && (nRelationId != INVALID_VALUE || !bAdd))
+    {
+        return nRelationId;
+    }
+
     CDBManager* pDBManager = CDBManager::getInstance();
     CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_slave");
     if (pDBConn)
     {
-        uint32_t nBigId = nUserAId > nUserBId ? nUserAId : nUserBId;
-        uint32_t nSmallId = nUserAId > nUserBId ? nUserBId : nUserAId;
         string strSql = "select id from IMRelationShip where smallId=" + int2string(nSmallId) + " and bigId="+ int2string(nBigId) + " and status = 0";
         
         CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
@@ -67,9 +74,11 @@ uint32_t CRelationModel::getRelationId(uint32_t nUserAId, uint32_t nUserBId, boo
         {
             while (pResultSet->Next())
             {
-                nRelationId = pResultSet->GetInt("id");
+                nRelationId = pResultSet->GetUInt(0);
             }
             delete pResultSet;
+            // 查询出错时不缓存
+            m_relationCache.set(nKey, nRelationId, nSeq);
         }
         else
         {
@@ -79,6 +88,10 @@ uint32_t CRelationModel::getRelationId(uint32_t nUserAId, uint32_t nUserBId, boo
         if (nRelationId == INVALID_VALUE && bAdd)
         {
             nRelationId = addRelation(nSmallId, nBigId);
+            if (nRelationId != INVALID_VALUE)
+            {
+                m_relationCache.set(nKey, nRelationId);
+            }
         }
     }
     else
@@ -88,6 +101,112 @@ uint32_t CRelationModel::getRelationId(uint32_t nUserAId, uint32_t nUserBId, boo
     return nRelationId;
 }
 
+/**
+ *  批量获取一个用户和多个人的会话关系ID, 不创建关系
+ *  先查缓存, 没命中的用一条sql查出来, 查不到的也写入负缓存
+ *
+ *  @param nUserId       用户Id
+ *  @param lsPeerId      对方的用户Id列表
+ *  @param mapRelationId <对方用户Id, 关系Id>, 没有关系或者查询失败的不返回
+ */
+void CRelationModel::getRelationIds(uint32_t nUserId, const list<uint32_t>& lsPeerId, map<uint32_t, uint32_t>& mapRelationId)
+{
+    if (nUserId == 0) {
+        log("invalied user id:%u", nUserId);
+        return;
+    }
+
+    // 没命中的对方Id -> 读缓存时的删除序号
+    map<uint32_t, uint32_t> mapMiss;
+    for (auto it = lsPeerId.begin(); it != lsPeerId.end(); ++it)
+    {
+        uint32_t nPeerId = *it;
+        if (nPeerId == 0 || mapMiss.find(nPeerId) != mapMiss.end()) {
+            continue;
+        }
+        uint32_t nBigId = nUserId > nPeerId ? nUserId : nPeerId;
+        uint32_t nSmallId = nUserId > nPeerId ? nPeerId : nUserId;
+        uint64_t nKey = ((uint64_t)nSmallId << 32) | nBigId;
+        uint32_t nRelationId = INVALID_VALUE;
+        uint32_t nSeq = 0;
+        if (m_relationCache.get(nKey, nRelationId, &nSeq))
+        {
+            if (nRelationId != INVALID_VALUE) {
+                mapRelationId[nPeerId] = nRelationId;
+            }
+            continue;
+        }
+        mapMiss[nPeerId] = nSeq;
+    }
+
+    if (mapMiss.empty()) {
+        return;
+    }
+
+    string strSmallIds, strBigIds;
+    for (auto it = mapMiss.begin(); it != mapMiss.end(); ++it)
+    {
+        string& strIds = it->first > nUserId ? strBigIds : strSmallIds;
+        if (!strIds.empty()) {
+            strIds += ",";
+        }
+        strIds += int2string(it->first);
+    }
+
+    CDBManager* pDBManager = CDBManager::getInstance();
+    CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_slave");
+    if (pDBConn)
+    {
+        string strClause;
+        if (!strBigIds.empty()) {
+            strClause = "(smallId=" + int2string(nUserId) + " and bigId in (" + strBigIds + "))";
+        }
+        if (!strSmallIds.empty()) {
+            if (!strClause.empty()) {
+                strClause += " or ";
+            }
+            strClause += "(bigId=" + int2string(nUserId) + " and smallId in (" + strSmallIds + "))";
+        }
+        string strSql = "select id, smallId, bigId from IMRelationShip where (" + strClause + ") and status = 0";
+
+        CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
+        if (pResultSet)
+        {
+            map<uint32_t, uint32_t> mapFound;
+            while (pResultSet->Next())
+            {
+                uint32_t nSmallId = pResultSet->GetUInt(1);
+                uint32_t nBigId = pResultSet->GetUInt(2);
+                mapFound[nSmallId == nUserId ? nBigId : nSmallId] = pResultSet->GetUInt(0);
+            }
+            delete pResultSet;
+            // 查询出错时不缓存
+            for (auto it = mapMiss.begin(); it != mapMiss.end(); ++it)
+            {
+                uint32_t nPeerId = it->first;
+                uint32_t nBigId = nUserId > nPeerId ? nUserId : nPeerId;
+                uint32_t nSmallId = nUserId > nPeerId ? nPeerId : nUserId;
+                uint64_t nKey = ((uint64_t)nSmallId << 32) | nBigId;
+                auto itFound = mapFound.find(nPeerId);
+                uint32_t nRelationId = itFound != mapFound.end() ? itFound->second : INVALID_VALUE;
+                m_relationCache.set(nKey, nRelationId, it->second);
+                if (nRelationId != INVALID_VALUE) {
+                    mapRelationId[nPeerId] = nRelationId;
+                }
+            }
+        }
+        else
+        {
+            log("there is no result for sql:%s", strSql.c_str());
+        }
+        pDBManager->RelDBConn(pDBConn);
+    }
+    else
+    {
+        log("no db connection for teamtalk_slave");
+    }
+}
+
 uint32_t CRelationModel::addRelation(uint32_t nSmallId, uint32_t nBigId)
 {
     uint32_t nRelationId = INVALID_VALUE;
@@ -100,7 +219,7 @@ uint32_t CRelationModel::addRelation(uint32_t nSmallId, uint32_t nBigId)
         CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
         if(pResultSet && pResultSet->Next())
         {
-            nRelationId = pResultSet->GetInt("id");
+            nRelationId = pResultSet->GetUInt(0);
             strSql = "update IMRelationShip set status=0, updated=" + int2string(nTimeNow) + " where id=" + int2string(nRelationId);
             bool bRet = pDBConn->ExecuteUpdate(strSql.c_str());
             if(!bRet)
@@ -113,9 +232,9 @@ uint32_t CRelationModel::addRelation(uint32_t nSmallId, uint32_t nBigId)
         else
         {
             strSql = "insert into IMRelationShip (`smallId`,`bigId`,`status`,`created`,`updated`) values(?,?,?,?,?)";
-            // 必须在释放连接前delete CPrepareStatement对象，否则有可能多个线程操作mysql对象，会crash
-            CPrepareStatement* stmt = new CPrepareStatement();
-            if (stmt->Init(pDBConn->GetMysql(), strSql))
+            // 语句由连接缓存, 不能delete, 释放连接后也不能再使用，否则有可能多个线程操作mysql对象，会crash
+            CPrepareStatement* stmt = pDBConn->GetStatement(strSql);
+            if (stmt)
             {
                 uint32_t nStatus = 0;
                 uint32_t index = 0;
@@ -142,7 +261,6 @@ uint32_t CRelationModel::addRelation(uint32_t nSmallId, uint32_t nBigId)
                     log("reset msgId failed. smallId=%u, bigId=%u.", nSmallId, nBigId);
                 }
             }
-            delete stmt;
         }
         pDBManager->RelDBConn(pDBConn);
     }
@@ -182,6 +300,7 @@ bool CRelationModel::removeRelation(uint32_t nRelationId)
         string strSql = "update IMRelationShip set status = 1, updated="+int2string(nNow)+" where id=" + int2string(nRelationId);
         bRet = pDBConn->ExecuteUpdate(strSql.c_str());
         pDBManager->RelDBConn(pDBConn);
+        m_relationCache.removeValue(nRelationId);
     }
     else
     {
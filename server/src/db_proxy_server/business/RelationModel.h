@@ -13,9 +13,11 @@
 #define RELATION_SHIP_H_
 
 #include <list>
+#include <map>
 
 #include "util.h"
 #include "ImPduBase.h"
+#include "../IdCache.h"
 #include "IM.BaseDefine.pb.h"
 
 using namespace std;
@@ -27,13 +29,18 @@ public:
 
 	static CRelationModel* getInstance();
     uint32_t getRelationId(uint32_t nUserAId, uint32_t nUserBId, bool bAdd);
+    void getRelationIds(uint32_t nUserId, const list<uint32_t>& lsPeerId, map<uint32_t, uint32_t>& mapRelationId);
     bool updateRelation(uint32_t nRelationId, uint32_t nUpdateTime);
     bool removeRelation(uint32_t nRelationId);
+
+    void init() { m_relationCache.init(); }
+    CIdCache* getCache() { return &m_relationCache; }
     
 private:
 	CRelationModel();
     uint32_t addRelation(uint32_t nSmallId, uint32_t nBigId);
 private:
 	static CRelationModel*	m_pInstance;
+    CIdCache                m_relationCache;    // (smallId << 32 | bigId) -> relateId
 };
 #endif
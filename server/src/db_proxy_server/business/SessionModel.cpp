@@ -10,12 +10,27 @@
 ================================================================*/
 #include "SessionModel.h"
 #include "DBPool.h"
+#include "ConfigFileReader.h"
 #include "MessageModel.h"
 #include "GroupMessageModel.h"
 
+#define DEFAULT_SESSION_UPDATE_INTERVAL 1000
+#define SESSION_UPDATE_BATCH_CNT        500     // 一条update语句最多更新的会话数
 
 CSessionModel* CSessionModel::m_pInstance = NULL;
 
+CSessionModel::CSessionModel() : m_singleCache("single_session"), m_groupCache("group_session"),
+    m_updateCond(&m_updateLock)
+{
+    m_nUpdateInterval = 0;
+    m_bRunning = false;
+}
+
+CSessionModel::~CSessionModel()
+{
+    stop();
+}
+
 CSessionModel* CSessionModel::getInstance()
 {
     if (!m_pInstance) {
@@ -25,13 +40,67 @@ CSessionModel* CSessionModel::getInstance()
     return m_pInstance;
 }
 
+void CSessionModel::init()
+{
+    m_singleCache.init();
+    m_groupCache.init();
+
+    CConfigFileReader config_file("dbproxyserver.conf");
+    char* str_interval = config_file.GetConfigName("SessionUpdateInterval");
+    m_nUpdateInterval = str_interval ? atoi(str_interval) : DEFAULT_SESSION_UPDATE_INTERVAL;
+    if (m_nUpdateInterval == 0) {
+        log("session update merge disabled");
+        return;
+    }
+
+    m_bRunning = true;
+    if (pthread_create(&m_nThreadId, NULL, doFlushUpdate, this) != 0) {
+        log("create session update thread failed");
+        m_bRunning = false;
+        m_nUpdateInterval = 0;
+        return;
+    }
+    log("session update merge enabled, interval=%ums", m_nUpdateInterval);
+}
+
+void CSessionModel::stop()
+{
+    m_updateLock.lock();
+    if (!m_bRunning) {
+        m_updateLock.unlock();
+        return;
+    }
+    m_bRunning = false;
+    m_updateCond.notify();
+    m_updateLock.unlock();
+
+    // 合并线程退出前会把攒下来的时间写掉
+    pthread_join(m_nThreadId, NULL);
+
+    m_updateLock.lock();
+    if (!m_mapUpdate.empty()) {
+        log("%lu session updates not written", m_mapUpdate.size());
+    }
+    m_updateLock.unlock();
+}
+
+CIdCache* CSessionModel::getCache(uint32_t nType)
+{
+    if (nType == IM::BaseDefine::SESSION_TYPE_SINGLE) {
+        return &m_singleCache;
+    } else if (nType == IM::BaseDefine::SESSION_TYPE_GROUP) {
+        return &m_groupCache;
+    }
+    return NULL;
+}
+
 void CSessionModel::getRecentSession(uint32_t nUserId, uint32_t lastTime, list<IM::BaseDefine::ContactSessionInfo>& lsContact)
 {
     CDBManager* pDBManager = CDBManager::getInstance();
     CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_slave");
     if (pDBConn)
     {
-        string strSql = "select * from IMRecentSession where userId = " + int2string(nUserId) + " and status = 0 and updated >" + int2string(lastTime) + " order by updated desc limit 100";
+        string strSql = "select peerId, status, type, updated from IMRecentSession where userId = " + int2string(nUserId) + " and status = 0 and updated >" + int2string(lastTime) + " order by updated desc limit 100";
         
         CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
         if (pResultSet)
@@ -39,15 +108,15 @@ void CSessionModel::getRecentSession(uint32_t nUserId, uint32_t lastTime, list<I
             while (pResultSet->Next())
             {
                 IM::BaseDefine::ContactSessionInfo cRelate;
-                uint32_t nPeerId = pResultSet->GetInt("peerId");
+                uint32_t nPeerId = pResultSet->GetUInt(0);
                 cRelate.set_session_id(nPeerId);
-                cRelate.set_session_status(::IM::BaseDefine::SessionStatusType(pResultSet->GetInt("status")));
+                cRelate.set_session_status(::IM::BaseDefine::SessionStatusType(pResultSet->GetInt(1)));
                 
-                IM::BaseDefine::SessionType nSessionType = IM::BaseDefine::SessionType(pResultSet->GetInt("type"));
+                IM::BaseDefine::SessionType nSessionType = IM::BaseDefine::SessionType(pResultSet->GetInt(2));
                 if(IM::BaseDefine::SessionType_IsValid(nSessionType))
                 {
                     cRelate.set_session_type(IM::BaseDefine::SessionType(nSessionType));
-                    cRelate.set_updated_time(pResultSet->GetInt("updated"));
+                    cRelate.set_updated_time(pResultSet->GetUInt(3));
                     lsContact.push_back(cRelate);
                 }
                 else
@@ -75,27 +144,44 @@ void CSessionModel::getRecentSession(uint32_t nUserId, uint32_t lastTime, list<I
 
 uint32_t CSessionModel::getSessionId(uint32_t nUserId, uint32_t nPeerId, uint32_t nType, bool isAll)
 {
+    uint32_t nSessionId = INVALID_VALUE;
+    // 缓存里只有未删除的会话
+    CIdCache* pCache = isAll ? NULL : getCache(nType);
+    uint64_t nKey = ((uint64_t)nUserId << 32) | nPeerId;
+    uint32_t nSeq = 0;
+    if (pCache && pCache->get(nKey, nSessionId, &nSeq)) {
+        return nSessionId;
+    }
+
     CDBManager* pDBManager = CDBManager::getInstance();
     CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_slave");
-    uint32_t nSessionId = INVALID_VALUE;
     if(pDBConn)
     {
         string strSql;
         if (isAll) {
-            strSql= "select id from IMRecentSession where userId=" + int2string(nUserId) + " and peerId=" + int2string(nPeerId) + " and type=" + int2string(nType);
+            strSql= "select id from IMRecentSession where userId=? and peerId=? and type=?";
         }
         else
         {
-            strSql= "select id from IMRecentSession where userId=" + int2string(nUserId) + " and peerId=" + int2string(nPeerId) + " and type=" + int2string(nType) + " and status=0";
+            strSql= "select id from IMRecentSession where userId=? and peerId=? and type=? and status=0";
         }
         
-        CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
-        if(pResultSet)
+        CPrepareStatement* pStmt = pDBConn->GetStatement(strSql);
+        if(pStmt)
         {
-            while (pResultSet->Next()) {
-                nSessionId = pResultSet->GetInt("id");
+            uint32_t index = 0;
+            pStmt->SetParam(index++, nUserId);
+            pStmt->SetParam(index++, nPeerId);
+            pStmt->SetParam(index++, nType);
+            if (pStmt->ExecuteQuery())
+            {
+                while (pStmt->Next()) {
+                    nSessionId = pStmt->GetUInt(0);
+                }
+                if (pCache) {
+                    pCache->set(nKey, nSessionId, nSeq);
+                }
             }
-            delete pResultSet;
         }
         pDBManager->RelDBConn(pDBConn);
     }
@@ -108,6 +194,18 @@ uint32_t CSessionModel::getSessionId(uint32_t nUserId, uint32_t nPeerId, uint32_
 
 bool CSessionModel::updateSession(uint32_t nSessionId, uint32_t nUpdateTime)
 {
+    if (m_nUpdateInterval != 0) {
+        CAutoLock autoLock(&m_updateLock);
+        // stop之后直接写库
+        if (m_bRunning) {
+            uint32_t& nTime = m_mapUpdate[nSessionId];
+            if (nTime < nUpdateTime) {
+                nTime = nUpdateTime;
+            }
+            return true;
+        }
+    }
+
     bool bRet = false;
     CDBManager* pDBManager = CDBManager::getInstance();
     CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_master");
@@ -135,6 +233,11 @@ bool CSessionModel::removeSession(uint32_t nSessionId)
         string strSql = "update IMRecentSession set status = 1, updated="+int2string(nNow)+" where id=" + int2string(nSessionId);
         bRet = pDBConn->ExecuteUpdate(strSql.c_str());
         pDBManager->RelDBConn(pDBConn);
+
+        m_singleCache.removeValue(nSessionId);
+        m_groupCache.removeValue(nSessionId);
+        CAutoLock autoLock(&m_updateLock);
+        m_mapUpdate.erase(nSessionId);
     }
     else
     {
@@ -166,9 +269,9 @@ uint32_t CSessionModel::addSession(uint32_t nUserId, uint32_t nPeerId, uint32_t
         else
         {
             string strSql = "insert into IMRecentSession (`userId`,`peerId`,`type`,`status`,`created`,`updated`) values(?,?,?,?,?,?)";
-            // 必须在释放连接前delete CPrepareStatement对象，否则有可能多个线程操作mysql对象，会crash
-            CPrepareStatement* stmt = new CPrepareStatement();
-            if (stmt->Init(pDBConn->GetMysql(), strSql))
+            // 语句由连接缓存, 不能delete, 释放连接后也不能再使用，否则有可能多个线程操作mysql对象，会crash
+            CPrepareStatement* stmt = pDBConn->GetStatement(strSql);
+            if (stmt)
             {
                 uint32_t nStatus = 0;
                 uint32_t index = 0;
@@ -188,9 +291,13 @@ uint32_t CSessionModel::addSession(uint32_t nUserId, uint32_t nPeerId, uint32_t
                     log("insert message failed. %s", strSql.c_str());
                 }
             }
-            delete stmt;
         }
         pDBManager->RelDBConn(pDBConn);
+
+        CIdCache* pCache = getCache(nType);
+        if (pCache && nSessionId != INVALID_VALUE) {
+            pCache->set(((uint64_t)nUserId << 32) | nPeerId, nSessionId);
+        }
     }
     else
     {
@@ -199,25 +306,142 @@ uint32_t CSessionModel::addSession(uint32_t nUserId, uint32_t nPeerId, uint32_t
     return nSessionId;
 }
 
+void* CSessionModel::doFlushUpdate(void* arg)
+{
+    CSessionModel* pModel = (CSessionModel*)arg;
+    for (;;) {
+        pModel->m_updateLock.lock();
+        if (pModel->m_bRunning) {
+            pModel->m_updateCond.waitTime(pModel->m_nUpdateInterval);
+        }
+        bool bRunning = pModel->m_bRunning;
+        pModel->m_updateLock.unlock();
+
+        pModel->flushUpdate();
+        if (!bRunning)
+            break;
+    }
+    return NULL;
+}
+
+/*
+ * 把攒下来的会话时间写入数据库, 同一时间戳的会话合并成一条update,
+ * 发消息的会话时间基本都落在同一秒里
+ */
+void CSessionModel::flushUpdate()
+{
+    map<uint32_t, uint32_t> mapUpdate;
+    m_updateLock.lock();
+    mapUpdate.swap(m_mapUpdate);
+    m_updateLock.unlock();
+    if (mapUpdate.empty()) {
+        return;
+    }
+
+    map<uint32_t, list<uint32_t> > mapTime;
+    for (map<uint32_t, uint32_t>::iterator it = mapUpdate.begin(); it != mapUpdate.end(); it++) {
+        mapTime[it->second].push_back(it->first);
+    }
+
+    CDBManager* pDBManager = CDBManager::getInstance();
+    CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_master");
+    if (!pDBConn) {
+        log("no db connection for teamtalk_master, retry %lu session updates later", mapUpdate.size());
+        for (map<uint32_t, list<uint32_t> >::iterator it = mapTime.begin(); it != mapTime.end(); it++) {
+            mergeUpdate(it->second, it->first);
+        }
+        return;
+    }
+
+    for (map<uint32_t, list<uint32_t> >::iterator it = mapTime.begin(); it != mapTime.end(); it++) {
+        list<uint32_t>& lsId = it->second;
+        list<uint32_t>::iterator itId = lsId.begin();
+        while (itId != lsId.end()) {
+            list<uint32_t> lsBatch;
+            string strClause;
+            for (uint32_t i = 0; i < SESSION_UPDATE_BATCH_CNT && itId != lsId.end(); i++, itId++) {
+                if (i > 0) {
+                    strClause += ",";
+                }
+                strClause += int2string(*itId);
+                lsBatch.push_back(*itId);
+            }
+            string strSql = "update IMRecentSession set `updated`=" + int2string(it->first) + " where id in (" + strClause + ")";
+            // 时间没变的行affected_rows为0也返回false, 用mysql_errno区分真正的出错
+            if (!pDBConn->ExecuteUpdate(strSql.c_str()) && mysql_errno(pDBConn->GetMysql()) != 0) {
+                mergeUpdate(lsBatch, it->first);
+            }
+        }
+    }
+    pDBManager->RelDBConn(pDBConn);
+}
+
+// 没写进去的时间放回待写入的表, 期间有更新的时间的会话保留更新的
+void CSessionModel::mergeUpdate(const list<uint32_t>& lsId, uint32_t nUpdateTime)
+{
+    CAutoLock autoLock(&m_updateLock);
+    for (list<uint32_t>::const_iterator it = lsId.begin(); it != lsId.end(); it++) {
+        uint32_t& nTime = m_mapUpdate[*it];
+        if (nTime < nUpdateTime) {
+            nTime = nUpdateTime;
+        }
+    }
+}
+
 
 
 void CSessionModel::fillSessionMsg(uint32_t nUserId, list<IM::BaseDefine::ContactSessionInfo>& lsContact)
 {
+    // 单聊和群聊的最后一条消息各用一次批量查询取回, 不再每个会话查一次库
+    list<uint32_t> lsPeerId;
+    list<uint32_t> lsGroupId;
+    for (auto it=lsContact.begin(); it!=lsContact.end(); ++it)
+    {
+        if( it->session_type() == IM::BaseDefine::SESSION_TYPE_SINGLE)
+        {
+            lsPeerId.push_back(it->session_id());
+        }
+        else
+        {
+            lsGroupId.push_back(it->session_id());
+        }
+    }
+    map<uint32_t, LastMsg_t> mapSingleMsg;
+    map<uint32_t, LastMsg_t> mapGroupMsg;
+    if (!lsPeerId.empty())
+    {
+        CMessageModel::getInstance()->getLastMsgs(nUserId, lsPeerId, mapSingleMsg);
+    }
+    if (!lsGroupId.empty())
+    {
+        CGroupMessageModel::getInstance()->getLastMsgs(lsGroupId, mapGroupMsg);
+    }
+
     for (auto it=lsContact.begin(); it!=lsContact.end();)
     {
-        uint32_t nMsgId = 0;
-        string strMsgData;
-        IM::BaseDefine::MsgType nMsgType;
+        map<uint32_t, LastMsg_t>::iterator itMsg;
         uint32_t nFromId = 0;
         if( it->session_type() == IM::BaseDefine::SESSION_TYPE_SINGLE)
         {
+            itMsg = mapSingleMsg.find(it->session_id());
+            if (itMsg == mapSingleMsg.end())
+            {
+                it = lsContact.erase(it);
+                continue;
+            }
             nFromId = it->session_id();
-            CMessageModel::getInstance()->getLastMsg(it->session_id(), nUserId, nMsgId, strMsgData, nMsgType);
         }
         else
         {
-            CGroupMessageModel::getInstance()->getLastMsg(it->session_id(), nMsgId, strMsgData, nMsgType, nFromId);
+            itMsg = mapGroupMsg.find(it->session_id());
+            if (itMsg == mapGroupMsg.end())
+            {
+                it = lsContact.erase(it);
+                continue;
+            }
+            nFromId = itMsg->second.from_id;
         }
+        IM::BaseDefine::MsgType nMsgType = IM::BaseDefine::MsgType(itMsg->second.msg_type);
         if(!IM::BaseDefine::MsgType_IsValid(nMsgType))
         {
             it = lsContact.erase(it);
@@ -225,8 +449,8 @@ void CSessionModel::fillSessionMsg(uint32_t nUserId, list<IM::BaseDefine::Contac
         else
         {
             it->set_latest_msg_from_user_id(nFromId);
-            it->set_latest_msg_id(nMsgId);
-            it->set_latest_msg_data(strMsgData);
+            it->set_latest_msg_id(itMsg->second.msg_id);
+            it->set_latest_msg_data(itMsg->second.content);
             it->set_latest_msg_type(nMsgType);
             ++it;
         }
@@ -12,14 +12,29 @@
 #ifndef __SESSIONMODEL_H__
 #define __SESSIONMODEL_H__
 
+#include <map>
 #include "ImPduBase.h"
 #include "IM.BaseDefine.pb.h"
+#include "Lock.h"
+#include "Condition.h"
+#include "../IdCache.h"
 
+/*
+ * 会话id有进程内缓存(见IdCache.h), 发消息时不用每次查IMRecentSession;
+ * 发消息时更新会话时间改为先记在内存里, 由后台线程每SessionUpdateInterval毫秒
+ * 合并成几条update写入, 配置为0时每次直接写库;
+ * 写库失败(连不上或者update出错)的时间放回去下次再写, 退出前调用stop把剩下的写完
+ */
 class CSessionModel
 {
 public:
     static CSessionModel* getInstance();
-    ~CSessionModel() {}
+    ~CSessionModel();
+
+    void init();
+    // 停掉合并线程并写入还没写的会话时间, 之后的更新直接写库
+    void stop();
+    CIdCache* getCache(uint32_t nType);
 
     void getRecentSession(uint32_t userId, uint32_t lastTime, list<IM::BaseDefine::ContactSessionInfo>& lsContact);
     uint32_t getSessionId(uint32_t nUserId, uint32_t nPeerId, uint32_t nType, bool isAll);
@@ -28,10 +43,23 @@ public:
     uint32_t addSession(uint32_t nUserId, uint32_t nPeerId, uint32_t nType);
     
 private:
-    CSessionModel() {};
+    CSessionModel();
     void fillSessionMsg(uint32_t nUserId, list<IM::BaseDefine::ContactSessionInfo>& lsContact);
+    static void* doFlushUpdate(void* arg);
+    void flushUpdate();
+    void mergeUpdate(const list<uint32_t>& lsId, uint32_t nUpdateTime);
 private:
     static CSessionModel* m_pInstance;
+
+    CIdCache            m_singleCache;      // (userId << 32 | peerId) -> sessionId
+    CIdCache            m_groupCache;       // (userId << 32 | groupId) -> sessionId
+
+    uint32_t            m_nUpdateInterval;  // 毫秒, 0表示不合并
+    volatile bool       m_bRunning;         // 合并线程在运行, m_updateLock保护
+    pthread_t           m_nThreadId;
+    CLock               m_updateLock;
+    CCondition          m_updateCond;       // 通知合并线程退出
+    map<uint32_t, uint32_t> m_mapUpdate;    // sessionId -> 待写入的updated
 };
 
 #endif /*defined(__SESSIONMODEL_H__) */
@@ -28,46 +28,36 @@ namespace DB_PROXY {
     void getUserInfo(CImPdu* pPdu, uint32_t conn_uuid)
     {
         IM::Buddy::IMUsersInfoReq msg;
-        IM::Buddy::IMUsersInfoRsp msgResp;
         if(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()))
         {
-            CImPdu* pPduRes = new CImPdu;
-            
             uint32_t from_user_id = msg.user_id();
             uint32_t userCount = msg.user_id_list_size();
             std::list<uint32_t> idList;
             for(uint32_t i = 0; i < userCount;++i) {
-    		idList.push_back(msg.user_id_list(i));
-            }
-	std::list<IM::BaseDefine::UserInfo> lsUser;
-            CUserModel::getInstance()->getUsers(idList, lsUser);
-msgResp.set_user_id(from_user_id);
-            for(list<IM::BaseDefine::UserInfo>::iterator it=lsUser.begin();
-                it!=lsUser.end(); ++it)
-            {
-                IM::BaseDefine::UserInfo* pUser = msgResp.add_user_info_list();
-    //            *pUser = *it;
-             
-   pUser->set_user_id(it->user_id());
-                pUser->set_user_gender(it->user_gender());
-                pUser->set_user_nick_name(it->user_nick_name());
-                pUser->set_avatar_url(it->avatar_url());
-
-                pUser->set_sign_info(it->sign_info());
-    pUser->set_department_id(it->department_id());
-                pUser->set_email(it->email());
-                pUser->set_user_real_name(it->user_real_name());
-                pUser->set_user_tel(it->user_tel());
-                pUser->set_user_domain(it->user_domain());
-                pUser->set_status(it->status());
+                idList.push_back(msg.user_id_list(i));
             }
-            log("userId=%u, userCnt=%u", from_user_id, userCount);
-            msgResp.set_attach_data(msg.attach_data());
-            pPduRes->SetPBMsg(&msgResp);
-            pPduRes->SetSeqNum(pPdu->GetSeqNum());
-            pPduRes->SetServiceId(IM::BaseDefine::SID_BUDDY_LIST);
-            pPduRes->SetCommandId(IM::BaseDefine::CID_BUDDY_LIST_USER_INFO_RESPONSE);
-            CProxyConn::AddResponsePdu(conn_uuid, pPduRes);
+            
+            // 登录时的热点请求, 走异步查询, 工作线程不等数据库; pPdu在返回后就被释放, 回调里要用的先拷贝出来
+            uint16_t nSeqNum = pPdu->GetSeqNum();
+            string strAttachData = msg.attach_data();
+            CUserModel::getInstance()->getUsersAsync(idList, [conn_uuid, nSeqNum, from_user_id, userCount, strAttachData](list<IM::BaseDefine::UserInfo>& lsUser) {
+                IM::Buddy::IMUsersInfoRsp msgResp;
+                msgResp.set_user_id(from_user_id);
+                for(list<IM::BaseDefine::UserInfo>::iterator it=lsUser.begin();
+                    it!=lsUser.end(); ++it)
+                {
+                    IM::BaseDefine::UserInfo* pUser = msgResp.add_user_info_list();
+                    pUser->Swap(&(*it));
+                }
+                log("userId=%u, userCnt=%u", from_user_id, userCount);
+                msgResp.set_attach_data(strAttachData);
+                CImPdu* pPduRes = new CImPdu;
+                pPduRes->SetPBMsg(&msgResp);
+                pPduRes->SetSeqNum(nSeqNum);
+                pPduRes->SetServiceId(IM::BaseDefine::SID_BUDDY_LIST);
+                pPduRes->SetCommandId(IM::BaseDefine::CID_BUDDY_LIST_USER_INFO_RESPONSE);
+                CProxyConn::AddResponsePdu(conn_uuid, pPduRes);
+            });
         }
         else
         {
@@ -10,6 +10,7 @@
 ================================================================*/
 #include "UserModel.h"
 #include "../DBPool.h"
+#include "../AsyncDBPool.h"
 #include "../CachePool.h"
 #include "Common.h"
 #include "SyncCenter.h"
@@ -55,8 +56,8 @@ void CUserModel::getChangedId(uint32_t& nLastTime, list<uint32_t> &lsIds)
         if(pResultSet)
         {
             while (pResultSet->Next()) {
-                uint32_t nId = pResultSet->GetInt("id");
-                uint32_t nUpdated = pResultSet->GetInt("updated");
+                uint32_t nId = pResultSet->GetUInt(0);
+                uint32_t nUpdated = pResultSet->GetUInt(1);
         	 if(nLastTime < nUpdated)
                 {
                     nLastTime = nUpdated;
@@ -77,6 +78,45 @@ void CUserModel::getChangedId(uint32_t& nLastTime, list<uint32_t> &lsIds)
     }
 }
 
+static string getUsersSql(const list<uint32_t>& lsIds)
+{
+    string strClause;
+    bool bFirst = true;
+    for (auto it = lsIds.begin(); it!=lsIds.end(); ++it)
+    {
+        if(bFirst)
+        {
+            bFirst = false;
+            strClause += int2string(*it);
+        }
+        else
+        {
+            strClause += ("," + int2string(*it));
+        }
+    }
+    return "select id, sex, nick, domain, name, phone, email, avatar, sign_info, departId, status from IMUser where id in (" + strClause + ")";
+}
+
+static void readUsers(IResultSet* pResultSet, list<IM::BaseDefine::UserInfo>& lsUsers)
+{
+    while (pResultSet->Next())
+    {
+        IM::BaseDefine::UserInfo cUser;
+        cUser.set_user_id(pResultSet->GetUInt(0));
+        cUser.set_user_gender(pResultSet->GetUInt(1));
+        cUser.set_user_nick_name(pResultSet->GetString(2), pResultSet->GetStringLen(2));
+        cUser.set_user_domain(pResultSet->GetString(3), pResultSet->GetStringLen(3));
+        cUser.set_user_real_name(pResultSet->GetString(4), pResultSet->GetStringLen(4));
+        cUser.set_user_tel(pResultSet->GetString(5), pResultSet->GetStringLen(5));
+        cUser.set_email(pResultSet->GetString(6), pResultSet->GetStringLen(6));
+        cUser.set_avatar_url(pResultSet->GetString(7), pResultSet->GetStringLen(7));
+        cUser.set_sign_info(pResultSet->GetString(8), pResultSet->GetStringLen(8));
+        cUser.set_department_id(pResultSet->GetUInt(9));
+        cUser.set_status(pResultSet->GetUInt(10));
+        lsUsers.push_back(cUser);
+    }
+}
+
 void CUserModel::getUsers(list<uint32_t> lsIds, list<IM::BaseDefine::UserInfo> &lsUsers)
 {
     if (lsIds.empty()) {
@@ -87,42 +127,11 @@ void CUserModel::getUsers(list<uint32_t> lsIds, list<IM::BaseDefine::UserInfo> &
     CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_slave");
     if (pDBConn)
     {
-        string strClause;
-        bool bFirst = true;
-        for (auto it = lsIds.begin(); it!=lsIds.end(); ++it)
-        {
-            if(bFirst)
-            {
-                bFirst = false;
-                strClause += int2string(*it);
-            }
-            else
-            {
-                strClause += ("," + int2string(*it));
-            }
-        }
-        string  strSql = "select * from IMUser where id in (" + strClause + ")";
+        string strSql = getUsersSql(lsIds);
         CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
         if(pResultSet)
         {
-            while (pResultSet->Next())
-            {
-                IM::BaseDefine::UserInfo cUser;
-                cUser.set_user_id(pResultSet->GetInt("id"));
-                cUser.set_user_gender(pResultSet->GetInt("sex"));
-                cUser.set_user_nick_name(pResultSet->GetString("nick"));
-                cUser.set_user_domain(pResultSet->GetString("domain"));
-                cUser.set_user_real_name(pResultSet->GetString("name"));
-                cUser.set_user_tel(pResultSet->GetString("phone"));
-                cUser.set_email(pResultSet->GetString("email"));
-                cUser.set_avatar_url(pResultSet->GetString("avatar"));
-		cUser.set_sign_info(pResultSet->GetString("sign_info"));
-             
-                cUser.set_department_id(pResultSet->GetInt("departId"));
-  		 cUser.set_department_id(pResultSet->GetInt("departId"));
-                cUser.set_status(pResultSet->GetInt("status"));
-                lsUsers.push_back(cUser);
-            }
+            readUsers(pResultSet, lsUsers);
             delete pResultSet;
         }
         else
@@ -137,6 +146,28 @@ void CUserModel::getUsers(list<uint32_t> lsIds, list<IM::BaseDefine::UserInfo> &
     }
 }
 
+void CUserModel::getUsersAsync(const list<uint32_t>& lsIds, const std::function<void (list<IM::BaseDefine::UserInfo>& lsUsers)>& callback)
+{
+    if (lsIds.empty()) {
+        log("list is empty");
+        list<IM::BaseDefine::UserInfo> lsUsers;
+        callback(lsUsers);
+        return;
+    }
+    CAsyncDBManager::getInstance()->Query("teamtalk_slave", getUsersSql(lsIds), [callback](CResultSet* pResultSet) {
+        list<IM::BaseDefine::UserInfo> lsUsers;
+        if (pResultSet)
+        {
+            readUsers(pResultSet, lsUsers);
+        }
+        else
+        {
+            log("get users failed");
+        }
+        callback(lsUsers);
+    });
+}
+
 bool CUserModel::getUser(uint32_t nUserId, DBUserInfo_t &cUser)
 {
     bool bRet = false;
@@ -144,23 +175,23 @@ bool CUserModel::getUser(uint32_t nUserId, DBUserInfo_t &cUser)
     CDBConn* pDBConn = pDBManager->GetDBConn("teamtalk_slave");
     if (pDBConn)
     {
-        string strSql = "select * from IMUser where id="+int2string(nUserId);
+        string strSql = "select id, sex, nick, domain, name, phone, email, avatar, sign_info, departId, status from IMUser where id="+int2string(nUserId);
         CResultSet* pResultSet = pDBConn->ExecuteQuery(strSql.c_str());
         if(pResultSet)
         {
             while (pResultSet->Next())
             {
-                cUser.nId = pResultSet->GetInt("id");
-                cUser.nSex = pResultSet->GetInt("sex");
-                cUser.strNick = pResultSet->GetString("nick");
-                cUser.strDomain = pResultSet->GetString("domain");
-                cUser.strName = pResultSet->GetString("name");
-                cUser.strTel = pResultSet->GetString("phone");
-                cUser.strEmail = pResultSet->GetString("email");
-                cUser.strAvatar = pResultSet->GetString("avatar");
-                cUser.sign_info = pResultSet->GetString("sign_info");
-                cUser.nDeptId = pResultSet->GetInt("departId");
-                cUser.nStatus = pResultSet->GetInt("status");
+                cUser.nId = pResultSet->GetUInt(0);
+                cUser.nSex = pResultSet->GetUInt(1);
+                cUser.strNick = pResultSet->GetStdString(2);
+                cUser.strDomain = pResultSet->GetStdString(3);
+                cUser.strName = pResultSet->GetStdString(4);
+                cUser.strTel = pResultSet->GetStdString(5);
+                cUser.strEmail = pResultSet->GetStdString(6);
+                cUser.strAvatar = pResultSet->GetStdString(7);
+                cUser.sign_info = pResultSet->GetStdString(8);
+                cUser.nDeptId = pResultSet->GetUInt(9);
+                cUser.nStatus = pResultSet->GetUInt(10);
                 bRet = true;
             }
             delete pResultSet;
@@ -210,8 +241,8 @@ bool CUserModel::insertUser(DBUserInfo_t &cUser)
     if (pDBConn)
     {
         string strSql = "insert into IMUser(`id`,`sex`,`nick`,`domain`,`name`,`phone`,`email`,`avatar`,`sign_info`,`departId`,`status`,`created`,`updated`) values(?,?,?,?,?,?,?,?,?,?,?,?)";
-        CPrepareStatement* stmt = new CPrepareStatement();
-        if (stmt->Init(pDBConn->GetMysql(), strSql))
+        CPrepareStatement* stmt = pDBConn->GetStatement(strSql);
+        if (stmt)
         {
             uint32_t nNow = (uint32_t) time(NULL);
             uint32_t index = 0;
@@ -238,7 +269,6 @@ bool CUserModel::insertUser(DBUserInfo_t &cUser)
                 log("insert user failed: %s", strSql.c_str());
             }
         }
-        delete stmt;
         pDBManager->RelDBConn(pDBConn);
     }
     else
@@ -306,8 +336,8 @@ void CUserModel::setCallReport(uint32_t nUserId, uint32_t nPeerId, IM::BaseDefin
         if(pDBConn)
         {
             string strSql = "insert into IMCallLog(`userId`, `peerId`, `clientType`,`created`,`updated`) values(?,?,?,?,?)";
-            CPrepareStatement* stmt = new CPrepareStatement();
-            if (stmt->Init(pDBConn->GetMysql(), strSql))
+            CPrepareStatement* stmt = pDBConn->GetStatement(strSql);
+            if (stmt)
             {
                 uint32_t nNow = (uint32_t) time(NULL);
                 uint32_t index = 0;
@@ -324,7 +354,6 @@ void CUserModel::setCallReport(uint32_t nUserId, uint32_t nPeerId, IM::BaseDefin
                     log("insert report failed: %s", strSql.c_str());
                 }
             }
-            delete stmt;
             pDBManager->RelDBConn(pDBConn);
         }
         else
@@ -375,7 +404,7 @@ bool CUserModel::getUserSingInfo(uint32_t user_id, string* sign_info) {
         CResultSet* result_set = db_conn->ExecuteQuery(str_sql.c_str());
         if(result_set) {
             if (result_set->Next()) {
-                *sign_info = result_set->GetString("sign_info");
+                *sign_info = result_set->GetStdString(0);
                 rv = true;
                 }
             delete result_set;
@@ -419,7 +448,7 @@ bool CUserModel::getPushShield(uint32_t user_id, uint32_t* shield_status) {
         CResultSet* result_set = db_conn->ExecuteQuery(str_sql.c_str());
         if(result_set) {
             if (result_set->Next()) {
-                *shield_status = result_set->GetInt("push_shield_status");
+                *shield_status = result_set->GetUInt(0);
                 rv = true;
             }
             delete result_set;
@@ -12,6 +12,7 @@
 #ifndef __USERMODEL_H__
 #define __USERMODEL_H__
 
+#include <functional>
 #include "IM.BaseDefine.pb.h"
 #include "ImPduBase.h"
 #include "public_define.h"
@@ -22,6 +23,8 @@ public:
     ~CUserModel();
     void getChangedId(uint32_t& nLastTime, list<uint32_t>& lsIds);
     void getUsers(list<uint32_t> lsIds, list<IM::BaseDefine::UserInfo>& lsUsers);
+    // 异步查询, 回调在异步线程里执行, 不能再做阻塞的操作, 见AsyncDBPool.h
+    void getUsersAsync(const list<uint32_t>& lsIds, const std::function<void (list<IM::BaseDefine::UserInfo>& lsUsers)>& callback);
     bool getUser(uint32_t nUserId, DBUserInfo_t& cUser);
 
     bool updateUser(DBUserInfo_t& cUser);
@@ -23,6 +23,11 @@
 #include "business/GroupMessageModel.h"
 #include "business/FileModel.h"
 #include "SyncCenter.h"
+#include "MsgBatcher.h"
+#include "MsgIdAllocator.h"
+#include "LastMsgCache.h"
+#include "AsyncDBPool.h"
+#include "MetricsServer.h"
 
 string strAudioEnc;
 // this callback will be replaced by imconn_callback() in OnConnect()
@@ -80,6 +85,12 @@ int main(int argc, char* argv[])
         return -1;
     }
     puts("db init success");
+
+    // 非阻塞的异步查询, 配置了AsyncDBThreadNum才会开启
+    if (CAsyncDBManager::getInstance()->Init()) {
+        log("AsyncDBManager init failed");
+        return -1;
+    }
     // 主线程初始化单例，不然在工作线程可能会出现多次初始化，不用加锁
     if (!CAudioModel::getInstance()) {
         return -1;
@@ -166,6 +177,21 @@ int main(int argc, char* argv[])
     //3、创建线程处理任务队列中的任务  //
     
 
+    // 消息写入的组提交, 配置了MsgBatchWindow才会开启
+    if (CMsgBatcher::getInstance()->init()) {
+        return -1;
+    }
+
+    // 按会话租用消息id段, MsgIdLeaseSize=0时每条消息INCRBY
+    CMsgIdAllocator::getInstance()->init();
+
+    // relateId/sessionId的进程内缓存, 会话时间的合并写入
+    CRelationModel::getInstance()->init();
+    CSessionModel::getInstance()->init();
+
+    // 会话最后一条消息的redis记录, LastMsgCacheTime=0时每次查库
+    CLastMsgCache::getInstance()->init();
+
     init_proxy_conn(thread_num);
 
     //启动从mysql同步数据到redis工作
@@ -182,6 +208,10 @@ int main(int argc, char* argv[])
     }
 
     printf("server start listen on: %s:%d\n", listen_ip, listen_port);
+    // 本地端口上的/metrics, 配置了MetricsPort才监听
+    if (metrics_server_init(&config_file) == -1)
+        return -1;
+
     printf("now enter the event loop...\n");
     writePid();
 
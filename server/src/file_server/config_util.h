@@ -26,14 +26,24 @@ public:
     void SetTaskTimeout(uint32_t timeout) { task_timeout_ = timeout; }
     uint32_t GetTaskTimeout() const { return task_timeout_; }
     
+    // 离线文件每次拉取的数据块大小, 以及上传时同时在途的拉取请求个数
+    void SetSegmentSize(uint32_t segment_size) { segment_size_ = segment_size; }
+    uint32_t GetSegmentSize() const { return segment_size_; }
+    void SetUploadWindow(uint32_t window) { upload_window_ = window; }
+    uint32_t GetUploadWindow() const { return upload_window_; }
+    
 private:
     friend class Singleton<ConfigUtil>;
     
     ConfigUtil()
-        : task_timeout_(3600) { }
+        : task_timeout_(3600),
+          segment_size_(32768),
+          upload_window_(16) { }
     
     std::list<IM::BaseDefine::IpAddr> addrs_;
     uint32_t task_timeout_;
+    uint32_t segment_size_;
+    uint32_t upload_window_;
 };
 
 #endif /* defined(FILE_SERVER_CONFIG_UTIL_H_) */
@@ -12,6 +12,8 @@
 #include "base/pb/protocol/IM.File.pb.h"
 
 #include "base/im_conn_util.h"
+#include "base/pb/google/protobuf/io/coded_stream.h"
+#include "base/pb/google/protobuf/wire_format_lite.h"
 
 #include "file_server/config_util.h"
 #include "file_server/transfer_task_manager.h"
@@ -189,6 +191,11 @@ void FileClientConn::OnTimer(uint64_t curr_tick) {
 
 void FileClientConn::OnWrite() {
     CImConn::OnWrite();
+    
+    if (close_after_send_ && !m_busy) {
+        log("all data sent, close client, user_id=%u", user_id_);
+        Close();
+    }
 }
 
 void FileClientConn::HandlePdu(CImPdu* pdu) {
@@ -295,14 +302,8 @@ void FileClientConn::_HandleClientFileLoginReq(CImPdu* pdu) {
                 
                 OfflineTransferTask* offline = reinterpret_cast<OfflineTransferTask*>(transfer_task);
                 
-                IM::File::IMFilePullDataReq pull_data_req;
-                pull_data_req.set_task_id(task_id);
-                pull_data_req.set_user_id(user_id);
-                pull_data_req.set_trans_mode(FILE_TYPE_OFFLINE);
-                pull_data_req.set_offset(0);
-                pull_data_req.set_data_size(offline->GetNextSegmentBlockSize());
-                
-                ::SendMessageLite(this, SID_FILE, CID_FILE_PULL_DATA_REQ, &pull_data_req);
+                // 一次发出一个窗口的拉取请求
+                _SendPullDataReqs(offline);
 
                 log("Pull Data Req");
             }
@@ -415,6 +416,11 @@ void FileClientConn::_HandleClientFilePullFileReq(CImPdu *pdu) {
         return;
     }
     
+    if (close_after_send_) {
+        log("Download finished, ignore pull request, user_id=%u", user_id_);
+        return;
+    }
+    
     IM::File::IMFilePullDataReq pull_data_req;
     CHECK_PB_PARSE_MSG(pull_data_req.ParseFromArray(pdu->GetBodyData(), pdu->GetBodyLength()));
     
@@ -426,14 +432,6 @@ void FileClientConn::_HandleClientFilePullFileReq(CImPdu *pdu) {
 
     log("Recv FilePullFileReq, user_id=%d, task_id=%s, file_role=%d, offset=%d, datasize=%d", user_id, task_id.c_str(), mode, offset, datasize);
 
-    // rsp
-    IM::File::IMFilePullDataRsp pull_data_rsp;
-    pull_data_rsp.set_result_code(1);
-    pull_data_rsp.set_task_id(task_id);
-    pull_data_rsp.set_user_id(user_id);
-    pull_data_rsp.set_offset(offset);
-    pull_data_rsp.set_file_data("");
-
     // BaseTransferTask* transfer_task = NULL;
     int rv = -1;
     
@@ -458,13 +456,11 @@ void FileClientConn::_HandleClientFilePullFileReq(CImPdu *pdu) {
             break;
         }
         
-        rv =  transfer_task_->DoPullFileRequest(user_id, offset, datasize, pull_data_rsp.mutable_file_data());
+        rv =  transfer_task_->DoPullFileRequest(user_id, offset, &datasize);
         
         if (rv == -1) {
             break;
         }
-        
-        pull_data_rsp.set_result_code(0);
 
         if (transfer_task_->GetTransMode() == FILE_TYPE_ONLINE) {
             OnlineTransferTask* online = reinterpret_cast<OnlineTransferTask*>(transfer_task_);
@@ -476,7 +472,9 @@ void FileClientConn::_HandleClientFilePullFileReq(CImPdu *pdu) {
             }
             // SendPdu(&pdu);
         } else {
-            SendMessageLite(this, SID_FILE, CID_FILE_PULL_DATA_RSP, pdu->GetSeqNum(), &pull_data_rsp);
+            OfflineTransferTask* offline = reinterpret_cast<OfflineTransferTask*>(transfer_task_);
+            _SendPullDataRsp(pdu->GetSeqNum(), task_id, user_id, offset, offline->GetFile(),
+                             OfflineTransferTask::GetFileOffset(offset), datasize);
             if (rv == 1) {
                 _StatesNotify(CLIENT_FILE_DONE, task_id, transfer_task_->from_user_id(), this);
             }
@@ -486,7 +484,10 @@ void FileClientConn::_HandleClientFilePullFileReq(CImPdu *pdu) {
     } while (0);
 
 
-    if (rv!=0) {
+    if (rv == 1 && m_busy) {
+        // 下载完成, 等发送队列里的数据发完再关闭
+        close_after_send_ = true;
+    } else if (rv!=0) {
         Close();
     }
 
@@ -551,14 +552,8 @@ void FileClientConn::_HandleClientFilePullFileRsp(CImPdu *pdu) {
             } else {
                 OfflineTransferTask* offline = reinterpret_cast<OfflineTransferTask*>(transfer_task_);
                 
-                IM::File::IMFilePullDataReq pull_data_req;
-                pull_data_req.set_task_id(task_id);
-                pull_data_req.set_user_id(user_id);
-                pull_data_req.set_trans_mode(static_cast<IM::BaseDefine::TransferFileType>(offline->GetTransMode()));
-                pull_data_req.set_offset(offline->GetNextOffset());
-                pull_data_req.set_data_size(offline->GetNextSegmentBlockSize());
-                
-                ::SendMessageLite(this, SID_FILE, CID_FILE_PULL_DATA_REQ, &pull_data_req);
+                // 收到一块, 窗口里空出一个位置
+                _SendPullDataReqs(offline);
                 // log("size not match");
             }
         }
@@ -572,6 +567,60 @@ void FileClientConn::_HandleClientFilePullFileRsp(CImPdu *pdu) {
     }
 }
 
+void FileClientConn::_SendPullDataReqs(OfflineTransferTask* offline) {
+    uint32_t offset = 0;
+    uint32_t data_size = 0;
+    while (offline->GetNextPullRequest(&offset, &data_size)) {
+        IM::File::IMFilePullDataReq pull_data_req;
+        pull_data_req.set_task_id(offline->task_id());
+        pull_data_req.set_user_id(user_id_);
+        pull_data_req.set_trans_mode(FILE_TYPE_OFFLINE);
+        pull_data_req.set_offset(offset);
+        pull_data_req.set_data_size(data_size);
+        
+        ::SendMessageLite(this, SID_FILE, CID_FILE_PULL_DATA_REQ, &pull_data_req);
+    }
+}
+
+void FileClientConn::_SendPullDataRsp(uint16_t seq_num, const std::string& task_id, uint32_t user_id, uint32_t offset,
+                                      CSharedFile* file, uint64_t file_offset, uint32_t data_size) {
+    using google::protobuf::io::CodedOutputStream;
+    using google::protobuf::internal::WireFormatLite;
+    
+    // file_data以外的字段正常序列化, file_data只写tag和长度, 内容紧跟在后面由sendfile发出;
+    // 字段顺序不影响解析, 收到的是一个完整的IMFilePullDataRsp
+    IM::File::IMFilePullDataRsp pull_data_rsp;
+    pull_data_rsp.set_result_code(0);
+    pull_data_rsp.set_task_id(task_id);
+    pull_data_rsp.set_user_id(user_id);
+    pull_data_rsp.set_offset(offset);
+    
+    uint32_t tag = WireFormatLite::MakeTag(IM::File::IMFilePullDataRsp::kFileDataFieldNumber,
+                                           WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+    uint32_t msg_size = pull_data_rsp.ByteSize();
+    uint32_t field_head_size = CodedOutputStream::VarintSize32(tag) + CodedOutputStream::VarintSize32(data_size);
+    uint32_t head_size = IM_PDU_HEADER_LEN + msg_size + field_head_size;
+    
+    CSharedBuffer* head = new CSharedBuffer(NULL, head_size);
+    uchar_t* buf = head->GetBuffer();
+    CByteStream::WriteInt32(buf, head_size + data_size);
+    CByteStream::WriteUint16(buf + 4, IM_PDU_VERSION);
+    CByteStream::WriteUint16(buf + 6, 0);
+    CByteStream::WriteUint16(buf + 8, SID_FILE);
+    CByteStream::WriteUint16(buf + 10, CID_FILE_PULL_DATA_RSP);
+    CByteStream::WriteUint16(buf + 12, seq_num);
+    CByteStream::WriteUint16(buf + 14, 0);
+    
+    // 还没有file_data, 不能用SerializeToArray检查必填字段
+    pull_data_rsp.SerializePartialToArray(buf + IM_PDU_HEADER_LEN, msg_size);
+    uint8_t* field_head = buf + IM_PDU_HEADER_LEN + msg_size;
+    field_head = CodedOutputStream::WriteVarint32ToArray(tag, field_head);
+    CodedOutputStream::WriteVarint32ToArray(data_size, field_head);
+    
+    SendFile(head, file, file_offset, data_size);
+    head->ReleaseRef();
+}
+
 int FileClientConn::_StatesNotify(int state, const std::string& task_id, uint32_t user_id, CImConn* conn) {
     FileClientConn* file_client_conn = reinterpret_cast<FileClientConn*>(conn);
     
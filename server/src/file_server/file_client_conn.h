@@ -19,6 +19,7 @@ class FileClientConn : public CImConn {
 public:
     FileClientConn()
         : auth_(false),
+          close_after_send_(false),
           user_id_(0),
           transfer_task_(NULL) {
     }
@@ -51,6 +52,12 @@ private:
     
     int _StatesNotify(int state, const std::string& task_id, uint32_t user_id, CImConn* conn);
     
+    // 离线上传: 窗口没满就继续向发送方拉取下一块
+    void _SendPullDataReqs(OfflineTransferTask* offline);
+    // 离线下载: 包头和其他字段拷贝一次, file_data直接从文件sendfile
+    void _SendPullDataRsp(uint16_t seq_num, const std::string& task_id, uint32_t user_id, uint32_t offset,
+                          CSharedFile* file, uint64_t file_offset, uint32_t data_size);
+    
     // bool _IsAuth() const { return auth_; }
     
     /// yunfan add 2014.8.18
@@ -60,6 +67,8 @@ private:
     /// yunan add end
     
     bool		auth_;
+    // 下载完成时发送队列里可能还有数据, 发完再关闭连接
+    bool		close_after_send_;
     
     uint32_t	user_id_;
     // 当前设计每个连接对应一次任务，故可预先缓存
@@ -15,6 +15,7 @@
 #include "file_server/config_util.h"
 #include "file_server/file_client_conn.h"
 #include "file_server/file_msg_server_conn.h"
+#include "MetricsServer.h"
 
 /*
  Address=0.0.0.0         # address for client
@@ -26,6 +27,9 @@
  MsgServerListenPort=8601
  
  TaskTimeout=60         # Task Timeout (seconds)
+ 
+ SegmentSize=32768
+ UploadWindow=16
  */
 
 //void file_client_conn_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam) {
@@ -74,6 +78,8 @@ int main(int argc, char* argv[])
     char* str_msg_server_listen_port = config_file.GetConfigName("MsgServerListenPort");
 
     char* str_task_timeout = config_file.GetConfigName("TaskTimeout");
+    char* str_segment_size = config_file.GetConfigName("SegmentSize");
+    char* str_upload_window = config_file.GetConfigName("UploadWindow");
 
 	if (!str_client_listen_ip || !str_client_listen_port || !str_msg_server_listen_ip || !str_msg_server_listen_port) {
 		log("config item missing, exit... ");
@@ -93,6 +99,22 @@ int main(int argc, char* argv[])
 
     ConfigUtil::GetInstance()->SetTaskTimeout(task_timeout);
     
+    // 没配置时用默认值, 和老版本一样32K一块
+    if (str_segment_size) {
+        uint32_t segment_size = atoi(str_segment_size);
+        if (segment_size < 4096 || segment_size > 1048576) {
+            log("invalid SegmentSize=%s, must be 4096~1048576", str_segment_size);
+            return -1;
+        }
+        ConfigUtil::GetInstance()->SetSegmentSize(segment_size);
+    }
+    if (str_upload_window) {
+        uint32_t upload_window = atoi(str_upload_window);
+        ConfigUtil::GetInstance()->SetUploadWindow(upload_window > 0 ? upload_window : 1);
+    }
+    log("offline segment_size=%u, upload_window=%u", ConfigUtil::GetInstance()->GetSegmentSize(),
+        ConfigUtil::GetInstance()->GetUploadWindow());
+    
     InitializeFileMsgServerConn();
 	InitializeFileClientConn();
 
@@ -122,6 +144,10 @@ int main(int argc, char* argv[])
         printf("server start listen on %s:%d\n", str_msg_server_listen_ip, msg_server_listen_port);
     }
 
+	// 本地端口上的/metrics, 配置了MetricsPort才监听
+	if (metrics_server_init(&config_file) == -1)
+		return -1;
+
 	printf("now enter the event loop...\n");
     
     writePid();
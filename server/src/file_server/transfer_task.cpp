@@ -8,11 +8,15 @@
 
 #include "file_server/transfer_task.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <uuid/uuid.h>
 
 #include "base/util.h"
 #include "base/pb/protocol/IM.BaseDefine.pb.h"
 
+#include "file_server/config_util.h"
+
 // static char g_current_save_path[BUFSIZ];
 
 using namespace IM::BaseDefine;
@@ -55,21 +59,21 @@ const char* GetCurrentOfflinePath() {
     return g_current_save_path;
 }
 
-static FILE* OpenByRead(const std::string& task_id, uint32_t user_id) {
-    FILE* fp = NULL;
+static int OpenByRead(const std::string& task_id, uint32_t user_id) {
+    int fd = -1;
     if (task_id.length()>=2) {
         char save_path[BUFSIZ];
         snprintf(save_path, BUFSIZ, "%s/%s/%s", GetCurrentOfflinePath(), task_id.substr(0, 2).c_str() , task_id.c_str());
-        fp = fopen(save_path, "rb");  // save fp
-        if (!fp) {
+        fd = open(save_path, O_RDONLY);
+        if (fd == -1) {
             log("Open file %s for read failed", save_path);
         }
     }
-    return fp;
+    return fd;
 }
 
-static FILE* OpenByWrite(const std::string& task_id, uint32_t user_id) {
-    FILE* fp = NULL;
+static int OpenByWrite(const std::string& task_id, uint32_t user_id) {
+    int fd = -1;
     if (task_id.length()>=2) {
 
         char save_path[BUFSIZ];
@@ -83,15 +87,51 @@ static FILE* OpenByWrite(const std::string& task_id, uint32_t user_id) {
             strncat(save_path, "/", BUFSIZ);
             strncat(save_path, task_id.c_str(), BUFSIZ);
             
-            fp = fopen(save_path, "ab+");
-            if (!fp) {
+            // 重新上传时覆盖掉上次没传完的文件
+            fd = open(save_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1) {
                 log("Open file for write failed");
                 //break;
             }
         }
     }
     
-    return fp;
+    return fd;
+}
+
+// 按偏移读写, 不移动文件指针, 乱序到达的数据块可以直接写到各自的位置
+static bool PReadFull(int fd, void* buf, uint32_t len, uint64_t offset) {
+    char* p = (char*)buf;
+    while (len > 0) {
+        ssize_t ret = pread(fd, p, len, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        p += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+static bool PWriteFull(int fd, const void* buf, uint32_t len, uint64_t offset) {
+    const char* p = (const char*)buf;
+    while (len > 0) {
+        ssize_t ret = pwrite(fd, p, len, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        p += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return true;
 }
 
 
@@ -234,7 +274,7 @@ int OnlineTransferTask::DoRecvData(uint32_t user_id, uint32_t offset, const char
     return rv;
 }
 
-int OnlineTransferTask::DoPullFileRequest(uint32_t user_id, uint32_t offset, uint32_t data_size, std::string* data) {
+int OnlineTransferTask::DoPullFileRequest(uint32_t user_id, uint32_t offset, uint32_t* data_size) {
     int rv = -1;
     
     // 在线
@@ -258,16 +298,74 @@ int OnlineTransferTask::DoPullFileRequest(uint32_t user_id, uint32_t offset, uin
 }
 
 //----------------------------------------------------------------------------
+OfflineTransferTask::OfflineTransferTask(const std::string& task_id, uint32_t from_user_id, uint32_t to_user_id, const std::string& file_name, uint32_t file_size)
+    : BaseTransferTask(task_id, from_user_id, to_user_id, file_name, file_size),
+      file_(NULL),
+      next_pull_idx_(0),
+      done_cnt_(0) {
+    
+    segment_size_ = ConfigUtil::GetInstance()->GetSegmentSize();
+    upload_window_ = ConfigUtil::GetInstance()->GetUploadWindow();
+    segment_cnt_ = (file_size + segment_size_ - 1) / segment_size_;
+    // 空文件也按一个0字节的块处理, 和原来一样拉取一次, 收到后才写文件头并结束上传
+    if (segment_cnt_ == 0) {
+        segment_cnt_ = 1;
+    }
+    done_segments_.resize(segment_cnt_, false);
+}
+
+OfflineTransferTask::~OfflineTransferTask() {
+    CloseFile();
+}
+
+void OfflineTransferTask::CloseFile() {
+    // 发送队列里还有数据块时, 文件等它们发完才真正关闭
+    if (file_) {
+        file_->ReleaseRef();
+        file_ = NULL;
+    }
+}
+
+void OfflineTransferTask::ResetSegments() {
+    next_pull_idx_ = 0;
+    done_cnt_ = 0;
+    done_segments_.assign(segment_cnt_, false);
+}
+
+bool OfflineTransferTask::MarkSegmentDone(uint32_t idx) {
+    if (done_segments_[idx]) {
+        return false;
+    }
+    done_segments_[idx] = true;
+    ++done_cnt_;
+    return true;
+}
+
+bool OfflineTransferTask::GetNextPullRequest(uint32_t* offset, uint32_t* data_size) {
+    if (state_ != kTransferTaskStateWaitingUpload && state_ != kTransferTaskStateUploading) {
+        return false;
+    }
+    
+    // 已经拉取还没收到的块不超过窗口大小
+    if (next_pull_idx_ >= segment_cnt_ || next_pull_idx_ - done_cnt_ >= upload_window_) {
+        return false;
+    }
+    
+    *offset = next_pull_idx_*segment_size_;
+    *data_size = GetSegmentBlockSize(next_pull_idx_);
+    ++next_pull_idx_;
+    return true;
+}
+
 OfflineTransferTask* OfflineTransferTask::LoadFromDisk(const std::string& task_id, uint32_t user_id) {
     OfflineTransferTask* offline = NULL;
     
-    FILE* fp = OpenByRead(task_id, user_id);
-    if (fp) {
+    int fd = OpenByRead(task_id, user_id);
+    if (fd != -1) {
         OfflineFileHeader file_header;
-        size_t size = fread(&file_header, 1, sizeof(file_header), fp);
-        if (size==sizeof(file_header)) {
-            fseek(fp, 0L, SEEK_END);
-            size_t file_size = static_cast<size_t>(ftell(fp))-size;
+        struct stat st;
+        if (PReadFull(fd, &file_header, sizeof(file_header), 0) && fstat(fd, &st) == 0) {
+            size_t file_size = static_cast<size_t>(st.st_size)-sizeof(file_header);
             if (file_size == file_header.get_file_size()) {
                 offline = new OfflineTransferTask(file_header.get_task_id(),
                                                   file_header.get_from_user_id(),
@@ -283,7 +381,7 @@ OfflineTransferTask* OfflineTransferTask::LoadFromDisk(const std::string& task_i
         } else {
             log("Read file_header error by task_id=%s, user_id=%u", task_id.c_str(), user_id);
         }
-        fclose(fp);
+        close(fd);
     }
     
     return offline;
@@ -392,27 +490,28 @@ int OfflineTransferTask::DoRecvData(uint32_t user_id, uint32_t offset, const cha
             break;
         }
         
-        // 检查offset是否有效
-        if (offset != transfered_idx_*SEGMENT_SIZE) {
+        // 检查offset是否有效, 必须是已经拉取过的块
+        uint32_t idx = offset / segment_size_;
+        if (offset % segment_size_ != 0 || idx >= next_pull_idx_) {
+            log("Recv offset error, offset=%u, segment_size=%u, pulled=%u", offset, segment_size_, next_pull_idx_);
             break;
         }
         
-        //if (data_size != GetNextSegmentBlockSize()) {
-        //    break;
-        //}
-        // todo
-        // 检查文件大小
+        // 检查块大小
+        if (data_size != GetSegmentBlockSize(idx)) {
+            log("Recv data_size error, offset=%u, data_size=%u, need %u", offset, data_size, GetSegmentBlockSize(idx));
+            break;
+        }
         
-        data_size = GetNextSegmentBlockSize();
-        log("Ready recv data, offset=%d, data_size=%d, segment_size=%d", offset, data_size, sengment_size_);
+        log("Ready recv data, offset=%u, data_size=%u, segment_cnt=%u", offset, data_size, segment_cnt_);
         
         if (state_ == kTransferTaskStateWaitingUpload) {
-            if (fp_ == NULL) {
-                fp_ = OpenByWrite(task_id_, to_user_id_);
-                if (fp_ == NULL) {
-                    break;
-                }
+            CloseFile();
+            int fd = OpenByWrite(task_id_, to_user_id_);
+            if (fd == -1) {
+                break;
             }
+            file_ = new CSharedFile(fd);
 
             // 写文件头
             OfflineFileHeader file_header;
@@ -423,28 +522,37 @@ int OfflineTransferTask::DoRecvData(uint32_t user_id, uint32_t offset, const cha
             file_header.set_to_user_id(to_user_id_);
             file_header.set_file_name("");
             file_header.set_file_size(file_size_);
-            fwrite(&file_header, 1, sizeof(file_header), fp_);
-            fflush(fp_);
+            if (!PWriteFull(fd, &file_header, sizeof(file_header), 0)) {
+                log("Write file_header error, task_id=%s", task_id_.c_str());
+                CloseFile();
+                break;
+            }
 
             state_ = kTransferTaskStateUploading;
         }
         
         // 存储
-        if (fp_ == NULL) {
+        if (file_ == NULL) {
             //
             break;
         }
         
-        fwrite(data, 1, data_size, fp_);
-        fflush(fp_);
+        // 重复的块(客户端重发)不再写
+        if (done_segments_[idx]) {
+            log("Recv duplicate segment, offset=%u", offset);
+        } else {
+            if (!PWriteFull(file_->GetFd(), data, data_size, GetFileOffset(offset))) {
+                log("Write data error, task_id=%s, offset=%u", task_id_.c_str(), offset);
+                break;
+            }
+            MarkSegmentDone(idx);
+        }
 
-        ++transfered_idx_;
         SetLastUpdateTime();
 
-        if (transfered_idx_ == sengment_size_) {
+        if (done_cnt_ == segment_cnt_) {
             state_ = kTransferTaskStateUploadEnd;
-            fclose(fp_);
-            fp_ = NULL;
+            CloseFile();
             rv = 1;
         } else {
             rv = 0;
@@ -454,10 +562,10 @@ int OfflineTransferTask::DoRecvData(uint32_t user_id, uint32_t offset, const cha
     return rv;
 }
 
-int OfflineTransferTask::DoPullFileRequest(uint32_t user_id, uint32_t offset, uint32_t data_size, std::string* data) {
+int OfflineTransferTask::DoPullFileRequest(uint32_t user_id, uint32_t offset, uint32_t* data_size) {
     int rv = -1;
     
-    log("Recv pull file request: user_id=%d, offset=%d, data_size=%d", user_id, offset, data_size);
+    log("Recv pull file request: user_id=%d, offset=%u, data_size=%u", user_id, offset, *data_size);
 
     do {
         // 1. 首先检查状态，必须为kTransferTaskStateWaitingDownload或kTransferTaskStateDownloading
@@ -468,150 +576,62 @@ int OfflineTransferTask::DoPullFileRequest(uint32_t user_id, uint32_t offset, ui
         
         // 2. 处理kTransferTaskStateWaitingDownload
         if(state_ == kTransferTaskStateWaitingDownload) {
-            if (transfered_idx_ != 0)
-                transfered_idx_ = 0;
-            
-            if (fp_!=NULL) {
-                fclose(fp_);
-                fp_ = NULL;
-            }
+            ResetSegments();
+            CloseFile();
 
-            fp_ = OpenByRead(task_id_, user_id);
-            if (fp_ == NULL) {
+            int fd = OpenByRead(task_id_, user_id);
+            if (fd == -1) {
                 break;
             }
             
-            //if (file_header_ == NULL) {
-            //    file_header_ = new FileHeader();
-            //}
- 
+            // 检查文件头和文件大小, 之后直接按偏移sendfile
             OfflineFileHeader file_header;
-            size_t size = fread(&file_header, 1, sizeof(file_header), fp_); // read header
-            if (sizeof(file_header) != size) {
+            struct stat st;
+            if (!PReadFull(fd, &file_header, sizeof(file_header), 0) || fstat(fd, &st) != 0 ||
+                    static_cast<uint64_t>(st.st_size) < GetFileOffset(file_size_)) {
                 // close to ensure next time will read again
                 log("read file head failed.");
-                fclose(fp_); // error to get header
-                fp_ = NULL;
+                close(fd);
                 break;
-                
             }
+            file_ = new CSharedFile(fd);
  
             state_ = kTransferTaskStateDownloading;
         } else {
             // 检查文件是否打开
-            if (fp_ == NULL) {
+            if (file_ == NULL) {
                 // 不可能发生
                 break;
             }
         }
         
-        // 检查offset是否有效
-        if (offset != transfered_idx_*SEGMENT_SIZE) {
-            log("Recv offset error, offser=%d, transfered_offset=%d", offset, transfered_idx_*SEGMENT_SIZE);
+        // 检查offset是否有效, 请求可以乱序, 但必须按块对齐
+        uint32_t idx = offset / segment_size_;
+        if (offset % segment_size_ != 0 || idx >= segment_cnt_) {
+            log("Recv offset error, offset=%u, segment_size=%u, segment_cnt=%u", offset, segment_size_, segment_cnt_);
             break;
         }
         
-        data_size = GetNextSegmentBlockSize();
+        // 和原来一样忽略请求里的data_size, 每次发一整块
+        *data_size = GetSegmentBlockSize(idx);
+        MarkSegmentDone(idx);
         
-        log("Ready send data, offset=%d, data_size=%d", offset, data_size);
-        //if (data_size != GetNextSegmentBlockSize()) {
-        //    log("Recv data_size error, data_size=%d, transfered_data_size=%d", data_size, GetNextSegmentBlockSize());
-        //    break;
-        //}
+        log("Ready send data, offset=%u, data_size=%u", offset, *data_size);
 
-        
         // the header won't be sent to recver, because the msg svr had already notified it.
         // if the recver needs to check it, it could be helpful
         // or sometime later, the recver needs it in some way.
         
-            
-        // read data and send based on offset and datasize.
-        char* tmpbuf = new char[data_size];
-        if (NULL == tmpbuf) {
-            // alloc mem failed
-            log("alloc mem failed.");
-            // SendPdu(&pdu);
-            //t->unlock(__LINE__);
-            // return;
-            break;
-        }
-        memset(tmpbuf, 0, data_size);
-        
-        size_t size = fread(tmpbuf, 1, data_size, fp_);
-        if (size != data_size) {
-            log("Read size error, data_size=%d, but read_size=%d", data_size, size);
-            delete [] tmpbuf;
-            break;
-            //
-        }
-        
-        data->append(tmpbuf, data_size);
-        delete [] tmpbuf;
-
-        transfered_idx_++;
-        
         SetLastUpdateTime();
-        if (transfered_idx_ == sengment_size_) {
+        if (done_cnt_ == segment_cnt_) {
+            // 最后一块还要用文件发送, 文件等任务释放或者下次下载时再关闭
             log("pull req end.");
             state_ = kTransferTaskStateUploadEnd;
-            fclose(fp_);
-            fp_ = NULL;
             rv = 1;
         } else {
             rv = 0;
         }
-
-/*      
-        msg2.set_file_data(tmpbuf, size);
-        msg2.set_result_code(0);
-        CImPdu pdu2;
-        pdu2.SetPBMsg(&msg2);
-        pdu2.SetServiceId(SID_FILE);
-        pdu2.SetCommandId(CID_FILE_PULL_DATA_RSP);
-        pdu2.SetSeqNum(pPdu->GetSeqNum());
-        pdu2.SetSeqNum(pPdu->GetSeqNum());
-        SendPdu(&pdu2);
-        delete[] tmpbuf;
-  */
-//        t->transfered_size += size; // record transfered size for next time offset
-
-/*
-        // offset file_header_t
-        int iret = fseek(fp_, sizeof(FileHeader) + offset, SEEK_SET); // read after file_header_t
-        if (0 != iret) {
-            log("seek offset failed.");
-            // SendPdu(&pdu);
-            delete[] tmpbuf;
-            
-            //t->unlock(__LINE__);
-            //return;
-            // offset failed
-            break;
-        }
- */
-        
-        
-/*
-            t->transfered_size += size; // record transfered size for next time offset
-            if (0 == size) {
-                fclose(t->fp);
-                t->fp = NULL;
-                
-                _StatesNotify(CLIENT_FILE_DONE, task_id.c_str(), user_id, this);
-                Close();
-                
-                t->self_destroy = true;
-                t->unlock(__LINE__);
-                return;
-            }
-
- */
-//        rv = 0;
- //       }
-        
     } while (0);
 
     return rv;
 }
-
-
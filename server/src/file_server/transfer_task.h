@@ -9,7 +9,10 @@
 #ifndef FILE_SERVER_TRANSFER_TASK_H_
 #define FILE_SERVER_TRANSFER_TASK_H_
 
+#include <vector>
+
 #include "base/util.h"
+#include "base/OutputQueue.h"
 
 #include "file_server/offline_file_util.h"
 
@@ -193,7 +196,8 @@ public:
     
     virtual int DoRecvData(uint32_t user_id, uint32_t offset, const char* data, uint32_t data_size) { return -1; }
     
-    virtual int DoPullFileRequest(uint32_t user_id, uint32_t offset, uint32_t data_size, std::string* data) { return -1; }
+    // 检查拉取请求, 离线文件通过data_size返回offset处要发送的字节数
+    virtual int DoPullFileRequest(uint32_t user_id, uint32_t offset, uint32_t* data_size) { return -1; }
 
 protected:
     // uint32_t    transfer_mode; // FILE_TYPE_ONLINE realtime, FILE_TYPE_OFFLINE offline / mobile
@@ -232,7 +236,7 @@ public:
     virtual bool CheckByUserIDAndFileRole(uint32_t user_id, int file_role) const;
     
     virtual int DoRecvData(uint32_t user_id, uint32_t offset, const char* data, uint32_t data_size);
-    virtual int DoPullFileRequest(uint32_t user_id, uint32_t offset, uint32_t data_size, std::string* data);
+    virtual int DoPullFileRequest(uint32_t user_id, uint32_t offset, uint32_t* data_size);
     
     void SetSeqNum(uint32_t seq_num) {
         mac_seq_num_ = seq_num;
@@ -247,29 +251,14 @@ private:
 };
 
 //----------------------------------------------------------------------------
-#define SEGMENT_SIZE 32768
-
+// 离线文件按块传输, 块大小由fileserver.conf的SegmentSize配置(默认32K)
+// 1. 上传: 服务端同时向发送方拉取最多UploadWindow块, 回应可以乱序到达, 按offset用pwrite写到文件里
+// 2. 下载: 接收方可以连续发多个拉取请求不等回应, offset按块对齐即可, 数据用sendfile直接从文件发出
+// 两个方向都按块记录是否已经传过, 所有块都传完才算结束
 class OfflineTransferTask : public BaseTransferTask {
 public:
-    OfflineTransferTask(const std::string& task_id, uint32_t from_user_id, uint32_t to_user_id, const std::string& file_name, uint32_t file_size)
-        : BaseTransferTask(task_id, from_user_id, to_user_id, file_name, file_size) {
-//        file_header_ = NULL;
-        fp_ = NULL;
-        transfered_idx_ = 0;
-            
-        sengment_size_ = SetMaxSegmentSize(file_size);
-    }
-
-    virtual ~OfflineTransferTask() {
-//        if (file_header_) {
-//            delete file_header_;
-//            file_header_ = NULL;
-//        }
-        if (fp_) {
-            fclose(fp_);
-            fp_ =NULL;
-        }
-    }
+    OfflineTransferTask(const std::string& task_id, uint32_t from_user_id, uint32_t to_user_id, const std::string& file_name, uint32_t file_size);
+    virtual ~OfflineTransferTask();
     
     static OfflineTransferTask* LoadFromDisk(const std::string& task_id, uint32_t user_id);
     
@@ -280,48 +269,51 @@ public:
     virtual bool CheckByUserIDAndFileRole(uint32_t user_id, int file_role) const;
     
     virtual int DoRecvData(uint32_t user_id, uint32_t offset, const char* data, uint32_t data_size);
-    virtual int DoPullFileRequest(uint32_t user_id, uint32_t offset, uint32_t data_size, std::string* data);
+    virtual int DoPullFileRequest(uint32_t user_id, uint32_t offset, uint32_t* data_size);
    
-    inline int GetSegmentSize() const {
-        return sengment_size_;
+    inline uint32_t GetSegmentCount() const {
+        return segment_cnt_;
     }
     
-    inline int GetNextSegmentBlockSize() {
-        int block_size = SEGMENT_SIZE;
-        if (transfered_idx_+1 == sengment_size_) {
-            block_size = file_size_ - transfered_idx_*SEGMENT_SIZE;
+    inline uint32_t GetSegmentBlockSize(uint32_t idx) const {
+        uint32_t block_size = segment_size_;
+        if (idx+1 == segment_cnt_) {
+            block_size = file_size_ - idx*segment_size_;
         }
         return block_size;
     }
 
-    uint32_t GetNextOffset() const {
-        return SEGMENT_SIZE * transfered_idx_;
-    }
+    // 上传时窗口没满就返回下一个要拉取的块
+    bool GetNextPullRequest(uint32_t* offset, uint32_t* data_size);
     
-private:
-    // 迭代器
-    inline int SetMaxSegmentSize(uint32_t file_size) {
-        int seg_size = file_size / SEGMENT_SIZE;
-        if (file_size_%SEGMENT_SIZE != 0) {
-            seg_size = file_size / SEGMENT_SIZE + 1;
-        }
-        return seg_size;
+    // 下载时正在读的文件, 发送队列里的数据块持有它的引用
+    CSharedFile* GetFile() const {
+        return file_;
     }
-
-    // std::map<uint32_t, upload_package_t*> upload_packages;
-    
-    
-    // uint32_t    transfered_size;    // download size
-    // file_header_t*   file_head;
     
-    // FileHeader* file_header_;
-    FILE*       fp_;
-    
-    // 已经传输
-    int transfered_idx_;
-    int sengment_size_;
+    // 数据在磁盘文件里的偏移, 前面是文件头
+    static uint64_t GetFileOffset(uint32_t offset) {
+        return sizeof(OfflineFileHeader) + offset;
+    }
     
-    // std::map<uint32_t, upload_package_t*> upload_packages;
+private:
+    void CloseFile();
+    // 开始一轮新的上传或下载, 清掉已传输的记录
+    void ResetSegments();
+    // 标记第idx块已经传过, 返回false表示重复
+    bool MarkSegmentDone(uint32_t idx);
+
+    CSharedFile*        file_;
+    
+    uint32_t            segment_size_;
+    uint32_t            segment_cnt_;
+    uint32_t            upload_window_;
+    
+    // 上传时下一个要拉取的块
+    uint32_t            next_pull_idx_;
+    // 已经传输的块
+    uint32_t            done_cnt_;
+    std::vector<bool>   done_segments_;
 };
 
 
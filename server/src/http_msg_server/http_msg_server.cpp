@@ -15,6 +15,7 @@
 #include "HttpConn.h"
 #include "HttpQuery.h"
 #include "util.h"
+#include "MetricsServer.h"
 
 #define DEFAULT_CONCURRENT_DB_CONN_CNT  2
 
@@ -106,6 +107,10 @@ int main(int argc, char* argv[])
 		HTTP::init_route_serv_conn(route_server_list, route_server_count);
 	}
 
+	// 本地端口上的/metrics, 配置了MetricsPort才监听
+	if (metrics_server_init(&config_file) == -1)
+		return -1;
+
 	printf("now enter the event loop...\n");
     
     writePid();
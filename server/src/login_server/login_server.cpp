@@ -11,6 +11,7 @@
 #include "version.h"
 #include "HttpConn.h"
 #include "ipparser.h"
+#include "MetricsServer.h"
 
 IpParser* pIpParser = NULL;
 string strMsfsUrl;
@@ -137,6 +138,10 @@ int main(int argc, char* argv[])
 	init_login_conn();
     init_http_conn();
 
+	// 本地端口上的/metrics, 配置了MetricsPort才监听
+	if (metrics_server_init(&config_file) == -1)
+		return -1;
+
 	printf("now enter the event loop...\n");
     
     writePid();
@@ -0,0 +1,332 @@
+/*
+ * Multimedia Small File Storage System
+ * content addressed blob store implement
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "BlobStore.h"
+#include "FileLin.h"
+#include "util.h"
+
+#define BLOB_REF_SUFFIX		".ref"
+#define BLOB_LINK_SUFFIX	".link"
+#define BLOB_CMP_BUF_SIZE	0x10000
+
+namespace msfs {
+
+int BlobStore::init(const char *disk) {
+	m_root = string(disk) + BLOB_DIR;
+	u64 code = File::mkdirNoRecursion(m_root.c_str());
+	if (code && code != EEXIST) {
+		log("Create dir[%s] error[%d]", m_root.c_str(), (int)code);
+		return -1;
+	}
+	return 0;
+}
+
+bool BlobStore::isDigest(const char *str, u32 len) {
+	if (len < BLOB_DIGEST_LEN)
+		return false;
+	for (u32 i = 0; i < BLOB_DIGEST_LEN; i++) {
+		char c = str[i];
+		if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+			return false;
+	}
+	return true;
+}
+
+string BlobStore::getBlobPath(const string &digest) {
+	return m_root + "/" + digest.substr(0, 2) + "/" + digest.substr(2, 2) + "/" + digest;
+}
+
+string BlobStore::makeRelatePath(const string &digest, const string &suffix) {
+	return string(BLOB_DIR) + "/" + digest.substr(0, 2) + "/" + digest.substr(2, 2) + "/" + digest + suffix;
+}
+
+bool BlobStore::getBlobPathByRelatePath(const string &relate, string &path) {
+	string digest;
+	if (!getDigestByRelatePath(relate, digest))
+		return false;
+	path = getBlobPath(digest);
+	return true;
+}
+
+bool BlobStore::getDigestByRelatePath(const string &relate, string &digest) {
+	//  /sha/ab/cd/<digest>[suffix]
+	static const u32 prefixLen = strlen(BLOB_DIR) + 7;
+	if (relate.size() < prefixLen + BLOB_DIGEST_LEN
+			|| relate.compare(0, strlen(BLOB_DIR) + 1, BLOB_DIR "/") != 0)
+		return false;
+	const char *name = relate.c_str() + prefixLen;
+	if (!isDigest(name, relate.size() - prefixLen))
+		return false;
+	digest.assign(name, BLOB_DIGEST_LEN);
+	if (relate.compare(strlen(BLOB_DIR) + 1, 2, digest, 0, 2) != 0
+			|| relate.compare(strlen(BLOB_DIR) + 4, 2, digest, 2, 2) != 0)
+		return false;
+	return true;
+}
+
+void BlobStore::toBinary(const string &digest, u8 *bin) {
+	for (u32 i = 0; i < BLOB_DIGEST_LEN / 2; i++) {
+		char c1 = digest[i * 2], c2 = digest[i * 2 + 1];
+		bin[i] = ((c1 <= '9' ? c1 - '0' : c1 - 'a' + 10) << 4) | (c2 <= '9' ? c2 - '0' : c2 - 'a' + 10);
+	}
+}
+
+int BlobStore::lookupVolume(const string &digest, needle_location_t *loc) {
+	if (!m_volumeStore || digest.size() != BLOB_DIGEST_LEN)
+		return -1;
+	u8 bin[VOLUME_DIGEST_SIZE];
+	toBinary(digest, bin);
+	return m_volumeStore->lookup(bin, loc);
+}
+
+CriticalSection& BlobStore::getLock(const string &digest) {
+	return m_locks[strtoul(digest.substr(0, 2).c_str(), NULL, 16) % BLOB_LOCK_CNT];
+}
+
+int BlobStore::makeBlobDir(const string &digest) {
+	string dir = m_root + "/" + digest.substr(0, 2);
+	u64 code = File::mkdirNoRecursion(dir.c_str());
+	if (code && code != EEXIST)
+		return -1;
+	dir += "/" + digest.substr(2, 2);
+	code = File::mkdirNoRecursion(dir.c_str());
+	if (code && code != EEXIST)
+		return -1;
+	return 0;
+}
+
+int BlobStore::store(const string &srcPath, const string &digest, u64 size, bool keepLink) {
+	if (!isDigest(digest.c_str(), digest.size()) || digest.size() != BLOB_DIGEST_LEN)
+		return BLOB_ERROR;
+
+	string blobPath = getBlobPath(digest);
+	CriticalSection &cs = getLock(digest);
+	cs.Enter();
+
+	if (m_volumeStore && !keepLink) {
+		bool stored = false;
+		int ret = storeVolume(srcPath, digest, size, &stored);
+		if (stored) {
+			cs.Leave();
+			return ret;
+		}
+	}
+
+	struct stat buf;
+	if (stat(blobPath.c_str(), &buf) != 0) {
+		int ret = BLOB_NEW;
+		if (makeBlobDir(digest) != 0) {
+			ret = BLOB_ERROR;
+		} else if (keepLink) {
+			if (link(srcPath.c_str(), blobPath.c_str()) != 0)
+				ret = BLOB_ERROR;
+		} else if (rename(srcPath.c_str(), blobPath.c_str()) != 0) {
+			ret = BLOB_ERROR;
+		}
+		cs.Leave();
+		if (ret == BLOB_ERROR)
+			log("Store blob[%s] from [%s] error[%d]", blobPath.c_str(), srcPath.c_str(), errno);
+		return ret;
+	}
+
+	//hash相同再逐字节确认, 内容不同时不去重
+	if ((u64)buf.st_size != size || !sameContent(srcPath, blobPath, size)) {
+		cs.Leave();
+		log("Blob digest collision, digest=%s, file=%s", digest.c_str(), srcPath.c_str());
+		return BLOB_COLLISION;
+	}
+
+	struct stat srcBuf;
+	if (keepLink && stat(srcPath.c_str(), &srcBuf) == 0 && srcBuf.st_ino == buf.st_ino
+			&& srcBuf.st_dev == buf.st_dev) {
+		//已经是这个blob的硬链接(迁移工具重复执行)
+		cs.Leave();
+		return BLOB_DUPLICATE;
+	}
+
+	int ret = incRef(blobPath);
+	if (ret == 0) {
+		if (keepLink)
+			ret = replaceWithLink(blobPath, srcPath);
+		else
+			unlink(srcPath.c_str());
+	}
+	cs.Leave();
+	return (ret == 0) ? BLOB_DUPLICATE : BLOB_ERROR;
+}
+
+int BlobStore::storeVolume(const string &srcPath, const string &digest, u64 size, bool *stored) {
+	u8 bin[VOLUME_DIGEST_SIZE];
+	toBinary(digest, bin);
+	needle_location_t loc;
+	if (m_volumeStore->lookup(bin, &loc) == 0) {
+		*stored = true;
+		int fd = ::open(srcPath.c_str(), O_RDONLY);
+		bool same = (fd != -1 && loc.size == size && sameContent(fd, 0, loc.fd, loc.offset, size));
+		if (fd != -1)
+			::close(fd);
+		if (!same) {
+			log("Blob digest collision in volume, file=%s", srcPath.c_str());
+			return BLOB_COLLISION;
+		}
+		if (m_volumeStore->addRef(bin, 1) < 0)
+			return BLOB_ERROR;
+		unlink(srcPath.c_str());
+		return BLOB_DUPLICATE;
+	}
+
+	//打包存储之前就单独存了的内容, 还按单独的文件去重
+	struct stat buf;
+	if (stat(getBlobPath(digest).c_str(), &buf) == 0 || size > 0xffffffffULL)
+		return BLOB_ERROR;
+	int fd = ::open(srcPath.c_str(), O_RDONLY);
+	if (fd == -1)
+		return BLOB_ERROR;
+	int ret = m_volumeStore->append(bin, fd, (u32)size);
+	::close(fd);
+	if (ret != 0)
+		return BLOB_ERROR;
+	unlink(srcPath.c_str());
+	*stored = true;
+	return BLOB_NEW;
+}
+
+int BlobStore::getRefCount(const string &digest) {
+	string blobPath = getBlobPath(digest);
+	CriticalSection &cs = getLock(digest);
+	cs.Enter();
+	int refCount = 0;
+	struct stat buf;
+	needle_location_t loc;
+	if (lookupVolume(digest, &loc) == 0)
+		refCount = loc.refCount;
+	else if (stat(blobPath.c_str(), &buf) == 0)
+		refCount = readRef(blobPath);
+	cs.Leave();
+	return refCount;
+}
+
+int BlobStore::release(const string &digest) {
+	if (!isDigest(digest.c_str(), digest.size()) || digest.size() != BLOB_DIGEST_LEN)
+		return -1;
+
+	string blobPath = getBlobPath(digest);
+	CriticalSection &cs = getLock(digest);
+	cs.Enter();
+	int refCount = -1;
+	struct stat buf;
+	if (m_volumeStore) {
+		u8 bin[VOLUME_DIGEST_SIZE];
+		toBinary(digest, bin);
+		refCount = m_volumeStore->addRef(bin, -1);
+	}
+	if (refCount < 0 && stat(blobPath.c_str(), &buf) == 0) {
+		refCount = readRef(blobPath) - 1;
+		string refPath = blobPath + BLOB_REF_SUFFIX;
+		if (refCount > 1) {
+			if (writeRef(blobPath, refCount) != 0)
+				refCount = -1;
+		} else if (refCount == 1) {
+			//计数为1时没有计数文件
+			unlink(refPath.c_str());
+		} else if (unlink(blobPath.c_str()) != 0) {
+			log("Remove blob[%s] error[%d]", blobPath.c_str(), errno);
+			refCount = -1;
+		} else {
+			unlink(refPath.c_str());
+		}
+	}
+	cs.Leave();
+	return refCount;
+}
+
+//调用者持有锁
+int BlobStore::readRef(const string &blobPath) {
+	string refPath = blobPath + BLOB_REF_SUFFIX;
+	int fd = ::open(refPath.c_str(), O_RDONLY);
+	if (fd == -1)
+		return 1;
+	char buf[32] = {0};
+	ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+	::close(fd);
+	int refCount = (len > 0) ? atoi(buf) : 0;
+	return (refCount > 0) ? refCount : 1;
+}
+
+//调用者持有锁
+int BlobStore::incRef(const string &blobPath) {
+	return writeRef(blobPath, readRef(blobPath) + 1);
+}
+
+//调用者持有锁, 计数定长写, 不用截断文件
+int BlobStore::writeRef(const string &blobPath, int refCount) {
+	string refPath = blobPath + BLOB_REF_SUFFIX;
+	int fd = ::open(refPath.c_str(), O_WRONLY | O_CREAT, 00640);
+	if (fd == -1) {
+		log("Open ref file[%s] error[%d]", refPath.c_str(), errno);
+		return -1;
+	}
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), "%020d\n", refCount);
+	int ret = (pwrite(fd, buf, len, 0) == len) ? 0 : -1;
+	::close(fd);
+	return ret;
+}
+
+bool BlobStore::sameContent(const string &path1, const string &path2, u64 size) {
+	int fd1 = ::open(path1.c_str(), O_RDONLY);
+	if (fd1 == -1)
+		return false;
+	int fd2 = ::open(path2.c_str(), O_RDONLY);
+	if (fd2 == -1) {
+		::close(fd1);
+		return false;
+	}
+	bool same = sameContent(fd1, 0, fd2, 0, size);
+	::close(fd1);
+	::close(fd2);
+	return same;
+}
+
+bool BlobStore::sameContent(int fd1, u64 offset1, int fd2, u64 offset2, u64 size) {
+	char *buf1 = new char[BLOB_CMP_BUF_SIZE];
+	char *buf2 = new char[BLOB_CMP_BUF_SIZE];
+	bool same = true;
+	u64 offset = 0;
+	while (same && offset < size) {
+		u32 len = (size - offset > BLOB_CMP_BUF_SIZE) ? BLOB_CMP_BUF_SIZE : (u32)(size - offset);
+		if (pread(fd1, buf1, len, offset1 + offset) != (ssize_t)len
+				|| pread(fd2, buf2, len, offset2 + offset) != (ssize_t)len || memcmp(buf1, buf2, len) != 0)
+			same = false;
+		offset += len;
+	}
+	delete [] buf1;
+	delete [] buf2;
+	return same;
+}
+
+int BlobStore::replaceWithLink(const string &blobPath, const string &path) {
+	string tmpPath = path + BLOB_LINK_SUFFIX;
+	unlink(tmpPath.c_str());
+	if (link(blobPath.c_str(), tmpPath.c_str()) != 0) {
+		log("Link [%s] to [%s] error[%d]", tmpPath.c_str(), blobPath.c_str(), errno);
+		return -1;
+	}
+	if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+		log("Rename [%s] to [%s] error[%d]", tmpPath.c_str(), path.c_str(), errno);
+		unlink(tmpPath.c_str());
+		return -1;
+	}
+	return 0;
+}
+
+}
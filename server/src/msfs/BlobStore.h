@@ -0,0 +1,92 @@
+/*
+ * Multimedia Small File Storage System
+ * 按内容寻址的文件存储, 相同内容只存一份:
+ * 1. 文件按SHA-256存在 <disk>/sha/ab/cd/<digest>, ab和cd是digest的前两个字节, 一个目录下的文件不会太多
+ * 2. digest相同时逐字节比较确认内容相同, 真的碰撞时不去重, 由调用者按原来的方式存
+ * 3. 引用计数为指向这个blob的url个数, 为1时没有计数文件, 大于1时记在 <digest>.ref 里;
+ *    上传去重时加1, release减1, 减到0时删掉blob(卷里的needle标记删除, 空间等compact回收).
+ *    msfs没有删除url的接口, 目前由维护工具msfs_volume -r调用release
+ * 4. 同一个blob的存入和计数修改按digest分段加锁, 不同内容的上传互不影响;
+ *    迁移工具和msfs不能同时修改同一个目录
+ * 5. 设置了VolumeStore时新内容打包追加到卷文件里, 不再单独建文件; url不变, 下载时先查卷再查单独的文件
+ */
+
+#ifndef _BLOBSTORE_H_
+#define _BLOBSTORE_H_
+
+#include <pthread.h>
+#include <string>
+#include "Portable.h"
+#include "CriticalSection.h"
+#include "VolumeStore.h"
+
+using namespace std;
+
+#define BLOB_DIR			"/sha"
+#define BLOB_DIGEST_LEN		64		//十六进制的SHA-256
+#define BLOB_LOCK_CNT		64
+
+namespace msfs {
+
+enum {
+	BLOB_ERROR = -1,
+	BLOB_NEW = 0,			//第一次存这个内容
+	BLOB_DUPLICATE,			//已经有相同内容的blob, 引用计数加1
+	BLOB_COLLISION,			//digest相同但内容不同
+};
+
+class BlobStore {
+public:
+	BlobStore() { m_volumeStore = NULL; }
+	~BlobStore() {}
+
+	int init(const char *disk);
+	void setVolumeStore(VolumeStore *volumeStore) { m_volumeStore = volumeStore; }
+
+	/*
+	 * 把srcPath的文件存成digest对应的blob, 返回BLOB_xxx:
+	 * keepLink为false时(上传): 新内容把srcPath rename过去, 重复内容删掉srcPath;
+	 * keepLink为true时(迁移老文件): srcPath保留, 和blob是同一个inode的硬链接, 老的url继续可以访问;
+	 * 打包存储时keepLink为false的新内容写到卷里, 卷里digest前8字节冲突或者写失败时还是单独存文件
+	 */
+	int store(const string &srcPath, const string &digest, u64 size, bool keepLink);
+	int getRefCount(const string &digest);
+	/*
+	 * 引用计数减1, 返回剩下的计数, 为0时blob已经删除; 没有这个blob或者出错返回-1.
+	 * 只删blob自己的路径, 迁移时和blob硬链接在一起的老路径由调用者删
+	 */
+	int release(const string &digest);
+
+	string getBlobPath(const string &digest);
+	//相对路径(如/sha/ab/cd/<digest>_100x200.png)是不是blob的url, 是的话返回blob的绝对路径
+	bool getBlobPathByRelatePath(const string &relate, string &path);
+	static bool getDigestByRelatePath(const string &relate, string &digest);
+	//在卷里查十六进制的digest, 不在卷里(没有打包存储或者单独存的文件)返回-1
+	int lookupVolume(const string &digest, needle_location_t *loc);
+	static bool isDigest(const char *str, u32 len);
+	static void toBinary(const string &digest, u8 *bin);
+	//url里的相对路径, 后缀是原来文件名的扩展名或尺寸, 下载时按后缀判断Content-Type
+	static string makeRelatePath(const string &digest, const string &suffix);
+
+private:
+	int makeBlobDir(const string &digest);
+	int incRef(const string &blobPath);
+	int readRef(const string &blobPath);
+	int writeRef(const string &blobPath, int refCount);
+	static bool sameContent(int fd1, u64 offset1, int fd2, u64 offset2, u64 size);
+	static bool sameContent(const string &path1, const string &path2, u64 size);
+	//调用者持有锁, 返回BLOB_xxx, 不能放进卷时返回BLOB_ERROR且srcPath还在
+	int storeVolume(const string &srcPath, const string &digest, u64 size, bool *stored);
+	//用硬链接原子地把path替换成blobPath
+	static int replaceWithLink(const string &blobPath, const string &path);
+	CriticalSection &getLock(const string &digest);
+
+private:
+	string			m_root;		//<disk>/sha
+	VolumeStore		*m_volumeStore;
+	CriticalSection	m_locks[BLOB_LOCK_CNT];
+};
+
+}
+
+#endif
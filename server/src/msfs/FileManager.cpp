@@ -10,6 +10,8 @@
 #include <iostream>
 #include <sys/mount.h>
 #include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <time.h>
 #include "FileManager.h"
@@ -17,10 +19,23 @@
 #include "StringUtils.h"
 #include "util.h"
 #include "Base64.h"
+#include "atomic.h"
 
 using namespace std;
 
+#define UPLOAD_TMP_DIR	"/tmp"
+
 namespace msfs {
+static double get_cache_bytes(void* user_data)
+{
+	return (double)((FileManager*)user_data)->getCacheBytes();
+}
+
+static double get_cache_entries(void* user_data)
+{
+	return (double)((FileManager*)user_data)->getCacheEntries();
+}
+
 //创建名称为000～255的文件夹，每个文件夹里面会有000～255个子目录，这些目录用于存放聊天图片
 int FileManager::initDir() {
 		bool isExist = File::isExist(m_disk);
@@ -56,6 +71,28 @@ int FileManager::initDir() {
 			}
 			memset(first, 0x0, 10);
 		}
+
+		if (m_blobStore.init(m_disk) != 0)
+			return -1;
+
+		//上传的临时文件, 上次退出时没写完的直接删掉
+		string tmpDir = string(m_disk) + UPLOAD_TMP_DIR;
+		int code = File::mkdirNoRecursion(tmpDir.c_str());
+		if (code && (errno != EEXIST)) {
+			log("Create dir[%s] error[%d]", tmpDir.c_str(), errno);
+			return -1;
+		}
+		DIR *dp = opendir(tmpDir.c_str());
+		if (dp) {
+			struct dirent *ep = NULL;
+			while ((ep = readdir(dp)) != NULL) {
+				if (ep->d_name[0] == '.')
+					continue;
+				string tmpFile = tmpDir + "/" + ep->d_name;
+				unlink(tmpFile.c_str());
+			}
+			closedir(dp);
+		}
 		
 		return 0;
 	}
@@ -88,6 +125,28 @@ int FileManager::uploadFile(const char *type, const void* content, u32 size,
 		return -1;
 	}
 
+	string fullUrl;
+	string path = createUploadPath(type, ext, fullUrl);
+	strncpy(url, fullUrl.c_str(), strlen(fullUrl.c_str()));
+
+	//不再往缓存里拷一份, 第一次下载时再mmap进缓存
+	//open and write file then close
+	string absPath = string(m_disk) + path;
+	File * tmpFile = new File(absPath.c_str());
+	tmpFile->create();
+	tmpFile->write(0, size, content);
+	delete tmpFile;
+	tmpFile = NULL;
+
+	//increase total file sum
+	m_filesCs.Enter();
+	m_totFiles++;
+	m_filesCs.Leave();
+	
+	return 0;
+}
+
+string FileManager::createUploadPath(const char *type, const char *ext, string &url) {
 	//append the type suffix
 	string path = createFileRelatePath();
 	if (ext)
@@ -97,31 +156,140 @@ int FileManager::uploadFile(const char *type, const void* content, u32 size,
 	
 	//construct url with group num
 	string groups("g0");
-	string fullUrl = groups + path;
-	strncpy(url, fullUrl.c_str(), strlen(fullUrl.c_str()));
+	url = groups + path;
+	return path;
+}
 
-	//insert map file cache
-	m_cs.Enter();
-	insertEntry(fullUrl, (u64)size, content);
-	updateMapCache();
-	m_cs.Leave();
-	
-	//open and write file then close
+int FileManager::createUploadFile(string &tmpPath) {
+	char name[64];
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	u32 seq = ATOMIC_ADD_AND_FETCH(&m_uploadSeq, 1);
+	snprintf(name, sizeof(name), "/%llu_%u.part", (u64)tv.tv_sec * 1000000 + tv.tv_usec, seq);
+	tmpPath = string(m_disk) + UPLOAD_TMP_DIR + name;
+
+	int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 00640);
+	if (fd == -1) {
+		log("Create upload file[%s] error[%d]", tmpPath.c_str(), errno);
+	}
+	return fd;
+}
+
+int FileManager::commitUploadFile(const string &tmpPath, const string &digest, u64 size, const char *type,
+		char *url, const char *ext) {
+	if (m_dedup && !digest.empty()) {
+		int ret = m_blobStore.store(tmpPath, digest, size, false);
+		if (ret == BLOB_NEW || ret == BLOB_DUPLICATE) {
+			string suffix = ext ? "_" + string(ext) : "." + string(type);
+			string fullUrl = "g0" + BlobStore::makeRelatePath(digest, suffix);
+			strncpy(url, fullUrl.c_str(), strlen(fullUrl.c_str()));
+			m_logicalBytesCounter->Inc(size);
+			if (ret == BLOB_NEW) {
+				m_dedupNewCounter->Inc();
+				m_storedBytesCounter->Inc(size);
+			} else {
+				m_dedupDupCounter->Inc();
+			}
+			return 0;
+		}
+		if (ret == BLOB_COLLISION)
+			m_dedupCollisionCounter->Inc();
+		//出错或者碰撞时临时文件还在, 按原来的方式存
+	}
+
+	string fullUrl;
+	string path = createUploadPath(type, ext, fullUrl);
 	string absPath = string(m_disk) + path;
-	File * tmpFile = new File(absPath.c_str());
-	tmpFile->create();
-	tmpFile->write(0, size, content);
-	delete tmpFile;
-	tmpFile = NULL;
+	if (rename(tmpPath.c_str(), absPath.c_str()) != 0) {
+		log("Rename [%s] to [%s] error[%d]", tmpPath.c_str(), absPath.c_str(), errno);
+		return -1;
+	}
+	strncpy(url, fullUrl.c_str(), strlen(fullUrl.c_str()));
 
 	//increase total file sum
 	m_filesCs.Enter();
 	m_totFiles++;
 	m_filesCs.Leave();
-	
+	if (m_logicalBytesCounter) {
+		m_logicalBytesCounter->Inc(size);
+		m_storedBytesCounter->Inc(size);
+	}
 	return 0;
 }
 
+void FileManager::initDedup(bool enable) {
+	m_dedup = enable;
+
+	CMetricsRegistry* pRegistry = CMetricsRegistry::getInstance();
+	m_dedupNewCounter = pRegistry->GetCounter("teamtalk_msfs_dedup_uploads_total",
+			"uploads by content dedup result", metrics_label("result", "new"));
+	m_dedupDupCounter = pRegistry->GetCounter("teamtalk_msfs_dedup_uploads_total",
+			"uploads by content dedup result", metrics_label("result", "duplicate"));
+	m_dedupCollisionCounter = pRegistry->GetCounter("teamtalk_msfs_dedup_uploads_total",
+			"uploads by content dedup result", metrics_label("result", "collision"));
+	m_logicalBytesCounter = pRegistry->GetCounter("teamtalk_msfs_upload_logical_bytes_total",
+			"bytes of files uploaded by clients");
+	m_storedBytesCounter = pRegistry->GetCounter("teamtalk_msfs_upload_stored_bytes_total",
+			"bytes of uploaded files actually stored after dedup");
+	pRegistry->AddCallback(METRIC_TYPE_GAUGE, "teamtalk_msfs_dedup_ratio",
+			"uploaded bytes / stored bytes since start", "", getDedupRatio, this);
+	log("content dedup %s", enable ? "enabled" : "disabled");
+}
+
+int FileManager::initVolume(bool enable, u64 volumeSize) {
+	if (!enable)
+		return 0;
+	if (!m_dedup) {
+		log("volume store needs content dedup, ignored");
+		return 0;
+	}
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	if (m_volumeStore.init(m_disk, volumeSize) != 0)
+		return -1;
+	gettimeofday(&end, NULL);
+	m_blobStore.setVolumeStore(&m_volumeStore);
+
+	CMetricsRegistry* pRegistry = CMetricsRegistry::getInstance();
+	pRegistry->AddCallback(METRIC_TYPE_GAUGE, "teamtalk_msfs_volume_needles",
+			"blobs stored in packed volumes", "", getVolumeNeedles, this);
+	pRegistry->AddCallback(METRIC_TYPE_GAUGE, "teamtalk_msfs_volume_bytes",
+			"bytes of packed volume files", metrics_label("kind", "data"), getVolumeDataBytes, this);
+	pRegistry->AddCallback(METRIC_TYPE_GAUGE, "teamtalk_msfs_volume_bytes",
+			"bytes of packed volume files", metrics_label("kind", "live"), getVolumeLiveBytes, this);
+	log("volume store enabled, volume size=%llu, needles=%llu, load time=%lldms", volumeSize,
+			m_volumeStore.getNeedleCnt(), ((s64)(end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec) / 1000);
+	return 0;
+}
+
+double FileManager::getVolumeNeedles(void *userData) {
+	return (double)((FileManager *)userData)->m_volumeStore.getNeedleCnt();
+}
+
+double FileManager::getVolumeDataBytes(void *userData) {
+	vector<volume_stat_t> list;
+	((FileManager *)userData)->m_volumeStore.getVolumeStat(list);
+	u64 bytes = 0;
+	for (u32 i = 0; i < list.size(); i++)
+		bytes += list[i].dataBytes;
+	return (double)bytes;
+}
+
+double FileManager::getVolumeLiveBytes(void *userData) {
+	vector<volume_stat_t> list;
+	((FileManager *)userData)->m_volumeStore.getVolumeStat(list);
+	u64 bytes = 0;
+	for (u32 i = 0; i < list.size(); i++)
+		bytes += list[i].liveBytes;
+	return (double)bytes;
+}
+
+double FileManager::getDedupRatio(void *userData) {
+	FileManager *fm = (FileManager *)userData;
+	u64 stored = fm->m_storedBytesCounter->Value();
+	return stored ? (double)fm->m_logicalBytesCounter->Value() / stored : 1.0;
+}
+
 int FileManager::getRelatePathByUrl(const string &url, string &path) {
 	string::size_type pos = url.find("/");
 	if (string::npos == pos) {
@@ -138,150 +306,257 @@ int FileManager::getAbsPathByUrl(const string &url, string &path) {
 		log("Get path from url[%s] error", url.c_str());
 		return -1;
 	}
+	//去重存储的url: g0/sha/ab/cd/<digest>后缀, 后缀不同的url指向同一个blob
+	if (m_blobStore.getBlobPathByRelatePath(relate, path))
+		return 0;
 	path = string(m_disk) + relate;
 	return 0;
 }
 
 
-FileManager::Entry* 
-FileManager::getOrCreateEntry(const std::string& url, bool create) {
+void FileManager::initCache(u64 cacheSize, u64 maxFileSize) {
+	m_cacheLimit = cacheSize;
+	m_cacheMaxFileSize = (maxFileSize < cacheSize) ? maxFileSize : cacheSize;
+
+	CMetricsRegistry* pRegistry = CMetricsRegistry::getInstance();
+	m_hitCounter = pRegistry->GetCounter("teamtalk_msfs_cache_requests_total",
+			"downloads by file cache result", metrics_label("result", "hit"));
+	m_missCounter = pRegistry->GetCounter("teamtalk_msfs_cache_requests_total",
+			"downloads by file cache result", metrics_label("result", "miss"));
+	m_uncachedCounter = pRegistry->GetCounter("teamtalk_msfs_cache_requests_total",
+			"downloads by file cache result", metrics_label("result", "uncached"));
+	m_evictCounter = pRegistry->GetCounter("teamtalk_msfs_cache_evictions_total",
+			"files evicted from the download cache");
+	pRegistry->AddCallback(METRIC_TYPE_GAUGE, "teamtalk_msfs_cache_bytes",
+			"bytes of files mapped in the download cache", "", get_cache_bytes, this);
+	pRegistry->AddCallback(METRIC_TYPE_GAUGE, "teamtalk_msfs_cache_entries",
+			"files in the download cache", "", get_cache_entries, this);
+	log("file cache size=%llu, max file size=%llu", m_cacheLimit, m_cacheMaxFileSize);
+}
+
+int FileManager::openFileByUrl(const string &url, Entry **entry, int *fd, u64 *offset, u64 *size) {
+	*entry = NULL;
+	*fd = -1;
+	*offset = 0;
+
+	//按文件路径缓存, 去重后后缀不同的url共用一个缓存项
+	string path;
+	if (getAbsPathByUrl(url, path)) {
+		log("Get abs path from url[%s] error", url.c_str());
+		return -1;
+	}
+
 	m_cs.Enter();
-	EntryMap::iterator it = m_map.find(url);
+	EntryMap::iterator it = m_map.find(path);
 	if (it != m_map.end()) {
-		log("the map has the file while url:%s", url.c_str());
+		Entry *e = it->second;
+		unlinkEntry(e);
+		linkFront(e);
+		ATOMIC_ADD(&e->m_refCount, 1);
 		m_cs.Leave();
-		return it->second;
+		m_hitCounter->Inc();
+		*entry = e;
+		*size = e->m_fileSize;
+		return 0;
 	}
-	if (!create) {
-		m_cs.Leave();
-		return NULL;
+	m_cs.Leave();
+
+	//打开和映射文件不持有锁, 不挡住其他线程的命中; 卷里的文件不用open, 直接映射卷文件的一段
+	Entry *e = NULL;
+	needle_location_t loc;
+	if (lookupVolume(url, &loc) == 0) {
+		*size = loc.size;
+		e = loadVolumeEntry(path, loc, fd, offset);
+	} else {
+		e = loadEntry(path, fd, size);
 	}
-	
-	string path;
-	if (getAbsPathByUrl(url, path)) {
-		log("Get abs path from url[%s] error", url.c_str());
-		m_cs.Leave();
-		return NULL;
+	if (!e) {
+		return (*fd == -1) ? -1 : 0;
 	}
-    
-    struct stat buf;
-    if(stat(path.c_str(), &buf) == -1)
-    {
-        m_cs.Leave();
-        return NULL;
-    }
-    
-    if(!S_ISREG(buf.st_mode))
-    {
-        m_cs.Leave();
-        return NULL;
-    }
-    
+	m_missCounter->Inc();
 
-	Entry *e = new Entry();
-	u64 fileSize = File::getFileSize(path.c_str());
-	e->m_fileSize = fileSize;
-	e->m_fileContent = new byte[fileSize];
-	memset(e->m_fileContent, 0x0, fileSize);
-	e->m_lastAccess = time(NULL);
-	File* tmpFile = new File(path.c_str());
-	tmpFile->open();
-	int ret = tmpFile->read(0, fileSize, e->m_fileContent);
-	if (ret) {
-		log("read file error while url:%s", url.c_str());
-		delete e;
-		e = NULL;
-		delete tmpFile;
-		tmpFile = NULL;
+	m_cs.Enter();
+	it = m_map.find(path);
+	if (it != m_map.end()) {
+		//别的线程同时加载了同一个文件, 用先放进缓存的那个
+		Entry *old = it->second;
+		unlinkEntry(old);
+		linkFront(old);
+		ATOMIC_ADD(&old->m_refCount, 1);
 		m_cs.Leave();
-		return NULL;
-	}
-	delete tmpFile;
-	tmpFile = NULL;
-	
-	std::pair < map <std::string, Entry*>::iterator, bool> result;
-	result = m_map.insert(EntryMap::value_type(url, e));
-	if (result.second == false) {
-		log("Insert url[%s] to file map error", url.c_str());
 		delete e;
-		e = NULL;
+		*entry = old;
+		return 0;
 	}
-	updateMapCache();
+	ATOMIC_ADD(&e->m_refCount, 1);	//缓存持有一个, 调用者持有一个
+	m_map.insert(EntryMap::value_type(path, e));
+	linkFront(e);
+	m_cacheBytes += e->m_fileSize;
+	evictEntries();
 	m_cs.Leave();
-	return e;
+
+	*entry = e;
+	return 0;
 }
 
-int FileManager::downloadFileByUrl(char *url, void *buf, u32 *size) {
-	Entry* en = getOrCreateEntry(url, true);
-	if (!en) {
-		log("download file error, while url:%s", url);
-		return -1;
+void FileManager::releaseEntry(Entry *entry) {
+	if (ATOMIC_SUB_AND_FETCH(&entry->m_refCount, 1) == 0)
+		delete entry;
+}
+
+void FileManager::prefaultEntry(const Entry *entry, u64 offset, u64 len) {
+	static const u64 pageSize = (u64)sysconf(_SC_PAGESIZE);
+	if (!entry->m_fileContent || offset >= entry->m_fileSize)
+		return;
+	if (len > entry->m_fileSize - offset)
+		len = entry->m_fileSize - offset;
+	if (len == 0)
+		return;
+
+	//缓存命中时页面可能已经被回收了, 先让内核批量读回来, 再逐页访问确认都在内存里
+	const u8 *begin = entry->m_fileContent + offset;
+	u8 *alignedBegin = (u8*)((uintptr_t)begin & ~(uintptr_t)(pageSize - 1));
+	madvise(alignedBegin, (size_t)(begin + len - alignedBegin), MADV_WILLNEED);
+	volatile u8 sum = 0;
+	for (const u8 *p = begin; p < begin + len; p += pageSize)
+		sum += *p;
+	sum += *(begin + len - 1);
+}
+
+void FileManager::prefetchFile(int fd, u64 offset, u64 len) {
+	if (len == 0)
+		return;
+#ifdef __linux__
+	if (readahead(fd, (off64_t)offset, (size_t)len) == 0)
+		return;
+#endif
+	//不支持readahead时读一遍, 数据丢掉, 只为了进page cache
+	char buf[0x10000];
+	while (len > 0) {
+		ssize_t ret = pread(fd, buf, len > sizeof(buf) ? sizeof(buf) : (size_t)len, (off_t)offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		offset += ret;
+		len -= ret;
 	}
-	memcpy(buf, en->m_fileContent, en->m_fileSize);
-	*size = (u32)en->m_fileSize;
-	en->m_lastAccess = time(NULL);//todo:need prodect with mutex
-	return 0;
 }
 
-void FileManager::updateMapCache() {
-	size_t currSize = m_map.size();
-	if (currSize > MAX_FILE_IN_MAP) {
-		EntryMap::iterator it = m_map.begin();
-		int times = abs(MAX_FILE_IN_MAP - currSize);
-		while (it != m_map.end() && times) {
-			delete it->second;
-			m_map.erase(it++);
-			times--;
-		}
+u64 FileManager::getCacheEntries() {
+	m_cs.Enter();
+	u64 cnt = m_map.size();
+	m_cs.Leave();
+	return cnt;
+}
 
-		it = m_map.begin();
-		while (it != m_map.end() && times) {
-			time_t currTime = time(NULL);
-			if(currTime - it->second->m_lastAccess > 2*60*60) {
-				delete it->second;
-				m_map.erase(it++);
-			}
-		}
+FileManager::Entry* FileManager::loadEntry(const string &path, int *fd, u64 *size) {
+	int file = ::open(path.c_str(), O_RDONLY);
+	if (file == -1) {
+		return NULL;
+	}
+
+	struct stat buf;
+	if (fstat(file, &buf) == -1 || !S_ISREG(buf.st_mode)) {
+		::close(file);
+		return NULL;
+	}
+	*size = (u64)buf.st_size;
+
+	Entry *e = NULL;
+	if (*size <= m_cacheMaxFileSize)
+		e = mapEntry(path, file, 0, *size);
+	if (!e) {
+		//太大或者映射失败时用sendfile
+		m_uncachedCounter->Inc();
+		*fd = file;
+		return NULL;
 	}
+	::close(file);
+	return e;
 }
 
-int FileManager::insertEntry(const std::string& url, size_t fileSize, 
-							const void* content) {
-	if (m_map.size()) {
-		EntryMap::iterator it = m_map.find(url);
-		if (it != m_map.end()) 
-			return -1;
+int FileManager::lookupVolume(const string &url, needle_location_t *loc) {
+	string relate, digest;
+	if (!m_volumeStore.isOpened() || getRelatePathByUrl(url, relate)
+			|| !BlobStore::getDigestByRelatePath(relate, digest))
+		return -1;
+	return m_blobStore.lookupVolume(digest, loc);
+}
+
+FileManager::Entry* FileManager::loadVolumeEntry(const string &path, const needle_location_t &loc, int *fd,
+		u64 *offset) {
+	Entry *e = NULL;
+	if (loc.size <= m_cacheMaxFileSize)
+		e = mapEntry(path, loc.fd, loc.offset, loc.size);
+	if (!e) {
+		//卷文件的fd一直开着, dup一个给发送用, 发完close不影响卷
+		m_uncachedCounter->Inc();
+		*fd = dup(loc.fd);
+		*offset = loc.offset;
 	}
+	return e;
+}
+
+FileManager::Entry* FileManager::mapEntry(const string &path, int file, u64 offset, u64 size) {
+	static const u64 pageMask = (u64)sysconf(_SC_PAGESIZE) - 1;
 	Entry *e = new Entry();
-	e->m_fileSize = fileSize;
-	e->m_fileContent = new byte[fileSize];
-	e->m_lastAccess = time(NULL);
-	memcpy(e->m_fileContent, content, fileSize);
-	
-	m_cs.Enter();
-	pair< map<std::string, Entry*>::iterator, bool> ret;
-	ret = m_map.insert(EntryMap::value_type(url, e));
-	if (ret.second == false) {
-		delete e;
-		e = NULL;
+	e->m_path = path;
+	e->m_fileSize = (size_t)size;
+	if (size > 0) {
+		u64 delta = offset & pageMask;
+		e->m_mapLen = (size_t)(size + delta);
+		int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+		//在工作线程里一次把页面读进来, 主线程发送时不再缺页
+		flags |= MAP_POPULATE;
+#endif
+		void *addr = mmap(NULL, e->m_mapLen, PROT_READ, flags, file, offset - delta);
+		if (addr == MAP_FAILED) {
+			log("mmap file[%s] error[%d]", path.c_str(), errno);
+			e->m_mapLen = 0;
+			delete e;
+			return NULL;
+		}
+		e->m_mapAddr = addr;
+		e->m_fileContent = (u8*)addr + delta;
 	}
-	updateMapCache();
-	m_cs.Leave();
-	return 0;
+	return e;
 }
 
-void FileManager::releaseFileCache(const std::string& url) {
-	m_cs.Enter();
-	const Entry* entry = getEntry(url);
-	if (!entry) {
-		log("map has not the url::%s", url.c_str());
-        m_cs.Leave();
-		return;
+void FileManager::linkFront(Entry *entry) {
+	entry->m_prev = NULL;
+	entry->m_next = m_lruHead;
+	if (m_lruHead)
+		m_lruHead->m_prev = entry;
+	m_lruHead = entry;
+	if (!m_lruTail)
+		m_lruTail = entry;
+}
+
+void FileManager::unlinkEntry(Entry *entry) {
+	if (entry->m_prev)
+		entry->m_prev->m_next = entry->m_next;
+	else
+		m_lruHead = entry->m_next;
+	if (entry->m_next)
+		entry->m_next->m_prev = entry->m_prev;
+	else
+		m_lruTail = entry->m_prev;
+	entry->m_prev = NULL;
+	entry->m_next = NULL;
+}
+
+//调用者持有m_cs
+void FileManager::evictEntries() {
+	while (m_cacheBytes > m_cacheLimit && m_lruTail) {
+		Entry *e = m_lruTail;
+		unlinkEntry(e);
+		m_map.erase(e->m_path);
+		m_cacheBytes -= e->m_fileSize;
+		m_evictCounter->Inc();
+		releaseEntry(e);
 	}
-	delete [] entry->m_fileContent;
-	m_map.erase(url);
-	m_cs.Leave();
-	return;
 }
 
 }
@@ -13,11 +13,15 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <string>
 #include <errno.h>
 #include <time.h>
 #include "FileLin.h"
 #include "CriticalSection.h"
+#include "BlobStore.h"
+#include "VolumeStore.h"
+#include "Metrics.h"
 
 using namespace std;
 
@@ -36,7 +40,23 @@ private:
 		strncpy(m_disk, disk, strlen(disk));
 		m_totFiles = totFiles;
 		m_filesPerDir = filesPerDir;
+		m_uploadSeq = 0;
+		m_dedup = false;
+		m_dedupNewCounter = NULL;
+		m_dedupDupCounter = NULL;
+		m_dedupCollisionCounter = NULL;
+		m_logicalBytesCounter = NULL;
+		m_storedBytesCounter = NULL;
 		m_map.clear();
+		m_lruHead = NULL;
+		m_lruTail = NULL;
+		m_cacheBytes = 0;
+		m_cacheLimit = DEFAULT_CACHE_SIZE;
+		m_cacheMaxFileSize = DEFAULT_CACHE_MAX_FILE_SIZE;
+		m_hitCounter = NULL;
+		m_missCounter = NULL;
+		m_uncachedCounter = NULL;
+		m_evictCounter = NULL;
 	}
 	~FileManager() {
 		if (m_host)
@@ -47,7 +67,7 @@ private:
 		m_disk = NULL;
 		EntryMap::iterator it = m_map.begin();
 		while (it != m_map.end()) {
-			delete it->second;
+			releaseEntry(it->second);
 			m_map.erase(it++);
 		}
 	}
@@ -74,35 +94,96 @@ public:
 	
 	string createFileRelatePath();
 	int uploadFile(const char *type, const void *content, u32 size, char *url, char *ext = NULL);
-	int downloadFileByUrl(char *urlEn, void *buf, u32 *size);
+	/*
+	 * 流式上传: 先写到m_disk/tmp下的临时文件, 写完后rename到正式的路径,
+	 * 下载的人看不到写了一半的文件; 临时文件和正式文件在同一个文件系统上, rename是原子的
+	 */
+	int createUploadFile(string &tmpPath);
+	/*
+	 * 打开去重时按digest(文件内容的SHA-256)存到BlobStore, 返回的url指向共享的blob;
+	 * digest为空、没有打开去重或者digest碰撞时按原来的目录方式存
+	 */
+	int commitUploadFile(const string &tmpPath, const string &digest, u64 size, const char *type,
+			char *url, const char *ext = NULL);
+	void initDedup(bool enable);
+	/*
+	 * 小文件打包存储(要先打开去重): 新的blob追加到BaseDir/vol下的卷文件, volumeSize为单个卷文件的字节数;
+	 * 启动时只加载卷的索引文件
+	 */
+	int initVolume(bool enable, u64 volumeSize);
 	int getRelatePathByUrl(const string &url, string &path);
 	int getAbsPathByUrl(const string &url, string &path);
-	
-protected:
+
+	/*
+	 * 下载用的文件缓存: 整个文件只读mmap进来, 发送时直接从映射区写到socket, 不再拷贝到堆上;
+	 * 缓存按映射的总字节数限制, 超过时从LRU链表尾部淘汰. 缓存和每个正在发送的请求各持有一个引用,
+	 * 被淘汰的项在最后一个请求发完后才munmap
+	 */
 	struct Entry {
-		time_t m_lastAccess;
+		std::string m_path;
 		size_t m_fileSize;
 		u8* m_fileContent;
+		void* m_mapAddr;	//卷里的文件从页对齐的位置开始映射, m_fileContent在映射区中间
+		size_t m_mapLen;
+		volatile s32 m_refCount;
+		Entry* m_prev;		//LRU链表, 表头是最近访问的
+		Entry* m_next;
 		Entry() {
-			m_lastAccess = 0;
 			m_fileSize = 0;
 			m_fileContent = NULL;
+			m_mapAddr = NULL;
+			m_mapLen = 0;
+			m_refCount = 1;
+			m_prev = NULL;
+			m_next = NULL;
 		}
 		~Entry() {
-			if (m_fileContent)
-				delete [] m_fileContent;
+			if (m_mapAddr)
+				munmap(m_mapAddr, m_mapLen);
+			m_mapAddr = NULL;
 			m_fileContent = NULL;
 		}
 	};
-	typedef std::map<std::string, Entry*> EntryMap;
-	int insertEntry(const std::string& url, size_t filesize, 
-					const void* content);
-	Entry* getEntry(const std::string& url) const {
-		return const_cast<FileManager*>(this)->getOrCreateEntry(url,false);
-	}
-	Entry* getOrCreateEntry(const std::string& url, bool create);
-	void releaseFileCache(const std::string& url);
-	void updateMapCache();
+
+	//cacheSize: 缓存映射的总字节数上限, maxFileSize: 超过这个大小的文件不进缓存, 用sendfile发送
+	void initCache(u64 cacheSize, u64 maxFileSize);
+	/*
+	 * 打开url对应的文件, 成功返回0, *size为文件大小:
+	 * 1. 能缓存的文件*entry为加了引用的缓存项, 用完调用releaseEntry
+	 * 2. 不缓存的大文件*entry为NULL, *fd为打开的文件, 调用者负责close, 内容从fd的*offset开始
+	 *    (卷里的文件是卷文件的一段, 单独存的文件*offset为0)
+	 */
+	int openFileByUrl(const string &url, Entry **entry, int *fd, u64 *offset, u64 *size);
+	static void releaseEntry(Entry *entry);
+	/*
+	 * 以下工作线程调用, 把要发送的正文先读进内存, 主线程发送时不会因为缺页或者sendfile读盘卡住:
+	 * prefaultEntry逐页访问缓存项里[offset, offset + len)的映射区;
+	 * prefetchFile把fd的[offset, offset + len)读进page cache, 读完才返回
+	 */
+	static void prefaultEntry(const Entry *entry, u64 offset, u64 len);
+	static void prefetchFile(int fd, u64 offset, u64 len);
+	u64 getCacheBytes() { return m_cacheBytes; }
+	u64 getCacheEntries();
+
+protected:
+	typedef hash_map<std::string, Entry*> EntryMap;
+	Entry* loadEntry(const string &path, int *fd, u64 *size);
+	//url指向卷里的blob时返回needle的位置
+	int lookupVolume(const string &url, needle_location_t *loc);
+	Entry* loadVolumeEntry(const string &path, const needle_location_t &loc, int *fd, u64 *offset);
+	Entry* mapEntry(const string &path, int file, u64 offset, u64 size);
+	void linkFront(Entry *entry);
+	void unlinkEntry(Entry *entry);
+	void evictEntries();
+	//按扩展名生成新文件的相对路径和url
+	string createUploadPath(const char *type, const char *ext, string &url);
+	static double getDedupRatio(void *userData);
+	static double getVolumeNeedles(void *userData);
+	static double getVolumeDataBytes(void *userData);
+	static double getVolumeLiveBytes(void *userData);
+
+public:
+    static const u32 MAX_FILE_SIZE_PER_FILE = 5 * 1024 * 1024; 
 
 private:
 	char			*m_host;	//msfs server ip or hostname
@@ -111,12 +192,30 @@ private:
 	CriticalSection	m_filesCs;
 	
 	int 			m_filesPerDir;	//mas file nums per dir eg. xxx/xxx
-    static const u32 MAX_FILE_SIZE_PER_FILE = 5 * 1024 * 1024; 
+	volatile u32	m_uploadSeq;	//临时文件名的序号
 	static const int FIRST_DIR_MAX =255;
 	static const int SECOND_DIR_MAX =255;
 	static FileManager * m_instance;
+	static const u64 DEFAULT_CACHE_SIZE = 256 * 1024 * 1024;
+	static const u64 DEFAULT_CACHE_MAX_FILE_SIZE = 2 * 1024 * 1024;
 	EntryMap m_map;
-	static const u64 MAX_FILE_IN_MAP = 10000;
+	Entry			*m_lruHead;
+	Entry			*m_lruTail;
+	u64				m_cacheBytes;	//缓存里所有文件的大小之和
+	u64				m_cacheLimit;
+	u64				m_cacheMaxFileSize;
+	CMetricCounter	*m_hitCounter;
+	CMetricCounter	*m_missCounter;
+	CMetricCounter	*m_uncachedCounter;
+	CMetricCounter	*m_evictCounter;
+	BlobStore		m_blobStore;
+	VolumeStore		m_volumeStore;
+	bool			m_dedup;
+	CMetricCounter	*m_dedupNewCounter;
+	CMetricCounter	*m_dedupDupCounter;
+	CMetricCounter	*m_dedupCollisionCounter;
+	CMetricCounter	*m_logicalBytesCounter;	//上传的文件大小之和
+	CMetricCounter	*m_storedBytesCounter;	//实际写到磁盘上的大小之和
 	CriticalSection	m_cs;
 };
 
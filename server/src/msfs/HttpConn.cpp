@@ -17,8 +17,8 @@ static HttpConnMap_t g_http_conn_map;
 
 // conn_handle 从0开始递增，可以防止因socket handle重用引起的一些冲突
 static uint32_t g_conn_handle_generator = 0;
-CLock CHttpConn::s_list_lock;
-list<Response_t*> CHttpConn::s_response_pdu_list;
+CMpscQueue CHttpConn::s_response_queue;
+static int s_response_notify = -1;	// 工作线程入队后唤醒主线程的通知id
 
 CHttpConn* FindHttpConnByHandle(uint32_t conn_handle)
 {
@@ -63,7 +63,7 @@ void httpconn_callback(void* callback_data, uint8_t msg, uint32_t handle,
     }
 }
 
-void http_conn_loop_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+void http_conn_notify_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
 {
     CHttpConn::SendResponsePduList();
 }
@@ -88,7 +88,7 @@ void http_conn_timer_callback(void* callback_data, uint8_t msg, uint32_t handle,
 void init_http_conn()
 {
     netlib_register_timer(http_conn_timer_callback, NULL, 1000);
-    netlib_add_loop(http_conn_loop_callback, NULL);
+    s_response_notify = netlib_add_notify(0, http_conn_notify_callback, NULL);
 }
 
 //////////////////////////
@@ -99,9 +99,8 @@ CHttpTask::CHttpTask(Request_t request)
     m_nMethod = request.method;
     m_strUrl = request.strUrl;
     m_strContentType = request.strContentType;
-    m_pContent = request.pContent;
-    m_nContentLen = request.nContentLen;
     m_strAccessHost = request.strAccessHost;
+    m_strRange = request.strRange;
 }
 
 CHttpTask::~CHttpTask()
@@ -111,300 +110,153 @@ CHttpTask::~CHttpTask()
 void CHttpTask::run()
 {
 
+    // 上传在主线程里边收边交给CUploadStream写盘, 不经过这里
     if(HTTP_GET == m_nMethod)
     {
         OnDownload();
     }
-    else if(HTTP_POST == m_nMethod)
-    {
-       OnUpload();
-    }
     else
     {
         char* pContent = new char[strlen(HTTP_RESPONSE_403)];
         snprintf(pContent, strlen(HTTP_RESPONSE_403), HTTP_RESPONSE_403);
         CHttpConn::AddResponsePdu(m_ConnHandle, pContent, strlen(pContent));
     }
-    if(m_pContent != NULL)
-    {
-        delete [] m_pContent;
-        m_pContent = NULL;
-    }
 }
 
-void CHttpTask::OnUpload()
+void  CHttpTask::OnDownload()
 {
+        FileManager::Entry* pEntry = NULL;
+        int nFd = -1;
+        u64 nFileOffset = 0;
+        u64 nFileSize = 0;
+        if(g_fileManager->openFileByUrl(m_strUrl, &pEntry, &nFd, &nFileOffset, &nFileSize) != 0)
+        {
+            int nTotalLen = strlen(HTTP_RESPONSE_404);
+            char* pContent = new char[nTotalLen + 1];
+            snprintf(pContent, nTotalLen + 1, HTTP_RESPONSE_404);
+            CHttpConn::AddResponsePdu(m_ConnHandle, pContent, nTotalLen);
+            log("File not found, url=%s", m_strUrl.c_str());
+            return;
+        }
 
-    //get the file original filename
-    char *pContent = NULL;
-        int nTmpLen = 0;
-        const char* pPos = memfind(m_pContent, m_nContentLen, CONTENT_DISPOSITION, strlen(CONTENT_DISPOSITION));
-        if (pPos != NULL)
+        uint64_t nStart = 0;
+        uint64_t nEnd = 0;
+        int nRange = _ParseRange(nFileSize, nStart, nEnd);
+        char* pHeader = new char[1024];
+        if(nRange < 0)
         {
-            nTmpLen = pPos - m_pContent;
-            const char* pPos2 = memfind(pPos, m_nContentLen - nTmpLen, "filename=", strlen("filename="));
-            if (pPos2 != NULL)
-            {
-                pPos = pPos2 + strlen("filename=") + 1;
-                const char * pPosQuotes = memfind(pPos, m_nContentLen - nTmpLen, "\"", strlen("\""));
-                int nFileNameLen = pPosQuotes - pPos;
-                
-                char szFileName[256];
-                if(nFileNameLen <= 255)
-                {
-                    memcpy(szFileName,  pPos, nFileNameLen);
-                    szFileName[nFileNameLen] = 0;
-
-                    
-                    const char* pPosType = memfind(szFileName, nFileNameLen, ".", 1, false);
-                    if(pPosType != NULL)
-                    {
-                        char szType[16];
-                        int nTypeLen = nFileNameLen - (pPosType + 1 - szFileName);
-                        if(nTypeLen <=15)
-                        {
-                            memcpy(szType, pPosType + 1, nTypeLen);
-                            szType[nTypeLen] = 0;
-                            log("upload file, file name:%s", szFileName);
-                            char szExtend[16];
-                            const char* pPosExtend = memfind(szFileName, nFileNameLen, "_", 1, false);
-                            if(pPosExtend != NULL)
-                            {
-                                const char* pPosTmp = memfind(pPosExtend, nFileNameLen - (pPosExtend + 1 - szFileName), "x", 1);
-                                if(pPosTmp != NULL)
-                                {
-                                    int nWidthLen = pPosTmp - pPosExtend - 1;
-                                    int nHeightLen = pPosType - pPosTmp - 1;
-                                    if(nWidthLen >= 0 && nHeightLen >= 0)
-                                    {
-                                        int nWidth = 0;
-                                        int nHeight = 0;
-                                        char szWidth[5], szHeight[5];
-                                        if(nWidthLen <=4 && nHeightLen <=4)
-                                        {
-                                            memcpy(szWidth, pPosExtend + 1, nWidthLen);
-                                            szWidth[nWidthLen] = 0;
-                                            memcpy(szHeight, pPosTmp + 1, nHeightLen );
-                                            szHeight[nHeightLen] = 0;
-                                            nWidth = atoi(szWidth);
-                                            nHeight = atoi(szHeight);
-                                            snprintf(szExtend, sizeof(szExtend), "%dx%d.%s", nWidth, nHeight, szType);
-                                        }else
-                                        {
-                                            szExtend[0] = 0;
-                                        }
-                                    }
-                                    else
-                                    {
-                                        szExtend[0] = 0;
-                                    }
-                                }
-                                else{
-                                    szExtend[0] = 0;
-                                }
-                            }
-                            else
-                            {
-                                szExtend[0] = 0;
-                            }
-
-                            //get the file content
-                            size_t nPos = m_strContentType.find(BOUNDARY_MARK);
-                            if (nPos != m_strContentType.npos)
-                            {
-                                const  char* pBoundary = m_strContentType.c_str() + nPos + strlen(BOUNDARY_MARK);
-                                int nBoundaryLen = m_strContentType.length() - nPos - strlen(BOUNDARY_MARK);
-
-                                pPos = memfind(m_pContent, m_nContentLen, pBoundary, nBoundaryLen);
-                                if (NULL != pPos)
-                                {
-                                    nTmpLen = pPos - m_pContent;
-                                    pPos = memfind(m_pContent + nTmpLen, m_nContentLen - nTmpLen, CONTENT_TYPE, strlen(CONTENT_TYPE));
-                                    if (NULL != pPos)
-                                    {
-                                        nTmpLen = pPos - m_pContent;
-                                        pPos = memfind(m_pContent + nTmpLen, m_nContentLen - nTmpLen, HTTP_END_MARK, strlen(HTTP_END_MARK));
-                                        if (NULL != pPos)
-                                        {
-                                            nTmpLen = pPos - m_pContent;
-                                            const char* pFileStart = pPos + strlen(HTTP_END_MARK);
-                                            pPos2 = memfind(m_pContent + nTmpLen, m_nContentLen - nTmpLen, pBoundary, nBoundaryLen);
-                                            if (NULL != pPos2)
-                                            {
-                                                int64_t nFileSize = pPos2 - strlen(HTTP_END_MARK) - pFileStart;
-                                                if (nFileSize <= HTTP_UPLOAD_MAX)
-                                                {
-                                                    char filePath[512] =
-                                                    { 0 };
-                                                    if(strlen(szExtend) != 0)
-                                                    {
-                                                        g_fileManager->uploadFile(szType, pFileStart, nFileSize, filePath, szExtend);
-                                                    }
-                                                    else{
-                                                        g_fileManager->uploadFile(szType, pFileStart, nFileSize, filePath);
-                                                    }
-                                                    char url[1024];
-                                                    snprintf(url, sizeof(url), "{\"error_code\":0,\"error_msg\": \"成功\",\"path\":\"%s\",\"url\":\"http://%s/%s\"}", filePath,m_strAccessHost.c_str(), filePath);
-                                                    uint32_t content_length = strlen(url);
-                                                    pContent = new char[HTTP_RESPONSE_HTML_MAX];
-                                                    snprintf(pContent, HTTP_RESPONSE_HTML_MAX, HTTP_RESPONSE_HTML, content_length,url);
-                                                    CHttpConn::AddResponsePdu(m_ConnHandle, pContent, strlen(pContent));
-                                                }
-                                            }
-                                            else
-                                            {
-                                                char url[128];
-                                                snprintf(url, sizeof(url), "{\"error_code\":8,\"error_msg\": \"格式错误\",\"path\":\"\",\"url\":\"\"}");
-                                                log("%s",url);
-                                                uint32_t content_length = strlen(url);
-                                                pContent = new char[HTTP_RESPONSE_HTML_MAX];
-                                                snprintf(pContent, HTTP_RESPONSE_HTML_MAX, HTTP_RESPONSE_HTML, content_length,url);
-                                                CHttpConn::AddResponsePdu(m_ConnHandle, pContent, strlen(pContent));
-                                            }
-                                        }
-                                        else
-                                        {
-                                            char url[128];
-                                            snprintf(url, sizeof(url), "{\"error_code\":7,\"error_msg\": \"格式错误\",\"path\":\"\",\"url\":\"\"}");
-                                            log("%s",url);
-                                            uint32_t content_length = strlen(url);
-                                            pContent = new char[HTTP_RESPONSE_HTML_MAX];
-                                            snprintf(pContent, HTTP_RESPONSE_HTML_MAX, HTTP_RESPONSE_HTML, content_length,url);
-                                            CHttpConn::AddResponsePdu(m_ConnHandle, pContent, strlen(pContent));
-                                        }
-
-                                    }
-                                    else
-                                    {
-                                        char url[128];
-                                        snprintf(url, sizeof(url), "{\"error_code\":6,\"error_msg\": \"格式错误\",\"path\":\"\",\"url\":\"\"}");
-                                        log("%s",url);
-                                        uint32_t content_length = strlen(url);
-                                        pContent = new char[HTTP_RESPONSE_HTML_MAX];
-                                        snprintf(pContent, HTTP_RESPONSE_HTML_MAX, HTTP_RESPONSE_HTML, content_length,url);
-                                        CHttpConn::AddResponsePdu(m_ConnHandle, pContent, strlen(pContent));
-                                    }
-                                }
-                                else
-                                {
-                                    char url[128];
-                                    snprintf(url, sizeof(url), "{\"error_code\":5,\"error_msg\": \"格式错误\",\"path\":\"\",\"url\":\"\"}");
-                                    log("%s",url);
-                                    uint32_t content_length = strlen(url);
-                                    pContent = new char[HTTP_RESPONSE_HTML_MAX];
-                                    snprintf(pContent, HTTP_RESPONSE_HTML_MAX, HTTP_RESPONSE_HTML, content_length,url);
-                                    CHttpConn::AddResponsePdu(m_ConnHandle, pContent, strlen(pContent));
-                                }
-                            }
-                            else
-                            {
-                                char url[128];
-                                snprintf(url, sizeof(url), "{\"error_code\":4,\"error_msg\": \"格式错误\",\"path\":\"\",\"url\":\"\"}");
-                                log("%s",url);
-                                uint32_t content_length = strlen(url);
-                                pContent = new char[HTTP_RESPONSE_HTML_MAX];
-                                snprintf(pContent, HTTP_RESPONSE_HTML_MAX, HTTP_RESPONSE_HTML, content_length,url);
-                                CHttpConn::AddResponsePdu(m_ConnHandle, pContent, strlen(pContent));
-                            }
-                        }
-                        else{
-                            char url[128];
-                            snprintf(url, sizeof(url), "{\"error_code\":9,\"error_msg\": \"格式错误\",\"path\":\"\",\"url\":\"\"}");
-                            log("%s",url);
-                            uint32_t content_length = strlen(url);
-                            pContent = new char[HTTP_RESPONSE_HTML_MAX];
-                            snprintf(pContent, HTTP_RESPONSE_HTML_MAX, HTTP_RESPONSE_HTML, content_length,url);
-                            CHttpConn::AddResponsePdu(m_ConnHandle, pContent, strlen(pContent));
-                        }
-                   }
-                   else{
-                       char url[128];
-                       snprintf(url, sizeof(url), "{\"error_code\":10,\"error_msg\": \"格式错误\",\"path\":\"\",\"url\":\"\"}");
-                       log("%s",url);
-                       uint32_t content_length = strlen(url);
-                       pContent = new char[HTTP_RESPONSE_HTML_MAX];
-                       snprintf(pContent, HTTP_RESPONSE_HTML_MAX, HTTP_RESPONSE_HTML, content_length,url);
-                       CHttpConn::AddResponsePdu(m_ConnHandle, pContent, strlen(pContent));
-                   }
-                }else
-                {
-                    char url[128];
-                    snprintf(url, sizeof(url), "{\"error_code\":11,\"error_msg\": \"格式错误\",\"path\":\"\",\"url\":\"\"}");
-                    log("%s",url);
-                    uint32_t content_length = strlen(url);
-                    pContent = new char[HTTP_RESPONSE_HTML_MAX];
-                    snprintf(pContent, HTTP_RESPONSE_HTML_MAX, HTTP_RESPONSE_HTML, content_length,url);
-                    CHttpConn::AddResponsePdu(m_ConnHandle, pContent, strlen(pContent));
-                }
-            }
-            else
+            snprintf(pHeader, 1024, HTTP_RESPONSE_416, (unsigned long long)nFileSize);
+            CHttpConn::AddResponsePdu(m_ConnHandle, pHeader, strlen(pHeader));
+            if(pEntry)
+                FileManager::releaseEntry(pEntry);
+            if(nFd != -1)
+                close(nFd);
+            return;
+        }
+
+        string strContentType = "multipart/form-data";
+        size_t nPos = m_strUrl.find_last_of(".");
+        if(nPos != string::npos)
+        {
+            string strType = m_strUrl.substr(nPos + 1);
+            if(strType == "jpg" || strType == "JPG" || strType == "jpeg" || strType == "JPEG" || strType == "png" || strType == "PNG" || strType == "gif" || strType == "GIF")
             {
-                char url[128];
-                snprintf(url, sizeof(url), "{\"error_code\":3,\"error_msg\": \"格式错误\",\"path\":\"\",\"url\":\"\"}");
-                log("%s",url);
-                uint32_t content_length = strlen(url);
-                pContent = new char[HTTP_RESPONSE_HTML_MAX];
-                snprintf(pContent, HTTP_RESPONSE_HTML_MAX, HTTP_RESPONSE_HTML, content_length,url);
-                CHttpConn::AddResponsePdu(m_ConnHandle, pContent, strlen(pContent));
+                strContentType = "image/" + strType;
             }
         }
+
+        uint64_t nLen = nFileSize;
+        if(nRange > 0)
+        {
+            nLen = nEnd - nStart + 1;
+            snprintf(pHeader, 1024, HTTP_RESPONSE_FILE_RANGE, (unsigned long long)nStart, (unsigned long long)nEnd,
+                    (unsigned long long)nFileSize, (unsigned long long)nLen, strContentType.c_str());
+        }
         else
         {
-            char url[128];
-            snprintf(url, sizeof(url), "{\"error_code\":2,\"error_msg\": \"格式错误\",\"path\":\"\",\"url\":\"\"}");
-            log("%s",url);
-            uint32_t content_length = strlen(url);
-            pContent = new char[HTTP_RESPONSE_HTML_MAX];
-            snprintf(pContent, HTTP_RESPONSE_HTML_MAX, HTTP_RESPONSE_HTML, content_length,url);
-            CHttpConn::AddResponsePdu(m_ConnHandle, pContent, strlen(pContent));
+            snprintf(pHeader, 1024, HTTP_RESPONSE_FILE, (unsigned long long)nFileSize, strContentType.c_str());
         }
-}
-
-void  CHttpTask::OnDownload()
-{
-        uint32_t  nFileSize = 0;
-        int32_t nTmpSize = 0;
-        string strPath;
-        if(g_fileManager->getAbsPathByUrl(m_strUrl, strPath ) == 0)
+        // 正文不拷贝, 由主线程直接从mmap的缓存或者用sendfile从文件发出去; 卷里的文件从卷文件的偏移处开始发.
+        // 先在这里把要发的内容读进内存, 主线程发送时不会卡在缺页或者读盘上;
+        // sendfile只预读第一段, 后面的由CPrefetchTask边发边读
+        if(pEntry)
         {
-            nTmpSize = File::getFileSize((char*)strPath.c_str());
-            if(nTmpSize != -1)
-            {
-                char szResponseHeader[1024];
-                size_t nPos = strPath.find_last_of(".");
-                string strType = strPath.substr(nPos + 1, strPath.length() - nPos);
-                if(strType == "jpg" || strType == "JPG" || strType == "jpeg" || strType == "JPEG" || strType == "png" || strType == "PNG" || strType == "gif" || strType == "GIF")
-                {
-                    snprintf(szResponseHeader, sizeof(szResponseHeader), HTTP_RESPONSE_IMAGE, nTmpSize, strType.c_str());
-                }
-                else
-                {
-                    snprintf(szResponseHeader,sizeof(szResponseHeader), HTTP_RESPONSE_EXTEND, nTmpSize);
-                }
-                int nLen = strlen(szResponseHeader);
-                char* pContent = new char[nLen + nTmpSize];
-                memcpy(pContent, szResponseHeader, nLen);
-                g_fileManager->downloadFileByUrl((char*)m_strUrl.c_str(), pContent + nLen, &nFileSize);
-                int nTotalLen = nLen + nFileSize;
-                CHttpConn::AddResponsePdu(m_ConnHandle, pContent, nTotalLen);
-            }
-            else
-            {
-                int nTotalLen = strlen(HTTP_RESPONSE_404);
-                char* pContent = new char[nTotalLen];
-                snprintf(pContent, nTotalLen, HTTP_RESPONSE_404);
-                CHttpConn::AddResponsePdu(m_ConnHandle, pContent, nTotalLen);
-                log("File size is invalied\n");
-                
-            }
+            FileManager::prefaultEntry(pEntry, nStart, nLen);
         }
         else
         {
-        	int nTotalLen = strlen(HTTP_RESPONSE_500);
-			char* pContent = new char[nTotalLen];
-			snprintf(pContent, nTotalLen, HTTP_RESPONSE_500);
-			CHttpConn::AddResponsePdu(m_ConnHandle, pContent, nTotalLen);
+            FileManager::prefetchFile(nFd, nFileOffset + nStart, nLen > HTTP_PREFETCH_WINDOW ? HTTP_PREFETCH_WINDOW : nLen);
         }
+        CHttpConn::AddFileResponse(m_ConnHandle, pHeader, strlen(pHeader), pEntry, nFd,
+                (nFd != -1) ? nFileOffset + nStart : nStart, nLen);
+}
+
+CPrefetchTask::CPrefetchTask(uint32_t conn_handle, int fd, uint64_t offset, uint64_t len)
+{
+    m_conn_handle = conn_handle;
+    m_fd = fd;
+    m_offset = offset;
+    m_len = len;
+}
+
+CPrefetchTask::~CPrefetchTask()
+{
+    if (m_fd != -1)
+        close(m_fd);
+}
+
+void CPrefetchTask::run()
+{
+    FileManager::prefetchFile(m_fd, m_offset, m_len);
+    CHttpConn::AddPrefetchDone(m_conn_handle, m_offset + m_len);
+}
+
+int CHttpTask::_ParseRange(uint64_t file_size, uint64_t& start, uint64_t& end)
+{
+    const char* pPos = m_strRange.c_str();
+    if(strncasecmp(pPos, "bytes=", 6) != 0 || strchr(pPos, ',') != NULL)
+    {
+        return 0;
+    }
+    pPos += 6;
+    while(*pPos == ' ')
+        pPos++;
+
+    char* pEnd = NULL;
+    if(*pPos == '-')
+    {
+        // bytes=-n: 最后n个字节
+        uint64_t nSuffix = strtoull(pPos + 1, &pEnd, 10);
+        if(pEnd == pPos + 1)
+            return 0;
+        if(nSuffix == 0 || file_size == 0)
+            return -1;
+        start = (nSuffix >= file_size) ? 0 : file_size - nSuffix;
+        end = file_size - 1;
+        return 1;
+    }
+
+    start = strtoull(pPos, &pEnd, 10);
+    if(pEnd == pPos || *pEnd != '-')
+        return 0;
+    pPos = pEnd + 1;
+    if(*pPos == '\0')
+    {
+        // bytes=start-: 从start到文件结尾, 断点续传一般是这种
+        end = file_size - 1;
+    }
+    else
+    {
+        end = strtoull(pPos, &pEnd, 10);
+        if(pEnd == pPos)
+            return 0;
+        if(end >= file_size)
+            end = file_size - 1;
+    }
+
+    if(start >= file_size || start > end)
+        return -1;
+    return 1;
 }
 
 CHttpConn::CHttpConn()
@@ -412,6 +264,15 @@ CHttpConn::CHttpConn()
     m_busy = false;
     m_sock_handle = NETLIB_INVALID_HANDLE;
     m_state = CONN_STATE_IDLE;
+    m_header_done = false;
+    m_request_done = false;
+    m_upload = NULL;
+    m_body_entry = NULL;
+    m_body_fd = -1;
+    m_body_offset = 0;
+    m_body_remain = 0;
+    m_body_ready = 0;
+    m_prefetching = false;
 
     m_last_send_tick = m_last_recv_tick = get_tick_count();
     m_conn_handle = ++g_conn_handle_generator;
@@ -426,6 +287,7 @@ CHttpConn::CHttpConn()
 CHttpConn::~CHttpConn()
 {
     //log("~CHttpConn, handle=%u", m_conn_handle);
+    _ReleaseBody();
 }
 
 int CHttpConn::Send(void* data, int len)
@@ -462,6 +324,14 @@ void CHttpConn::Close()
 
     g_http_conn_map.erase(m_conn_handle);
     netlib_close(m_sock_handle);
+    _ReleaseBody();
+    if (m_upload)
+    {
+        // 没收完的上传由写盘线程删掉临时文件
+        m_upload->Abort();
+        m_upload->ReleaseRef();
+        m_upload = NULL;
+    }
 
     ReleaseRef();
 }
@@ -481,9 +351,12 @@ void CHttpConn::OnConnect(net_handle_t handle)
 
 void CHttpConn::OnRead()
 {
-    //1、先取数据
     for (;;)
     {
+        // 请求已经收完, 或者上传写盘跟不上时先不读, 数据留在内核的接收缓冲区里, TCP流控让客户端慢下来
+        if (m_request_done || (m_upload && m_upload->PauseIfBusy()))
+            return;
+
         uint32_t free_buf_len = m_in_buf.GetAllocSize()
                 - m_in_buf.GetWriteOffset();
         if (free_buf_len < READ_BUF_SIZE + 1)
@@ -498,102 +371,301 @@ void CHttpConn::OnRead()
         m_in_buf.IncWriteOffset(ret);
 
         m_last_recv_tick = get_tick_count();
+
+        // 每次请求对应一个HTTP连接，所以读完数据后，不用在同一个连接里面准备读取下个请求
+        if (!_ParseRequest())
+            return;
     }
+}
 
-    // 每次请求对应一个HTTP连接，所以读完数据后，不用在同一个连接里面准备读取下个请求
+static int http_body_callback(void* callback_data, const char* at, size_t length)
+{
+    return ((CHttpConn*)callback_data)->OnBody(at, (uint32_t)length);
+}
+
+bool CHttpConn::_ParseRequest()
+{
     char* in_buf = (char*) m_in_buf.GetBuffer();
     uint32_t buf_len = m_in_buf.GetWriteOffset();
-    in_buf[buf_len] = '\0';
 
-    //log("OnRead, buf_len=%u, conn_handle=%u", buf_len, m_conn_handle); // for debug
+    if (!m_header_done)
+    {
+        // 请求头收齐之前先缓存, http_parser的回调拿到的都是完整的请求头
+        in_buf[buf_len] = '\0';
+        char* pHeaderEnd = strstr(in_buf, HTTP_END_MARK);
+        if (pHeaderEnd == NULL)
+        {
+            if (buf_len > HTTP_HEADER_MAX)
+            {
+                log("http header is too long, conn_handle=%u", m_conn_handle);
+                Close();
+                return false;
+            }
+            return true;
+        }
 
-    //2、解包
-    m_HttpParser.ParseHttpContent(in_buf, buf_len);
+        m_header_done = true;
+        uint32_t header_len = pHeaderEnd - in_buf + strlen(HTTP_END_MARK);
+        m_HttpParser.InitStream(http_body_callback, this);
+        m_HttpParser.ParseStream(in_buf, header_len);
+        if (!_OnHeaders())
+            return false;
+        in_buf += header_len;
+        buf_len -= header_len;
+    }
 
-    if (m_HttpParser.IsReadAll())
+    //解包, body直接交给m_upload, 不在内存里攒
+    if (buf_len > 0 && !m_HttpParser.IsReadAll())
+        m_HttpParser.ParseStream(in_buf, buf_len);
+    m_in_buf.Read(NULL, m_in_buf.GetWriteOffset());
+
+    if (m_HttpParser.IsParseError())
     {
-        string strUrl = m_HttpParser.GetUrl();
-        log("IP:%s access:%s", m_peer_ip.c_str(), strUrl.c_str());
-        if (strUrl.find("..") != strUrl.npos) {
-            Close();
-            return;
+        if (m_upload && m_upload->GetError() != UPLOAD_OK)
+        {
+            _SendUploadResult(m_upload->GetError());
+            return false;
         }
-        m_access_host = m_HttpParser.GetHost();
+        log("parse http request failed, conn_handle=%u", m_conn_handle);
+        Close();
+        return false;
+    }
+
+    if (m_HttpParser.IsReadAll())
+        return _OnRequestComplete();
+    return true;
+}
+
+bool CHttpConn::_OnHeaders()
+{
+    if (m_HttpParser.IsParseError())
+    {
+        log("parse http header failed, conn_handle=%u", m_conn_handle);
+        Close();
+        return false;
+    }
+
+    string strUrl = m_HttpParser.GetUrl();
+    log("IP:%s access:%s", m_peer_ip.c_str(), strUrl.c_str());
+    if (strUrl.find("..") != strUrl.npos) {
+        Close();
+        return false;
+    }
+    m_access_host = m_HttpParser.GetHost();
+
+    if (HTTP_POST == m_HttpParser.GetMethod())
+    {
         if (m_HttpParser.GetContentLen() > HTTP_UPLOAD_MAX)
         {
-            // file is too big
+            // file is too big, 不用等body收完
             log("content  is too big");
-            char url[128];
-            snprintf(url, sizeof(url), "{\"error_code\":1,\"error_msg\": \"上传文件过大\",\"url\":\"\"}");
-            log("%s",url);
-            uint32_t content_length = strlen(url);
-            char pContent[1024];
-            snprintf(pContent, sizeof(pContent), HTTP_RESPONSE_HTML, content_length,url);
-            Send(pContent, strlen(pContent));
-            return;
+            _SendUploadResult(UPLOAD_ERR_TOO_LARGE);
+            return false;
         }
+        m_upload = new CUploadStream(m_conn_handle, m_access_host);
+        int nError = m_upload->Init(m_HttpParser.GetContentType());
+        if (nError != UPLOAD_OK)
+        {
+            _SendUploadResult(nError);
+            return false;
+        }
+    }
+    return true;
+}
+
+int CHttpConn::OnBody(const char* pData, uint32_t nLen)
+{
+    // GET等请求的body忽略
+    if (!m_upload)
+        return 0;
+    return (m_upload->Write(pData, nLen) == UPLOAD_OK) ? 0 : -1;
+}
 
-        int nContentLen = m_HttpParser.GetContentLen();
-        char* pContent = NULL;
-        if(nContentLen != 0)
+bool CHttpConn::_OnRequestComplete()
+{
+    m_request_done = true;
+    if (m_upload)
+    {
+        // 写盘线程写完文件后回复
+        int nError = m_upload->Finish();
+        if (nError != UPLOAD_OK)
         {
-            try {
-                pContent =new char[nContentLen];
-                memcpy(pContent, m_HttpParser.GetBodyContent(), nContentLen);
-            }
-            catch(...)
+            _SendUploadResult(nError);
+            return false;
+        }
+        return true;
+    }
+
+    Request_t request;
+    request.conn_handle = m_conn_handle;
+    request.method = m_HttpParser.GetMethod();
+    request.strAccessHost = m_HttpParser.GetHost();
+    request.strContentType = m_HttpParser.GetContentType();
+    request.strUrl = m_HttpParser.GetUrl() + 1;
+    request.strRange = m_HttpParser.GetRange();
+    CHttpTask* pTask = new CHttpTask(request);
+    //3、然后根据客户端发送的http请求到底是get还是post方
+    if(HTTP_GET == m_HttpParser.GetMethod())
+    {
+    	g_GetThreadPool.AddTask(pTask);
+    }
+    else
+    {
+    	g_PostThreadPool.AddTask(pTask);
+    }
+    return true;
+}
+
+void CHttpConn::_SendUploadResult(int nErrorCode)
+{
+    m_request_done = true;
+    if (m_upload)
+        m_upload->Abort();
+    char* pContent = CUploadStream::MakeResult(nErrorCode, "", "", "");
+    Send(pContent, strlen(pContent));
+    delete [] pContent;
+}
+
+void CHttpConn::OnWrite()
+{
+    if (!m_busy)
+        return;
+
+    _SendPending();
+}
+
+void CHttpConn::_SendFile(Response_t* pResp)
+{
+    m_last_send_tick = get_tick_count();
+    m_body_entry = pResp->pEntry;
+    m_body_fd = pResp->file_fd;
+    m_body_offset = pResp->body_offset;
+    m_body_remain = pResp->body_len;
+    // CHttpTask::OnDownload已经预读了第一段
+    m_body_ready = m_body_offset + ((m_body_remain > HTTP_PREFETCH_WINDOW) ? HTTP_PREFETCH_WINDOW : m_body_remain);
+    m_prefetching = false;
+    pResp->pEntry = NULL;
+    pResp->file_fd = -1;
+
+    m_out_buf.Write(pResp->pContent, pResp->content_len);
+    m_busy = true;
+    _SendPending();
+}
+
+void CHttpConn::_SendPending()
+{
+    while (m_out_buf.GetWriteOffset() > 0 || m_body_remain > 0)
+    {
+        uint32_t header_len = m_out_buf.GetWriteOffset();
+        uint32_t body_len = (m_body_remain > HTTP_SEND_CHUNK) ? HTTP_SEND_CHUNK : (uint32_t)m_body_remain;
+        int ret = 0;
+        if (m_body_entry && body_len > 0)
+        {
+            // 响应头和mmap里的正文一次writev发出
+            netlib_iovec_t iov[2];
+            int iov_cnt = 0;
+            if (header_len > 0)
             {
-                log("not enough memory");
-                char szResponse[HTTP_RESPONSE_500_LEN + 1];
-                snprintf(szResponse, HTTP_RESPONSE_500_LEN, "%s", HTTP_RESPONSE_500);
-                Send(szResponse, HTTP_RESPONSE_500_LEN);
-                return;
+                iov[iov_cnt].base = m_out_buf.GetBuffer();
+                iov[iov_cnt].len = header_len;
+                iov_cnt++;
             }
+            iov[iov_cnt].base = m_body_entry->m_fileContent + m_body_offset;
+            iov[iov_cnt].len = body_len;
+            iov_cnt++;
+            ret = netlib_sendv(m_sock_handle, iov, iov_cnt);
         }
-        Request_t request;
-        request.conn_handle = m_conn_handle;
-        request.method = m_HttpParser.GetMethod();;
-        request.nContentLen = nContentLen;
-        request.pContent = pContent;
-        request.strAccessHost = m_HttpParser.GetHost();
-        request.strContentType = m_HttpParser.GetContentType();
-        request.strUrl = m_HttpParser.GetUrl() + 1;
-        CHttpTask* pTask = new CHttpTask(request);
-        //3、然后根据客户端发送的http请求到底是get还是post方
-        if(HTTP_GET == m_HttpParser.GetMethod())
+        else if (header_len > 0)
         {
-        	g_GetThreadPool.AddTask(pTask);
+            ret = netlib_send(m_sock_handle, m_out_buf.GetBuffer(), header_len);
         }
         else
         {
-        	g_PostThreadPool.AddTask(pTask);
+            // 只发送已经读进page cache的部分, 剩下的等预读完成
+            if (m_body_offset >= m_body_ready)
+            {
+                _Prefetch();
+                return;
+            }
+            if (body_len > m_body_ready - m_body_offset)
+                body_len = (uint32_t)(m_body_ready - m_body_offset);
+            // sendfile自己推进m_body_offset
+            ret = netlib_sendfile(m_sock_handle, m_body_fd, &m_body_offset, body_len);
+            if (ret > 0)
+            {
+                m_body_remain -= ret;
+                // 读进来的只剩半段时开始读下一段, 发送和读盘重叠
+                if (m_body_ready - m_body_offset < HTTP_PREFETCH_WINDOW / 2)
+                    _Prefetch();
+            }
+        }
+
+        if (ret <= 0)
+        {
+            // 发送缓冲区满, 等可写事件
+            return;
         }
+        m_last_send_tick = get_tick_count();
+
+        if (m_body_fd != -1 && header_len == 0)
+            continue;
+
+        uint32_t header_sent = ((uint32_t)ret > header_len) ? header_len : (uint32_t)ret;
+        m_out_buf.Read(NULL, header_sent);
+        m_body_offset += ret - header_sent;
+        m_body_remain -= ret - header_sent;
     }
+
+    m_busy = false;
+    _ReleaseBody();
+    OnSendComplete();
 }
 
-void CHttpConn::OnWrite()
+void CHttpConn::_Prefetch()
 {
-    if (!m_busy)
+    uint64_t body_end = m_body_offset + m_body_remain;
+    if (m_prefetching || m_body_fd == -1 || m_body_ready >= body_end)
         return;
 
-    int ret = netlib_send(m_sock_handle, m_out_buf.GetBuffer(),
-            m_out_buf.GetWriteOffset());
-    if (ret < 0)
-        ret = 0;
-
-    int out_buf_size = (int) m_out_buf.GetWriteOffset();
+    // 连接可能先关闭并close(m_body_fd), 任务用dup出来的fd
+    int fd = dup(m_body_fd);
+    if (fd == -1)
+    {
+        // 只能在主线程里直接sendfile了
+        log("dup fd for prefetch error[%d], handle=%u", errno, m_conn_handle);
+        m_body_ready = body_end;
+        return;
+    }
+    uint64_t len = body_end - m_body_ready;
+    if (len > HTTP_PREFETCH_WINDOW)
+        len = HTTP_PREFETCH_WINDOW;
+    m_prefetching = true;
+    g_GetThreadPool.AddTask(new CPrefetchTask(m_conn_handle, fd, m_body_ready, len), m_conn_handle);
+}
 
-    m_out_buf.Read(NULL, ret);
+void CHttpConn::_OnPrefetchDone(uint64_t ready_offset)
+{
+    m_prefetching = false;
+    if (m_body_fd == -1 || ready_offset <= m_body_ready)
+        return;
+    m_body_ready = ready_offset;
+    if (m_busy)
+        _SendPending();
+}
 
-    if (ret < out_buf_size)
+void CHttpConn::_ReleaseBody()
+{
+    if (m_body_entry)
     {
-        m_busy = true;
-//        log("not send all, remain=%d", m_out_buf.GetWriteOffset());
-    } else
+        FileManager::releaseEntry(m_body_entry);
+        m_body_entry = NULL;
+    }
+    if (m_body_fd != -1)
     {
-        m_busy = false;
-        OnSendComplete();
+        close(m_body_fd);
+        m_body_fd = -1;
     }
+    m_body_remain = 0;
 }
 
 void CHttpConn::OnClose()
@@ -603,7 +675,9 @@ void CHttpConn::OnClose()
 
 void CHttpConn::OnTimer(uint64_t curr_tick)
 {
-    if (curr_tick > m_last_recv_tick + HTTP_CONN_TIMEOUT)
+    // 大文件下载时一直在发送, 不算超时
+    uint64_t last_tick = (m_last_send_tick > m_last_recv_tick) ? m_last_send_tick : m_last_recv_tick;
+    if (curr_tick > last_tick + HTTP_CONN_TIMEOUT)
     {
         log("HttpConn timeout, handle=%d", m_conn_handle);
         Close();
@@ -616,39 +690,99 @@ void CHttpConn::AddResponsePdu(uint32_t conn_handle, char* pContent, int nLen)
     pResp->conn_handle = conn_handle;
     pResp->pContent = pContent;
     pResp->content_len = nLen;
+    pResp->pEntry = NULL;
+    pResp->file_fd = -1;
+    pResp->body_offset = 0;
+    pResp->body_len = 0;
+    pResp->resume_read = false;
+    pResp->prefetch_done = false;
+
+    s_response_queue.Push(pResp);
+    netlib_notify(0, s_response_notify);
+}
 
-    s_list_lock.lock();
-    s_response_pdu_list.push_back(pResp);
-    s_list_lock.unlock();
+void CHttpConn::AddResumeRead(uint32_t conn_handle)
+{
+    Response_t* pResp = new Response_t;
+    pResp->conn_handle = conn_handle;
+    pResp->pContent = NULL;
+    pResp->content_len = 0;
+    pResp->pEntry = NULL;
+    pResp->file_fd = -1;
+    pResp->body_offset = 0;
+    pResp->body_len = 0;
+    pResp->resume_read = true;
+    pResp->prefetch_done = false;
+
+    s_response_queue.Push(pResp);
+    netlib_notify(0, s_response_notify);
 }
 
-void CHttpConn::SendResponsePduList()
+void CHttpConn::AddPrefetchDone(uint32_t conn_handle, uint64_t ready_offset)
 {
-    s_list_lock.lock();
-    while (!s_response_pdu_list.empty()) {
-        Response_t* pResp = s_response_pdu_list.front();
-        s_response_pdu_list.pop_front();
-        s_list_lock.unlock();
+    Response_t* pResp = new Response_t;
+    pResp->conn_handle = conn_handle;
+    pResp->pContent = NULL;
+    pResp->content_len = 0;
+    pResp->pEntry = NULL;
+    pResp->file_fd = -1;
+    pResp->body_offset = ready_offset;
+    pResp->body_len = 0;
+    pResp->resume_read = false;
+    pResp->prefetch_done = true;
+
+    s_response_queue.Push(pResp);
+    netlib_notify(0, s_response_notify);
+}
+
+void CHttpConn::AddFileResponse(uint32_t conn_handle, char* pHeader, int nHeaderLen, FileManager::Entry* pEntry,
+        int file_fd, uint64_t offset, uint64_t len)
+{
+    Response_t* pResp = new Response_t;
+    pResp->conn_handle = conn_handle;
+    pResp->pContent = pHeader;
+    pResp->content_len = nHeaderLen;
+    pResp->pEntry = pEntry;
+    pResp->file_fd = file_fd;
+    pResp->body_offset = offset;
+    pResp->body_len = len;
+    pResp->resume_read = false;
+    pResp->prefetch_done = false;
+
+    s_response_queue.Push(pResp);
+    netlib_notify(0, s_response_notify);
+}
 
+void CHttpConn::SendResponsePduList()
+{
+    Response_t* pResp = NULL;
+    while ((pResp = (Response_t*)s_response_queue.Pop()) != NULL) {
         CHttpConn* pConn = FindHttpConnByHandle(pResp->conn_handle);
         if (pConn) {
-            pConn->Send(pResp->pContent, pResp->content_len);
+            if (pResp->resume_read) {
+                pConn->OnRead();
+            } else if (pResp->prefetch_done) {
+                pConn->_OnPrefetchDone(pResp->body_offset);
+            } else if (pResp->pEntry || pResp->file_fd != -1) {
+                pConn->_SendFile(pResp);
+            } else {
+                pConn->Send(pResp->pContent, pResp->content_len);
+            }
+        }
+        // 连接已经关闭时正文还在这里
+        if (pResp->pEntry) {
+            FileManager::releaseEntry(pResp->pEntry);
+        }
+        if (pResp->file_fd != -1) {
+            close(pResp->file_fd);
         }
         if(pResp->pContent != NULL)
         {
             delete [] pResp->pContent;
             pResp->pContent = NULL;
         }
-        if(pResp != NULL)
-        {
-            delete pResp;
-            pResp = NULL;
-        }
-
-        s_list_lock.lock();
+        delete pResp;
     }
-
-    s_list_lock.unlock();
 }
 
 void CHttpConn::OnSendComplete()
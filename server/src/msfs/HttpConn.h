@@ -24,16 +24,21 @@
 #include "netlib.h"
 #include "FileManager.h"
 #include "ConfigFileReader.h"
-#include "ThreadPool.h"
+#include "TaskScheduler.h"
+#include "MpscQueue.h"
 #include "HttpParserWrapper.h"
+#include "UploadStream.h"
 
 #define HTTP_CONN_TIMEOUT            30000
 #define HTTP_UPLOAD_MAX                 0xA00000     //10M
+#define HTTP_HEADER_MAX                 0x10000      //64K, 请求头超过这个长度时关闭连接
 #define BOUNDARY_MARK                    "boundary="
 #define HTTP_END_MARK                        "\r\n\r\n"
 #define CONTENT_TYPE                            "Content-Type:"
 #define CONTENT_DISPOSITION         "Content-Disposition:"
 #define READ_BUF_SIZE    0x100000 //1M
+#define HTTP_SEND_CHUNK  0x400000 //下载时一次系统调用最多发送的正文字节数
+#define HTTP_PREFETCH_WINDOW  0x800000 //sendfile下载时工作线程每次提前读进page cache的正文字节数
 #define HTTP_RESPONSE_HEADER    "HTTP/1.1 200 OK\r\n"\
 "Connection:close\r\n"\
 "Content-Length:%d\r\n"\
@@ -51,6 +56,22 @@
                                     "Content-Length:%d\r\n"\
                                     "Content-Type:text/html;charset=utf-8\r\n\r\n%s"
 #define HTTP_RESPONSE_HTML_MAX      1024
+// 下载: 支持Range断点续传, 只支持单个区间, 多个区间时按整个文件返回
+#define HTTP_RESPONSE_FILE          "HTTP/1.1 200 OK\r\n"\
+                                    "Connection:close\r\n"\
+                                    "Accept-Ranges:bytes\r\n"\
+                                    "Content-Length:%llu\r\n"\
+                                    "Content-Type:%s\r\n\r\n"
+#define HTTP_RESPONSE_FILE_RANGE    "HTTP/1.1 206 Partial Content\r\n"\
+                                    "Connection:close\r\n"\
+                                    "Accept-Ranges:bytes\r\n"\
+                                    "Content-Range:bytes %llu-%llu/%llu\r\n"\
+                                    "Content-Length:%llu\r\n"\
+                                    "Content-Type:%s\r\n\r\n"
+#define HTTP_RESPONSE_416           "HTTP/1.1 416 Range Not Satisfiable\r\n"\
+                                    "Connection:close\r\n"\
+                                    "Content-Range:bytes */%llu\r\n"\
+                                    "Content-Length:0\r\n\r\n"
 #define HTTP_RESPONSE_403           "HTTP/1.1 403 Access Forbidden\r\n"\
                                     "Content-Length: 0\r\n"\
                                     "Connection: close\r\n"\
@@ -75,42 +96,64 @@ enum
 
 extern FileManager * g_fileManager;
 extern CConfigFileReader config_file;
-extern CThreadPool g_PostThreadPool;
-extern CThreadPool g_GetThreadPool;
+extern CTaskScheduler g_PostThreadPool;
+extern CTaskScheduler g_GetThreadPool;
 
 typedef struct {
     uint32_t conn_handle;
     int method;
-    int nContentLen;
     string strAccessHost;
-    char* pContent;
     string strUrl;
     string strContentType;
+    string strRange;
 }Request_t;
 
-typedef struct {
+struct Response_t : public CMpscNode {
     uint32_t    conn_handle;
     char*     pContent;
     uint32_t content_len;
-} Response_t;
+    // 下载时pContent只是响应头, 正文在缓存的mmap里(pEntry), 或者用sendfile从file_fd发送
+    FileManager::Entry* pEntry;
+    int file_fd;
+    uint64_t body_offset;
+    uint64_t body_len;
+    bool resume_read;       // 上传写盘跟上了, 继续收数据, 没有要发送的内容
+    bool prefetch_done;     // sendfile的正文已经读进page cache直到body_offset, 没有要发送的内容
+};
 
 class CHttpConn;
+// sendfile下载时把正文的下一段读进page cache, 主线程只发送已经读进来的部分, 不会卡在读盘上
+class CPrefetchTask: public CTask
+{
+public:
+    // fd的所有权转给任务
+    CPrefetchTask(uint32_t conn_handle, int fd, uint64_t offset, uint64_t len);
+    virtual ~CPrefetchTask();
+    void run();
+private:
+    uint32_t m_conn_handle;
+    int m_fd;
+    uint64_t m_offset;
+    uint64_t m_len;
+};
+
 class CHttpTask: public CTask
 {
 public:
     CHttpTask(Request_t request);
     virtual ~CHttpTask();
     void run();
-    void OnUpload();
     void OnDownload();
 private:
+    // 解析Range: bytes=start-end, 没有Range或者不支持的格式返回0(返回整个文件), 区间无效返回-1
+    int _ParseRange(uint64_t file_size, uint64_t& start, uint64_t& end);
+
     uint32_t m_ConnHandle;
     int m_nMethod;
     string m_strUrl;
     string m_strContentType;
-    char* m_pContent;
-    int m_nContentLen;
     string m_strAccessHost;
+    string m_strRange;
 };
 
 class CHttpConn: public CRefObject
@@ -137,10 +180,31 @@ public:
     void OnClose();
     void OnTimer(uint64_t curr_tick);
     void OnSendComplete();
+    // 流式解析时收到的请求body, 返回非0时停止解析
+    int OnBody(const char* pData, uint32_t nLen);
 
     static void AddResponsePdu(uint32_t conn_handle, char* pContent, int nLen);   // 工作线程调用
+    // 工作线程调用, pHeader为响应头, pEntry和file_fd的所有权转给连接, 发完或者连接关闭时释放
+    static void AddFileResponse(uint32_t conn_handle, char* pHeader, int nHeaderLen, FileManager::Entry* pEntry,
+            int file_fd, uint64_t offset, uint64_t len);
+    static void AddResumeRead(uint32_t conn_handle);    // 工作线程调用
+    static void AddPrefetchDone(uint32_t conn_handle, uint64_t ready_offset);   // 工作线程调用
     static void SendResponsePduList();  // 主线程调用
 protected:
+    // 返回false时连接已经关闭或者已经回复了错误, 不能再访问成员
+    bool _ParseRequest();
+    bool _OnHeaders();
+    bool _OnRequestComplete();
+    void _SendUploadResult(int nErrorCode);
+
+    void _SendFile(Response_t* pResp);
+    // 发送m_out_buf里剩下的数据和正文, 发送缓冲区满时等OnWrite
+    void _SendPending();
+    // sendfile时已经读进来的正文不够了, 让工作线程读下一段
+    void _Prefetch();
+    void _OnPrefetchDone(uint64_t ready_offset);
+    void _ReleaseBody();
+
     net_handle_t m_sock_handle;
     uint32_t m_conn_handle;
     bool m_busy;
@@ -151,13 +215,21 @@ protected:
     string m_access_host;
     CSimpleBuffer m_in_buf;
     CSimpleBuffer m_out_buf;
+    bool m_header_done;
+    bool m_request_done;
+    CUploadStream* m_upload;
+    FileManager::Entry* m_body_entry;
+    int m_body_fd;
+    uint64_t m_body_offset;
+    uint64_t m_body_remain;
+    uint64_t m_body_ready;      // sendfile时已经读进page cache的位置, 只发送到这里
+    bool m_prefetching;
     uint64_t m_last_send_tick;
     uint64_t m_last_recv_tick;
 
     CHttpParserWrapper m_HttpParser;
 
-    static CLock          s_list_lock;
-    static list<Response_t*> s_response_pdu_list;    // 主线程发送回复消息
+    static CMpscQueue     s_response_queue;    // 工作线程无锁入队, 主线程发送回复消息
 };
 
 typedef hash_map<uint32_t, CHttpConn*> HttpConnMap_t;
@@ -0,0 +1,242 @@
+/*================================================================
+ *   文件名称：MultipartParser.cpp
+ *   描    述：multipart/form-data的增量解析
+ ================================================================*/
+#include "MultipartParser.h"
+#include <string.h>
+#include <strings.h>
+
+#define BOUNDARY_PARAM      "boundary="
+
+CMultipartParser::CMultipartParser()
+{
+    m_state = STATE_PREAMBLE;
+    m_error = MULTIPART_OK;
+    m_match = 0;
+}
+
+int CMultipartParser::Init(const string& strContentType)
+{
+    size_t nPos = strContentType.find(BOUNDARY_PARAM);
+    if (nPos == string::npos)
+    {
+        m_error = MULTIPART_ERR_BOUNDARY;
+        return m_error;
+    }
+    string strBoundary = strContentType.substr(nPos + strlen(BOUNDARY_PARAM));
+    nPos = strBoundary.find(';');
+    if (nPos != string::npos)
+        strBoundary.erase(nPos);
+    if (strBoundary.size() >= 2 && strBoundary[0] == '"' && strBoundary[strBoundary.size() - 1] == '"')
+        strBoundary = strBoundary.substr(1, strBoundary.size() - 2);
+    if (strBoundary.empty())
+    {
+        m_error = MULTIPART_ERR_BOUNDARY;
+        return m_error;
+    }
+
+    m_delimiter = "\r\n--" + strBoundary;
+    m_state = STATE_PREAMBLE;
+    // 第一个分隔符一般在body的最开头, 前面没有\r\n, 当作已经匹配了\r\n
+    m_match = 2;
+    return MULTIPART_OK;
+}
+
+int CMultipartParser::Feed(const char* pData, uint32_t nLen)
+{
+    uint32_t nPos = 0;
+    while (nPos < nLen && m_error == MULTIPART_OK)
+    {
+        switch (m_state)
+        {
+        case STATE_PREAMBLE:
+        case STATE_BODY:
+            nPos += _FeedBody(pData + nPos, nLen - nPos);
+            break;
+        case STATE_BOUNDARY_TAIL:
+            if (m_tail.empty() && (pData[nPos] == ' ' || pData[nPos] == '\t'))
+            {
+                // 分隔符后面允许有空白
+                nPos++;
+                break;
+            }
+            m_tail.push_back(pData[nPos++]);
+            if (m_tail.size() == 2)
+            {
+                if (m_tail == "--")
+                {
+                    m_state = STATE_END;
+                }
+                else if (m_tail == "\r\n")
+                {
+                    m_state = STATE_HEADER;
+                    m_header = "\r\n";
+                }
+                else
+                {
+                    m_error = MULTIPART_ERR_HEADER;
+                }
+            }
+            break;
+        case STATE_HEADER:
+            nPos += _FeedHeader(pData + nPos, nLen - nPos);
+            break;
+        case STATE_END:
+            // 结束分隔符后面的epilogue, 丢掉
+            return MULTIPART_OK;
+        }
+    }
+    return m_error;
+}
+
+int CMultipartParser::Finish()
+{
+    if (m_error == MULTIPART_OK && m_state != STATE_END)
+        m_error = MULTIPART_ERR_INCOMPLETE;
+    return m_error;
+}
+
+uint32_t CMultipartParser::_FeedBody(const char* pData, uint32_t nLen)
+{
+    uint32_t nPos = 0;
+    while (nPos < nLen)
+    {
+        if (m_match == 0)
+        {
+            // 分隔符只有第一个字节是\r, 找到\r之前的都是正文
+            const char* pCR = (const char*)memchr(pData + nPos, '\r', nLen - nPos);
+            uint32_t nDataLen = pCR ? (uint32_t)(pCR - pData - nPos) : nLen - nPos;
+            if (nDataLen > 0 && _EmitData(pData + nPos, nDataLen) != 0)
+                return nLen;
+            nPos += nDataLen;
+            if (!pCR)
+                break;
+        }
+
+        while (nPos < nLen && m_match < m_delimiter.size() && pData[nPos] == m_delimiter[m_match])
+        {
+            nPos++;
+            m_match++;
+        }
+        if (m_match == m_delimiter.size())
+        {
+            m_match = 0;
+            if (m_state == STATE_BODY && OnPartEnd() != 0)
+            {
+                m_error = MULTIPART_ERR_CALLBACK;
+                return nLen;
+            }
+            m_state = STATE_BOUNDARY_TAIL;
+            m_tail.clear();
+            return nPos;
+        }
+        if (nPos < nLen)
+        {
+            // 不匹配: 前面匹配上的是正文, 当前字节重新从分隔符开头匹配
+            if (_EmitData(m_delimiter.data(), m_match) != 0)
+                return nLen;
+            m_match = 0;
+        }
+    }
+    return nPos;
+}
+
+uint32_t CMultipartParser::_FeedHeader(const char* pData, uint32_t nLen)
+{
+    size_t nOldLen = m_header.size();
+    uint32_t nCopyLen = nLen;
+    if (nOldLen + nCopyLen > PART_HEADER_MAX + 4)
+        nCopyLen = PART_HEADER_MAX + 4 - nOldLen;
+    m_header.append(pData, nCopyLen);
+
+    // m_header以\r\n开头, 没有头部的part也能找到\r\n\r\n
+    size_t nEnd = m_header.find("\r\n\r\n", (nOldLen > 3) ? nOldLen - 3 : 0);
+    if (nEnd == string::npos)
+    {
+        if (m_header.size() >= PART_HEADER_MAX + 4)
+            m_error = MULTIPART_ERR_HEADER;
+        return nCopyLen;
+    }
+
+    uint32_t nUsed = (uint32_t)(nEnd + 4 - nOldLen);
+    m_header.erase(nEnd + 2);
+    if (_ParseHeader() != 0)
+    {
+        m_error = MULTIPART_ERR_CALLBACK;
+        return nLen;
+    }
+    m_header.clear();
+    m_state = STATE_BODY;
+    m_match = 0;
+    return nUsed;
+}
+
+int CMultipartParser::_EmitData(const char* pData, uint32_t nLen)
+{
+    if (m_state != STATE_BODY || nLen == 0)
+        return 0;
+    if (OnPartData(pData, nLen) != 0)
+    {
+        m_error = MULTIPART_ERR_CALLBACK;
+        return -1;
+    }
+    return 0;
+}
+
+int CMultipartParser::_ParseHeader()
+{
+    string strDisposition;
+    string strContentType;
+    size_t nStart = 2;
+    while (nStart < m_header.size())
+    {
+        size_t nEnd = m_header.find("\r\n", nStart);
+        if (nEnd == string::npos)
+            nEnd = m_header.size();
+        string strLine = m_header.substr(nStart, nEnd - nStart);
+        nStart = nEnd + 2;
+
+        size_t nColon = strLine.find(':');
+        if (nColon == string::npos)
+            continue;
+        size_t nValue = strLine.find_first_not_of(" \t", nColon + 1);
+        string strValue = (nValue == string::npos) ? "" : strLine.substr(nValue);
+        if (nColon == 19 && strncasecmp(strLine.c_str(), "Content-Disposition", 19) == 0)
+            strDisposition = strValue;
+        else if (nColon == 12 && strncasecmp(strLine.c_str(), "Content-Type", 12) == 0)
+            strContentType = strValue;
+    }
+
+    return OnPartBegin(_GetParam(strDisposition, "name"), _GetParam(strDisposition, "filename"), strContentType);
+}
+
+// form-data; name="file"; filename="a.png" 里取一个参数的值, 去掉引号
+string CMultipartParser::_GetParam(const string& strHeader, const char* szName)
+{
+    size_t nNameLen = strlen(szName);
+    size_t nStart = strHeader.find(';');
+    while (nStart != string::npos)
+    {
+        nStart = strHeader.find_first_not_of(" \t", nStart + 1);
+        if (nStart == string::npos)
+            break;
+        size_t nEnd = nStart;
+        bool bQuoted = false;
+        while (nEnd < strHeader.size() && (bQuoted || strHeader[nEnd] != ';'))
+        {
+            if (strHeader[nEnd] == '"')
+                bQuoted = !bQuoted;
+            nEnd++;
+        }
+        if (nEnd - nStart > nNameLen && strHeader[nStart + nNameLen] == '='
+                && strncasecmp(strHeader.c_str() + nStart, szName, nNameLen) == 0)
+        {
+            string strValue = strHeader.substr(nStart + nNameLen + 1, nEnd - nStart - nNameLen - 1);
+            if (strValue.size() >= 2 && strValue[0] == '"' && strValue[strValue.size() - 1] == '"')
+                strValue = strValue.substr(1, strValue.size() - 2);
+            return strValue;
+        }
+        nStart = (nEnd < strHeader.size()) ? nEnd : string::npos;
+    }
+    return "";
+}
@@ -0,0 +1,70 @@
+/*================================================================
+ *   文件名称：MultipartParser.h
+ *   描    述：multipart/form-data的增量解析, 数据分多次送进来, 不需要整个body都在内存里:
+ *             1. 分隔符(\r\n--boundary)可以跨两次Feed, 已经匹配的前缀就是分隔符本身,
+ *                不匹配时从分隔符里取回来当正文交出去, 不用额外缓存
+ *             2. 每个part的头部最多PART_HEADER_MAX字节, 超过时当作格式错误
+ *             3. 正文通过OnPartData分段交给派生类, 数据指针只在回调里有效
+ ================================================================*/
+#ifndef __MULTIPART_PARSER_H__
+#define __MULTIPART_PARSER_H__
+
+#include "ostype.h"
+#include <string>
+using namespace std;
+
+#define PART_HEADER_MAX     0x2000  //8K
+
+enum {
+    MULTIPART_OK = 0,
+    MULTIPART_ERR_BOUNDARY,     // Content-Type里没有boundary
+    MULTIPART_ERR_HEADER,       // part的头部太长
+    MULTIPART_ERR_CALLBACK,     // 派生类的回调返回了错误
+    MULTIPART_ERR_INCOMPLETE,   // 数据结束了还没有看到结束分隔符
+};
+
+class CMultipartParser
+{
+public:
+    CMultipartParser();
+    virtual ~CMultipartParser() {}
+
+    // strContentType为请求头里的Content-Type, 从里面取boundary
+    int Init(const string& strContentType);
+    // 返回MULTIPART_OK, 出错之后不再解析, 再调用返回同样的错误
+    int Feed(const char* pData, uint32_t nLen);
+    // body收完时调用, 检查是否完整
+    int Finish();
+    bool IsComplete() { return m_state == STATE_END; }
+
+protected:
+    // 返回非0时停止解析
+    virtual int OnPartBegin(const string& strName, const string& strFileName, const string& strContentType) = 0;
+    virtual int OnPartData(const char* pData, uint32_t nLen) = 0;
+    virtual int OnPartEnd() = 0;
+
+private:
+    enum {
+        STATE_PREAMBLE,         // 第一个分隔符之前的内容, 丢掉
+        STATE_BOUNDARY_TAIL,    // 分隔符后面的两个字节: \r\n是下一个part, --是结束
+        STATE_HEADER,
+        STATE_BODY,
+        STATE_END,
+    };
+
+    // 在正文(或preamble)里找分隔符, 返回消耗的字节数
+    uint32_t _FeedBody(const char* pData, uint32_t nLen);
+    uint32_t _FeedHeader(const char* pData, uint32_t nLen);
+    int _EmitData(const char* pData, uint32_t nLen);
+    int _ParseHeader();
+    static string _GetParam(const string& strHeader, const char* szName);
+
+    int         m_state;
+    int         m_error;
+    string      m_delimiter;    // \r\n--boundary
+    uint32_t    m_match;        // m_delimiter已经匹配的字节数
+    string      m_tail;         // STATE_BOUNDARY_TAIL已经收到的字节
+    string      m_header;
+};
+
+#endif
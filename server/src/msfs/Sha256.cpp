@@ -0,0 +1,131 @@
+/*
+ * Multimedia Small File Storage System
+ * SHA-256 implement, FIPS 180-4
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include "Sha256.h"
+
+namespace msfs {
+
+static const u32 K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+void Sha256::init() {
+	m_state[0] = 0x6a09e667;
+	m_state[1] = 0xbb67ae85;
+	m_state[2] = 0x3c6ef372;
+	m_state[3] = 0xa54ff53a;
+	m_state[4] = 0x510e527f;
+	m_state[5] = 0x9b05688c;
+	m_state[6] = 0x1f83d9ab;
+	m_state[7] = 0x5be0cd19;
+	m_totalSize = 0;
+	m_blockSize = 0;
+}
+
+void Sha256::transform(const u8 *block) {
+	u32 w[64];
+	for (int i = 0; i < 16; i++) {
+		w[i] = ((u32)block[i * 4] << 24) | ((u32)block[i * 4 + 1] << 16)
+				| ((u32)block[i * 4 + 2] << 8) | (u32)block[i * 4 + 3];
+	}
+	for (int i = 16; i < 64; i++) {
+		u32 s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		u32 s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	u32 a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+	u32 e = m_state[4], f = m_state[5], g = m_state[6], h = m_state[7];
+	for (int i = 0; i < 64; i++) {
+		u32 t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+		u32 t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	m_state[0] += a;
+	m_state[1] += b;
+	m_state[2] += c;
+	m_state[3] += d;
+	m_state[4] += e;
+	m_state[5] += f;
+	m_state[6] += g;
+	m_state[7] += h;
+}
+
+void Sha256::update(const void *data, u64 size) {
+	const u8 *p = (const u8 *)data;
+	m_totalSize += size;
+
+	//先补齐上次剩下的半个块
+	if (m_blockSize > 0) {
+		u32 n = 64 - m_blockSize;
+		if (n > size)
+			n = (u32)size;
+		memcpy(m_block + m_blockSize, p, n);
+		m_blockSize += n;
+		p += n;
+		size -= n;
+		if (m_blockSize < 64)
+			return;
+		transform(m_block);
+		m_blockSize = 0;
+	}
+
+	while (size >= 64) {
+		transform(p);
+		p += 64;
+		size -= 64;
+	}
+	if (size > 0) {
+		memcpy(m_block, p, size);
+		m_blockSize = (u32)size;
+	}
+}
+
+void Sha256::final(u8 digest[DIGEST_SIZE]) {
+	u64 bits = m_totalSize * 8;
+	u8 pad[72];
+	u32 padSize = (m_blockSize < 56) ? (56 - m_blockSize) : (120 - m_blockSize);
+	memset(pad, 0, sizeof(pad));
+	pad[0] = 0x80;
+	for (int i = 0; i < 8; i++)
+		pad[padSize + i] = (u8)(bits >> (56 - i * 8));
+	update(pad, padSize + 8);
+
+	for (int i = 0; i < 8; i++) {
+		digest[i * 4] = (u8)(m_state[i] >> 24);
+		digest[i * 4 + 1] = (u8)(m_state[i] >> 16);
+		digest[i * 4 + 2] = (u8)(m_state[i] >> 8);
+		digest[i * 4 + 3] = (u8)m_state[i];
+	}
+}
+
+string Sha256::finalHex() {
+	u8 digest[DIGEST_SIZE];
+	final(digest);
+	char hex[DIGEST_SIZE * 2 + 1];
+	for (u32 i = 0; i < DIGEST_SIZE; i++)
+		snprintf(hex + i * 2, 3, "%02x", digest[i]);
+	return string(hex, DIGEST_SIZE * 2);
+}
+
+}
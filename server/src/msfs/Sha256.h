@@ -0,0 +1,40 @@
+/*
+ * Multimedia Small File Storage System
+ * SHA-256, 可以分多次update, 上传时边收边算文件内容的hash
+*/
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include "Portable.h"
+#include <string>
+
+using namespace std;
+
+namespace msfs {
+
+class Sha256 {
+public:
+	static const u32 DIGEST_SIZE = 32;
+
+	Sha256() { init(); }
+
+	void init();
+	void update(const void *data, u64 size);
+	void final(u8 digest[DIGEST_SIZE]);
+	//final之后转成64个字符的小写十六进制
+	string finalHex();
+
+private:
+	void transform(const u8 *block);
+
+private:
+	u32 m_state[8];
+	u64 m_totalSize;	//已经update的字节数
+	u8 m_block[64];
+	u32 m_blockSize;	//m_block里还没处理的字节数
+};
+
+}
+
+#endif
@@ -0,0 +1,355 @@
+/*================================================================
+ *   文件名称：UploadStream.cpp
+ *   描    述：流式上传
+ ================================================================*/
+#include "UploadStream.h"
+#include "HttpConn.h"
+#include "atomic.h"
+
+static CMetricCounter* g_upload_ok_counter = NULL;
+static CMetricCounter* g_upload_error_counter = NULL;
+static CMetricCounter* g_upload_bytes_counter = NULL;
+
+CUploadStream::CUploadStream(uint32_t conn_handle, const string& strAccessHost)
+{
+    m_conn_handle = conn_handle;
+    m_access_host = strAccessHost;
+    m_error = UPLOAD_OK;
+    m_in_file = false;
+    m_has_file = false;
+    m_finished = false;
+    m_file_size = 0;
+    m_chunk = NULL;
+    m_chunk_len = 0;
+    m_pending_cnt = 0;
+    m_paused = 0;
+    m_fd = -1;
+    m_write_offset = 0;
+    m_write_error = false;
+
+    if (!g_upload_ok_counter)
+    {
+        CMetricsRegistry* pRegistry = CMetricsRegistry::getInstance();
+        g_upload_ok_counter = pRegistry->GetCounter("teamtalk_msfs_upload_total", "uploads by result",
+                metrics_label("result", "ok"));
+        g_upload_error_counter = pRegistry->GetCounter("teamtalk_msfs_upload_total", "uploads by result",
+                metrics_label("result", "error"));
+        g_upload_bytes_counter = pRegistry->GetCounter("teamtalk_msfs_upload_bytes_total",
+                "bytes of uploaded files written to disk");
+    }
+}
+
+CUploadStream::~CUploadStream()
+{
+    if (m_chunk)
+    {
+        delete [] m_chunk;
+        m_chunk = NULL;
+    }
+    if (m_fd != -1)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+int CUploadStream::Init(const string& strContentType)
+{
+    if (CMultipartParser::Init(strContentType) != MULTIPART_OK)
+        m_error = UPLOAD_ERR_BOUNDARY;
+    return m_error;
+}
+
+int CUploadStream::Write(const char* pData, uint32_t nLen)
+{
+    if (m_error == UPLOAD_OK && Feed(pData, nLen) != MULTIPART_OK && m_error == UPLOAD_OK)
+        m_error = UPLOAD_ERR_FORMAT;
+    return m_error;
+}
+
+int CUploadStream::Finish()
+{
+    if (m_error == UPLOAD_OK && CMultipartParser::Finish() != MULTIPART_OK)
+        m_error = UPLOAD_ERR_FORMAT;
+    if (m_error == UPLOAD_OK && !m_has_file)
+        m_error = UPLOAD_ERR_NO_FILE;
+    if (m_error != UPLOAD_OK)
+    {
+        Abort();
+        return m_error;
+    }
+
+    _SubmitChunk();
+    m_finished = true;
+    _SubmitComplete(false);
+    return UPLOAD_OK;
+}
+
+void CUploadStream::Abort()
+{
+    if (m_finished)
+        return;
+    m_finished = true;
+    g_upload_error_counter->Inc();
+    _SubmitComplete(true);
+}
+
+bool CUploadStream::PauseIfBusy()
+{
+    if (m_pending_cnt < UPLOAD_MAX_PENDING)
+        return false;
+
+    // 先置暂停标志再检查一次, 写盘线程在两次检查之间写完的话由这里自己清掉, 不会漏掉唤醒
+    m_paused = 1;
+    __sync_synchronize();
+    if (m_pending_cnt < UPLOAD_MAX_PENDING && __sync_bool_compare_and_swap(&m_paused, 1, 0))
+        return false;
+    return true;
+}
+
+int CUploadStream::OnPartBegin(const string& strName, const string& strFileName, const string& strContentType)
+{
+    NOTUSED_ARG(strName);
+    NOTUSED_ARG(strContentType);
+    if (m_has_file || strFileName.empty())
+        return 0;
+
+    m_error = _ParseFileName(strFileName);
+    if (m_error != UPLOAD_OK)
+        return -1;
+    log("upload file, file name:%s", strFileName.c_str());
+    m_has_file = true;
+    m_in_file = true;
+    return 0;
+}
+
+int CUploadStream::OnPartData(const char* pData, uint32_t nLen)
+{
+    if (!m_in_file)
+        return 0;
+
+    m_file_size += nLen;
+    if (m_file_size > msfs::FileManager::MAX_FILE_SIZE_PER_FILE)
+    {
+        m_error = UPLOAD_ERR_TOO_LARGE;
+        return -1;
+    }
+
+    while (nLen > 0)
+    {
+        if (!m_chunk)
+        {
+            m_chunk = new char[UPLOAD_CHUNK_SIZE];
+            m_chunk_len = 0;
+        }
+        uint32_t nCopyLen = UPLOAD_CHUNK_SIZE - m_chunk_len;
+        if (nCopyLen > nLen)
+            nCopyLen = nLen;
+        memcpy(m_chunk + m_chunk_len, pData, nCopyLen);
+        m_chunk_len += nCopyLen;
+        pData += nCopyLen;
+        nLen -= nCopyLen;
+        if (m_chunk_len == UPLOAD_CHUNK_SIZE)
+            _SubmitChunk();
+    }
+    return 0;
+}
+
+int CUploadStream::OnPartEnd()
+{
+    m_in_file = false;
+    return 0;
+}
+
+// 文件名如abc_100x200.png, 带尺寸时保存为xxx_100x200.png, 否则为xxx.png
+int CUploadStream::_ParseFileName(const string& strFileName)
+{
+    if (strFileName.size() > 255)
+        return UPLOAD_ERR_NAME_LEN;
+    size_t nTypePos = strFileName.rfind('.');
+    if (nTypePos == string::npos)
+        return UPLOAD_ERR_NO_TYPE;
+    m_type = strFileName.substr(nTypePos + 1);
+    if (m_type.size() > 15)
+        return UPLOAD_ERR_TYPE_LEN;
+
+    m_extend.clear();
+    size_t nExtendPos = strFileName.rfind('_');
+    if (nExtendPos == string::npos || nExtendPos > nTypePos)
+        return UPLOAD_OK;
+    size_t nXPos = strFileName.find('x', nExtendPos + 1);
+    if (nXPos == string::npos || nXPos > nTypePos)
+        return UPLOAD_OK;
+    size_t nWidthLen = nXPos - nExtendPos - 1;
+    size_t nHeightLen = nTypePos - nXPos - 1;
+    if (nWidthLen <= 4 && nHeightLen <= 4)
+    {
+        char szExtend[32];
+        int nWidth = atoi(strFileName.substr(nExtendPos + 1, nWidthLen).c_str());
+        int nHeight = atoi(strFileName.substr(nXPos + 1, nHeightLen).c_str());
+        snprintf(szExtend, sizeof(szExtend), "%dx%d.%s", nWidth, nHeight, m_type.c_str());
+        m_extend = szExtend;
+    }
+    return UPLOAD_OK;
+}
+
+void CUploadStream::_SubmitChunk()
+{
+    if (!m_chunk || m_chunk_len == 0)
+        return;
+
+    ATOMIC_ADD(&m_pending_cnt, 1);
+    AddRef();
+    g_PostThreadPool.AddTask(new CUploadTask(this, CUploadTask::UPLOAD_TASK_WRITE, m_chunk, m_chunk_len),
+            m_conn_handle);
+    m_chunk = NULL;
+    m_chunk_len = 0;
+}
+
+void CUploadStream::_SubmitComplete(bool bAbort)
+{
+    AddRef();
+    g_PostThreadPool.AddTask(new CUploadTask(this, bAbort ? CUploadTask::UPLOAD_TASK_ABORT :
+            CUploadTask::UPLOAD_TASK_COMPLETE), m_conn_handle);
+}
+
+void CUploadStream::WriteChunk(char* pBuf, uint32_t nLen)
+{
+    if (!m_write_error && m_fd == -1)
+    {
+        m_fd = g_fileManager->createUploadFile(m_tmp_path);
+        if (m_fd == -1)
+            m_write_error = true;
+    }
+
+    uint32_t nOffset = 0;
+    while (!m_write_error && nOffset < nLen)
+    {
+        ssize_t ret = pwrite(m_fd, pBuf + nOffset, nLen - nOffset, m_write_offset);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            log("write upload file[%s] error[%d]", m_tmp_path.c_str(), errno);
+            m_write_error = true;
+            break;
+        }
+        nOffset += ret;
+        m_write_offset += ret;
+    }
+    if (!m_write_error)
+    {
+        m_sha256.update(pBuf, nLen);
+        g_upload_bytes_counter->Inc(nLen);
+    }
+
+    if (ATOMIC_SUB_AND_FETCH(&m_pending_cnt, 1) < UPLOAD_MAX_PENDING
+            && m_paused && __sync_bool_compare_and_swap(&m_paused, 1, 0))
+    {
+        CHttpConn::AddResumeRead(m_conn_handle);
+    }
+}
+
+void CUploadStream::Complete(bool bAbort)
+{
+    if (!bAbort && !m_write_error && m_fd == -1)
+    {
+        // 空文件
+        m_fd = g_fileManager->createUploadFile(m_tmp_path);
+        if (m_fd == -1)
+            m_write_error = true;
+    }
+    if (!bAbort && !m_write_error && fsync(m_fd) != 0)
+    {
+        log("fsync upload file[%s] error[%d]", m_tmp_path.c_str(), errno);
+        m_write_error = true;
+    }
+    if (m_fd != -1)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+    if (bAbort)
+    {
+        if (!m_tmp_path.empty())
+            unlink(m_tmp_path.c_str());
+        return;
+    }
+
+    string strHash = m_sha256.finalHex();
+    char szPath[512] = { 0 };
+    if (m_write_error || g_fileManager->commitUploadFile(m_tmp_path, strHash, m_write_offset, m_type.c_str(),
+            szPath, m_extend.empty() ? NULL : m_extend.c_str()) != 0)
+    {
+        unlink(m_tmp_path.c_str());
+        g_upload_error_counter->Inc();
+        char* pContent = MakeResult(UPLOAD_ERR_WRITE, "", "", "");
+        CHttpConn::AddResponsePdu(m_conn_handle, pContent, strlen(pContent));
+        return;
+    }
+
+    log("upload file done, path=%s, size=%llu, sha256=%s", szPath, (unsigned long long)m_write_offset,
+            strHash.c_str());
+    g_upload_ok_counter->Inc();
+    char* pContent = MakeResult(UPLOAD_OK, szPath, m_access_host.c_str(), strHash.c_str());
+    CHttpConn::AddResponsePdu(m_conn_handle, pContent, strlen(pContent));
+}
+
+char* CUploadStream::MakeResult(int nErrorCode, const char* szPath, const char* szHost, const char* szHash)
+{
+    char url[1024];
+    if (nErrorCode == UPLOAD_OK)
+    {
+        snprintf(url, sizeof(url), "{\"error_code\":0,\"error_msg\": \"成功\",\"path\":\"%s\",\"url\":\"http://%s/%s\",\"sha256\":\"%s\"}",
+                szPath, szHost, szPath, szHash);
+    }
+    else
+    {
+        const char* szMsg = "格式错误";
+        if (nErrorCode == UPLOAD_ERR_TOO_LARGE)
+            szMsg = "上传文件过大";
+        else if (nErrorCode == UPLOAD_ERR_WRITE)
+            szMsg = "写文件失败";
+        snprintf(url, sizeof(url), "{\"error_code\":%d,\"error_msg\": \"%s\",\"path\":\"\",\"url\":\"\"}",
+                nErrorCode, szMsg);
+        log("%s", url);
+    }
+    uint32_t content_length = strlen(url);
+    char* pContent = new char[HTTP_RESPONSE_HTML_MAX + content_length];
+    snprintf(pContent, HTTP_RESPONSE_HTML_MAX + content_length, HTTP_RESPONSE_HTML, content_length, url);
+    return pContent;
+}
+
+CUploadTask::CUploadTask(CUploadStream* pStream, int nType, char* pBuf, uint32_t nLen)
+{
+    m_stream = pStream;
+    m_type = nType;
+    m_buf = pBuf;
+    m_len = nLen;
+}
+
+CUploadTask::~CUploadTask()
+{
+    if (m_buf)
+    {
+        delete [] m_buf;
+        m_buf = NULL;
+    }
+    m_stream->ReleaseRef();
+}
+
+void CUploadTask::run()
+{
+    switch (m_type)
+    {
+    case UPLOAD_TASK_WRITE:
+        m_stream->WriteChunk(m_buf, m_len);
+        break;
+    case UPLOAD_TASK_COMPLETE:
+        m_stream->Complete(false);
+        break;
+    case UPLOAD_TASK_ABORT:
+        m_stream->Complete(true);
+        break;
+    }
+}
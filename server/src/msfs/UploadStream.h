@@ -0,0 +1,111 @@
+/*================================================================
+ *   文件名称：UploadStream.h
+ *   描    述：流式上传, 不再把整个请求body攒在内存里:
+ *             1. 主线程每收到一段body就交给multipart解析, 文件内容攒满UPLOAD_CHUNK_SIZE
+ *                交给上传线程池写临时文件, 同一个连接的写盘任务带亲和性, 在同一个线程里按顺序执行
+ *             2. 写盘线程边写边算SHA-256, 收完后fsync, 按内容去重存放或者rename到正式路径, 再回复客户端
+ *             3. 没写完的块超过UPLOAD_MAX_PENDING个时主线程暂停收数据, 写完一块后再继续,
+ *                每个上传占的内存不超过(UPLOAD_MAX_PENDING + 1) * UPLOAD_CHUNK_SIZE, 和文件大小无关
+ ================================================================*/
+#ifndef __UPLOAD_STREAM_H__
+#define __UPLOAD_STREAM_H__
+
+#include "util.h"
+#include "Task.h"
+#include "MultipartParser.h"
+#include "Sha256.h"
+#include "Metrics.h"
+
+#define UPLOAD_CHUNK_SIZE       0x40000     //256K
+#define UPLOAD_MAX_PENDING      4
+
+// 回复里的error_code, 和原来整包解析时的错误码保持一致
+enum {
+    UPLOAD_OK = 0,
+    UPLOAD_ERR_TOO_LARGE = 1,       // 上传文件过大
+    UPLOAD_ERR_NO_FILE = 2,         // 没有带filename的part
+    UPLOAD_ERR_BOUNDARY = 4,        // Content-Type里没有boundary
+    UPLOAD_ERR_FORMAT = 8,          // multipart格式错误
+    UPLOAD_ERR_TYPE_LEN = 9,        // 扩展名太长
+    UPLOAD_ERR_NO_TYPE = 10,        // 文件名没有扩展名
+    UPLOAD_ERR_NAME_LEN = 11,       // 文件名太长
+    UPLOAD_ERR_WRITE = 12,          // 写文件失败
+};
+
+class CUploadStream : public CMultipartParser, public CRefObject
+{
+public:
+    CUploadStream(uint32_t conn_handle, const string& strAccessHost);
+    virtual ~CUploadStream();
+
+    // 以下主线程调用, 出错时返回错误码, 由调用者回复
+    int Init(const string& strContentType);
+    int Write(const char* pData, uint32_t nLen);
+    int Finish();
+    // 连接关闭或者出错, 删掉临时文件; Finish之后调用不做任何事
+    void Abort();
+    // 写盘跟不上时返回true, 主线程不再收数据, 写完一块后通过CHttpConn::AddResumeRead唤醒
+    bool PauseIfBusy();
+    int GetError() { return m_error; }
+
+    // 以下写盘线程调用
+    void WriteChunk(char* pBuf, uint32_t nLen);
+    void Complete(bool bAbort);
+
+    // 上传结果的HTTP回复, new出来的, 调用者负责delete []
+    static char* MakeResult(int nErrorCode, const char* szPath, const char* szHost, const char* szHash);
+protected:
+    virtual int OnPartBegin(const string& strName, const string& strFileName, const string& strContentType);
+    virtual int OnPartData(const char* pData, uint32_t nLen);
+    virtual int OnPartEnd();
+private:
+    int _ParseFileName(const string& strFileName);
+    void _SubmitChunk();
+    void _SubmitComplete(bool bAbort);
+
+    // 主线程用
+    uint32_t        m_conn_handle;
+    string          m_access_host;
+    int             m_error;
+    bool            m_in_file;      // 正在接收文件的part
+    bool            m_has_file;     // 已经收到了一个文件, 后面带filename的part忽略
+    bool            m_finished;
+    uint64_t        m_file_size;
+    char*           m_chunk;
+    uint32_t        m_chunk_len;
+    string          m_type;
+    string          m_extend;       // 文件名带尺寸时的后缀, 如100x200.png
+
+    // 主线程和写盘线程共用
+    volatile long   m_pending_cnt;  // 交给写盘线程还没写完的块数
+    volatile long   m_paused;
+
+    // 写盘线程用
+    int             m_fd;
+    string          m_tmp_path;
+    uint64_t        m_write_offset;
+    bool            m_write_error;
+    msfs::Sha256    m_sha256;
+};
+
+class CUploadTask : public CTask
+{
+public:
+    enum {
+        UPLOAD_TASK_WRITE,
+        UPLOAD_TASK_COMPLETE,
+        UPLOAD_TASK_ABORT,
+    };
+
+    // 持有pStream的一个引用, pBuf的所有权转给任务
+    CUploadTask(CUploadStream* pStream, int nType, char* pBuf = NULL, uint32_t nLen = 0);
+    virtual ~CUploadTask();
+    virtual void run();
+private:
+    CUploadStream*  m_stream;
+    int             m_type;
+    char*           m_buf;
+    uint32_t        m_len;
+};
+
+#endif
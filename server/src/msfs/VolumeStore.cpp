@@ -0,0 +1,619 @@
+/*
+ * Multimedia Small File Storage System
+ * packed volume store implement
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "VolumeStore.h"
+#include "FileLin.h"
+#include "util.h"
+
+#define VOLUME_DAT_SUFFIX		".dat"
+#define VOLUME_IDX_SUFFIX		".idx"
+#define VOLUME_TMP_SUFFIX		".tmp"
+#define VOLUME_IO_BUF_SIZE		0x40000
+#define VOLUME_INIT_CAPACITY	(1 << 16)
+#define VOLUME_LOAD_RECORDS		4096
+
+namespace msfs {
+
+VolumeStore::VolumeStore() {
+	m_opened = false;
+	m_volumeSize = 0;
+	m_writable = NULL;
+	m_table = NULL;
+	m_capacity = 0;
+	m_size = 0;
+}
+
+VolumeStore::~VolumeStore() {
+	VolumeMap::iterator it = m_volumes.begin();
+	for (; it != m_volumes.end(); it++) {
+		::close(it->second->datFd);
+		::close(it->second->idxFd);
+		delete it->second;
+	}
+	m_volumes.clear();
+	if (m_table)
+		delete [] m_table;
+	m_table = NULL;
+}
+
+int VolumeStore::init(const char *disk, u64 volumeSize) {
+	m_dir = string(disk) + VOLUME_DIR;
+	m_volumeSize = volumeSize;
+	u64 code = File::mkdirNoRecursion(m_dir.c_str());
+	if (code && code != EEXIST) {
+		log("Create dir[%s] error[%d]", m_dir.c_str(), (int)code);
+		return -1;
+	}
+	resize(VOLUME_INIT_CAPACITY);
+
+	DIR *dp = opendir(m_dir.c_str());
+	if (!dp) {
+		log("Open dir[%s] error[%d]", m_dir.c_str(), errno);
+		return -1;
+	}
+	vector<u32> ids;
+	struct dirent *ep = NULL;
+	while ((ep = readdir(dp)) != NULL) {
+		char *end = NULL;
+		u32 id = strtoul(ep->d_name, &end, 10);
+		if (end != ep->d_name && id > 0 && strcmp(end, VOLUME_DAT_SUFFIX) == 0)
+			ids.push_back(id);
+	}
+	closedir(dp);
+
+	//按id从小到大加载, 后写的记录覆盖先写的
+	sort(ids.begin(), ids.end());
+	for (u32 i = 0; i < ids.size(); i++) {
+		volume_t *vol = openVolume(ids[i], false);
+		if (!vol || loadVolume(vol) != 0)
+			return -1;
+	}
+	if (!m_volumes.empty())
+		m_writable = m_volumes.rbegin()->second;
+	m_opened = true;
+	log("volume store %s: volumes=%u, needles=%u", m_dir.c_str(), (u32)m_volumes.size(), m_size);
+	return 0;
+}
+
+u64 VolumeStore::digestKey(const u8 *digest) {
+	u64 key;
+	memcpy(&key, digest, sizeof(key));
+	return key ? key : 1;
+}
+
+//调用者持有m_cs
+VolumeStore::entry_t* VolumeStore::find(u64 key) {
+	u32 mask = m_capacity - 1;
+	for (u32 i = key & mask; ; i = (i + 1) & mask) {
+		if (m_table[i].key == key)
+			return &m_table[i];
+		if (m_table[i].key == 0)
+			return NULL;
+	}
+}
+
+//调用者持有m_cs, 负载超过3/4时扩容
+VolumeStore::entry_t* VolumeStore::insert(u64 key) {
+	if ((m_size + 1) * 4 > m_capacity * 3)
+		resize(m_capacity * 2);
+	u32 mask = m_capacity - 1;
+	u32 i = key & mask;
+	while (m_table[i].key != 0)
+		i = (i + 1) & mask;
+	memset(&m_table[i], 0, sizeof(entry_t));
+	m_table[i].key = key;
+	m_size++;
+	return &m_table[i];
+}
+
+//调用者持有m_cs, 线性探测删除后把后面的项往前移, 不留墓碑
+void VolumeStore::erase(entry_t *entry) {
+	u32 mask = m_capacity - 1;
+	u32 hole = entry - m_table;
+	for (u32 i = (hole + 1) & mask; m_table[i].key != 0; i = (i + 1) & mask) {
+		u32 home = m_table[i].key & mask;
+		//home不在(hole, i]之间时可以移到hole
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			m_table[hole] = m_table[i];
+			hole = i;
+		}
+	}
+	m_table[hole].key = 0;
+	m_size--;
+}
+
+void VolumeStore::resize(u32 capacity) {
+	entry_t *old = m_table;
+	u32 oldCapacity = m_capacity;
+	m_table = new entry_t[capacity];
+	memset(m_table, 0, sizeof(entry_t) * capacity);
+	m_capacity = capacity;
+	u32 mask = capacity - 1;
+	for (u32 j = 0; j < oldCapacity; j++) {
+		if (old[j].key == 0)
+			continue;
+		u32 i = old[j].key & mask;
+		while (m_table[i].key != 0)
+			i = (i + 1) & mask;
+		m_table[i] = old[j];
+	}
+	if (old)
+		delete [] old;
+}
+
+VolumeStore::volume_t* VolumeStore::openVolume(u32 id, bool create) {
+	char name[32];
+	snprintf(name, sizeof(name), "/%u", id);
+	string datPath = m_dir + name + VOLUME_DAT_SUFFIX;
+	string idxPath = m_dir + name + VOLUME_IDX_SUFFIX;
+
+	int flags = O_RDWR | (create ? (O_CREAT | O_EXCL) : 0);
+	int datFd = ::open(datPath.c_str(), flags, 00640);
+	if (datFd == -1) {
+		log("Open volume[%s] error[%d]", datPath.c_str(), errno);
+		return NULL;
+	}
+	int idxFd = ::open(idxPath.c_str(), O_RDWR | O_CREAT | O_APPEND, 00640);
+	if (idxFd == -1) {
+		log("Open volume index[%s] error[%d]", idxPath.c_str(), errno);
+		::close(datFd);
+		return NULL;
+	}
+	struct stat buf;
+	if (fstat(datFd, &buf) != 0) {
+		::close(datFd);
+		::close(idxFd);
+		return NULL;
+	}
+
+	volume_t *vol = new volume_t;
+	vol->id = id;
+	vol->datFd = datFd;
+	vol->idxFd = idxFd;
+	vol->datSize = buf.st_size;
+	vol->liveBytes = 0;
+	vol->liveCnt = 0;
+	vol->recordCnt = 0;
+	m_cs.Enter();
+	m_volumes[id] = vol;
+	m_cs.Leave();
+	return vol;
+}
+
+void VolumeStore::closeVolume(volume_t *vol, bool remove) {
+	m_cs.Enter();
+	m_volumes.erase(vol->id);
+	m_cs.Leave();
+	::close(vol->datFd);
+	::close(vol->idxFd);
+	if (remove) {
+		char name[32];
+		snprintf(name, sizeof(name), "/%u", vol->id);
+		unlink((m_dir + name + VOLUME_IDX_SUFFIX).c_str());
+		unlink((m_dir + name + VOLUME_DAT_SUFFIX).c_str());
+	}
+	delete vol;
+}
+
+int VolumeStore::loadVolume(volume_t *vol) {
+	volume_index_t *recs = new volume_index_t[VOLUME_LOAD_RECORDS];
+	u64 offset = 0;
+	u64 indexedEnd = 0;
+	while (true) {
+		ssize_t ret = pread(vol->idxFd, recs, sizeof(volume_index_t) * VOLUME_LOAD_RECORDS, offset);
+		if (ret < 0) {
+			log("Read volume index %u error[%d]", vol->id, errno);
+			delete [] recs;
+			return -1;
+		}
+		u32 cnt = ret / sizeof(volume_index_t);
+		for (u32 i = 0; i < cnt; i++) {
+			//索引比卷文件新(卷文件没有sync上)的记录丢掉
+			u64 end = recs[i].offset + needleSize(recs[i].size);
+			if (end > vol->datSize) {
+				log("Volume %u index beyond data, offset=%llu", vol->id, recs[i].offset);
+				continue;
+			}
+			if (end > indexedEnd)
+				indexedEnd = end;
+			applyRecord(vol, recs[i]);
+		}
+		offset += (u64)cnt * sizeof(volume_index_t);
+		if ((size_t)ret < sizeof(volume_index_t) * VOLUME_LOAD_RECORDS)
+			break;
+	}
+	delete [] recs;
+
+	//写了一半的记录
+	struct stat buf;
+	if (fstat(vol->idxFd, &buf) == 0 && (u64)buf.st_size != offset)
+		ftruncate(vol->idxFd, offset);
+	vol->recordCnt = offset / sizeof(volume_index_t);
+	return recoverVolume(vol, indexedEnd);
+}
+
+int VolumeStore::recoverVolume(volume_t *vol, u64 indexedEnd) {
+	u64 offset = indexedEnd;
+	while (offset < vol->datSize) {
+		needle_header_t header;
+		if (pread(vol->datFd, &header, sizeof(header), offset) != sizeof(header)
+				|| header.magic != NEEDLE_MAGIC || offset + needleSize(header.size) > vol->datSize)
+			break;
+		volume_index_t rec;
+		memcpy(rec.digest, header.digest, sizeof(rec.digest));
+		rec.offset = offset;
+		rec.size = header.size;
+		rec.refCount = 1;
+		if (writeRecord(vol, rec) != 0)
+			return -1;
+		applyRecord(vol, rec);
+		offset += needleSize(header.size);
+		log("Volume %u recover needle, offset=%llu, size=%u", vol->id, rec.offset, rec.size);
+	}
+	if (offset < vol->datSize) {
+		log("Volume %u truncate broken tail from %llu to %llu", vol->id, vol->datSize, offset);
+		if (ftruncate(vol->datFd, offset) != 0)
+			return -1;
+		vol->datSize = offset;
+	}
+	return 0;
+}
+
+void VolumeStore::applyRecord(volume_t *vol, const volume_index_t &rec) {
+	u64 key = digestKey(rec.digest);
+	m_cs.Enter();
+	entry_t *e = find(key);
+	if (e) {
+		VolumeMap::iterator it = m_volumes.find(e->volumeId);
+		if (it != m_volumes.end()) {
+			it->second->liveBytes -= needleSize(e->size);
+			it->second->liveCnt--;
+		}
+		if (rec.refCount == 0)
+			erase(e);
+	}
+	if (rec.refCount != 0) {
+		if (!e)
+			e = insert(key);
+		e->offset = rec.offset;
+		e->size = rec.size;
+		e->refCount = rec.refCount;
+		e->volumeId = vol->id;
+		vol->liveBytes += needleSize(rec.size);
+		vol->liveCnt++;
+	}
+	m_cs.Leave();
+}
+
+int VolumeStore::writeRecord(volume_t *vol, const volume_index_t &rec) {
+	if (write(vol->idxFd, &rec, sizeof(rec)) != sizeof(rec)) {
+		log("Write volume index %u error[%d]", vol->id, errno);
+		return -1;
+	}
+	vol->recordCnt++;
+	return 0;
+}
+
+bool VolumeStore::checkDigest(int fd, u64 offset, const u8 *digest) {
+	needle_header_t header;
+	return pread(fd, &header, sizeof(header), offset) == sizeof(header) && header.magic == NEEDLE_MAGIC
+			&& memcmp(header.digest, digest, VOLUME_DIGEST_SIZE) == 0;
+}
+
+int VolumeStore::lookup(const u8 *digest, needle_location_t *loc) {
+	m_cs.Enter();
+	entry_t *e = find(digestKey(digest));
+	if (!e) {
+		m_cs.Leave();
+		return -1;
+	}
+	loc->volumeId = e->volumeId;
+	loc->fd = m_volumes[e->volumeId]->datFd;
+	loc->offset = e->offset;
+	loc->size = e->size;
+	loc->refCount = e->refCount;
+	m_cs.Leave();
+
+	//前8字节相同的是另一个文件
+	if (!checkDigest(loc->fd, loc->offset, digest))
+		return -1;
+	loc->offset += sizeof(needle_header_t);
+	return 0;
+}
+
+VolumeStore::volume_t* VolumeStore::getWritableVolume(u32 needle) {
+	if (m_writable && (m_writable->datSize == 0 || m_writable->datSize + needle <= m_volumeSize))
+		return m_writable;
+	u32 id = 1;
+	m_cs.Enter();
+	if (!m_volumes.empty())
+		id = m_volumes.rbegin()->first + 1;
+	m_cs.Leave();
+	volume_t *vol = openVolume(id, true);
+	if (vol) {
+		m_writable = vol;
+		log("create volume %u", id);
+	}
+	return vol;
+}
+
+int VolumeStore::writeNeedle(volume_t *vol, const u8 *digest, int srcFd, u64 srcOffset, u32 size, u64 *offset) {
+	*offset = vol->datSize;
+	u32 total = needleSize(size);
+	char *buf = new char[VOLUME_IO_BUF_SIZE];
+
+	//头部和数据拼在一起写, 小文件一次pwrite
+	needle_header_t *header = (needle_header_t *)buf;
+	header->magic = NEEDLE_MAGIC;
+	header->size = size;
+	memcpy(header->digest, digest, VOLUME_DIGEST_SIZE);
+	u32 used = sizeof(needle_header_t);
+	u32 remain = size;
+	u32 done = 0;
+	int ret = 0;
+	while (ret == 0) {
+		while (used < VOLUME_IO_BUF_SIZE && remain > 0) {
+			u32 want = (remain < VOLUME_IO_BUF_SIZE - used) ? remain : VOLUME_IO_BUF_SIZE - used;
+			ssize_t len = pread(srcFd, buf + used, want, srcOffset + (size - remain));
+			if (len <= 0) {
+				ret = -1;
+				break;
+			}
+			used += len;
+			remain -= len;
+		}
+		if (ret != 0)
+			break;
+		if (remain == 0) {
+			//最后一块补齐到8字节, 缓冲区大小是8的倍数, 一定放得下
+			u32 pad = total - done - used;
+			memset(buf + used, 0, pad);
+			used += pad;
+		}
+		if (pwrite(vol->datFd, buf, used, *offset + done) != (ssize_t)used) {
+			ret = -1;
+			break;
+		}
+		done += used;
+		used = 0;
+		if (remain == 0)
+			break;
+	}
+	delete [] buf;
+
+	if (ret != 0) {
+		log("Write volume %u error[%d]", vol->id, errno);
+		ftruncate(vol->datFd, vol->datSize);
+		return -1;
+	}
+	m_cs.Enter();
+	vol->datSize += total;
+	m_cs.Leave();
+	return 0;
+}
+
+int VolumeStore::append(const u8 *digest, int fd, u32 size, u32 refCount) {
+	u64 key = digestKey(digest);
+	m_appendCs.Enter();
+	//插入只在这里和compact里, 持有m_appendCs时查到没有就不会被别人插进来
+	m_cs.Enter();
+	entry_t *e = find(key);
+	m_cs.Leave();
+	if (e) {
+		m_appendCs.Leave();
+		return 1;
+	}
+
+	u64 offset = 0;
+	volume_t *vol = getWritableVolume(needleSize(size));
+	if (!vol || writeNeedle(vol, digest, fd, 0, size, &offset) != 0) {
+		m_appendCs.Leave();
+		return -1;
+	}
+	//数据先落盘再写索引, 索引只会比数据旧, 启动时从数据补
+	if (fdatasync(vol->datFd) != 0) {
+		log("Sync volume %u error[%d]", vol->id, errno);
+		m_appendCs.Leave();
+		return -1;
+	}
+	volume_index_t rec;
+	memcpy(rec.digest, digest, sizeof(rec.digest));
+	rec.offset = offset;
+	rec.size = size;
+	rec.refCount = refCount;
+	writeRecord(vol, rec);
+	applyRecord(vol, rec);
+	m_appendCs.Leave();
+	return 0;
+}
+
+int VolumeStore::addRef(const u8 *digest, int delta) {
+	needle_location_t loc;
+	m_appendCs.Enter();
+	if (lookup(digest, &loc) != 0) {
+		m_appendCs.Leave();
+		return -1;
+	}
+	s64 refCount = (s64)loc.refCount + delta;
+	volume_index_t rec;
+	memcpy(rec.digest, digest, sizeof(rec.digest));
+	rec.offset = loc.offset - sizeof(needle_header_t);
+	rec.size = loc.size;
+	rec.refCount = (refCount > 0) ? (u32)refCount : 0;
+
+	m_cs.Enter();
+	volume_t *vol = m_volumes[loc.volumeId];
+	m_cs.Leave();
+	if (writeRecord(vol, rec) != 0) {
+		m_appendCs.Leave();
+		return -1;
+	}
+	applyRecord(vol, rec);
+	m_appendCs.Leave();
+	return rec.refCount;
+}
+
+int VolumeStore::rewriteIndex(volume_t *vol) {
+	char name[32];
+	snprintf(name, sizeof(name), "/%u", vol->id);
+	string idxPath = m_dir + name + VOLUME_IDX_SUFFIX;
+	string tmpPath = idxPath + VOLUME_TMP_SUFFIX;
+	int fd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 00640);
+	if (fd == -1) {
+		log("Open [%s] error[%d]", tmpPath.c_str(), errno);
+		return -1;
+	}
+
+	//按偏移排序写, 启动时顺序读卷文件头部校验也方便
+	vector<pair<u64, u32> > items;
+	m_cs.Enter();
+	for (u32 i = 0; i < m_capacity; i++) {
+		if (m_table[i].key != 0 && m_table[i].volumeId == vol->id)
+			items.push_back(make_pair(m_table[i].offset, i));
+	}
+	m_cs.Leave();
+	sort(items.begin(), items.end());
+
+	int ret = 0;
+	for (u32 i = 0; i < items.size() && ret == 0; i++) {
+		entry_t *e = &m_table[items[i].second];
+		volume_index_t rec;
+		needle_header_t header;
+		if (pread(vol->datFd, &header, sizeof(header), e->offset) != sizeof(header)) {
+			ret = -1;
+			break;
+		}
+		memcpy(rec.digest, header.digest, sizeof(rec.digest));
+		rec.offset = e->offset;
+		rec.size = e->size;
+		rec.refCount = e->refCount;
+		if (write(fd, &rec, sizeof(rec)) != sizeof(rec))
+			ret = -1;
+	}
+	if (ret != 0 || fsync(fd) != 0 || rename(tmpPath.c_str(), idxPath.c_str()) != 0) {
+		log("Rewrite volume index %u error[%d]", vol->id, errno);
+		::close(fd);
+		unlink(tmpPath.c_str());
+		return -1;
+	}
+	::close(vol->idxFd);
+	vol->idxFd = fd;
+	vol->recordCnt = items.size();
+	return 0;
+}
+
+s64 VolumeStore::compact(double garbageRatio) {
+	s64 reclaimed = 0;
+	m_appendCs.Enter();
+
+	vector<volume_t *> victims;
+	vector<volume_t *> others;
+	m_cs.Enter();
+	for (VolumeMap::iterator it = m_volumes.begin(); it != m_volumes.end(); it++) {
+		volume_t *vol = it->second;
+		if (vol->datSize > 0 && (double)(vol->datSize - vol->liveBytes) > vol->datSize * garbageRatio)
+			victims.push_back(vol);
+		else
+			others.push_back(vol);
+	}
+	m_cs.Leave();
+
+	for (u32 v = 0; v < victims.size(); v++) {
+		volume_t *victim = victims[v];
+		if (victim == m_writable)
+			m_writable = NULL;
+
+		//先把有引用的needle全部拷过去并sync, 再写索引, 最后删旧卷;
+		//中途退出时旧卷还在, 下次启动新卷的记录覆盖旧卷的, 旧卷里的数据变成无效数据
+		vector<pair<volume_t *, volume_index_t> > moved;
+		vector<volume_t *> targets;
+		int ret = 0;
+		for (u32 i = 0; i < m_capacity && ret == 0; i++) {
+			entry_t *e = &m_table[i];
+			if (e->key == 0 || e->volumeId != victim->id)
+				continue;
+			needle_header_t header;
+			u64 offset = 0;
+			volume_t *vol = getWritableVolume(needleSize(e->size));
+			if (!vol || pread(victim->datFd, &header, sizeof(header), e->offset) != sizeof(header)
+					|| writeNeedle(vol, header.digest, victim->datFd, e->offset + sizeof(header), e->size,
+					&offset) != 0) {
+				ret = -1;
+				break;
+			}
+			volume_index_t rec;
+			memcpy(rec.digest, header.digest, sizeof(rec.digest));
+			rec.offset = offset;
+			rec.size = e->size;
+			rec.refCount = e->refCount;
+			moved.push_back(make_pair(vol, rec));
+			if (std::find(targets.begin(), targets.end(), vol) == targets.end())
+				targets.push_back(vol);
+		}
+		for (u32 i = 0; i < targets.size() && ret == 0; i++) {
+			if (fdatasync(targets[i]->datFd) != 0)
+				ret = -1;
+		}
+		for (u32 i = 0; i < moved.size() && ret == 0; i++) {
+			if (writeRecord(moved[i].first, moved[i].second) != 0)
+				ret = -1;
+		}
+		for (u32 i = 0; i < targets.size() && ret == 0; i++) {
+			if (fdatasync(targets[i]->idxFd) != 0)
+				ret = -1;
+		}
+		if (ret != 0) {
+			log("Compact volume %u error[%d]", victim->id, errno);
+			m_appendCs.Leave();
+			return -1;
+		}
+
+		//拷的时候不改内存索引, 否则上面按槽遍历会漏掉或者重复
+		for (u32 i = 0; i < moved.size(); i++)
+			applyRecord(moved[i].first, moved[i].second);
+		u32 id = victim->id;
+		u64 datSize = victim->datSize;
+		closeVolume(victim, true);
+		u64 movedBytes = 0;
+		for (u32 i = 0; i < moved.size(); i++)
+			movedBytes += needleSize(moved[i].second.size);
+		reclaimed += datSize - movedBytes;
+		log("compact volume %u: size=%llu, moved needles=%u, moved bytes=%llu", id,
+				datSize, (u32)moved.size(), movedBytes);
+	}
+
+	//索引文件里过期的记录(引用计数变化和删除)超过一半时重写
+	for (u32 i = 0; i < others.size(); i++) {
+		volume_t *vol = others[i];
+		if (vol->recordCnt > vol->liveCnt * 2 && vol->recordCnt > VOLUME_LOAD_RECORDS)
+			rewriteIndex(vol);
+	}
+	m_appendCs.Leave();
+	return reclaimed;
+}
+
+void VolumeStore::getVolumeStat(vector<volume_stat_t> &list) {
+	m_cs.Enter();
+	for (VolumeMap::iterator it = m_volumes.begin(); it != m_volumes.end(); it++) {
+		volume_stat_t stat;
+		stat.id = it->first;
+		stat.needleCnt = it->second->liveCnt;
+		stat.dataBytes = it->second->datSize;
+		stat.liveBytes = it->second->liveBytes;
+		list.push_back(stat);
+	}
+	m_cs.Leave();
+}
+
+}
@@ -0,0 +1,154 @@
+/*
+ * Multimedia Small File Storage System
+ * 小文件打包存储: 按内容寻址的blob追加写到大的卷文件里, 不再一个文件一个inode
+ * 1. 卷文件 <disk>/vol/<id>.dat 只追加, 每个文件是一个needle: 头部(magic, 大小, digest) + 数据, 按8字节对齐;
+ *    写满VolumeSize后新开一个卷, 旧卷只读
+ * 2. 每个卷有一个索引文件 <id>.idx, 每条记录48字节(digest, 偏移, 大小, 引用计数), 也是只追加,
+ *    引用计数变化和删除(计数为0)都追加一条新记录, 加载时后面的覆盖前面的;
+ *    启动时只读索引文件, 不扫描目录; 索引落后于卷文件时(写完needle还没写索引就崩溃了)从卷文件尾部补上
+ * 3. 内存索引是按digest前8字节哈希的开放寻址表, 每项32字节; 前8字节相同而digest不同的文件不进卷,
+ *    由BlobStore按单独的文件存
+ * 4. 读取不用open/stat/close: 在内存里查到卷和偏移, 直接mmap或者sendfile卷文件的一段
+ * 5. 删除只追加一条计数为0的记录, 空间由compact回收: 把卷里还有引用的needle拷到新卷, 删掉旧卷,
+ *    compact和删除由离线工具(tools/msfs_volume)在msfs停止时执行
+ */
+
+#ifndef _VOLUMESTORE_H_
+#define _VOLUMESTORE_H_
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "Portable.h"
+#include "CriticalSection.h"
+
+using namespace std;
+
+#define VOLUME_DIR				"/vol"
+#define VOLUME_DIGEST_SIZE		32
+#define NEEDLE_MAGIC			0x4c44454e		//"NEDL"
+#define NEEDLE_ALIGN			8
+
+namespace msfs {
+
+typedef struct {
+	u32		magic;
+	u32		size;
+	u8		digest[VOLUME_DIGEST_SIZE];
+} needle_header_t;
+
+typedef struct {
+	u8		digest[VOLUME_DIGEST_SIZE];
+	u64		offset;			//needle头部在卷文件里的偏移
+	u32		size;
+	u32		refCount;		//0表示删除
+} volume_index_t;
+
+//查到的needle位置, 数据在fd的offset处(已经跳过了头部)
+typedef struct {
+	u32		volumeId;
+	int		fd;				//卷文件, 属于VolumeStore, 调用者不能close
+	u64		offset;
+	u32		size;
+	u32		refCount;
+} needle_location_t;
+
+typedef struct {
+	u32		id;
+	u64		needleCnt;
+	u64		dataBytes;		//卷文件的大小
+	u64		liveBytes;		//还有引用的needle的大小
+} volume_stat_t;
+
+class VolumeStore {
+public:
+	VolumeStore();
+	~VolumeStore();
+
+	//加载所有卷的索引, volumeSize为单个卷文件的最大字节数
+	int init(const char *disk, u64 volumeSize);
+	bool isOpened() { return m_opened; }
+
+	//digest为32字节的SHA-256; 成功返回0, 不在卷里返回-1
+	int lookup(const u8 *digest, needle_location_t *loc);
+	/*
+	 * 把文件fd的前size字节作为新needle追加到卷里, 引用计数为refCount;
+	 * 返回0成功, 1表示digest的前8字节和卷里已有的needle冲突(调用者改为单独存文件), -1出错
+	 */
+	int append(const u8 *digest, int fd, u32 size, u32 refCount = 1);
+	//引用计数加减, 减到0时删除; 返回新的计数, 出错返回-1
+	int addRef(const u8 *digest, int delta);
+
+	/*
+	 * 无效数据的比例超过garbageRatio的卷: 把还有引用的needle拷到当前写的卷, 再删掉旧卷;
+	 * 其他卷的索引文件里过期的记录太多时重写索引文件. 返回回收的字节数, 出错返回-1
+	 */
+	s64 compact(double garbageRatio);
+	void getVolumeStat(vector<volume_stat_t> &list);
+	u64 getNeedleCnt() { return m_size; }
+
+	static u32 needleSize(u32 size) {
+		return (sizeof(needle_header_t) + size + NEEDLE_ALIGN - 1) & ~(NEEDLE_ALIGN - 1);
+	}
+
+private:
+	typedef struct {
+		u64		key;			//digest的前8字节, 0表示空槽
+		u64		offset;
+		u32		size;
+		u32		refCount;
+		u32		volumeId;
+		u32		reserved;
+	} entry_t;
+
+	typedef struct {
+		u32		id;
+		int		datFd;
+		int		idxFd;
+		u64		datSize;
+		u64		liveBytes;
+		u64		liveCnt;
+		u64		recordCnt;		//索引文件里的记录数, 包括过期的
+	} volume_t;
+
+	typedef map<u32, volume_t*> VolumeMap;
+
+	static u64 digestKey(const u8 *digest);
+	entry_t* find(u64 key);
+	entry_t* insert(u64 key);
+	void erase(entry_t *entry);
+	void resize(u32 capacity);
+
+	volume_t* openVolume(u32 id, bool create);
+	void closeVolume(volume_t *vol, bool remove);
+	int loadVolume(volume_t *vol);
+	//索引文件之后卷文件里还有完整的needle时补到索引里, 不完整的尾部截掉
+	int recoverVolume(volume_t *vol, u64 indexedEnd);
+	void applyRecord(volume_t *vol, const volume_index_t &rec);
+	int writeRecord(volume_t *vol, const volume_index_t &rec);
+	int rewriteIndex(volume_t *vol);
+	//以下调用者持有m_appendCs
+	volume_t* getWritableVolume(u32 needle);
+	//把srcFd从srcOffset开始的size字节写成一个needle, 不sync
+	int writeNeedle(volume_t *vol, const u8 *digest, int srcFd, u64 srcOffset, u32 size, u64 *offset);
+	static bool checkDigest(int fd, u64 offset, const u8 *digest);
+
+private:
+	bool			m_opened;
+	string			m_dir;
+	u64				m_volumeSize;
+	VolumeMap		m_volumes;
+	volume_t		*m_writable;
+
+	entry_t			*m_table;
+	u32				m_capacity;		//2的幂
+	u32				m_size;
+
+	CriticalSection	m_cs;			//内存索引和卷的统计
+	CriticalSection	m_appendCs;		//追加写卷文件和索引文件
+};
+
+}
+
+#endif
@@ -16,7 +16,8 @@
 #include "ConfigFileReader.h"
 #include "HttpConn.h"
 #include "FileManager.h"
-#include "ThreadPool.h"
+#include "TaskScheduler.h"
+#include "MetricsServer.h"
 
 using namespace std;
 using namespace msfs;
@@ -25,8 +26,8 @@ using namespace msfs;
 FileManager* FileManager::m_instance = NULL;
 FileManager* g_fileManager = NULL;
 CConfigFileReader config_file("msfs.conf");
-CThreadPool g_PostThreadPool;
-CThreadPool g_GetThreadPool;
+CTaskScheduler g_PostThreadPool;
+CTaskScheduler g_GetThreadPool;
 
 void closeall(int fd)
 {
@@ -157,8 +158,8 @@ int main(int argc, char* argv[])
         return -1;
     }
     //建立两个队列，分别处理get和post请求
-    g_PostThreadPool.Init(nPostThreadCount);
-    g_GetThreadPool.Init(nGetThreadCount);
+    g_PostThreadPool.Init(nPostThreadCount, "post");
+    g_GetThreadPool.Init(nGetThreadCount, "get");
 
     g_fileManager = FileManager::getInstance(listen_ip, base_dir, fileCnt, filesPerDir);
 	int ret = g_fileManager->initDir();
@@ -166,6 +167,33 @@ int main(int argc, char* argv[])
 		printf("The BaseDir is set incorrectly :%s\n",base_dir);
 		return ret;
     }
+
+    //下载缓存: CacheSize为mmap的总大小(MB), 大于CacheMaxFileSize(KB)的文件不缓存, 直接sendfile
+    u64 cacheSize = 256;
+    u64 cacheMaxFileSize = 2048;
+    char* str_cache_size = config_file.GetConfigName("CacheSize");
+    char* str_cache_max_file_size = config_file.GetConfigName("CacheMaxFileSize");
+    if (str_cache_size)
+        cacheSize = atoll(str_cache_size);
+    if (str_cache_max_file_size)
+        cacheMaxFileSize = atoll(str_cache_max_file_size);
+    g_fileManager->initCache(cacheSize * 1024 * 1024, cacheMaxFileSize * 1024);
+
+    //按内容去重: 相同的文件只存一份, 默认打开
+    char* str_dedup = config_file.GetConfigName("DedupEnable");
+    g_fileManager->initDedup(str_dedup == NULL || atoi(str_dedup) != 0);
+
+    //小文件打包存储: 新上传的文件追加到VolumeSize(MB)大小的卷文件里, 默认关闭
+    char* str_volume = config_file.GetConfigName("VolumeEnable");
+    char* str_volume_size = config_file.GetConfigName("VolumeSize");
+    u64 volumeSize = 4096;
+    if (str_volume_size)
+        volumeSize = atoll(str_volume_size);
+    if (g_fileManager->initVolume(str_volume != NULL && atoi(str_volume) != 0, volumeSize * 1024 * 1024) != 0)
+    {
+        printf("init volume store in %s failed\n", base_dir);
+        return -1;
+    }
 	ret = netlib_init();
     if (ret == NETLIB_ERROR)
         return ret;
@@ -188,6 +216,10 @@ int main(int argc, char* argv[])
 
     printf("server start listen on: %s:%d\n", listen_ip, listen_port);
     init_http_conn();
+    // 本地端口上的/metrics, 配置了MetricsPort才监听
+    if (metrics_server_init(&config_file) == -1)
+        return -1;
+
     printf("now enter the event loop...\n");
 
     netlib_eventloop();
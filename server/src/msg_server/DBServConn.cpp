@@ -31,6 +31,7 @@ static ConnMap_t g_db_server_conn_map;
 static serv_info_t* g_db_server_list = NULL;
 static uint32_t		g_db_server_count = 0;			// 到DBServer的总连接数
 static uint32_t		g_db_server_login_count = 0;	// 到进行登录处理的DBServer的总连接数
+static uint32_t		g_db_server_concur_cnt = 1;		// 到每个DBServer实例的连接数, 同一实例的连接在列表里相邻
 static CGroupChat*	s_group_chat = NULL;
 static CFileHandler* s_file_handler = NULL;
 
@@ -63,6 +64,7 @@ void init_db_serv_conn(serv_info_t* server_list, uint32_t server_count, uint32_t
 	g_db_server_list = server_list;
 	g_db_server_count = server_count;
 
+	g_db_server_concur_cnt = concur_conn_cnt ? concur_conn_cnt : 1;
 	uint32_t total_db_instance = server_count / concur_conn_cnt;
 	g_db_server_login_count = (total_db_instance / 2) * concur_conn_cnt;
 	log("DB server connection index for login business: [0, %u), for other business: [%u, %u) ",
@@ -128,6 +130,31 @@ CDBServConn* get_db_serv_conn()
 	return pDBConn;
 }
 
+/*
+ * 按key(会话)固定选择一个DBServer实例, 同一个会话的消息总是由同一个db_proxy处理,
+ * db_proxy据此在内存里分配会话的消息id; 该实例没有可用连接时随机选一个
+ */
+CDBServConn* get_db_serv_conn_by_key(uint32_t key)
+{
+	uint32_t start_pos = g_db_server_login_count;
+	uint32_t stop_pos = g_db_server_count;
+	if (start_pos >= stop_pos) {
+		start_pos = 0;
+	}
+
+	uint32_t instance_cnt = (stop_pos - start_pos) / g_db_server_concur_cnt;
+	if (instance_cnt > 0) {
+		uint32_t instance_pos = start_pos + (key % instance_cnt) * g_db_server_concur_cnt;
+		for (uint32_t i = 0; i < g_db_server_concur_cnt; i++) {
+			CDBServConn* pDbConn = (CDBServConn*)g_db_server_list[instance_pos + (key + i) % g_db_server_concur_cnt].serv_conn;
+			if (pDbConn && pDbConn->IsOpen()) {
+				return pDbConn;
+			}
+		}
+	}
+
+	return get_db_serv_conn();
+}
 
 CDBServConn::CDBServConn()
 {
@@ -57,5 +57,6 @@ private:
 void init_db_serv_conn(serv_info_t* server_list, uint32_t server_count, uint32_t concur_conn_cnt);
 CDBServConn* get_db_serv_conn_for_login();
 CDBServConn* get_db_serv_conn();
+CDBServConn* get_db_serv_conn_by_key(uint32_t key);
 
 #endif /* DBSERVCONN_H_ */
@@ -122,69 +122,53 @@ void CGroupChat::HandleGroupInfoResponse(CImPdu* pPdu)
     log("HandleGroupInfoResponse, user_id=%u, group_cnt=%u. ", user_id, group_cnt);
 
     //此处是查询成员时使用，主要用于群消息从数据库获得msg_id后进行发送,一般此时group_cnt = 1
-    if (pduAttachData.GetPduLength() > 0 && group_cnt > 0)
+    if (pduAttachData.GetPduLength() > 0)
     {
-        IM::BaseDefine::GroupInfo group_info = msg.group_info_list(0);
-        uint32_t group_id = group_info.group_id();
+        IM::Message::IMMsgData msg2;
+        CHECK_PB_PARSE_MSG(msg2.ParseFromArray(pduAttachData.GetPdu(), pduAttachData.GetPduLength()));
+        uint32_t group_id = msg2.to_session_id();
         log("GroupInfoRequest is send by server, group_id=%u ", group_id);
-        
-        std::set<uint32_t> group_member_set;
-        for (uint32_t i = 0; i < group_info.group_member_list_size(); i++)
-        {
-            uint32_t member_user_id = group_info.group_member_list(i);
-            group_member_set.insert(member_user_id);
-        }
-        if (group_member_set.find(user_id) == group_member_set.end())
+
+        if (group_cnt > 0)
         {
-            log("user_id=%u is not in group, group_id=%u. ", user_id, group_id);
-            return;
+            _UpdateGroupCache(msg.group_info_list(0));
         }
-        
-        IM::Message::IMMsgData msg2;
-        CHECK_PB_PARSE_MSG(msg2.ParseFromArray(pduAttachData.GetPdu(), pduAttachData.GetPduLength()));
-        CImPdu pdu;
-        pdu.SetPBMsg(&msg2);
-        pdu.SetServiceId(SID_MSG);
-        pdu.SetCommandId(CID_MSG_DATA);
-        
-        //Push相关
-        IM::Server::IMGroupGetShieldReq msg3;
-        msg3.set_group_id(group_id);
-        msg3.set_attach_data(pdu.GetBodyData(), pdu.GetBodyLength());
-        for (uint32_t i = 0; i < group_info.group_member_list_size(); i++)
+
+        group_cache_t* pCache = _GetGroupCache(group_id);
+        if (!pCache)
         {
-            uint32_t member_user_id = group_info.group_member_list(i);
-            
-            msg3.add_user_id(member_user_id);
-            
-            CImUser* pToImUser = CImUserManager::GetInstance()->GetImUserById(member_user_id);
-            if (pToImUser)
+            // 请求时带了版本号, 回应之前缓存被删掉了(变更通知或淘汰), 重新要一次完整的成员列表
+            // 版本号为0还没有结果, 说明群不存在
+            uint32_t req_version = pduAttachData.GetServiceType();
+            if (group_cnt == 0 && req_version != 0)
             {
-                CMsgConn* pFromConn = NULL;
-                if( member_user_id == user_id )
-                {
-                    uint32_t reqHandle = pduAttachData.GetHandle();
-                    if(reqHandle != 0)
-                        pFromConn = CImUserManager::GetInstance()->GetMsgConnByHandle(user_id, reqHandle);
-                }
-                
-                pToImUser->BroadcastData(pdu.GetBuffer(), pdu.GetLength(), pFromConn);
+                log("group cache is gone, request again, group_id=%u, version=%u. ", group_id, req_version);
+                _RequestGroupInfo(pduAttachData.GetPdu(), pduAttachData.GetPduLength(), user_id, group_id,
+                        pduAttachData.GetHandle(), 0);
+                return;
             }
+            log("no group info, drop group message, group_id=%u, from_user_id=%u. ", group_id, user_id);
+            return;
         }
-        
-        CImPdu pdu2;
-        pdu2.SetPBMsg(&msg3);
-        pdu2.SetServiceId(SID_OTHER);
-        pdu2.SetCommandId(CID_OTHER_GET_SHIELD_REQ);
-        CDBServConn* pDbConn = get_db_serv_conn();
-        if (pDbConn)
+
+        if (group_cnt == 0)
         {
-            pDbConn->SendPdu(&pdu2);
+            // 请求里带的版本号已经是最新的, db_proxy不再返回群信息, 缓存继续有效
+            pCache->update_tick = get_tick_count();
         }
+
+        _SyncGroupMemberToRoute(group_id, pCache->member_set);
+        _BroadcastGroupMessage(pduAttachData.GetPdu(), pduAttachData.GetPduLength(), user_id,
+                pduAttachData.GetHandle(), group_id, pCache->member_set);
     }
     else if (pduAttachData.GetPduLength() == 0)
     {
-        //正常获取群信息的返回
+        //正常获取群信息的返回, 顺便更新成员缓存
+        for (uint32_t i = 0; i < group_cnt; i++)
+        {
+            _UpdateGroupCache(msg.group_info_list(i));
+        }
+
         CMsgConn* pConn = CImUserManager::GetInstance()->GetMsgConnByHandle(user_id, pduAttachData.GetHandle());
         if (pConn)
         {
@@ -236,25 +220,7 @@ void CGroupChat::HandleGroupMessage(CImPdu* pPdu)
         pRouteConn->SendPdu(pPdu);
     }
     
-    // 服务器没有群的信息，向DB服务器请求群信息，并带上消息作为附件，返回时在发送该消息给其他群成员
-    //IM::BaseDefine::GroupVersionInfo group_version_info;
-    CPduAttachData pduAttachData(ATTACH_TYPE_HANDLE_AND_PDU, attach_data.GetHandle(), pPdu->GetBodyLength(), pPdu->GetBodyData());
-    
-    IM::Group::IMGroupInfoListReq msg3;
-    msg3.set_user_id(from_user_id);
-    IM::BaseDefine::GroupVersionInfo* group_version_info = msg3.add_group_version_list();
-    group_version_info->set_group_id(to_group_id);
-    group_version_info->set_version(0);
-    msg3.set_attach_data(pduAttachData.GetBuffer(), pduAttachData.GetLength());
-    CImPdu pdu;
-    pdu.SetPBMsg(&msg3);
-    pdu.SetServiceId(SID_GROUP);
-    pdu.SetCommandId(CID_GROUP_INFO_REQUEST);
-    CDBServConn* pDbConn = get_db_serv_conn();
-    if(pDbConn)
-    {
-        pDbConn->SendPdu(&pdu);
-    }
+    _DispatchGroupMessage(pPdu, from_user_id, to_group_id, attach_data.GetHandle());
 }
 
 void CGroupChat::HandleGroupMessageBroadcast(CImPdu *pPdu)
@@ -268,25 +234,7 @@ void CGroupChat::HandleGroupMessageBroadcast(CImPdu *pPdu)
     uint32_t msg_id = msg.msg_id();
     log("HandleGroupMessageBroadcast, %u->%u, msg id=%u. ", from_user_id, to_group_id, msg_id);
     
-    // 服务器没有群的信息，向DB服务器请求群信息，并带上消息作为附件，返回时在发送该消息给其他群成员
-    //IM::BaseDefine::GroupVersionInfo group_version_info;
-    CPduAttachData pduAttachData(ATTACH_TYPE_HANDLE_AND_PDU, 0, pPdu->GetBodyLength(), pPdu->GetBodyData());
-    
-    IM::Group::IMGroupInfoListReq msg2;
-    msg2.set_user_id(from_user_id);
-    IM::BaseDefine::GroupVersionInfo* group_version_info = msg2.add_group_version_list();
-    group_version_info->set_group_id(to_group_id);
-    group_version_info->set_version(0);
-    msg2.set_attach_data(pduAttachData.GetBuffer(), pduAttachData.GetLength());
-    CImPdu pdu;
-    pdu.SetPBMsg(&msg2);
-    pdu.SetServiceId(SID_GROUP);
-    pdu.SetCommandId(CID_GROUP_INFO_REQUEST);
-    CDBServConn* pDbConn = get_db_serv_conn();
-    if(pDbConn)
-    {
-        pDbConn->SendPdu(&pdu);
-    }
+    _DispatchGroupMessage(pPdu, from_user_id, to_group_id, 0);
 }
 
 void CGroupChat::HandleClientGroupCreateRequest(CImPdu* pPdu, CMsgConn* pFromConn)
@@ -423,6 +371,9 @@ void CGroupChat::HandleGroupChangeMemberResponse(CImPdu* pPdu)
         for (uint32_t i = 0; i < cur_user_cnt; i++) {
             msg2.add_cur_user_id_list(msg.cur_user_id_list(i));
         }
+        if (msg.has_version()) {
+            msg2.set_version(msg.version());
+        }
         CImPdu pdu;
         pdu.SetPBMsg(&msg2);
         pdu.SetServiceId(SID_GROUP);
@@ -432,6 +383,15 @@ void CGroupChat::HandleGroupChangeMemberResponse(CImPdu* pPdu)
 			pRouteConn->SendPdu(&pdu);
 		}
 
+        _UpdateGroupMember(group_id, msg2);
+
+        // 变更通知只发给了主route_server, 其他route_server的成员索引也要更新
+        group_member_t member_set;
+        for (uint32_t i = 0; i < cur_user_cnt; i++) {
+            member_set.insert(msg.cur_user_id_list(i));
+        }
+        _SyncGroupMemberToRoute(group_id, member_set);
+
         for (uint32_t i = 0; i < chg_user_cnt; i++)
         {
             uint32_t to_user_id = msg.chg_user_id_list(i);
@@ -455,6 +415,8 @@ void CGroupChat::HandleGroupChangeMemberBroadcast(CImPdu* pPdu)
     uint32_t cur_user_cnt = msg.cur_user_id_list_size();
 	log("HandleChangeMemberBroadcast, change_type=%u, group_id=%u, chg_user_cnt=%u, cur_user_cnt=%u. ", change_type, group_id, chg_user_cnt, cur_user_cnt);
 
+    _UpdateGroupMember(group_id, msg);
+
     for (uint32_t i = 0; i < chg_user_cnt; i++)
     {
         uint32_t to_user_id = msg.chg_user_id_list(i);
@@ -564,3 +526,202 @@ void CGroupChat::_SendPduToUser(CImPdu* pPdu, uint32_t user_id, CMsgConn* pReqCo
         pToUser->BroadcastPdu(pPdu, pReqConn);
     }
 }
+
+group_cache_t* CGroupChat::_GetGroupCache(uint32_t group_id)
+{
+    group_map_t::iterator it = m_group_map.find(group_id);
+    if (it == m_group_map.end()) {
+        return NULL;
+    }
+
+    group_cache_t* pCache = it->second;
+    m_group_lru.splice(m_group_lru.begin(), m_group_lru, pCache->lru_it);
+    return pCache;
+}
+
+void CGroupChat::_RemoveGroupCache(uint32_t group_id)
+{
+    group_map_t::iterator it = m_group_map.find(group_id);
+    if (it == m_group_map.end()) {
+        return;
+    }
+
+    group_cache_t* pCache = it->second;
+    m_group_lru.erase(pCache->lru_it);
+    m_group_map.erase(it);
+    delete pCache;
+}
+
+void CGroupChat::_UpdateGroupCache(const IM::BaseDefine::GroupInfo& group_info)
+{
+    uint32_t group_id = group_info.group_id();
+    group_cache_t* pCache = _GetGroupCache(group_id);
+    if (pCache && group_info.version() < pCache->version) {
+        // 变更通知之前发出的查询, 返回的是旧成员列表
+        log("ignore stale group info, group_id=%u, version=%u, cache_version=%u. ", group_id,
+            group_info.version(), pCache->version);
+        return;
+    }
+
+    if (!pCache) {
+        while (m_group_map.size() >= GROUP_CACHE_MAX_CNT) {
+            _RemoveGroupCache(m_group_lru.back());
+        }
+        pCache = new group_cache_t;
+        pCache->lru_it = m_group_lru.insert(m_group_lru.begin(), group_id);
+        m_group_map.insert(make_pair(group_id, pCache));
+    }
+
+    pCache->version = group_info.version();
+    pCache->update_tick = get_tick_count();
+    pCache->member_set.clear();
+    for (int i = 0; i < group_info.group_member_list_size(); i++) {
+        pCache->member_set.insert(group_info.group_member_list(i));
+    }
+}
+
+void CGroupChat::_UpdateGroupMember(uint32_t group_id, const IM::Group::IMGroupChangeMemberNotify& msg)
+{
+    group_cache_t* pCache = _GetGroupCache(group_id);
+    if (!pCache) {
+        return;
+    }
+
+    if (msg.cur_user_id_list_size() == 0 || !msg.has_version()) {
+        // 没带当前成员列表, 或者是老的db_proxy没带修改后的版本号, 下一条群消息时重新查询
+        _RemoveGroupCache(group_id);
+        return;
+    }
+
+    if (msg.version() < pCache->version) {
+        log("ignore stale group change notify, group_id=%u, version=%u, cache_version=%u. ", group_id,
+            msg.version(), pCache->version);
+        return;
+    }
+
+    // 用db_proxy修改后的版本号, 通知之前发出的查询结果版本号更小, 会被丢弃
+    pCache->version = msg.version();
+    pCache->update_tick = get_tick_count();
+    pCache->member_set.clear();
+    for (int i = 0; i < msg.cur_user_id_list_size(); i++) {
+        pCache->member_set.insert(msg.cur_user_id_list(i));
+    }
+}
+
+void CGroupChat::_SyncGroupMemberToRoute(uint32_t group_id, const group_member_t& member_set)
+{
+    if (member_set.empty()) {
+        return;
+    }
+
+    // 不带chg_user_id_list的变更通知, route_server只用来更新索引, 不转发给客户端
+    IM::Group::IMGroupChangeMemberNotify msg;
+    msg.set_user_id(0);
+    msg.set_change_type(::IM::BaseDefine::GROUP_MODIFY_TYPE_ADD);
+    msg.set_group_id(group_id);
+    for (group_member_t::const_iterator it = member_set.begin(); it != member_set.end(); it++) {
+        msg.add_cur_user_id_list(*it);
+    }
+    CImPdu pdu;
+    pdu.SetPBMsg(&msg);
+    pdu.SetServiceId(SID_GROUP);
+    pdu.SetCommandId(CID_GROUP_CHANGE_MEMBER_NOTIFY);
+    send_to_all_route_server(&pdu);
+}
+
+void CGroupChat::_DispatchGroupMessage(CImPdu* pPdu, uint32_t from_user_id, uint32_t group_id, uint32_t req_handle)
+{
+    group_cache_t* pCache = _GetGroupCache(group_id);
+    if (pCache && get_tick_count() < pCache->update_tick + GROUP_CACHE_TIMEOUT) {
+        _BroadcastGroupMessage(pPdu->GetBodyData(), pPdu->GetBodyLength(), from_user_id, req_handle,
+                group_id, pCache->member_set);
+        return;
+    }
+
+    // 服务器没有群的信息或者缓存过期，向DB服务器请求群信息，并带上消息作为附件，返回时在发送该消息给其他群成员
+    // 带上缓存的版本号, 版本没变时db_proxy不用再返回成员列表
+    _RequestGroupInfo(pPdu->GetBodyData(), pPdu->GetBodyLength(), from_user_id, group_id, req_handle,
+            pCache ? pCache->version : 0);
+}
+
+void CGroupChat::_RequestGroupInfo(const uchar_t* msg_buf, uint32_t msg_len, uint32_t from_user_id, uint32_t group_id,
+        uint32_t req_handle, uint32_t version)
+{
+    // 请求的版本号放在附件的service_type里带回来, 回应里没有群信息时用来判断要不要重新请求
+    CPduAttachData pduAttachData(ATTACH_TYPE_HANDLE_AND_PDU, req_handle, msg_len, (uchar_t*)msg_buf, version);
+
+    IM::Group::IMGroupInfoListReq msg;
+    msg.set_user_id(from_user_id);
+    IM::BaseDefine::GroupVersionInfo* group_version_info = msg.add_group_version_list();
+    group_version_info->set_group_id(group_id);
+    group_version_info->set_version(version);
+    msg.set_attach_data(pduAttachData.GetBuffer(), pduAttachData.GetLength());
+    CImPdu pdu;
+    pdu.SetPBMsg(&msg);
+    pdu.SetServiceId(SID_GROUP);
+    pdu.SetCommandId(CID_GROUP_INFO_REQUEST);
+    CDBServConn* pDbConn = get_db_serv_conn();
+    if(pDbConn)
+    {
+        pDbConn->SendPdu(&pdu);
+    }
+    else
+    {
+        log("no db connection, drop group message, group_id=%u, from_user_id=%u. ", group_id, from_user_id);
+    }
+}
+
+void CGroupChat::_BroadcastGroupMessage(const uchar_t* msg_buf, uint32_t msg_len, uint32_t from_user_id,
+        uint32_t req_handle, uint32_t group_id, const group_member_t& member_set)
+{
+    if (member_set.find(from_user_id) == member_set.end())
+    {
+        log("user_id=%u is not in group, group_id=%u. ", from_user_id, group_id);
+        return;
+    }
+
+    IM::Message::IMMsgData msg;
+    CHECK_PB_PARSE_MSG(msg.ParseFromArray(msg_buf, msg_len));
+    msg.clear_attach_data();
+    CImPdu pdu;
+    pdu.SetPBMsg(&msg);
+    pdu.SetServiceId(SID_MSG);
+    pdu.SetCommandId(CID_MSG_DATA);
+
+    //Push相关
+    IM::Server::IMGroupGetShieldReq msg2;
+    msg2.set_group_id(group_id);
+    msg2.set_attach_data(pdu.GetBodyData(), pdu.GetBodyLength());
+    // 只序列化一次, 所有成员的连接共享同一块发送缓冲
+    CSharedBuffer* pBuf = new CSharedBuffer(pdu.GetBuffer(), pdu.GetLength());
+    for (group_member_t::const_iterator it = member_set.begin(); it != member_set.end(); it++)
+    {
+        uint32_t member_user_id = *it;
+
+        msg2.add_user_id(member_user_id);
+
+        CImUser* pToImUser = CImUserManager::GetInstance()->GetImUserById(member_user_id);
+        if (pToImUser)
+        {
+            CMsgConn* pFromConn = NULL;
+            if( member_user_id == from_user_id )
+            {
+                if(req_handle != 0)
+                    pFromConn = CImUserManager::GetInstance()->GetMsgConnByHandle(from_user_id, req_handle);
+            }
+
+            pToImUser->BroadcastBuffer(pBuf, CLIENT_TYPE_FLAG_BOTH, pFromConn);
+        }
+    }
+    pBuf->ReleaseRef();
+
+    CImPdu pdu2;
+    pdu2.SetPBMsg(&msg2);
+    pdu2.SetServiceId(SID_OTHER);
+    pdu2.SetCommandId(CID_OTHER_GET_SHIELD_REQ);
+    CDBServConn* pDbConn = get_db_serv_conn();
+    if (pDbConn)
+    {
+        pDbConn->SendPdu(&pdu2);
+    }
+}
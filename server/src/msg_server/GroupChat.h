@@ -9,9 +9,25 @@
 #define GROUPCHAT_H_
 
 #include "ImPduBase.h" 
+#include "IM.BaseDefine.pb.h"
+#include "IM.Group.pb.h"
+
+// 群成员缓存, 有成员变更通知时直接更新, 超过GROUP_CACHE_TIMEOUT再用版本号向db_proxy确认一次
+#define GROUP_CACHE_TIMEOUT		60000
+// 最多缓存多少个群, 超过时淘汰最久没有消息的群
+#define GROUP_CACHE_MAX_CNT		20000
 
 typedef set<uint32_t> group_member_t;
-typedef hash_map<uint32_t, group_member_t*> group_map_t;
+typedef list<uint32_t> group_lru_t;
+
+typedef struct {
+	uint32_t		version;
+	uint64_t		update_tick;	// 最近一次和db_proxy确认或收到变更通知的时间
+	group_member_t	member_set;
+	group_lru_t::iterator	lru_it;
+} group_cache_t;
+
+typedef hash_map<uint32_t, group_cache_t*> group_map_t;
 
 class CMsgConn;
 
@@ -47,11 +63,25 @@ private:
 	CGroupChat() {}	// for singleton;
 
 	void _SendPduToUser(CImPdu* pPdu, uint32_t user_id, CMsgConn* pReqConn = NULL);
+
+	group_cache_t* _GetGroupCache(uint32_t group_id);
+	void _RemoveGroupCache(uint32_t group_id);
+	void _UpdateGroupCache(const IM::BaseDefine::GroupInfo& group_info);
+	void _UpdateGroupMember(uint32_t group_id, const IM::Group::IMGroupChangeMemberNotify& msg);
+	// route_server按成员所在的msg_server转发群消息, 成员列表由这里同步过去
+	void _SyncGroupMemberToRoute(uint32_t group_id, const group_member_t& member_set);
+	// 缓存里有新鲜的成员列表就直接分发, 否则带着消息向db_proxy查询群信息
+	void _DispatchGroupMessage(CImPdu* pPdu, uint32_t from_user_id, uint32_t group_id, uint32_t req_handle);
+	void _RequestGroupInfo(const uchar_t* msg_buf, uint32_t msg_len, uint32_t from_user_id, uint32_t group_id,
+			uint32_t req_handle, uint32_t version);
+	void _BroadcastGroupMessage(const uchar_t* msg_buf, uint32_t msg_len, uint32_t from_user_id,
+			uint32_t req_handle, uint32_t group_id, const group_member_t& member_set);
 private:
 
 	static CGroupChat* s_group_chat_instance;
 
 	group_map_t m_group_map;
+	group_lru_t m_group_lru;	// 最近用过的在前面
 };
 
 
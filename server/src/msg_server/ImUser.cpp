@@ -76,54 +76,59 @@ user_conn_t CImUser::GetUserConn()
 
 void CImUser::BroadcastPdu(CImPdu* pPdu, CMsgConn* pFromConn)
 {
-    for (map<uint32_t, CMsgConn*>::iterator it = m_conn_map.begin(); it != m_conn_map.end(); it++)
-    {
-        CMsgConn* pConn = it->second;
-        if (pConn != pFromConn) {
-            pConn->SendPdu(pPdu);
-        }
-    }
+    CSharedBuffer* pBuf = new CSharedBuffer(pPdu->GetBuffer(), pPdu->GetLength());
+    BroadcastBuffer(pBuf, CLIENT_TYPE_FLAG_BOTH, pFromConn);
+    pBuf->ReleaseRef();
 }
 
 void CImUser::BroadcastPduWithOutMobile(CImPdu *pPdu, CMsgConn* pFromConn)
 {
-    for (map<uint32_t, CMsgConn*>::iterator it = m_conn_map.begin(); it != m_conn_map.end(); it++)
-    {
-        CMsgConn* pConn = it->second;
-        if (pConn != pFromConn && CHECK_CLIENT_TYPE_PC(pConn->GetClientType())) {
-            pConn->SendPdu(pPdu);
-        }
-    }
+    CSharedBuffer* pBuf = new CSharedBuffer(pPdu->GetBuffer(), pPdu->GetLength());
+    BroadcastBuffer(pBuf, CLIENT_TYPE_FLAG_PC, pFromConn);
+    pBuf->ReleaseRef();
 }
 
 void CImUser::BroadcastPduToMobile(CImPdu* pPdu, CMsgConn* pFromConn)
+{
+    CSharedBuffer* pBuf = new CSharedBuffer(pPdu->GetBuffer(), pPdu->GetLength());
+    BroadcastBuffer(pBuf, CLIENT_TYPE_FLAG_MOBILE, pFromConn);
+    pBuf->ReleaseRef();
+}
+
+void CImUser::BroadcastBuffer(CSharedBuffer* pBuf, uint32_t client_type_flag, CMsgConn* pFromConn)
 {
     for (map<uint32_t, CMsgConn*>::iterator it = m_conn_map.begin(); it != m_conn_map.end(); it++)
     {
         CMsgConn* pConn = it->second;
-        if (pConn != pFromConn && CHECK_CLIENT_TYPE_MOBILE(pConn->GetClientType())) {
-            pConn->SendPdu(pPdu);
+        if (pConn == pFromConn) {
+            continue;
+        }
+        
+        if (client_type_flag == CLIENT_TYPE_FLAG_BOTH || (pConn->GetClientTypeFlag() & client_type_flag)) {
+            pConn->SendBuffer(pBuf);
         }
     }
 }
 
-
 void CImUser::BroadcastClientMsgData(CImPdu* pPdu, uint32_t msg_id, CMsgConn* pFromConn, uint32_t from_id)
 {
+    CSharedBuffer* pBuf = new CSharedBuffer(pPdu->GetBuffer(), pPdu->GetLength());
     for (map<uint32_t, CMsgConn*>::iterator it = m_conn_map.begin(); it != m_conn_map.end(); it++)
     {
         CMsgConn* pConn = it->second;
         if (pConn != pFromConn) {
-            pConn->SendPdu(pPdu);
+            pConn->SendBuffer(pBuf);
             pConn->AddToSendList(msg_id, from_id);
         }
     }
+    pBuf->ReleaseRef();
 }
 
 void CImUser::BroadcastData(void *buff, uint32_t len, CMsgConn* pFromConn)
 {
     if(!buff)
         return;
+    CSharedBuffer* pBuf = new CSharedBuffer(buff, len);
     for (map<uint32_t, CMsgConn*>::iterator it = m_conn_map.begin(); it != m_conn_map.end(); it++)
     {
         CMsgConn* pConn = it->second;
@@ -132,9 +137,10 @@ void CImUser::BroadcastData(void *buff, uint32_t len, CMsgConn* pFromConn)
             continue;
         
         if (pConn != pFromConn) {
-            pConn->Send(buff, len);
+            pConn->SendBuffer(pBuf);
         }
     }
+    pBuf->ReleaseRef();
 }
 
 void CImUser::HandleKickUser(CMsgConn* pConn, uint32_t reason)
@@ -332,6 +338,19 @@ void CImUserManager::GetUserConnCnt(list<user_conn_t>* user_conn_list, uint32_t&
 }
 
 void CImUserManager::BroadcastPdu(CImPdu* pdu, uint32_t client_type_flag)
+{
+    if (client_type_flag != CLIENT_TYPE_FLAG_PC && client_type_flag != CLIENT_TYPE_FLAG_MOBILE
+        && client_type_flag != CLIENT_TYPE_FLAG_BOTH) {
+        return;
+    }
+    
+    // 全服广播只序列化一次, 每个连接的发送队列只引用这一份数据
+    CSharedBuffer* pBuf = new CSharedBuffer(pdu->GetBuffer(), pdu->GetLength());
+    BroadcastBuffer(pBuf, client_type_flag);
+    pBuf->ReleaseRef();
+}
+
+void CImUserManager::BroadcastBuffer(CSharedBuffer* pBuf, uint32_t client_type_flag)
 {
     CImUser* pImUser = NULL;
     for (ImUserMap_t::iterator it = m_im_user_map.begin(); it != m_im_user_map.end(); it++)
@@ -339,19 +358,7 @@ void CImUserManager::BroadcastPdu(CImPdu* pdu, uint32_t client_type_flag)
         pImUser = (CImUser*)it->second;
         if (pImUser->IsValidate())
         {
-            switch (client_type_flag) {
-                case CLIENT_TYPE_FLAG_PC:
-                    pImUser->BroadcastPduWithOutMobile(pdu);
-                    break;
-                case CLIENT_TYPE_FLAG_MOBILE:
-                    pImUser->BroadcastPduToMobile(pdu);
-                    break;
-                case CLIENT_TYPE_FLAG_BOTH:
-                    pImUser->BroadcastPdu(pdu);
-                    break;
-                default:
-                    break;
-            }
+            pImUser->BroadcastBuffer(pBuf, client_type_flag);
         }
     }
 }
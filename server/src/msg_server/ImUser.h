@@ -50,6 +50,8 @@ public:
     void BroadcastPduToMobile(CImPdu* pPdu, CMsgConn* pFromConn = NULL);
     void BroadcastClientMsgData(CImPdu* pPdu, uint32_t msg_id, CMsgConn* pFromConn = NULL, uint32_t from_id = 0);
     void BroadcastData(void* buff, uint32_t len, CMsgConn* pFromConn = NULL);
+    // 数据包只序列化一次, 所有连接共享同一份数据
+    void BroadcastBuffer(CSharedBuffer* pBuf, uint32_t client_type_flag, CMsgConn* pFromConn = NULL);
         
     void HandleKickUser(CMsgConn* pConn, uint32_t reason);
     
@@ -96,6 +98,8 @@ public:
     void GetUserConnCnt(list<user_conn_t>* user_conn_list, uint32_t& total_conn_cnt);
     
     void BroadcastPdu(CImPdu* pdu, uint32_t client_type_flag);
+    // pBuf里可以是多个拼在一起的pdu, 每个连接只排一次队
+    void BroadcastBuffer(CSharedBuffer* pBuf, uint32_t client_type_flag);
 private:
     ImUserMap_t m_im_user_map;
     ImUserMapByName_t m_im_user_map_by_name;
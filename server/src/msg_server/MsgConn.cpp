@@ -22,6 +22,7 @@
 #include "IM.SwitchService.pb.h"
 #include "public_define.h"
 #include "ImPduBase.h"
+#include "Metrics.h"
 using namespace IM::BaseDefine;
 
 #define TIMEOUT_WATI_LOGIN_RESPONSE		15000	// 15 seconds
@@ -31,11 +32,13 @@ using namespace IM::BaseDefine;
 static ConnMap_t g_msg_conn_map;
 static UserMap_t g_msg_conn_user_map;
 
-static uint64_t	g_last_stat_tick;	// 上次显示丢包率信息的时间
 static uint32_t g_up_msg_total_cnt = 0;		// 上行消息包总数
 static uint32_t g_up_msg_miss_cnt = 0;		// 上行消息包丢数
 static uint32_t g_down_msg_total_cnt = 0;	// 下行消息包总数
 static uint32_t g_down_msg_miss_cnt = 0;	// 下行消息丢包数
+// 和上面的计数相同, 但不会被SIGUSR1清零, 由/metrics导出
+static CMetricCounter* g_down_msg_counter = NULL;
+static CMetricCounter* g_down_msg_miss_counter = NULL;
 
 static bool g_log_msg_toggle = true;	// 是否把收到的MsgData写入Log的开关，通过kill -SIGUSR2 pid 打开/关闭
 
@@ -44,23 +47,9 @@ static CGroupChat* s_group_chat = NULL;
 
 void msg_conn_timer_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
 {
-	ConnMap_t::iterator it_old;
-	CMsgConn* pConn = NULL;
-	uint64_t cur_time = get_tick_count();
-
-	for (ConnMap_t::iterator it = g_msg_conn_map.begin(); it != g_msg_conn_map.end(); ) {
-		it_old = it;
-		it++;
-
-		pConn = (CMsgConn*)it_old->second;
-		pConn->OnTimer(cur_time);
-	}
-
-	if (cur_time > g_last_stat_tick + LOG_MSG_STAT_INTERVAL) {
-		g_last_stat_tick = cur_time;
-		log("up_msg_cnt=%u, up_msg_miss_cnt=%u, down_msg_cnt=%u, down_msg_miss_cnt=%u ",
-			g_up_msg_total_cnt, g_up_msg_miss_cnt, g_down_msg_total_cnt, g_down_msg_miss_cnt);
-	}
+	// 连接的超时检查由每个连接自己的定时器完成, 这里只输出丢包率统计
+	log("up_msg_cnt=%u, up_msg_miss_cnt=%u, down_msg_cnt=%u, down_msg_miss_cnt=%u ",
+		g_up_msg_total_cnt, g_up_msg_miss_cnt, g_down_msg_total_cnt, g_down_msg_miss_cnt);
 }
 
 static void signal_handler_usr1(int sig_no)
@@ -92,11 +81,14 @@ static void signal_handler_hup(int sig_no)
 
 void init_msg_conn()
 {
-	g_last_stat_tick = get_tick_count();
 	signal(SIGUSR1, signal_handler_usr1);
 	signal(SIGUSR2, signal_handler_usr2);
 	signal(SIGHUP, signal_handler_hup);
-	netlib_register_timer(msg_conn_timer_callback, NULL, 1000);
+	netlib_register_timer(msg_conn_timer_callback, NULL, LOG_MSG_STAT_INTERVAL);
+	g_down_msg_counter = CMetricsRegistry::getInstance()->GetCounter("teamtalk_msg_down_total",
+			"messages sent to clients that expect an ack");
+	g_down_msg_miss_counter = CMetricsRegistry::getInstance()->GetCounter("teamtalk_msg_down_miss_total",
+			"messages sent to clients without an ack in time");
 	s_file_handler = CFileHandler::getInstance();
 	s_group_chat = CGroupChat::GetInstance();
 }
@@ -108,7 +100,8 @@ CMsgConn::CMsgConn()
     m_bOpen = false;
     m_bKickOff = false;
     m_last_seq_no = 0;
-    m_msg_cnt_per_sec = 0;
+    m_msg_tokens = MAX_MSG_CNT_PER_SECOND * 1000;
+    m_msg_token_tick = get_tick_count();
     m_send_msg_list.clear();
     m_online_status = IM::BaseDefine::USER_STATUS_OFFLINE;
 }
@@ -140,16 +133,8 @@ void CMsgConn::SendUserStatusUpdate(uint32_t user_status)
         pdu.SetCommandId(CID_OTHER_USER_CNT_UPDATE);
         send_to_all_login_server(&pdu);
         
-        IM::Server::IMUserStatusUpdate msg2;
-        msg2.set_user_status(::IM::BaseDefine::USER_STATUS_ONLINE);
-        msg2.set_user_id(pImUser->GetUserId());
-        msg2.set_client_type((::IM::BaseDefine::ClientType)m_client_type);
-        CImPdu pdu2;
-        pdu2.SetPBMsg(&msg2);
-        pdu2.SetServiceId(SID_OTHER);
-        pdu2.SetCommandId(CID_OTHER_USER_STATUS_UPDATE);
-        
-        send_to_all_route_server(&pdu2);
+        // 上线立即发给route_server, 下线才在合并窗口里攒着
+        send_user_status_to_route_server(pImUser->GetUserId(), user_status, m_client_type);
     } else if (user_status == ::IM::BaseDefine::USER_STATUS_OFFLINE) {
         IM::Server::IMUserCntUpdate msg;
         msg.set_user_action(USER_CNT_DEC);
@@ -160,15 +145,7 @@ void CMsgConn::SendUserStatusUpdate(uint32_t user_status)
         pdu.SetCommandId(CID_OTHER_USER_CNT_UPDATE);
         send_to_all_login_server(&pdu);
         
-        IM::Server::IMUserStatusUpdate msg2;
-        msg2.set_user_status(::IM::BaseDefine::USER_STATUS_OFFLINE);
-        msg2.set_user_id(pImUser->GetUserId());
-        msg2.set_client_type((::IM::BaseDefine::ClientType)m_client_type);
-        CImPdu pdu2;
-        pdu2.SetPBMsg(&msg2);
-        pdu2.SetServiceId(SID_OTHER);
-        pdu2.SetCommandId(CID_OTHER_USER_STATUS_UPDATE);
-        send_to_all_route_server(&pdu2);
+        send_user_status_to_route_server(pImUser->GetUserId(), user_status, m_client_type);
     }
 }
 
@@ -177,7 +154,7 @@ void CMsgConn::Close(bool kick_user)
     log("Close client, handle=%d, user_id=%u ", m_handle, GetUserId());
     if (m_handle != NETLIB_INVALID_HANDLE) {
         netlib_close(m_handle);
-        g_msg_conn_map.erase(m_handle);
+        imconn_map_del(&g_msg_conn_map, m_handle);
     }
     
     CImUser *pImUser = CImUserManager::GetInstance()->GetImUserById(GetUserId());
@@ -200,6 +177,7 @@ void CMsgConn::Close(bool kick_user)
     }
 
     
+    KillAllTimers();
     ReleaseRef();
 }
 
@@ -208,12 +186,15 @@ void CMsgConn::OnConnect(net_handle_t handle)
 	m_handle = handle;
 	m_login_time = get_tick_count();
 
-	g_msg_conn_map.insert(make_pair(handle, this));
+	imconn_map_add(&g_msg_conn_map, handle, this);
 
 	netlib_option(handle, NETLIB_OPT_SET_CALLBACK, (void*)imconn_callback);
 	netlib_option(handle, NETLIB_OPT_SET_CALLBACK_DATA, (void*)&g_msg_conn_map);
 	netlib_option(handle, NETLIB_OPT_GET_REMOTE_IP, (void*)&m_peer_ip);
 	netlib_option(handle, NETLIB_OPT_GET_REMOTE_PORT, (void*)&m_peer_port);
+
+	SetTimer(IMCONN_TIMER_IDLE, CLIENT_TIMEOUT);
+	SetTimer(IMCONN_TIMER_LOGIN, TIMEOUT_WATI_LOGIN_RESPONSE);
 }
 
 void CMsgConn::OnClose()
@@ -222,48 +203,49 @@ void CMsgConn::OnClose()
 	Close();
 }
 
-void CMsgConn::OnTimer(uint64_t curr_tick)
+void CMsgConn::OnTimerExpire(uint32_t timer_type, uint64_t curr_tick)
 {
-	m_msg_cnt_per_sec = 0;
-
-    if (CHECK_CLIENT_TYPE_MOBILE(GetClientType()))
-    {
-        if (curr_tick > m_last_recv_tick + MOBILE_CLIENT_TIMEOUT) {
-            log("mobile client timeout, handle=%d, uid=%u ", m_handle, GetUserId());
-            Close();
-            return;
-        }
-    }
-    else
-    {
-        if (curr_tick > m_last_recv_tick + CLIENT_TIMEOUT) {
-            log("client timeout, handle=%d, uid=%u ", m_handle, GetUserId());
-            Close();
-            return;
-        }
-    }
-    
-
-	if (!IsOpen()) {
-		if (curr_tick > m_login_time + TIMEOUT_WATI_LOGIN_RESPONSE) {
-			log("login timeout, handle=%d, uid=%u ", m_handle, GetUserId());
+	switch (timer_type)
+	{
+	case IMCONN_TIMER_IDLE:
+	{
+		// 收到数据时不动定时器, 到期时再按最后收包时间顺延
+		uint64_t timeout = CHECK_CLIENT_TYPE_MOBILE(GetClientType()) ? MOBILE_CLIENT_TIMEOUT : CLIENT_TIMEOUT;
+		if (curr_tick >= m_last_recv_tick + timeout) {
+			log("client timeout, handle=%d, uid=%u, client_type=%u ", m_handle, GetUserId(), GetClientType());
 			Close();
-			return;
+		} else {
+			SetTimer(IMCONN_TIMER_IDLE, m_last_recv_tick + timeout - curr_tick);
 		}
+		break;
 	}
-
-	list<msg_ack_t>::iterator it_old;
-	for (list<msg_ack_t>::iterator it = m_send_msg_list.begin(); it != m_send_msg_list.end(); ) {
-		msg_ack_t msg = *it;
-		it_old = it;
-		it++;
-		if (curr_tick >= msg.timestamp + TIMEOUT_WAITING_MSG_DATA_ACK) {
-			log("!!!a msg missed, msg_id=%u, %u->%u ", msg.msg_id, msg.from_id, GetUserId());
-			g_down_msg_miss_cnt++;
-			m_send_msg_list.erase(it_old);
-		} else {
-			break;
+	case IMCONN_TIMER_LOGIN:
+		if (!IsOpen()) {
+			log("login timeout, handle=%d, uid=%u ", m_handle, GetUserId());
+			Close();
 		}
+		break;
+	case IMCONN_TIMER_ACK:
+	{
+		list<msg_ack_t>::iterator it_old;
+		for (list<msg_ack_t>::iterator it = m_send_msg_list.begin(); it != m_send_msg_list.end(); ) {
+			msg_ack_t msg = *it;
+			it_old = it;
+			it++;
+			if (curr_tick >= msg.timestamp + TIMEOUT_WAITING_MSG_DATA_ACK) {
+				log("!!!a msg missed, msg_id=%u, %u->%u ", msg.msg_id, msg.from_id, GetUserId());
+				g_down_msg_miss_cnt++;
+				g_down_msg_miss_counter->Inc();
+				m_send_msg_list.erase(it_old);
+			} else {
+				SetTimer(IMCONN_TIMER_ACK, msg.timestamp + TIMEOUT_WAITING_MSG_DATA_ACK - curr_tick);
+				break;
+			}
+		}
+		break;
+	}
+	default:
+		break;
 	}
 }
 
@@ -565,7 +547,18 @@ void CMsgConn::_HandleClientMsgData(CImPdu* pPdu)
 		return;
 	}
 
-	if (m_msg_cnt_per_sec >= MAX_MSG_CNT_PER_SECOND) {
+	// 令牌桶: 令牌按时间连续补充, 每秒MAX_MSG_CNT_PER_SECOND条, 最多攒MAX_MSG_CNT_PER_SECOND条,
+	// 不再每秒整体清零, 发完一波后要等令牌慢慢补回来
+	uint64_t curr_tick = get_tick_count();
+	if (curr_tick > m_msg_token_tick) {
+		m_msg_tokens += (curr_tick - m_msg_token_tick) * MAX_MSG_CNT_PER_SECOND;
+		if (m_msg_tokens > MAX_MSG_CNT_PER_SECOND * 1000) {
+			m_msg_tokens = MAX_MSG_CNT_PER_SECOND * 1000;
+		}
+		m_msg_token_tick = curr_tick;
+	}
+
+	if (m_msg_tokens < 1000) {
 		log("!!!too much msg cnt in one second, uid=%u ", GetUserId());
 		return;
 	}
@@ -576,7 +569,7 @@ void CMsgConn::_HandleClientMsgData(CImPdu* pPdu)
         return;
     }
 
-	m_msg_cnt_per_sec++;
+	m_msg_tokens -= 1000;
 
 	uint32_t to_session_id = msg.to_session_id();
     uint32_t msg_id = msg.msg_id();
@@ -593,8 +586,13 @@ void CMsgConn::_HandleClientMsgData(CImPdu* pPdu)
     msg.set_create_time(cur_time);
     msg.set_attach_data(attach_data.GetBuffer(), attach_data.GetLength());
     pPdu->SetPBMsg(&msg);
-	// send to DB storage server
-	CDBServConn* pDbConn = get_db_serv_conn();
+	// send to DB storage server, 同一个会话(两人之间/群)的消息固定发给同一个db_proxy
+	uint32_t session_key = to_session_id;
+	if (CHECK_MSG_TYPE_SINGLE(msg_type)) {
+		uint32_t from_user_id = GetUserId();
+		session_key = from_user_id < to_session_id ? (from_user_id * 31 + to_session_id) : (to_session_id * 31 + from_user_id);
+	}
+	CDBServConn* pDbConn = get_db_serv_conn_by_key(session_key);
 	if (pDbConn) {
 		pDbConn->SendPdu(pPdu);
 	}
@@ -923,7 +921,13 @@ void CMsgConn::AddToSendList(uint32_t msg_id, uint32_t from_id)
 	msg.timestamp = get_tick_count();
 	m_send_msg_list.push_back(msg);
 
+	// 列表按时间有序, 定时器只需要跟踪第一条
+	if (!IsTimerPending(IMCONN_TIMER_ACK)) {
+		SetTimer(IMCONN_TIMER_ACK, TIMEOUT_WAITING_MSG_DATA_ACK);
+	}
+
 	g_down_msg_total_cnt++;
+	g_down_msg_counter->Inc();
 }
 
 void CMsgConn::DelFromSendList(uint32_t msg_id, uint32_t from_id)
@@ -48,7 +48,7 @@ public:
 
 	virtual void OnConnect(net_handle_t handle);
 	virtual void OnClose();
-	virtual inline void OnTimer(uint64_t curr_tick);
+	virtual void OnTimerExpire(uint32_t timer_type, uint64_t curr_tick);
 
 	virtual void HandlePdu(CImPdu* pPdu);
 
@@ -96,7 +96,8 @@ private:
     
     list<msg_ack_t>	m_send_msg_list;
     
-    uint32_t		m_msg_cnt_per_sec;
+    uint64_t		m_msg_tokens;		// 发消息的令牌桶, 单位为1/1000条
+    uint64_t		m_msg_token_tick;	// 上次补充令牌的时间
     
     uint32_t        m_client_type;        //客户端登录方式
     
@@ -22,6 +22,8 @@
 #include "IM.Server.pb.h"
 #include "IM.SwitchService.pb.h"
 #include "IM.File.pb.h"
+#include "UserStatCodec.h"
+#include "Metrics.h"
 using namespace IM::BaseDefine;
 
 static ConnMap_t g_route_server_conn_map;
@@ -32,6 +34,53 @@ static CRouteServConn* g_master_rs_conn = NULL;
 static CFileHandler* s_file_handler = NULL;
 static CGroupChat* s_group_chat = NULL;
 
+// 窗口内每个(user_id, client_type)还没发出去的下线数(负数); 上线立即发送, 不进窗口,
+// 否则route_server在窗口内找不到刚登录的用户, 发给他的消息会被丢掉;
+// 窗口里还有同一个端的下线时, 上线和它抵消(route_server那边本来就还认为在线)
+typedef hash_map<uint64_t, int32_t> StatusDeltaMap_t;
+static StatusDeltaMap_t g_status_delta_map;
+static uint32_t g_status_batch_interval = 0;
+static CMetricCounter* g_status_change_counter = NULL;
+static CMetricCounter* g_status_sent_counter = NULL;
+
+static void flush_user_status()
+{
+	if (g_status_delta_map.empty()) {
+		return;
+	}
+
+	vector<user_stat_t> user_stat_list;
+	user_stat_t stat;
+	for (StatusDeltaMap_t::iterator it = g_status_delta_map.begin(); it != g_status_delta_map.end(); it++) {
+		stat.user_id = (uint32_t)(it->first >> 32);
+		stat.client_type = (uint32_t)it->first;
+		stat.status = USER_STATUS_OFFLINE;
+		// 同一类型的端可能同时有多个, 下线了几个就发几项
+		for (int32_t i = 0; i < -it->second; i++) {
+			user_stat_list.push_back(stat);
+		}
+	}
+	g_status_delta_map.clear();
+
+	if (user_stat_list.empty()) {
+		return;
+	}
+
+	g_status_sent_counter->Inc(user_stat_list.size());
+	IM::Server::IMOnlineUserInfo msg;
+	encode_user_stat_list(user_stat_list, *msg.mutable_user_stat_data());
+	CImPdu pdu;
+	pdu.SetPBMsg(&msg);
+	pdu.SetServiceId(SID_OTHER);
+	pdu.SetCommandId(CID_OTHER_USER_STATUS_BATCH);
+	send_to_all_route_server(&pdu);
+}
+
+static void user_status_timer_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+	flush_user_status();
+}
+
 void route_server_conn_timer_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
 {
 	ConnMap_t::iterator it_old;
@@ -50,7 +99,7 @@ void route_server_conn_timer_callback(void* callback_data, uint8_t msg, uint32_t
 	serv_check_reconnect<CRouteServConn>(g_route_server_list, g_route_server_count);
 }
 
-void init_route_serv_conn(serv_info_t* server_list, uint32_t server_count)
+void init_route_serv_conn(serv_info_t* server_list, uint32_t server_count, uint32_t status_batch_interval)
 {
 	g_route_server_list = server_list;
 	g_route_server_count = server_count;
@@ -60,6 +109,15 @@ void init_route_serv_conn(serv_info_t* server_list, uint32_t server_count)
 	netlib_register_timer(route_server_conn_timer_callback, NULL, 1000);
 	s_file_handler = CFileHandler::getInstance();
 	s_group_chat = CGroupChat::GetInstance();
+
+	g_status_batch_interval = status_batch_interval;
+	if (g_status_batch_interval > 0) {
+		netlib_register_timer(user_status_timer_callback, NULL, g_status_batch_interval);
+	}
+	g_status_change_counter = CMetricsRegistry::getInstance()->GetCounter("teamtalk_user_status_change_total",
+			"client login/logout events on this msg_server");
+	g_status_sent_counter = CMetricsRegistry::getInstance()->GetCounter("teamtalk_user_status_sent_total",
+			"login/logout events sent to route_server after coalescing");
 }
 
 bool is_route_server_available()
@@ -88,6 +146,37 @@ void send_to_all_route_server(CImPdu* pPdu)
 	}
 }
 
+void send_user_status_to_route_server(uint32_t user_id, uint32_t user_status, uint32_t client_type)
+{
+	g_status_change_counter->Inc();
+	uint64_t key = ((uint64_t)user_id << 32) | client_type;
+	if (g_status_batch_interval > 0) {
+		if (user_status != USER_STATUS_ONLINE) {
+			g_status_delta_map[key]--;
+			return;
+		}
+
+		StatusDeltaMap_t::iterator it = g_status_delta_map.find(key);
+		if (it != g_status_delta_map.end()) {
+			if (++it->second == 0) {
+				g_status_delta_map.erase(it);
+			}
+			return;
+		}
+	}
+
+	IM::Server::IMUserStatusUpdate msg;
+	msg.set_user_status(user_status);
+	msg.set_user_id(user_id);
+	msg.set_client_type((::IM::BaseDefine::ClientType)client_type);
+	CImPdu pdu;
+	pdu.SetPBMsg(&msg);
+	pdu.SetServiceId(SID_OTHER);
+	pdu.SetCommandId(CID_OTHER_USER_STATUS_UPDATE);
+	g_status_sent_counter->Inc();
+	send_to_all_route_server(&pdu);
+}
+
 // get the oldest route server connection
 CRouteServConn* get_route_serv_conn()
 {
@@ -166,6 +255,9 @@ void CRouteServConn::Close()
 void CRouteServConn::OnConfirm()
 {
 	log("connect to route server success ");
+	// 下面的全量列表已经包含了还在窗口里的变化, 先把它们发给其他已经连上的route_server,
+	// 否则这个route_server会重复计算
+	flush_user_status();
 	m_bOpen = true;
 	m_connect_time = get_tick_count();
 	g_route_server_list[m_serv_idx].reconnect_cnt = MIN_RECONNECT_CNT / 2;
@@ -179,17 +271,14 @@ void CRouteServConn::OnConfirm()
     //这样将来A用户给B发聊天消息，msg_server将该聊天消息转给route_server，
     //route_server就知道用户B在哪个msg_server上了，
     //以便将该聊天消息发给B所在的msg_server。
+    //用户多时逐项的ServerUserStat很大, 改成差分编码放在user_stat_data里, 见UserStatCodec.h
 	list<user_stat_t> online_user_list;
     CImUserManager::GetInstance()->GetOnlineUserInfo(&online_user_list);
+    vector<user_stat_t> user_stat_list(online_user_list.begin(), online_user_list.end());
     IM::Server::IMOnlineUserInfo msg;
-    for (list<user_stat_t>::iterator it = online_user_list.begin(); it != online_user_list.end(); it++) {
-        user_stat_t user_stat = *it;
-        IM::BaseDefine::ServerUserStat* server_user_stat = msg.add_user_stat_list();
-        server_user_stat->set_user_id(user_stat.user_id);
-        server_user_stat->set_status((::IM::BaseDefine::UserStatType)user_stat.status);
-        server_user_stat->set_client_type((::IM::BaseDefine::ClientType)user_stat.client_type);
-
-    }
+    encode_user_stat_list(user_stat_list, *msg.mutable_user_stat_data());
+    log("send online user info, user_cnt=%u, data_len=%u ", (uint32_t)user_stat_list.size(),
+        (uint32_t)msg.user_stat_data().size());
     CImPdu pdu;
     pdu.SetPBMsg(&msg);
     pdu.SetServiceId(SID_OTHER);
@@ -246,6 +335,12 @@ void CRouteServConn::HandlePdu(CImPdu* pPdu)
         case CID_OTHER_LOGIN_STATUS_NOTIFY:
             _HandlePCLoginStatusNotify(pPdu);
             break;
+        case CID_OTHER_USER_STAT_NOTIFY_BATCH:
+            _HandleStatusNotifyBatch(pPdu);
+            break;
+        case CID_OTHER_LOGIN_STATUS_NOTIFY_BATCH:
+            _HandlePCLoginStatusNotifyBatch(pPdu);
+            break;
         case CID_BUDDY_LIST_REMOVE_SESSION_NOTIFY:
             _HandleRemoveSessionNotify(pPdu);
             break;
@@ -479,7 +574,11 @@ void CRouteServConn::_HandlePCLoginStatusNotify(CImPdu *pPdu)
     uint32_t user_id = msg.user_id();
     uint32_t login_status = msg.login_status();
     log("HandlePCLoginStatusNotify, user_id=%u, login_status=%u ", user_id, login_status);
-    
+    _NotifyPCLoginStatus(user_id, login_status);
+}
+
+void CRouteServConn::_NotifyPCLoginStatus(uint32_t user_id, uint32_t login_status)
+{
     CImUser* pUser = CImUserManager::GetInstance()->GetImUserById(user_id);
     if (pUser)
     {
@@ -502,6 +601,59 @@ void CRouteServConn::_HandlePCLoginStatusNotify(CImPdu *pPdu)
     }
 }
 
+void CRouteServConn::_HandleStatusNotifyBatch(CImPdu* pPdu)
+{
+    IM::Server::IMOnlineUserInfo msg;
+    CHECK_PB_PARSE_MSG(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()));
+
+    vector<user_stat_t> user_stat_list;
+    if (!decode_user_stat_list(msg.user_stat_data(), user_stat_list)) {
+        log("HandleStatusNotifyBatch, bad user_stat_data, len=%u ", (uint32_t)msg.user_stat_data().size());
+        return;
+    }
+    log("HandleStatusNotifyBatch, user_cnt=%u ", (uint32_t)user_stat_list.size());
+    if (user_stat_list.empty()) {
+        return;
+    }
+
+    // 每个用户还是一个IMUserStatNotify, 客户端不用改; 所有的通知拼在一起, 每个pc端连接只排一次队
+    string notify_data;
+    for (vector<user_stat_t>::iterator it = user_stat_list.begin(); it != user_stat_list.end(); it++) {
+        IM::Buddy::IMUserStatNotify msg2;
+        IM::BaseDefine::UserStat* user_stat = msg2.mutable_user_stat();
+        user_stat->set_user_id(it->user_id);
+        user_stat->set_status((IM::BaseDefine::UserStatType)it->status);
+        CImPdu pdu;
+        pdu.SetPBMsg(&msg2);
+        pdu.SetServiceId(SID_BUDDY_LIST);
+        pdu.SetCommandId(CID_BUDDY_LIST_STATUS_NOTIFY);
+        notify_data.append((char*)pdu.GetBuffer(), pdu.GetLength());
+    }
+
+    CSharedBuffer* pBuf = new CSharedBuffer(notify_data.data(), notify_data.size());
+    CImUserManager::GetInstance()->BroadcastBuffer(pBuf, CLIENT_TYPE_FLAG_PC);
+    pBuf->ReleaseRef();
+}
+
+void CRouteServConn::_HandlePCLoginStatusNotifyBatch(CImPdu* pPdu)
+{
+    IM::Server::IMOnlineUserInfo msg;
+    CHECK_PB_PARSE_MSG(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()));
+
+    vector<user_stat_t> user_stat_list;
+    if (!decode_user_stat_list(msg.user_stat_data(), user_stat_list)) {
+        log("HandlePCLoginStatusNotifyBatch, bad user_stat_data, len=%u ", (uint32_t)msg.user_stat_data().size());
+        return;
+    }
+    log("HandlePCLoginStatusNotifyBatch, user_cnt=%u ", (uint32_t)user_stat_list.size());
+
+    // 只有本机上有这个用户时才需要处理, 一般只占很少一部分
+    for (vector<user_stat_t>::iterator it = user_stat_list.begin(); it != user_stat_list.end(); it++) {
+        uint32_t login_status = (it->status == USER_STATUS_ONLINE) ? IM_PC_LOGIN_STATUS_ON : IM_PC_LOGIN_STATUS_OFF;
+        _NotifyPCLoginStatus(it->user_id, login_status);
+    }
+}
+
 void CRouteServConn::_HandleSignInfoChangedNotify(CImPdu* pPdu) {
         IM::Buddy::IMSignInfoChangedNotify msg;
         CHECK_PB_PARSE_MSG(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()));
@@ -36,6 +36,9 @@ private:
 	void _HandleP2PMsg(CImPdu* pPdu);
 	void _HandleUsersStatusResponse(CImPdu* pPdu);
     void _HandlePCLoginStatusNotify(CImPdu* pPdu);
+    void _HandleStatusNotifyBatch(CImPdu* pPdu);
+    void _HandlePCLoginStatusNotifyBatch(CImPdu* pPdu);
+    void _NotifyPCLoginStatus(uint32_t user_id, uint32_t login_status);
     void _HandleRemoveSessionNotify(CImPdu* pPdu);
     void _HandleSignInfoChangedNotify(CImPdu* pPdu);
 private:
@@ -44,9 +47,12 @@ private:
 	uint64_t	m_connect_time;
 };
 
-void init_route_serv_conn(serv_info_t* server_list, uint32_t server_count);
+// status_batch_interval: 用户下线合并发给route_server的窗口(毫秒), 0表示每次下线立即单独发送; 上线总是立即发送
+void init_route_serv_conn(serv_info_t* server_list, uint32_t server_count, uint32_t status_batch_interval);
 bool is_route_server_available();
 void send_to_all_route_server(CImPdu* pPdu);
+// 一个端上线(USER_STATUS_ONLINE)或下线(USER_STATUS_OFFLINE)
+void send_user_status_to_route_server(uint32_t user_id, uint32_t user_status, uint32_t client_type);
 CRouteServConn* get_route_serv_conn();
 
 
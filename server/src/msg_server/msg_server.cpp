@@ -15,8 +15,11 @@
 #include "PushServConn.h"
 #include "FileServConn.h"
 //#include "version.h"
+#include "MetricsServer.h"
 
 #define DEFAULT_CONCURRENT_DB_CONN_CNT  10
+#define DEFAULT_REACTOR_CNT             1
+#define DEFAULT_STATUS_BATCH_INTERVAL   100     // 毫秒
 
 CAes *pAes;
 
@@ -122,6 +125,19 @@ int main(int argc, char* argv[])
 	if (ret == NETLIB_ERROR)
 		return ret;
 
+	// 客户端连接分散到多个reactor线程收发, 业务逻辑仍在主线程处理
+	uint32_t reactor_cnt = DEFAULT_REACTOR_CNT;
+	char* str_reactor_cnt = config_file.GetConfigName("ReactorCount");
+	if (str_reactor_cnt) {
+		reactor_cnt = atoi(str_reactor_cnt);
+	}
+
+	ret = netlib_init_reactors(reactor_cnt);
+	if (ret == NETLIB_ERROR) {
+		log("invalid ReactorCount: %u ", reactor_cnt);
+		return ret;
+	}
+
     //在8000端口号上侦听客户端连接
 	CStrExplode listen_ip_list(listen_ip, ';');
 	for (uint32_t i = 0; i < listen_ip_list.GetItemCnt(); i++) {
@@ -130,7 +146,7 @@ int main(int argc, char* argv[])
 			return ret;
 	}
 
-	printf("server start listen on: %s:%d\n", listen_ip, listen_port);
+	printf("server start listen on: %s:%d, reactor count: %u\n", listen_ip, listen_port, reactor_cnt);
 
 	init_msg_conn();
 
@@ -141,9 +157,19 @@ int main(int argc, char* argv[])
 
 	init_login_serv_conn(login_server_list, login_server_count, ip_addr1, ip_addr2, listen_port, max_conn_cnt);
 
-	init_route_serv_conn(route_server_list, route_server_count);
+	// 用户下线在这个窗口里合并后批量发给route_server, 上线总是立即发送; 0表示下线也立即发送(老的route_server只支持这种)
+	uint32_t status_batch_interval = DEFAULT_STATUS_BATCH_INTERVAL;
+	char* str_status_batch_interval = config_file.GetConfigName("StatusBatchInterval");
+	if (str_status_batch_interval) {
+		status_batch_interval = atoi(str_status_batch_interval);
+	}
+	init_route_serv_conn(route_server_list, route_server_count, status_batch_interval);
 
     init_push_serv_conn(push_server_list, push_server_count);
+	// 本地端口上的/metrics, 配置了MetricsPort才监听
+	if (metrics_server_init(&config_file) == -1)
+		return -1;
+
 	printf("now enter the event loop...\n");
     
     writePid();
@@ -0,0 +1,370 @@
+/*
+ * PresenceTable.cpp
+ *
+ */
+
+#include "PresenceTable.h"
+#include "public_define.h"
+#include "IM.BaseDefine.pb.h"
+using namespace IM::BaseDefine;
+
+CPresenceTable::CPresenceTable()
+{
+	m_user_cnt = 0;
+	for (uint32_t i = 0; i < PRESENCE_SHARD_CNT; i++) {
+		Shard_t* pShard = &m_shards[i];
+		pShard->capacity = PRESENCE_INIT_CAPACITY;
+		pShard->mask = PRESENCE_INIT_CAPACITY - 1;
+		pShard->size = 0;
+		pShard->entry_list = new presence_entry_t[PRESENCE_INIT_CAPACITY];
+		memset(pShard->entry_list, 0, sizeof(presence_entry_t) * PRESENCE_INIT_CAPACITY);
+	}
+}
+
+CPresenceTable::~CPresenceTable()
+{
+	for (uint32_t i = 0; i < PRESENCE_SHARD_CNT; i++) {
+		delete [] m_shards[i].entry_list;
+	}
+}
+
+void CPresenceTable::AddClient(uint32_t user_id, uint32_t server_idx, uint32_t client_type)
+{
+	if (user_id == 0 || server_idx >= PRESENCE_MAX_SERVER) {
+		return;
+	}
+
+	presence_entry_t* pEntry = _Find(user_id);
+	if (!pEntry) {
+		pEntry = _Insert(user_id);
+	}
+
+	for (uint32_t i = 0; i < pEntry->item_cnt; i++) {
+		presence_item_t& item = pEntry->items[i];
+		if (item.server_idx == server_idx && item.client_type == client_type) {
+			item.count++;
+			return;
+		}
+	}
+
+	presence_item_list_t* pItemList = NULL;
+	if (pEntry->flags & PRESENCE_FLAG_OVERFLOW) {
+		pItemList = &m_overflow_map[user_id];
+		for (presence_item_list_t::iterator it = pItemList->begin(); it != pItemList->end(); it++) {
+			if (it->server_idx == server_idx && it->client_type == client_type) {
+				it->count++;
+				return;
+			}
+		}
+	}
+
+	presence_item_t item;
+	item.server_idx = server_idx;
+	item.client_type = client_type;
+	item.count = 1;
+	pEntry->server_mask |= (uint64_t)1 << server_idx;
+	if (pEntry->item_cnt < PRESENCE_INLINE_ITEM_CNT) {
+		pEntry->items[pEntry->item_cnt++] = item;
+	} else {
+		if (!pItemList) {
+			pItemList = &m_overflow_map[user_id];
+		}
+		pItemList->push_back(item);
+		pEntry->flags |= PRESENCE_FLAG_OVERFLOW;
+	}
+}
+
+void CPresenceTable::RemoveClient(uint32_t user_id, uint32_t server_idx, uint32_t client_type)
+{
+	presence_entry_t* pEntry = _Find(user_id);
+	if (!pEntry) {
+		return;
+	}
+
+	bool bFound = false;
+	for (uint32_t i = 0; i < pEntry->item_cnt; i++) {
+		presence_item_t& item = pEntry->items[i];
+		if (item.server_idx == server_idx && item.client_type == client_type) {
+			if (--item.count > 0) {
+				return;
+			}
+			pEntry->items[i] = pEntry->items[--pEntry->item_cnt];
+			_RefillInline(pEntry);
+			bFound = true;
+			break;
+		}
+	}
+
+	if (!bFound && (pEntry->flags & PRESENCE_FLAG_OVERFLOW)) {
+		OverflowMap_t::iterator it_map = m_overflow_map.find(user_id);
+		presence_item_list_t& item_list = it_map->second;
+		for (presence_item_list_t::iterator it = item_list.begin(); it != item_list.end(); it++) {
+			if (it->server_idx == server_idx && it->client_type == client_type) {
+				if (--it->count > 0) {
+					return;
+				}
+				item_list.erase(it);
+				if (item_list.empty()) {
+					m_overflow_map.erase(it_map);
+					pEntry->flags &= ~PRESENCE_FLAG_OVERFLOW;
+				}
+				bFound = true;
+				break;
+			}
+		}
+	}
+
+	if (!bFound) {
+		return;
+	}
+
+	if (pEntry->item_cnt == 0) {
+		Shard_t* pShard = _GetShard(user_id);
+		_Erase(pShard, pEntry - pShard->entry_list);
+		return;
+	}
+
+	// 这个msg_server上还有没有这个用户的其他端
+	for (uint32_t i = 0; i < pEntry->item_cnt; i++) {
+		if (pEntry->items[i].server_idx == server_idx) {
+			return;
+		}
+	}
+	if (pEntry->flags & PRESENCE_FLAG_OVERFLOW) {
+		presence_item_list_t& item_list = m_overflow_map[user_id];
+		for (presence_item_list_t::iterator it = item_list.begin(); it != item_list.end(); it++) {
+			if (it->server_idx == server_idx) {
+				return;
+			}
+		}
+	}
+	pEntry->server_mask &= ~((uint64_t)1 << server_idx);
+}
+
+void CPresenceTable::RemoveServer(uint32_t server_idx)
+{
+	if (server_idx >= PRESENCE_MAX_SERVER) {
+		return;
+	}
+
+	uint64_t server_bit = (uint64_t)1 << server_idx;
+	for (uint32_t i = 0; i < PRESENCE_SHARD_CNT; i++) {
+		Shard_t* pShard = &m_shards[i];
+		for (uint32_t slot = 0; slot < pShard->capacity; ) {
+			presence_entry_t* pEntry = &pShard->entry_list[slot];
+			if (pEntry->user_id != 0 && (pEntry->server_mask & server_bit) && _RemoveServerItems(pEntry, server_idx)) {
+				// 后面的项会移到这个槽, 不前进, 再检查一次这个槽
+				_Erase(pShard, slot);
+			} else {
+				slot++;
+			}
+		}
+	}
+}
+
+void CPresenceTable::Reserve(uint32_t user_cnt)
+{
+	uint32_t shard_cnt = user_cnt / PRESENCE_SHARD_CNT + 1;
+	for (uint32_t i = 0; i < PRESENCE_SHARD_CNT; i++) {
+		Shard_t* pShard = &m_shards[i];
+		uint32_t capacity = pShard->capacity;
+		while ((uint64_t)(pShard->size + shard_cnt) * 4 > (uint64_t)capacity * 3) {
+			capacity <<= 1;
+		}
+		if (capacity != pShard->capacity) {
+			_Resize(pShard, capacity);
+		}
+	}
+}
+
+uint64_t CPresenceTable::GetServerMask(uint32_t user_id)
+{
+	presence_entry_t* pEntry = _Find(user_id);
+	return pEntry ? pEntry->server_mask : 0;
+}
+
+bool CPresenceTable::IsPCClientLogin(uint32_t user_id)
+{
+	return _HasClientType(user_id, true);
+}
+
+bool CPresenceTable::IsMobileClientLogin(uint32_t user_id)
+{
+	return _HasClientType(user_id, false);
+}
+
+uint32_t CPresenceTable::GetStatus(uint32_t user_id)
+{
+	return _HasClientType(user_id, true) ? USER_STATUS_ONLINE : USER_STATUS_OFFLINE;
+}
+
+uint64_t CPresenceTable::GetMemoryUsage()
+{
+	uint64_t mem_size = sizeof(CPresenceTable);
+	for (uint32_t i = 0; i < PRESENCE_SHARD_CNT; i++) {
+		mem_size += (uint64_t)m_shards[i].capacity * sizeof(presence_entry_t);
+	}
+
+	// 溢出表按节点和vector的大小估算, 正常情况下几乎是空的
+	for (OverflowMap_t::iterator it = m_overflow_map.begin(); it != m_overflow_map.end(); it++) {
+		mem_size += 48 + it->second.capacity() * sizeof(presence_item_t);
+	}
+	return mem_size;
+}
+
+presence_entry_t* CPresenceTable::_Find(uint32_t user_id)
+{
+	if (user_id == 0) {
+		return NULL;
+	}
+
+	Shard_t* pShard = _GetShard(user_id);
+	uint32_t slot = _Hash(user_id) & pShard->mask;
+	while (true) {
+		presence_entry_t* pEntry = &pShard->entry_list[slot];
+		if (pEntry->user_id == user_id) {
+			return pEntry;
+		} else if (pEntry->user_id == 0) {
+			return NULL;
+		}
+		slot = (slot + 1) & pShard->mask;
+	}
+}
+
+presence_entry_t* CPresenceTable::_Insert(uint32_t user_id)
+{
+	Shard_t* pShard = _GetShard(user_id);
+	// 装载率不超过3/4, 线性探测的平均查找长度还比较短
+	if ((uint64_t)(pShard->size + 1) * 4 > (uint64_t)pShard->capacity * 3) {
+		_Resize(pShard, pShard->capacity << 1);
+	}
+
+	uint32_t slot = _Hash(user_id) & pShard->mask;
+	while (pShard->entry_list[slot].user_id != 0) {
+		slot = (slot + 1) & pShard->mask;
+	}
+
+	presence_entry_t* pEntry = &pShard->entry_list[slot];
+	memset(pEntry, 0, sizeof(presence_entry_t));
+	pEntry->user_id = user_id;
+	pShard->size++;
+	m_user_cnt++;
+	return pEntry;
+}
+
+void CPresenceTable::_Erase(Shard_t* pShard, uint32_t slot)
+{
+	presence_entry_t* entry_list = pShard->entry_list;
+	uint32_t hole = slot;
+	uint32_t next = (slot + 1) & pShard->mask;
+	while (entry_list[next].user_id != 0) {
+		// 这一项的理想位置到它现在的位置之间经过了空出来的槽, 就可以挪到空槽里
+		uint32_t home = _Hash(entry_list[next].user_id) & pShard->mask;
+		if (((next - home) & pShard->mask) >= ((next - hole) & pShard->mask)) {
+			entry_list[hole] = entry_list[next];
+			hole = next;
+		}
+		next = (next + 1) & pShard->mask;
+	}
+
+	memset(&entry_list[hole], 0, sizeof(presence_entry_t));
+	pShard->size--;
+	m_user_cnt--;
+}
+
+void CPresenceTable::_Resize(Shard_t* pShard, uint32_t capacity)
+{
+	presence_entry_t* old_list = pShard->entry_list;
+	uint32_t old_capacity = pShard->capacity;
+
+	pShard->entry_list = new presence_entry_t[capacity];
+	memset(pShard->entry_list, 0, sizeof(presence_entry_t) * capacity);
+	pShard->capacity = capacity;
+	pShard->mask = capacity - 1;
+
+	for (uint32_t i = 0; i < old_capacity; i++) {
+		if (old_list[i].user_id == 0) {
+			continue;
+		}
+
+		uint32_t slot = _Hash(old_list[i].user_id) & pShard->mask;
+		while (pShard->entry_list[slot].user_id != 0) {
+			slot = (slot + 1) & pShard->mask;
+		}
+		pShard->entry_list[slot] = old_list[i];
+	}
+
+	delete [] old_list;
+}
+
+bool CPresenceTable::_HasClientType(uint32_t user_id, bool bPC)
+{
+	presence_entry_t* pEntry = _Find(user_id);
+	if (!pEntry) {
+		return false;
+	}
+
+	for (uint32_t i = 0; i < pEntry->item_cnt; i++) {
+		if (CHECK_CLIENT_TYPE_PC(pEntry->items[i].client_type) == bPC) {
+			return true;
+		}
+	}
+	if (pEntry->flags & PRESENCE_FLAG_OVERFLOW) {
+		presence_item_list_t& item_list = m_overflow_map[user_id];
+		for (presence_item_list_t::iterator it = item_list.begin(); it != item_list.end(); it++) {
+			if (CHECK_CLIENT_TYPE_PC(it->client_type) == bPC) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void CPresenceTable::_RefillInline(presence_entry_t* pEntry)
+{
+	if (!(pEntry->flags & PRESENCE_FLAG_OVERFLOW) || pEntry->item_cnt >= PRESENCE_INLINE_ITEM_CNT) {
+		return;
+	}
+
+	OverflowMap_t::iterator it = m_overflow_map.find(pEntry->user_id);
+	presence_item_list_t& item_list = it->second;
+	while (pEntry->item_cnt < PRESENCE_INLINE_ITEM_CNT && !item_list.empty()) {
+		pEntry->items[pEntry->item_cnt++] = item_list.back();
+		item_list.pop_back();
+	}
+	if (item_list.empty()) {
+		m_overflow_map.erase(it);
+		pEntry->flags &= ~PRESENCE_FLAG_OVERFLOW;
+	}
+}
+
+bool CPresenceTable::_RemoveServerItems(presence_entry_t* pEntry, uint32_t server_idx)
+{
+	if (pEntry->flags & PRESENCE_FLAG_OVERFLOW) {
+		OverflowMap_t::iterator it_map = m_overflow_map.find(pEntry->user_id);
+		presence_item_list_t& item_list = it_map->second;
+		for (presence_item_list_t::iterator it = item_list.begin(); it != item_list.end(); ) {
+			if (it->server_idx == server_idx) {
+				it = item_list.erase(it);
+			} else {
+				it++;
+			}
+		}
+		if (item_list.empty()) {
+			m_overflow_map.erase(it_map);
+			pEntry->flags &= ~PRESENCE_FLAG_OVERFLOW;
+		}
+	}
+
+	uint32_t cnt = 0;
+	for (uint32_t i = 0; i < pEntry->item_cnt; i++) {
+		if (pEntry->items[i].server_idx != server_idx) {
+			pEntry->items[cnt++] = pEntry->items[i];
+		}
+	}
+	pEntry->item_cnt = cnt;
+	_RefillInline(pEntry);
+
+	pEntry->server_mask &= ~((uint64_t)1 << server_idx);
+	return pEntry->item_cnt == 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * PresenceTable.h
+ *
+ * route_server上的在线状态表: 每个在线用户在哪些msg_server上, 每个msg_server上有几个什么类型的端
+ * 1. 开放寻址(线性探测)的平铺数组, 一个用户一项32字节, 不再为每个用户分配CUserInfo, set和map的节点;
+ *    删除时把后面的项往前移(backward shift), 不留墓碑
+ * 2. 每项有一个64位的位图记录用户在哪些msg_server上(按CRouteConn的槽位号), 转发时直接按位图找连接;
+ *    (msg_server槽位, client_type, 个数)内联存4个, 同一个用户超过4个组合时放到溢出表
+ * 3. 按user_id的哈希分成PRESENCE_SHARD_CNT个分片, 每个分片单独扩容, 100万用户时一次扩容只搬1/16,
+ *    不会让事件循环卡住太久
+ *
+ * route_server是单线程的, 这里不加锁
+ */
+
+#ifndef PRESENCETABLE_H_
+#define PRESENCETABLE_H_
+
+#include "ostype.h"
+#include "util.h"
+#include <vector>
+using namespace std;
+
+#define PRESENCE_MAX_SERVER			64		// msg_server的最大个数, 即位图的位数
+#define PRESENCE_INLINE_ITEM_CNT	4
+#define PRESENCE_SHARD_CNT			16
+#define PRESENCE_INIT_CAPACITY		1024	// 每个分片的初始槽数, 2的幂
+
+#define PRESENCE_FLAG_OVERFLOW		0x01	// 这个用户还有放在溢出表里的项
+
+typedef struct {
+	uint8_t		server_idx;
+	uint8_t		client_type;
+	uint16_t	count;
+} presence_item_t;
+
+typedef struct {
+	uint32_t		user_id;		// 0表示空槽
+	uint8_t			item_cnt;		// 内联的项数
+	uint8_t			flags;
+	uint16_t		reserved;
+	uint64_t		server_mask;
+	presence_item_t	items[PRESENCE_INLINE_ITEM_CNT];
+} presence_entry_t;
+
+typedef vector<presence_item_t> presence_item_list_t;
+
+class CPresenceTable
+{
+public:
+	CPresenceTable();
+	virtual ~CPresenceTable();
+
+	// 某个msg_server上的一个端上线/下线, 同一类型的端可以有多个, 按个数记
+	void AddClient(uint32_t user_id, uint32_t server_idx, uint32_t client_type);
+	void RemoveClient(uint32_t user_id, uint32_t server_idx, uint32_t client_type);
+	// msg_server断开, 去掉它上面的所有端, 需要扫描整个表
+	void RemoveServer(uint32_t server_idx);
+	// 知道大概的用户数时先扩好容量, 全量同步时避免边插入边扩容
+	void Reserve(uint32_t user_cnt);
+
+	// 0表示不在线
+	uint64_t GetServerMask(uint32_t user_id);
+	bool IsOnline(uint32_t user_id) { return _Find(user_id) != NULL; }
+	bool IsPCClientLogin(uint32_t user_id);
+	bool IsMobileClientLogin(uint32_t user_id);
+	// 有pc端在线时为USER_STATUS_ONLINE, 否则为USER_STATUS_OFFLINE(和原来CUserInfo的规则一样)
+	uint32_t GetStatus(uint32_t user_id);
+
+	uint32_t GetUserCount() { return m_user_cnt; }
+	uint64_t GetMemoryUsage();
+private:
+	typedef struct {
+		presence_entry_t*	entry_list;
+		uint32_t			capacity;
+		uint32_t			mask;
+		uint32_t			size;
+	} Shard_t;
+
+	typedef hash_map<uint32_t, presence_item_list_t> OverflowMap_t;
+
+	static uint32_t _Hash(uint32_t user_id) { return user_id * 0x9E3779B1; }
+	Shard_t* _GetShard(uint32_t user_id) { return &m_shards[_Hash(user_id) >> 28]; }
+
+	presence_entry_t* _Find(uint32_t user_id);
+	presence_entry_t* _Insert(uint32_t user_id);
+	void _Erase(Shard_t* pShard, uint32_t slot);
+	void _Resize(Shard_t* pShard, uint32_t capacity);
+	bool _HasClientType(uint32_t user_id, bool bPC);
+	// 把溢出表里的一项挪回内联数组
+	void _RefillInline(presence_entry_t* pEntry);
+	// 去掉server_idx上的所有项, 返回这个用户是否已经没有任何端了
+	bool _RemoveServerItems(presence_entry_t* pEntry, uint32_t server_idx);
+private:
+	Shard_t			m_shards[PRESENCE_SHARD_CNT];
+	OverflowMap_t	m_overflow_map;
+	uint32_t		m_user_cnt;
+};
+
+#endif /* PRESENCETABLE_H_ */
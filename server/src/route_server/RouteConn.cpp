@@ -7,30 +7,55 @@
 
 #include "netlib.h"
 #include "RouteConn.h"
-#include "UserInfo.h"
+#include "PresenceTable.h"
+#include "UserStatCodec.h"
 #include "IM.Buddy.pb.h"
+#include "IM.File.pb.h"
 #include "IM.Group.pb.h"
 #include "IM.Message.pb.h"
 #include "IM.Other.pb.h"
 #include "IM.Server.pb.h"
 #include "IM.SwitchService.pb.h"
 #include "public_define.h"
+#include "Metrics.h"
 using namespace IM::BaseDefine;
 
-//typedef hash_map<uint32_t /* user_id */, UserStat_t> UserStatMap_t;
 static ConnMap_t g_route_conn_map;
-typedef hash_map<uint32_t, CUserInfo*> UserInfoMap_t;
-static UserInfoMap_t g_user_map;
+// 每个msg_server连接占一个槽位, 在线状态表里用槽位号的位图记录用户在哪些msg_server上
+static CRouteConn* g_server_conn_list[PRESENCE_MAX_SERVER];
+static uint64_t g_server_mask = 0;
+static CPresenceTable g_presence_table;
+typedef hash_map<uint32_t, route_group_t*> RouteGroupMap_t;
+static RouteGroupMap_t g_group_map;
+// 还没有上报在线用户列表的msg_server个数, 不为0时在线状态表不完整, 只能广播
+static uint32_t g_unready_conn_cnt = 0;
+static uint64_t g_last_group_check_tick = 0;
+// 能处理批量状态通知的msg_server(上报过user_stat_data或者批量状态更新的), 其余的仍然逐个用户发老的通知
+static uint64_t g_batch_server_mask = 0;
+typedef hash_map<uint32_t, route_status_change_t> StatusChangeMap_t;
+static StatusChangeMap_t g_status_change_map;
+static uint32_t g_status_batch_interval = 0;
+
+static CMetricCounter* g_route_targeted_counter = NULL;
+static CMetricCounter* g_route_broadcast_counter = NULL;
+static CMetricCounter* g_route_send_counter = NULL;
+static CMetricCounter* g_status_change_counter = NULL;
+static CMetricCounter* g_stat_notify_counter = NULL;
+static CMetricCounter* g_login_notify_counter = NULL;
+
+static double get_group_index_size(void* user_data)
+{
+	return (double)g_group_map.size();
+}
 
-CUserInfo* GetUserInfo(uint32_t user_id)
+static double get_online_user_count(void* user_data)
 {
-    CUserInfo* pUser = NULL;
-    UserInfoMap_t::iterator it = g_user_map.find(user_id);
-    if (it != g_user_map.end()) {
-        pUser = it->second;
-    }
-    
-    return pUser;
+	return (double)g_presence_table.GetUserCount();
+}
+
+static double get_presence_memory(void* user_data)
+{
+	return (double)g_presence_table.GetMemoryUsage();
 }
  
 void route_serv_timer_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
@@ -43,16 +68,79 @@ void route_serv_timer_callback(void* callback_data, uint8_t msg, uint32_t handle
 		CRouteConn* pConn = (CRouteConn*)it_old->second;
 		pConn->OnTimer(cur_time);
 	}
+
+	// 清理很久没有同步的群, 同步是跟着群消息来的, 不活跃的群不用一直占着内存
+	if (cur_time > g_last_group_check_tick + ROUTE_GROUP_INDEX_TIMEOUT / 10) {
+		g_last_group_check_tick = cur_time;
+		for (RouteGroupMap_t::iterator it = g_group_map.begin(); it != g_group_map.end(); ) {
+			RouteGroupMap_t::iterator it_old = it;
+			it++;
+
+			if (cur_time > it_old->second->update_tick + ROUTE_GROUP_INDEX_TIMEOUT) {
+				delete it_old->second;
+				g_group_map.erase(it_old);
+			}
+		}
+	}
 }
 
-void init_routeconn_timer_callback()
+// 在更新在线状态表之前调用
+static void record_status_change(uint32_t user_id, uint32_t status)
+{
+	g_status_change_counter->Inc();
+	StatusChangeMap_t::iterator it = g_status_change_map.find(user_id);
+	if (it == g_status_change_map.end()) {
+		route_status_change_t change;
+		change.pc_login = g_presence_table.IsPCClientLogin(user_id);
+		change.client_login = false;
+		it = g_status_change_map.insert(make_pair(user_id, change)).first;
+	}
+
+	if (status != USER_STATUS_OFFLINE) {
+		it->second.client_login = true;
+	}
+}
+
+void status_change_timer_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+	CRouteConn::FlushStatusChange();
+}
+
+void init_routeconn_timer_callback(uint32_t status_batch_interval)
 {
 	netlib_register_timer(route_serv_timer_callback, NULL, 1000);
+
+	g_status_batch_interval = status_batch_interval;
+	if (g_status_batch_interval > 0) {
+		netlib_register_timer(status_change_timer_callback, NULL, g_status_batch_interval);
+	}
+
+	CMetricsRegistry* pRegistry = CMetricsRegistry::getInstance();
+	g_route_targeted_counter = pRegistry->GetCounter("teamtalk_route_msg_total",
+			"messages routed by route_server", metrics_label("mode", "targeted"));
+	g_route_broadcast_counter = pRegistry->GetCounter("teamtalk_route_msg_total",
+			"messages routed by route_server", metrics_label("mode", "broadcast"));
+	g_route_send_counter = pRegistry->GetCounter("teamtalk_route_send_total",
+			"copies of routed messages sent to msg_servers");
+	g_status_change_counter = pRegistry->GetCounter("teamtalk_route_status_change_total",
+			"login/logout events received from msg_servers");
+	g_stat_notify_counter = pRegistry->GetCounter("teamtalk_route_status_notify_total",
+			"user status notifications sent after coalescing", metrics_label("kind", "stat"));
+	g_login_notify_counter = pRegistry->GetCounter("teamtalk_route_status_notify_total",
+			"user status notifications sent after coalescing", metrics_label("kind", "pc_login"));
+	pRegistry->AddCallback(METRIC_TYPE_GAUGE, "teamtalk_route_group_index_size",
+			"groups with a known member list in route_server", "", get_group_index_size, NULL);
+	pRegistry->AddCallback(METRIC_TYPE_GAUGE, "teamtalk_route_online_users",
+			"users online on at least one msg_server", "", get_online_user_count, NULL);
+	pRegistry->AddCallback(METRIC_TYPE_GAUGE, "teamtalk_route_presence_bytes",
+			"memory used by the presence table", "", get_presence_memory, NULL);
 }
 
 CRouteConn::CRouteConn()
 {
 	m_bMaster = false;
+	m_bUserInfoReady = false;
+	m_server_idx = PRESENCE_MAX_SERVER;
 }
 
 CRouteConn::~CRouteConn()
@@ -67,23 +155,19 @@ void CRouteConn::Close()
 		g_route_conn_map.erase(m_handle);
 	}
 
+	if (!m_bUserInfoReady) {
+		m_bUserInfoReady = true;
+		g_unready_conn_cnt--;
+	}
+
 	// remove all user info from this MessageServer
-    
-    UserInfoMap_t::iterator it_old;
-    for (UserInfoMap_t::iterator it = g_user_map.begin(); it != g_user_map.end(); )
-    {
-        it_old = it;
-        it++;
-        
-        CUserInfo* pUser = it_old->second;
-        pUser->RemoveRouteConn(this);
-        if (pUser->GetRouteConnCount() == 0)
-        {
-            delete pUser;
-            pUser = NULL;
-            g_user_map.erase(it_old);
-        }
-    }
+	if (m_server_idx < PRESENCE_MAX_SERVER) {
+		g_presence_table.RemoveServer(m_server_idx);
+		g_server_conn_list[m_server_idx] = NULL;
+		g_server_mask &= ~((uint64_t)1 << m_server_idx);
+		g_batch_server_mask &= ~((uint64_t)1 << m_server_idx);
+		m_server_idx = PRESENCE_MAX_SERVER;
+	}
 
 	ReleaseRef();
 }
@@ -91,11 +175,23 @@ void CRouteConn::Close()
 void CRouteConn::OnConnect(net_handle_t handle)
 {
 	m_handle = handle;
+	g_unready_conn_cnt++;
 
 	g_route_conn_map.insert(make_pair(handle, this));
 
 	netlib_option(handle, NETLIB_OPT_SET_CALLBACK, (void*)imconn_callback);
 	netlib_option(handle, NETLIB_OPT_SET_CALLBACK_DATA, (void*)&g_route_conn_map);
+
+	if (g_server_mask == (uint64_t)-1) {
+		log("too many msg servers, max=%d, close handle=%d ", PRESENCE_MAX_SERVER, handle);
+		Close();
+		return;
+	}
+
+	m_server_idx = __builtin_ctzll(~g_server_mask);
+	g_server_mask |= (uint64_t)1 << m_server_idx;
+	g_server_conn_list[m_server_idx] = this;
+	log("MsgServer connected, handle=%d, server_idx=%u ", handle, m_server_idx);
 }
 
 void CRouteConn::OnClose()
@@ -138,6 +234,10 @@ void CRouteConn::HandlePdu(CImPdu* pPdu)
             //route_server的处理也就是更新下记录的该msg_server上的用户数量和用户id。
             _HandleUserStatusUpdate( pPdu );
             break;
+        case CID_OTHER_USER_STATUS_BATCH:
+            //新的msg_server把一个窗口内的上下线合并成一个包, 每项是一个端的净变化
+            _HandleUserStatusBatch( pPdu );
+            break;
         case CID_OTHER_ROLE_SET:
             _HandleRoleSet( pPdu );
             break;
@@ -151,9 +251,9 @@ void CRouteConn::HandlePdu(CImPdu* pPdu)
         case CID_GROUP_CHANGE_MEMBER_NOTIFY:
         case CID_FILE_NOTIFY:
         case CID_BUDDY_LIST_REMOVE_SESSION_NOTIFY:
-            //这几个消息都是往外广播消息，由于msg_server 可以配置多个，A给B发了一条消息，
-            //必须广播在各个msg_server 才能知道B到底在哪个msg_server上
-            _BroadcastMsg(pPdu, this);
+            //这几个消息以前都广播给所有msg_server, 由各个msg_server自己判断B在不在本机;
+            //在线状态表里已经记录了每个用户登录在哪些msg_server上, 只转发给这些msg_server
+            _RouteMsg(pPdu);
             break;
         case CID_BUDDY_LIST_SIGN_INFO_CHANGED_NOTIFY:
             _BroadcastMsg(pPdu);
@@ -170,13 +270,36 @@ void CRouteConn::_HandleOnlineUserInfo(CImPdu* pPdu)
     IM::Server::IMOnlineUserInfo msg;
     CHECK_PB_PARSE_MSG(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()));
 
-	uint32_t user_count = msg.user_stat_list_size();
+	uint64_t start_tick = get_tick_count();
+	if (msg.has_user_stat_data()) {
+		// 新的msg_server发的是差分编码的全量列表, 也能处理批量的状态通知
+		g_batch_server_mask |= (uint64_t)1 << m_server_idx;
+		vector<user_stat_t> user_list;
+		if (!decode_user_stat_list(msg.user_stat_data(), user_list)) {
+			log("HandleOnlineUserInfo, bad user_stat_data, len=%u, decoded=%u ",
+					(uint32_t)msg.user_stat_data().size(), (uint32_t)user_list.size());
+		}
 
-	log("HandleOnlineUserInfo, user_cnt=%u ", user_count);
+		g_presence_table.Reserve(user_list.size());
+		for (vector<user_stat_t>::iterator it = user_list.begin(); it != user_list.end(); it++) {
+			_UpdateUserStatus(it->user_id, it->status, it->client_type);
+		}
+		log("HandleOnlineUserInfo, server_idx=%u, user_cnt=%u, data_len=%u, cost=%llums ", m_server_idx,
+				(uint32_t)user_list.size(), (uint32_t)msg.user_stat_data().size(), get_tick_count() - start_tick);
+	} else {
+		uint32_t user_count = msg.user_stat_list_size();
+		g_presence_table.Reserve(user_count);
+		for (uint32_t i = 0; i < user_count; i++) {
+			const IM::BaseDefine::ServerUserStat& server_user_stat = msg.user_stat_list(i);
+			_UpdateUserStatus(server_user_stat.user_id(), server_user_stat.status(), server_user_stat.client_type());
+		}
+		log("HandleOnlineUserInfo, server_idx=%u, user_cnt=%u, cost=%llums ", m_server_idx, user_count,
+				get_tick_count() - start_tick);
+	}
 
-	for (uint32_t i = 0; i < user_count; i++) {
-        IM::BaseDefine::ServerUserStat server_user_stat = msg.user_stat_list(i);
-		_UpdateUserStatus(server_user_stat.user_id(), server_user_stat.status(), server_user_stat.client_type());
+	if (!m_bUserInfoReady) {
+		m_bUserInfoReady = true;
+		g_unready_conn_cnt--;
 	}
 }
 
@@ -190,76 +313,118 @@ void CRouteConn::_HandleUserStatusUpdate(CImPdu* pPdu)
     uint32_t client_type = msg.client_type();
 	log("HandleUserStatusUpdate, status=%u, uid=%u, client_type=%u ", user_status, user_id, client_type);
 
+	record_status_change(user_id, user_status);
 	_UpdateUserStatus(user_id, user_status, client_type);
-    
-    //用于通知客户端,同一用户在pc端的登录情况
-    CUserInfo* pUser = GetUserInfo(user_id);
-    if (pUser)
-    {
-        IM::Server::IMServerPCLoginStatusNotify msg2;
-        msg2.set_user_id(user_id);
-        if (user_status == IM::BaseDefine::USER_STATUS_OFFLINE)
-        {
-            msg2.set_login_status(IM_PC_LOGIN_STATUS_OFF);
-        }
-        else
-        {
-            msg2.set_login_status(IM_PC_LOGIN_STATUS_ON);
-        }
-        CImPdu pdu;
-        pdu.SetPBMsg(&msg2);
-        pdu.SetServiceId(SID_OTHER);
-        pdu.SetCommandId(CID_OTHER_LOGIN_STATUS_NOTIFY);
-        
-        if (user_status == USER_STATUS_OFFLINE)
-        {
-            //pc端下线且无pc端存在，则给msg_server发送一个通知
-            if (CHECK_CLIENT_TYPE_PC(client_type) && !pUser->IsPCClientLogin())
-            {
-                _BroadcastMsg(&pdu);
-            }
-        }
-        else
-        {
-            //只要pc端在线，则不管上线的是pc还是移动端，都通知msg_server
-            if (pUser->IsPCClientLogin())
-            {
-                _BroadcastMsg(&pdu);
-            }
-        }
-    }
-    
-    //状态更新的是pc client端，则通知给所有其他人
-    if (CHECK_CLIENT_TYPE_PC(client_type))
-    {
-        IM::Buddy::IMUserStatNotify msg3;
-        IM::BaseDefine::UserStat* user_stat = msg3.mutable_user_stat();
-        user_stat->set_user_id(user_id);
-        user_stat->set_status((IM::BaseDefine::UserStatType)user_status);
-        CImPdu pdu2;
-        pdu2.SetPBMsg(&msg3);
-        pdu2.SetServiceId(SID_BUDDY_LIST);
-        pdu2.SetCommandId(CID_BUDDY_LIST_STATUS_NOTIFY);
-        
-        //用户存在
-        if (pUser)
-        {
-            //如果是pc客户端离线，但是仍然存在pc客户端，则不发送离线通知
-            //此种情况一般是pc客户端多点登录时引起
-            if (USER_STATUS_OFFLINE == user_status && pUser->IsPCClientLogin())
-            {
-                return;
-            }
-            else
-            {
-                _BroadcastMsg(&pdu2);
-            }
-        }
-        else//该用户不存在了，则表示是离线状态
-        {
-            _BroadcastMsg(&pdu2);
-        }
-    }
+	if (g_status_batch_interval == 0) {
+		FlushStatusChange();
+	}
+}
+
+void CRouteConn::_HandleUserStatusBatch(CImPdu* pPdu)
+{
+    IM::Server::IMOnlineUserInfo msg;
+    CHECK_PB_PARSE_MSG(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()));
+
+	g_batch_server_mask |= (uint64_t)1 << m_server_idx;
+
+	vector<user_stat_t> user_list;
+	if (!decode_user_stat_list(msg.user_stat_data(), user_list)) {
+		log("HandleUserStatusBatch, bad user_stat_data, len=%u, decoded=%u ",
+				(uint32_t)msg.user_stat_data().size(), (uint32_t)user_list.size());
+	}
+	log("HandleUserStatusBatch, server_idx=%u, cnt=%u ", m_server_idx, (uint32_t)user_list.size());
+
+	for (vector<user_stat_t>::iterator it = user_list.begin(); it != user_list.end(); it++) {
+		record_status_change(it->user_id, it->status);
+		_UpdateUserStatus(it->user_id, it->status, it->client_type);
+	}
+	if (g_status_batch_interval == 0) {
+		FlushStatusChange();
+	}
+}
+
+void CRouteConn::FlushStatusChange()
+{
+	if (g_status_change_map.empty()) {
+		return;
+	}
+
+	vector<user_stat_t> stat_list;
+	vector<user_stat_t> login_list;
+	for (StatusChangeMap_t::iterator it = g_status_change_map.begin(); it != g_status_change_map.end(); it++) {
+		uint32_t user_id = it->first;
+		route_status_change_t& change = it->second;
+		bool bPCLogin = g_presence_table.IsPCClientLogin(user_id);
+
+		user_stat_t stat;
+		stat.user_id = user_id;
+		stat.client_type = 0;
+		stat.status = bPCLogin ? USER_STATUS_ONLINE : USER_STATUS_OFFLINE;
+
+		//好友看到的状态只跟pc端有关, 窗口内pc端上线又下线(或者多点登录的pc端下线一个)不通知
+		if (bPCLogin != change.pc_login) {
+			stat_list.push_back(stat);
+		}
+
+		//用于通知客户端,同一用户在pc端的登录情况:
+		//pc端在线时有端上线(新上线的端要知道pc端在线), 或者pc端全部下线了, 且该用户还有端在线
+		if (g_presence_table.IsOnline(user_id) && ((bPCLogin && change.client_login) || (!bPCLogin && change.pc_login))) {
+			login_list.push_back(stat);
+		}
+	}
+	log("FlushStatusChange, user_cnt=%u, stat_notify=%u, login_notify=%u ", (uint32_t)g_status_change_map.size(),
+			(uint32_t)stat_list.size(), (uint32_t)login_list.size());
+	g_status_change_map.clear();
+
+	g_stat_notify_counter->Inc(stat_list.size());
+	g_login_notify_counter->Inc(login_list.size());
+	_SendStatusNotify(stat_list, CID_OTHER_USER_STAT_NOTIFY_BATCH);
+	_SendStatusNotify(login_list, CID_OTHER_LOGIN_STATUS_NOTIFY_BATCH);
+}
+
+void CRouteConn::_SendStatusNotify(vector<user_stat_t>& user_list, uint32_t cmd_id)
+{
+	if (user_list.empty()) {
+		return;
+	}
+
+	uint64_t batch_mask = g_server_mask & g_batch_server_mask;
+	if (batch_mask) {
+		IM::Server::IMOnlineUserInfo msg;
+		encode_user_stat_list(user_list, *msg.mutable_user_stat_data());
+		CImPdu pdu;
+		pdu.SetPBMsg(&msg);
+		pdu.SetServiceId(SID_OTHER);
+		pdu.SetCommandId(cmd_id);
+		_SendToServers(&pdu, batch_mask);
+	}
+
+	//还没有升级的msg_server, 逐个用户发原来的通知
+	uint64_t legacy_mask = g_server_mask & ~g_batch_server_mask;
+	if (legacy_mask == 0) {
+		return;
+	}
+
+	for (vector<user_stat_t>::iterator it = user_list.begin(); it != user_list.end(); it++) {
+		CImPdu pdu;
+		if (cmd_id == CID_OTHER_USER_STAT_NOTIFY_BATCH) {
+			IM::Buddy::IMUserStatNotify msg;
+			IM::BaseDefine::UserStat* user_stat = msg.mutable_user_stat();
+			user_stat->set_user_id(it->user_id);
+			user_stat->set_status((IM::BaseDefine::UserStatType)it->status);
+			pdu.SetPBMsg(&msg);
+			pdu.SetServiceId(SID_BUDDY_LIST);
+			pdu.SetCommandId(CID_BUDDY_LIST_STATUS_NOTIFY);
+		} else {
+			IM::Server::IMServerPCLoginStatusNotify msg;
+			msg.set_user_id(it->user_id);
+			msg.set_login_status((it->status == USER_STATUS_ONLINE) ? IM_PC_LOGIN_STATUS_ON : IM_PC_LOGIN_STATUS_OFF);
+			pdu.SetPBMsg(&msg);
+			pdu.SetServiceId(SID_OTHER);
+			pdu.SetCommandId(CID_OTHER_LOGIN_STATUS_NOTIFY);
+		}
+		_SendToServers(&pdu, legacy_mask);
+	}
 }
 
 void CRouteConn::_HandleRoleSet(CImPdu* pPdu)
@@ -296,14 +461,7 @@ void CRouteConn::_HandleUsersStatusRequest(CImPdu* pPdu)
         IM::BaseDefine::UserStat* user_stat = msg2.add_user_stat_list();
         uint32_t user_id = msg.user_id_list(i);
         user_stat->set_user_id(user_id);
-        CUserInfo* pUser = GetUserInfo(user_id);
-        if (pUser) {
-            user_stat->set_status((::IM::BaseDefine::UserStatType) pUser->GetStatus()) ;
-        }
-		else
-		{
-            user_stat->set_status(USER_STATUS_OFFLINE) ;
-		}
+        user_stat->set_status((::IM::BaseDefine::UserStatType) g_presence_table.GetStatus(user_id));
 	}
 
 	// send back query user status
@@ -316,84 +474,199 @@ void CRouteConn::_HandleUsersStatusRequest(CImPdu* pPdu)
 }
 
 /*
- * update user status info, the logic seems complex
+ * update user status info
+ * 按(msg_server, client_type)记个数, 某个msg_server上这个用户的端都下线了, 才从它的位图里去掉这个msg_server
  */
 void CRouteConn::_UpdateUserStatus(uint32_t user_id, uint32_t status, uint32_t client_type)
 {
-    CUserInfo* pUser = GetUserInfo(user_id);
-    if (pUser) {
-        if (pUser->FindRouteConn(this))
+    if (status == USER_STATUS_OFFLINE) {
+        g_presence_table.RemoveClient(user_id, m_server_idx, client_type);
+    } else {
+        g_presence_table.AddClient(user_id, m_server_idx, client_type);
+    }
+}
+
+void CRouteConn::_BroadcastMsg(CImPdu* pPdu, CRouteConn* pFromConn)
+{
+	CSharedBuffer* pBuf = new CSharedBuffer(pPdu->GetBuffer(), pPdu->GetLength());
+	ConnMap_t::iterator it;
+	for (it = g_route_conn_map.begin(); it != g_route_conn_map.end(); it++) {
+		CRouteConn* pRouteConn = (CRouteConn*)it->second;
+		if (pRouteConn != pFromConn) {
+			pRouteConn->SendBuffer(pBuf);
+		}
+	}
+	pBuf->ReleaseRef();
+}
+
+void CRouteConn::_RouteMsg(CImPdu* pPdu)
+{
+	uint64_t server_mask = 0;
+	bool bKnown = true;
+	switch (pPdu->GetCommandId()) {
+        case CID_MSG_DATA:
         {
-            if (status == USER_STATUS_OFFLINE)
-            {
-                pUser->RemoveClientType(client_type);
-                if (pUser->IsMsgConnNULL())
-                {
-                    pUser->RemoveRouteConn(this);
-                    if (pUser->GetRouteConnCount() == 0) {
-                        delete pUser;
-                        pUser = NULL;
-                        g_user_map.erase(user_id);
-                    }
-                }
-            }
-            else
-            {
-                pUser->AddClientType(client_type);
+            IM::Message::IMMsgData msg;
+            CHECK_PB_PARSE_MSG(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()));
+            if (CHECK_MSG_TYPE_GROUP(msg.msg_type())) {
+                bKnown = _RouteGroupMsg(msg.to_session_id(), server_mask);
+            } else {
+                // 接收者的所有端, 以及发送者登录在其他msg_server上的端(多端同步)
+                server_mask |= g_presence_table.GetServerMask(msg.from_user_id());
+                server_mask |= g_presence_table.GetServerMask(msg.to_session_id());
             }
+            break;
         }
-        else
+        case CID_SWITCH_P2P_CMD:
         {
-            if (status != USER_STATUS_OFFLINE)
-            {
-                pUser->AddRouteConn(this);
-                pUser->AddClientType(client_type);
-            }
+            IM::SwitchService::IMP2PCmdMsg msg;
+            CHECK_PB_PARSE_MSG(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()));
+            server_mask |= g_presence_table.GetServerMask(msg.from_user_id());
+            server_mask |= g_presence_table.GetServerMask(msg.to_user_id());
+            break;
         }
-    }
-    else
-    {
-        if (status != USER_STATUS_OFFLINE) {
-            CUserInfo* pUserInfo = new CUserInfo();
-            if (pUserInfo != NULL) {
-                pUserInfo->AddRouteConn(this);
-                pUserInfo->AddClientType(client_type);
-                g_user_map.insert(make_pair(user_id, pUserInfo));
+        case CID_MSG_READ_NOTIFY:
+        {
+            // 已读通知只发给发出者自己的其他端
+            IM::Message::IMMsgDataReadNotify msg;
+            CHECK_PB_PARSE_MSG(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()));
+            server_mask |= g_presence_table.GetServerMask(msg.user_id());
+            break;
+        }
+        case CID_OTHER_SERVER_KICK_USER:
+            // 踢人是在新端登录时发的, 这时另一台msg_server上刚登录的端可能还在状态合并窗口里,
+            // 在线状态表里还查不到; 踢人不频繁, 直接广播
+            bKnown = false;
+            break;
+        case CID_BUDDY_LIST_REMOVE_SESSION_NOTIFY:
+        {
+            IM::Buddy::IMRemoveSessionNotify msg;
+            CHECK_PB_PARSE_MSG(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()));
+            server_mask |= g_presence_table.GetServerMask(msg.user_id());
+            break;
+        }
+        case CID_FILE_NOTIFY:
+        {
+            IM::File::IMFileNotify msg;
+            CHECK_PB_PARSE_MSG(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()));
+            server_mask |= g_presence_table.GetServerMask(msg.to_user_id());
+            break;
+        }
+        case CID_GROUP_CHANGE_MEMBER_NOTIFY:
+        {
+            IM::Group::IMGroupChangeMemberNotify msg;
+            CHECK_PB_PARSE_MSG(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()));
+            _UpdateGroupIndex(msg);
+            if (msg.chg_user_id_list_size() == 0) {
+                // msg_server同步过来的群成员列表, 只更新索引, 不往外转发
+                return;
+            }
+
+            for (int i = 0; i < msg.chg_user_id_list_size(); i++) {
+                server_mask |= g_presence_table.GetServerMask(msg.chg_user_id_list(i));
             }
-            else
-            {
-                log("new UserInfo failed. ");
+            for (int i = 0; i < msg.cur_user_id_list_size(); i++) {
+                server_mask |= g_presence_table.GetServerMask(msg.cur_user_id_list(i));
             }
+            break;
         }
-    }
+        default:
+            bKnown = false;
+            break;
+	}
+
+	if (!bKnown || g_unready_conn_cnt > 0) {
+		g_route_broadcast_counter->Inc();
+		g_route_send_counter->Inc(g_route_conn_map.size() - 1);
+		_BroadcastMsg(pPdu, this);
+		return;
+	}
+
+	// 发出消息的msg_server自己已经投递给了本机上的用户
+	if (m_server_idx < PRESENCE_MAX_SERVER) {
+		server_mask &= ~((uint64_t)1 << m_server_idx);
+	}
+	g_route_targeted_counter->Inc();
+	_SendToServers(pPdu, server_mask);
 }
 
-void CRouteConn::_BroadcastMsg(CImPdu* pPdu, CRouteConn* pFromConn)
+bool CRouteConn::_RouteGroupMsg(uint32_t group_id, uint64_t& server_mask)
 {
-	ConnMap_t::iterator it;
-	for (it = g_route_conn_map.begin(); it != g_route_conn_map.end(); it++) {
-		CRouteConn* pRouteConn = (CRouteConn*)it->second;
-		if (pRouteConn != pFromConn) {
-			pRouteConn->SendPdu(pPdu);
+	RouteGroupMap_t::iterator it = g_group_map.find(group_id);
+	if (it == g_group_map.end()) {
+		return false;
+	}
+
+	route_group_t* pGroup = it->second;
+	if (get_tick_count() > pGroup->update_tick + ROUTE_GROUP_INDEX_TIMEOUT) {
+		delete pGroup;
+		g_group_map.erase(it);
+		return false;
+	}
+
+	for (route_member_t::iterator it_member = pGroup->member_set.begin(); it_member != pGroup->member_set.end();
+			it_member++) {
+		server_mask |= g_presence_table.GetServerMask(*it_member);
+		if (server_mask == g_server_mask) {
+			// 已经覆盖了所有的msg_server, 剩下的成员不用再查
+			break;
 		}
 	}
+	return true;
+}
+
+void CRouteConn::_UpdateGroupIndex(const IM::Group::IMGroupChangeMemberNotify& msg)
+{
+	uint32_t group_id = msg.group_id();
+	route_group_t* pGroup = NULL;
+	RouteGroupMap_t::iterator it = g_group_map.find(group_id);
+	if (it != g_group_map.end()) {
+		pGroup = it->second;
+	}
+
+	if (msg.cur_user_id_list_size() == 0) {
+		// 没带当前成员列表, 下一条群消息先广播, 等msg_server重新同步
+		if (pGroup) {
+			delete pGroup;
+			g_group_map.erase(it);
+		}
+		return;
+	}
+
+	if (!pGroup) {
+		pGroup = new route_group_t;
+		g_group_map.insert(make_pair(group_id, pGroup));
+	}
+
+	pGroup->update_tick = get_tick_count();
+	pGroup->member_set.clear();
+	for (int i = 0; i < msg.cur_user_id_list_size(); i++) {
+		pGroup->member_set.insert(msg.cur_user_id_list(i));
+	}
 }
 
+void CRouteConn::_SendToServers(CImPdu* pPdu, uint64_t server_mask)
+{
+	server_mask &= g_server_mask;
+	if (server_mask == 0) {
+		return;
+	}
+
+	g_route_send_counter->Inc(__builtin_popcountll(server_mask));
+	CSharedBuffer* pBuf = new CSharedBuffer(pPdu->GetBuffer(), pPdu->GetLength());
+	while (server_mask) {
+		uint32_t server_idx = __builtin_ctzll(server_mask);
+		server_mask &= server_mask - 1;
+		g_server_conn_list[server_idx]->SendBuffer(pBuf);
+	}
+	pBuf->ReleaseRef();
+}
 
 void CRouteConn::_SendPduToUser(uint32_t user_id, CImPdu* pPdu, bool bAll)
 {
-    CUserInfo* pUser = GetUserInfo(user_id);
-    if (pUser)
-    {
-        set<CRouteConn*>* pUserSet = pUser->GetRouteConn();
-        for (set<CRouteConn*>::iterator it = pUserSet->begin(); it != pUserSet->end(); it++)
-        {
-            CRouteConn* pToConn = *it;
-            if (bAll || pToConn != this)
-            {
-                pToConn->Send(pPdu->GetBuffer(), pPdu->GetLength());
-            }
-        }
+    uint64_t server_mask = g_presence_table.GetServerMask(user_id);
+    if (!bAll && m_server_idx < PRESENCE_MAX_SERVER) {
+        server_mask &= ~((uint64_t)1 << m_server_idx);
     }
+    _SendToServers(pPdu, server_mask);
 }
-
@@ -8,7 +8,27 @@
 #ifndef ROUTECONN_H_
 #define ROUTECONN_H_
 
+#include <set>
 #include "imconn.h"
+#include "public_define.h"
+#include "IM.Group.pb.h"
+
+// 群成员索引(group_id -> 成员), 由msg_server在刷新群成员缓存和修改成员时同步过来,
+// 超过这个时间没有同步就不再使用, 群消息退回到广播给所有msg_server
+#define ROUTE_GROUP_INDEX_TIMEOUT	300000
+
+typedef set<uint32_t> route_member_t;
+
+typedef struct {
+	uint64_t		update_tick;
+	route_member_t	member_set;
+} route_group_t;
+
+// 合并窗口内状态有变化的用户, 记下窗口开始前的状态, 窗口结束时和当前状态比较, 只通知净变化
+typedef struct {
+	bool			pc_login;		// 窗口开始前有pc端在线
+	bool			client_login;	// 窗口内有端上线过
+} route_status_change_t;
 
 class CRouteConn : public CImConn
 {
@@ -24,9 +44,13 @@ public:
 
 	virtual void HandlePdu(CImPdu* pPdu);
 
+	// 把窗口内的状态变化合并成批量通知发给所有msg_server
+	static void FlushStatusChange();
+
 private:
 	void _HandleOnlineUserInfo(CImPdu* pPdu);
 	void _HandleUserStatusUpdate(CImPdu* pPdu);
+	void _HandleUserStatusBatch(CImPdu* pPdu);
 	void _HandleRoleSet(CImPdu* pPdu);
 	void _HandleUsersStatusRequest(CImPdu* pPdu);
     void _HandleMsgReadNotify(CImPdu* pPdu);
@@ -35,6 +59,14 @@ private:
 	void _DispatchFriend(uint32_t friend_cnt, uint32_t* friend_id_list);
 
 	void _BroadcastMsg(CImPdu* pPdu, CRouteConn* pFromConn = NULL);
+
+	// 只转发给接收者所在的msg_server, 不知道接收者在哪里时退回到_BroadcastMsg
+	void _RouteMsg(CImPdu* pPdu);
+	bool _RouteGroupMsg(uint32_t group_id, uint64_t& server_mask);
+	void _UpdateGroupIndex(const IM::Group::IMGroupChangeMemberNotify& msg);
+	// server_mask是msg_server槽位号的位图
+	static void _SendToServers(CImPdu* pPdu, uint64_t server_mask);
+	static void _SendStatusNotify(vector<user_stat_t>& user_list, uint32_t cmd_id);
     
 private:
     void _UpdateUserStatus(uint32_t user_id, uint32_t status, uint32_t client_type);
@@ -42,8 +74,11 @@ private:
     
 private:
 	bool			m_bMaster;
+	bool			m_bUserInfoReady;	// 已经收到这个msg_server的在线用户列表
+	uint32_t		m_server_idx;		// 在在线状态表位图里的槽位号
 };
 
-void init_routeconn_timer_callback();
+// status_batch_interval: 状态通知的合并窗口(毫秒), 0表示每收到一个状态更新就通知
+void init_routeconn_timer_callback(uint32_t status_batch_interval);
 
 #endif /* ROUTECONN_H_ */
@@ -9,6 +9,9 @@
 #include "netlib.h"
 #include "ConfigFileReader.h"
 #include "version.h"
+#include "MetricsServer.h"
+
+#define DEFAULT_STATUS_BATCH_INTERVAL	50	// 毫秒, msg_server那边已经合并过一次, 这里主要合并跨msg_server的变化
 
 // this callback will be replaced by imconn_callback() in OnConnect()
 void route_serv_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
@@ -54,14 +57,24 @@ int main(int argc, char* argv[])
 
 	CStrExplode listen_ip_list(listen_ip, ';');
 	for (uint32_t i = 0; i < listen_ip_list.GetItemCnt(); i++) {
-		ret =   (listen_ip_list.GetItem(i), listen_msg_port, route_serv_callback, NULL);
+		ret = netlib_listen(listen_ip_list.GetItem(i), listen_msg_port, route_serv_callback, NULL);
 		if (ret == NETLIB_ERROR)
 			return ret;
 	}
 
 	printf("server start listen on: %s:%d\n", listen_ip,  listen_msg_port);
 
-	init_routeconn_timer_callback();
+	// 用户上下线的通知在这个窗口里合并, 同一个用户只通知最后的状态, 0表示每收到一个状态更新就通知
+	uint32_t status_batch_interval = DEFAULT_STATUS_BATCH_INTERVAL;
+	char* str_status_batch_interval = config_file.GetConfigName("StatusBatchInterval");
+	if (str_status_batch_interval) {
+		status_batch_interval = atoi(str_status_batch_interval);
+	}
+	init_routeconn_timer_callback(status_batch_interval);
+
+	// 本地端口上的/metrics, 配置了MetricsPort才监听
+	if (metrics_server_init(&config_file) == -1)
+		return -1;
 
 	printf("now enter the event loop...\n");
 
@@ -13,6 +13,7 @@
 #include "Common.h"
 #include "json/json.h"
 #include "ClientConn.h"
+#include "playsound.h"
 
 
 static ClientConn*  g_pConn = NULL;
@@ -87,7 +88,7 @@ void CClient::connect()
         return;
     }
     
-    g_pConn = new ClientConn();
+    g_pConn = new ClientConn(this);
     m_nHandle = g_pConn->connect(strPriorIp.c_str(), nPort, m_strName, m_strPass);
     if(m_nHandle != INVALID_SOCKET)
     {
@@ -237,5 +238,5 @@ void CClient::onGetMsgList(uint32_t nSeqNo, uint32_t nUserId, uint32_t nPeerId,
 
 void CClient::onRecvMsg(uint32_t nSeqNo, uint32_t nFromId, uint32_t nToId, uint32_t nMsgId, uint32_t nCreateTime, IM::BaseDefine::MsgType nMsgType, const string &strMsgData)
 {
-    
+    play("message.wav");
 }
@@ -9,12 +9,13 @@
  *
  ================================================================*/
 #include "ClientConn.h"
-#include "playsound.h"
 #include "Common.h"
 
+static ConnMap_t g_client_conn_map;
 
-ClientConn::ClientConn():
-m_bOpen(false)
+ClientConn::ClientConn(IPacketCallback* pCallback):
+m_bOpen(false),
+m_pCallback(pCallback)
 {
     m_pSeqAlloctor = CSeqAlloctor::getInstance();
 }
@@ -26,7 +27,10 @@ ClientConn::~ClientConn()
 
 net_handle_t ClientConn::connect(const string& strIp, uint16_t nPort, const string& strName, const string& strPass)
 {
-	m_handle = netlib_connect(strIp.c_str(), nPort, imconn_callback, NULL);
+	m_handle = netlib_connect(strIp.c_str(), nPort, imconn_callback, (void*)&g_client_conn_map);
+    if (m_handle != NETLIB_INVALID_HANDLE) {
+        imconn_map_add(&g_client_conn_map, m_handle, this);
+    }
     return  m_handle;
 }
 
@@ -43,6 +47,10 @@ void ClientConn::OnConfirm()
 void ClientConn::OnClose()
 {
     log("onclose from handle=%d\n", m_handle);
+    if(m_pCallback)
+    {
+        m_pCallback->onClose();
+    }
     Close();
 }
 
@@ -202,9 +210,14 @@ uint32_t ClientConn::sendMsgAck(uint32_t nUserId, uint32_t nPeerId, IM::BaseDefi
 
 void ClientConn::Close()
 {
-	if (m_handle != NETLIB_INVALID_HANDLE) {
-		netlib_close(m_handle);
+	// 主动关闭和对端关闭都会走到这里, 只释放一次
+	if (m_handle == NETLIB_INVALID_HANDLE) {
+		return;
 	}
+	netlib_close(m_handle);
+	imconn_map_del(&g_client_conn_map, m_handle);
+	m_handle = NETLIB_INVALID_HANDLE;
+	m_bOpen = false;
 	ReleaseRef();
 }
 
@@ -403,8 +416,6 @@ void ClientConn::_HandleMsgData(CImPdu* pPdu)
     uint32_t nSeqNo = pPdu->GetSeqNum();
     if(msg.ParseFromArray(pPdu->GetBodyData(), pPdu->GetBodyLength()))
     {
-        play("message.wav");
-        
         uint32_t nFromId = msg.from_user_id();
         uint32_t nToId = msg.to_session_id();
         uint32_t nMsgId = msg.msg_id();
@@ -26,14 +26,17 @@
 class ClientConn : public CImConn
 {
 public:
-	ClientConn();
+	ClientConn(IPacketCallback* pCallback = NULL);
 	virtual ~ClientConn();
 
 	bool IsOpen() { return m_bOpen; }
+	net_handle_t GetHandle() { return m_handle; }
 
     net_handle_t connect(const string& strIp, uint16_t nPort, const string& strName, const string& strPass);
     
     virtual void Close();
+
+    void setCallback(IPacketCallback* pCallback) { m_pCallback = pCallback; }
 public:
     uint32_t login(const string& strName, const string& strPass);
     uint32_t getUser(uint32_t nUserId, uint32_t nTime =0);
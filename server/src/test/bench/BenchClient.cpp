@@ -0,0 +1,269 @@
+/*================================================================
+*   文件名称：BenchClient.cpp
+*   描    述：
+*
+================================================================*/
+#include <time.h>
+#include "BenchClient.h"
+#include "BenchRunner.h"
+#include "ClientConn.h"
+
+uint64_t bench_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+CBenchClient::CBenchClient(CBenchRunner* pRunner, uint32_t nIndex, const string& strName, const string& strPass):
+m_pRunner(pRunner),
+m_nIndex(nIndex),
+m_strName(strName),
+m_strPass(strPass),
+m_nUserId(0),
+m_nState(BENCH_STATE_IDLE),
+m_nConnectUs(0),
+m_nPort(0),
+m_nReactor(-1),
+m_pConn(NULL)
+{
+}
+
+CBenchClient::~CBenchClient()
+{
+    close();
+}
+
+typedef struct
+{
+    CBenchClient*   pClient;
+    ClientConn*     pConn;
+} BenchConnectTask_t;
+
+bool CBenchClient::connect(const string& strIp, uint16_t nPort, uint32_t nReactor)
+{
+    m_nState = BENCH_STATE_CONNECTING;
+    m_nConnectUs = bench_now_us();
+    m_strIp = strIp;
+    m_nPort = nPort;
+    m_pConn = new ClientConn(this);
+    if(nReactor != 0)
+    {
+        // netlib_connect把socket放在调用线程的reactor上, 所以到目标reactor的线程里去连接;
+        // 任务返回之前这个reactor不会处理连接事件, ClientConn已经在连接表里了
+        BenchConnectTask_t* pTask = new BenchConnectTask_t;
+        pTask->pClient = this;
+        pTask->pConn = m_pConn;
+        m_pConn->AddRef();
+        netlib_post_task(nReactor, _ConnectTask, pTask);
+        return true;
+    }
+    
+    if(m_pConn->connect(strIp, nPort, m_strName, m_strPass) == NETLIB_INVALID_HANDLE)
+    {
+        m_pConn->ReleaseRef();
+        m_pConn = NULL;
+        m_nState = BENCH_STATE_FAILED;
+        return false;
+    }
+    return true;
+}
+
+// 在目标reactor里执行, 只读connect()里设置好的字段
+void CBenchClient::_ConnectTask(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+    BenchConnectTask_t* pTask = (BenchConnectTask_t*)callback_data;
+    CBenchClient* pClient = pTask->pClient;
+    if(pTask->pConn->connect(pClient->m_strIp, pClient->m_nPort, pClient->m_strName, pClient->m_strPass) == NETLIB_INVALID_HANDLE)
+    {
+        // 失败要回到主reactor里统计
+        netlib_post_task(0, _ConnectFailTask, pTask);
+        return;
+    }
+    pTask->pConn->ReleaseRef();
+    delete pTask;
+}
+
+void CBenchClient::_ConnectFailTask(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+    BenchConnectTask_t* pTask = (BenchConnectTask_t*)callback_data;
+    CBenchClient* pClient = pTask->pClient;
+    if(pClient->m_pConn == pTask->pConn)
+    {
+        pClient->m_pConn->ReleaseRef();
+        pClient->m_pConn = NULL;
+        pClient->m_nState = BENCH_STATE_FAILED;
+        pClient->m_pRunner->onLogin(pClient, false, 0);
+    }
+    pTask->pConn->ReleaseRef();
+    delete pTask;
+}
+
+void CBenchClient::close()
+{
+    if(m_pConn)
+    {
+        // Close()会释放连接, 先断开回调
+        ClientConn* pConn = m_pConn;
+        m_pConn = NULL;
+        pConn->setCallback(NULL);
+        pConn->Close();
+    }
+}
+
+void CBenchClient::onTimer(uint64_t nCurTick)
+{
+    if(m_pConn && isOnline())
+    {
+        m_pConn->OnTimer(nCurTick);
+    }
+}
+
+void CBenchClient::sendMsg(uint32_t nToId, IM::BaseDefine::MsgType nType, uint32_t nPayloadSize)
+{
+    if(!isOnline())
+        return;
+    
+    // 消息体里带上发送时间, 接收方据此计算端到端延迟; 压测进程里所有用户共用一个时钟
+    uint64_t nNowUs = bench_now_us();
+    char szHead[64];
+    snprintf(szHead, sizeof(szHead), BENCH_MSG_PREFIX "%llu:", (unsigned long long)nNowUs);
+    string strMsg = szHead;
+    if(strMsg.size() < nPayloadSize)
+    {
+        strMsg.append(nPayloadSize - strMsg.size(), 'x');
+    }
+    
+    uint32_t nSeqNo = m_pConn->sendMessage(m_nUserId, nToId, nType, strMsg);
+    BenchReq_t req = { BENCH_REQ_MSG, nNowUs };
+    m_mapPending[(uint16_t)nSeqNo] = req;
+    m_pRunner->onSend(BENCH_REQ_MSG);
+}
+
+void CBenchClient::getMsgList(uint32_t nPeerId, uint32_t nMsgCnt)
+{
+    if(!isOnline())
+        return;
+    
+    uint32_t nSeqNo = m_pConn->getMsgList(m_nUserId, IM::BaseDefine::SESSION_TYPE_SINGLE, nPeerId, 0, nMsgCnt);
+    BenchReq_t req = { BENCH_REQ_HISTORY, bench_now_us() };
+    m_mapPending[(uint16_t)nSeqNo] = req;
+    m_pRunner->onSend(BENCH_REQ_HISTORY);
+}
+
+void CBenchClient::getUnreadMsgCnt()
+{
+    if(!isOnline())
+        return;
+    
+    uint32_t nSeqNo = m_pConn->getUnreadMsgCnt(m_nUserId);
+    BenchReq_t req = { BENCH_REQ_UNREAD, bench_now_us() };
+    m_mapPending[(uint16_t)nSeqNo] = req;
+    m_pRunner->onSend(BENCH_REQ_UNREAD);
+}
+
+uint64_t CBenchClient::_popPending(uint32_t nSeqNo, uint32_t nType)
+{
+    // 包头里的序号只有16位, ClientConn分配的是32位
+    auto it = m_mapPending.find((uint16_t)nSeqNo);
+    if(it == m_mapPending.end() || it->second.nType != nType)
+    {
+        return 0;
+    }
+    uint64_t nSendUs = it->second.nSendUs;
+    m_mapPending.erase(it);
+    return nSendUs;
+}
+
+void CBenchClient::onError(uint32_t nSeqNo, uint32_t nCmd, const string& strMsg)
+{
+    log("bench user %s error, cmd=%u, msg=%s", m_strName.c_str(), nCmd, strMsg.c_str());
+    m_pRunner->onError();
+}
+
+void CBenchClient::onConnect()
+{
+    if(m_pConn)
+    {
+        m_nReactor = netlib_get_reactor(m_pConn->GetHandle());
+        m_nState = BENCH_STATE_LOGINING;
+        m_pConn->login(m_strName, m_strPass);
+    }
+}
+
+void CBenchClient::onClose()
+{
+    // 对端关闭, ClientConn会自己释放
+    m_pConn = NULL;
+    m_mapPending.clear();
+    if(m_nState == BENCH_STATE_CONNECTING || m_nState == BENCH_STATE_LOGINING)
+    {
+        m_nState = BENCH_STATE_FAILED;
+        m_pRunner->onLogin(this, false, bench_now_us() - m_nConnectUs);
+    }
+    else
+    {
+        m_nState = BENCH_STATE_FAILED;
+        m_pRunner->onClose(this);
+    }
+}
+
+void CBenchClient::onLogin(uint32_t nSeqNo, uint32_t nResultCode, string& strMsg, IM::BaseDefine::UserInfo* pUser)
+{
+    uint64_t nLatencyUs = bench_now_us() - m_nConnectUs;
+    if(nResultCode != 0 || !pUser)
+    {
+        log("bench user %s login failed, code=%u, msg=%s", m_strName.c_str(), nResultCode, strMsg.c_str());
+        m_nState = BENCH_STATE_FAILED;
+        m_pRunner->onLogin(this, false, nLatencyUs);
+        close();
+        return;
+    }
+    
+    m_nUserId = pUser->user_id();
+    m_nState = BENCH_STATE_ONLINE;
+    m_pRunner->onLogin(this, true, nLatencyUs);
+}
+
+void CBenchClient::onSendMsg(uint32_t nSeqNo, uint32_t nSendId, uint32_t nRecvId, IM::BaseDefine::SessionType nType, uint32_t nMsgId)
+{
+    uint64_t nSendUs = _popPending(nSeqNo, BENCH_REQ_MSG);
+    if(nSendUs)
+    {
+        m_pRunner->onMsgAck(bench_now_us() - nSendUs);
+    }
+}
+
+void CBenchClient::onGetUnreadMsgCnt(uint32_t nSeqNo, uint32_t nUserId, uint32_t nTotalCnt, const list<IM::BaseDefine::UnreadInfo>& lsUnreadCnt)
+{
+    uint64_t nSendUs = _popPending(nSeqNo, BENCH_REQ_UNREAD);
+    if(nSendUs)
+    {
+        m_pRunner->onResponse(BENCH_REQ_UNREAD, bench_now_us() - nSendUs);
+    }
+}
+
+void CBenchClient::onGetMsgList(uint32_t nSeqNo, uint32_t nUserId, uint32_t nPeerId, IM::BaseDefine::SessionType nType, uint32_t nMsgId, uint32_t nMsgCnt, const list<IM::BaseDefine::MsgInfo>& lsMsg)
+{
+    uint64_t nSendUs = _popPending(nSeqNo, BENCH_REQ_HISTORY);
+    if(nSendUs)
+    {
+        m_pRunner->onResponse(BENCH_REQ_HISTORY, bench_now_us() - nSendUs);
+    }
+}
+
+void CBenchClient::onRecvMsg(uint32_t nSeqNo, uint32_t nFromId, uint32_t nToId, uint32_t nMsgId, uint32_t nCreateTime, IM::BaseDefine::MsgType nMsgType, const string& strMsgData)
+{
+    // 只统计本次压测发出的消息, 登录后收到的离线消息(包括之前压测留下的)不算
+    if(strMsgData.compare(0, strlen(BENCH_MSG_PREFIX), BENCH_MSG_PREFIX) != 0)
+    {
+        return;
+    }
+    
+    uint64_t nSendUs = strtoull(strMsgData.c_str() + strlen(BENCH_MSG_PREFIX), NULL, 10);
+    uint64_t nNowUs = bench_now_us();
+    if(nSendUs >= m_pRunner->getStartUs() && nSendUs <= nNowUs)
+    {
+        m_pRunner->onMsgDelivered(nNowUs - nSendUs);
+    }
+}
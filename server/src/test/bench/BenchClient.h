@@ -0,0 +1,98 @@
+/*================================================================
+*   文件名称：BenchClient.h
+*   描    述：压测里的一个模拟用户, 基于ClientConn收发数据包,
+*             记录每个请求的发出时间, 回包时把延迟交给CBenchRunner统计
+*
+================================================================*/
+#ifndef __BENCHCLIENT_H__
+#define __BENCHCLIENT_H__
+
+#include "ostype.h"
+#include "IPacketCallback.h"
+
+using namespace std;
+
+#define BENCH_MSG_PREFIX    "BENCH:"
+
+typedef enum
+{
+    BENCH_STATE_IDLE = 0,
+    BENCH_STATE_CONNECTING,
+    BENCH_STATE_LOGINING,
+    BENCH_STATE_ONLINE,
+    BENCH_STATE_FAILED,
+} BENCH_STATE;
+
+typedef enum
+{
+    BENCH_REQ_MSG = 1,
+    BENCH_REQ_HISTORY,
+    BENCH_REQ_UNREAD,
+} BENCH_REQ_TYPE;
+
+typedef struct
+{
+    uint32_t    nType;
+    uint64_t    nSendUs;
+} BenchReq_t;
+
+class ClientConn;
+class CBenchRunner;
+
+// 单调时钟, 微秒
+uint64_t bench_now_us();
+
+class CBenchClient : public IPacketCallback
+{
+public:
+    CBenchClient(CBenchRunner* pRunner, uint32_t nIndex, const string& strName, const string& strPass);
+    virtual ~CBenchClient();
+public:
+    uint32_t getIndex() { return m_nIndex; }
+    uint32_t getUserId() { return m_nUserId; }
+    uint32_t getState() { return m_nState; }
+    bool isOnline() { return m_nState == BENCH_STATE_ONLINE; }
+    uint32_t getPendingCnt() { return (uint32_t)m_mapPending.size(); }
+    int getReactor() { return m_nReactor; }
+    
+    // nReactor: 连接放在哪个reactor上收发, 0是主reactor
+    bool connect(const string& strIp, uint16_t nPort, uint32_t nReactor);
+    void close();
+    void onTimer(uint64_t nCurTick);
+    
+    void sendMsg(uint32_t nToId, IM::BaseDefine::MsgType nType, uint32_t nPayloadSize);
+    void getMsgList(uint32_t nPeerId, uint32_t nMsgCnt);
+    void getUnreadMsgCnt();
+public:
+    virtual void onError(uint32_t nSeqNo, uint32_t nCmd, const string& strMsg);
+    virtual void onConnect();
+    virtual void onClose();
+    virtual void onLogin(uint32_t nSeqNo, uint32_t nResultCode, string& strMsg, IM::BaseDefine::UserInfo* pUser = NULL);
+    virtual void onGetChangedUser(uint32_t nSeqNo,const list<IM::BaseDefine::UserInfo>& lsUser) {}
+    virtual void onGetUserInfo(uint32_t nSeqNo, const list<IM::BaseDefine::UserInfo>& lsUser) {}
+    virtual void onSendMsg(uint32_t nSeqNo, uint32_t nSendId, uint32_t nRecvId, IM::BaseDefine::SessionType nType, uint32_t nMsgId);
+    virtual void onGetUnreadMsgCnt(uint32_t nSeqNo, uint32_t nUserId, uint32_t nTotalCnt, const list<IM::BaseDefine::UnreadInfo>& lsUnreadCnt);
+    virtual void onGetRecentSession(uint32_t nSeqNo, uint32_t nUserId, const list<IM::BaseDefine::ContactSessionInfo>& lsSession) {}
+    virtual void onGetMsgList(uint32_t nSeqNo, uint32_t nUserId, uint32_t nPeerId, IM::BaseDefine::SessionType nType, uint32_t nMsgId, uint32_t nMsgCnt, const list<IM::BaseDefine::MsgInfo>& lsMsg);
+    virtual void onRecvMsg(uint32_t nSeqNo, uint32_t nFromId, uint32_t nToId, uint32_t nMsgId, uint32_t nCreateTime, IM::BaseDefine::MsgType nMsgType, const string& strMsgData);
+private:
+    // 返回请求发出的时间, 找不到返回0
+    uint64_t _popPending(uint32_t nSeqNo, uint32_t nType);
+    static void _ConnectTask(void* callback_data, uint8_t msg, uint32_t handle, void* pParam);
+    static void _ConnectFailTask(void* callback_data, uint8_t msg, uint32_t handle, void* pParam);
+private:
+    CBenchRunner*   m_pRunner;
+    uint32_t        m_nIndex;
+    string          m_strName;
+    string          m_strPass;
+    uint32_t        m_nUserId;
+    uint32_t        m_nState;
+    uint64_t        m_nConnectUs;
+    string          m_strIp;
+    uint16_t        m_nPort;
+    int             m_nReactor;     // 连接实际所在的reactor, 连上之后才知道
+    ClientConn*     m_pConn;
+    hash_map<uint32_t, BenchReq_t>  m_mapPending;
+};
+
+#endif /*defined(__BENCHCLIENT_H__) */
@@ -0,0 +1,442 @@
+/*================================================================
+*   文件名称：BenchRunner.cpp
+*   描    述：
+*
+================================================================*/
+#include "BenchRunner.h"
+#include "BenchClient.h"
+#include "netlib.h"
+#include "util.h"
+
+#define BENCH_TICK_INTERVAL     10          // 毫秒
+#define BENCH_HEARTBEAT_INTERVAL 1000       // 毫秒, ClientConn自己判断是否需要发心跳
+#define BENCH_LOGIN_TIMEOUT     30000000    // 最后一个用户发起连接后等待登录结果的时间, 微秒
+#define BENCH_DRAIN_QUIET       200000      // 没有在途请求并且这么久没有收到消息就结束
+#define BENCH_DRAIN_TIMEOUT     5000000
+
+static const char* g_scenario_name[] = { "login", "unread", "single", "group", "history" };
+
+CBenchRunner* CBenchRunner::m_pInstance = NULL;
+
+CBenchRunner::CBenchRunner()
+{
+    m_nStartUs = 0;
+    m_nPhase = PHASE_LOGIN;
+    m_nPhaseStartUs = 0;
+    m_nLoginEndUs = 0;
+    m_nRunStartUs = 0;
+    m_nRunEndUs = 0;
+    m_nConnected = 0;
+    m_nLoginDone = 0;
+    m_nIssued = 0;
+    m_nNextClient = 0;
+    m_nLastHeartbeat = 0;
+    m_nLastDeliveryUs = 0;
+    memset(&m_counter, 0, sizeof(m_counter));
+}
+
+CBenchRunner::~CBenchRunner()
+{
+    for (auto it = m_vecClient.begin(); it != m_vecClient.end(); ++it) {
+        delete *it;
+    }
+    m_vecClient.clear();
+}
+
+CBenchRunner* CBenchRunner::getInstance()
+{
+    if(!m_pInstance)
+    {
+        m_pInstance = new CBenchRunner();
+    }
+    return m_pInstance;
+}
+
+bool CBenchRunner::parseScenario(const char* szName, uint32_t& nScenario)
+{
+    for (uint32_t i = 0; i < sizeof(g_scenario_name) / sizeof(g_scenario_name[0]); i++) {
+        if(strcmp(szName, g_scenario_name[i]) == 0)
+        {
+            nScenario = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* CBenchRunner::getScenarioName(uint32_t nScenario)
+{
+    if(nScenario < sizeof(g_scenario_name) / sizeof(g_scenario_name[0]))
+    {
+        return g_scenario_name[nScenario];
+    }
+    return "unknown";
+}
+
+int CBenchRunner::start(const BenchConfig_t& config)
+{
+    m_config = config;
+    m_nStartUs = bench_now_us();
+    m_nPhase = PHASE_LOGIN;
+    m_nPhaseStartUs = m_nStartUs;
+    
+    for (uint32_t i = 0; i < m_config.nUserCnt; i++) {
+        char szName[64];
+        snprintf(szName, sizeof(szName), "%s%u", m_config.strUserPrefix.c_str(), m_config.nUserStart + i);
+        m_vecClient.push_back(new CBenchClient(this, i, szName, m_config.strPass));
+    }
+    
+    m_vecReactorConn.assign(netlib_get_reactor_count(), 0);
+    printf("bench %s: %u users -> %s:%u, reactors=%u\n", getScenarioName(m_config.nScenario), m_config.nUserCnt,
+           m_config.strIp.c_str(), m_config.nPort, netlib_get_reactor_count());
+    return netlib_register_timer(_TimerCallback, this, BENCH_TICK_INTERVAL);
+}
+
+void CBenchRunner::_TimerCallback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+    CBenchRunner* pRunner = (CBenchRunner*)callback_data;
+    pRunner->_onTick();
+}
+
+void CBenchRunner::_onTick()
+{
+    uint64_t nNowUs = bench_now_us();
+    uint64_t nCurTick = get_tick_count();
+    if(nCurTick >= m_nLastHeartbeat + BENCH_HEARTBEAT_INTERVAL)
+    {
+        m_nLastHeartbeat = nCurTick;
+        for (auto it = m_vecClient.begin(); it != m_vecClient.end(); ++it) {
+            (*it)->onTimer(nCurTick);
+        }
+    }
+    
+    switch (m_nPhase) {
+        case PHASE_LOGIN:
+            _doLogin(nNowUs);
+            break;
+        case PHASE_RUN:
+            _doRun(nNowUs);
+            break;
+        case PHASE_DRAIN:
+            if(_getInflight() == 0 && nNowUs >= m_nLastDeliveryUs + BENCH_DRAIN_QUIET)
+            {
+                _finish();
+            }
+            else if(nNowUs >= m_nPhaseStartUs + BENCH_DRAIN_TIMEOUT)
+            {
+                printf("drain timeout, %u requests still in flight\n", _getInflight());
+                _finish();
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void CBenchRunner::_doLogin(uint64_t nNowUs)
+{
+    // 按速率逐步发起连接, 模拟登录风暴
+    uint32_t nTarget = m_config.nUserCnt;
+    if(m_config.nLoginRate > 0)
+    {
+        uint64_t nAllowed = (nNowUs - m_nPhaseStartUs) * m_config.nLoginRate / 1000000 + 1;
+        if(nAllowed < nTarget)
+        {
+            nTarget = (uint32_t)nAllowed;
+        }
+    }
+    
+    for (; m_nConnected < nTarget; m_nConnected++) {
+        CBenchClient* pClient = m_vecClient[m_nConnected];
+        // 按序号轮流分到各个reactor上, 收发和拆包分摊到多个线程
+        if(!pClient->connect(m_config.strIp, m_config.nPort, m_nConnected % netlib_get_reactor_count()))
+        {
+            onLogin(pClient, false, 0);
+        }
+        if(m_nConnected + 1 == m_config.nUserCnt)
+        {
+            m_nRunStartUs = nNowUs;     // 记录最后一个连接发起的时间, 用于登录超时
+        }
+    }
+    
+    bool bTimeout = (m_nConnected == m_config.nUserCnt) && (nNowUs >= m_nRunStartUs + BENCH_LOGIN_TIMEOUT);
+    if(m_nLoginDone < m_config.nUserCnt && !bTimeout)
+        return;
+    
+    if(bTimeout)
+    {
+        printf("login timeout, %u users without result\n", m_config.nUserCnt - m_nLoginDone);
+    }
+    m_nLoginEndUs = nNowUs;
+    printf("login phase done, ok=%llu fail=%llu, %s\n", (unsigned long long)m_counter.login_ok,
+           (unsigned long long)m_counter.login_fail, m_histLogin.toString().c_str());
+    
+    if(m_config.nScenario == BENCH_SCENARIO_LOGIN || m_config.nScenario == BENCH_SCENARIO_UNREAD)
+    {
+        m_nRunStartUs = m_nStartUs;
+        m_nRunEndUs = nNowUs;
+        m_nPhase = PHASE_DRAIN;
+        m_nPhaseStartUs = nNowUs;
+        return;
+    }
+    
+    m_nPhase = PHASE_RUN;
+    m_nPhaseStartUs = nNowUs;
+    m_nRunStartUs = nNowUs;
+}
+
+void CBenchRunner::_doRun(uint64_t nNowUs)
+{
+    if(nNowUs >= m_nRunStartUs + (uint64_t)m_config.nDuration * 1000000)
+    {
+        m_nRunEndUs = nNowUs;
+        m_nPhase = PHASE_DRAIN;
+        m_nPhaseStartUs = nNowUs;
+        return;
+    }
+    
+    // 按总速率均匀地发, 在线用户轮流发送
+    uint64_t nTarget = (nNowUs - m_nRunStartUs) * m_config.nRate / 1000000;
+    uint32_t nTried = 0;
+    while (m_nIssued < nTarget && nTried < m_vecClient.size()) {
+        CBenchClient* pClient = m_vecClient[m_nNextClient];
+        m_nNextClient = (m_nNextClient + 1) % m_vecClient.size();
+        if(!pClient->isOnline())
+        {
+            nTried++;
+            continue;
+        }
+        
+        nTried = 0;
+        _doOne(pClient);
+        m_nIssued++;
+    }
+    
+    // 没有在线用户的时候不要累积欠账
+    if(m_nIssued < nTarget)
+    {
+        m_nIssued = nTarget;
+    }
+}
+
+void CBenchRunner::_doOne(CBenchClient* pClient)
+{
+    CBenchClient* pPeer = NULL;
+    switch (m_config.nScenario) {
+        case BENCH_SCENARIO_SINGLE:
+            pPeer = _getPeer(pClient);
+            if(pPeer)
+            {
+                pClient->sendMsg(pPeer->getUserId(), IM::BaseDefine::MSG_TYPE_SINGLE_TEXT, m_config.nPayloadSize);
+            }
+            break;
+        case BENCH_SCENARIO_GROUP:
+            pClient->sendMsg(m_config.nGroupId, IM::BaseDefine::MSG_TYPE_GROUP_TEXT, m_config.nPayloadSize);
+            break;
+        case BENCH_SCENARIO_HISTORY:
+            pPeer = _getPeer(pClient);
+            if(pPeer)
+            {
+                pClient->getMsgList(pPeer->getUserId(), m_config.nHistoryCnt);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// 用户两两配对: 0和1, 2和3...; 总数为奇数时最后一个和0配对
+CBenchClient* CBenchRunner::_getPeer(CBenchClient* pClient)
+{
+    uint32_t nIndex = pClient->getIndex();
+    uint32_t nPeer = nIndex ^ 1;
+    if(nPeer >= m_vecClient.size())
+    {
+        nPeer = 0;
+    }
+    CBenchClient* pPeer = m_vecClient[nPeer];
+    if(pPeer == pClient || pPeer->getUserId() == 0)
+    {
+        return NULL;
+    }
+    return pPeer;
+}
+
+uint32_t CBenchRunner::_getInflight()
+{
+    uint32_t nCnt = 0;
+    for (auto it = m_vecClient.begin(); it != m_vecClient.end(); ++it) {
+        nCnt += (*it)->getPendingCnt();
+    }
+    return nCnt;
+}
+
+void CBenchRunner::onLogin(CBenchClient* pClient, bool bSuccess, uint64_t nLatencyUs)
+{
+    m_nLoginDone++;
+    if(!bSuccess)
+    {
+        m_counter.login_fail++;
+        return;
+    }
+    
+    m_counter.login_ok++;
+    m_histLogin.record(nLatencyUs);
+    int nReactor = pClient->getReactor();
+    if(nReactor >= 0 && nReactor < (int)m_vecReactorConn.size())
+    {
+        m_vecReactorConn[nReactor]++;
+    }
+    if(m_config.nScenario == BENCH_SCENARIO_UNREAD)
+    {
+        pClient->getUnreadMsgCnt();
+    }
+}
+
+void CBenchRunner::onClose(CBenchClient* pClient)
+{
+    m_counter.closed++;
+}
+
+void CBenchRunner::onSend(uint32_t nType)
+{
+    if(nType == BENCH_REQ_MSG)
+    {
+        m_counter.sent++;
+    }
+    else
+    {
+        m_counter.requests++;
+    }
+}
+
+void CBenchRunner::onMsgAck(uint64_t nLatencyUs)
+{
+    m_counter.acked++;
+    m_histAck.record(nLatencyUs);
+}
+
+void CBenchRunner::onMsgDelivered(uint64_t nLatencyUs)
+{
+    m_counter.delivered++;
+    m_histDelivery.record(nLatencyUs);
+    m_nLastDeliveryUs = bench_now_us();
+}
+
+void CBenchRunner::onResponse(uint32_t nType, uint64_t nLatencyUs)
+{
+    m_counter.responses++;
+    if(nType == BENCH_REQ_HISTORY)
+    {
+        m_histHistory.record(nLatencyUs);
+    }
+    else if(nType == BENCH_REQ_UNREAD)
+    {
+        m_histUnread.record(nLatencyUs);
+    }
+}
+
+void CBenchRunner::_finish()
+{
+    m_nPhase = PHASE_DONE;
+    netlib_delete_timer(_TimerCallback, this);
+    _report();
+    
+    for (auto it = m_vecClient.begin(); it != m_vecClient.end(); ++it) {
+        (*it)->close();
+    }
+    netlib_stop_event();
+}
+
+static double to_seconds(uint64_t nStartUs, uint64_t nEndUs)
+{
+    if(nEndUs <= nStartUs)
+    {
+        return 1;
+    }
+    return (double)(nEndUs - nStartUs) / 1000000;
+}
+
+void CBenchRunner::_report()
+{
+    double fSeconds = to_seconds(m_nRunStartUs, m_nRunEndUs);
+    double fLoginSeconds = to_seconds(m_nStartUs, m_nLoginEndUs);
+    
+    printf("==================== %s ====================\n", getScenarioName(m_config.nScenario));
+    printf("users=%u login_ok=%llu login_fail=%llu closed=%llu errors=%llu\n", m_config.nUserCnt,
+           (unsigned long long)m_counter.login_ok, (unsigned long long)m_counter.login_fail,
+           (unsigned long long)m_counter.closed, (unsigned long long)m_counter.errors);
+    printf("reactor conns:");
+    for (size_t i = 0; i < m_vecReactorConn.size(); i++) {
+        printf(" %lu:%u", (unsigned long)i, m_vecReactorConn[i]);
+    }
+    printf("\n");
+    printf("login=%.2fs duration=%.2fs sent=%llu acked=%llu delivered=%llu requests=%llu responses=%llu\n", fLoginSeconds, fSeconds,
+           (unsigned long long)m_counter.sent, (unsigned long long)m_counter.acked,
+           (unsigned long long)m_counter.delivered, (unsigned long long)m_counter.requests,
+           (unsigned long long)m_counter.responses);
+    printf("throughput: logins/s=%.1f sent/s=%.1f delivered/s=%.1f responses/s=%.1f\n",
+           m_counter.login_ok / fLoginSeconds, m_counter.sent / fSeconds,
+           m_counter.delivered / fSeconds, m_counter.responses / fSeconds);
+    printf("latency(us):\n");
+    printf("  login    %s\n", m_histLogin.toString().c_str());
+    printf("  ack      %s\n", m_histAck.toString().c_str());
+    printf("  delivery %s\n", m_histDelivery.toString().c_str());
+    printf("  history  %s\n", m_histHistory.toString().c_str());
+    printf("  unread   %s\n", m_histUnread.toString().c_str());
+    
+    if(m_config.strOutput.empty())
+        return;
+    
+    FILE* fp = fopen(m_config.strOutput.c_str(), "w");
+    if(!fp)
+    {
+        printf("open %s failed: %s\n", m_config.strOutput.c_str(), strerror(errno));
+        return;
+    }
+    string strJson = _toJson();
+    fwrite(strJson.c_str(), 1, strJson.size(), fp);
+    fclose(fp);
+    printf("report written to %s\n", m_config.strOutput.c_str());
+}
+
+// 一个json对象, 字段固定, 方便CI里和基线做比较
+string CBenchRunner::_toJson()
+{
+    double fSeconds = to_seconds(m_nRunStartUs, m_nRunEndUs);
+    double fLoginSeconds = to_seconds(m_nStartUs, m_nLoginEndUs);
+    
+    char szBuf[1024];
+    snprintf(szBuf, sizeof(szBuf),
+             "{\"scenario\":\"%s\",\"users\":%u,\"reactors\":%u,\"rate\":%u,\"payload\":%u,\"group_id\":%u,\"login_s\":%.3f,\"duration_s\":%.3f,"
+             "\"counters\":{\"login_ok\":%llu,\"login_fail\":%llu,\"closed\":%llu,\"errors\":%llu,\"sent\":%llu,\"acked\":%llu,"
+             "\"delivered\":%llu,\"requests\":%llu,\"responses\":%llu},"
+             "\"throughput\":{\"logins_per_sec\":%.1f,\"sent_per_sec\":%.1f,\"delivered_per_sec\":%.1f,\"responses_per_sec\":%.1f},"
+             "\"latency_us\":{",
+             getScenarioName(m_config.nScenario), m_config.nUserCnt, netlib_get_reactor_count(), m_config.nRate,
+             m_config.nPayloadSize, m_config.nGroupId, fLoginSeconds, fSeconds,
+             (unsigned long long)m_counter.login_ok, (unsigned long long)m_counter.login_fail,
+             (unsigned long long)m_counter.closed, (unsigned long long)m_counter.errors,
+             (unsigned long long)m_counter.sent, (unsigned long long)m_counter.acked,
+             (unsigned long long)m_counter.delivered, (unsigned long long)m_counter.requests,
+             (unsigned long long)m_counter.responses,
+             m_counter.login_ok / fLoginSeconds, m_counter.sent / fSeconds,
+             m_counter.delivered / fSeconds, m_counter.responses / fSeconds);
+    
+    string strJson = szBuf;
+    strJson += "\"login\":" + m_histLogin.toJson();
+    strJson += ",\"ack\":" + m_histAck.toJson();
+    strJson += ",\"delivery\":" + m_histDelivery.toJson();
+    strJson += ",\"history\":" + m_histHistory.toJson();
+    strJson += ",\"unread\":" + m_histUnread.toJson();
+    strJson += "},\"reactor_conns\":[";
+    for (size_t i = 0; i < m_vecReactorConn.size(); i++) {
+        if(i > 0)
+        {
+            strJson += ",";
+        }
+        strJson += int2string(m_vecReactorConn[i]);
+    }
+    strJson += "]}\n";
+    return strJson;
+}
@@ -0,0 +1,133 @@
+/*================================================================
+*   文件名称：BenchRunner.h
+*   描    述：压测场景的驱动和统计, 所有回调都在主reactor里执行, 不需要加锁
+*
+*   场景:
+*     login     登录风暴, 按-L的速率建连登录, 统计建连到登录成功的延迟
+*     unread    登录后立即请求未读计数, 统计请求延迟
+*     single    单聊, 用户两两配对互发, 统计服务器ack延迟和对端收到的端到端延迟
+*     group     群聊, 所有用户往-g指定的群发消息, 扇出数由群成员数决定
+*     history   拉取和配对用户的历史消息, 统计请求延迟
+*
+================================================================*/
+#ifndef __BENCHRUNNER_H__
+#define __BENCHRUNNER_H__
+
+#include <vector>
+#include "ostype.h"
+#include "LatencyHistogram.h"
+
+using namespace std;
+
+class CBenchClient;
+
+typedef enum
+{
+    BENCH_SCENARIO_LOGIN = 0,
+    BENCH_SCENARIO_UNREAD,
+    BENCH_SCENARIO_SINGLE,
+    BENCH_SCENARIO_GROUP,
+    BENCH_SCENARIO_HISTORY,
+} BENCH_SCENARIO;
+
+typedef struct
+{
+    string      strIp;
+    uint16_t    nPort;
+    string      strUserPrefix;  // 用户名为前缀加序号, 如test0, test1...
+    uint32_t    nUserStart;
+    uint32_t    nUserCnt;
+    string      strPass;
+    uint32_t    nScenario;
+    uint32_t    nLoginRate;     // 每秒建连数, 0表示一次全部发起
+    uint32_t    nRate;          // 所有用户合计每秒的消息/请求数
+    uint32_t    nDuration;      // 秒
+    uint32_t    nGroupId;
+    uint32_t    nPayloadSize;
+    uint32_t    nHistoryCnt;
+    string      strOutput;      // json报告的文件名, 空表示不输出
+} BenchConfig_t;
+
+typedef struct
+{
+    uint64_t    login_ok;
+    uint64_t    login_fail;
+    uint64_t    closed;
+    uint64_t    sent;
+    uint64_t    acked;
+    uint64_t    delivered;
+    uint64_t    requests;
+    uint64_t    responses;
+    uint64_t    errors;
+} BenchCounter_t;
+
+class CBenchRunner
+{
+public:
+    static CBenchRunner* getInstance();
+    
+    static bool parseScenario(const char* szName, uint32_t& nScenario);
+    static const char* getScenarioName(uint32_t nScenario);
+    
+    int start(const BenchConfig_t& config);
+    const BenchConfig_t& getConfig() { return m_config; }
+    uint64_t getStartUs() { return m_nStartUs; }
+    
+    // CBenchClient的回调
+    void onLogin(CBenchClient* pClient, bool bSuccess, uint64_t nLatencyUs);
+    void onClose(CBenchClient* pClient);
+    void onMsgAck(uint64_t nLatencyUs);
+    void onMsgDelivered(uint64_t nLatencyUs);
+    void onResponse(uint32_t nType, uint64_t nLatencyUs);
+    void onSend(uint32_t nType);
+    void onError() { m_counter.errors++; }
+private:
+    CBenchRunner();
+    virtual ~CBenchRunner();
+    
+    static void _TimerCallback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam);
+    void _onTick();
+    void _doLogin(uint64_t nNowUs);
+    void _doRun(uint64_t nNowUs);
+    void _doOne(CBenchClient* pClient);
+    CBenchClient* _getPeer(CBenchClient* pClient);
+    uint32_t _getInflight();
+    void _finish();
+    void _report();
+    string _toJson();
+private:
+    typedef enum
+    {
+        PHASE_LOGIN = 0,
+        PHASE_RUN,
+        PHASE_DRAIN,
+        PHASE_DONE,
+    } PHASE;
+    
+    static CBenchRunner*    m_pInstance;
+    
+    BenchConfig_t           m_config;
+    vector<CBenchClient*>   m_vecClient;
+    uint64_t                m_nStartUs;
+    uint32_t                m_nPhase;
+    uint64_t                m_nPhaseStartUs;
+    uint64_t                m_nLoginEndUs;
+    uint64_t                m_nRunStartUs;
+    uint64_t                m_nRunEndUs;
+    uint32_t                m_nConnected;   // 已经发起连接的用户数
+    uint32_t                m_nLoginDone;   // 登录有结果的用户数
+    uint64_t                m_nIssued;      // RUN阶段已经发出的操作数
+    uint32_t                m_nNextClient;
+    uint64_t                m_nLastHeartbeat;
+    uint64_t                m_nLastDeliveryUs;
+    
+    BenchCounter_t          m_counter;
+    vector<uint32_t>        m_vecReactorConn;   // 每个reactor上登录成功的连接数
+    CLatencyHistogram       m_histLogin;
+    CLatencyHistogram       m_histAck;
+    CLatencyHistogram       m_histDelivery;
+    CLatencyHistogram       m_histHistory;
+    CLatencyHistogram       m_histUnread;
+};
+
+#endif /*defined(__BENCHRUNNER_H__) */
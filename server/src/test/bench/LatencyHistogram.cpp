@@ -0,0 +1,131 @@
+/*================================================================
+*   文件名称：LatencyHistogram.cpp
+*   描    述：
+*
+================================================================*/
+#include <string.h>
+#include "LatencyHistogram.h"
+
+CLatencyHistogram::CLatencyHistogram()
+{
+    reset();
+}
+
+void CLatencyHistogram::reset()
+{
+    m_nCount = 0;
+    m_nSum = 0;
+    m_nMin = (uint64_t)-1;
+    m_nMax = 0;
+    memset(m_nBuckets, 0, sizeof(m_nBuckets));
+}
+
+/*
+ * 小于HIST_SUB_CNT的值一个值一个桶;
+ * 更大的值按最高位分段, 每段取最高的HIST_SUB_BITS位, 落在后半段的HIST_HALF_SUB_CNT个桶里
+ */
+uint32_t CLatencyHistogram::_getIndex(uint64_t nValue)
+{
+    if (nValue < HIST_SUB_CNT) {
+        return (uint32_t)nValue;
+    }
+    
+    uint32_t nMsb = 63 - __builtin_clzll(nValue);
+    if (nMsb >= HIST_MAX_BITS) {
+        return HIST_BUCKET_CNT - 1;
+    }
+    uint32_t nShift = nMsb - (HIST_SUB_BITS - 1);
+    return nShift * HIST_HALF_SUB_CNT + (uint32_t)(nValue >> nShift);
+}
+
+uint64_t CLatencyHistogram::_getUpper(uint32_t nIndex)
+{
+    if (nIndex < HIST_SUB_CNT) {
+        return nIndex;
+    }
+    
+    uint32_t nShift = nIndex / HIST_HALF_SUB_CNT - 1;
+    uint64_t nSub = nIndex - nShift * HIST_HALF_SUB_CNT;
+    return ((nSub + 1) << nShift) - 1;
+}
+
+void CLatencyHistogram::record(uint64_t nValue)
+{
+    m_nBuckets[_getIndex(nValue)]++;
+    m_nCount++;
+    m_nSum += nValue;
+    if (nValue < m_nMin)
+        m_nMin = nValue;
+    if (nValue > m_nMax)
+        m_nMax = nValue;
+}
+
+void CLatencyHistogram::merge(const CLatencyHistogram& other)
+{
+    if (other.m_nCount == 0)
+        return;
+    
+    for (uint32_t i = 0; i < HIST_BUCKET_CNT; i++) {
+        m_nBuckets[i] += other.m_nBuckets[i];
+    }
+    m_nCount += other.m_nCount;
+    m_nSum += other.m_nSum;
+    if (other.m_nMin < m_nMin)
+        m_nMin = other.m_nMin;
+    if (other.m_nMax > m_nMax)
+        m_nMax = other.m_nMax;
+}
+
+uint64_t CLatencyHistogram::getPercentile(double fPercentile) const
+{
+    if (m_nCount == 0)
+        return 0;
+    
+    uint64_t nTarget = (uint64_t)(fPercentile / 100 * m_nCount + 0.5);
+    if (nTarget == 0)
+        nTarget = 1;
+    
+    uint64_t nSeen = 0;
+    for (uint32_t i = 0; i < HIST_BUCKET_CNT; i++) {
+        nSeen += m_nBuckets[i];
+        if (nSeen >= nTarget) {
+            uint64_t nUpper = _getUpper(i);
+            return nUpper < m_nMax ? nUpper : m_nMax;
+        }
+    }
+    return m_nMax;
+}
+
+string CLatencyHistogram::toString() const
+{
+    char szBuf[256];
+    snprintf(szBuf, sizeof(szBuf), "count=%llu min=%llu mean=%.1f p50=%llu p90=%llu p99=%llu p999=%llu max=%llu",
+             (unsigned long long)m_nCount, (unsigned long long)getMin(), getMean(),
+             (unsigned long long)getPercentile(50), (unsigned long long)getPercentile(90),
+             (unsigned long long)getPercentile(99), (unsigned long long)getPercentile(99.9),
+             (unsigned long long)m_nMax);
+    return szBuf;
+}
+
+string CLatencyHistogram::toJson() const
+{
+    char szBuf[512];
+    snprintf(szBuf, sizeof(szBuf), "{\"count\":%llu,\"min\":%llu,\"mean\":%.1f,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu,\"buckets\":[",
+             (unsigned long long)m_nCount, (unsigned long long)getMin(), getMean(),
+             (unsigned long long)getPercentile(50), (unsigned long long)getPercentile(90),
+             (unsigned long long)getPercentile(99), (unsigned long long)getPercentile(99.9),
+             (unsigned long long)m_nMax);
+    string strJson = szBuf;
+    
+    bool bFirst = true;
+    for (uint32_t i = 0; i < HIST_BUCKET_CNT; i++) {
+        if (m_nBuckets[i] == 0)
+            continue;
+        snprintf(szBuf, sizeof(szBuf), "%s[%llu,%llu]", bFirst ? "" : ",",
+                 (unsigned long long)_getUpper(i), (unsigned long long)m_nBuckets[i]);
+        strJson += szBuf;
+        bFirst = false;
+    }
+    strJson += "]}";
+    return strJson;
+}
@@ -0,0 +1,53 @@
+/*================================================================
+*   文件名称：LatencyHistogram.h
+*   描    述：HDR风格的延迟直方图, 对数分段+段内线性分桶,
+*             任意量级的值相对误差都小于1/128, 内存固定, 记录是O(1)的
+*
+================================================================*/
+#ifndef __LATENCYHISTOGRAM_H__
+#define __LATENCYHISTOGRAM_H__
+
+#include <string>
+#include "ostype.h"
+
+using namespace std;
+
+#define HIST_SUB_BITS		8
+#define HIST_SUB_CNT		(1 << HIST_SUB_BITS)		// 每段的桶数
+#define HIST_HALF_SUB_CNT	(HIST_SUB_CNT / 2)
+#define HIST_MAX_BITS		40							// 最大可记录约12天(微秒)
+#define HIST_BUCKET_CNT		((HIST_MAX_BITS - HIST_SUB_BITS + 2) * HIST_HALF_SUB_CNT)
+
+class CLatencyHistogram
+{
+public:
+    CLatencyHistogram();
+    
+    void reset();
+    // 单位由调用者决定, 压测工具里统一用微秒
+    void record(uint64_t nValue);
+    void merge(const CLatencyHistogram& other);
+    
+    uint64_t getCount() const { return m_nCount; }
+    uint64_t getMin() const { return m_nCount ? m_nMin : 0; }
+    uint64_t getMax() const { return m_nMax; }
+    double getMean() const { return m_nCount ? (double)m_nSum / m_nCount : 0; }
+    // fPercentile取0~100, 返回该分位所在桶的上界(不超过最大值)
+    uint64_t getPercentile(double fPercentile) const;
+    
+    // 一行可读的摘要
+    string toString() const;
+    // 机器可读的json对象, 包含分位数和非空的桶(桶上界, 个数)
+    string toJson() const;
+private:
+    static uint32_t _getIndex(uint64_t nValue);
+    static uint64_t _getUpper(uint32_t nIndex);
+private:
+    uint64_t    m_nCount;
+    uint64_t    m_nSum;
+    uint64_t    m_nMin;
+    uint64_t    m_nMax;
+    uint64_t    m_nBuckets[HIST_BUCKET_CNT];
+};
+
+#endif /*defined(__LATENCYHISTOGRAM_H__) */
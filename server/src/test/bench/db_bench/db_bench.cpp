@@ -0,0 +1,307 @@
+/*================================================================
+*   文件名称：db_bench.cpp
+*   描    述：db_proxy数据库访问层压测, 同一条查询分别走阻塞的CDBConn(工作线程+连接池)
+*             和非阻塞的CAsyncDBManager(epoll线程, 每个线程多个查询同时在途), 比较吞吐和延迟
+*
+*   在db_proxy_server的运行目录下执行, 连接参数取自dbproxyserver.conf
+*   例: ./db_bench -m both -t 16 -T 2 -C 8 -c 64 -d 30 -n 10000 \
+*           -q "select id, sex, nick, domain, name, phone, email, avatar, sign_info, departId, status from IMUser where id=%u"
+*   阻塞方式的并发受-t和实例的maxconncnt两者中较小的限制, 延迟包含在连接池上等待的时间
+*
+================================================================*/
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "util.h"
+#include "Thread.h"
+#include "DBPool.h"
+#include "AsyncDBPool.h"
+#include "LatencyHistogram.h"
+
+typedef struct {
+    string      strMode;
+    string      strInstance;
+    string      strSql;         // %u替换成[1, nIdRange]里的随机id
+    uint32_t    nIdRange;
+    uint32_t    nDuration;
+    uint32_t    nThreadCnt;     // 阻塞方式的工作线程数
+    uint32_t    nAsyncThreadCnt;
+    uint32_t    nAsyncConnCnt;
+    uint32_t    nConcurrency;   // 异步方式同时在途的查询数
+    string      strOutput;
+} DBBenchConfig_t;
+
+struct DBBenchResult_t {
+    uint64_t            nQueryCnt;
+    uint64_t            nErrorCnt;
+    uint64_t            nRowCnt;
+    double              fSeconds;
+    CLatencyHistogram   hist;
+
+    DBBenchResult_t() : nQueryCnt(0), nErrorCnt(0), nRowCnt(0), fSeconds(0) {}
+};
+
+static DBBenchConfig_t g_config;
+
+static uint64_t now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static string make_sql(uint32_t* pSeed)
+{
+    size_t nPos = g_config.strSql.find("%u");
+    if(nPos == string::npos)
+        return g_config.strSql;
+
+    uint32_t nId = rand_r(pSeed) % g_config.nIdRange + 1;
+    string strSql = g_config.strSql;
+    strSql.replace(nPos, 2, int2string(nId));
+    return strSql;
+}
+
+static uint32_t read_rows(CResultSet* pResultSet)
+{
+    uint32_t nRows = 0;
+    while (pResultSet->Next())
+    {
+        // 和业务代码一样把每一列取一遍
+        for (uint32_t i = 0; i < pResultSet->GetColumnCount(); i++)
+        {
+            pResultSet->GetStringRef(i);
+        }
+        nRows++;
+    }
+    return nRows;
+}
+
+/////////// 阻塞方式: 每个线程循环 取连接->查询->还连接
+typedef struct {
+    uint64_t            nEndUs;
+    uint32_t            nSeed;
+    DBBenchResult_t     result;
+} BlockingWorker_t;
+
+static void* blocking_worker(void* arg)
+{
+    BlockingWorker_t* pWorker = (BlockingWorker_t*)arg;
+    CDBManager* pDBManager = CDBManager::getInstance();
+    while (now_us() < pWorker->nEndUs)
+    {
+        string strSql = make_sql(&pWorker->nSeed);
+        uint64_t nStartUs = now_us();
+        CDBConn* pDBConn = pDBManager->GetDBConn(g_config.strInstance.c_str());
+        CResultSet* pResultSet = pDBConn ? pDBConn->ExecuteQuery(strSql.c_str()) : NULL;
+        if (pResultSet)
+        {
+            pWorker->result.nRowCnt += read_rows(pResultSet);
+            delete pResultSet;
+        }
+        else
+        {
+            pWorker->result.nErrorCnt++;
+        }
+        pDBManager->RelDBConn(pDBConn);
+        pWorker->result.hist.record(now_us() - nStartUs);
+        pWorker->result.nQueryCnt++;
+    }
+    return NULL;
+}
+
+static void run_blocking(DBBenchResult_t& result)
+{
+    vector<BlockingWorker_t*> vecWorker;
+    vector<pthread_t> vecThread(g_config.nThreadCnt);
+    uint64_t nStartUs = now_us();
+    for (uint32_t i = 0; i < g_config.nThreadCnt; i++)
+    {
+        BlockingWorker_t* pWorker = new BlockingWorker_t;
+        pWorker->nEndUs = nStartUs + (uint64_t)g_config.nDuration * 1000000;
+        pWorker->nSeed = i + 1;
+        vecWorker.push_back(pWorker);
+        pthread_create(&vecThread[i], NULL, blocking_worker, pWorker);
+    }
+
+    for (uint32_t i = 0; i < g_config.nThreadCnt; i++)
+    {
+        pthread_join(vecThread[i], NULL);
+        result.nQueryCnt += vecWorker[i]->result.nQueryCnt;
+        result.nErrorCnt += vecWorker[i]->result.nErrorCnt;
+        result.nRowCnt += vecWorker[i]->result.nRowCnt;
+        result.hist.merge(vecWorker[i]->result.hist);
+        delete vecWorker[i];
+    }
+    result.fSeconds = (now_us() - nStartUs) / 1000000.0;
+}
+
+/////////// 异步方式: 一个线程提交, 保持nConcurrency个查询在途, 回调在异步线程里统计
+static CThreadNotify g_async_notify;
+static uint32_t g_async_inflight = 0;
+
+static void run_async(DBBenchResult_t& result)
+{
+    CAsyncDBManager* pAsyncManager = CAsyncDBManager::getInstance();
+    CLock lock;
+    uint32_t nSeed = 1;
+    uint64_t nStartUs = now_us();
+    uint64_t nEndUs = nStartUs + (uint64_t)g_config.nDuration * 1000000;
+    while (now_us() < nEndUs)
+    {
+        g_async_notify.Lock();
+        while (g_async_inflight >= g_config.nConcurrency)
+        {
+            g_async_notify.Wait();
+        }
+        g_async_inflight++;
+        g_async_notify.Unlock();
+
+        uint64_t nSubmitUs = now_us();
+        pAsyncManager->Query(g_config.strInstance.c_str(), make_sql(&nSeed), [&result, &lock, nSubmitUs](CResultSet* pResultSet) {
+            uint32_t nRows = pResultSet ? read_rows(pResultSet) : 0;
+            uint64_t nLatencyUs = now_us() - nSubmitUs;
+            lock.lock();
+            result.nQueryCnt++;
+            result.nRowCnt += nRows;
+            if (!pResultSet)
+                result.nErrorCnt++;
+            result.hist.record(nLatencyUs);
+            lock.unlock();
+
+            g_async_notify.Lock();
+            g_async_inflight--;
+            g_async_notify.Signal();
+            g_async_notify.Unlock();
+        });
+    }
+
+    // 等在途的查询都回来
+    g_async_notify.Lock();
+    while (g_async_inflight > 0)
+    {
+        g_async_notify.Wait();
+    }
+    g_async_notify.Unlock();
+    result.fSeconds = (now_us() - nStartUs) / 1000000.0;
+}
+
+static void print_result(const char* szMode, const DBBenchResult_t& result)
+{
+    printf("==================== %s ====================\n", szMode);
+    printf("queries=%llu errors=%llu rows=%llu duration=%.2fs qps=%.1f\n",
+           (unsigned long long)result.nQueryCnt, (unsigned long long)result.nErrorCnt,
+           (unsigned long long)result.nRowCnt, result.fSeconds, result.nQueryCnt / result.fSeconds);
+    printf("latency(us): %s\n", result.hist.toString().c_str());
+}
+
+static string result_json(const DBBenchResult_t& result)
+{
+    char szBuf[256];
+    snprintf(szBuf, sizeof(szBuf), "{\"queries\":%llu,\"errors\":%llu,\"rows\":%llu,\"duration_s\":%.3f,\"qps\":%.1f,\"latency_us\":",
+             (unsigned long long)result.nQueryCnt, (unsigned long long)result.nErrorCnt,
+             (unsigned long long)result.nRowCnt, result.fSeconds, result.nQueryCnt / result.fSeconds);
+    return string(szBuf) + result.hist.toJson() + "}";
+}
+
+void print_help(const char* szName)
+{
+    printf("Usage: %s [options]\n", szName);
+    printf("  -m mode       blocking|async|both, default both\n");
+    printf("  -i instance   db instance in dbproxyserver.conf, default teamtalk_slave\n");
+    printf("  -q sql        query to run, %%u is replaced by a random id, default select on IMUser by id\n");
+    printf("  -n range      random id range [1, range], default 1000\n");
+    printf("  -d seconds    duration of each mode, default 10\n");
+    printf("  -t threads    blocking worker threads, default 16\n");
+    printf("  -T threads    async event loop threads, default 2\n");
+    printf("  -C count      async connections per thread, default 8\n");
+    printf("  -c count      async queries in flight, default 64\n");
+    printf("  -o file       write the report as json\n");
+}
+
+int main(int argc, char* argv[])
+{
+    g_config.strMode = "both";
+    g_config.strInstance = "teamtalk_slave";
+    g_config.strSql = "select id, sex, nick, domain, name, phone, email, avatar, sign_info, departId, status from IMUser where id=%u";
+    g_config.nIdRange = 1000;
+    g_config.nDuration = 10;
+    g_config.nThreadCnt = 16;
+    g_config.nAsyncThreadCnt = 2;
+    g_config.nAsyncConnCnt = 8;
+    g_config.nConcurrency = 64;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "m:i:q:n:d:t:T:C:c:o:")) != -1) {
+        switch (ch) {
+            case 'm': g_config.strMode = optarg; break;
+            case 'i': g_config.strInstance = optarg; break;
+            case 'q': g_config.strSql = optarg; break;
+            case 'n': g_config.nIdRange = atoi(optarg); break;
+            case 'd': g_config.nDuration = atoi(optarg); break;
+            case 't': g_config.nThreadCnt = atoi(optarg); break;
+            case 'T': g_config.nAsyncThreadCnt = atoi(optarg); break;
+            case 'C': g_config.nAsyncConnCnt = atoi(optarg); break;
+            case 'c': g_config.nConcurrency = atoi(optarg); break;
+            case 'o': g_config.strOutput = optarg; break;
+            default:
+                print_help(argv[0]);
+                return -1;
+        }
+    }
+
+    bool bBlocking = (g_config.strMode == "blocking" || g_config.strMode == "both");
+    bool bAsync = (g_config.strMode == "async" || g_config.strMode == "both");
+    if ((!bBlocking && !bAsync) || g_config.nIdRange == 0 || g_config.nThreadCnt == 0 || g_config.nConcurrency == 0)
+    {
+        print_help(argv[0]);
+        return -1;
+    }
+
+    // CDBManager::getInstance()里读取配置并建立连接池
+    if (!CDBManager::getInstance())
+    {
+        printf("db init failed, run in the directory of dbproxyserver.conf\n");
+        return -1;
+    }
+
+    DBBenchResult_t cBlocking, cAsync;
+    if (bBlocking)
+    {
+        run_blocking(cBlocking);
+        print_result("blocking", cBlocking);
+    }
+    if (bAsync)
+    {
+        if (CAsyncDBManager::getInstance()->Init(g_config.nAsyncThreadCnt, g_config.nAsyncConnCnt, g_config.strInstance.c_str()) ||
+            !CAsyncDBManager::getInstance()->IsEnabled())
+        {
+            printf("async db init failed, the mysql client library must be MariaDB\n");
+            return -1;
+        }
+        // 等异步连接建立好
+        sleep(1);
+        run_async(cAsync);
+        print_result("async", cAsync);
+    }
+
+    if (g_config.strOutput.empty())
+        return 0;
+
+    FILE* fp = fopen(g_config.strOutput.c_str(), "w");
+    if (!fp)
+    {
+        printf("open %s failed: %s\n", g_config.strOutput.c_str(), strerror(errno));
+        return -1;
+    }
+    char szBuf[256];
+    snprintf(szBuf, sizeof(szBuf), "{\"instance\":\"%s\",\"threads\":%u,\"async_threads\":%u,\"async_conns\":%u,\"concurrency\":%u,",
+             g_config.strInstance.c_str(), g_config.nThreadCnt, g_config.nAsyncThreadCnt, g_config.nAsyncConnCnt, g_config.nConcurrency);
+    string strJson = szBuf;
+    strJson += "\"blocking\":" + (bBlocking ? result_json(cBlocking) : string("null"));
+    strJson += ",\"async\":" + (bAsync ? result_json(cAsync) : string("null")) + "}";
+    fwrite(strJson.c_str(), 1, strJson.size(), fp);
+    fclose(fp);
+    printf("report written to %s\n", g_config.strOutput.c_str());
+    return 0;
+}
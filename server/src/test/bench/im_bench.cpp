@@ -0,0 +1,107 @@
+/*================================================================
+*   文件名称：im_bench.cpp
+*   描    述：msg_server压测工具, 不需要交互, 跑完输出报告后退出
+*
+*   例: ./im_bench -h 127.0.0.1 -p 8000 -u test -n 2000 -w 123456 -s single -r 5000 -d 60 -R 4 -o single.json
+*   注意: msg_server限制每个用户每秒最多发20条消息, -r要小于用户数*20
+*
+================================================================*/
+#include <unistd.h>
+#include "netlib.h"
+#include "BenchRunner.h"
+
+void print_help(const char* szName)
+{
+    printf("Usage: %s [options]\n", szName);
+    printf("  -h ip         msg_server ip, default 127.0.0.1\n");
+    printf("  -p port       msg_server port, default 8000\n");
+    printf("  -u prefix     user name prefix, user names are prefix+index, default test\n");
+    printf("  -b start      first user index, default 0\n");
+    printf("  -n count      user count, default 100\n");
+    printf("  -w password   password of all users, default 123456\n");
+    printf("  -s scenario   login|unread|single|group|history, default login\n");
+    printf("  -L rate       new connections per second, 0 means all at once, default 0\n");
+    printf("  -r rate       messages/requests per second of all users, default 1000\n");
+    printf("  -d seconds    duration of single/group/history, default 30\n");
+    printf("  -g group_id   group of the group scenario, fan-out is the group size\n");
+    printf("  -z bytes      message size, default 64\n");
+    printf("  -c count      messages per history request, default 20\n");
+    printf("  -R reactors   event loop threads, connections are spread round-robin, default 1\n");
+    printf("  -o file       write the report as json\n");
+}
+
+int main(int argc, char* argv[])
+{
+    BenchConfig_t config;
+    config.strIp = "127.0.0.1";
+    config.nPort = 8000;
+    config.strUserPrefix = "test";
+    config.nUserStart = 0;
+    config.nUserCnt = 100;
+    config.strPass = "123456";
+    config.nScenario = BENCH_SCENARIO_LOGIN;
+    config.nLoginRate = 0;
+    config.nRate = 1000;
+    config.nDuration = 30;
+    config.nGroupId = 0;
+    config.nPayloadSize = 64;
+    config.nHistoryCnt = 20;
+    uint32_t nReactorCnt = 1;
+    
+    int ch;
+    while ((ch = getopt(argc, argv, "h:p:u:b:n:w:s:L:r:d:g:z:c:R:o:")) != -1) {
+        switch (ch) {
+            case 'h': config.strIp = optarg; break;
+            case 'p': config.nPort = (uint16_t)atoi(optarg); break;
+            case 'u': config.strUserPrefix = optarg; break;
+            case 'b': config.nUserStart = atoi(optarg); break;
+            case 'n': config.nUserCnt = atoi(optarg); break;
+            case 'w': config.strPass = optarg; break;
+            case 's':
+                if(!CBenchRunner::parseScenario(optarg, config.nScenario))
+                {
+                    printf("unknown scenario: %s\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'L': config.nLoginRate = atoi(optarg); break;
+            case 'r': config.nRate = atoi(optarg); break;
+            case 'd': config.nDuration = atoi(optarg); break;
+            case 'g': config.nGroupId = atoi(optarg); break;
+            case 'z': config.nPayloadSize = atoi(optarg); break;
+            case 'c': config.nHistoryCnt = atoi(optarg); break;
+            case 'R': nReactorCnt = atoi(optarg); break;
+            case 'o': config.strOutput = optarg; break;
+            default:
+                print_help(argv[0]);
+                return -1;
+        }
+    }
+    
+    if(config.nUserCnt == 0 || nReactorCnt == 0)
+    {
+        print_help(argv[0]);
+        return -1;
+    }
+    if(config.nScenario == BENCH_SCENARIO_GROUP && config.nGroupId == 0)
+    {
+        printf("group scenario needs -g group_id\n");
+        return -1;
+    }
+    
+    signal(SIGPIPE, SIG_IGN);
+    
+    int ret = netlib_init();
+    if (ret == NETLIB_ERROR)
+        return ret;
+    
+    // 每个进程能打开的连接数受ulimit -n限制
+    netlib_init_reactors(nReactorCnt);
+    
+    if (CBenchRunner::getInstance()->start(config) != 0)
+        return -1;
+    
+    netlib_eventloop(10);
+    
+    return 0;
+}
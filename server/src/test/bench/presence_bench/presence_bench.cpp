@@ -0,0 +1,273 @@
+/*================================================================
+*   文件名称：presence_bench.cpp
+*   描    述：route_server在线状态表压测, 比较原来的hash_map<user_id, CUserInfo*>
+*             (每个用户一个set<CRouteConn*>和map<client_type, count>)和CPresenceTable:
+*             1. 每个在线用户占的内存(malloc统计的差值)
+*             2. msg_server重连时全量同步的耗时: 组包, 序列化, 解析, 写入在线状态表,
+*                逐项的ServerUserStat和差分编码的user_stat_data分别测
+*             3. 一个msg_server断开时清理它上面的用户的耗时, 以及按user_id查位置的速度
+*
+*   例: ./presence_bench -n 1000000 -s 20 -m 30
+*
+================================================================*/
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/time.h>
+#include <set>
+#include <map>
+#include "util.h"
+#include "PresenceTable.h"
+#include "UserStatCodec.h"
+#include "IM.Server.pb.h"
+using namespace IM::BaseDefine;
+
+typedef struct {
+    uint32_t    nUserCnt;
+    uint32_t    nServerCnt;
+    uint32_t    nMobilePercent;     // 同时有手机端在线的用户比例
+} PresenceBenchConfig_t;
+
+static PresenceBenchConfig_t g_config;
+
+// 原来route_server里CUserInfo的数据结构, 只保留用到的部分
+class CLegacyUserInfo
+{
+public:
+    set<uint32_t>                   m_server_set;
+    map<uint32_t, uint32_t>         m_client_type_map;
+};
+typedef hash_map<uint32_t, CLegacyUserInfo*> LegacyUserMap_t;
+
+static uint64_t now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint64_t heap_used()
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+// 每个msg_server上的在线用户列表, user_id有间隔, 和真实的自增id分布差不多
+static void make_server_user_list(vector<vector<user_stat_t> >& server_user_list)
+{
+    server_user_list.resize(g_config.nServerCnt);
+    uint32_t nSeed = 1;
+    uint32_t nUserId = 10000;
+    for (uint32_t i = 0; i < g_config.nUserCnt; i++) {
+        nUserId += 1 + rand_r(&nSeed) % 3;
+        user_stat_t stat;
+        stat.user_id = nUserId;
+        stat.status = USER_STATUS_ONLINE;
+        stat.client_type = (rand_r(&nSeed) % 2) ? CLIENT_TYPE_WINDOWS : CLIENT_TYPE_MAC;
+        server_user_list[rand_r(&nSeed) % g_config.nServerCnt].push_back(stat);
+
+        if ((uint32_t)(rand_r(&nSeed) % 100) < g_config.nMobilePercent) {
+            stat.client_type = (rand_r(&nSeed) % 2) ? CLIENT_TYPE_IOS : CLIENT_TYPE_ANDROID;
+            server_user_list[rand_r(&nSeed) % g_config.nServerCnt].push_back(stat);
+        }
+    }
+}
+
+static void legacy_add(LegacyUserMap_t& user_map, uint32_t nServer, const user_stat_t& stat)
+{
+    CLegacyUserInfo* pUser = NULL;
+    LegacyUserMap_t::iterator it = user_map.find(stat.user_id);
+    if (it == user_map.end()) {
+        pUser = new CLegacyUserInfo();
+        user_map.insert(make_pair(stat.user_id, pUser));
+    } else {
+        pUser = it->second;
+    }
+    pUser->m_server_set.insert(nServer);
+    pUser->m_client_type_map[stat.client_type] += 1;
+}
+
+static void legacy_remove_server(LegacyUserMap_t& user_map, uint32_t nServer)
+{
+    for (LegacyUserMap_t::iterator it = user_map.begin(); it != user_map.end(); ) {
+        LegacyUserMap_t::iterator it_old = it;
+        it++;
+
+        CLegacyUserInfo* pUser = it_old->second;
+        pUser->m_server_set.erase(nServer);
+        if (pUser->m_server_set.empty()) {
+            delete pUser;
+            user_map.erase(it_old);
+        }
+    }
+}
+
+typedef struct {
+    uint64_t    nBytes;             // 所有msg_server的同步包大小之和
+    uint64_t    nEncodeUs;          // msg_server: 组包+序列化
+    uint64_t    nApplyUs;           // route_server: 解析+写入
+} SyncResult_t;
+
+static void bench_legacy(vector<vector<user_stat_t> >& server_user_list)
+{
+    SyncResult_t result = {0, 0, 0};
+    LegacyUserMap_t* pUserMap = new LegacyUserMap_t;
+    uint64_t nHeapBefore = heap_used();
+
+    for (uint32_t i = 0; i < server_user_list.size(); i++) {
+        uint64_t nStart = now_us();
+        IM::Server::IMOnlineUserInfo msg;
+        vector<user_stat_t>& user_list = server_user_list[i];
+        for (vector<user_stat_t>::iterator it = user_list.begin(); it != user_list.end(); it++) {
+            ServerUserStat* server_user_stat = msg.add_user_stat_list();
+            server_user_stat->set_user_id(it->user_id);
+            server_user_stat->set_status((UserStatType)it->status);
+            server_user_stat->set_client_type((ClientType)it->client_type);
+        }
+        string strData;
+        msg.SerializeToString(&strData);
+        result.nEncodeUs += now_us() - nStart;
+        result.nBytes += strData.size();
+
+        nStart = now_us();
+        IM::Server::IMOnlineUserInfo msg2;
+        msg2.ParseFromString(strData);
+        for (int j = 0; j < msg2.user_stat_list_size(); j++) {
+            const ServerUserStat& server_user_stat = msg2.user_stat_list(j);
+            user_stat_t stat;
+            stat.user_id = server_user_stat.user_id();
+            stat.status = server_user_stat.status();
+            stat.client_type = server_user_stat.client_type();
+            legacy_add(*pUserMap, i, stat);
+        }
+        result.nApplyUs += now_us() - nStart;
+    }
+
+    uint64_t nHeapUsed = heap_used() - nHeapBefore;
+    uint32_t nOnlineCnt = pUserMap->size();
+
+    uint64_t nStart = now_us();
+    uint32_t nSeed = 2;
+    uint64_t nHit = 0;
+    for (uint32_t i = 0; i < g_config.nUserCnt; i++) {
+        LegacyUserMap_t::iterator it = pUserMap->find(10000 + rand_r(&nSeed) % (g_config.nUserCnt * 2));
+        if (it != pUserMap->end())
+            nHit += it->second->m_server_set.size();
+    }
+    uint64_t nLookupUs = now_us() - nStart;
+
+    nStart = now_us();
+    legacy_remove_server(*pUserMap, 0);
+    uint64_t nRemoveUs = now_us() - nStart;
+
+    printf("%-10s users=%u mem=%.1fMB bytes/user=%.1f sync_bytes=%.1fMB encode=%.1fms apply=%.1fms "
+           "lookup=%.1fns remove_server=%.1fms (hit=%llu)\n", "legacy", nOnlineCnt, nHeapUsed / 1048576.0,
+           (double)nHeapUsed / nOnlineCnt, result.nBytes / 1048576.0, result.nEncodeUs / 1000.0,
+           result.nApplyUs / 1000.0, nLookupUs * 1000.0 / g_config.nUserCnt, nRemoveUs / 1000.0,
+           (unsigned long long)nHit);
+
+    for (LegacyUserMap_t::iterator it = pUserMap->begin(); it != pUserMap->end(); it++) {
+        delete it->second;
+    }
+    delete pUserMap;
+}
+
+static void bench_presence(vector<vector<user_stat_t> >& server_user_list)
+{
+    SyncResult_t result = {0, 0, 0};
+    uint64_t nHeapBefore = heap_used();
+    CPresenceTable* pTable = new CPresenceTable();
+
+    for (uint32_t i = 0; i < server_user_list.size(); i++) {
+        uint64_t nStart = now_us();
+        vector<user_stat_t> user_list = server_user_list[i];
+        IM::Server::IMOnlineUserInfo msg;
+        encode_user_stat_list(user_list, *msg.mutable_user_stat_data());
+        string strData;
+        msg.SerializeToString(&strData);
+        result.nEncodeUs += now_us() - nStart;
+        result.nBytes += strData.size();
+
+        nStart = now_us();
+        IM::Server::IMOnlineUserInfo msg2;
+        msg2.ParseFromString(strData);
+        vector<user_stat_t> user_list2;
+        if (!decode_user_stat_list(msg2.user_stat_data(), user_list2)) {
+            printf("decode user_stat_data failed\n");
+            exit(1);
+        }
+        pTable->Reserve(user_list2.size());
+        for (vector<user_stat_t>::iterator it = user_list2.begin(); it != user_list2.end(); it++) {
+            pTable->AddClient(it->user_id, i, it->client_type);
+        }
+        result.nApplyUs += now_us() - nStart;
+    }
+
+    uint64_t nHeapUsed = heap_used() - nHeapBefore;
+    uint32_t nOnlineCnt = pTable->GetUserCount();
+
+    uint64_t nStart = now_us();
+    uint32_t nSeed = 2;
+    uint64_t nHit = 0;
+    for (uint32_t i = 0; i < g_config.nUserCnt; i++) {
+        nHit += __builtin_popcountll(pTable->GetServerMask(10000 + rand_r(&nSeed) % (g_config.nUserCnt * 2)));
+    }
+    uint64_t nLookupUs = now_us() - nStart;
+
+    nStart = now_us();
+    pTable->RemoveServer(0);
+    uint64_t nRemoveUs = now_us() - nStart;
+
+    printf("%-10s users=%u mem=%.1fMB bytes/user=%.1f sync_bytes=%.1fMB encode=%.1fms apply=%.1fms "
+           "lookup=%.1fns remove_server=%.1fms (hit=%llu)\n", "presence", nOnlineCnt, nHeapUsed / 1048576.0,
+           (double)nHeapUsed / nOnlineCnt, result.nBytes / 1048576.0, result.nEncodeUs / 1000.0,
+           result.nApplyUs / 1000.0, nLookupUs * 1000.0 / g_config.nUserCnt, nRemoveUs / 1000.0,
+           (unsigned long long)nHit);
+    printf("%-10s users_after_remove=%u table_mem=%.1fMB\n", "presence", pTable->GetUserCount(),
+           pTable->GetMemoryUsage() / 1048576.0);
+
+    delete pTable;
+}
+
+static void print_usage(const char* szName)
+{
+    printf("Usage: %s [options]\n", szName);
+    printf("  -n users      online users, default 1000000\n");
+    printf("  -s servers    msg_servers, default 20, at most %d\n", PRESENCE_MAX_SERVER);
+    printf("  -m percent    users that also have a mobile client online, default 30\n");
+}
+
+int main(int argc, char* argv[])
+{
+    g_config.nUserCnt = 1000000;
+    g_config.nServerCnt = 20;
+    g_config.nMobilePercent = 30;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "n:s:m:h")) != -1) {
+        switch (ch) {
+            case 'n':
+                g_config.nUserCnt = atoi(optarg);
+                break;
+            case 's':
+                g_config.nServerCnt = atoi(optarg);
+                break;
+            case 'm':
+                g_config.nMobilePercent = atoi(optarg);
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+    if (g_config.nUserCnt == 0 || g_config.nServerCnt == 0 || g_config.nServerCnt > PRESENCE_MAX_SERVER) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    vector<vector<user_stat_t> > server_user_list;
+    make_server_user_list(server_user_list);
+
+    bench_legacy(server_user_list);
+    bench_presence(server_user_list);
+    return 0;
+}
@@ -0,0 +1,831 @@
+/*================================================================
+*   文件名称：transfer_bench.cpp
+*   描    述：file_server离线文件分块传输的吞吐量压测, 在本机回环上模拟不同的RTT:
+*             进程内用netlib跑一个服务端(CImConn), 主线程是客户端, 请求方把每个请求推迟rtt再发出,
+*             相当于每一问一答多了一个RTT. 服务端有两种模式:
+*             old  原来的做法: 一问一答(窗口固定为1), 下载时new缓冲区+fread+拷进string+序列化再拷贝,
+*                  上传时按顺序fwrite+fflush
+*             new  窗口内的请求不等回应连续发出, 下载时包头之后用sendfile直接从文件发数据,
+*                  上传时回应按offset用pwrite写到文件里
+*             down 客户端向服务端拉取文件(离线下载), up 服务端向客户端拉取文件(离线上传)
+*
+*   例: ./transfer_bench -d /data/bench -s 64 -b 32768 -r 0,1,10,50 -w 1,4,16,64
+*       ./transfer_bench -d /data/bench -D up -m new -b 65536 -r 20 -w 32 -V
+*
+================================================================*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <deque>
+#include <vector>
+#include "netlib.h"
+#include "imconn.h"
+#include "UtilPdu.h"
+
+#define BENCH_SID                   0x7f
+#define CID_BENCH_PULL_REQ          1       // 包体: offset, size
+#define CID_BENCH_PULL_RSP          2       // 包体: offset, size, 数据
+#define CID_BENCH_UPLOAD_START      3
+#define CID_BENCH_UPLOAD_DONE       4
+#define BENCH_PULL_HEAD_LEN         8
+
+typedef struct {
+    string      strDir;
+    uint64_t    nFileSize;
+    uint32_t    nSegmentSize;
+    uint32_t    nTimeLimit;         // 每组最多跑多少秒, 慢的组合只统计这段时间里传完的数据
+    uint16_t    nPort;
+    bool        bVerify;
+    string      strRtts;            // 毫秒, 逗号分隔
+    string      strWindows;
+    string      strMode;            // old, new, both
+    string      strDirection;       // down, up, both
+} TransferBenchConfig_t;
+
+// 当前这一组的参数, 客户端连接之前设置好, 服务端线程只读
+typedef struct {
+    bool        bNewMode;
+    uint32_t    nWindow;
+    uint32_t    nSegmentCnt;
+    uint64_t    nRttUs;             // 客户端用
+} BenchCase_t;
+
+static TransferBenchConfig_t g_config;
+static BenchCase_t g_case;
+static string g_src_path;
+static string g_dst_path;
+static ConnMap_t g_bench_conn_map;
+
+static uint64_t now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint32_t segment_block_size(uint32_t idx)
+{
+    if (idx + 1 == g_case.nSegmentCnt)
+        return (uint32_t)(g_config.nFileSize - (uint64_t)idx * g_config.nSegmentSize);
+    return g_config.nSegmentSize;
+}
+
+static void write_pdu_header(uchar_t* buf, uint32_t len, uint16_t cid)
+{
+    CByteStream::WriteInt32(buf, len);
+    CByteStream::WriteUint16(buf + 4, IM_PDU_VERSION);
+    CByteStream::WriteUint16(buf + 6, 0);
+    CByteStream::WriteUint16(buf + 8, BENCH_SID);
+    CByteStream::WriteUint16(buf + 10, cid);
+    CByteStream::WriteUint16(buf + 12, 0);
+    CByteStream::WriteUint16(buf + 14, 0);
+}
+
+static bool pread_full(int fd, char* buf, uint32_t len, uint64_t offset)
+{
+    while (len > 0) {
+        ssize_t ret = pread(fd, buf, len, offset);
+        if (ret <= 0)
+            return false;
+        buf += ret;
+        len -= ret;
+        offset += ret;
+    }
+    return true;
+}
+
+//////////////////////////
+// 服务端, 相当于file_server的FileClientConn + OfflineTransferTask
+class CTransferBenchConn : public CImConn
+{
+public:
+    CTransferBenchConn();
+    virtual ~CTransferBenchConn();
+
+    virtual void OnConnect(net_handle_t handle);
+    virtual void OnClose();
+    virtual void HandlePdu(CImPdu* pPdu);
+private:
+    void _Close();
+    void _HandlePullReq(CImPdu* pPdu);
+    void _HandleUploadStart();
+    void _HandlePullRsp(CImPdu* pPdu);
+    void _SendPullReqs();
+
+    CSharedFile*    m_src_file;
+    int             m_dst_fd;
+    FILE*           m_dst_fp;
+    uint32_t        m_next_idx;
+    uint32_t        m_done_cnt;
+    vector<bool>    m_done_segments;
+};
+
+CTransferBenchConn::CTransferBenchConn()
+{
+    m_src_file = NULL;
+    m_dst_fd = -1;
+    m_dst_fp = NULL;
+    m_next_idx = 0;
+    m_done_cnt = 0;
+}
+
+CTransferBenchConn::~CTransferBenchConn()
+{
+    if (m_src_file)
+        m_src_file->ReleaseRef();
+    if (m_dst_fd != -1)
+        close(m_dst_fd);
+    if (m_dst_fp)
+        fclose(m_dst_fp);
+}
+
+void CTransferBenchConn::OnConnect(net_handle_t handle)
+{
+    m_handle = handle;
+    g_bench_conn_map.insert(make_pair(handle, this));
+    netlib_option(handle, NETLIB_OPT_SET_CALLBACK, (void*)imconn_callback);
+    netlib_option(handle, NETLIB_OPT_SET_CALLBACK_DATA, (void*)&g_bench_conn_map);
+
+    // 和FileClientConn一样
+    uint32_t socket_buf_size = NETLIB_MAX_SOCKET_BUF_SIZE;
+    netlib_option(handle, NETLIB_OPT_SET_SEND_BUF_SIZE, &socket_buf_size);
+    netlib_option(handle, NETLIB_OPT_SET_RECV_BUF_SIZE, &socket_buf_size);
+
+    int fd = open(g_src_path.c_str(), O_RDONLY);
+    if (fd != -1)
+        m_src_file = new CSharedFile(fd);
+}
+
+void CTransferBenchConn::OnClose()
+{
+    _Close();
+}
+
+void CTransferBenchConn::_Close()
+{
+    if (m_handle != NETLIB_INVALID_HANDLE) {
+        netlib_close(m_handle);
+        g_bench_conn_map.erase(m_handle);
+        m_handle = NETLIB_INVALID_HANDLE;
+        ReleaseRef();
+    }
+}
+
+void CTransferBenchConn::HandlePdu(CImPdu* pPdu)
+{
+    switch (pPdu->GetCommandId()) {
+        case CID_BENCH_PULL_REQ:
+            _HandlePullReq(pPdu);
+            break;
+        case CID_BENCH_UPLOAD_START:
+            _HandleUploadStart();
+            break;
+        case CID_BENCH_PULL_RSP:
+            _HandlePullRsp(pPdu);
+            break;
+        default:
+            break;
+    }
+}
+
+void CTransferBenchConn::_HandlePullReq(CImPdu* pPdu)
+{
+    if (pPdu->GetBodyLength() < BENCH_PULL_HEAD_LEN || !m_src_file) {
+        _Close();
+        return;
+    }
+    uint32_t offset = CByteStream::ReadUint32(pPdu->GetBodyData());
+    uint32_t idx = offset / g_config.nSegmentSize;
+    if (offset % g_config.nSegmentSize != 0 || idx >= g_case.nSegmentCnt) {
+        _Close();
+        return;
+    }
+    uint32_t size = segment_block_size(idx);
+    uint32_t head_len = IM_PDU_HEADER_LEN + BENCH_PULL_HEAD_LEN;
+
+    if (g_case.bNewMode) {
+        // 包头和offset/size放在一块小缓冲区里, 数据sendfile
+        CSharedBuffer* pHead = new CSharedBuffer(NULL, head_len);
+        write_pdu_header(pHead->GetBuffer(), head_len + size, CID_BENCH_PULL_RSP);
+        CByteStream::WriteUint32(pHead->GetBuffer() + IM_PDU_HEADER_LEN, offset);
+        CByteStream::WriteUint32(pHead->GetBuffer() + IM_PDU_HEADER_LEN + 4, size);
+        SendFile(pHead, m_src_file, offset, size);
+        pHead->ReleaseRef();
+        return;
+    }
+
+    // 原来的DoPullFileRequest: new一块缓冲区读文件, 再拷进pb的string
+    char* tmpbuf = new char[size];
+    if (!pread_full(m_src_file->GetFd(), tmpbuf, size, offset)) {
+        delete [] tmpbuf;
+        _Close();
+        return;
+    }
+    string data;
+    data.append(tmpbuf, size);
+    delete [] tmpbuf;
+
+    // 原来的SetPBMsg: 序列化到临时数组, 再写进CImPdu的缓冲区
+    uchar_t* msg = new uchar_t[BENCH_PULL_HEAD_LEN + size];
+    CByteStream::WriteUint32(msg, offset);
+    CByteStream::WriteUint32(msg + 4, size);
+    memcpy(msg + BENCH_PULL_HEAD_LEN, data.data(), size);
+    CSimpleBuffer buf;
+    buf.Write(NULL, IM_PDU_HEADER_LEN);
+    buf.Write(msg, BENCH_PULL_HEAD_LEN + size);
+    delete [] msg;
+    write_pdu_header(buf.GetBuffer(), buf.GetWriteOffset(), CID_BENCH_PULL_RSP);
+    Send(buf.GetBuffer(), buf.GetWriteOffset());
+}
+
+void CTransferBenchConn::_HandleUploadStart()
+{
+    if (g_case.bNewMode) {
+        m_dst_fd = open(g_dst_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    } else {
+        m_dst_fp = fopen(g_dst_path.c_str(), "wb");
+    }
+    if (m_dst_fd == -1 && !m_dst_fp) {
+        _Close();
+        return;
+    }
+    m_next_idx = 0;
+    m_done_cnt = 0;
+    m_done_segments.assign(g_case.nSegmentCnt, false);
+    _SendPullReqs();
+}
+
+void CTransferBenchConn::_SendPullReqs()
+{
+    // old模式窗口固定为1
+    uint32_t window = g_case.bNewMode ? g_case.nWindow : 1;
+    while (m_next_idx < g_case.nSegmentCnt && m_next_idx - m_done_cnt < window) {
+        uchar_t req[IM_PDU_HEADER_LEN + BENCH_PULL_HEAD_LEN];
+        write_pdu_header(req, sizeof(req), CID_BENCH_PULL_REQ);
+        CByteStream::WriteUint32(req + IM_PDU_HEADER_LEN, m_next_idx * g_config.nSegmentSize);
+        CByteStream::WriteUint32(req + IM_PDU_HEADER_LEN + 4, segment_block_size(m_next_idx));
+        Send(req, sizeof(req));
+        m_next_idx++;
+    }
+}
+
+void CTransferBenchConn::_HandlePullRsp(CImPdu* pPdu)
+{
+    if (pPdu->GetBodyLength() < BENCH_PULL_HEAD_LEN) {
+        _Close();
+        return;
+    }
+    uchar_t* body = pPdu->GetBodyData();
+    uint32_t offset = CByteStream::ReadUint32(body);
+    uint32_t size = pPdu->GetBodyLength() - BENCH_PULL_HEAD_LEN;
+    uint32_t idx = offset / g_config.nSegmentSize;
+    if (offset % g_config.nSegmentSize != 0 || idx >= m_next_idx || size != segment_block_size(idx)) {
+        _Close();
+        return;
+    }
+
+    if (g_case.bNewMode) {
+        if (!m_done_segments[idx]) {
+            if (pwrite(m_dst_fd, body + BENCH_PULL_HEAD_LEN, size, offset) != (ssize_t)size) {
+                _Close();
+                return;
+            }
+            m_done_segments[idx] = true;
+            m_done_cnt++;
+        }
+    } else {
+        // 原来的DoRecvData: 只接受下一块, 按顺序fwrite
+        if (idx != m_done_cnt) {
+            _Close();
+            return;
+        }
+        fwrite(body + BENCH_PULL_HEAD_LEN, 1, size, m_dst_fp);
+        fflush(m_dst_fp);
+        m_done_cnt++;
+    }
+
+    if (m_done_cnt == g_case.nSegmentCnt) {
+        if (m_dst_fd != -1) {
+            close(m_dst_fd);
+            m_dst_fd = -1;
+        }
+        if (m_dst_fp) {
+            fclose(m_dst_fp);
+            m_dst_fp = NULL;
+        }
+        uchar_t done[IM_PDU_HEADER_LEN];
+        write_pdu_header(done, sizeof(done), CID_BENCH_UPLOAD_DONE);
+        Send(done, sizeof(done));
+    } else {
+        _SendPullReqs();
+    }
+}
+
+static void bench_conn_callback(void* callback_data, uint8_t msg, uint32_t handle, void* pParam)
+{
+    if (msg == NETLIB_MSG_CONNECT) {
+        CTransferBenchConn* pConn = new CTransferBenchConn();
+        pConn->OnConnect(handle);
+    }
+}
+
+static void* server_thread(void* arg)
+{
+    netlib_eventloop(10);
+    return NULL;
+}
+
+//////////////////////////
+// 客户端, 阻塞socket发送, poll等待接收和延迟到期的请求
+typedef struct {
+    uint64_t    due;
+    uint32_t    offset;
+    uint32_t    size;
+} DelayedReq_t;
+
+typedef struct {
+    uint64_t    nBytes;
+    uint64_t    nElapsedUs;
+    bool        bComplete;
+    bool        bError;
+} CaseResult_t;
+
+class CBenchClient
+{
+public:
+    CBenchClient() : m_fd(-1), m_src_fd(-1), m_read_pos(0), m_read_len(0) {}
+    ~CBenchClient()
+    {
+        if (m_fd != -1)
+            close(m_fd);
+        if (m_src_fd != -1)
+            close(m_src_fd);
+    }
+
+    bool Connect();
+    void RunDownload(CaseResult_t* pResult);
+    void RunUpload(CaseResult_t* pResult);
+private:
+    bool _SendAll(const char* data, uint32_t len);
+    // 等到deadline或者有数据可读, 读到的完整数据包留在m_read_buf里
+    int _Wait(uint64_t deadline);
+    // 返回下一个完整数据包的长度, 没有返回0; 数据包在_PduData()
+    uint32_t _NextPdu();
+    uchar_t* _PduData() { return (uchar_t*)&m_read_buf[m_read_pos]; }
+    void _Consume(uint32_t len);
+
+    int             m_fd;
+    int             m_src_fd;
+    vector<char>    m_read_buf;
+    uint32_t        m_read_pos;
+    uint32_t        m_read_len;     // 从m_read_pos开始还没处理的字节数
+    vector<char>    m_data_buf;
+};
+
+bool CBenchClient::Connect()
+{
+    m_src_fd = open(g_src_path.c_str(), O_RDONLY);
+    m_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_src_fd == -1 || m_fd == -1)
+        return false;
+    int on = 1;
+    setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(g_config.nPort);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(m_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+        return false;
+
+    m_read_buf.resize(4 * (g_config.nSegmentSize + 1024));
+    m_data_buf.resize(IM_PDU_HEADER_LEN + BENCH_PULL_HEAD_LEN + g_config.nSegmentSize);
+    return true;
+}
+
+bool CBenchClient::_SendAll(const char* data, uint32_t len)
+{
+    while (len > 0) {
+        ssize_t ret = send(m_fd, data, len, MSG_NOSIGNAL);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        data += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+int CBenchClient::_Wait(uint64_t deadline)
+{
+    uint64_t now = now_us();
+    struct timespec ts;
+    uint64_t wait_us = (deadline > now) ? deadline - now : 0;
+    ts.tv_sec = wait_us / 1000000;
+    ts.tv_nsec = (wait_us % 1000000) * 1000;
+    struct pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    int ret = ppoll(&pfd, 1, &ts, NULL);
+    if (ret <= 0)
+        return ret;
+
+    // 处理过的数据包每次读之前一起挪走, 不用每个包memmove一次
+    if (m_read_pos > 0) {
+        if (m_read_len > 0)
+            memmove(&m_read_buf[0], &m_read_buf[m_read_pos], m_read_len);
+        m_read_pos = 0;
+    }
+    for (;;) {
+        if (m_read_len == m_read_buf.size())
+            m_read_buf.resize(m_read_buf.size() * 2);
+        ssize_t len = recv(m_fd, &m_read_buf[m_read_len], m_read_buf.size() - m_read_len, MSG_DONTWAIT);
+        if (len > 0) {
+            m_read_len += len;
+            continue;
+        }
+        if (len == 0 || (errno != EAGAIN && errno != EINTR))
+            return -1;
+        break;
+    }
+    return 1;
+}
+
+uint32_t CBenchClient::_NextPdu()
+{
+    if (m_read_len < IM_PDU_HEADER_LEN)
+        return 0;
+    uint32_t pdu_len = CByteStream::ReadUint32(_PduData());
+    return (pdu_len <= m_read_len) ? pdu_len : 0;
+}
+
+void CBenchClient::_Consume(uint32_t len)
+{
+    m_read_pos += len;
+    m_read_len -= len;
+}
+
+void CBenchClient::RunDownload(CaseResult_t* pResult)
+{
+    uint32_t window = g_case.bNewMode ? g_case.nWindow : 1;
+    uint64_t rtt_us = g_case.nRttUs;
+    uint64_t start = now_us();
+    uint64_t stop = start + (uint64_t)g_config.nTimeLimit * 1000000;
+
+    deque<DelayedReq_t> delay_queue;
+    uint32_t next_idx = 0;
+    uint32_t in_flight = 0;
+    uint32_t done_cnt = 0;
+    for (; next_idx < g_case.nSegmentCnt && next_idx < window; next_idx++) {
+        DelayedReq_t req = { start + rtt_us, next_idx * g_config.nSegmentSize, 0 };
+        delay_queue.push_back(req);
+    }
+
+    while (done_cnt < g_case.nSegmentCnt && !pResult->bError) {
+        uint64_t now = now_us();
+        if (now >= stop) {
+            // 超时后不再发新的请求, 已经发出去的收完
+            delay_queue.clear();
+            if (in_flight == 0)
+                break;
+        }
+        while (!delay_queue.empty() && delay_queue.front().due <= now) {
+            char req[IM_PDU_HEADER_LEN + BENCH_PULL_HEAD_LEN];
+            write_pdu_header((uchar_t*)req, sizeof(req), CID_BENCH_PULL_REQ);
+            CByteStream::WriteUint32((uchar_t*)req + IM_PDU_HEADER_LEN, delay_queue.front().offset);
+            CByteStream::WriteUint32((uchar_t*)req + IM_PDU_HEADER_LEN + 4, g_config.nSegmentSize);
+            if (!_SendAll(req, sizeof(req)))
+                pResult->bError = true;
+            delay_queue.pop_front();
+            in_flight++;
+        }
+
+        uint64_t deadline = delay_queue.empty() ? now + 100000 : delay_queue.front().due;
+        if (_Wait(deadline) < 0) {
+            pResult->bError = true;
+            break;
+        }
+
+        uint32_t pdu_len = 0;
+        while ((pdu_len = _NextPdu()) > 0) {
+            uchar_t* pdu = _PduData();
+            uint32_t offset = CByteStream::ReadUint32(pdu + IM_PDU_HEADER_LEN);
+            uint32_t size = CByteStream::ReadUint32(pdu + IM_PDU_HEADER_LEN + 4);
+            uint32_t idx = offset / g_config.nSegmentSize;
+            if (CByteStream::ReadUint16(pdu + 10) != CID_BENCH_PULL_RSP || idx >= g_case.nSegmentCnt ||
+                    size != segment_block_size(idx) || pdu_len != IM_PDU_HEADER_LEN + BENCH_PULL_HEAD_LEN + size) {
+                printf("bad response, offset=%u, size=%u, pdu_len=%u\n", offset, size, pdu_len);
+                pResult->bError = true;
+                break;
+            }
+            if (g_config.bVerify) {
+                char* data = &m_data_buf[0];
+                if (!pread_full(m_src_fd, data, size, offset) ||
+                        memcmp(data, pdu + IM_PDU_HEADER_LEN + BENCH_PULL_HEAD_LEN, size) != 0) {
+                    printf("data mismatch at offset %u\n", offset);
+                    pResult->bError = true;
+                    break;
+                }
+            }
+            _Consume(pdu_len);
+            in_flight--;
+            done_cnt++;
+            pResult->nBytes += size;
+
+            // 回应到了, 下一个请求一个RTT之后才到达服务端
+            if (next_idx < g_case.nSegmentCnt && now_us() < stop) {
+                DelayedReq_t req = { now_us() + rtt_us, next_idx * g_config.nSegmentSize, 0 };
+                delay_queue.push_back(req);
+                next_idx++;
+            }
+        }
+    }
+
+    pResult->nElapsedUs = now_us() - start;
+    pResult->bComplete = (done_cnt == g_case.nSegmentCnt);
+}
+
+void CBenchClient::RunUpload(CaseResult_t* pResult)
+{
+    uint64_t rtt_us = g_case.nRttUs;
+    uint64_t start = now_us();
+    uint64_t stop = start + (uint64_t)g_config.nTimeLimit * 1000000;
+
+    char start_pdu[IM_PDU_HEADER_LEN];
+    write_pdu_header((uchar_t*)start_pdu, sizeof(start_pdu), CID_BENCH_UPLOAD_START);
+    if (!_SendAll(start_pdu, sizeof(start_pdu))) {
+        pResult->bError = true;
+        return;
+    }
+
+    // 服务端的拉取请求一个RTT之后才到达客户端
+    deque<DelayedReq_t> delay_queue;
+    bool done = false;
+    while (!done && !pResult->bError && now_us() < stop) {
+        uint64_t now = now_us();
+        while (!delay_queue.empty() && delay_queue.front().due <= now) {
+            DelayedReq_t& req = delay_queue.front();
+            char* data = &m_data_buf[0];
+            uint32_t len = IM_PDU_HEADER_LEN + BENCH_PULL_HEAD_LEN + req.size;
+            write_pdu_header((uchar_t*)data, len, CID_BENCH_PULL_RSP);
+            CByteStream::WriteUint32((uchar_t*)data + IM_PDU_HEADER_LEN, req.offset);
+            CByteStream::WriteUint32((uchar_t*)data + IM_PDU_HEADER_LEN + 4, req.size);
+            if (!pread_full(m_src_fd, data + IM_PDU_HEADER_LEN + BENCH_PULL_HEAD_LEN, req.size, req.offset) ||
+                    !_SendAll(data, len)) {
+                pResult->bError = true;
+                break;
+            }
+            pResult->nBytes += req.size;
+            delay_queue.pop_front();
+        }
+
+        uint64_t deadline = delay_queue.empty() ? now + 100000 : delay_queue.front().due;
+        if (_Wait(deadline) < 0) {
+            pResult->bError = true;
+            break;
+        }
+
+        uint32_t pdu_len = 0;
+        while ((pdu_len = _NextPdu()) > 0) {
+            uchar_t* pdu = _PduData();
+            uint16_t cid = CByteStream::ReadUint16(pdu + 10);
+            if (cid == CID_BENCH_UPLOAD_DONE) {
+                done = true;
+            } else if (cid == CID_BENCH_PULL_REQ) {
+                DelayedReq_t req;
+                req.due = now_us() + rtt_us;
+                req.offset = CByteStream::ReadUint32(pdu + IM_PDU_HEADER_LEN);
+                req.size = CByteStream::ReadUint32(pdu + IM_PDU_HEADER_LEN + 4);
+                if (req.size > g_config.nSegmentSize) {
+                    pResult->bError = true;
+                    break;
+                }
+                delay_queue.push_back(req);
+            }
+            _Consume(pdu_len);
+        }
+    }
+
+    pResult->nElapsedUs = now_us() - start;
+    pResult->bComplete = done;
+}
+
+//////////////////////////
+static bool compare_files(const string& strPath1, const string& strPath2)
+{
+    int fd1 = open(strPath1.c_str(), O_RDONLY);
+    int fd2 = open(strPath2.c_str(), O_RDONLY);
+    bool same = (fd1 != -1 && fd2 != -1);
+    vector<char> buf1(1 << 20), buf2(1 << 20);
+    for (uint64_t offset = 0; same && offset < g_config.nFileSize; offset += buf1.size()) {
+        uint32_t len = (uint32_t)min((uint64_t)buf1.size(), g_config.nFileSize - offset);
+        same = pread_full(fd1, &buf1[0], len, offset) && pread_full(fd2, &buf2[0], len, offset) &&
+                memcmp(&buf1[0], &buf2[0], len) == 0;
+    }
+    struct stat st;
+    if (same && (fstat(fd2, &st) != 0 || (uint64_t)st.st_size != g_config.nFileSize))
+        same = false;
+    if (fd1 != -1)
+        close(fd1);
+    if (fd2 != -1)
+        close(fd2);
+    return same;
+}
+
+static int prepare_source()
+{
+    mkdir(g_config.strDir.c_str(), 0755);
+    g_src_path = g_config.strDir + "/transfer_src";
+    g_dst_path = g_config.strDir + "/transfer_dst";
+
+    struct stat st;
+    if (stat(g_src_path.c_str(), &st) == 0 && (uint64_t)st.st_size == g_config.nFileSize)
+        return 0;
+
+    int fd = open(g_src_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return -1;
+    vector<uint64_t> buf(1 << 17);
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+    for (uint64_t offset = 0; offset < g_config.nFileSize; offset += buf.size() * 8) {
+        for (size_t i = 0; i < buf.size(); i++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            buf[i] = x;
+        }
+        uint64_t len = min((uint64_t)buf.size() * 8, g_config.nFileSize - offset);
+        if (write(fd, &buf[0], len) != (ssize_t)len) {
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+static void split_list(const string& strList, vector<uint32_t>& list)
+{
+    CStrExplode items((char*)strList.c_str(), ',');
+    for (uint32_t i = 0; i < items.GetItemCnt(); i++)
+        list.push_back(atoi(items.GetItem(i)));
+}
+
+static void run_case(bool bUpload, bool bNewMode, uint32_t nRttMs, uint32_t nWindow)
+{
+    g_case.bNewMode = bNewMode;
+    g_case.nWindow = nWindow;
+    g_case.nSegmentCnt = (uint32_t)((g_config.nFileSize + g_config.nSegmentSize - 1) / g_config.nSegmentSize);
+    g_case.nRttUs = (uint64_t)nRttMs * 1000;
+
+    CaseResult_t result;
+    memset(&result, 0, sizeof(result));
+    {
+        CBenchClient client;
+        if (!client.Connect()) {
+            printf("connect to 127.0.0.1:%u failed\n", g_config.nPort);
+            exit(1);
+        }
+        if (bUpload)
+            client.RunUpload(&result);
+        else
+            client.RunDownload(&result);
+    }
+    // 等服务端处理完连接关闭
+    usleep(50000);
+
+    const char* szCheck = "";
+    if (g_config.bVerify && !result.bError) {
+        if (!bUpload)
+            szCheck = " verified";
+        else if (result.bComplete)
+            szCheck = compare_files(g_src_path, g_dst_path) ? " verified" : " MISMATCH";
+    }
+    double fSeconds = result.nElapsedUs / 1000000.0;
+    printf("%-4s %-3s rtt=%3ums window=%3u segment=%7u  %9.2f MB/s  %8.2f MB in %6.2fs%s%s%s\n",
+            bUpload ? "up" : "down", bNewMode ? "new" : "old", nRttMs, bNewMode ? nWindow : 1,
+            g_config.nSegmentSize, fSeconds > 0 ? result.nBytes / fSeconds / 1048576 : 0.0,
+            result.nBytes / 1048576.0, fSeconds, result.bComplete ? "" : " (time limit)",
+            result.bError ? " ERROR" : "", szCheck);
+    fflush(stdout);
+}
+
+static void print_usage(const char* szName)
+{
+    printf("Usage: %s [options]\n", szName);
+    printf("  -d dir        bench directory, default /tmp/transfer_bench\n");
+    printf("  -s size       file size in MB, default 64\n");
+    printf("  -b bytes      segment size, default 32768\n");
+    printf("  -r list       simulated RTTs in ms, default 0,1,10,50\n");
+    printf("  -w list       windows of the new mode, default 1,4,16,64\n");
+    printf("  -m mode       old, new or both, default both\n");
+    printf("  -D direction  down, up or both, default both\n");
+    printf("  -t seconds    time limit of each case, default 10\n");
+    printf("  -P port       local port of the bench server, default 18600\n");
+    printf("  -V            verify the transferred data\n");
+}
+
+int main(int argc, char* argv[])
+{
+    g_config.strDir = "/tmp/transfer_bench";
+    g_config.nFileSize = 64;
+    g_config.nSegmentSize = 32768;
+    g_config.nTimeLimit = 10;
+    g_config.nPort = 18600;
+    g_config.bVerify = false;
+    g_config.strRtts = "0,1,10,50";
+    g_config.strWindows = "1,4,16,64";
+    g_config.strMode = "both";
+    g_config.strDirection = "both";
+
+    int ch;
+    while ((ch = getopt(argc, argv, "d:s:b:r:w:m:D:t:P:Vh")) != -1) {
+        switch (ch) {
+            case 'd':
+                g_config.strDir = optarg;
+                break;
+            case 's':
+                g_config.nFileSize = atoll(optarg);
+                break;
+            case 'b':
+                g_config.nSegmentSize = atoi(optarg);
+                break;
+            case 'r':
+                g_config.strRtts = optarg;
+                break;
+            case 'w':
+                g_config.strWindows = optarg;
+                break;
+            case 'm':
+                g_config.strMode = optarg;
+                break;
+            case 'D':
+                g_config.strDirection = optarg;
+                break;
+            case 't':
+                g_config.nTimeLimit = atoi(optarg);
+                break;
+            case 'P':
+                g_config.nPort = atoi(optarg);
+                break;
+            case 'V':
+                g_config.bVerify = true;
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+    g_config.nFileSize *= 1024 * 1024;
+    if (g_config.nFileSize == 0 || g_config.nSegmentSize < 1024 || g_config.nSegmentSize > 16 * 1024 * 1024) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    if (prepare_source() != 0) {
+        printf("create %s failed\n", g_src_path.c_str());
+        return -1;
+    }
+
+    if (netlib_init() == NETLIB_ERROR || netlib_listen("127.0.0.1", g_config.nPort, bench_conn_callback, NULL) == NETLIB_ERROR) {
+        printf("listen on 127.0.0.1:%u failed\n", g_config.nPort);
+        return -1;
+    }
+    pthread_t tid;
+    pthread_create(&tid, NULL, server_thread, NULL);
+
+    vector<uint32_t> rtts, windows;
+    split_list(g_config.strRtts, rtts);
+    split_list(g_config.strWindows, windows);
+
+    printf("file=%lluMB segment=%u time_limit=%us\n", (unsigned long long)(g_config.nFileSize / 1048576), g_config.nSegmentSize,
+            g_config.nTimeLimit);
+    for (int up = 0; up <= 1; up++) {
+        if (g_config.strDirection != "both" && g_config.strDirection != (up ? "up" : "down"))
+            continue;
+        for (size_t i = 0; i < rtts.size(); i++) {
+            if (g_config.strMode != "new")
+                run_case(up, false, rtts[i], 1);
+            if (g_config.strMode == "old")
+                continue;
+            for (size_t j = 0; j < windows.size(); j++)
+                run_case(up, true, rtts[i], windows[j]);
+        }
+    }
+
+    unlink(g_dst_path.c_str());
+    return 0;
+}
@@ -0,0 +1,374 @@
+/*================================================================
+*   文件名称：volume_bench.cpp
+*   描    述：msfs两种存储方式的压测, 默认1000万个文件:
+*             file   原来的一个文件一个inode, 放在256x256的两级目录里, 写完fsync
+*             volume VolumeStore打包追加到卷文件, 每个needle写完fdatasync
+*             1. write: 写入速度, 占用的磁盘空间和inode个数
+*             2. load:  启动耗时, file为遍历所有目录(一致性检查/统计都要做), volume为加载索引文件,
+*                       以及索引占的内存
+*             3. read:  随机读, file为open+fstat+pread+close, volume为查内存索引+pread, 延迟分布(微秒)
+*             测冷缓存时分开跑各个阶段, 中间执行 echo 3 > /proc/sys/vm/drop_caches
+*
+*   例: ./volume_bench -d /data/bench -n 10000000 -s 8192 -p w
+*       ./volume_bench -d /data/bench -n 10000000 -s 8192 -p lr -r 1000000
+*       1000万个8K的文件两种方式一共要200G左右的磁盘, 放不下时减小-s, 或者用-m file/-m volume分开跑,
+*       跑完一种删掉目录再跑另一种
+*
+================================================================*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <malloc.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "VolumeStore.h"
+#include "LatencyHistogram.h"
+
+using namespace msfs;
+
+typedef struct {
+    string      strDir;
+    uint32_t    nFileCnt;
+    uint32_t    nAvgSize;       // 文件大小在[nAvgSize/2, nAvgSize*3/2]之间均匀分布
+    uint32_t    nReadCnt;
+    uint64_t    nVolumeSize;
+    string      strPhase;       // w:写 l:加载 r:读
+    string      strMode;        // file, volume, both
+} VolumeBenchConfig_t;
+
+static VolumeBenchConfig_t g_config;
+
+static uint64_t now_us()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static uint64_t heap_used()
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+static uint64_t mix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// 第i个文件的大小和digest都由i算出来, 读的时候不用保存
+static uint32_t file_size(uint32_t i)
+{
+    return g_config.nAvgSize / 2 + mix64(i) % (g_config.nAvgSize + 1);
+}
+
+static void file_digest(uint32_t i, u8* pDigest)
+{
+    for (uint32_t j = 0; j < VOLUME_DIGEST_SIZE / 8; j++) {
+        uint64_t x = mix64(((uint64_t)i << 2) | j);
+        memcpy(pDigest + j * 8, &x, 8);
+    }
+}
+
+static string file_path(uint32_t i)
+{
+    char szPath[64];
+    snprintf(szPath, sizeof(szPath), "/file/%03u/%03u/%u.png", i % 256, (i / 256) % 256, i);
+    return g_config.strDir + szPath;
+}
+
+static void print_progress(const char* szMode, const char* szPhase, uint32_t i, uint64_t nStart)
+{
+    if (i > 0 && i % 1000000 == 0) {
+        printf("%-6s %s %u files, %.0f files/s\n", szMode, szPhase, i, i * 1000000.0 / (now_us() - nStart));
+        fflush(stdout);
+    }
+}
+
+static void print_read(const char* szMode, const CLatencyHistogram& hist, uint64_t nUs, uint64_t nBytes)
+{
+    printf("%-6s read  reads=%llu %.0f reads/s %.1fMB/s latency(us): %s\n", szMode,
+           (unsigned long long)hist.getCount(), hist.getCount() * 1000000.0 / nUs,
+           nBytes / 1048576.0 * 1000000.0 / nUs, hist.toString().c_str());
+}
+
+// 源数据放在一个临时文件里, 卷的追加接口从fd读
+static int make_source(char* pBuf, uint32_t nLen)
+{
+    string strPath = g_config.strDir + "/source.tmp";
+    int fd = open(strPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0640);
+    if (fd == -1 || write(fd, pBuf, nLen) != (ssize_t)nLen) {
+        printf("create %s failed\n", strPath.c_str());
+        exit(1);
+    }
+    unlink(strPath.c_str());
+    return fd;
+}
+
+static void bench_file_write(const char* pBuf)
+{
+    char szDir[64];
+    mkdir((g_config.strDir + "/file").c_str(), 0750);
+    for (uint32_t i = 0; i < 256; i++) {
+        snprintf(szDir, sizeof(szDir), "/file/%03u", i);
+        mkdir((g_config.strDir + szDir).c_str(), 0750);
+        for (uint32_t j = 0; j < 256; j++) {
+            snprintf(szDir, sizeof(szDir), "/file/%03u/%03u", i, j);
+            mkdir((g_config.strDir + szDir).c_str(), 0750);
+        }
+    }
+
+    uint64_t nStart = now_us();
+    uint64_t nBytes = 0;
+    for (uint32_t i = 0; i < g_config.nFileCnt; i++) {
+        uint32_t nSize = file_size(i);
+        int fd = open(file_path(i).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0640);
+        if (fd == -1 || write(fd, pBuf, nSize) != (ssize_t)nSize || fsync(fd) != 0) {
+            printf("write %s failed\n", file_path(i).c_str());
+            exit(1);
+        }
+        close(fd);
+        nBytes += nSize;
+        print_progress("file", "write", i, nStart);
+    }
+    uint64_t nUs = now_us() - nStart;
+    printf("%-6s write files=%u bytes=%llu %.0f files/s %.1fMB/s\n", "file", g_config.nFileCnt,
+           (unsigned long long)nBytes, g_config.nFileCnt * 1000000.0 / nUs, nBytes / 1048576.0 * 1000000.0 / nUs);
+}
+
+static void bench_file_load()
+{
+    uint64_t nStart = now_us();
+    uint64_t nFiles = 0, nDiskBytes = 0;
+    char szDir[64];
+    for (uint32_t i = 0; i < 256; i++) {
+        for (uint32_t j = 0; j < 256; j++) {
+            snprintf(szDir, sizeof(szDir), "/file/%03u/%03u", i, j);
+            string strDir = g_config.strDir + szDir;
+            DIR* dp = opendir(strDir.c_str());
+            if (!dp)
+                continue;
+            struct dirent* ep = NULL;
+            while ((ep = readdir(dp)) != NULL) {
+                struct stat st;
+                if (ep->d_name[0] == '.' || stat((strDir + "/" + ep->d_name).c_str(), &st) != 0)
+                    continue;
+                nFiles++;
+                nDiskBytes += (uint64_t)st.st_blocks * 512;
+            }
+            closedir(dp);
+        }
+    }
+    printf("%-6s load  scan=%.1fms files=%llu inodes=%llu disk=%.1fMB\n", "file", (now_us() - nStart) / 1000.0,
+           (unsigned long long)nFiles, (unsigned long long)(nFiles + 256 * 257), nDiskBytes / 1048576.0);
+}
+
+static void bench_file_read(char* pBuf)
+{
+    CLatencyHistogram hist;
+    uint32_t nSeed = 1;
+    uint64_t nBytes = 0;
+    uint64_t nStart = now_us();
+    for (uint32_t n = 0; n < g_config.nReadCnt; n++) {
+        uint32_t i = rand_r(&nSeed) % g_config.nFileCnt;
+        uint64_t nBegin = now_us();
+        // 和msfs没有缓存时一样: 按路径打开, 取大小, 读, 关闭
+        int fd = open(file_path(i).c_str(), O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) != 0 || pread(fd, pBuf, st.st_size, 0) != st.st_size) {
+            printf("read %s failed\n", file_path(i).c_str());
+            exit(1);
+        }
+        close(fd);
+        hist.record(now_us() - nBegin);
+        nBytes += st.st_size;
+    }
+    print_read("file", hist, now_us() - nStart, nBytes);
+}
+
+static void bench_volume_write(VolumeStore& volumeStore, int nSourceFd)
+{
+    uint64_t nStart = now_us();
+    uint64_t nBytes = 0;
+    u8 digest[VOLUME_DIGEST_SIZE];
+    for (uint32_t i = 0; i < g_config.nFileCnt; i++) {
+        file_digest(i, digest);
+        uint32_t nSize = file_size(i);
+        if (volumeStore.append(digest, nSourceFd, nSize) < 0) {
+            printf("append %u failed\n", i);
+            exit(1);
+        }
+        nBytes += nSize;
+        print_progress("volume", "write", i, nStart);
+    }
+    uint64_t nUs = now_us() - nStart;
+    printf("%-6s write files=%u bytes=%llu %.0f files/s %.1fMB/s\n", "volume", g_config.nFileCnt,
+           (unsigned long long)nBytes, g_config.nFileCnt * 1000000.0 / nUs, nBytes / 1048576.0 * 1000000.0 / nUs);
+}
+
+static void bench_volume_stat(VolumeStore& volumeStore, uint64_t nLoadUs, uint64_t nHeapUsed)
+{
+    vector<volume_stat_t> list;
+    volumeStore.getVolumeStat(list);
+    uint64_t nDiskBytes = 0;
+    for (uint32_t i = 0; i < list.size(); i++) {
+        char szName[64];
+        snprintf(szName, sizeof(szName), "%s/%u", VOLUME_DIR, list[i].id);
+        struct stat st;
+        if (stat((g_config.strDir + szName + ".dat").c_str(), &st) == 0)
+            nDiskBytes += (uint64_t)st.st_blocks * 512;
+        if (stat((g_config.strDir + szName + ".idx").c_str(), &st) == 0)
+            nDiskBytes += (uint64_t)st.st_blocks * 512;
+    }
+    printf("%-6s load  index=%.1fms files=%llu volumes=%u inodes=%u disk=%.1fMB index_mem=%.1fMB bytes/file=%.1f\n",
+           "volume", nLoadUs / 1000.0, volumeStore.getNeedleCnt(), (uint32_t)list.size(),
+           (uint32_t)list.size() * 2 + 1, nDiskBytes / 1048576.0, nHeapUsed / 1048576.0,
+           volumeStore.getNeedleCnt() ? (double)nHeapUsed / volumeStore.getNeedleCnt() : 0.0);
+}
+
+static void bench_volume_read(VolumeStore& volumeStore, char* pBuf)
+{
+    CLatencyHistogram hist;
+    uint32_t nSeed = 1;
+    uint64_t nBytes = 0;
+    u8 digest[VOLUME_DIGEST_SIZE];
+    uint64_t nStart = now_us();
+    for (uint32_t n = 0; n < g_config.nReadCnt; n++) {
+        uint32_t i = rand_r(&nSeed) % g_config.nFileCnt;
+        file_digest(i, digest);
+        uint64_t nBegin = now_us();
+        needle_location_t loc;
+        if (volumeStore.lookup(digest, &loc) != 0 || pread(loc.fd, pBuf, loc.size, loc.offset) != loc.size) {
+            printf("read %u failed\n", i);
+            exit(1);
+        }
+        hist.record(now_us() - nBegin);
+        nBytes += loc.size;
+    }
+    print_read("volume", hist, now_us() - nStart, nBytes);
+}
+
+static VolumeStore* open_volume_store()
+{
+    VolumeStore* pVolumeStore = new VolumeStore();
+    if (pVolumeStore->init(g_config.strDir.c_str(), g_config.nVolumeSize) != 0) {
+        printf("init volume store in %s failed\n", g_config.strDir.c_str());
+        exit(1);
+    }
+    return pVolumeStore;
+}
+
+static void bench_volume(char* pBuf, uint32_t nBufLen)
+{
+    if (g_config.strPhase.find('w') != string::npos) {
+        VolumeStore* pVolumeStore = open_volume_store();
+        int fd = make_source(pBuf, nBufLen);
+        bench_volume_write(*pVolumeStore, fd);
+        close(fd);
+        delete pVolumeStore;
+    }
+    if (g_config.strPhase.find('l') == string::npos && g_config.strPhase.find('r') == string::npos)
+        return;
+
+    // 重新打开, 和msfs启动时一样只加载索引文件
+    uint64_t nHeapBefore = heap_used();
+    uint64_t nStart = now_us();
+    VolumeStore* pVolumeStore = open_volume_store();
+    uint64_t nLoadUs = now_us() - nStart;
+    uint64_t nHeapUsed = heap_used() - nHeapBefore;
+    if (g_config.strPhase.find('l') != string::npos)
+        bench_volume_stat(*pVolumeStore, nLoadUs, nHeapUsed);
+    if (g_config.strPhase.find('r') != string::npos && pVolumeStore->getNeedleCnt() > 0)
+        bench_volume_read(*pVolumeStore, pBuf);
+    delete pVolumeStore;
+}
+
+static void bench_file(char* pBuf)
+{
+    if (g_config.strPhase.find('w') != string::npos)
+        bench_file_write(pBuf);
+    if (g_config.strPhase.find('l') != string::npos)
+        bench_file_load();
+    if (g_config.strPhase.find('r') != string::npos)
+        bench_file_read(pBuf);
+}
+
+static void print_usage(const char* szName)
+{
+    printf("Usage: %s -d dir [options]\n", szName);
+    printf("  -d dir        bench directory, file layout in dir/file, volumes in dir%s\n", VOLUME_DIR);
+    printf("  -n files      files, default 10000000\n");
+    printf("  -s size       average file size in bytes, default 8192\n");
+    printf("  -r reads      random reads, default 1000000\n");
+    printf("  -S size       volume size in MB, default 4096\n");
+    printf("  -p phases     w(write) l(load) r(read), default wlr\n");
+    printf("  -m mode       file, volume or both, default both\n");
+}
+
+int main(int argc, char* argv[])
+{
+    g_config.nFileCnt = 10000000;
+    g_config.nAvgSize = 8192;
+    g_config.nReadCnt = 1000000;
+    g_config.nVolumeSize = 4096;
+    g_config.strPhase = "wlr";
+    g_config.strMode = "both";
+
+    int ch;
+    while ((ch = getopt(argc, argv, "d:n:s:r:S:p:m:h")) != -1) {
+        switch (ch) {
+            case 'd':
+                g_config.strDir = optarg;
+                break;
+            case 'n':
+                g_config.nFileCnt = atoi(optarg);
+                break;
+            case 's':
+                g_config.nAvgSize = atoi(optarg);
+                break;
+            case 'r':
+                g_config.nReadCnt = atoi(optarg);
+                break;
+            case 'S':
+                g_config.nVolumeSize = atoll(optarg);
+                break;
+            case 'p':
+                g_config.strPhase = optarg;
+                break;
+            case 'm':
+                g_config.strMode = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+    if (g_config.strDir.empty() || g_config.nFileCnt == 0 || g_config.nAvgSize < 2 || g_config.nVolumeSize == 0) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    g_config.nVolumeSize *= 1024 * 1024;
+    mkdir(g_config.strDir.c_str(), 0750);
+
+    uint32_t nBufLen = g_config.nAvgSize * 3 / 2 + 1;
+    char* pBuf = new char[nBufLen];
+    uint32_t nSeed = 1;
+    for (uint32_t i = 0; i < nBufLen; i++)
+        pBuf[i] = rand_r(&nSeed);
+
+    printf("files=%u avg_size=%u reads=%u phases=%s\n", g_config.nFileCnt, g_config.nAvgSize,
+           g_config.nReadCnt, g_config.strPhase.c_str());
+    if (g_config.strMode != "volume")
+        bench_file(pBuf);
+    if (g_config.strMode != "file")
+        bench_volume(pBuf, nBufLen);
+
+    delete [] pBuf;
+    return 0;
+}
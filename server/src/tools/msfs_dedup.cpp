@@ -0,0 +1,225 @@
+/*================================================================
+*   文件名称：msfs_dedup.cpp
+*   描    述：把msfs按目录存放的老文件迁移到按内容去重的存储(BaseDir/sha):
+*             1. 遍历 BaseDir/000~255/000~255 下的文件, 算SHA-256
+*             2. 第一次出现的内容硬链接成blob, 重复的内容逐字节确认后, 把老路径原子地换成blob的硬链接,
+*                老的url不用改, 重复的文件只占一份磁盘空间
+*             3. 重复执行是安全的, 已经是blob硬链接的文件会跳过
+*             要在msfs停止时执行; -n只统计能省多少空间, 不修改任何文件
+*
+*   例: ./msfs_dedup -d /data/msfs -n
+*
+================================================================*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+#include "BlobStore.h"
+#include "Sha256.h"
+
+using namespace msfs;
+
+#define HASH_BUF_SIZE	0x100000
+
+typedef struct {
+	u64		nFileCnt;
+	u64		nFileBytes;
+	u64		nNewCnt;		// 新建的blob
+	u64		nNewBytes;
+	u64		nDupCnt;		// 换成了blob硬链接的重复文件
+	u64		nDupBytes;
+	u64		nLinkedCnt;		// 之前已经迁移过的
+	u64		nCollisionCnt;
+	u64		nErrorCnt;
+} DedupStat_t;
+
+typedef struct {
+	char	digest[Sha256::DIGEST_SIZE];
+	u64		size;
+} DigestItem_t;
+
+static bool operator<(const DigestItem_t& a, const DigestItem_t& b)
+{
+	return memcmp(a.digest, b.digest, sizeof(a.digest)) < 0;
+}
+
+static bool operator==(const DigestItem_t& a, const DigestItem_t& b)
+{
+	return memcmp(a.digest, b.digest, sizeof(a.digest)) == 0;
+}
+
+static DedupStat_t g_stat;
+static vector<DigestItem_t> g_digest_list;	// -n时记下所有文件的digest, 最后排序去重
+static char* g_hash_buf = NULL;
+
+static int hash_file(const string& strPath, u64 nSize, u8* pDigest)
+{
+	int fd = open(strPath.c_str(), O_RDONLY);
+	if (fd == -1)
+		return -1;
+
+	Sha256 sha256;
+	u64 nOffset = 0;
+	while (nOffset < nSize) {
+		ssize_t ret = pread(fd, g_hash_buf, HASH_BUF_SIZE, nOffset);
+		if (ret <= 0)
+			break;
+		sha256.update(g_hash_buf, ret);
+		nOffset += ret;
+	}
+	close(fd);
+	if (nOffset != nSize)
+		return -1;
+	sha256.final(pDigest);
+	return 0;
+}
+
+static string to_hex(const u8* pDigest)
+{
+	char szHex[Sha256::DIGEST_SIZE * 2 + 1];
+	for (u32 i = 0; i < Sha256::DIGEST_SIZE; i++)
+		snprintf(szHex + i * 2, 3, "%02x", pDigest[i]);
+	return string(szHex, Sha256::DIGEST_SIZE * 2);
+}
+
+static void migrate_file(BlobStore& blobStore, const string& strPath, const struct stat& st, bool bDryRun)
+{
+	u8 digest[Sha256::DIGEST_SIZE];
+	if (hash_file(strPath, st.st_size, digest) != 0) {
+		printf("read %s failed: %s\n", strPath.c_str(), strerror(errno));
+		g_stat.nErrorCnt++;
+		return;
+	}
+	g_stat.nFileCnt++;
+	g_stat.nFileBytes += st.st_size;
+
+	if (bDryRun) {
+		DigestItem_t item;
+		memcpy(item.digest, digest, sizeof(item.digest));
+		item.size = st.st_size;
+		g_digest_list.push_back(item);
+		return;
+	}
+
+	string strDigest = to_hex(digest);
+	struct stat blobSt;
+	if (stat(blobStore.getBlobPath(strDigest).c_str(), &blobSt) == 0 && blobSt.st_ino == st.st_ino
+			&& blobSt.st_dev == st.st_dev) {
+		g_stat.nLinkedCnt++;
+		return;
+	}
+
+	switch (blobStore.store(strPath, strDigest, st.st_size, true)) {
+	case BLOB_NEW:
+		g_stat.nNewCnt++;
+		g_stat.nNewBytes += st.st_size;
+		break;
+	case BLOB_DUPLICATE:
+		g_stat.nDupCnt++;
+		g_stat.nDupBytes += st.st_size;
+		break;
+	case BLOB_COLLISION:
+		printf("digest collision, keep %s\n", strPath.c_str());
+		g_stat.nCollisionCnt++;
+		break;
+	default:
+		printf("store %s failed\n", strPath.c_str());
+		g_stat.nErrorCnt++;
+		break;
+	}
+}
+
+static void migrate_dir(BlobStore& blobStore, const string& strDir, bool bDryRun)
+{
+	DIR* dp = opendir(strDir.c_str());
+	if (!dp)
+		return;
+
+	struct dirent* ep = NULL;
+	while ((ep = readdir(dp)) != NULL) {
+		if (ep->d_name[0] == '.')
+			continue;
+		string strPath = strDir + "/" + ep->d_name;
+		struct stat st;
+		if (lstat(strPath.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		migrate_file(blobStore, strPath, st, bDryRun);
+	}
+	closedir(dp);
+}
+
+static void print_usage(const char* szName)
+{
+	printf("Usage: %s -d BaseDir [-n]\n", szName);
+	printf("  -d dir    msfs BaseDir\n");
+	printf("  -n        dry run, only report how much space dedup would save\n");
+}
+
+int main(int argc, char* argv[])
+{
+	const char* szBaseDir = NULL;
+	bool bDryRun = false;
+
+	int ch;
+	while ((ch = getopt(argc, argv, "d:nh")) != -1) {
+		switch (ch) {
+			case 'd':
+				szBaseDir = optarg;
+				break;
+			case 'n':
+				bDryRun = true;
+				break;
+			default:
+				print_usage(argv[0]);
+				return -1;
+		}
+	}
+	if (!szBaseDir) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	BlobStore blobStore;
+	if (!bDryRun && blobStore.init(szBaseDir) != 0) {
+		printf("init blob store in %s failed\n", szBaseDir);
+		return -1;
+	}
+	g_hash_buf = new char[HASH_BUF_SIZE];
+
+	char szFirst[8], szSecond[8];
+	for (int i = 0; i <= 255; i++) {
+		snprintf(szFirst, sizeof(szFirst), "/%03d", i);
+		for (int j = 0; j <= 255; j++) {
+			snprintf(szSecond, sizeof(szSecond), "/%03d", j);
+			migrate_dir(blobStore, string(szBaseDir) + szFirst + szSecond, bDryRun);
+		}
+		if ((i + 1) % 16 == 0)
+			printf("scanned %d/256 dirs, files=%llu\n", i + 1, g_stat.nFileCnt);
+	}
+
+	if (bDryRun) {
+		sort(g_digest_list.begin(), g_digest_list.end());
+		vector<DigestItem_t>::iterator it = unique(g_digest_list.begin(), g_digest_list.end());
+		u64 nUniqueBytes = 0;
+		for (vector<DigestItem_t>::iterator it2 = g_digest_list.begin(); it2 != it; it2++)
+			nUniqueBytes += it2->size;
+		printf("files=%llu bytes=%llu unique_files=%llu unique_bytes=%llu dedup_ratio=%.3f\n",
+				g_stat.nFileCnt, g_stat.nFileBytes, (u64)(it - g_digest_list.begin()), nUniqueBytes,
+				nUniqueBytes ? (double)g_stat.nFileBytes / nUniqueBytes : 1.0);
+	} else {
+		u64 nStoredBytes = g_stat.nFileBytes - g_stat.nDupBytes;
+		printf("files=%llu bytes=%llu new_blobs=%llu duplicates=%llu saved_bytes=%llu already_linked=%llu "
+				"collisions=%llu errors=%llu dedup_ratio=%.3f\n", g_stat.nFileCnt, g_stat.nFileBytes,
+				g_stat.nNewCnt, g_stat.nDupCnt, g_stat.nDupBytes, g_stat.nLinkedCnt, g_stat.nCollisionCnt,
+				g_stat.nErrorCnt, nStoredBytes ? (double)g_stat.nFileBytes / nStoredBytes : 1.0);
+	}
+
+	delete [] g_hash_buf;
+	return (g_stat.nErrorCnt == 0) ? 0 : 1;
+}
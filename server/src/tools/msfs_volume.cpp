@@ -0,0 +1,207 @@
+/*================================================================
+*   文件名称：msfs_volume.cpp
+*   描    述：msfs小文件打包存储(BaseDir/vol)的维护工具, 要在msfs停止时执行:
+*             -s  每个卷的大小、有效数据和needle个数(默认)
+*             -m  把BaseDir/sha下单独存的blob追加到卷里, 再删掉单独的文件;
+*                 还和老路径硬链接在一起的blob(msfs_dedup迁移的)不动, 删了也不省空间
+*             -r  blob的引用计数减1, 减到0时删除: 卷里的空间等compact时回收, 单独存的文件直接删掉
+*             -c  无效数据比例超过ratio的卷, 把有效的needle拷到新卷后删掉旧卷
+*
+*   例: ./msfs_volume -d /data/msfs -m
+*       ./msfs_volume -d /data/msfs -c 0.3
+*
+================================================================*/
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <vector>
+#include "BlobStore.h"
+#include "VolumeStore.h"
+
+using namespace msfs;
+
+#define DEFAULT_VOLUME_SIZE		4096	// MB, 和msfs.conf的VolumeSize一致
+
+typedef struct {
+	u64		nBlobCnt;
+	u64		nMovedCnt;
+	u64		nMovedBytes;
+	u64		nLinkedCnt;		// 还有老路径硬链接的blob
+	u64		nErrorCnt;
+} MigrateStat_t;
+
+static MigrateStat_t g_stat;
+
+static void print_stat(VolumeStore& volumeStore)
+{
+	vector<volume_stat_t> list;
+	volumeStore.getVolumeStat(list);
+	u64 nDataBytes = 0, nLiveBytes = 0;
+	for (u32 i = 0; i < list.size(); i++) {
+		printf("volume %u: needles=%llu size=%llu live=%llu garbage=%.1f%%\n", list[i].id, list[i].needleCnt,
+				list[i].dataBytes, list[i].liveBytes, list[i].dataBytes ?
+				(double)(list[i].dataBytes - list[i].liveBytes) * 100 / list[i].dataBytes : 0.0);
+		nDataBytes += list[i].dataBytes;
+		nLiveBytes += list[i].liveBytes;
+	}
+	printf("volumes=%u needles=%llu size=%llu live=%llu\n", (u32)list.size(), volumeStore.getNeedleCnt(),
+			nDataBytes, nLiveBytes);
+}
+
+static void migrate_blob(BlobStore& blobStore, VolumeStore& volumeStore, const string& strDir, const char* szName)
+{
+	u32 nLen = strlen(szName);
+	if (nLen != BLOB_DIGEST_LEN || !BlobStore::isDigest(szName, nLen))
+		return;
+	string strDigest(szName);
+	string strPath = strDir + "/" + strDigest;
+	struct stat st;
+	if (lstat(strPath.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+		return;
+	g_stat.nBlobCnt++;
+	if (st.st_nlink > 1) {
+		g_stat.nLinkedCnt++;
+		return;
+	}
+
+	int nRefCount = blobStore.getRefCount(strDigest);
+	int fd = open(strPath.c_str(), O_RDONLY);
+	if (fd == -1 || (u64)st.st_size > 0xffffffffULL) {
+		printf("open %s failed: %s\n", strPath.c_str(), strerror(errno));
+		g_stat.nErrorCnt++;
+		if (fd != -1)
+			close(fd);
+		return;
+	}
+	u8 digest[VOLUME_DIGEST_SIZE];
+	BlobStore::toBinary(strDigest, digest);
+	int ret = volumeStore.append(digest, fd, (u32)st.st_size, nRefCount > 0 ? nRefCount : 1);
+	close(fd);
+	if (ret != 0) {
+		// 前8字节冲突的留着单独存
+		printf("append %s %s\n", strPath.c_str(), ret > 0 ? "conflict, keep it" : "failed");
+		if (ret < 0)
+			g_stat.nErrorCnt++;
+		return;
+	}
+	unlink((strPath + ".ref").c_str());
+	unlink(strPath.c_str());
+	g_stat.nMovedCnt++;
+	g_stat.nMovedBytes += st.st_size;
+}
+
+static void migrate(BlobStore& blobStore, VolumeStore& volumeStore, const string& strBaseDir)
+{
+	char szSub[16];
+	for (int i = 0; i <= 255; i++) {
+		for (int j = 0; j <= 255; j++) {
+			snprintf(szSub, sizeof(szSub), "/%02x/%02x", i, j);
+			string strDir = strBaseDir + BLOB_DIR + szSub;
+			DIR* dp = opendir(strDir.c_str());
+			if (!dp)
+				continue;
+			struct dirent* ep = NULL;
+			while ((ep = readdir(dp)) != NULL)
+				migrate_blob(blobStore, volumeStore, strDir, ep->d_name);
+			closedir(dp);
+		}
+		if ((i + 1) % 16 == 0)
+			printf("scanned %d/256 dirs, blobs=%llu\n", i + 1, g_stat.nBlobCnt);
+	}
+	printf("blobs=%llu moved=%llu moved_bytes=%llu linked=%llu errors=%llu\n", g_stat.nBlobCnt,
+			g_stat.nMovedCnt, g_stat.nMovedBytes, g_stat.nLinkedCnt, g_stat.nErrorCnt);
+}
+
+static void print_usage(const char* szName)
+{
+	printf("Usage: %s -d BaseDir [-S VolumeSize] [-s | -m | -r digest | -c ratio]\n", szName);
+	printf("  -d dir       msfs BaseDir\n");
+	printf("  -S size      volume size(MB) for new volumes, default %d\n", DEFAULT_VOLUME_SIZE);
+	printf("  -s           print volume stat\n");
+	printf("  -m           move blobs in BaseDir/sha into volumes\n");
+	printf("  -r digest    release one reference of a blob\n");
+	printf("  -c ratio     compact volumes whose garbage ratio is above ratio(0~1)\n");
+}
+
+int main(int argc, char* argv[])
+{
+	const char* szBaseDir = NULL;
+	const char* szDigest = NULL;
+	u64 nVolumeSize = DEFAULT_VOLUME_SIZE;
+	double fRatio = -1;
+	bool bMigrate = false;
+
+	int ch;
+	while ((ch = getopt(argc, argv, "d:S:smr:c:h")) != -1) {
+		switch (ch) {
+			case 'd':
+				szBaseDir = optarg;
+				break;
+			case 'S':
+				nVolumeSize = atoll(optarg);
+				break;
+			case 's':
+				break;
+			case 'm':
+				bMigrate = true;
+				break;
+			case 'r':
+				szDigest = optarg;
+				break;
+			case 'c':
+				fRatio = atof(optarg);
+				break;
+			default:
+				print_usage(argv[0]);
+				return -1;
+		}
+	}
+	if (!szBaseDir || nVolumeSize == 0) {
+		print_usage(argv[0]);
+		return -1;
+	}
+
+	BlobStore blobStore;
+	VolumeStore volumeStore;
+	if (blobStore.init(szBaseDir) != 0 || volumeStore.init(szBaseDir, nVolumeSize * 1024 * 1024) != 0) {
+		printf("init volume store in %s failed\n", szBaseDir);
+		return -1;
+	}
+	blobStore.setVolumeStore(&volumeStore);
+
+	int ret = 0;
+	if (bMigrate) {
+		migrate(blobStore, volumeStore, szBaseDir);
+		ret = (g_stat.nErrorCnt == 0) ? 0 : 1;
+	}
+	if (szDigest) {
+		u32 nLen = strlen(szDigest);
+		if (nLen != BLOB_DIGEST_LEN || !BlobStore::isDigest(szDigest, nLen)) {
+			printf("invalid digest %s\n", szDigest);
+			return -1;
+		}
+		int nRefCount = blobStore.release(szDigest);
+		if (nRefCount < 0) {
+			printf("%s not found\n", szDigest);
+			ret = 1;
+		} else {
+			printf("%s ref_count=%d%s\n", szDigest, nRefCount, nRefCount == 0 ? ", deleted" : "");
+		}
+	}
+	if (fRatio >= 0) {
+		s64 nReclaimed = volumeStore.compact(fRatio);
+		if (nReclaimed < 0) {
+			printf("compact failed\n");
+			ret = 1;
+		} else {
+			printf("compact done, reclaimed=%lld\n", nReclaimed);
+		}
+	}
+	print_stat(volumeStore);
+	return ret;
+}